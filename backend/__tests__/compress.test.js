@@ -0,0 +1,69 @@
+const fs = require('fs-extra');
+const { PDFDocument, StandardFonts } = require('pdf-lib');
+
+// Every run has to reach the compressor
+process.env.ZELL_RESULT_CACHE = '0';
+const app = require('../server');
+
+/**
+ * /api/compress on a PDF
+ */
+describe('POST /api/compress', () => {
+  let server;
+  let baseUrl;
+
+  beforeAll((done) => {
+    server = app.listen(0, () => {
+      baseUrl = `http://127.0.0.1:${server.address().port}`;
+      done();
+    });
+  });
+
+  afterAll((done) => {
+    server.close(done);
+  });
+
+  /**
+   * A PDF written without object streams, as many producers do
+   * @returns {Promise<Buffer>} PDF data
+   */
+  async function makePdf() {
+    const pdfDoc = await PDFDocument.create();
+    const font = await pdfDoc.embedFont(StandardFonts.Helvetica);
+    for (let i = 0; i < 40; i++) {
+      const page = pdfDoc.addPage();
+      for (let line = 0; line < 40; line++) {
+        page.drawText(`Page ${i + 1}, line ${line + 1}: the quick brown fox jumps over the lazy dog`, {
+          x: 40,
+          y: 760 - line * 18,
+          size: 11,
+          font,
+        });
+      }
+    }
+    return Buffer.from(await pdfDoc.save({ useObjectStreams: false }));
+  }
+
+  it('returns a smaller PDF', async () => {
+    const input = await makePdf();
+    const form = new FormData();
+    form.append('file', new Blob([input], { type: 'application/pdf' }), 'report.pdf');
+    form.append('compressionLevel', 'medium');
+
+    const response = await fetch(`${baseUrl}/api/compress`, { method: 'POST', body: form });
+    const body = await response.json();
+
+    expect(response.status).toBe(200);
+    expect(body.success).toBe(true);
+    expect(body.fileName).toBe('report_compressed.pdf');
+
+    const output = await fs.readFile(body.outputPath);
+    await fs.remove(body.outputPath);
+    expect(output.subarray(0, 5).toString('latin1')).toBe('%PDF-');
+    expect(output.length).toBeLessThan(input.length);
+    expect(body.compressedSize).toBe(output.length);
+
+    const compressed = await PDFDocument.load(output);
+    expect(compressed.getPageCount()).toBe(40);
+  });
+});
@@ -2,6 +2,34 @@ const archiver = require('archiver');
 const unzipper = require('unzipper');
 const fs = require('fs-extra');
 const path = require('path');
+const zlib = require('zlib');
+const { pipeline } = require('stream/promises');
+const {
+  POINTER_SIZE, loadWasmModule, copyToHeap, copyFromHeap, setPointer, writeOutputFile, withFileSource, saveTrace,
+} = require('../lib/wasmModules');
+
+// Formats the native writer produces; 'tar' is gzip-compressed like archiver's
+const NATIVE_FORMATS = { zip: 0, tar: 1, tzst: 2, tbr: 3 };
+
+// Codec of each archive format
+const FORMAT_CODECS = { zip: 'gzip', tar: 'gzip', tzst: 'zstd', tbr: 'brotli' };
+
+// Codecs of the native module, with the extension of a file compressed whole
+const CODECS = { gzip: 0, zstd: 1, brotli: 2 };
+const CODEC_EXTENSIONS = { gzip: 'gz', zstd: 'zst', brotli: 'br' };
+
+// Level of each codec for low, medium and high
+const CODEC_LEVELS = {
+  gzip: { low: 1, medium: 6, high: 9 },
+  zstd: { low: 1, medium: 6, high: 19 },
+  brotli: { low: 4, medium: 6, high: 9 }
+};
+
+// Slowest speed (MB/s of input) the auto mode accepts for low, medium and high
+const AUTO_TARGET_SPEEDS = { low: 200, medium: 40, high: 5 };
+
+// Largest total input handed to the native writer
+const NATIVE_ARCHIVE_LIMIT = 2 * 1024 * 1024 * 1024;
 
 /**
  * Archive converter module for ZELL
@@ -123,9 +151,132 @@ class ArchiveConverter {
    * @returns {Promise} Archive creation promise
    */
   async createArchive(inputDir, outputPath, format, compressionLevel) {
+    const files = await this.listFiles(inputDir);
+    return this.writeArchive(files, outputPath, format, compressionLevel);
+  }
+
+  /**
+   * Files under a directory, with their paths relative to it
+   * @param {string} inputDir - Directory to walk
+   * @param {string} prefix - Archive path of the directory
+   * @returns {Promise<Array>} Entries with path and name
+   */
+  async listFiles(inputDir, prefix = '') {
+    const files = [];
+    const entries = await fs.readdir(inputDir, { withFileTypes: true });
+    for (const entry of entries) {
+      const filePath = path.join(inputDir, entry.name);
+      const name = prefix + entry.name;
+      if (entry.isDirectory()) {
+        files.push(...await this.listFiles(filePath, `${name}/`));
+      } else if (entry.isFile()) {
+        files.push({ path: filePath, name });
+      }
+    }
+    return files;
+  }
+
+  /**
+   * Write an archive of files, with the native writer when it is built
+   * @param {Array} files - Entries with path and name
+   * @param {string} outputPath - Path for output archive
+   * @param {string} format - Archive format
+   * @param {string} compressionLevel - Compression level
+   * @returns {Promise} Archive creation promise
+   */
+  async writeArchive(files, outputPath, format, compressionLevel) {
+    if (!(format.toLowerCase() in NATIVE_FORMATS)) {
+      throw new Error(`Archive format ${format} not supported`);
+    }
+    if (await this.createArchiveNative(files, outputPath, format, compressionLevel)) {
+      return { outputPath };
+    }
+    return this.createArchiveWithArchiver(files, outputPath, format, compressionLevel);
+  }
+
+  /**
+   * Whether the native module was built with a codec
+   * @param {Object} wasm - Archive module
+   * @param {string} codec - gzip, zstd or brotli
+   * @returns {boolean} True when it can write the codec
+   */
+  hasNativeCodec(wasm, codec) {
+    return Boolean(wasm) && typeof wasm._compress_codec_available === 'function' &&
+      wasm._compress_codec_available(CODECS[codec]) === 1;
+  }
+
+  /**
+   * Write an archive with the native module: blocks are deflated on all
+   * cores and already-compressed media is stored as it is
+   * @param {Array} files - Entries with path and name
+   * @param {string} outputPath - Path for output archive
+   * @param {string} format - Archive format (zip or tar)
+   * @param {string} compressionLevel - Compression level
+   * @returns {Promise<boolean>} False when the module is unavailable or fails
+   */
+  async createArchiveNative(files, outputPath, format, compressionLevel) {
+    const wasm = await loadWasmModule('archive-processor');
+    const codec = FORMAT_CODECS[format.toLowerCase()];
+    if (!wasm || !this.hasNativeCodec(wasm, codec)) {
+      return false;
+    }
+    // Inputs go through module memory, which is limited to 4GB
+    const stats = await Promise.all(files.map((file) => fs.stat(file.path)));
+    if (stats.reduce((sum, stat) => sum + stat.size, 0) > NATIVE_ARCHIVE_LIMIT) {
+      return false;
+    }
+
+    const table = wasm._malloc(files.length * POINTER_SIZE);
+    const names = wasm._malloc(files.length * POINTER_SIZE);
+    const sizes = wasm._malloc(files.length * 8);
+    const pointers = [];
+
+    try {
+      if (!table || !names || !sizes) {
+        return false;
+      }
+      for (let i = 0; i < files.length; i++) {
+        const content = await fs.readFile(files[i].path);
+        const pointer = copyToHeap(wasm, content);
+        const name = copyToHeap(wasm, Buffer.from(`${files[i].name}\0`, 'utf8'));
+        pointers.push(pointer, name);
+        if (!pointer || !name) {
+          return false;
+        }
+        // Views are re-read after every allocation since memory may have grown
+        setPointer(wasm, table, i, pointer);
+        setPointer(wasm, names, i, name);
+        wasm.HEAP64[sizes / 8 + i] = BigInt(content.length);
+      }
+
+      const size = writeOutputFile(wasm, outputPath, (writeAt) =>
+        wasm._create_archive_sink(table, sizes, names, files.length, writeAt, 0,
+          NATIVE_FORMATS[format.toLowerCase()], this.getCompressionLevel(compressionLevel, codec), 0)
+      );
+      return size >= 0;
+    } finally {
+      pointers.forEach((pointer) => wasm._free(pointer));
+      wasm._free(sizes);
+      wasm._free(names);
+      wasm._free(table);
+      saveTrace(wasm, 'create_archive');
+    }
+  }
+
+  /**
+   * Write an archive with archiver, on one zlib stream; Zstandard and Brotli
+   * tarballs go through Node's own compressors
+   * @param {Array} files - Entries with path and name
+   * @param {string} outputPath - Path for output archive
+   * @param {string} format - Archive format
+   * @param {string} compressionLevel - Compression level
+   * @returns {Promise} Archive creation promise
+   */
+  async createArchiveWithArchiver(files, outputPath, format, compressionLevel) {
     return new Promise((resolve, reject) => {
       const output = fs.createWriteStream(outputPath);
       let archive;
+      let target = output;
 
       // Create archive based on format
       switch (format.toLowerCase()) {
@@ -140,6 +291,22 @@ class ArchiveConverter {
             gzipOptions: { level: this.getCompressionLevel(compressionLevel) }
           });
           break;
+        case 'tzst':
+        case 'tbr': {
+          const codec = FORMAT_CODECS[format.toLowerCase()];
+          let compressor;
+          try {
+            compressor = this.createCompressor(codec, this.getCompressionLevel(compressionLevel, codec));
+          } catch (error) {
+            reject(error);
+            return;
+          }
+          archive = archiver('tar');
+          compressor.on('error', (error) => reject(new Error(`Archive creation failed: ${error.message}`)));
+          compressor.pipe(output);
+          target = compressor;
+          break;
+        }
         default:
           reject(new Error(`Archive format ${format} not supported`));
           return;
@@ -153,8 +320,8 @@ class ArchiveConverter {
         reject(new Error(`Archive creation failed: ${error.message}`));
       });
 
-      archive.pipe(output);
-      archive.directory(inputDir, false);
+      archive.pipe(target);
+      files.forEach((file) => archive.file(file.path, { name: file.name }));
       archive.finalize();
     });
   }
@@ -162,18 +329,107 @@ class ArchiveConverter {
   /**
    * Get compression level value
    * @param {string} level - Compression level
-   * @returns {number} Compression level value
+   * @param {string} codec - gzip, zstd or brotli
+   * @returns {number} Compression level value on the codec's scale
    */
-  getCompressionLevel(level) {
-    switch (level.toLowerCase()) {
-      case 'low':
-        return 1;
-      case 'medium':
-        return 6;
-      case 'high':
-        return 9;
+  getCompressionLevel(level, codec = 'gzip') {
+    const levels = CODEC_LEVELS[codec] || CODEC_LEVELS.gzip;
+    return levels[level.toLowerCase()] ?? levels.medium;
+  }
+
+  /**
+   * Node's own compressor for a codec, for when the native module lacks it
+   * @param {string} codec - gzip, zstd or brotli
+   * @param {number} level - Level on the codec's scale
+   * @returns {Object} Transform stream
+   */
+  createCompressor(codec, level) {
+    switch (codec) {
+      case 'gzip':
+        return zlib.createGzip({ level });
+      case 'brotli':
+        return zlib.createBrotliCompress({ params: { [zlib.constants.BROTLI_PARAM_QUALITY]: level } });
+      case 'zstd':
+        if (typeof zlib.createZstdCompress === 'function') {
+          return zlib.createZstdCompress({ params: { [zlib.constants.ZSTD_c_compressionLevel]: level } });
+        }
+        throw new Error('Zstandard needs the native archive module or a newer Node.js');
       default:
-        return 6;
+        throw new Error(`Codec ${codec} not supported`);
+    }
+  }
+
+  /**
+   * Pick the codec and level for compressing a file whole. The native module
+   * samples the file and takes the best ratio that keeps up with the
+   * speed the compression level stands for; without it, gzip.
+   * @param {string} inputPath - File to compress
+   * @param {string} compressionLevel - Compression level (low, medium, high)
+   * @returns {Promise<Object>} { codec, level, extension }
+   */
+  async chooseCodec(inputPath, compressionLevel = 'medium') {
+    const wasm = await loadWasmModule('archive-processor');
+    const target = AUTO_TARGET_SPEEDS[compressionLevel.toLowerCase()] ?? AUTO_TARGET_SPEEDS.medium;
+    const levelPointer = wasm && typeof wasm._choose_codec_source === 'function' ? wasm._malloc(4) : 0;
+    if (levelPointer) {
+      try {
+        const chosen = withFileSource(wasm, inputPath, (readAt, size) =>
+          size > 0n ? wasm._choose_codec_source(readAt, 0, size, target, 0, levelPointer) : -1
+        );
+        const codec = Object.keys(CODECS).find((name) => CODECS[name] === chosen);
+        if (codec) {
+          return { codec, level: wasm.HEAP32[levelPointer >> 2], extension: CODEC_EXTENSIONS[codec] };
+        }
+      } finally {
+        wasm._free(levelPointer);
+        saveTrace(wasm, 'choose_codec');
+      }
+    }
+    return { codec: 'gzip', level: this.getCompressionLevel(compressionLevel), extension: CODEC_EXTENSIONS.gzip };
+  }
+
+  /**
+   * Compress a file whole into a .gz, .zst or .br file, with the native
+   * module when it has the codec (Zstandard then runs on all cores) and
+   * Node's compressors otherwise
+   * @param {string} inputPath - File to compress
+   * @param {string} outputPath - Path for the compressed file
+   * @param {Object} choice - { codec, level } from chooseCodec, or a codec of your own
+   * @returns {Object} Compression result with file info
+   */
+  async compressFile(inputPath, outputPath, choice) {
+    try {
+      const originalSize = (await fs.stat(inputPath)).size;
+      const wasm = await loadWasmModule('archive-processor');
+      let written = -1;
+      if (this.hasNativeCodec(wasm, choice.codec)) {
+        written = withFileSource(wasm, inputPath, (readAt, size) =>
+          writeOutputFile(wasm, outputPath, (writeAt) =>
+            wasm._compress_source_sink(readAt, 0, size, 0, writeAt, 0, CODECS[choice.codec], choice.level, 0)
+          )
+        );
+        saveTrace(wasm, 'compress_file');
+      }
+      if (written < 0) {
+        await pipeline(
+          fs.createReadStream(inputPath),
+          this.createCompressor(choice.codec, choice.level),
+          fs.createWriteStream(outputPath)
+        );
+      }
+
+      const compressedSize = (await fs.stat(outputPath)).size;
+      const compressionRatio = originalSize > 0 ? ((originalSize - compressedSize) / originalSize * 100).toFixed(2) : '0';
+      return {
+        outputPath,
+        originalSize,
+        compressedSize,
+        compressionRatio: parseFloat(compressionRatio),
+        codec: choice.codec,
+        extension: choice.extension
+      };
+    } catch (error) {
+      throw new Error(`File compression failed: ${error.message}`);
     }
   }
 
@@ -186,47 +442,35 @@ class ArchiveConverter {
    * @returns {Promise} Archive creation promise
    */
   async createArchiveFromFiles(filePaths, outputPath, format, compressionLevel) {
-    return new Promise((resolve, reject) => {
-      const output = fs.createWriteStream(outputPath);
-      let archive;
+    const files = filePaths
+      .filter((filePath) => fs.existsSync(filePath))
+      .map((filePath) => ({ path: filePath, name: path.basename(filePath) }));
+    return this.writeArchive(files, outputPath, format, compressionLevel);
+  }
 
-      // Create archive based on format
-      switch (format.toLowerCase()) {
-        case 'zip':
-          archive = archiver('zip', {
-            zlib: { level: this.getCompressionLevel(compressionLevel) }
-          });
-          break;
-        case 'tar':
-          archive = archiver('tar', {
-            gzip: true,
-            gzipOptions: { level: this.getCompressionLevel(compressionLevel) }
-          });
-          break;
-        default:
-          reject(new Error(`Archive format ${format} not supported`));
-          return;
+  /**
+   * Run a job on a ZIP opened with the native reader, which indexes the
+   * central directory and reads nothing else until an entry is extracted
+   * @param {string} inputPath - Path to ZIP file
+   * @param {Function} run - Called with the module and the open archive
+   * @returns {Promise<*>} What run returns, or null when the module is unavailable or cannot open the file
+   */
+  async withNativeZip(inputPath, run) {
+    const wasm = await loadWasmModule('archive-processor');
+    if (!wasm || typeof wasm._zip_open_source !== 'function') {
+      return null;
+    }
+    return withFileSource(wasm, inputPath, (readAt, size) => {
+      const archive = wasm._zip_open_source(readAt, 0, size, 0);
+      if (!archive) {
+        return null;
+      }
+      try {
+        return run(wasm, archive);
+      } finally {
+        wasm._zip_close(archive);
+        saveTrace(wasm, 'zip_read');
       }
-
-      output.on('close', () => {
-        resolve({ outputPath });
-      });
-
-      archive.on('error', (error) => {
-        reject(new Error(`Archive creation failed: ${error.message}`));
-      });
-
-      archive.pipe(output);
-
-      // Add files to archive
-      filePaths.forEach(filePath => {
-        if (fs.existsSync(filePath)) {
-          const fileName = path.basename(filePath);
-          archive.file(filePath, { name: fileName });
-        }
-      });
-
-      archive.finalize();
     });
   }
 
@@ -236,9 +480,32 @@ class ArchiveConverter {
    * @returns {Promise<Array>} Array of file entries
    */
   async listArchiveContents(inputPath) {
+    const inputExtension = path.extname(inputPath).toLowerCase().slice(1);
+    if (inputExtension === 'zip') {
+      const entries = await this.withNativeZip(inputPath, (wasm, archive) => {
+        const size = Number(wasm._zip_list(archive, 0, 0n));
+        const pointer = size >= 0 ? wasm._malloc(size) : 0;
+        if (!pointer) {
+          return null;
+        }
+        try {
+          const length = Number(wasm._zip_list(archive, pointer, BigInt(size)));
+          return length < 0 ? null : JSON.parse(copyFromHeap(wasm, pointer, length).toString('utf8'));
+        } finally {
+          wasm._free(pointer);
+        }
+      });
+      if (entries) {
+        return entries.map((entry) => ({
+          fileName: entry.name,
+          size: entry.size,
+          compressedSize: entry.compressedSize,
+          isDirectory: entry.directory
+        }));
+      }
+    }
+
     return new Promise((resolve, reject) => {
-      const inputExtension = path.extname(inputPath).toLowerCase().slice(1);
-      
       if (inputExtension === 'zip') {
         const entries = [];
         
@@ -269,9 +536,36 @@ class ArchiveConverter {
    * @returns {Promise} Extraction promise
    */
   async extractSpecificFiles(inputPath, outputDir, fileNames) {
+    const inputExtension = path.extname(inputPath).toLowerCase().slice(1);
+    if (inputExtension === 'zip') {
+      const extracted = await this.withNativeZip(inputPath, (wasm, archive) => {
+        let missing = 0;
+        for (const fileName of fileNames) {
+          const outputPath = this.resolveEntryPath(outputDir, fileName);
+          const name = copyToHeap(wasm, Buffer.from(`${fileName}\0`, 'utf8'));
+          const index = name ? wasm._zip_find(archive, name) : -1;
+          wasm._free(name);
+          if (index < 0) {
+            missing++;
+            continue;
+          }
+          // Each entry is inflated straight into its file; no other entry is read
+          fs.ensureDirSync(path.dirname(outputPath));
+          if (writeOutputFile(wasm, outputPath, (writeAt) => wasm._zip_extract_sink(archive, index, writeAt, 0)) < 0) {
+            throw new Error(`Could not extract ${fileName}`);
+          }
+        }
+        return { missing };
+      });
+      if (extracted) {
+        if (extracted.missing > 0) {
+          throw new Error('Some files were not found in the archive');
+        }
+        return;
+      }
+    }
+
     return new Promise((resolve, reject) => {
-      const inputExtension = path.extname(inputPath).toLowerCase().slice(1);
-      
       if (inputExtension === 'zip') {
         let extractedCount = 0;
         const totalFiles = fileNames.length;
@@ -280,7 +574,8 @@ class ArchiveConverter {
           .pipe(unzipper.Parse())
           .on('entry', (entry) => {
             if (fileNames.includes(entry.path)) {
-              const outputPath = path.join(outputDir, entry.path);
+              const outputPath = this.resolveEntryPath(outputDir, entry.path);
+              fs.ensureDirSync(path.dirname(outputPath));
               entry.pipe(fs.createWriteStream(outputPath));
               extractedCount++;
               
@@ -305,6 +600,22 @@ class ArchiveConverter {
     });
   }
 
+  /**
+   * Where an entry goes when extracted; names that would land outside the
+   * directory (absolute, or climbing out with ..) are refused
+   * @param {string} outputDir - Directory to extract to
+   * @param {string} entryName - Path in the archive
+   * @returns {string} Output path
+   */
+  resolveEntryPath(outputDir, entryName) {
+    const root = path.resolve(outputDir);
+    const outputPath = path.resolve(root, entryName);
+    if (!outputPath.startsWith(root + path.sep)) {
+      throw new Error(`Refusing to extract ${entryName} outside the output directory`);
+    }
+    return outputPath;
+  }
+
   /**
    * Get archive metadata
    * @param {string} inputPath - Path to archive file
@@ -3,6 +3,7 @@ const path = require('path');
 const { PDFDocument } = require('pdf-lib');
 const mammoth = require('mammoth');
 const pdf = require('node-html-pdf');
+const { loadWasmModule, copyToHeap, collectOutput, saveTrace } = require('../lib/wasmModules');
 
 /**
  * Document converter module for ZELL
@@ -115,10 +116,9 @@ class DocumentConverter {
    */
   async pdfToText(inputPath, outputPath) {
     try {
-      // Note: This is a simplified implementation
-      // For production, you'd want to use a proper PDF text extraction library like pdf-parse
       const pdfBuffer = await fs.readFile(inputPath);
-      const text = 'PDF text extraction not implemented in this version. Please use a dedicated PDF reader.';
+      const text = await this.extractPdfTextNative(pdfBuffer)
+        ?? 'PDF text extraction requires the PDF processor module (npm run build in wasm-modules).';
       
       await fs.writeFile(outputPath, text, 'utf8');
       
@@ -128,6 +128,32 @@ class DocumentConverter {
     }
   }
 
+  /**
+   * Extract the text of a PDF with the native processor
+   * @param {Buffer} input - PDF data
+   * @returns {Promise<string|null>} UTF-8 text, or null when the module is unavailable or fails
+   */
+  async extractPdfTextNative(input) {
+    const wasm = await loadWasmModule('pdf-processor');
+    if (!wasm) {
+      return null;
+    }
+
+    const inputPointer = copyToHeap(wasm, input);
+    try {
+      if (!inputPointer) {
+        return null;
+      }
+      // The text is streamed back in chunks, however long it turns out to be
+      const text = collectOutput(wasm, (writeAt) =>
+        wasm._extract_pdf_text_sink(inputPointer, BigInt(input.length), writeAt, 0, 0));
+      return text ? text.toString('utf8') : null;
+    } finally {
+      wasm._free(inputPointer);
+      saveTrace(wasm, 'extract_pdf_text');
+    }
+  }
+
   /**
    * Convert DOCX to PDF
    * @param {string} inputPath - Path to DOCX file
@@ -307,10 +333,20 @@ class DocumentConverter {
    */
   async compressPdf(inputPath, outputPath, compressionLevel) {
     try {
-      // Note: PDF compression requires specialized libraries
-      // This is a placeholder implementation
       const originalContent = await fs.readFile(inputPath);
-      await fs.writeFile(outputPath, originalContent);
+      const settings = this.getPdfCompressionSettings(compressionLevel);
+
+      let compressed = await this.compressPdfNative(originalContent, settings);
+      if (!compressed) {
+        // Without the native module pdf-lib can at least pack object streams
+        const pdfDoc = await PDFDocument.load(originalContent);
+        compressed = Buffer.from(await pdfDoc.save({ useObjectStreams: true }));
+      }
+      if (compressed.length >= originalContent.length) {
+        compressed = originalContent;
+      }
+
+      await fs.writeFile(outputPath, compressed);
       
       return { outputPath };
     } catch (error) {
@@ -318,6 +354,47 @@ class DocumentConverter {
     }
   }
 
+  /**
+   * Get PDF optimizer settings for a compression level
+   * @param {string} compressionLevel - Compression level
+   * @returns {Object} JPEG quality and target resolution for embedded images
+   */
+  getPdfCompressionSettings(compressionLevel) {
+    const settings = {
+      low: { imageQuality: 90, targetDpi: 300 },
+      medium: { imageQuality: 75, targetDpi: 150 },
+      high: { imageQuality: 50, targetDpi: 96 }
+    };
+
+    return settings[compressionLevel] || settings.medium;
+  }
+
+  /**
+   * Compress a PDF with the native optimizer
+   * @param {Buffer} input - PDF data
+   * @param {Object} settings - Settings from getPdfCompressionSettings
+   * @returns {Promise<Buffer|null>} Compressed PDF, or null when the module is unavailable or fails
+   */
+  async compressPdfNative(input, settings) {
+    const wasm = await loadWasmModule('pdf-processor');
+    if (!wasm) {
+      return null;
+    }
+
+    // The output is streamed back, so module memory only holds the input
+    const inputPointer = copyToHeap(wasm, input);
+    try {
+      if (!inputPointer) {
+        return null;
+      }
+      return collectOutput(wasm, (writeAt) => wasm._compress_pdf_sink(inputPointer,
+        BigInt(input.length), writeAt, 0, settings.imageQuality, settings.targetDpi));
+    } finally {
+      wasm._free(inputPointer);
+      saveTrace(wasm, 'compress_pdf');
+    }
+  }
+
   /**
    * Compress DOCX
    * @param {string} inputPath - Path to DOCX file
@@ -0,0 +1,305 @@
+const crypto = require('crypto');
+const fs = require('fs-extra');
+const path = require('path');
+const { v4: uuidv4 } = require('uuid');
+const { loadWasmModule, copyToHeap, copyFromHeap } = require('./wasmModules');
+
+/**
+ * Content-addressed cache of conversion results. Uploads are hashed while
+ * multer writes them to disk, so a repeat conversion of the same bytes with
+ * the same operation, source and target format and level is answered from
+ * the cache without reading the file again.
+ *
+ * The cache is shared by every client, so it is keyed on SHA-256: with a
+ * hash that is not collision resistant, one upload crafted to collide with
+ * a popular input would hand its result to everyone converting that input.
+ * The processors' 128-bit SIMD hash (zell_hash) is still computed in the
+ * same pass when the PDF module is built and reported as fileHash.
+ * Entries are hard links under outputs/cache, so handing one out (and
+ * deleting it after download) costs no copy.
+ */
+
+const DIGEST_SIZE = 16;
+
+// ZELL_RESULT_CACHE=0 turns caching off; ZELL_RESULT_CACHE_MB bounds its size
+const CACHE_ENABLED = process.env.ZELL_RESULT_CACHE !== '0';
+const CACHE_MAX_BYTES = (Number(process.env.ZELL_RESULT_CACHE_MB) || 1024) * 1024 * 1024;
+
+/**
+ * Streaming hash through the native module
+ */
+class WasmHasher {
+  constructor(wasm, state) {
+    this.wasm = wasm;
+    this.state = state;
+  }
+
+  update(chunk) {
+    const pointer = copyToHeap(this.wasm, chunk);
+    if (!pointer) {
+      throw new Error('Out of module memory while hashing');
+    }
+    try {
+      this.wasm._zell_hash_update(this.state, pointer, BigInt(chunk.length));
+    } finally {
+      this.wasm._free(pointer);
+    }
+  }
+
+  digest() {
+    const pointer = this.wasm._malloc(DIGEST_SIZE);
+    try {
+      if (!pointer || this.wasm._zell_hash_digest(this.state, pointer) !== DIGEST_SIZE) {
+        return null;
+      }
+      return `z128-${copyFromHeap(this.wasm, pointer, DIGEST_SIZE).toString('hex')}`;
+    } finally {
+      this.wasm._free(pointer);
+      this.dispose();
+    }
+  }
+
+  dispose() {
+    if (this.state) {
+      this.wasm._zell_hash_destroy(this.state);
+      this.state = 0;
+    }
+  }
+}
+
+/**
+ * Streaming hash for when the native module has not been built
+ */
+class CryptoHasher {
+  constructor() {
+    this.hash = crypto.createHash('sha256');
+  }
+
+  update(chunk) {
+    this.hash.update(chunk);
+  }
+
+  digest() {
+    return `sha256-${this.hash.digest('hex')}`;
+  }
+
+  dispose() {}
+}
+
+/**
+ * Start hashing a stream of chunks
+ * @returns {Promise<WasmHasher|CryptoHasher>} Hasher with update, digest and dispose
+ */
+async function createHasher() {
+  const wasm = await loadWasmModule('pdf-processor');
+  if (wasm && typeof wasm._zell_hash_create === 'function') {
+    const state = wasm._zell_hash_create();
+    if (state) {
+      return new WasmHasher(wasm, state);
+    }
+  }
+  return new CryptoHasher();
+}
+
+/**
+ * Multer storage engine that writes uploads like diskStorage and hashes
+ * them in the same pass. The content hash lands in `file.contentHash`, the
+ * SHA-256 the cache is keyed on in `file.cacheHash`
+ * @param {string} destination - Upload directory
+ * @returns {Object} Multer storage engine
+ */
+function hashingStorage(destination) {
+  return {
+    _handleFile(req, file, cb) {
+      const filename = `${uuidv4()}-${file.originalname}`;
+      const filePath = path.join(destination, filename);
+      let finished = false;
+      let hasher = null;
+      const done = (error, info) => {
+        if (!finished) {
+          finished = true;
+          if (error && hasher) {
+            hasher.dispose();
+          }
+          cb(error, info);
+        }
+      };
+
+      createHasher().then((created) => {
+        hasher = created;
+        // The SHA-256 fallback already is the cache hash
+        const keyHash = hasher instanceof CryptoHasher ? null : crypto.createHash('sha256');
+        const out = fs.createWriteStream(filePath);
+        let size = 0;
+        let failed = false;
+        const fail = (error) => {
+          failed = true;
+          file.stream.unpipe(out);
+          file.stream.resume();
+          const report = () => done(error);
+          const remove = () => fs.remove(filePath).then(report, report);
+          // Removing before the stream has opened the file would leave it behind
+          if (out.closed) {
+            remove();
+          } else {
+            out.once('close', remove);
+            out.destroy();
+          }
+        };
+        file.stream.on('data', (chunk) => {
+          if (failed) {
+            return;
+          }
+          try {
+            size += chunk.length;
+            hasher.update(chunk);
+            if (keyHash) {
+              keyHash.update(chunk);
+            }
+          } catch (error) {
+            fail(error);
+          }
+        });
+        file.stream.on('error', done);
+        out.on('error', done);
+        out.on('finish', () => {
+          try {
+            const contentHash = hasher.digest();
+            const cacheHash = keyHash ? `sha256-${keyHash.digest('hex')}` : contentHash;
+            done(null, { destination, filename, path: filePath, size, contentHash, cacheHash });
+          } catch (error) {
+            fail(error);
+          }
+        });
+        file.stream.pipe(out);
+      }, done);
+    },
+
+    _removeFile(req, file, cb) {
+      fs.unlink(file.path, cb);
+    },
+  };
+}
+
+/**
+ * Cache of conversion results in a directory
+ */
+class ResultCache {
+  /**
+   * @param {string} directory - Where entries are kept
+   * @param {number} maxBytes - Total size of results to keep; least recently used go first
+   */
+  constructor(directory, maxBytes = CACHE_MAX_BYTES) {
+    this.directory = directory;
+    this.maxBytes = maxBytes;
+    fs.ensureDirSync(directory);
+  }
+
+  /**
+   * Key of a job on an uploaded file. The source extension is part of it,
+   * as it picks the converter.
+   * @param {Object} file - Multer file from hashingStorage
+   * @param {string} operation - 'convert' or 'compress'
+   * @param {string} targetFormat - Output format
+   * @param {string} level - Compression level
+   * @returns {string|null} Key, or null when the upload was not hashed
+   */
+  keyFor(file, operation, targetFormat, level) {
+    if (!CACHE_ENABLED || !file.cacheHash) {
+      return null;
+    }
+    const sourceFormat = path.extname(file.originalname).slice(1) || 'none';
+    return [file.cacheHash, sourceFormat, operation, targetFormat, level]
+      .map((part) => String(part).toLowerCase().replace(/[^a-z0-9-]/g, '_'))
+      .join('.');
+  }
+
+  /**
+   * Hand out a cached result
+   * @param {string|null} key - Job key
+   * @param {string|Function} outputPath - Where the caller wants the result, or a
+   *   function making that path from the cached result (e.g. from its extension)
+   * @returns {Promise<Object|null>} Result as the converters return it, or null on a miss
+   */
+  async lookup(key, outputPath) {
+    if (!key) {
+      return null;
+    }
+    const dataPath = path.join(this.directory, `${key}.out`);
+    try {
+      const result = await fs.readJson(path.join(this.directory, `${key}.json`));
+      const target = typeof outputPath === 'function' ? outputPath(result) : outputPath;
+      await linkOrCopy(dataPath, target);
+      const now = new Date();
+      await fs.utimes(dataPath, now, now);
+      return { ...result, outputPath: target };
+    } catch (error) {
+      return null;
+    }
+  }
+
+  /**
+   * Keep a fresh result. Failures only cost the cache entry.
+   * @param {string|null} key - Job key
+   * @param {Object} result - Converter result with outputPath and sizes
+   */
+  async store(key, result) {
+    if (!key || !result?.outputPath) {
+      return;
+    }
+    const dataPath = path.join(this.directory, `${key}.out`);
+    try {
+      await fs.remove(dataPath);
+      await linkOrCopy(result.outputPath, dataPath);
+      await fs.writeJson(path.join(this.directory, `${key}.json`), {
+        originalSize: result.originalSize,
+        compressedSize: result.compressedSize,
+        compressionRatio: result.compressionRatio,
+        extension: result.extension,
+      });
+      await this.prune();
+    } catch (error) {
+      console.warn('Result cache store failed:', error.message);
+    }
+  }
+
+  /**
+   * Drop least recently used entries until the cache fits its budget
+   */
+  async prune() {
+    const names = (await fs.readdir(this.directory)).filter((name) => name.endsWith('.out'));
+    const entries = await Promise.all(names.map(async (name) => {
+      const stat = await fs.stat(path.join(this.directory, name));
+      return { key: name.slice(0, -4), size: stat.size, used: stat.mtimeMs };
+    }));
+    let total = entries.reduce((sum, entry) => sum + entry.size, 0);
+    entries.sort((a, b) => a.used - b.used);
+    for (const entry of entries) {
+      if (total <= this.maxBytes) {
+        break;
+      }
+      await fs.remove(path.join(this.directory, `${entry.key}.json`));
+      await fs.remove(path.join(this.directory, `${entry.key}.out`));
+      total -= entry.size;
+    }
+  }
+}
+
+/**
+ * Hard-link a file, copying when the file system cannot link
+ * @param {string} source - Existing file
+ * @param {string} target - New path
+ */
+async function linkOrCopy(source, target) {
+  try {
+    await fs.link(source, target);
+  } catch (error) {
+    await fs.copy(source, target);
+  }
+}
+
+module.exports = {
+  createHasher,
+  hashingStorage,
+  ResultCache,
+};
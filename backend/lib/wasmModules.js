@@ -0,0 +1,267 @@
+const fs = require('fs');
+const path = require('path');
+
+/**
+ * Loader for the ZELL WebAssembly processors (built by `npm run build` in
+ * wasm-modules). Every module is optional: callers get null when it has not
+ * been built and fall back to their JavaScript implementation.
+ */
+
+const DIST_DIR = path.join(__dirname, '..', '..', 'wasm-modules', 'dist');
+
+// ZELL_WASM64=1 selects the memory64 builds (`npm run build:wasm64`), which
+// can address inputs beyond 4GB. Sizes are BigInt in both builds. Pointer
+// arguments and results stay plain numbers because the memory64 glue
+// converts them; pointers stored in module memory (arrays of buffers or
+// names) do not, and are written with setPointer.
+const BUILD_DIR = process.env.ZELL_WASM64 === '1' ? path.join(DIST_DIR, 'wasm64') : DIST_DIR;
+
+// Smallest module using a SIMD instruction (i8x16.popcnt); engines without
+// 128-bit SIMD reject it
+const SIMD_PROBE = new Uint8Array([
+  0, 97, 115, 109, 1, 0, 0, 0, 1, 5, 1, 96, 0, 1, 123, 3, 2, 1, 0, 10, 10, 1, 8, 0, 65, 0, 253, 15, 253, 98, 11,
+]);
+
+// The -msimd128 builds (`npm run build:simd`) sit in a simd/ subdirectory
+// and are preferred when the engine supports them; ZELL_WASM_SIMD=0 forces
+// the plain builds. ZELL_WASM_STATS=1 prefers the instrumented builds
+// (`npm run build:stats`) over both.
+const MODULE_DIRS = [
+  ...(process.env.ZELL_WASM_STATS === '1' ? [path.join(BUILD_DIR, 'stats')] : []),
+  ...(process.env.ZELL_WASM_SIMD !== '0' && WebAssembly.validate(SIMD_PROBE) ? [path.join(BUILD_DIR, 'simd')] : []),
+  BUILD_DIR,
+];
+
+// With an instrumented build, ZELL_TRACE_DIR collects a Chrome trace per job
+const TRACE_DIR = process.env.ZELL_TRACE_DIR;
+
+// Signature of a ZellWriteAt callback: int64 (ctx, int64 offset, data, int64 length)
+const WRITE_AT_SIGNATURE = process.env.ZELL_WASM64 === '1' ? 'jpjpj' : 'jijij';
+
+// A ZellReadAt callback has the same shape: int64 (ctx, int64 offset, buffer, int64 length)
+const READ_AT_SIGNATURE = WRITE_AT_SIGNATURE;
+
+// Width of a pointer stored in module memory
+const POINTER_SIZE = process.env.ZELL_WASM64 === '1' ? 8 : 4;
+
+const instances = new Map();
+
+/**
+ * Instantiate a processor once and reuse it
+ * @param {string} name - Module name, e.g. 'pdf-processor'
+ * @returns {Promise<Object|null>} Emscripten module, or null when unavailable
+ */
+function loadWasmModule(name) {
+  if (!instances.has(name)) {
+    const file = MODULE_DIRS.map((dir) => path.join(dir, `${name}.js`)).find((candidate) => fs.existsSync(candidate));
+    let instance;
+    try {
+      const factory = require(file);
+      instance = Promise.resolve(factory()).catch(() => null);
+    } catch (error) {
+      instance = Promise.resolve(null);
+    }
+    instances.set(name, instance);
+  }
+  return instances.get(name);
+}
+
+/**
+ * Copy a buffer into module memory
+ * @param {Object} wasm - Emscripten module
+ * @param {Buffer} buffer - Data to copy
+ * @returns {number} Pointer to free with wasm._free, or 0 on failure
+ */
+function copyToHeap(wasm, buffer) {
+  const pointer = wasm._malloc(Math.max(buffer.length, 1));
+  if (pointer) {
+    wasm.HEAPU8.set(buffer, pointer);
+  }
+  return pointer;
+}
+
+/**
+ * Store a pointer in a pointer array in module memory (e.g. a `const
+ * unsigned char**` argument), at the width of the build
+ * @param {Object} wasm - Emscripten module
+ * @param {number} array - Start of the array, from wasm._malloc(count * POINTER_SIZE)
+ * @param {number} index - Entry to set
+ * @param {number} pointer - Pointer to store
+ */
+function setPointer(wasm, array, index, pointer) {
+  // Division rather than a shift: memory64 addresses may pass 2^31
+  if (POINTER_SIZE === 8) {
+    wasm.HEAP64[array / 8 + index] = BigInt(pointer);
+  } else {
+    wasm.HEAP32[array / 4 + index] = pointer;
+  }
+}
+
+/**
+ * Copy bytes out of module memory
+ * @param {Object} wasm - Emscripten module
+ * @param {number} pointer - Start of the data
+ * @param {number} size - Number of bytes
+ * @returns {Buffer} Copy of the data
+ */
+function copyFromHeap(wasm, pointer, size) {
+  return Buffer.from(wasm.HEAPU8.slice(pointer, pointer + size));
+}
+
+/**
+ * Run a `*_sink` entry point and gather the output it streams back, so no
+ * worst-case output buffer has to be allocated in module memory
+ * @param {Object} wasm - Emscripten module built with addFunction
+ * @param {Function} run - Called with the write_at function pointer; returns the output size
+ * @returns {Buffer|null} Output, or null when the job fails
+ */
+function collectOutput(wasm, run) {
+  const chunks = [];
+  const writeAt = wasm.addFunction((ctx, offset, data, length) => {
+    chunks.push({ offset: Number(offset), bytes: copyFromHeap(wasm, Number(data), Number(length)) });
+    return length;
+  }, WRITE_AT_SIGNATURE);
+
+  try {
+    const size = Number(run(writeAt));
+    if (size < 0) {
+      return null;
+    }
+    // Writes are positional: a job may start over from offset 0
+    const output = Buffer.alloc(size);
+    chunks.forEach(({ offset, bytes }) => {
+      if (offset < size) {
+        bytes.copy(output, offset, 0, Math.min(bytes.length, size - offset));
+      }
+    });
+    return output;
+  } finally {
+    wasm.removeFunction(writeAt);
+  }
+}
+
+/**
+ * Run a `*_sink` entry point and write its output straight to a file, for
+ * outputs too large to gather in memory
+ * @param {Object} wasm - Emscripten module built with addFunction
+ * @param {string} outputPath - File to write
+ * @param {Function} run - Called with the write_at function pointer; returns the output size
+ * @returns {number} Output size, or -1 when the job fails
+ */
+function writeOutputFile(wasm, outputPath, run) {
+  const fd = fs.openSync(outputPath, 'w');
+  const writeAt = wasm.addFunction((ctx, offset, data, length) => {
+    const bytes = wasm.HEAPU8.subarray(Number(data), Number(data) + Number(length));
+    try {
+      fs.writeSync(fd, bytes, 0, bytes.length, Number(offset));
+      return length;
+    } catch (error) {
+      return -1n;
+    }
+  }, WRITE_AT_SIGNATURE);
+
+  try {
+    const size = Number(run(writeAt));
+    // A job that starts over from offset 0 may leave a longer first attempt behind
+    if (size >= 0) {
+      fs.ftruncateSync(fd, size);
+    }
+    return size;
+  } finally {
+    wasm.removeFunction(writeAt);
+    fs.closeSync(fd);
+  }
+}
+
+/**
+ * Give a `*_source` entry point a file to read on demand, so only the
+ * ranges it needs are read and nothing is copied into module memory up front
+ * @param {Object} wasm - Emscripten module built with addFunction
+ * @param {string} inputPath - File to read
+ * @param {Function} run - Called with the read_at function pointer and the file size (BigInt)
+ * @returns {*} What run returns
+ */
+function withFileSource(wasm, inputPath, run) {
+  const fd = fs.openSync(inputPath, 'r');
+  const readAt = wasm.addFunction((ctx, offset, buffer, length) => {
+    try {
+      return BigInt(fs.readSync(fd, wasm.HEAPU8, Number(buffer), Number(length), Number(offset)));
+    } catch (error) {
+      return -1n;
+    }
+  }, READ_AT_SIGNATURE);
+
+  try {
+    return run(readAt, BigInt(fs.fstatSync(fd).size));
+  } finally {
+    wasm.removeFunction(readAt);
+    fs.closeSync(fd);
+  }
+}
+
+/**
+ * Read one of the JSON reports of an instrumented module
+ * @param {Object} wasm - Emscripten module
+ * @param {string} name - Report export, e.g. '_zell_get_stats'
+ * @returns {Object|null} Parsed report, or null when the module is not instrumented
+ */
+function readReport(wasm, name) {
+  if (typeof wasm[name] !== 'function') {
+    return null;
+  }
+  const size = Number(wasm[name](0, 0n));
+  const pointer = size >= 0 ? wasm._malloc(size + 1) : 0;
+  if (!pointer) {
+    return null;
+  }
+  try {
+    const length = Number(wasm[name](pointer, BigInt(size + 1)));
+    return length < 0 ? null : JSON.parse(copyFromHeap(wasm, pointer, length).toString('utf8'));
+  } finally {
+    wasm._free(pointer);
+  }
+}
+
+/**
+ * Counters of an instrumented module: per entry point calls, time and
+ * bytes, per stage time, memory high-water mark and thread utilization
+ * @param {Object} wasm - Emscripten module
+ * @returns {Object|null} Stats, or null when the module is not instrumented
+ */
+function readStats(wasm) {
+  return readReport(wasm, '_zell_get_stats');
+}
+
+/**
+ * Write the Chrome trace of the jobs since the last call to ZELL_TRACE_DIR
+ * and start a new one. Does nothing unless the module is instrumented and
+ * ZELL_TRACE_DIR is set.
+ * @param {Object} wasm - Emscripten module
+ * @param {string} label - Job name used in the file name
+ */
+function saveTrace(wasm, label) {
+  if (!TRACE_DIR) {
+    return;
+  }
+  const trace = readReport(wasm, '_zell_get_trace');
+  if (!trace) {
+    return;
+  }
+  trace.metadata = { label, stats: readStats(wasm) };
+  fs.mkdirSync(TRACE_DIR, { recursive: true });
+  fs.writeFileSync(path.join(TRACE_DIR, `${label}-${Date.now()}.json`), JSON.stringify(trace));
+  wasm._zell_reset_stats();
+}
+
+module.exports = {
+  POINTER_SIZE,
+  loadWasmModule,
+  copyToHeap,
+  setPointer,
+  copyFromHeap,
+  collectOutput,
+  writeOutputFile,
+  withFileSource,
+  readStats,
+  saveTrace,
+};
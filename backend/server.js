@@ -11,6 +11,7 @@ const audioConverter = require('./converters/audioConverter');
 const videoConverter = require('./converters/videoConverter');
 const documentConverter = require('./converters/documentConverter');
 const archiveConverter = require('./converters/archiveConverter');
+const { hashingStorage, ResultCache } = require('./lib/resultCache');
 
 const app = express();
 const PORT = process.env.PORT || 3001;
@@ -25,16 +26,11 @@ const outputsDir = path.join(__dirname, 'outputs');
 fs.ensureDirSync(uploadsDir);
 fs.ensureDirSync(outputsDir);
 
-// Configure multer for file uploads
-const storage = multer.diskStorage({
-  destination: (req, file, cb) => {
-    cb(null, uploadsDir);
-  },
-  filename: (req, file, cb) => {
-    const uniqueName = `${uuidv4()}-${file.originalname}`;
-    cb(null, uniqueName);
-  }
-});
+// Configure multer for file uploads; each upload is hashed as it is written
+const storage = hashingStorage(uploadsDir);
+
+// Results of earlier jobs, keyed by input hash, operation, target and level
+const resultCache = new ResultCache(path.join(outputsDir, 'cache'));
 
 const upload = multer({ 
   storage: storage,
@@ -61,7 +57,7 @@ app.get('/api/formats', (req, res) => {
     images: ['jpg', 'jpeg', 'png', 'webp', 'gif'],
     audio: ['mp3', 'wav', 'aac'],
     video: ['mp4', 'mov', 'avi', 'mkv'],
-    archives: ['zip', 'rar', '7z']
+    archives: ['zip', 'rar', '7z', 'tzst', 'tbr']
   };
   res.json(formats);
 });
@@ -84,41 +80,46 @@ app.post('/api/convert', upload.single('file'), async (req, res) => {
     const outputFileName = `${path.parse(originalName).name}.${targetFormat}`;
     const outputPath = path.join(outputsDir, `${uuidv4()}-${outputFileName}`);
 
-    let result;
-    
-    // Route to appropriate converter based on file type
-    switch (fileExtension) {
-      case 'jpg':
-      case 'jpeg':
-      case 'png':
-      case 'webp':
-      case 'gif':
-        result = await imageConverter.convert(inputPath, outputPath, targetFormat, compressionLevel);
-        break;
-      case 'mp3':
-      case 'wav':
-      case 'aac':
-        result = await audioConverter.convert(inputPath, outputPath, targetFormat, compressionLevel);
-        break;
-      case 'mp4':
-      case 'mov':
-      case 'avi':
-      case 'mkv':
-        result = await videoConverter.convert(inputPath, outputPath, targetFormat, compressionLevel);
-        break;
-      case 'pdf':
-      case 'docx':
-      case 'txt':
-      case 'pptx':
-        result = await documentConverter.convert(inputPath, outputPath, targetFormat, compressionLevel);
-        break;
-      case 'zip':
-      case 'rar':
-      case '7z':
-        result = await archiveConverter.convert(inputPath, outputPath, targetFormat, compressionLevel);
-        break;
-      default:
-        return res.status(400).json({ error: 'Unsupported file format' });
+    const cacheKey = resultCache.keyFor(req.file, 'convert', targetFormat, compressionLevel);
+    let result = await resultCache.lookup(cacheKey, outputPath);
+    const cached = Boolean(result);
+
+    if (!cached) {
+      // Route to appropriate converter based on file type
+      switch (fileExtension) {
+        case 'jpg':
+        case 'jpeg':
+        case 'png':
+        case 'webp':
+        case 'gif':
+          result = await imageConverter.convert(inputPath, outputPath, targetFormat, compressionLevel);
+          break;
+        case 'mp3':
+        case 'wav':
+        case 'aac':
+          result = await audioConverter.convert(inputPath, outputPath, targetFormat, compressionLevel);
+          break;
+        case 'mp4':
+        case 'mov':
+        case 'avi':
+        case 'mkv':
+          result = await videoConverter.convert(inputPath, outputPath, targetFormat, compressionLevel);
+          break;
+        case 'pdf':
+        case 'docx':
+        case 'txt':
+        case 'pptx':
+          result = await documentConverter.convert(inputPath, outputPath, targetFormat, compressionLevel);
+          break;
+        case 'zip':
+        case 'rar':
+        case '7z':
+          result = await archiveConverter.convert(inputPath, outputPath, targetFormat, compressionLevel);
+          break;
+        default:
+          return res.status(400).json({ error: 'Unsupported file format' });
+      }
+      await resultCache.store(cacheKey, result);
     }
 
     // Clean up input file
@@ -128,6 +129,8 @@ app.post('/api/convert', upload.single('file'), async (req, res) => {
       success: true,
       outputPath: result.outputPath,
       fileName: outputFileName,
+      fileHash: req.file.contentHash,
+      cached,
       originalSize: result.originalSize,
       compressedSize: result.compressedSize,
       compressionRatio: result.compressionRatio
@@ -153,33 +156,56 @@ app.post('/api/compress', upload.single('file'), async (req, res) => {
     const originalName = req.file.originalname;
     const fileExtension = path.extname(originalName).toLowerCase().slice(1);
     
-    // Generate output filename
-    const outputFileName = `${path.parse(originalName).name}_compressed.${fileExtension}`;
-    const outputPath = path.join(outputsDir, `${uuidv4()}-${outputFileName}`);
+    // Files without a format-aware compressor are compressed whole, with the
+    // codec and level that suit their content at the requested level.
+    // Choosing means trial-compressing the upload, so it only happens on a
+    // cache miss: the key says 'auto' and the entry keeps the extension chosen.
+    const formatAware = ['jpg', 'jpeg', 'png', 'webp', 'mp3', 'wav', 'aac', 'mp4', 'mov', 'avi', 'mkv',
+      'pdf', 'docx', 'txt'];
+    const wholeFile = !formatAware.includes(fileExtension);
 
-    let result;
-    
-    // Route to appropriate compressor
-    switch (fileExtension) {
-      case 'jpg':
-      case 'jpeg':
-      case 'png':
-      case 'webp':
-        result = await imageConverter.compress(inputPath, outputPath, compressionLevel);
-        break;
-      case 'mp3':
-      case 'wav':
-      case 'aac':
-        result = await audioConverter.compress(inputPath, outputPath, compressionLevel);
-        break;
-      case 'mp4':
-      case 'mov':
-      case 'avi':
-      case 'mkv':
-        result = await videoConverter.compress(inputPath, outputPath, compressionLevel);
-        break;
-      default:
-        return res.status(400).json({ error: 'Compression not supported for this file type' });
+    // Generate output filename
+    const outputId = uuidv4();
+    const outputFileNameFor = (extension) => (wholeFile
+      ? `${originalName}.${extension}`
+      : `${path.parse(originalName).name}_compressed.${fileExtension}`);
+    const outputPathFor = (extension) => path.join(outputsDir, `${outputId}-${outputFileNameFor(extension)}`);
+
+    const cacheKey = resultCache.keyFor(req.file, 'compress', wholeFile ? 'auto' : fileExtension, compressionLevel);
+    let result = await resultCache.lookup(cacheKey, (entry) => outputPathFor(entry.extension));
+    const cached = Boolean(result);
+
+    if (!cached) {
+      const choice = wholeFile ? await archiveConverter.chooseCodec(inputPath, compressionLevel) : null;
+      const outputPath = outputPathFor(choice?.extension);
+      // Route to appropriate compressor
+      switch (fileExtension) {
+        case 'jpg':
+        case 'jpeg':
+        case 'png':
+        case 'webp':
+          result = await imageConverter.compress(inputPath, outputPath, compressionLevel);
+          break;
+        case 'mp3':
+        case 'wav':
+        case 'aac':
+          result = await audioConverter.compress(inputPath, outputPath, compressionLevel);
+          break;
+        case 'mp4':
+        case 'mov':
+        case 'avi':
+        case 'mkv':
+          result = await videoConverter.compress(inputPath, outputPath, compressionLevel);
+          break;
+        case 'pdf':
+        case 'docx':
+        case 'txt':
+          result = await documentConverter.compress(inputPath, outputPath, compressionLevel);
+          break;
+        default:
+          result = await archiveConverter.compressFile(inputPath, outputPath, choice);
+      }
+      await resultCache.store(cacheKey, result);
     }
 
     // Clean up input file
@@ -188,7 +214,9 @@ app.post('/api/compress', upload.single('file'), async (req, res) => {
     res.json({
       success: true,
       outputPath: result.outputPath,
-      fileName: outputFileName,
+      fileName: outputFileNameFor(result.extension),
+      fileHash: req.file.contentHash,
+      cached,
       originalSize: result.originalSize,
       compressedSize: result.compressedSize,
       compressionRatio: result.compressionRatio
@@ -245,41 +273,46 @@ app.post('/api/batch-convert', upload.array('files', 10), async (req, res) => {
         const outputFileName = `${path.parse(originalName).name}.${targetFormat}`;
         const outputPath = path.join(outputsDir, `${uuidv4()}-${outputFileName}`);
 
-        let result;
-        
-        // Route to appropriate converter
-        switch (fileExtension) {
-          case 'jpg':
-          case 'jpeg':
-          case 'png':
-          case 'webp':
-          case 'gif':
-            result = await imageConverter.convert(inputPath, outputPath, targetFormat, compressionLevel);
-            break;
-          case 'mp3':
-          case 'wav':
-          case 'aac':
-            result = await audioConverter.convert(inputPath, outputPath, targetFormat, compressionLevel);
-            break;
-          case 'mp4':
-          case 'mov':
-          case 'avi':
-          case 'mkv':
-            result = await videoConverter.convert(inputPath, outputPath, targetFormat, compressionLevel);
-            break;
-          case 'pdf':
-          case 'docx':
-          case 'txt':
-          case 'pptx':
-            result = await documentConverter.convert(inputPath, outputPath, targetFormat, compressionLevel);
-            break;
-          default:
-            results.push({
-              fileName: originalName,
-              success: false,
-              error: 'Unsupported format'
-            });
-            continue;
+        const cacheKey = resultCache.keyFor(file, 'convert', targetFormat, compressionLevel);
+        let result = await resultCache.lookup(cacheKey, outputPath);
+        const cached = Boolean(result);
+
+        if (!cached) {
+          // Route to appropriate converter
+          switch (fileExtension) {
+            case 'jpg':
+            case 'jpeg':
+            case 'png':
+            case 'webp':
+            case 'gif':
+              result = await imageConverter.convert(inputPath, outputPath, targetFormat, compressionLevel);
+              break;
+            case 'mp3':
+            case 'wav':
+            case 'aac':
+              result = await audioConverter.convert(inputPath, outputPath, targetFormat, compressionLevel);
+              break;
+            case 'mp4':
+            case 'mov':
+            case 'avi':
+            case 'mkv':
+              result = await videoConverter.convert(inputPath, outputPath, targetFormat, compressionLevel);
+              break;
+            case 'pdf':
+            case 'docx':
+            case 'txt':
+            case 'pptx':
+              result = await documentConverter.convert(inputPath, outputPath, targetFormat, compressionLevel);
+              break;
+            default:
+              results.push({
+                fileName: originalName,
+                success: false,
+                error: 'Unsupported format'
+              });
+              continue;
+          }
+          await resultCache.store(cacheKey, result);
         }
 
         results.push({
@@ -287,6 +320,8 @@ app.post('/api/batch-convert', upload.array('files', 10), async (req, res) => {
           success: true,
           outputPath: result.outputPath,
           outputFileName: outputFileName,
+          fileHash: file.contentHash,
+          cached,
           originalSize: result.originalSize,
           compressedSize: result.compressedSize,
           compressionRatio: result.compressionRatio
@@ -318,8 +353,13 @@ app.use((error, req, res, next) => {
   res.status(500).json({ error: 'Internal server error' });
 });
 
-app.listen(PORT, () => {
-  console.log(`ZELL Backend server running on port ${PORT}`);
-});
+// The tests load the app and listen on a port of their own
+if (require.main === module) {
+  app.listen(PORT, () => {
+    console.log(`ZELL Backend server running on port ${PORT}`);
+  });
+}
+
+module.exports = app;
 
 
@@ -2,6 +2,8 @@ const { getDefaultConfig } = require('expo/metro-config');
 
 const config = getDefaultConfig(__dirname);
 
-module.exports = config;
-
+// The WebAssembly builds in wasm-modules/dist are optional: requires of them
+// inside a try resolve to a throwing stub when they have not been built
+config.transformer.allowOptionalDependencies = true;
 
+module.exports = config;
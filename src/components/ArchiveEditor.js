@@ -12,6 +12,7 @@ import {
   IconButton,
   Divider,
 } from 'react-native-paper';
+import OfflineProcessor from '../services/OfflineProcessor';
 
 /**
  * Archive Editor Component
@@ -51,15 +52,32 @@ const ArchiveEditor = ({ file, mode, onApply }) => {
    * Load archive contents
    */
   const loadArchiveContents = useCallback(async () => {
-    // Simulate loading archive contents
-    const mockContents = [
-      { name: 'document1.pdf', size: 1024000, type: 'file' },
-      { name: 'image1.jpg', size: 512000, type: 'file' },
-      { name: 'folder1/', size: 0, type: 'folder' },
-      { name: 'folder1/subfolder/', size: 0, type: 'folder' },
-      { name: 'folder1/subfolder/file.txt', size: 1024, type: 'file' },
-    ];
-    setArchiveContents(mockContents);
+    try {
+      const entries = await OfflineProcessor.listArchive(file.uri);
+      setArchiveContents(entries.map(entry => ({
+        name: entry.name,
+        size: entry.size,
+        type: entry.directory ? 'folder' : 'file',
+      })));
+    } catch (error) {
+      console.warn('Could not list archive contents:', error);
+      setArchiveContents([]);
+    }
+  }, [file]);
+
+  /**
+   * Toggle a file in the extraction selection
+   */
+  const toggleSelected = useCallback((fileName) => {
+    setEditParams(prev => {
+      const selected = prev.selectedFiles || [];
+      return {
+        ...prev,
+        selectedFiles: selected.includes(fileName)
+          ? selected.filter(name => name !== fileName)
+          : [...selected, fileName],
+      };
+    });
   }, []);
 
   /**
@@ -98,6 +116,46 @@ const ArchiveEditor = ({ file, mode, onApply }) => {
           ]}
         />
         
+        {(editParams.extractMode || 'selected') === 'selected' && (
+          <View>
+            <Button
+              mode="outlined"
+              onPress={loadArchiveContents}
+              style={styles.loadButton}
+            >
+              Load Archive Contents
+            </Button>
+
+            {archiveContents.length > 0 && (
+              <View style={styles.contentsContainer}>
+                <Text style={styles.contentsTitle}>
+                  Selected Files: {(editParams.selectedFiles || []).length}
+                </Text>
+                <FlatList
+                  data={archiveContents.filter(item => item.type === 'file')}
+                  keyExtractor={(item) => item.name}
+                  renderItem={({ item }) => (
+                    <List.Item
+                      title={item.name}
+                      description={formatFileSize(item.size)}
+                      onPress={() => toggleSelected(item.name)}
+                      left={(props) => (
+                        <List.Icon
+                          {...props}
+                          icon={(editParams.selectedFiles || []).includes(item.name)
+                            ? 'checkbox-marked'
+                            : 'checkbox-blank-outline'}
+                        />
+                      )}
+                    />
+                  )}
+                  style={styles.contentsList}
+                />
+              </View>
+            )}
+          </View>
+        )}
+
         {editParams.extractMode === 'folder' && (
           <TextInput
             label="Folder Path"
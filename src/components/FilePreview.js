@@ -1,11 +1,15 @@
-import React from 'react';
-import { View, StyleSheet } from 'react-native';
+import React, { useState, useEffect } from 'react';
+import { View, StyleSheet, Image, PixelRatio } from 'react-native';
 import { Card, Title, Paragraph, Chip, IconButton } from 'react-native-paper';
 import { Ionicons } from '@expo/vector-icons';
+import OfflineProcessor from '../services/OfflineProcessor';
 
 // Import theme colors
 import { fileTypeColors } from '../theme/theme';
 
+// Side of the photo thumbnail shown in place of the icon
+const THUMBNAIL_SIZE = 48;
+
 const FilePreview = ({ file, onRemove }) => {
   /**
    * Get file type from extension
@@ -77,16 +81,39 @@ const FilePreview = ({ file, onRemove }) => {
   const fileIcon = getFileIcon(fileCategory);
   const fileTypeColor = getFileTypeColor(fileCategory);
 
+  // JPEG photos show a thumbnail: their Exif one, or a reduced native decode
+  const [thumbnailUri, setThumbnailUri] = useState(null);
+  useEffect(() => {
+    let cancelled = false;
+    setThumbnailUri(null);
+    if (file.uri && (fileType === 'jpg' || fileType === 'jpeg')) {
+      OfflineProcessor.getImagePreview(file.uri, PixelRatio.getPixelSizeForLayoutSize(THUMBNAIL_SIZE))
+        .then((uri) => {
+          if (!cancelled) {
+            setThumbnailUri(uri);
+          }
+        })
+        .catch(() => {});
+    }
+    return () => {
+      cancelled = true;
+    };
+  }, [file.uri, fileType]);
+
   return (
     <Card style={[styles.container, { borderLeftColor: fileTypeColor }]}>
       <Card.Content style={styles.content}>
         <View style={styles.header}>
           <View style={styles.iconContainer}>
-            <Ionicons 
-              name={fileIcon} 
-              size={32} 
-              color={fileTypeColor} 
-            />
+            {thumbnailUri ? (
+              <Image source={{ uri: thumbnailUri }} style={styles.thumbnail} />
+            ) : (
+              <Ionicons 
+                name={fileIcon} 
+                size={32} 
+                color={fileTypeColor} 
+              />
+            )}
           </View>
           <View style={styles.fileInfo}>
             <Title numberOfLines={1} style={styles.fileName}>
@@ -142,6 +169,11 @@ const styles = StyleSheet.create({
   iconContainer: {
     marginRight: 12,
   },
+  thumbnail: {
+    width: THUMBNAIL_SIZE,
+    height: THUMBNAIL_SIZE,
+    borderRadius: 4,
+  },
   fileInfo: {
     flex: 1,
   },
@@ -1,5 +1,5 @@
-import React, { useState, useCallback } from 'react';
-import { View, StyleSheet, Dimensions } from 'react-native';
+import React, { useState, useCallback, useEffect } from 'react';
+import { View, StyleSheet, Dimensions, Image, PixelRatio } from 'react-native';
 import {
   Text,
   Button,
@@ -10,9 +10,12 @@ import {
   Card,
   Title,
 } from 'react-native-paper';
+import OfflineProcessor from '../services/OfflineProcessor';
 
 const { width: screenWidth } = Dimensions.get('window');
 
+const PREVIEW_HEIGHT = 200;
+
 /**
  * Image Editor Component
  * Provides editing tools for image files
@@ -20,6 +23,27 @@ const { width: screenWidth } = Dimensions.get('window');
 const ImageEditor = ({ file, mode, onApply }) => {
   const [editParams, setEditParams] = useState({});
   const [isProcessing, setIsProcessing] = useState(false);
+  const [previewUri, setPreviewUri] = useState(null);
+
+  /**
+   * Load a screen-sized preview of the photo without decoding it in full
+   */
+  useEffect(() => {
+    let cancelled = false;
+    setPreviewUri(null);
+    if (file?.uri) {
+      OfflineProcessor.getImagePreview(file.uri, PixelRatio.getPixelSizeForLayoutSize(screenWidth))
+        .then((uri) => {
+          if (!cancelled) {
+            setPreviewUri(uri);
+          }
+        })
+        .catch(() => {});
+    }
+    return () => {
+      cancelled = true;
+    };
+  }, [file?.uri]);
 
   /**
    * Handle parameter change
@@ -342,6 +366,10 @@ const ImageEditor = ({ file, mode, onApply }) => {
 
   return (
     <View style={styles.container}>
+      {previewUri && (
+        <Image source={{ uri: previewUri }} style={styles.preview} resizeMode="contain" />
+      )}
+
       {renderEditor()}
       
       <Button
@@ -361,6 +389,12 @@ const styles = StyleSheet.create({
   container: {
     marginTop: 16,
   },
+  preview: {
+    width: '100%',
+    height: PREVIEW_HEIGHT,
+    marginBottom: 16,
+    borderRadius: 8,
+  },
   editorContainer: {
     marginBottom: 16,
   },
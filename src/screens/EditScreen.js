@@ -256,6 +256,10 @@ const EditScreen = () => {
    * Apply archive edit
    */
   const applyArchiveEdit = async (file, mode, editData) => {
+    if (mode === 'extract') {
+      return extractArchive(file, editData);
+    }
+
     // Simulate archive editing
     await new Promise(resolve => setTimeout(resolve, 1000));
     
@@ -268,6 +272,42 @@ const EditScreen = () => {
     };
   };
 
+  /**
+   * Extract archive entries on the device, inflating only the chosen ones
+   */
+  const extractArchive = async (file, editData) => {
+    const params = editData.params || {};
+    const extractMode = params.extractMode || 'selected';
+
+    let names;
+    if (extractMode === 'selected') {
+      names = params.selectedFiles || [];
+    } else {
+      const entries = await OfflineProcessor.listArchive(file.uri);
+      const prefix = extractMode === 'folder' ? (params.folderPath || '') : '';
+      names = entries
+        .filter(entry => !entry.directory && entry.name.startsWith(prefix))
+        .map(entry => entry.name);
+    }
+    if (names.length === 0) {
+      throw new Error('No files to extract');
+    }
+
+    const folder = params.extractTo === 'new' && params.newFolderName
+      ? params.newFolderName
+      : file.name.replace(/\.[^.]+$/, '');
+    const outputDir = `${FileSystem.documentDirectory}extracted/${folder}/`;
+    const { totalSize } = await OfflineProcessor.extractArchiveEntries(file.uri, names, outputDir);
+
+    return {
+      outputPath: outputDir,
+      originalSize: file.size,
+      editedSize: totalSize,
+      editType: 'extract',
+      editData,
+    };
+  };
+
   /**
    * Undo last edit
    */
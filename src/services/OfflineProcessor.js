@@ -3,6 +3,79 @@ import { PDFDocument } from 'pdf-lib';
 import mammoth from 'mammoth';
 import JSZip from 'jszip';
 import yauzl from 'yauzl';
+import ResultCache from './ResultCache';
+
+// Emscripten module factories, only present once `npm run build` has run in
+// wasm-modules: a plain build, and a -msimd128 build for engines with SIMD.
+// Each require sits directly in its own try, which is what makes Metro treat
+// it as optional (transformer.allowOptionalDependencies in metro.config.js);
+// the paths stay literal so the bundler can resolve them.
+const wasmFactories = {
+  'pdf-processor': { simd: null, plain: null },
+  'archive-processor': { simd: null, plain: null },
+  'image-processor': { simd: null, plain: null },
+};
+try {
+  wasmFactories['pdf-processor'].simd = require('../../wasm-modules/dist/simd/pdf-processor.js');
+} catch (error) {
+  // not built
+}
+try {
+  wasmFactories['pdf-processor'].plain = require('../../wasm-modules/dist/pdf-processor.js');
+} catch (error) {
+  // not built
+}
+try {
+  wasmFactories['archive-processor'].simd = require('../../wasm-modules/dist/simd/archive-processor.js');
+} catch (error) {
+  // not built
+}
+try {
+  wasmFactories['archive-processor'].plain = require('../../wasm-modules/dist/archive-processor.js');
+} catch (error) {
+  // not built
+}
+try {
+  wasmFactories['image-processor'].simd = require('../../wasm-modules/dist/simd/image-processor.js');
+} catch (error) {
+  // not built
+}
+try {
+  wasmFactories['image-processor'].plain = require('../../wasm-modules/dist/image-processor.js');
+} catch (error) {
+  // not built
+}
+
+// Pages of compiled photo stacks: A4 in points, turned to suit each image
+const COMPILE_PAGE_SIZE = [595, 842];
+// JPEG quality for PNGs with transparency or interlacing, the only images a
+// compile re-encodes
+const COMPILE_IMAGE_QUALITY = 90;
+
+// Enough of the end of a ZIP to hold its end records and the longest comment
+const ZIP_TAIL_SIZE = 22 + 65535 + 20 + 56;
+
+// Enough of the start of a JPEG to hold the segments before its image data:
+// an Exif block (at most 64KB) and whatever JFIF or profile segments lead it
+const JPEG_HEAD_SIZE = 128 * 1024;
+
+// EXPO_PUBLIC_ZELL_WASM64=1 marks a bundle built from the memory64 modules
+// (`npm run build:wasm64`), as ZELL_WASM64 does for the backend. Pointer
+// arguments are converted by the glue either way; pointers stored in module
+// memory and the pointers a callback receives are 64-bit there.
+const WASM64 = process.env.EXPO_PUBLIC_ZELL_WASM64 === '1';
+
+// Width of a pointer stored in module memory
+const POINTER_SIZE = WASM64 ? 8 : 4;
+
+// Signature of a ZellWriteAt callback: int64 (ctx, int64 offset, data, int64 length)
+const WRITE_AT_SIGNATURE = WASM64 ? 'jpjpj' : 'jijij';
+
+// Smallest module using a SIMD instruction (i8x16.popcnt); engines without
+// 128-bit SIMD reject it
+const WASM_SIMD_PROBE = new Uint8Array([
+  0, 97, 115, 109, 1, 0, 0, 0, 1, 5, 1, 96, 0, 1, 123, 3, 2, 1, 0, 10, 10, 1, 8, 0, 65, 0, 253, 15, 253, 98, 11,
+]);
 
 /**
  * Offline File Processor for ZELL
@@ -37,18 +110,48 @@ class OfflineProcessor {
    */
   static async loadWasmModule(moduleName) {
     try {
-      // In a real implementation, this would load the actual WASM files
-      // For now, we'll use JavaScript fallbacks
+      // Processing still goes through the JavaScript fallbacks; `factory`
+      // instantiates the native build best suited to this engine
       return {
         process: this.getFallbackProcessor(moduleName),
         compress: this.getFallbackCompressor(moduleName),
         merge: this.getFallbackMerger(moduleName),
+        factory: this.selectWasmFactory(moduleName),
       };
     } catch (error) {
       throw new Error(`Failed to load WASM module: ${moduleName}`);
     }
   }
 
+  /**
+   * Whether the engine runs WebAssembly 128-bit SIMD, checked once
+   * @returns {boolean} True when the -msimd128 builds can be used
+   */
+  static supportsWasmSimd() {
+    if (this.wasmSimd === undefined) {
+      try {
+        this.wasmSimd = typeof WebAssembly !== 'undefined' && WebAssembly.validate(WASM_SIMD_PROBE);
+      } catch (error) {
+        this.wasmSimd = false;
+      }
+    }
+    return this.wasmSimd;
+  }
+
+  /**
+   * Pick the build of a module to instantiate: the SIMD one when the engine
+   * supports it and it has been built, the plain one otherwise
+   * @param {string} moduleName - Name of the WASM module
+   * @returns {Function|null} Emscripten module factory, or null when not built
+   */
+  static selectWasmFactory(moduleName) {
+    const builds = wasmFactories[moduleName];
+    if (!builds) {
+      return null;
+    }
+    return (this.supportsWasmSimd() && builds.simd) || builds.plain || null;
+  }
+
   /**
    * Get fallback processor for when WASM is not available
    * @param {string} moduleName - Module name
@@ -129,6 +232,15 @@ class OfflineProcessor {
       
       // Convert base64 to buffer
       const buffer = Buffer.from(fileData, 'base64');
+
+      // A file processed before with the same settings comes from the result cache
+      const cacheKey = ResultCache.keyFor(
+        await this.hashBuffer(buffer), buffer.length, 'convert', targetFormat, compressionLevel);
+      const cached = await ResultCache.lookup(cacheKey);
+      if (cached) {
+        onProgress?.(100);
+        return cached;
+      }
       
       onProgress?.(50);
       
@@ -157,14 +269,17 @@ class OfflineProcessor {
         encoding: FileSystem.EncodingType.Base64,
       });
       
-      onProgress?.(100);
-      
-      return {
+      const result = {
         outputPath,
         originalSize: file.size,
         compressedSize: processedData.length,
         compressionRatio: ((file.size - processedData.length) / file.size * 100).toFixed(2),
       };
+      await ResultCache.store(cacheKey, result);
+      
+      onProgress?.(100);
+      
+      return result;
       
     } catch (error) {
       throw new Error(`Image processing failed: ${error.message}`);
@@ -190,6 +305,15 @@ class OfflineProcessor {
       onProgress?.(30);
       
       const buffer = Buffer.from(fileData, 'base64');
+
+      // A file processed before with the same settings comes from the result cache
+      const cacheKey = ResultCache.keyFor(
+        await this.hashBuffer(buffer), buffer.length, 'convert', targetFormat, compressionLevel);
+      const cached = await ResultCache.lookup(cacheKey);
+      if (cached) {
+        onProgress?.(100);
+        return cached;
+      }
       
       onProgress?.(50);
       
@@ -216,14 +340,17 @@ class OfflineProcessor {
         encoding: FileSystem.EncodingType.Base64,
       });
       
-      onProgress?.(100);
-      
-      return {
+      const result = {
         outputPath,
         originalSize: file.size,
         compressedSize: processedData.length,
         compressionRatio: ((file.size - processedData.length) / file.size * 100).toFixed(2),
       };
+      await ResultCache.store(cacheKey, result);
+      
+      onProgress?.(100);
+      
+      return result;
       
     } catch (error) {
       throw new Error(`Audio processing failed: ${error.message}`);
@@ -249,6 +376,15 @@ class OfflineProcessor {
       onProgress?.(30);
       
       const buffer = Buffer.from(fileData, 'base64');
+
+      // A file processed before with the same settings comes from the result cache
+      const cacheKey = ResultCache.keyFor(
+        await this.hashBuffer(buffer), buffer.length, 'convert', targetFormat, compressionLevel);
+      const cached = await ResultCache.lookup(cacheKey);
+      if (cached) {
+        onProgress?.(100);
+        return cached;
+      }
       
       onProgress?.(50);
       
@@ -278,14 +414,17 @@ class OfflineProcessor {
         encoding: FileSystem.EncodingType.Base64,
       });
       
-      onProgress?.(100);
-      
-      return {
+      const result = {
         outputPath,
         originalSize: file.size,
         compressedSize: processedData.length,
         compressionRatio: ((file.size - processedData.length) / file.size * 100).toFixed(2),
       };
+      await ResultCache.store(cacheKey, result);
+      
+      onProgress?.(100);
+      
+      return result;
       
     } catch (error) {
       throw new Error(`Video processing failed: ${error.message}`);
@@ -311,6 +450,15 @@ class OfflineProcessor {
       onProgress?.(30);
       
       const buffer = Buffer.from(fileData, 'base64');
+
+      // A file processed before with the same settings comes from the result cache
+      const cacheKey = ResultCache.keyFor(
+        await this.hashBuffer(buffer), buffer.length, 'convert', targetFormat, compressionLevel);
+      const cached = await ResultCache.lookup(cacheKey);
+      if (cached) {
+        onProgress?.(100);
+        return cached;
+      }
       
       onProgress?.(50);
       
@@ -334,14 +482,17 @@ class OfflineProcessor {
         encoding: FileSystem.EncodingType.Base64,
       });
       
-      onProgress?.(100);
-      
-      return {
+      const result = {
         outputPath,
         originalSize: file.size,
         compressedSize: processedData.length,
         compressionRatio: ((file.size - processedData.length) / file.size * 100).toFixed(2),
       };
+      await ResultCache.store(cacheKey, result);
+      
+      onProgress?.(100);
+      
+      return result;
       
     } catch (error) {
       throw new Error(`PDF processing failed: ${error.message}`);
@@ -402,6 +553,243 @@ class OfflineProcessor {
     return Buffer.concat(buffers);
   }
 
+  /**
+   * Instantiate the native PDF module once
+   * @returns {Promise<Object|null>} Emscripten module, or null when unavailable
+   */
+  static getPdfModule() {
+    if (!this.pdfModulePromise) {
+      const createPdfProcessor = this.selectWasmFactory('pdf-processor');
+      this.pdfModulePromise = createPdfProcessor
+        ? createPdfProcessor().catch(() => null)
+        : Promise.resolve(null);
+    }
+    return this.pdfModulePromise;
+  }
+
+  /**
+   * Instantiate the native archive module once
+   * @returns {Promise<Object|null>} Emscripten module, or null when unavailable
+   */
+  static getArchiveModule() {
+    if (!this.archiveModulePromise) {
+      const createArchiveProcessor = this.selectWasmFactory('archive-processor');
+      this.archiveModulePromise = createArchiveProcessor
+        ? createArchiveProcessor().catch(() => null)
+        : Promise.resolve(null);
+    }
+    return this.archiveModulePromise;
+  }
+
+  /**
+   * Instantiate the native image module once
+   * @returns {Promise<Object|null>} Emscripten module, or null when unavailable
+   */
+  static getImageModule() {
+    if (!this.imageModulePromise) {
+      const createImageProcessor = this.selectWasmFactory('image-processor');
+      this.imageModulePromise = createImageProcessor
+        ? createImageProcessor().catch(() => null)
+        : Promise.resolve(null);
+    }
+    return this.imageModulePromise;
+  }
+
+  /**
+   * Content hash of a buffer, computed by the native module: the same
+   * 128-bit hash the backend keys its result cache and file_hash with
+   * @param {Buffer} buffer - Data to hash
+   * @returns {Promise<string|null>} Tagged hex digest, or null when the module is unavailable
+   */
+  static async hashBuffer(buffer) {
+    const wasm = await this.getPdfModule();
+    if (!wasm || typeof wasm._zell_hash !== 'function') {
+      return null;
+    }
+    const input = wasm._malloc(Math.max(buffer.length, 1));
+    const digest = wasm._malloc(16);
+    try {
+      if (!input || !digest) {
+        return null;
+      }
+      wasm.HEAPU8.set(buffer, input);
+      if (wasm._zell_hash(input, BigInt(buffer.length), digest) !== 16) {
+        return null;
+      }
+      return `z128-${Buffer.from(wasm.HEAPU8.slice(digest, digest + 16)).toString('hex')}`;
+    } finally {
+      wasm._free(input);
+      wasm._free(digest);
+    }
+  }
+
+  /**
+   * Run a `*_sink` entry point and gather the output it streams back, so no
+   * worst-case output buffer has to be allocated in module memory
+   * @param {Object} wasm - Emscripten module
+   * @param {Function} run - Called with the write_at function pointer; returns the output size
+   * @returns {Buffer|null} Output, or null when the job fails
+   */
+  static collectOutput(wasm, run) {
+    const chunks = [];
+    const writeAt = wasm.addFunction((ctx, offset, data, length) => {
+      const start = Number(data);
+      chunks.push({
+        offset: Number(offset),
+        bytes: Buffer.from(wasm.HEAPU8.slice(start, start + Number(length))),
+      });
+      return length;
+    }, WRITE_AT_SIGNATURE);
+
+    try {
+      const size = Number(run(writeAt));
+      if (size < 0) {
+        return null;
+      }
+      // Writes are positional: a job may start over from offset 0
+      const output = Buffer.alloc(size);
+      chunks.forEach(({ offset, bytes }) => {
+        if (offset < size) {
+          bytes.copy(output, offset, 0, Math.min(bytes.length, size - offset));
+        }
+      });
+      return output;
+    } finally {
+      wasm.removeFunction(writeAt);
+    }
+  }
+
+  /**
+   * Store a pointer in a pointer array in module memory, at the width of the
+   * build (see POINTER_SIZE)
+   * @param {Object} wasm - Emscripten module
+   * @param {number} array - Start of the array, from wasm._malloc(count * POINTER_SIZE)
+   * @param {number} index - Element to set
+   * @param {number} pointer - Pointer to store
+   */
+  static setPointer(wasm, array, index, pointer) {
+    if (POINTER_SIZE === 8) {
+      wasm.HEAP64[array / 8 + index] = BigInt(pointer);
+    } else {
+      wasm.HEAP32[array / 4 + index] = pointer;
+    }
+  }
+
+  /**
+   * Copy buffers into module memory as the multi-input entry points take
+   * them: a table of pointers and a table of int64 sizes. Everything is
+   * freed again once `run` returns.
+   * @param {Object} wasm - Emscripten module
+   * @param {Array<Buffer>} buffers - Inputs
+   * @param {Function} run - Called with the pointer table and the size table
+   * @returns {*} What `run` returns, or null when module memory runs out
+   */
+  static withInputTable(wasm, buffers, run) {
+    const table = wasm._malloc(buffers.length * POINTER_SIZE);
+    const sizes = wasm._malloc(buffers.length * 8);
+    const inputs = [];
+
+    try {
+      if (!table || !sizes) {
+        return null;
+      }
+      for (let i = 0; i < buffers.length; i++) {
+        const pointer = wasm._malloc(buffers[i].length);
+        if (!pointer) {
+          return null;
+        }
+        inputs.push(pointer);
+        // Views are re-read after every allocation since memory may have grown
+        wasm.HEAPU8.set(buffers[i], pointer);
+        this.setPointer(wasm, table, i, pointer);
+        wasm.HEAP64[sizes / 8 + i] = BigInt(buffers[i].length);
+      }
+      return run(table, sizes);
+    } finally {
+      inputs.forEach((pointer) => wasm._free(pointer));
+      wasm._free(sizes);
+      wasm._free(table);
+    }
+  }
+
+
+  /**
+   * Merge PDFs with the native module: one page tree, renumbered objects and
+   * shared fonts/images written once
+   * @param {Array<Buffer>} buffers - PDF files in page order
+   * @returns {Promise<Buffer|null>} Merged PDF, or null if the native path cannot handle it
+   */
+  static async mergePdfsNative(buffers) {
+    const wasm = await this.getPdfModule();
+    if (!wasm) {
+      return null;
+    }
+
+    // The merged file is streamed back instead of sized up front
+    return this.withInputTable(wasm, buffers, (table, sizes) =>
+      this.collectOutput(wasm, (writeAt) =>
+        wasm._merge_pdfs_sink(table, sizes, buffers.length, writeAt, 0)
+      )
+    );
+  }
+
+  /**
+   * Whether a file is a JPEG or PNG, the images a compile embeds as pages
+   * @param {Buffer} buffer - File contents
+   * @returns {boolean} True for JPEG and PNG data
+   */
+  static isPageImage(buffer) {
+    return (buffer.length > 3 && buffer[0] === 0xff && buffer[1] === 0xd8 && buffer[2] === 0xff) ||
+      (buffer.length > 8 && buffer.readUInt32BE(0) === 0x89504e47 && buffer.readUInt32BE(4) === 0x0d0a1a0a);
+  }
+
+  /**
+   * Compile images into a PDF with the native module, one page each. JPEGs
+   * and most PNGs are embedded without being decoded, and the PDF is
+   * streamed back page by page.
+   * @param {Array<Buffer>} buffers - JPEG and PNG files in page order
+   * @returns {Promise<Buffer|null>} PDF, or null if the native path cannot handle it
+   */
+  static async compileImagesNative(buffers) {
+    const wasm = await this.getPdfModule();
+    if (!wasm) {
+      return null;
+    }
+
+    return this.withInputTable(wasm, buffers, (table, sizes) =>
+      this.collectOutput(wasm, (writeAt) =>
+        wasm._images_to_pdf_sink(table, sizes, buffers.length, writeAt, 0,
+          COMPILE_PAGE_SIZE[0], COMPILE_PAGE_SIZE[1], COMPILE_IMAGE_QUALITY)
+      )
+    );
+  }
+
+  static async compileImagesFallback(buffers) {
+    try {
+      const pdf = await PDFDocument.create();
+
+      for (const buffer of buffers) {
+        const image = buffer[0] === 0xff ? await pdf.embedJpg(buffer) : await pdf.embedPng(buffer);
+        // Same layout as the native path: shrink to fit, never enlarge, centered
+        const [shortSide, longSide] = COMPILE_PAGE_SIZE;
+        const [width, height] = image.width > image.height ? [longSide, shortSide] : [shortSide, longSide];
+        const scale = Math.min(1, width / image.width, height / image.height);
+        const { width: drawWidth, height: drawHeight } = image.scale(scale);
+        const page = pdf.addPage([width, height]);
+        page.drawImage(image, {
+          x: (width - drawWidth) / 2,
+          y: (height - drawHeight) / 2,
+          width: drawWidth,
+          height: drawHeight,
+        });
+      }
+
+      return Buffer.from(await pdf.save());
+    } catch (error) {
+      throw new Error(`Image compilation failed: ${error.message}`);
+    }
+  }
+
   static async mergePdfsFallback(buffers) {
     try {
       const mergedPdf = await PDFDocument.create();
@@ -418,6 +806,288 @@ class OfflineProcessor {
     }
   }
 
+  /**
+   * Read part of a file
+   * @param {string} uri - File URI
+   * @param {number} position - First byte
+   * @param {number} length - Number of bytes
+   * @returns {Promise<Buffer>} The bytes
+   */
+  static async readFileRange(uri, position, length) {
+    const data = await FileSystem.readAsStringAsync(uri, {
+      encoding: FileSystem.EncodingType.Base64,
+      position,
+      length,
+    });
+    return Buffer.from(data, 'base64');
+  }
+
+  /**
+   * Open a ZIP with the native reader, reading only the end of the file:
+   * the end records, then the central directory they point to
+   * @param {Object} wasm - Archive module
+   * @param {string} uri - ZIP file URI
+   * @returns {Promise<Object|null>} { archive, directory } to release with closeZip, or null if not a ZIP
+   */
+  static async openZip(wasm, uri) {
+    const { size } = await FileSystem.getInfoAsync(uri);
+    const tailSize = Math.min(size, ZIP_TAIL_SIZE);
+    const tail = await this.readFileRange(uri, size - tailSize, tailSize);
+    const tailPointer = wasm._malloc(Math.max(tailSize, 1));
+    let start = -1;
+    if (tailPointer) {
+      wasm.HEAPU8.set(tail, tailPointer);
+      start = Number(wasm._zip_directory_start(tailPointer, BigInt(tailSize), BigInt(size)));
+      wasm._free(tailPointer);
+    }
+    if (start < 0) {
+      return null;
+    }
+
+    // The index points into these bytes, so they stay until closeZip
+    const bytes = await this.readFileRange(uri, start, size - start);
+    const directory = wasm._malloc(Math.max(bytes.length, 1));
+    if (!directory) {
+      return null;
+    }
+    wasm.HEAPU8.set(bytes, directory);
+    const archive = wasm._zip_open(directory, BigInt(bytes.length), BigInt(size));
+    if (!archive) {
+      wasm._free(directory);
+      return null;
+    }
+    return { archive, directory };
+  }
+
+  static closeZip(wasm, zip) {
+    wasm._zip_close(zip.archive);
+    wasm._free(zip.directory);
+  }
+
+  /**
+   * List the entries of a ZIP. The native reader only reads the central
+   * directory, so large archives list at once.
+   * @param {string} uri - ZIP file URI
+   * @returns {Promise<Array>} Entries with name, size, compressedSize and directory
+   */
+  static async listArchive(uri) {
+    const wasm = await this.getArchiveModule();
+    const zip = wasm ? await this.openZip(wasm, uri) : null;
+    if (!zip) {
+      return this.listArchiveFallback(uri);
+    }
+
+    try {
+      const size = Number(wasm._zip_list(zip.archive, 0, 0n));
+      const pointer = size >= 0 ? wasm._malloc(size) : 0;
+      if (!pointer) {
+        throw new Error('Out of module memory while listing the archive');
+      }
+      try {
+        const length = Number(wasm._zip_list(zip.archive, pointer, BigInt(size)));
+        return JSON.parse(Buffer.from(wasm.HEAPU8.slice(pointer, pointer + length)).toString('utf8'));
+      } finally {
+        wasm._free(pointer);
+      }
+    } finally {
+      this.closeZip(wasm, zip);
+    }
+  }
+
+  static async listArchiveFallback(uri) {
+    const data = await FileSystem.readAsStringAsync(uri, { encoding: FileSystem.EncodingType.Base64 });
+    const zip = await JSZip.loadAsync(data, { base64: true });
+    return Object.values(zip.files).map((entry) => ({
+      name: entry.name,
+      size: entry._data?.uncompressedSize ?? 0,
+      compressedSize: entry._data?.compressedSize ?? 0,
+      directory: entry.dir,
+    }));
+  }
+
+  /**
+   * Extract entries of a ZIP into a directory. With the native reader each
+   * entry's own bytes are read and inflated; the rest of the archive is not
+   * touched.
+   * @param {string} uri - ZIP file URI
+   * @param {Array<string>} names - Entry paths to extract
+   * @param {string} outputDir - Directory URI, ending in '/'
+   * @returns {Promise<Object>} { outputPaths, totalSize }
+   */
+  static async extractArchiveEntries(uri, names, outputDir) {
+    const wasm = await this.getArchiveModule();
+    const zip = wasm ? await this.openZip(wasm, uri) : null;
+    if (!zip) {
+      return this.extractArchiveEntriesFallback(uri, names, outputDir);
+    }
+
+    const outputPaths = [];
+    let totalSize = 0;
+    try {
+      for (const name of names) {
+        const namePointer = wasm._malloc(Buffer.byteLength(name) + 1);
+        if (!namePointer) {
+          throw new Error('Out of module memory while extracting');
+        }
+        wasm.HEAPU8.set(Buffer.from(`${name}\0`, 'utf8'), namePointer);
+        const index = wasm._zip_find(zip.archive, namePointer);
+        wasm._free(namePointer);
+        if (index < 0) {
+          throw new Error(`${name} is not in the archive`);
+        }
+
+        const data = await this.extractZipEntry(wasm, zip, index, uri);
+        const outputPath = this.entryOutputPath(outputDir, name);
+        await FileSystem.makeDirectoryAsync(outputPath.slice(0, outputPath.lastIndexOf('/') + 1), {
+          intermediates: true,
+        }).catch(() => {});
+        await FileSystem.writeAsStringAsync(outputPath, data.toString('base64'), {
+          encoding: FileSystem.EncodingType.Base64,
+        });
+        outputPaths.push(outputPath);
+        totalSize += data.length;
+      }
+    } finally {
+      this.closeZip(wasm, zip);
+    }
+    return { outputPaths, totalSize };
+  }
+
+  /**
+   * Read one entry's bytes from the file and inflate them in module memory
+   * @param {Object} wasm - Archive module
+   * @param {Object} zip - Open archive from openZip
+   * @param {number} index - Entry index
+   * @param {string} uri - ZIP file URI
+   * @returns {Promise<Buffer>} Entry contents
+   */
+  static async extractZipEntry(wasm, zip, index, uri) {
+    const spanPointer = wasm._malloc(8);
+    const offset = Number(wasm._zip_entry_span(zip.archive, index, spanPointer));
+    const spanSize = Number(wasm.HEAP64[spanPointer / 8]);
+    wasm._free(spanPointer);
+    if (offset < 0) {
+      throw new Error('Corrupt archive entry');
+    }
+
+    const span = await this.readFileRange(uri, offset, spanSize);
+    const input = wasm._malloc(Math.max(span.length, 1));
+    if (!input) {
+      throw new Error('Out of module memory while extracting');
+    }
+    let output = 0;
+    try {
+      wasm.HEAPU8.set(span, input);
+      const size = Number(wasm._zip_extract_from(zip.archive, index, input, BigInt(span.length), 0, 0n));
+      if (size <= 0) {
+        if (size < 0) {
+          throw new Error('Corrupt archive entry');
+        }
+        return Buffer.alloc(0);
+      }
+      output = wasm._malloc(size);
+      if (!output) {
+        throw new Error('Out of module memory while extracting');
+      }
+      if (Number(wasm._zip_extract_from(zip.archive, index, input, BigInt(span.length), output, BigInt(size))) !== size) {
+        throw new Error('Archive entry could not be inflated (encrypted, unsupported method or corrupt)');
+      }
+      return Buffer.from(wasm.HEAPU8.slice(output, output + size));
+    } finally {
+      wasm._free(input);
+      wasm._free(output);
+    }
+  }
+
+  /**
+   * Where an extracted entry goes; names that would climb out of the
+   * directory are refused
+   */
+  static entryOutputPath(outputDir, name) {
+    if (name.startsWith('/') || name.split(/[\\/]/).includes('..')) {
+      throw new Error(`Refusing to extract ${name} outside the output directory`);
+    }
+    return `${outputDir}${name}`;
+  }
+
+  static async extractArchiveEntriesFallback(uri, names, outputDir) {
+    const data = await FileSystem.readAsStringAsync(uri, { encoding: FileSystem.EncodingType.Base64 });
+    const zip = await JSZip.loadAsync(data, { base64: true });
+    const outputPaths = [];
+    let totalSize = 0;
+    for (const name of names) {
+      const entry = zip.file(name);
+      if (!entry) {
+        throw new Error(`${name} is not in the archive`);
+      }
+      const contents = await entry.async('base64');
+      const outputPath = this.entryOutputPath(outputDir, name);
+      await FileSystem.makeDirectoryAsync(outputPath.slice(0, outputPath.lastIndexOf('/') + 1), {
+        intermediates: true,
+      }).catch(() => {});
+      await FileSystem.writeAsStringAsync(outputPath, contents, { encoding: FileSystem.EncodingType.Base64 });
+      outputPaths.push(outputPath);
+      totalSize += Buffer.from(contents, 'base64').length;
+    }
+    return { outputPaths, totalSize };
+  }
+
+  /**
+   * A small upright preview of a JPEG photo. Only the head of the file is
+   * read at first, and when its Exif thumbnail is large enough the rest
+   * never is; otherwise the native module decodes the photo at 1/8, 1/4 or
+   * 1/2 scale inside the DCT, without building the full-size image.
+   * @param {string} uri - Image file URI
+   * @param {number} maxSide - Longest side wanted, in pixels
+   * @returns {Promise<string|null>} JPEG data URI, or null for other files or without the native module
+   */
+  static async getImagePreview(uri, maxSide) {
+    const wasm = await this.getImageModule();
+    if (!wasm) {
+      return null;
+    }
+    const { size } = await FileSystem.getInfoAsync(uri);
+    const head = await this.readFileRange(uri, 0, Math.min(size, JPEG_HEAD_SIZE));
+    if (head.length < 4 || head[0] !== 0xff || head[1] !== 0xd8) {
+      return null;
+    }
+
+    let preview = this.makeJpegPreview(wasm, head, maxSide, false);
+    if (!preview) {
+      const data = head.length < size ? await this.readFileRange(uri, 0, size) : head;
+      preview = this.makeJpegPreview(wasm, data, maxSide, true);
+    }
+    return preview ? `data:image/jpeg;base64,${preview.toString('base64')}` : null;
+  }
+
+  /**
+   * Run jpeg_preview over bytes in module memory
+   * @param {Object} wasm - Image module
+   * @param {Buffer} bytes - JPEG data, or its head when decode is false
+   * @param {number} maxSide - Longest side wanted, in pixels
+   * @param {boolean} decode - Decode the photo when its thumbnail will not do
+   * @returns {Buffer|null} Preview JPEG, or null when none was made
+   */
+  static makeJpegPreview(wasm, bytes, maxSide, decode) {
+    // An Exif thumbnail is under 64KB; a decoded preview is a q80 JPEG of
+    // at most maxSide x maxSide pixels
+    const outputSize = 65536 + maxSide * maxSide * 3;
+    const input = wasm._malloc(Math.max(bytes.length, 1));
+    const output = wasm._malloc(outputSize);
+    try {
+      if (!input || !output) {
+        return null;
+      }
+      wasm.HEAPU8.set(bytes, input);
+      const length = Number(wasm._jpeg_preview(input, BigInt(bytes.length), maxSide, decode ? 1 : 0,
+        output, BigInt(outputSize)));
+      return length > 0 ? Buffer.from(wasm.HEAPU8.slice(output, output + length)) : null;
+    } finally {
+      wasm._free(input);
+      wasm._free(output);
+    }
+  }
+
   // Format conversion methods (simplified implementations)
   
   static async convertToJpeg(buffer, compressionLevel) {
@@ -472,14 +1142,39 @@ class OfflineProcessor {
 
   static async convertPdfToText(buffer) {
     try {
-      const pdf = await PDFDocument.load(buffer);
-      // Simplified text extraction
-      return Buffer.from('PDF text extraction not fully implemented in offline mode');
+      const text = await this.extractPdfTextNative(buffer);
+      if (text !== null) {
+        return Buffer.from(text, 'utf8');
+      }
+      await PDFDocument.load(buffer);
+      return Buffer.from('PDF text extraction is not available without the PDF processor module');
     } catch (error) {
       throw new Error(`PDF to text conversion failed: ${error.message}`);
     }
   }
 
+  static async extractPdfTextNative(buffer) {
+    const wasm = await this.getPdfModule();
+    if (!wasm) {
+      return null;
+    }
+
+    const input = wasm._malloc(buffer.length);
+    try {
+      if (!input) {
+        return null;
+      }
+      wasm.HEAPU8.set(buffer, input);
+      // The text is streamed back in chunks, however long it turns out to be
+      const text = this.collectOutput(wasm, (writeAt) =>
+        wasm._extract_pdf_text_sink(input, BigInt(buffer.length), writeAt, 0, 0)
+      );
+      return text ? text.toString('utf8') : null;
+    } finally {
+      wasm._free(input);
+    }
+  }
+
   static async convertPdfToDocx(buffer) {
     try {
       // Simplified PDF to DOCX conversion
@@ -514,7 +1209,11 @@ class OfflineProcessor {
       let mergedData;
       switch (outputFormat.toLowerCase()) {
         case 'pdf':
-          mergedData = await this.mergePdfsFallback(buffers);
+          if (buffers.every((buffer) => this.isPageImage(buffer))) {
+            mergedData = await this.compileImagesNative(buffers) || await this.compileImagesFallback(buffers);
+          } else {
+            mergedData = await this.mergePdfsNative(buffers) || await this.mergePdfsFallback(buffers);
+          }
           break;
         case 'mp3':
         case 'wav':
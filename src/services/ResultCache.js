@@ -0,0 +1,153 @@
+import * as FileSystem from 'expo-file-system';
+import * as SQLite from 'expo-sqlite';
+
+/**
+ * Result Cache for ZELL
+ * Keeps offline processing results by content hash, operation, target
+ * format and level, so processing the same file again returns at once
+ */
+class ResultCache {
+  static db = null;
+
+  // Results live with the app's documents: the OS may purge cacheDirectory
+  static DIRECTORY = `${FileSystem.documentDirectory}results/`;
+
+  // Total size of kept results; least recently used go first
+  static MAX_BYTES = 256 * 1024 * 1024;
+
+  /**
+   * Initialize database
+   */
+  static async initDatabase() {
+    if (!this.db) {
+      this.db = await SQLite.openDatabaseAsync('zell_results.db');
+
+      await this.db.execAsync(`
+        CREATE TABLE IF NOT EXISTS result_cache (
+          cacheKey TEXT PRIMARY KEY,
+          outputPath TEXT NOT NULL,
+          originalSize INTEGER NOT NULL,
+          compressedSize INTEGER NOT NULL,
+          compressionRatio TEXT,
+          lastUsed INTEGER NOT NULL
+        );
+      `);
+      await FileSystem.makeDirectoryAsync(this.DIRECTORY, { intermediates: true }).catch(() => {});
+    }
+  }
+
+  /**
+   * Key of a job, in the same form as the backend's
+   * @param {string|null} contentHash - Hash of the input, e.g. from OfflineProcessor.hashBuffer
+   * @param {number} size - Input size in bytes
+   * @param {string} operation - 'convert', 'compress' or 'merge'
+   * @param {string} targetFormat - Output format
+   * @param {string} level - Compression level
+   * @returns {string|null} Key, or null when the input could not be hashed
+   */
+  static keyFor(contentHash, size, operation, targetFormat, level) {
+    if (!contentHash) {
+      return null;
+    }
+    // The size goes into the key too, as the hash is not cryptographic
+    return [contentHash, size, operation, targetFormat, level]
+      .map((part) => String(part).toLowerCase().replace(/[^a-z0-9-]/g, '_'))
+      .join('.');
+  }
+
+  /**
+   * Get a cached result
+   * @param {string|null} cacheKey - Job key
+   * @returns {Promise<Object|null>} Result as the processors return it, or null on a miss
+   */
+  static async lookup(cacheKey) {
+    if (!cacheKey) {
+      return null;
+    }
+    try {
+      await this.initDatabase();
+      const row = await this.db.getFirstAsync('SELECT * FROM result_cache WHERE cacheKey = ?', [cacheKey]);
+      if (!row) {
+        return null;
+      }
+      const info = await FileSystem.getInfoAsync(row.outputPath);
+      if (!info.exists) {
+        await this.db.runAsync('DELETE FROM result_cache WHERE cacheKey = ?', [cacheKey]);
+        return null;
+      }
+      await this.db.runAsync('UPDATE result_cache SET lastUsed = ? WHERE cacheKey = ?', [Date.now(), cacheKey]);
+      return {
+        outputPath: row.outputPath,
+        originalSize: row.originalSize,
+        compressedSize: row.compressedSize,
+        compressionRatio: row.compressionRatio,
+        cached: true,
+      };
+    } catch (error) {
+      console.warn('Result cache lookup failed:', error);
+      return null;
+    }
+  }
+
+  /**
+   * Keep a fresh result. Failures only cost the cache entry.
+   * @param {string|null} cacheKey - Job key
+   * @param {Object} result - Processing result with outputPath and sizes
+   */
+  static async store(cacheKey, result) {
+    if (!cacheKey || !result?.outputPath) {
+      return;
+    }
+    try {
+      await this.initDatabase();
+      const extension = result.outputPath.split('.').pop();
+      const cachedPath = `${this.DIRECTORY}${cacheKey}.${extension}`;
+      await FileSystem.copyAsync({ from: result.outputPath, to: cachedPath });
+      await this.db.runAsync(
+        `INSERT OR REPLACE INTO result_cache (
+          cacheKey, outputPath, originalSize, compressedSize, compressionRatio, lastUsed
+        ) VALUES (?, ?, ?, ?, ?, ?)`,
+        [
+          cacheKey,
+          cachedPath,
+          result.originalSize,
+          result.compressedSize,
+          String(result.compressionRatio),
+          Date.now(),
+        ]
+      );
+      await this.prune();
+    } catch (error) {
+      console.warn('Result cache store failed:', error);
+    }
+  }
+
+  /**
+   * Drop least recently used results until the cache fits its budget
+   */
+  static async prune() {
+    const rows = await this.db.getAllAsync(
+      'SELECT cacheKey, outputPath, compressedSize FROM result_cache ORDER BY lastUsed DESC'
+    );
+    let total = 0;
+    for (const row of rows) {
+      total += row.compressedSize;
+      if (total > this.MAX_BYTES) {
+        await FileSystem.deleteAsync(row.outputPath, { idempotent: true });
+        await this.db.runAsync('DELETE FROM result_cache WHERE cacheKey = ?', [row.cacheKey]);
+      }
+    }
+  }
+
+  /**
+   * Remove every cached result
+   */
+  static async clear() {
+    await this.initDatabase();
+    await this.db.runAsync('DELETE FROM result_cache');
+    await FileSystem.deleteAsync(this.DIRECTORY, { idempotent: true });
+    await FileSystem.makeDirectoryAsync(this.DIRECTORY, { intermediates: true });
+  }
+}
+
+export default ResultCache;
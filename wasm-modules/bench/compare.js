@@ -0,0 +1,90 @@
+#!/usr/bin/env node
+/**
+ * Compare two zell-bench JSON reports, e.g. a baseline against a change, or
+ * the native build against the WebAssembly one.
+ *
+ *   node bench/compare.js baseline.json current.json [--threshold 10]
+ *
+ * Cases are matched by module, function, variant and corpus size. Exits
+ * with status 1 when any case lost more than the threshold (in percent) of
+ * its throughput, or failed in the current report but not in the baseline.
+ */
+
+const fs = require('fs');
+
+function usage() {
+  console.error('usage: compare.js BASELINE.json CURRENT.json [--threshold PERCENT]');
+  process.exit(2);
+}
+
+const args = process.argv.slice(2);
+let threshold = 10;
+const files = [];
+for (let i = 0; i < args.length; i++) {
+  if (args[i] === '--threshold' && i + 1 < args.length) {
+    threshold = Number(args[++i]);
+  } else {
+    files.push(args[i]);
+  }
+}
+if (files.length !== 2 || !(threshold >= 0)) {
+  usage();
+}
+
+const [baseline, current] = files.map((file) => JSON.parse(fs.readFileSync(file, 'utf8')));
+const key = (result) => [result.module, result.function, result.variant, result.size].join(' ');
+const baselineResults = new Map(baseline.results.map((result) => [key(result), result]));
+
+console.log(`baseline: ${baseline.target}/${baseline.simd}, ${baseline.threads} threads (${files[0]})`);
+console.log(`current:  ${current.target}/${current.simd}, ${current.threads} threads (${files[1]})`);
+console.log('');
+
+let regressions = 0;
+const rows = [];
+current.results.forEach((result) => {
+  const before = baselineResults.get(key(result));
+  if (!before) {
+    return;
+  }
+  if (result.status !== 'ok') {
+    if (before.status === 'ok') {
+      regressions++;
+      rows.push([key(result), before.items_per_s.toFixed(1), result.status, '', 'FAILED']);
+    }
+    return;
+  }
+  if (before.status !== 'ok') {
+    return;
+  }
+
+  const change = (result.items_per_s / before.items_per_s - 1) * 100;
+  const memory = before.peak_memory_kb
+    ? `${((result.peak_memory_kb / before.peak_memory_kb - 1) * 100).toFixed(1)}%`
+    : '';
+  const regressed = change < -threshold;
+  if (regressed) {
+    regressions++;
+  }
+  rows.push([
+    key(result),
+    before.items_per_s.toFixed(1),
+    result.items_per_s.toFixed(1),
+    `${change >= 0 ? '+' : ''}${change.toFixed(1)}%`,
+    `${memory}${regressed ? '  SLOWER' : ''}`,
+  ]);
+});
+
+const widths = [0, 1, 2, 3].map((column) =>
+  Math.max(...rows.map((row) => row[column].length), ['case', 'before/s', 'after/s', 'speed'][column].length)
+);
+const format = (row) =>
+  row.map((cell, column) => (column === 0 ? cell.padEnd(widths[0]) : cell.padStart(widths[column] || 0)))
+    .join('  ');
+console.log(format(['case', 'before/s', 'after/s', 'speed', 'memory']));
+rows.forEach((row) => console.log(format(row)));
+
+console.log('');
+console.log(regressions
+  ? `${regressions} case(s) regressed by more than ${threshold}%`
+  : `no regressions beyond ${threshold}%`);
+process.exit(regressions ? 1 : 0);
@@ -0,0 +1,986 @@
+// Benchmark suite for the ZELL processor modules.
+//
+// One program for both targets: built with a C compiler it measures the
+// native modules (npm run bench:native), built with emcc it runs under node
+// and measures the WebAssembly build (npm run bench:wasm).  Every case runs
+// on a synthetic corpus generated from a fixed seed, so two runs -- or two
+// builds, e.g. with and without -msimd128, or two native kernel levels
+// picked with --cpu -- see identical inputs and their JSON reports can be
+// compared with bench/compare.js.
+//
+// Natively each case runs in a child process, which makes the reported peak
+// memory that case's own maximum resident set.  WebAssembly memory never
+// shrinks, so there the figure is the size of module memory after the case:
+// a high-water mark over the run so far, in case order.
+
+#include "zell-common.h"
+#include "zell-sink.h"
+#include "zell-cpu.h"
+#include "zell-deflate.h"
+#include "image-processor.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdarg.h>
+#include <math.h>
+#include <time.h>
+
+#ifdef __EMSCRIPTEN__
+#include <emscripten/heap.h>
+#else
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#endif
+
+// --- Entry points under test (only the image module has a header) -----------
+
+int64_t process_image(unsigned char*, int64_t, unsigned char*, int64_t, int, int);
+int64_t compress_image(unsigned char*, int64_t, unsigned char*, int64_t, int);
+
+int64_t process_audio(unsigned char*, int64_t, unsigned char*, int64_t, int, int);
+int64_t compress_audio(unsigned char*, int64_t, unsigned char*, int64_t, int);
+int64_t merge_audio(unsigned char**, const int64_t*, int, unsigned char*, int64_t);
+int64_t merge_audio_sink(unsigned char**, const int64_t*, int, ZellWriteAt, void*);
+int64_t trim_audio(unsigned char*, int64_t, unsigned char*, float, float, int, int, int);
+int64_t resample_audio(const int16_t*, int64_t, int, int, int, int16_t*, int64_t);
+int64_t mix_audio(const int16_t**, const int64_t*, const float*, int, int16_t*, int64_t);
+
+int64_t process_video(unsigned char*, int64_t, unsigned char*, int64_t, int, int);
+int64_t compress_video(unsigned char*, int64_t, unsigned char*, int64_t, int);
+int64_t merge_video(unsigned char**, const int64_t*, int, unsigned char*, int64_t);
+int64_t merge_video_sink(unsigned char**, const int64_t*, int, ZellWriteAt, void*);
+int64_t trim_video(unsigned char*, int64_t, unsigned char*, int64_t, int64_t, int64_t);
+int transform_video_frames(unsigned char*, int, int, unsigned char*, int, int, int, int, int);
+int detect_scene_changes(unsigned char*, int, int, int, float, int, int, float*, int);
+
+int64_t compress_pdf(unsigned char*, int64_t, unsigned char*, int64_t, int, int);
+int64_t merge_pdfs(unsigned char**, const int64_t*, int, unsigned char*, int64_t);
+int64_t merge_pdfs_sink(unsigned char**, const int64_t*, int, ZellWriteAt, void*);
+int64_t extract_pdf_text(unsigned char*, int64_t, unsigned char*, int64_t, int);
+int split_pdf(unsigned char*, int64_t, unsigned char**, int64_t*, int, int);
+int pdf_get_page_count(unsigned char*, int64_t);
+int64_t images_to_pdf_sink(unsigned char**, const int64_t*, int, ZellWriteAt, void*, int, int, int);
+
+int zell_hash(const unsigned char*, int64_t, unsigned char*);
+void* zell_hash_create(void);
+int zell_hash_update(void*, const unsigned char*, int64_t);
+int zell_hash_digest(void*, unsigned char*);
+void zell_hash_destroy(void*);
+
+int64_t create_archive_sink(unsigned char**, const int64_t*, const char**, int, ZellWriteAt, void*, int, int, int);
+int choose_codec(const unsigned char*, int64_t, int, int, int*);
+void* zip_open(const unsigned char*, int64_t, int64_t);
+void zip_close(void*);
+int zip_find(void*, const char*);
+int64_t zip_list(void*, unsigned char*, int64_t);
+int64_t zip_extract(void*, int, unsigned char*, int64_t);
+
+// --- Synthetic corpus ----------------------------------------------------------
+
+#define BENCH_SEED 0x5A11u
+#define BENCH_TIERS 3
+#define BENCH_SPLIT_PARTS 4
+#define BENCH_COMPILE_PAGES 32
+#define BENCH_TWO_PI 6.283185307179586
+
+static uint32_t bench_random(uint32_t* state) {
+    uint32_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return *state = x;
+}
+
+// Smooth gradients with a little noise: compresses and resizes like a photo
+static unsigned char* bench_make_pixels(int width, int height, int frames, uint32_t seed) {
+    unsigned char* pixels = (unsigned char*)malloc((size_t)width * height * 3 * frames);
+    if (!pixels) return NULL;
+    uint32_t state = seed;
+    unsigned char* p = pixels;
+    for (int f = 0; f < frames; f++) {
+        // A new shot every 12 frames gives scene detection something to find
+        int shot = f / 12;
+        for (int y = 0; y < height; y++) {
+            for (int x = 0; x < width; x++) {
+                uint32_t noise = bench_random(&state);
+                *p++ = (unsigned char)((x * 255 / width + shot * 85 + (noise & 15)) & 255);
+                *p++ = (unsigned char)((y * 255 / height + f + ((noise >> 8) & 15)) & 255);
+                *p++ = (unsigned char)(((x + y) * 127 / (width + height) + shot * 40 + ((noise >> 16) & 15)) & 255);
+            }
+        }
+    }
+    return pixels;
+}
+
+static unsigned char* bench_make_bytes(int64_t size, uint32_t seed) {
+    unsigned char* bytes = (unsigned char*)malloc((size_t)size);
+    if (!bytes) return NULL;
+    uint32_t state = seed;
+    for (int64_t i = 0; i < size; i++) bytes[i] = (unsigned char)(bench_random(&state) >> 24);
+    return bytes;
+}
+
+// A chord with a slow tremolo and a little noise, interleaved stereo
+static int16_t* bench_make_pcm(int64_t frames, int channels, uint32_t seed) {
+    int16_t* pcm = (int16_t*)malloc(sizeof(int16_t) * (size_t)(frames * channels));
+    if (!pcm) return NULL;
+    uint32_t state = seed;
+    for (int64_t i = 0; i < frames; i++) {
+        double t = (double)i / 44100.0;
+        double v = 0.3 * sin(t * BENCH_TWO_PI * 220.0) + 0.2 * sin(t * BENCH_TWO_PI * 277.2) +
+                   0.2 * sin(t * BENCH_TWO_PI * 329.6);
+        v *= 0.75 + 0.25 * sin(t * BENCH_TWO_PI * 0.5);
+        for (int c = 0; c < channels; c++) {
+            int noise = (int)(bench_random(&state) >> 22) - 512;
+            pcm[i * channels + c] = (int16_t)(v * 30000.0 * (c ? 0.9 : 1.0) + noise);
+        }
+    }
+    return pcm;
+}
+
+typedef struct {
+    char* data;
+    size_t length;
+    size_t capacity;
+} BenchBuffer;
+
+static void bench_append(BenchBuffer* b, const void* bytes, size_t n) {
+    if (b->length + n > b->capacity) {
+        size_t capacity = b->capacity ? b->capacity : 65536;
+        while (capacity < b->length + n) capacity *= 2;
+        char* grown = (char*)realloc(b->data, capacity);
+        if (!grown) abort();
+        b->data = grown;
+        b->capacity = capacity;
+    }
+    memcpy(b->data + b->length, bytes, n);
+    b->length += n;
+}
+
+static void bench_appendf(BenchBuffer* b, const char* format, ...) __attribute__((format(printf, 2, 3)));
+
+static void bench_appendf(BenchBuffer* b, const char* format, ...) {
+    char text[512];
+    va_list args;
+    va_start(args, format);
+    int n = vsnprintf(text, sizeof(text), format, args);
+    va_end(args);
+    if (n > 0) bench_append(b, text, (size_t)n < sizeof(text) ? (size_t)n : sizeof(text) - 1);
+}
+
+static void bench_append_stream(BenchBuffer* b, int num, const char* dict, const unsigned char* data,
+                                size_t size, int64_t* offsets) {
+    unsigned char* packed = (unsigned char*)malloc(zell_deflate_bound(size));
+    int64_t packed_size = packed ? zell_deflate(data, size, ZELL_DEFLATE_DEFAULT, ZELL_DEFLATE_ZLIB, packed,
+                                                zell_deflate_bound(size)) : -1;
+    if (packed_size < 0) abort();
+    offsets[num] = (int64_t)b->length;
+    bench_appendf(b, "%d 0 obj\n<<%s/Filter/FlateDecode/Length %lld>>\nstream\n", num, dict,
+                  (long long)packed_size);
+    bench_append(b, packed, (size_t)packed_size);
+    bench_appendf(b, "\nendstream\nendobj\n");
+    free(packed);
+}
+
+// A text document with a 300 dpi photo on every tenth page
+static unsigned char* bench_make_pdf(int pages, uint32_t seed, int64_t* size) {
+    static const char* const words[] = {
+        "offline", "archive", "document", "compress", "stream", "page", "image", "audio",
+        "video", "merge", "split", "extract", "quality", "format", "convert", "process",
+        "the", "of", "and", "to", "in", "is", "for", "with", "on", "that", "by", "this",
+        "buffer", "memory", "thread", "worker", "output", "input", "module", "native",
+    };
+    const int word_count = (int)(sizeof(words) / sizeof(words[0]));
+    const int object_count = 5 + pages * 2;
+    int64_t* offsets = (int64_t*)calloc((size_t)object_count, sizeof(int64_t));
+    BenchBuffer b = { NULL, 0, 0 };
+    BenchBuffer text = { NULL, 0, 0 };
+    uint32_t state = seed;
+    if (!offsets) abort();
+
+    bench_appendf(&b, "%%PDF-1.5\n%%\xE2\xE3\xCF\xD3\n");
+    offsets[1] = (int64_t)b.length;
+    bench_appendf(&b, "1 0 obj\n<</Type/Catalog/Pages 2 0 R>>\nendobj\n");
+    offsets[2] = (int64_t)b.length;
+    bench_appendf(&b, "2 0 obj\n<</Type/Pages/Count %d/Kids[", pages);
+    for (int i = 0; i < pages; i++) bench_appendf(&b, "%d 0 R ", 5 + i * 2);
+    bench_appendf(&b, "]>>\nendobj\n");
+    offsets[3] = (int64_t)b.length;
+    bench_appendf(&b, "3 0 obj\n<</Type/Font/Subtype/Type1/BaseFont/Helvetica/Encoding/WinAnsiEncoding>>\nendobj\n");
+
+    unsigned char* photo = bench_make_pixels(600, 600, 1, seed ^ 0x9E37u);
+    if (!photo) abort();
+    bench_append_stream(&b, 4, "/Type/XObject/Subtype/Image/Width 600/Height 600/ColorSpace/DeviceRGB/BitsPerComponent 8",
+                        photo, 600 * 600 * 3, offsets);
+    free(photo);
+
+    for (int i = 0; i < pages; i++) {
+        int page_num = 5 + i * 2;
+        offsets[page_num] = (int64_t)b.length;
+        bench_appendf(&b, "%d 0 obj\n<</Type/Page/Parent 2 0 R/MediaBox[0 0 612 792]"
+                      "/Resources<</Font<</F1 3 0 R>>/XObject<</Im1 4 0 R>>>>/Contents %d 0 R>>\nendobj\n",
+                      page_num, page_num + 1);
+
+        text.length = 0;
+        bench_appendf(&text, "BT /F1 11 Tf 14 TL 72 740 Td\n");
+        for (int line = 0; line < 45; line++) {
+            bench_appendf(&text, "(");
+            for (int w = 0; w < 11; w++) {
+                bench_appendf(&text, w ? " %s" : "%s", words[bench_random(&state) % (uint32_t)word_count]);
+            }
+            bench_appendf(&text, ") Tj T*\n");
+        }
+        bench_appendf(&text, "ET\n");
+        if (i % 10 == 0) bench_appendf(&text, "q 144 0 0 144 396 36 cm /Im1 Do Q\n");
+        bench_append_stream(&b, page_num + 1, "", (const unsigned char*)text.data, text.length, offsets);
+    }
+
+    int64_t xref = (int64_t)b.length;
+    bench_appendf(&b, "xref\n0 %d\n0000000000 65535 f \n", object_count);
+    for (int i = 1; i < object_count; i++) bench_appendf(&b, "%010lld 00000 n \n", (long long)offsets[i]);
+    bench_appendf(&b, "trailer\n<</Size %d/Root 1 0 R>>\nstartxref\n%lld\n%%%%EOF\n", object_count, (long long)xref);
+
+    free(text.data);
+    free(offsets);
+    *size = (int64_t)b.length;
+    return (unsigned char*)b.data;
+}
+
+// --- Cases -------------------------------------------------------------------------
+
+typedef struct {
+    unsigned char* input;
+    int64_t input_size;
+    unsigned char* input2;
+    int64_t input2_size;
+    unsigned char* output;
+    int64_t output_size;
+    int16_t* tracks[4];
+    unsigned char* parts[BENCH_SPLIT_PARTS];
+    int64_t part_sizes[BENCH_SPLIT_PARTS];
+    int width, height, out_width, out_height, frames, channels;
+    int param;          // per case: thread count, pixel format, track count
+    int64_t bytes;      // bytes one run consumes
+    int64_t items;      // units one run processes
+    char size_label[32];
+} BenchJob;
+
+typedef struct {
+    const char* module;
+    const char* function;
+    const char* variant;
+    const char* unit;
+    int (*setup)(BenchJob* job, int tier);
+    int (*run)(BenchJob* job);
+    int param;
+} BenchCase;
+
+static int64_t bench_null_write(void* ctx, int64_t offset, const unsigned char* data, int64_t length) {
+    (void)ctx; (void)offset; (void)data;
+    return length;
+}
+
+static void bench_job_free(BenchJob* job) {
+    free(job->input);
+    free(job->input2);
+    free(job->output);
+    for (int i = 0; i < 4; i++) free(job->tracks[i]);
+    for (int i = 0; i < BENCH_SPLIT_PARTS; i++) free(job->parts[i]);
+}
+
+// Images: VGA, 1080p and 4K RGB, halved by the resize cases
+static int setup_image(BenchJob* job, int tier) {
+    static const int widths[BENCH_TIERS] = { 640, 1920, 3840 };
+    static const int heights[BENCH_TIERS] = { 480, 1080, 2160 };
+    job->width = widths[tier];
+    job->height = heights[tier];
+    job->out_width = job->width / 2;
+    job->out_height = job->height / 2;
+    job->channels = 3;
+    job->input_size = (int64_t)job->width * job->height * 3;
+    job->input = bench_make_pixels(job->width, job->height, 1, BENCH_SEED);
+    job->output_size = job->input_size;
+    job->output = (unsigned char*)malloc((size_t)job->output_size);
+    if (!job->input || !job->output) return -1;
+
+    // Decoding and the byte-stream entry points work on the encoded image
+    job->input2 = (unsigned char*)malloc((size_t)job->input_size);
+    if (!job->input2) return -1;
+    job->input2_size = encode_jpeg(job->input, job->width, job->height, 3, 85, job->input2, job->input_size);
+    if (job->input2_size <= 0) return -1;
+
+    job->bytes = job->input_size;
+    job->items = (int64_t)job->width * job->height;
+    snprintf(job->size_label, sizeof(job->size_label), "%dx%d", job->width, job->height);
+    return 0;
+}
+
+// Screenshots: flat panels, window borders and rows of glyph-like strokes,
+// stored as plainly filtered PNGs for the optimizer
+static int setup_screenshot(BenchJob* job, int tier) {
+    static const int widths[BENCH_TIERS] = { 640, 1920, 3840 };
+    static const int heights[BENCH_TIERS] = { 480, 1080, 2160 };
+    static const unsigned char colors[6][3] = {
+        { 246, 246, 248 }, { 32, 33, 36 }, { 26, 115, 232 }, { 218, 220, 224 }, { 255, 255, 255 }, { 95, 99, 104 },
+    };
+    job->width = widths[tier];
+    job->height = heights[tier];
+    job->input_size = (int64_t)job->width * job->height * 3;
+    job->input = (unsigned char*)malloc((size_t)job->input_size);
+    job->output_size = job->input_size * 2;
+    job->output = (unsigned char*)malloc((size_t)job->output_size);
+    job->input2 = (unsigned char*)malloc((size_t)job->output_size);
+    if (!job->input || !job->output || !job->input2) return -1;
+
+    uint32_t state = BENCH_SEED;
+    unsigned char* p = job->input;
+    for (int y = 0; y < job->height; y++) {
+        for (int x = 0; x < job->width; x++, p += 3) {
+            int panel = x < job->width / 5 ? 3 : y < 48 ? 2 : 0;
+            int border = x == job->width / 5 || y == 48;
+            // Text: 12px lines of 7px cells, some lit pixels in each cell
+            int line = (y - 64) / 20, in_text = y >= 64 && (y - 64) % 20 < 12 && x > job->width / 5 + 16;
+            int lit = in_text && line % 7 != 6 && (bench_random(&state) >> 29) < 3 && (x / 7 + line) % 11 != 0;
+            const unsigned char* c = colors[border ? 5 : lit ? 1 : panel];
+            // Antialiased edges give the text a few in-between shades
+            int shade = lit && (x & 1) ? 40 : 0;
+            p[0] = (unsigned char)(c[0] + shade);
+            p[1] = (unsigned char)(c[1] + shade);
+            p[2] = (unsigned char)(c[2] + shade);
+        }
+    }
+    job->input2_size = encode_png(job->input, job->width, job->height, 3, 6, job->input2, job->output_size);
+    if (job->input2_size <= 0) return -1;
+
+    job->bytes = job->input2_size;
+    job->items = (int64_t)job->width * job->height;
+    snprintf(job->size_label, sizeof(job->size_label), "%dx%d", job->width, job->height);
+    return 0;
+}
+
+static int run_resize_image(BenchJob* job) {
+    return resize_image(job->input, job->width, job->height, job->output,
+                        job->out_width, job->out_height, 3);
+}
+
+static int run_encode_jpeg(BenchJob* job) {
+    return encode_jpeg(job->input, job->width, job->height, 3, 75, job->output, job->output_size) > 0 ? 0 : -1;
+}
+
+static int run_encode_png(BenchJob* job) {
+    return encode_png(job->input, job->width, job->height, 3, -1, job->output, job->output_size) > 0 ? 0 : -1;
+}
+
+static int run_encode_jpeg_target(BenchJob* job) {
+    return encode_jpeg_target(job->input, job->width, job->height, 3, 0.99, job->output, job->output_size,
+                              NULL) > 0 ? 0 : -1;
+}
+
+static int run_decode_jpeg(BenchJob* job) {
+    int width, height, channels;
+    job->bytes = job->input2_size;
+    unsigned char* pixels = decode_jpeg(job->input2, job->input2_size, &width, &height, &channels);
+    free(pixels);
+    return pixels ? 0 : -1;
+}
+
+static int run_decode_jpeg_scaled(BenchJob* job) {
+    int width, height, channels;
+    job->bytes = job->input2_size;
+    unsigned char* pixels = decode_jpeg_scaled(job->input2, job->input2_size, 8, &width, &height, &channels);
+    free(pixels);
+    return pixels ? 0 : -1;
+}
+
+static int run_jpeg_preview(BenchJob* job) {
+    job->bytes = job->input2_size;
+    return jpeg_preview(job->input2, job->input2_size, 256, 1, job->output, job->output_size) > 0 ? 0 : -1;
+}
+
+static int run_process_image(BenchJob* job) {
+    job->bytes = job->input2_size;
+    return process_image(job->input2, job->input2_size, job->output, job->output_size, 75, 0) < 0 ? -1 : 0;
+}
+
+static int run_optimize_png(BenchJob* job) {
+    return process_image(job->input2, job->input2_size, job->output, job->output_size, 100, 1) < 0 ? -1 : 0;
+}
+
+static int run_palette_png(BenchJob* job) {
+    return process_image(job->input2, job->input2_size, job->output, job->output_size, 75, 1) < 0 ? -1 : 0;
+}
+
+static int run_quantize_image(BenchJob* job) {
+    unsigned char palette[256 * 4];
+    return quantize_image(job->input, job->width, job->height, 3, 256, 1, palette, job->output) < 0 ? -1 : 0;
+}
+
+static int run_encode_gif(BenchJob* job) {
+    return encode_gif(job->input, job->width, job->height, 3, 256, 1, job->output, job->output_size) > 0 ? 0 : -1;
+}
+
+static int run_decode_png(BenchJob* job) {
+    int width, height, channels;
+    unsigned char* pixels = decode_png(job->input2, job->input2_size, &width, &height, &channels);
+    free(pixels);
+    return pixels ? 0 : -1;
+}
+
+static int run_compress_image(BenchJob* job) {
+    job->bytes = job->input2_size;
+    return compress_image(job->input2, job->input2_size, job->output, job->output_size, 75) < 0 ? -1 : 0;
+}
+
+// Video: 240p, 720p and 1080p RGB frame batches, halved by the transform cases
+static int setup_video(BenchJob* job, int tier) {
+    static const int widths[BENCH_TIERS] = { 320, 1280, 1920 };
+    static const int heights[BENCH_TIERS] = { 240, 720, 1080 };
+    static const int frames[BENCH_TIERS] = { 60, 30, 16 };
+    job->width = widths[tier];
+    job->height = heights[tier];
+    job->frames = frames[tier];
+    job->out_width = job->width / 2;
+    job->out_height = job->height / 2;
+    job->input_size = (int64_t)job->width * job->height * 3 * job->frames;
+    job->input = bench_make_pixels(job->width, job->height, job->frames, BENCH_SEED);
+    job->output_size = (int64_t)job->out_width * job->out_height * 3 * job->frames;
+    job->output = (unsigned char*)malloc((size_t)job->output_size);
+    if (!job->input || !job->output) return -1;
+
+    job->bytes = job->input_size;
+    job->items = job->frames;
+    snprintf(job->size_label, sizeof(job->size_label), "%dx%dx%d", job->width, job->height, job->frames);
+    return 0;
+}
+
+static int run_transform_video(BenchJob* job) {
+    int format = job->param & 1;    // 0 = RGB24 resize, 1 = I420 conversion
+    int threads = job->param >> 1;  // 0 = one per core
+    return transform_video_frames(job->input, job->width, job->height, job->output,
+                                  job->out_width, job->out_height, job->frames, format, threads);
+}
+
+static int run_detect_scenes(BenchJob* job) {
+    float cuts[64];
+    return detect_scene_changes(job->input, job->width, job->height, job->frames, 30.0f, 1, 50, cuts, 64) < 0 ? -1 : 0;
+}
+
+// Byte streams (container-level trim/merge and the stub codecs): 1, 16 and 64MB
+static int setup_stream(BenchJob* job, int tier) {
+    static const int64_t sizes[BENCH_TIERS] = { (int64_t)1 << 20, (int64_t)16 << 20, (int64_t)64 << 20 };
+    job->input_size = sizes[tier];
+    job->input = bench_make_bytes(job->input_size, BENCH_SEED);
+    job->input2_size = job->input_size / 2;
+    job->input2 = bench_make_bytes(job->input2_size, BENCH_SEED + 1);
+    job->output_size = job->input_size + job->input2_size;
+    job->output = (unsigned char*)malloc((size_t)job->output_size);
+    if (!job->input || !job->input2 || !job->output) return -1;
+
+    job->bytes = job->input_size;
+    job->items = job->input_size;
+    snprintf(job->size_label, sizeof(job->size_label), "%lldMB", (long long)(job->input_size >> 20));
+    return 0;
+}
+
+static int run_merge_streams(BenchJob* job) {
+    unsigned char* files[2] = { job->input, job->input2 };
+    int64_t sizes[2] = { job->input_size, job->input2_size };
+    int64_t result;
+    job->bytes = job->items = job->input_size + job->input2_size;
+    switch (job->param) {
+    case 0: result = merge_video(files, sizes, 2, job->output, job->output_size); break;
+    case 1: result = merge_video_sink(files, sizes, 2, bench_null_write, NULL); break;
+    case 2: result = merge_audio(files, sizes, 2, job->output, job->output_size); break;
+    default: result = merge_audio_sink(files, sizes, 2, bench_null_write, NULL); break;
+    }
+    return result == job->output_size ? 0 : -1;
+}
+
+static int run_trim_video(BenchJob* job) {
+    // The middle half, in 4KB "frames"
+    int64_t frames = job->input_size / 4096;
+    return trim_video(job->input, job->input_size, job->output, frames / 4, frames / 2, 4096) < 0 ? -1 : 0;
+}
+
+static int run_stream_codec(BenchJob* job) {
+    int64_t result;
+    switch (job->param) {
+    case 0: result = process_video(job->input, job->input_size, job->output, job->output_size, 75, 0); break;
+    case 1: result = compress_video(job->input, job->input_size, job->output, job->output_size, 75); break;
+    case 2: result = process_audio(job->input, job->input_size, job->output, job->output_size, 75, 0); break;
+    default: result = compress_audio(job->input, job->input_size, job->output, job->output_size, 75); break;
+    }
+    return result < 0 ? -1 : 0;
+}
+
+// Audio: 10 seconds, 1 minute and 3 minutes of 44.1kHz stereo
+static int setup_audio(BenchJob* job, int tier) {
+    static const int seconds[BENCH_TIERS] = { 10, 60, 180 };
+    int tracks = job->param > 1 ? job->param : 1;
+    job->channels = 2;
+    job->frames = seconds[tier] * 44100;
+    for (int i = 0; i < tracks; i++) {
+        job->tracks[i] = bench_make_pcm(job->frames, job->channels, BENCH_SEED + (uint32_t)i);
+        if (!job->tracks[i]) return -1;
+    }
+    // 48kHz output is the largest any audio case writes
+    job->output_size = (int64_t)job->frames * 48000 / 44100 * job->channels * 2 + 16;
+    job->output = (unsigned char*)malloc((size_t)job->output_size);
+    if (!job->output) return -1;
+
+    job->bytes = (int64_t)job->frames * job->channels * 2 * tracks;
+    job->items = job->frames;
+    snprintf(job->size_label, sizeof(job->size_label), "%ds", seconds[tier]);
+    return 0;
+}
+
+static int run_resample_audio(BenchJob* job) {
+    int64_t capacity = job->output_size / (2 * job->channels);
+    return resample_audio(job->tracks[0], job->frames, job->channels, 44100, 48000,
+                          (int16_t*)job->output, capacity) < 0 ? -1 : 0;
+}
+
+static int run_mix_audio(BenchJob* job) {
+    const int16_t* tracks[4] = { job->tracks[0], job->tracks[1], job->tracks[2], job->tracks[3] };
+    int64_t samples = (int64_t)job->frames * job->channels;
+    int64_t lengths[4] = { samples, samples, samples, samples };
+    float gains[4] = { 0.5f, 0.4f, 0.3f, 0.2f };
+    return mix_audio(tracks, lengths, gains, job->param, (int16_t*)job->output,
+                     job->output_size / 2) < 0 ? -1 : 0;
+}
+
+static int run_trim_audio(BenchJob* job) {
+    // The middle half of the clip
+    float seconds = (float)job->frames / 44100.0f;
+    return trim_audio((unsigned char*)job->tracks[0], (int64_t)job->frames * job->channels * 2, job->output,
+                      seconds / 4, seconds / 2, 44100, job->channels, 16) < 0 ? -1 : 0;
+}
+
+// PDF: 10, 100 and 1000 page documents
+static int setup_pdf(BenchJob* job, int tier) {
+    static const int pages[BENCH_TIERS] = { 10, 100, 1000 };
+    job->frames = pages[tier];
+    job->input = bench_make_pdf(pages[tier], BENCH_SEED, &job->input_size);
+    job->input2 = bench_make_pdf(pages[tier], BENCH_SEED + 1, &job->input2_size);
+    job->output_size = (job->input_size + job->input2_size) * 2 + 65536;
+    job->output = (unsigned char*)malloc((size_t)job->output_size);
+    for (int i = 0; i < BENCH_SPLIT_PARTS; i++) {
+        job->part_sizes[i] = job->input_size + 65536;
+        job->parts[i] = (unsigned char*)malloc((size_t)job->part_sizes[i]);
+        if (!job->parts[i]) return -1;
+    }
+    if (!job->input || !job->input2 || !job->output) return -1;
+
+    job->bytes = job->input_size;
+    job->items = pages[tier];
+    snprintf(job->size_label, sizeof(job->size_label), "%dp", pages[tier]);
+    return 0;
+}
+
+static int run_pdf_page_count(BenchJob* job) {
+    return pdf_get_page_count(job->input, job->input_size) == job->frames ? 0 : -1;
+}
+
+static int run_extract_pdf_text(BenchJob* job) {
+    return extract_pdf_text(job->input, job->input_size, job->output, job->output_size, job->param) <= 0 ? -1 : 0;
+}
+
+static int run_merge_pdfs(BenchJob* job) {
+    unsigned char* files[2] = { job->input, job->input2 };
+    int64_t sizes[2] = { job->input_size, job->input2_size };
+    job->bytes = job->input_size + job->input2_size;
+    job->items = job->frames * 2;
+    int64_t result = job->param
+        ? merge_pdfs_sink(files, sizes, 2, bench_null_write, NULL)
+        : merge_pdfs(files, sizes, 2, job->output, job->output_size);
+    return result > 0 ? 0 : -1;
+}
+
+static int run_compress_pdf(BenchJob* job) {
+    return compress_pdf(job->input, job->input_size, job->output, job->output_size, 75, 150) > 0 ? 0 : -1;
+}
+
+static int run_split_pdf(BenchJob* job) {
+    int64_t sizes[BENCH_SPLIT_PARTS];
+    memcpy(sizes, job->part_sizes, sizeof(sizes));
+    return split_pdf(job->input, job->input_size, job->parts, sizes, BENCH_SPLIT_PARTS, BENCH_SPLIT_PARTS);
+}
+
+// A photo stack: the image tier's JPEG on every page
+static int run_images_to_pdf(BenchJob* job) {
+    unsigned char* images[BENCH_COMPILE_PAGES];
+    int64_t sizes[BENCH_COMPILE_PAGES];
+    for (int i = 0; i < BENCH_COMPILE_PAGES; i++) {
+        images[i] = job->input2;
+        sizes[i] = job->input2_size;
+    }
+    job->bytes = job->input2_size * BENCH_COMPILE_PAGES;
+    job->items = BENCH_COMPILE_PAGES;
+    return images_to_pdf_sink(images, sizes, BENCH_COMPILE_PAGES, bench_null_write, NULL, 595, 842, 85) > job->bytes
+        ? 0 : -1;
+}
+
+// The stream tier hashed in one call, or fed in 64KB chunks like an upload
+static int run_hash(BenchJob* job) {
+    unsigned char digest[16];
+    if (!job->param) return zell_hash(job->input, job->input_size, digest) == 16 ? 0 : -1;
+
+    void* state = zell_hash_create();
+    if (!state) return -1;
+    int result = 0;
+    for (int64_t offset = 0; offset < job->input_size && result == 0; offset += 65536) {
+        int64_t length = job->input_size - offset < 65536 ? job->input_size - offset : 65536;
+        result = zell_hash_update(state, job->input + offset, length);
+    }
+    if (result == 0 && zell_hash_digest(state, digest) != 16) result = -1;
+    zell_hash_destroy(state);
+    return result;
+}
+
+// The PDF tier's two documents as one archive: text-heavy, so deflate does real work
+static int run_create_archive(BenchJob* job) {
+    unsigned char* files[2] = { job->input, job->input2 };
+    int64_t sizes[2] = { job->input_size, job->input2_size };
+    const char* names[2] = { "docs/a.pdf", "docs/b.pdf" };
+    job->bytes = job->input_size + job->input2_size;
+    job->items = job->bytes;
+    return create_archive_sink(files, sizes, names, 2, bench_null_write, NULL, job->param & 3, 6, job->param >> 2) > 0
+        ? 0 : -1;
+}
+
+// Codec choice for one document at a target speed in MB/s
+static int run_choose_codec(BenchJob* job) {
+    int level;
+    job->bytes = job->input_size;
+    job->items = job->bytes;
+    return choose_codec(job->input, job->input_size, job->param, 0, &level) >= 0 ? 0 : -1;
+}
+
+// ZIP reading: archives of 1k, 10k and 50k small text files, built once
+static int64_t bench_buffer_write(void* ctx, int64_t offset, const unsigned char* data, int64_t length) {
+    BenchBuffer* b = (BenchBuffer*)ctx;
+    if ((size_t)offset != b->length) return -1;
+    bench_append(b, data, (size_t)length);
+    return length;
+}
+
+static int setup_zip(BenchJob* job, int tier) {
+    static const int counts[BENCH_TIERS] = { 1000, 10000, 50000 };
+    int count = counts[tier];
+    unsigned char** files = (unsigned char**)malloc(sizeof(unsigned char*) * (size_t)count);
+    int64_t* sizes = (int64_t*)malloc(sizeof(int64_t) * (size_t)count);
+    char** names = (char**)malloc(sizeof(char*) * (size_t)count);
+    unsigned char* text = bench_make_pdf(1, BENCH_SEED, &job->input2_size);
+    BenchBuffer archive = { NULL, 0, 0 };
+    int status = -1;
+    if (files && sizes && names && text) {
+        uint32_t state = BENCH_SEED;
+        for (int i = 0; i < count; i++) {
+            // Slices of a PDF, which is text with some deflated streams
+            sizes[i] = 256 + bench_random(&state) % 4096;
+            files[i] = text + bench_random(&state) % (uint32_t)(job->input2_size - sizes[i]);
+            names[i] = (char*)malloc(48);
+            if (names[i]) snprintf(names[i], 48, "folder_%d/file_%d.txt", i % 64, i);
+        }
+        if (create_archive_sink(files, sizes, (const char**)names, count, bench_buffer_write, &archive, 0, 6, 0) > 0) {
+            status = 0;
+        }
+        for (int i = 0; i < count; i++) free(names[i]);
+    }
+    free(files);
+    free(sizes);
+    free(names);
+    free(text);
+    if (status != 0) return -1;
+
+    job->input = (unsigned char*)archive.data;
+    job->input_size = (int64_t)archive.length;
+    job->frames = count;
+    void* zip = zip_open(job->input, job->input_size, job->input_size);
+    job->output_size = zip ? zip_list(zip, NULL, 0) : -1;
+    zip_close(zip);
+    if (job->output_size < 4096) job->output_size = 4096;  // also holds any one entry
+    job->output = (unsigned char*)malloc((size_t)job->output_size);
+    if (!job->output) return -1;
+
+    job->bytes = job->input_size;
+    job->items = count;
+    snprintf(job->size_label, sizeof(job->size_label), "%dk_entries", count / 1000);
+    return 0;
+}
+
+// Open and list the whole archive, or open and extract the middle entry
+static int run_zip_read(BenchJob* job) {
+    void* zip = zip_open(job->input, job->input_size, job->input_size);
+    if (!zip) return -1;
+    int64_t result;
+    if (job->param) {
+        char name[48];
+        snprintf(name, sizeof(name), "folder_%d/file_%d.txt", (job->frames / 2) % 64, job->frames / 2);
+        result = zip_extract(zip, zip_find(zip, name), job->output, job->output_size);
+    } else {
+        result = zip_list(zip, job->output, job->output_size);
+    }
+    zip_close(zip);
+    return result > 0 ? 0 : -1;
+}
+
+#define TRANSFORM(format, threads) ((format) | (threads) << 1)
+#define ARCHIVE(format, threads) ((format) | (threads) << 2)
+
+static const BenchCase bench_cases[] = {
+    { "image", "resize_image", "rgb", "pixels", setup_image, run_resize_image, 0 },
+    { "image", "encode_jpeg", "q75", "pixels", setup_image, run_encode_jpeg, 0 },
+    { "image", "encode_png", "default", "pixels", setup_image, run_encode_png, 0 },
+    { "image", "encode_jpeg_target", "ssim99", "pixels", setup_image, run_encode_jpeg_target, 0 },
+    { "image", "decode_jpeg", "q85", "pixels", setup_image, run_decode_jpeg, 0 },
+    { "image", "decode_jpeg_scaled", "q85,eighth", "pixels", setup_image, run_decode_jpeg_scaled, 0 },
+    { "image", "jpeg_preview", "q85,256", "pixels", setup_image, run_jpeg_preview, 0 },
+    { "image", "process_image", "jpeg", "pixels", setup_image, run_process_image, 0 },
+    { "image", "compress_image", "q75", "pixels", setup_image, run_compress_image, 0 },
+    { "image", "process_image", "png,screenshot", "pixels", setup_screenshot, run_optimize_png, 0 },
+    { "image", "decode_png", "screenshot", "pixels", setup_screenshot, run_decode_png, 0 },
+    { "image", "process_image", "png8,screenshot", "pixels", setup_screenshot, run_palette_png, 0 },
+    { "image", "quantize_image", "256,floyd", "pixels", setup_image, run_quantize_image, 0 },
+    { "image", "encode_gif", "256,floyd", "pixels", setup_image, run_encode_gif, 0 },
+
+    { "video", "transform_video_frames", "resize,threads=1", "frames", setup_video, run_transform_video, TRANSFORM(0, 1) },
+    { "video", "transform_video_frames", "resize,threads=auto", "frames", setup_video, run_transform_video, TRANSFORM(0, 0) },
+    { "video", "transform_video_frames", "i420,threads=1", "frames", setup_video, run_transform_video, TRANSFORM(1, 1) },
+    { "video", "transform_video_frames", "i420,threads=auto", "frames", setup_video, run_transform_video, TRANSFORM(1, 0) },
+    { "video", "detect_scene_changes", "rgb", "frames", setup_video, run_detect_scenes, 0 },
+    { "video", "trim_video", "half", "bytes", setup_stream, run_trim_video, 0 },
+    { "video", "merge_video", "buffer", "bytes", setup_stream, run_merge_streams, 0 },
+    { "video", "merge_video_sink", "sink", "bytes", setup_stream, run_merge_streams, 1 },
+    { "video", "process_video", "mp4", "bytes", setup_stream, run_stream_codec, 0 },
+    { "video", "compress_video", "q75", "bytes", setup_stream, run_stream_codec, 1 },
+
+    { "audio", "resample_audio", "44100->48000", "sample_frames", setup_audio, run_resample_audio, 1 },
+    { "audio", "mix_audio", "4_tracks", "sample_frames", setup_audio, run_mix_audio, 4 },
+    { "audio", "trim_audio", "half", "sample_frames", setup_audio, run_trim_audio, 1 },
+    { "audio", "merge_audio", "buffer", "bytes", setup_stream, run_merge_streams, 2 },
+    { "audio", "merge_audio_sink", "sink", "bytes", setup_stream, run_merge_streams, 3 },
+    { "audio", "process_audio", "mp3", "bytes", setup_stream, run_stream_codec, 2 },
+    { "audio", "compress_audio", "q75", "bytes", setup_stream, run_stream_codec, 3 },
+
+    { "pdf", "pdf_get_page_count", "buffer", "pages", setup_pdf, run_pdf_page_count, 0 },
+    { "pdf", "extract_pdf_text", "threads=1", "pages", setup_pdf, run_extract_pdf_text, 1 },
+    { "pdf", "extract_pdf_text", "threads=auto", "pages", setup_pdf, run_extract_pdf_text, 0 },
+    { "pdf", "merge_pdfs", "buffer", "pages", setup_pdf, run_merge_pdfs, 0 },
+    { "pdf", "merge_pdfs_sink", "sink", "pages", setup_pdf, run_merge_pdfs, 1 },
+    { "pdf", "compress_pdf", "q75,150dpi", "pages", setup_pdf, run_compress_pdf, 0 },
+    { "pdf", "split_pdf", "4_parts", "pages", setup_pdf, run_split_pdf, 0 },
+    { "pdf", "images_to_pdf_sink", "32_jpegs", "pages", setup_image, run_images_to_pdf, 0 },
+
+    { "hash", "zell_hash", "buffer", "bytes", setup_stream, run_hash, 0 },
+    { "hash", "zell_hash_update", "64KB_chunks", "bytes", setup_stream, run_hash, 1 },
+
+    { "archive", "create_archive_sink", "zip,threads=1", "bytes", setup_pdf, run_create_archive, ARCHIVE(0, 1) },
+    { "archive", "create_archive_sink", "zip,threads=auto", "bytes", setup_pdf, run_create_archive, ARCHIVE(0, 0) },
+    { "archive", "create_archive_sink", "tar.gz,threads=auto", "bytes", setup_pdf, run_create_archive, ARCHIVE(1, 0) },
+    { "archive", "create_archive_sink", "tar.zst,threads=auto", "bytes", setup_pdf, run_create_archive, ARCHIVE(2, 0) },
+    { "archive", "create_archive_sink", "tar.br", "bytes", setup_pdf, run_create_archive, ARCHIVE(3, 0) },
+    { "archive", "choose_codec", "50MB/s", "bytes", setup_pdf, run_choose_codec, 50 },
+    { "archive", "zip_list", "open+list", "entries", setup_zip, run_zip_read, 0 },
+    { "archive", "zip_extract", "open+one_entry", "entries", setup_zip, run_zip_read, 1 },
+};
+
+// --- Runner ------------------------------------------------------------------------
+
+typedef struct {
+    int quick;
+    int isolate;        // run each case in a child process (native only)
+    double min_seconds; // time each case runs for, after one warm-up run
+    const char* filter;
+} BenchOptions;
+
+static double bench_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Run one case at one tier and describe it as a JSON object without its
+// closing brace, so the runner can add the memory figure
+static void bench_measure(const BenchCase* c, int tier, const BenchOptions* options, BenchBuffer* out) {
+    BenchJob job;
+    memset(&job, 0, sizeof(job));
+    job.param = c->param;
+
+    bench_appendf(out, "{\"module\":\"%s\",\"function\":\"%s\",\"variant\":\"%s\",\"tier\":%d",
+                  c->module, c->function, c->variant, tier);
+    if (c->setup(&job, tier) != 0 || c->run(&job) != 0) {
+        bench_appendf(out, ",\"size\":\"%s\",\"status\":\"failed\"", job.size_label);
+        bench_job_free(&job);
+        return;
+    }
+
+    int iterations = 0;
+    double best = 1e30, total = 0;
+    double start = bench_now();
+    do {
+        double t0 = bench_now();
+        if (c->run(&job) != 0) break;
+        double elapsed = bench_now() - t0;
+        total += elapsed;
+        if (elapsed < best) best = elapsed;
+        iterations++;
+    } while (bench_now() - start < options->min_seconds);
+
+    if (iterations == 0) {
+        bench_appendf(out, ",\"size\":\"%s\",\"status\":\"failed\"", job.size_label);
+    } else {
+        bench_appendf(out, ",\"size\":\"%s\",\"status\":\"ok\",\"unit\":\"%s\",\"iterations\":%d"
+                      ",\"mean_ms\":%.4f,\"best_ms\":%.4f,\"bytes\":%lld,\"items\":%lld"
+                      ",\"mb_per_s\":%.2f,\"items_per_s\":%.2f",
+                      job.size_label, c->unit, iterations, total / iterations * 1e3, best * 1e3,
+                      (long long)job.bytes, (long long)job.items,
+                      job.bytes / best / 1e6, job.items / best);
+    }
+    bench_job_free(&job);
+}
+
+static void bench_run_case(const BenchCase* c, int tier, const BenchOptions* options, BenchBuffer* out) {
+#ifndef __EMSCRIPTEN__
+    if (options->isolate) {
+        int fds[2];
+        if (pipe(fds) != 0) return;
+        pid_t pid = fork();
+        if (pid == 0) {
+            BenchBuffer result = { NULL, 0, 0 };
+            close(fds[0]);
+            bench_measure(c, tier, options, &result);
+            ssize_t unused = write(fds[1], result.data, result.length);
+            (void)unused;
+            _exit(0);
+        }
+        close(fds[1]);
+        char chunk[4096];
+        ssize_t n;
+        size_t before = out->length;
+        while ((n = read(fds[0], chunk, sizeof(chunk))) > 0) bench_append(out, chunk, (size_t)n);
+        close(fds[0]);
+
+        int status = 0;
+        struct rusage usage;
+        memset(&usage, 0, sizeof(usage));
+        if (pid < 0 || wait4(pid, &status, 0, &usage) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+            out->length = before;
+            bench_appendf(out, "{\"module\":\"%s\",\"function\":\"%s\",\"variant\":\"%s\",\"tier\":%d"
+                          ",\"status\":\"crashed\"}", c->module, c->function, c->variant, tier);
+            return;
+        }
+#ifdef __APPLE__
+        long peak_kb = (long)(usage.ru_maxrss / 1024);
+#else
+        long peak_kb = (long)usage.ru_maxrss;
+#endif
+        bench_appendf(out, ",\"peak_memory_kb\":%ld}", peak_kb);
+        return;
+    }
+#endif
+
+    bench_measure(c, tier, options, out);
+#ifdef __EMSCRIPTEN__
+    bench_appendf(out, ",\"peak_memory_kb\":%ld}", (long)(emscripten_get_heap_size() / 1024));
+#else
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    bench_appendf(out, ",\"peak_memory_kb\":%ld}", (long)usage.ru_maxrss);
+#endif
+}
+
+static void bench_usage(const char* name) {
+    fprintf(stderr,
+            "usage: %s [--quick] [--filter TEXT] [--min-time MS] [--cpu LEVEL] [--no-isolate] [--output FILE]"
+            " [--list]\n"
+            "  --quick       small and medium corpus tiers only, shorter runs\n"
+            "  --filter      only cases whose module/function contains TEXT\n"
+            "  --min-time    time spent on each case after warm-up (default 500ms)\n"
+            "  --cpu         cap the native kernels at scalar, sse4.1, avx2, avx512 or neon\n"
+            "  --no-isolate  run every case in this process (native builds fork per case)\n"
+            "  --output      write the JSON report to FILE instead of stdout\n",
+            name);
+}
+
+int main(int argc, char** argv) {
+    BenchOptions options = { 0, 1, 0.5, NULL };
+    const char* output_path = NULL;
+    int list = 0;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--quick") == 0) {
+            options.quick = 1;
+            options.min_seconds = 0.1;
+        } else if (strcmp(argv[i], "--filter") == 0 && i + 1 < argc) {
+            options.filter = argv[++i];
+        } else if (strcmp(argv[i], "--min-time") == 0 && i + 1 < argc) {
+            options.min_seconds = atof(argv[++i]) / 1e3;
+        } else if (strcmp(argv[i], "--cpu") == 0 && i + 1 < argc) {
+            // Read by each module when it first picks its kernels
+            setenv("ZELL_CPU", argv[++i], 1);
+        } else if (strcmp(argv[i], "--no-isolate") == 0) {
+            options.isolate = 0;
+        } else if (strcmp(argv[i], "--output") == 0 && i + 1 < argc) {
+            output_path = argv[++i];
+        } else if (strcmp(argv[i], "--list") == 0) {
+            list = 1;
+        } else {
+            bench_usage(argv[0]);
+            return 2;
+        }
+    }
+#ifdef __EMSCRIPTEN__
+    options.isolate = 0;
+#endif
+
+    const int case_count = (int)(sizeof(bench_cases) / sizeof(bench_cases[0]));
+    BenchBuffer report = { NULL, 0, 0 };
+    bench_appendf(&report, "{\"suite\":\"zell-bench\",\"version\":1,\"target\":\"%s\",\"simd\":\"%s\""
+                  ",\"threads\":%d,\"quick\":%s,\"memory\":\"%s\",\"results\":[",
+#ifdef __EMSCRIPTEN__
+                  "wasm",
+#else
+                  "native",
+#endif
+                  zell_cpu_name(zell_cpu_level()), zell_resolve_threads(0), options.quick ? "true" : "false",
+#ifdef __EMSCRIPTEN__
+                  "wasm_memory_high_water"
+#else
+                  options.isolate ? "case_max_rss" : "process_max_rss"
+#endif
+                  );
+
+    int first = 1;
+    for (int i = 0; i < case_count; i++) {
+        const BenchCase* c = &bench_cases[i];
+        char name[96];
+        snprintf(name, sizeof(name), "%s/%s", c->module, c->function);
+        if (options.filter && !strstr(name, options.filter)) continue;
+        if (list) {
+            printf("%s %s\n", name, c->variant);
+            continue;
+        }
+        for (int tier = 0; tier < (options.quick ? 2 : BENCH_TIERS); tier++) {
+            fprintf(stderr, "%-40s %-22s tier %d\n", name, c->variant, tier);
+            if (!first) bench_appendf(&report, ",");
+            bench_appendf(&report, "\n  ");
+            bench_run_case(c, tier, &options, &report);
+            first = 0;
+        }
+    }
+    if (list) return 0;
+    bench_appendf(&report, "\n]}\n");
+
+    FILE* out = output_path ? fopen(output_path, "w") : stdout;
+    if (!out) {
+        fprintf(stderr, "cannot write %s\n", output_path);
+        return 1;
+    }
+    fwrite(report.data, 1, report.length, out);
+    if (out != stdout) fclose(out);
+    free(report.data);
+    return 0;
+}
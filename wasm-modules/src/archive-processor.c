@@ -0,0 +1,2247 @@
+#include "zell-common.h"
+#include "zell-source.h"
+#include "zell-alloc.h"
+#include "zell-sink.h"
+#include "zell-hash.h"
+#include "zell-crc32.h"
+#include "zell-deflate.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <sys/stat.h>
+
+// Zstandard and Brotli are built in when their headers are found: the
+// native build links -lzstd -lbrotlienc, and the WebAssembly build compiles
+// whatever sources and include paths ZELL_ARCHIVE_CODECS names (emscripten
+// has no port of either).  -DZELL_NO_ZSTD and -DZELL_NO_BROTLI leave them
+// out regardless.
+#if defined(__has_include)
+#if !defined(ZELL_NO_ZSTD) && __has_include(<zstd.h>)
+#define ZELL_HAVE_ZSTD 1
+#include <zstd.h>
+#endif
+#if !defined(ZELL_NO_BROTLI) && __has_include(<brotli/encode.h>)
+#define ZELL_HAVE_BROTLI 1
+#include <brotli/encode.h>
+#endif
+#endif
+
+// Archive processing functions for WebAssembly
+// Optimized for offline processing in ZELL
+
+#define ARCHIVE_ZIP        0
+#define ARCHIVE_TAR_GZ     1
+#define ARCHIVE_TAR_ZSTD   2
+#define ARCHIVE_TAR_BROTLI 3
+
+// Codecs of the tar formats and of the single-input compressors
+#define ARCHIVE_CODEC_GZIP   0
+#define ARCHIVE_CODEC_ZSTD   1
+#define ARCHIVE_CODEC_BROTLI 2
+
+// ---------------------------------------------------------------------------
+// Parallel deflate
+//
+// Archives are written the way pigz writes gzip: every input stream (a ZIP
+// entry, or the whole tar stream of a .tar.gz) is cut into 128KB blocks that
+// are deflated independently on a thread pool.  Each block starts with the
+// 32KB of input before it as a preset dictionary, so matches still reach
+// back across block boundaries, and all but the last end with a sync flush,
+// which byte-aligns the block so the pieces concatenate into one valid
+// deflate stream.  Each worker also checksums its block; the CRCs are joined
+// with zell_crc32_combine.  Blocks run in batches of a few per thread and
+// the calling thread writes each batch in order, so the output does not
+// depend on thread timing and memory stays bounded.
+//
+// Already-compressed media (JPEG, MP4, MP3, ...) is not recompressed: ZIP
+// stores those entries, and a .tar.gz wraps blocks that are mostly such data
+// in stored deflate blocks.
+// ---------------------------------------------------------------------------
+
+#define ARCHIVE_BLOCK ((int64_t)128 << 10)
+#define ARCHIVE_WINDOW ((int64_t)32 << 10)
+#define ARCHIVE_OUTPUT_CAPACITY (ARCHIVE_BLOCK + ARCHIVE_BLOCK / 8 + 1024)
+#define ARCHIVE_BLOCKS_PER_THREAD 2
+#define ARCHIVE_STORED_MAX 65535
+
+// Part of an input stream: bytes of an entry, or headers and padding
+typedef struct {
+    int64_t start;               // offset in the stream
+    int64_t length;
+    const unsigned char* bytes;  // in-memory bytes, or NULL to read `source`
+    const ZellSource* source;
+    int stored;                  // already-compressed data
+} ArchiveSegment;
+
+typedef struct {
+    ArchiveSegment* segments;
+    int count;
+    int64_t length;
+    int raw;                     // copied verbatim (a stored ZIP entry)
+} ArchiveStream;
+
+typedef enum {
+    ARCHIVE_BLOCK_DEFLATE = 0,
+    ARCHIVE_BLOCK_STORED,        // wrapped in stored deflate blocks
+    ARCHIVE_BLOCK_COPY,          // raw bytes, written by the ordered phase
+    ARCHIVE_BLOCK_CRC,           // checksum only
+} ArchiveBlockMode;
+
+// One block in flight, with the buffers of its batch position
+typedef struct {
+    const ArchiveStream* stream;
+    int index;                   // stream number
+    int64_t start;
+    int64_t length;
+    int first;
+    int final;                   // last block of its stream
+    ArchiveBlockMode mode;
+
+    uint32_t crc;
+    int64_t out_length;
+    int failed;
+
+    ZellDeflate* deflater;       // created on the slot's first deflate block
+    unsigned char* input;        // dictionary + block, when not resident
+    unsigned char* output;
+} ArchiveSlot;
+
+typedef struct ArchiveWriter ArchiveWriter;
+
+// What a pass over a list of streams does around each stream
+typedef struct {
+    ArchiveStream* streams;
+    int count;
+    int checksum_only;           // CRC the raw streams, write nothing
+    void (*begin)(ArchiveWriter* w, void* ctx, int index);
+    void (*end)(ArchiveWriter* w, void* ctx, int index, uint32_t crc, int64_t size, int64_t written);
+    void* ctx;
+} ArchivePass;
+
+struct ArchiveWriter {
+    ZellSink* sink;
+    int64_t position;
+    int failed;
+    int level;
+    int threads;
+    int batch;
+    ArchiveSlot* slots;
+};
+
+typedef void (*ArchiveTaskFn)(void* ctx, int index);
+
+typedef struct {
+    ArchiveTaskFn run;
+    void* ctx;
+    int count;
+    int next;
+} ArchiveScheduler;
+
+#ifdef ZELL_HAVE_THREADS
+static void* archive_scheduler_worker(void* arg) {
+    ArchiveScheduler* scheduler = (ArchiveScheduler*)arg;
+    for (;;) {
+        int index = __atomic_fetch_add(&scheduler->next, 1, __ATOMIC_RELAXED);
+        if (index >= scheduler->count) break;
+        ZELL_STATS_WORKER();
+        scheduler->run(scheduler->ctx, index);
+    }
+    return NULL;
+}
+#endif
+
+// Run run(ctx, i) for every i in [0, count) on up to `threads` threads
+static void archive_parallel_for(int count, int threads, ArchiveTaskFn run, void* ctx) {
+    if (threads > count) threads = count;
+#ifdef ZELL_HAVE_THREADS
+    if (threads > 1) {
+        ZELL_STATS_PARALLEL(threads);
+        ArchiveScheduler scheduler = { run, ctx, count, 0 };
+        pthread_t workers[ZELL_MAX_THREADS];
+        int started = 0;
+        for (; started < threads - 1; started++) {
+            if (pthread_create(&workers[started], NULL, archive_scheduler_worker, &scheduler) != 0) break;
+        }
+        // The calling thread works too, so a failed spawn only costs speed
+        archive_scheduler_worker(&scheduler);
+        for (int i = 0; i < started; i++) pthread_join(workers[i], NULL);
+        return;
+    }
+#endif
+    for (int i = 0; i < count; i++) run(ctx, i);
+}
+
+static int archive_find_segment(const ArchiveStream* stream, int64_t offset) {
+    int lo = 0, hi = stream->count - 1;
+    while (lo < hi) {
+        int mid = (lo + hi + 1) / 2;
+        if (stream->segments[mid].start <= offset) lo = mid;
+        else hi = mid - 1;
+    }
+    return lo;
+}
+
+// Resident bytes of a range that lies within one segment, or NULL
+static const unsigned char* archive_stream_view(const ArchiveStream* stream, int64_t offset, int64_t length) {
+    if (stream->count == 0) return NULL;
+    const ArchiveSegment* segment = &stream->segments[archive_find_segment(stream, offset)];
+    int64_t local = offset - segment->start;
+    if (local < 0 || local + length > segment->length) return NULL;
+    if (segment->bytes) return segment->bytes + local;
+    return segment->source->data ? segment->source->data + local : NULL;
+}
+
+/**
+ * Gather a range of a stream
+ * @return -1 on error, 0 on success
+ */
+static int archive_stream_read(const ArchiveStream* stream, int64_t offset, unsigned char* buffer, int64_t length) {
+    int i = stream->count ? archive_find_segment(stream, offset) : 0;
+    while (length > 0) {
+        if (i >= stream->count) return -1;
+        const ArchiveSegment* segment = &stream->segments[i];
+        int64_t local = offset - segment->start;
+        int64_t take = segment->length - local;
+        if (take > length) take = length;
+        if (take > 0) {
+            if (segment->bytes) {
+                memcpy(buffer, segment->bytes + local, (size_t)take);
+            } else if (zell_source_read(segment->source, local, buffer, take) != take) {
+                return -1;
+            }
+            buffer += take;
+            offset += take;
+            length -= take;
+        }
+        i++;
+    }
+    return 0;
+}
+
+// Whether a block is at least 7/8 already-compressed data
+static int archive_mostly_stored(const ArchiveStream* stream, int64_t offset, int64_t length) {
+    if (length == 0 || stream->count == 0) return 0;
+    int64_t stored = 0, end = offset + length;
+    for (int i = archive_find_segment(stream, offset); i < stream->count; i++) {
+        const ArchiveSegment* segment = &stream->segments[i];
+        if (segment->start >= end) break;
+        if (!segment->stored) continue;
+        int64_t from = segment->start > offset ? segment->start : offset;
+        int64_t to = segment->start + segment->length < end ? segment->start + segment->length : end;
+        if (to > from) stored += to - from;
+    }
+    return stored * 8 >= length * 7;
+}
+
+// Wrap bytes in stored deflate blocks
+static int64_t archive_put_stored(unsigned char* out, const unsigned char* data, int64_t length, int final) {
+    int64_t written = 0;
+    do {
+        int64_t piece = length > ARCHIVE_STORED_MAX ? ARCHIVE_STORED_MAX : length;
+        length -= piece;
+        out[written++] = (unsigned char)(final && length == 0);  // BFINAL, BTYPE 00
+        out[written++] = (unsigned char)piece;
+        out[written++] = (unsigned char)(piece >> 8);
+        out[written++] = (unsigned char)~piece;
+        out[written++] = (unsigned char)(~piece >> 8);
+        memcpy(out + written, data, (size_t)piece);
+        written += piece;
+        data += piece;
+    } while (length > 0);
+    return written;
+}
+
+static void archive_block_task(void* ctx, int index) {
+    ArchiveWriter* w = (ArchiveWriter*)ctx;
+    ArchiveSlot* slot = &w->slots[index];
+    if (slot->mode == ARCHIVE_BLOCK_COPY) return;
+    ZELL_STATS_STAGE(ZELL_STAGE_ENCODE, "archive_block");
+
+    int64_t window = 0;
+    if (slot->mode == ARCHIVE_BLOCK_DEFLATE) {
+        window = slot->start < ARCHIVE_WINDOW ? slot->start : ARCHIVE_WINDOW;
+    }
+    const unsigned char* data = archive_stream_view(slot->stream, slot->start - window, window + slot->length);
+    if (!data && slot->length + window > 0) {
+        if (archive_stream_read(slot->stream, slot->start - window, slot->input, window + slot->length) != 0) {
+            slot->failed = 1;
+            return;
+        }
+        data = slot->input;
+    }
+    const unsigned char* block = data ? data + window : NULL;
+    slot->crc = block ? zell_crc32(0, block, (size_t)slot->length) : 0;
+
+    if (slot->mode == ARCHIVE_BLOCK_STORED) {
+        slot->out_length = archive_put_stored(slot->output, block, slot->length, slot->final);
+        return;
+    }
+    if (slot->mode != ARCHIVE_BLOCK_DEFLATE) return;
+
+    if (!slot->deflater) slot->deflater = zell_deflate_create(w->level);
+    if (!slot->deflater) {
+        slot->failed = 1;
+        return;
+    }
+    // The window before the block serves as its history
+    slot->out_length = zell_deflate_block(slot->deflater, data, (size_t)window, (size_t)(window + slot->length),
+                                          slot->output, (size_t)ARCHIVE_OUTPUT_CAPACITY, slot->final);
+    if (slot->out_length < 0) slot->failed = 1;
+}
+
+static void archive_put(ArchiveWriter* w, const void* bytes, int64_t length) {
+    zell_sink_put(w->sink, bytes, length);
+    w->position += length;
+}
+
+// Write a raw range of a stream, straight from memory where it is resident
+static void archive_copy(ArchiveWriter* w, ArchiveSlot* slot) {
+    if (slot->length == 0) return;
+    const unsigned char* data = archive_stream_view(slot->stream, slot->start, slot->length);
+    if (!data) {
+        if (archive_stream_read(slot->stream, slot->start, slot->input, slot->length) != 0) {
+            w->failed = 1;
+            return;
+        }
+        data = slot->input;
+    }
+    archive_put(w, data, slot->length);
+}
+
+/**
+ * Run a pass over streams: blocks are processed in parallel batches and
+ * written in order, with the pass's callbacks around each stream
+ * @return -1 on error, 0 on success
+ */
+static int archive_run(ArchiveWriter* w, const ArchivePass* pass) {
+    int stream_index = 0;
+    int64_t offset = 0;
+    uint32_t crc = 0;
+    int64_t size = 0, written = 0;
+
+    while (!w->failed) {
+        int filled = 0;
+        while (filled < w->batch && stream_index < pass->count) {
+            const ArchiveStream* stream = &pass->streams[stream_index];
+            if (pass->checksum_only && !stream->raw) {
+                stream_index++;
+                continue;
+            }
+            ArchiveSlot* slot = &w->slots[filled++];
+            int64_t length = stream->length - offset < ARCHIVE_BLOCK ? stream->length - offset : ARCHIVE_BLOCK;
+            slot->stream = stream;
+            slot->index = stream_index;
+            slot->start = offset;
+            slot->length = length;
+            slot->first = offset == 0;
+            slot->final = offset + length >= stream->length;
+            slot->crc = 0;
+            slot->out_length = 0;
+            slot->failed = 0;
+            if (pass->checksum_only) slot->mode = ARCHIVE_BLOCK_CRC;
+            else if (stream->raw) slot->mode = ARCHIVE_BLOCK_COPY;
+            else if (w->level == 0 || archive_mostly_stored(stream, offset, length)) slot->mode = ARCHIVE_BLOCK_STORED;
+            else slot->mode = ARCHIVE_BLOCK_DEFLATE;
+
+            if (slot->final) {
+                stream_index++;
+                offset = 0;
+            } else {
+                offset += length;
+            }
+        }
+        if (filled == 0) break;
+
+        archive_parallel_for(filled, w->threads, archive_block_task, w);
+
+        for (int i = 0; i < filled && !w->failed; i++) {
+            ArchiveSlot* slot = &w->slots[i];
+            if (slot->failed) {
+                w->failed = 1;
+                break;
+            }
+            if (slot->first) {
+                crc = 0;
+                size = written = 0;
+                if (pass->begin) pass->begin(w, pass->ctx, slot->index);
+            }
+            int64_t before = w->position;
+            if (slot->mode == ARCHIVE_BLOCK_COPY) archive_copy(w, slot);
+            else if (slot->mode != ARCHIVE_BLOCK_CRC) archive_put(w, slot->output, slot->out_length);
+            written += w->position - before;
+            crc = zell_crc32_combine(crc, slot->crc, slot->length);
+            size += slot->length;
+            if (slot->final && pass->end) pass->end(w, pass->ctx, slot->index, crc, size, written);
+        }
+    }
+    return w->failed || w->sink->failed ? -1 : 0;
+}
+
+static int archive_writer_init(ArchiveWriter* w, ZellSink* sink, int level, int num_threads) {
+    memset(w, 0, sizeof(*w));
+    w->sink = sink;
+    w->level = level < 0 ? 6 : level > 9 ? 9 : level;
+    w->threads = zell_resolve_threads(num_threads);
+    w->batch = w->threads * ARCHIVE_BLOCKS_PER_THREAD;
+    w->slots = (ArchiveSlot*)calloc((size_t)w->batch, sizeof(ArchiveSlot));
+    if (!w->slots) return -1;
+    for (int i = 0; i < w->batch; i++) {
+        w->slots[i].input = (unsigned char*)zell_pool_get((size_t)(ARCHIVE_WINDOW + ARCHIVE_BLOCK));
+        w->slots[i].output = (unsigned char*)zell_pool_get((size_t)ARCHIVE_OUTPUT_CAPACITY);
+        if (!w->slots[i].input || !w->slots[i].output) return -1;
+    }
+    return 0;
+}
+
+static void archive_writer_free(ArchiveWriter* w) {
+    if (!w->slots) return;
+    for (int i = 0; i < w->batch; i++) {
+        zell_deflate_destroy(w->slots[i].deflater);
+        zell_pool_put(w->slots[i].input);
+        zell_pool_put(w->slots[i].output);
+    }
+    free(w->slots);
+    w->slots = NULL;
+}
+
+// ---------------------------------------------------------------------------
+// Entries
+// ---------------------------------------------------------------------------
+
+typedef struct {
+    const char* name;            // path inside the archive
+    size_t name_length;
+    ZellSource source;
+    int opened;                  // source owns a file
+    int64_t mtime;               // seconds since the epoch
+    int stored;                  // already-compressed format
+    ArchiveSegment segment;
+    uint32_t crc;
+    int64_t compressed;
+    int64_t offset;              // of the ZIP local header
+    int zip64;
+    unsigned char* tar_header;
+    int64_t tar_header_length;
+} ArchiveEntry;
+
+// Formats that deflate cannot shrink further
+static int archive_is_compressed_name(const char* name, size_t length) {
+    static const char* const extensions[] = {
+        "jpg", "jpeg", "png", "gif", "webp", "heic", "avif",
+        "mp4", "m4v", "mov", "mkv", "webm", "avi",
+        "mp3", "aac", "m4a", "ogg", "opus", "flac",
+        "zip", "gz", "tgz", "bz2", "xz", "zst", "br", "7z", "rar", "docx", "xlsx", "pptx",
+    };
+    const char* dot = NULL;
+    for (size_t i = length; i > 0; i--) {
+        if (name[i - 1] == '.') { dot = name + i; break; }
+        if (name[i - 1] == '/') break;
+    }
+    if (!dot) return 0;
+    size_t ext_length = (size_t)(name + length - dot);
+    for (size_t i = 0; i < sizeof(extensions) / sizeof(extensions[0]); i++) {
+        if (strlen(extensions[i]) != ext_length) continue;
+        size_t k = 0;
+        while (k < ext_length && (dot[k] | 0x20) == extensions[i][k]) k++;
+        if (k == ext_length) return 1;
+    }
+    return 0;
+}
+
+// Archive names are relative: no leading slashes or "./"
+static const char* archive_clean_name(const char* name) {
+    for (;;) {
+        if (name[0] == '/') name++;
+        else if (name[0] == '.' && name[1] == '/') name += 2;
+        else return name;
+    }
+}
+
+static const char* archive_basename(const char* path) {
+    const char* slash = strrchr(path, '/');
+    return slash ? slash + 1 : path;
+}
+
+static void archive_entries_free(ArchiveEntry* entries, int count) {
+    if (!entries) return;
+    for (int i = 0; i < count; i++) {
+        if (entries[i].opened) zell_source_close(&entries[i].source);
+        free(entries[i].tar_header);
+    }
+    free(entries);
+}
+
+/**
+ * Describe buffers as entries
+ * @return entries (free with archive_entries_free), or NULL on error
+ */
+static ArchiveEntry* archive_entries_from_buffers(unsigned char** inputs, const int64_t* input_sizes,
+                                                  const char** names, int count) {
+    ArchiveEntry* entries = (ArchiveEntry*)calloc((size_t)count, sizeof(ArchiveEntry));
+    if (!entries) return NULL;
+    int64_t now = (int64_t)time(NULL);
+    for (int i = 0; i < count; i++) {
+        if (!names[i] || input_sizes[i] < 0 || (!inputs[i] && input_sizes[i] != 0)) {
+            archive_entries_free(entries, count);
+            return NULL;
+        }
+        zell_source_memory(&entries[i].source, inputs[i], input_sizes[i]);
+        entries[i].name = archive_clean_name(names[i]);
+        entries[i].mtime = now;
+    }
+    return entries;
+}
+
+/**
+ * Open files as entries. Mapped files give their descriptor back at once,
+ * so large file lists do not run out of descriptors.
+ * @return entries (free with archive_entries_free), or NULL on error
+ */
+static ArchiveEntry* archive_entries_from_files(const char** paths, const char** names, int count) {
+    ArchiveEntry* entries = (ArchiveEntry*)calloc((size_t)count, sizeof(ArchiveEntry));
+    if (!entries) return NULL;
+    for (int i = 0; i < count; i++) {
+        ArchiveEntry* entry = &entries[i];
+        struct stat info;
+        if (!paths[i] || stat(paths[i], &info) != 0 || !S_ISREG(info.st_mode)) {
+            archive_entries_free(entries, count);
+            return NULL;
+        }
+        if (info.st_size == 0) {
+            zell_source_memory(&entry->source, NULL, 0);
+        } else if (zell_source_open_file(&entry->source, paths[i]) == 0) {
+            entry->opened = 1;
+            if (entry->source.mapping) {
+                close(entry->source.fd);
+                entry->source.fd = -1;
+            }
+        } else {
+            archive_entries_free(entries, count);
+            return NULL;
+        }
+        entry->name = archive_clean_name(names && names[i] ? names[i] : archive_basename(paths[i]));
+        entry->mtime = (int64_t)info.st_mtime;
+    }
+    return entries;
+}
+
+static void archive_prepare_entries(ArchiveEntry* entries, int count, int level) {
+    for (int i = 0; i < count; i++) {
+        ArchiveEntry* entry = &entries[i];
+        entry->name_length = strlen(entry->name);
+        entry->stored = level == 0 || archive_is_compressed_name(entry->name, entry->name_length);
+        entry->segment.start = 0;
+        entry->segment.length = entry->source.size;
+        entry->segment.bytes = NULL;
+        entry->segment.source = &entry->source;
+        entry->segment.stored = entry->stored;
+    }
+}
+
+static void archive_le16(unsigned char* p, uint32_t v) {
+    p[0] = (unsigned char)v;
+    p[1] = (unsigned char)(v >> 8);
+}
+
+static void archive_le32(unsigned char* p, uint32_t v) {
+    archive_le16(p, v & 0xFFFF);
+    archive_le16(p + 2, v >> 16);
+}
+
+static void archive_le64(unsigned char* p, uint64_t v) {
+    archive_le32(p, (uint32_t)v);
+    archive_le32(p + 4, (uint32_t)(v >> 32));
+}
+
+// ---------------------------------------------------------------------------
+// ZIP
+//
+// Stored entries are checksummed in a first parallel pass, so their local
+// headers are complete.  Deflated entries set general purpose bit 3 and
+// carry their CRC and sizes in a data descriptor, as the sink cannot go back
+// and patch a header.  Entries of 4GB and more, offsets past 4GB and more
+// than 65534 entries switch to the ZIP64 records.
+// ---------------------------------------------------------------------------
+
+#define ZIP_LOCAL_SIG      0x04034b50u
+#define ZIP_DESCRIPTOR_SIG 0x08074b50u
+#define ZIP_CENTRAL_SIG    0x02014b50u
+#define ZIP_END_SIG        0x06054b50u
+#define ZIP64_END_SIG      0x06064b50u
+#define ZIP64_LOCATOR_SIG  0x07064b50u
+#define ZIP_FLAG_DESCRIPTOR 0x0008
+#define ZIP_FLAG_UTF8       0x0800
+// Entries from this size on use ZIP64: leaves room for deflate's worst-case growth
+#define ZIP64_ENTRY_LIMIT  ((int64_t)0xFF000000)
+#define ZIP_MAX32          0xFFFFFFFFu
+
+static void zip_dos_time(int64_t mtime, uint32_t* dos_time, uint32_t* dos_date) {
+    time_t t = (time_t)mtime;
+    struct tm tm;
+    if (mtime <= 0 || !localtime_r(&t, &tm) || tm.tm_year < 80 || tm.tm_year > 207) {
+        *dos_time = 0;
+        *dos_date = (1 << 5) | 1;  // 1980-01-01
+        return;
+    }
+    *dos_time = (uint32_t)((tm.tm_hour << 11) | (tm.tm_min << 5) | (tm.tm_sec / 2));
+    *dos_date = (uint32_t)(((tm.tm_year - 80) << 9) | ((tm.tm_mon + 1) << 5) | tm.tm_mday);
+}
+
+static void zip_begin_entry(ArchiveWriter* w, void* ctx, int index) {
+    ArchiveEntry* entry = &((ArchiveEntry*)ctx)[index];
+    unsigned char header[30 + 20];
+    uint32_t dos_time, dos_date;
+    zip_dos_time(entry->mtime, &dos_time, &dos_date);
+
+    entry->offset = w->position;
+    entry->zip64 = entry->source.size >= ZIP64_ENTRY_LIMIT;
+    int64_t size = entry->stored ? entry->source.size : 0;
+
+    archive_le32(header, ZIP_LOCAL_SIG);
+    archive_le16(header + 4, entry->zip64 ? 45 : 20);
+    archive_le16(header + 6, ZIP_FLAG_UTF8 | (entry->stored ? 0 : ZIP_FLAG_DESCRIPTOR));
+    archive_le16(header + 8, entry->stored ? 0 : 8);
+    archive_le16(header + 10, dos_time);
+    archive_le16(header + 12, dos_date);
+    archive_le32(header + 14, entry->stored ? entry->crc : 0);
+    archive_le32(header + 18, entry->zip64 ? ZIP_MAX32 : (uint32_t)size);
+    archive_le32(header + 22, entry->zip64 ? ZIP_MAX32 : (uint32_t)size);
+    archive_le16(header + 26, (uint32_t)entry->name_length);
+    archive_le16(header + 28, entry->zip64 ? 20 : 0);
+    if (entry->zip64) {
+        archive_le16(header + 30, 0x0001);
+        archive_le16(header + 32, 16);
+        archive_le64(header + 34, (uint64_t)size);
+        archive_le64(header + 42, (uint64_t)size);
+    }
+    archive_put(w, header, 30);
+    archive_put(w, entry->name, (int64_t)entry->name_length);
+    if (entry->zip64) archive_put(w, header + 30, 20);
+}
+
+static void zip_end_entry(ArchiveWriter* w, void* ctx, int index, uint32_t crc, int64_t size, int64_t written) {
+    ArchiveEntry* entry = &((ArchiveEntry*)ctx)[index];
+    (void)size;
+    entry->compressed = written;
+    if (entry->stored) return;
+
+    unsigned char descriptor[24];
+    entry->crc = crc;
+    archive_le32(descriptor, ZIP_DESCRIPTOR_SIG);
+    archive_le32(descriptor + 4, crc);
+    if (entry->zip64) {
+        archive_le64(descriptor + 8, (uint64_t)written);
+        archive_le64(descriptor + 16, (uint64_t)entry->source.size);
+        archive_put(w, descriptor, 24);
+    } else {
+        archive_le32(descriptor + 8, (uint32_t)written);
+        archive_le32(descriptor + 12, (uint32_t)entry->source.size);
+        archive_put(w, descriptor, 16);
+    }
+}
+
+static void zip_checksum_end(ArchiveWriter* w, void* ctx, int index, uint32_t crc, int64_t size, int64_t written) {
+    (void)w; (void)size; (void)written;
+    ((ArchiveEntry*)ctx)[index].crc = crc;
+}
+
+static void zip_put_central(ArchiveWriter* w, const ArchiveEntry* entry) {
+    unsigned char header[46], extra[28];
+    uint32_t dos_time, dos_date;
+    zip_dos_time(entry->mtime, &dos_time, &dos_date);
+
+    // The ZIP64 extra holds exactly the fields that do not fit, in this order
+    int64_t extra_length = 4;
+    int sizes64 = entry->zip64 || entry->compressed >= (int64_t)ZIP_MAX32;
+    int offset64 = entry->offset >= (int64_t)ZIP_MAX32;
+    if (sizes64) {
+        archive_le64(extra + extra_length, (uint64_t)entry->source.size);
+        archive_le64(extra + extra_length + 8, (uint64_t)entry->compressed);
+        extra_length += 16;
+    }
+    if (offset64) {
+        archive_le64(extra + extra_length, (uint64_t)entry->offset);
+        extra_length += 8;
+    }
+    if (extra_length == 4) extra_length = 0;
+    archive_le16(extra, 0x0001);
+    archive_le16(extra + 2, (uint32_t)(extra_length - 4));
+
+    int version = extra_length ? 45 : 20;
+    archive_le32(header, ZIP_CENTRAL_SIG);
+    archive_le16(header + 4, (3 << 8) | version);  // made by Unix
+    archive_le16(header + 6, version);
+    archive_le16(header + 8, ZIP_FLAG_UTF8 | (entry->stored ? 0 : ZIP_FLAG_DESCRIPTOR));
+    archive_le16(header + 10, entry->stored ? 0 : 8);
+    archive_le16(header + 12, dos_time);
+    archive_le16(header + 14, dos_date);
+    archive_le32(header + 16, entry->crc);
+    archive_le32(header + 20, sizes64 ? ZIP_MAX32 : (uint32_t)entry->compressed);
+    archive_le32(header + 24, sizes64 ? ZIP_MAX32 : (uint32_t)entry->source.size);
+    archive_le16(header + 28, (uint32_t)entry->name_length);
+    archive_le16(header + 30, (uint32_t)extra_length);
+    archive_le16(header + 32, 0);                  // comment
+    archive_le16(header + 34, 0);                  // disk
+    archive_le16(header + 36, 0);                  // internal attributes
+    archive_le32(header + 38, 0100644u << 16);     // -rw-r--r--
+    archive_le32(header + 42, offset64 ? ZIP_MAX32 : (uint32_t)entry->offset);
+    archive_put(w, header, 46);
+    archive_put(w, entry->name, (int64_t)entry->name_length);
+    if (extra_length) archive_put(w, extra, extra_length);
+}
+
+static void zip_put_end(ArchiveWriter* w, int64_t count, int64_t directory_offset) {
+    unsigned char record[56 + 20 + 22];
+    int64_t directory_size = w->position - directory_offset;
+    int zip64 = count >= 0xFFFF || directory_offset >= (int64_t)ZIP_MAX32 || directory_size >= (int64_t)ZIP_MAX32;
+
+    if (zip64) {
+        int64_t record_offset = w->position;
+        archive_le32(record, ZIP64_END_SIG);
+        archive_le64(record + 4, 44);              // size of the rest of the record
+        archive_le16(record + 12, (3 << 8) | 45);
+        archive_le16(record + 14, 45);
+        archive_le32(record + 16, 0);
+        archive_le32(record + 20, 0);
+        archive_le64(record + 24, (uint64_t)count);
+        archive_le64(record + 32, (uint64_t)count);
+        archive_le64(record + 40, (uint64_t)directory_size);
+        archive_le64(record + 48, (uint64_t)directory_offset);
+        archive_le32(record + 56, ZIP64_LOCATOR_SIG);
+        archive_le32(record + 60, 0);
+        archive_le64(record + 64, (uint64_t)record_offset);
+        archive_le32(record + 72, 1);
+        archive_put(w, record, 76);
+    }
+    archive_le32(record, ZIP_END_SIG);
+    archive_le16(record + 4, 0);
+    archive_le16(record + 6, 0);
+    archive_le16(record + 8, zip64 ? 0xFFFF : (uint32_t)count);
+    archive_le16(record + 10, zip64 ? 0xFFFF : (uint32_t)count);
+    archive_le32(record + 12, zip64 ? ZIP_MAX32 : (uint32_t)directory_size);
+    archive_le32(record + 16, zip64 ? ZIP_MAX32 : (uint32_t)directory_offset);
+    archive_le16(record + 20, 0);
+    archive_put(w, record, 22);
+}
+
+static int64_t zip_write(ArchiveWriter* w, ArchiveEntry* entries, int count) {
+    ArchiveStream* streams = (ArchiveStream*)calloc((size_t)count, sizeof(ArchiveStream));
+    if (!streams) return -1;
+    for (int i = 0; i < count; i++) {
+        streams[i].segments = &entries[i].segment;
+        streams[i].count = 1;
+        streams[i].length = entries[i].source.size;
+        streams[i].raw = entries[i].stored;
+    }
+
+    ArchivePass checksum = { streams, count, 1, NULL, zip_checksum_end, entries };
+    ArchivePass write = { streams, count, 0, zip_begin_entry, zip_end_entry, entries };
+    int status = archive_run(w, &checksum);
+    if (status == 0) status = archive_run(w, &write);
+    free(streams);
+    if (status != 0) return -1;
+
+    int64_t directory_offset = w->position;
+    for (int i = 0; i < count; i++) zip_put_central(w, &entries[i]);
+    zip_put_end(w, count, directory_offset);
+    return w->sink->failed ? -1 : w->position;
+}
+
+// ---------------------------------------------------------------------------
+// TAR
+//
+// The whole ustar stream goes through one compressor: a gzip member written
+// with the parallel deflate, or a Zstandard or Brotli frame (see "Stream
+// codecs").  Names that do not fit the ustar name/prefix fields and sizes of
+// 8GB or more get a PAX extended header first.
+// ---------------------------------------------------------------------------
+
+#define TAR_RECORD 512
+
+static const unsigned char tar_zeros[2 * TAR_RECORD] = { 0 };
+
+static void tar_octal(unsigned char* field, int width, uint64_t value) {
+    field[width - 1] = 0;
+    for (int i = width - 2; i >= 0; i--) {
+        field[i] = (unsigned char)('0' + (value & 7));
+        value >>= 3;
+    }
+}
+
+static void tar_put_header(unsigned char* header, const char* name, size_t name_length,
+                           const char* prefix, size_t prefix_length, uint64_t size, int64_t mtime, char type) {
+    memset(header, 0, TAR_RECORD);
+    memcpy(header, name, name_length);
+    tar_octal(header + 100, 8, 0644);
+    tar_octal(header + 108, 8, 0);
+    tar_octal(header + 116, 8, 0);
+    tar_octal(header + 124, 12, size);
+    tar_octal(header + 136, 12, mtime > 0 ? (uint64_t)mtime : 0);
+    header[156] = (unsigned char)type;
+    memcpy(header + 257, "ustar", 6);
+    memcpy(header + 263, "00", 2);
+    memcpy(header + 345, prefix, prefix_length);
+
+    uint32_t sum = 0;
+    memset(header + 148, ' ', 8);
+    for (int i = 0; i < TAR_RECORD; i++) sum += header[i];
+    tar_octal(header + 148, 7, sum);
+    header[155] = ' ';
+}
+
+// "<length> <key>=<value>\n", where length counts the whole record
+static size_t tar_pax_record(char* out, const char* key, const char* value, size_t value_length) {
+    size_t body = 1 + strlen(key) + 1 + value_length + 1;
+    size_t length = body + 1;
+    while (length < body + (size_t)snprintf(NULL, 0, "%zu", length)) length++;
+    int digits = sprintf(out, "%zu %s=", length, key);
+    memcpy(out + digits, value, value_length);
+    out[digits + value_length] = '\n';
+    return length;
+}
+
+/**
+ * Build the header records of an entry
+ * @return -1 on error, 0 on success
+ */
+static int tar_build_header(ArchiveEntry* entry) {
+    const char* name = entry->name;
+    size_t length = entry->name_length;
+    const char* prefix = "";
+    size_t prefix_length = 0;
+    uint64_t size = (uint64_t)entry->source.size;
+    int long_size = size > 077777777777ULL;
+    int long_name = length > 100;
+
+    if (long_name && length <= 256) {
+        // Split at a slash into prefix (up to 155) and name (up to 100)
+        for (size_t i = length - 1; i > 0; i--) {
+            if (name[i] == '/' && i <= 155 && length - i - 1 <= 100 && length - i - 1 > 0) {
+                prefix = name;
+                prefix_length = i;
+                name += i + 1;
+                length -= i + 1;
+                long_name = 0;
+                break;
+            }
+        }
+    }
+
+    size_t pax_length = 0;
+    char* pax = NULL;
+    if (long_name || long_size) {
+        pax = (char*)malloc(entry->name_length + 64);
+        if (!pax) return -1;
+        if (long_name) pax_length += tar_pax_record(pax, "path", entry->name, entry->name_length);
+        if (long_size) {
+            char digits[24];
+            int n = snprintf(digits, sizeof(digits), "%llu", (unsigned long long)size);
+            pax_length += tar_pax_record(pax + pax_length, "size", digits, (size_t)n);
+        }
+    }
+
+    size_t pax_records = pax ? 1 + (pax_length + TAR_RECORD - 1) / TAR_RECORD : 0;
+    entry->tar_header_length = (int64_t)((pax_records + 1) * TAR_RECORD);
+    entry->tar_header = (unsigned char*)calloc(1, (size_t)entry->tar_header_length);
+    if (!entry->tar_header) {
+        free(pax);
+        return -1;
+    }
+    unsigned char* header = entry->tar_header;
+    if (pax) {
+        tar_put_header(header, "PaxHeader", 9, "", 0, pax_length, entry->mtime, 'x');
+        memcpy(header + TAR_RECORD, pax, pax_length);
+        header += pax_records * TAR_RECORD;
+        free(pax);
+        if (long_name) length = length > 100 ? 100 : length;
+    }
+    tar_put_header(header, name, length, prefix, prefix_length, long_size ? 0 : size, entry->mtime, '0');
+    return 0;
+}
+
+static void archive_gzip_end(ArchiveWriter* w, void* ctx, int index, uint32_t crc, int64_t size, int64_t written) {
+    unsigned char trailer[8];
+    (void)ctx; (void)index; (void)written;
+    archive_le32(trailer, crc);
+    archive_le32(trailer + 4, (uint32_t)size);  // ISIZE is the size modulo 2^32
+    archive_put(w, trailer, 8);
+}
+
+/**
+ * Lay out the tar stream of entries: headers, data and padding
+ * @return segments (free when done), or NULL on error
+ */
+static ArchiveSegment* tar_build_stream(ArchiveEntry* entries, int count, ArchiveStream* stream) {
+    ArchiveSegment* segments = (ArchiveSegment*)calloc((size_t)count * 3 + 1, sizeof(ArchiveSegment));
+    if (!segments) return NULL;
+
+    int n = 0;
+    int64_t offset = 0;
+    for (int i = 0; i < count; i++) {
+        ArchiveEntry* entry = &entries[i];
+        if (tar_build_header(entry) != 0) {
+            free(segments);
+            return NULL;
+        }
+        ArchiveSegment header = { offset, entry->tar_header_length, entry->tar_header, NULL, 0 };
+        segments[n++] = header;
+        offset += entry->tar_header_length;
+        if (entry->source.size > 0) {
+            ArchiveSegment data = { offset, entry->source.size, NULL, &entry->source, entry->stored };
+            segments[n++] = data;
+            offset += entry->source.size;
+        }
+        int64_t padding = (TAR_RECORD - entry->source.size % TAR_RECORD) % TAR_RECORD;
+        if (padding) {
+            ArchiveSegment zeros = { offset, padding, tar_zeros, NULL, 0 };
+            segments[n++] = zeros;
+            offset += padding;
+        }
+    }
+    ArchiveSegment end = { offset, sizeof(tar_zeros), tar_zeros, NULL, 0 };
+    segments[n++] = end;
+    offset += end.length;
+
+    stream->segments = segments;
+    stream->count = n;
+    stream->length = offset;
+    stream->raw = 0;
+    return segments;
+}
+
+/**
+ * Write a stream as one gzip member
+ * @return -1 on error, 0 on success
+ */
+static int archive_gzip_run(ArchiveWriter* w, ArchiveStream* stream) {
+    int64_t mtime = (int64_t)time(NULL);
+    unsigned char header[10] = { 0x1f, 0x8b, 8, 0, 0, 0, 0, 0, 0, 3 };  // deflate, Unix
+    archive_le32(header + 4, (uint32_t)mtime);
+    header[8] = w->level >= 9 ? 2 : w->level == 1 ? 4 : 0;
+    archive_put(w, header, sizeof(header));
+
+    ArchivePass pass = { stream, 1, 0, NULL, archive_gzip_end, NULL };
+    return archive_run(w, &pass);
+}
+
+// ---------------------------------------------------------------------------
+// Stream codecs
+//
+// Besides gzip, a stream can go into a Zstandard frame (multithreaded by
+// libzstd itself, with long-range matching on large inputs so repeated
+// files far apart in a bundle still match) or a Brotli stream.  Both
+// libraries are optional: without their headers the codecs are left out and
+// report themselves unavailable.  The stream is fed in 1MB pieces, straight
+// from memory where it is resident.
+// ---------------------------------------------------------------------------
+
+#define ARCHIVE_CODEC_CHUNK ((int64_t)1 << 20)
+#define ARCHIVE_ZSTD_LONG_MIN ((int64_t)8 << 20)   // inputs that get long-range matching
+#define ARCHIVE_ZSTD_JOB ((int64_t)8 << 20)        // per-worker job with long-range matching
+#define ARCHIVE_BROTLI_WINDOW 24                   // largest standard window (16MB)
+
+static int archive_codec_available(int codec) {
+    switch (codec) {
+        case ARCHIVE_CODEC_GZIP: return 1;
+#ifdef ZELL_HAVE_ZSTD
+        case ARCHIVE_CODEC_ZSTD: return 1;
+#endif
+#ifdef ZELL_HAVE_BROTLI
+        case ARCHIVE_CODEC_BROTLI: return 1;
+#endif
+        default: return 0;
+    }
+}
+
+// Bytes [offset, offset + length) of a stream, from memory or read into buffer
+static const unsigned char* archive_stream_piece(const ArchiveStream* stream, int64_t offset, int64_t length,
+                                                 unsigned char* buffer) {
+    if (length == 0) return buffer;
+    const unsigned char* data = archive_stream_view(stream, offset, length);
+    if (data) return data;
+    return archive_stream_read(stream, offset, buffer, length) == 0 ? buffer : NULL;
+}
+
+#ifdef ZELL_HAVE_ZSTD
+static ZSTD_CCtx* archive_zstd_context(int level, int threads, int64_t size) {
+    ZSTD_CCtx* cctx = ZSTD_createCCtx();
+    if (!cctx) return NULL;
+    ZSTD_CCtx_setParameter(cctx, ZSTD_c_compressionLevel, level > ZSTD_maxCLevel() ? ZSTD_maxCLevel() : level);
+    ZSTD_CCtx_setParameter(cctx, ZSTD_c_checksumFlag, 1);
+    if (size >= ARCHIVE_ZSTD_LONG_MIN) ZSTD_CCtx_setParameter(cctx, ZSTD_c_enableLongDistanceMatching, 1);
+    // A libzstd built without threads refuses workers and compresses inline
+    if (threads > 1 && !ZSTD_isError(ZSTD_CCtx_setParameter(cctx, ZSTD_c_nbWorkers, threads)) &&
+        size >= ARCHIVE_ZSTD_LONG_MIN) {
+        // Long-range jobs default to 4x the 128MB window, which leaves one worker busy
+        ZSTD_CCtx_setParameter(cctx, ZSTD_c_jobSize, (int)ARCHIVE_ZSTD_JOB);
+    }
+    ZSTD_CCtx_setPledgedSrcSize(cctx, (unsigned long long)size);
+    return cctx;
+}
+
+static int archive_zstd_run(ArchiveWriter* w, const ArchiveStream* stream, int level,
+                            unsigned char* input, unsigned char* output) {
+    ZSTD_CCtx* cctx = archive_zstd_context(level, w->threads, stream->length);
+    if (!cctx) return -1;
+    int status = 0;
+    int64_t offset = 0;
+    do {
+        int64_t length = stream->length - offset < ARCHIVE_CODEC_CHUNK ? stream->length - offset : ARCHIVE_CODEC_CHUNK;
+        const unsigned char* data = archive_stream_piece(stream, offset, length, input);
+        if (!data) {
+            status = -1;
+            break;
+        }
+        offset += length;
+        int last = offset >= stream->length;
+        ZSTD_inBuffer in = { data, (size_t)length, 0 };
+        size_t remaining;
+        do {
+            ZSTD_outBuffer out = { output, (size_t)ARCHIVE_CODEC_CHUNK, 0 };
+            remaining = ZSTD_compressStream2(cctx, &out, &in, last ? ZSTD_e_end : ZSTD_e_continue);
+            if (ZSTD_isError(remaining)) {
+                status = -1;
+                break;
+            }
+            archive_put(w, output, (int64_t)out.pos);
+        } while (last ? remaining != 0 : in.pos < in.size);
+    } while (status == 0 && offset < stream->length && !w->sink->failed);
+    ZSTD_freeCCtx(cctx);
+    return status;
+}
+#endif // ZELL_HAVE_ZSTD
+
+#ifdef ZELL_HAVE_BROTLI
+static BrotliEncoderState* archive_brotli_state(int level, int64_t size) {
+    BrotliEncoderState* state = BrotliEncoderCreateInstance(NULL, NULL, NULL);
+    if (!state) return NULL;
+    int quality = level < BROTLI_MIN_QUALITY ? BROTLI_MIN_QUALITY : level > BROTLI_MAX_QUALITY ? BROTLI_MAX_QUALITY : level;
+    BrotliEncoderSetParameter(state, BROTLI_PARAM_QUALITY, (uint32_t)quality);
+    BrotliEncoderSetParameter(state, BROTLI_PARAM_LGWIN, ARCHIVE_BROTLI_WINDOW);
+    BrotliEncoderSetParameter(state, BROTLI_PARAM_SIZE_HINT, size < (1 << 30) ? (uint32_t)size : (1u << 30));
+    return state;
+}
+
+static int archive_brotli_run(ArchiveWriter* w, const ArchiveStream* stream, int level,
+                              unsigned char* input, unsigned char* output) {
+    BrotliEncoderState* state = archive_brotli_state(level, stream->length);
+    if (!state) return -1;
+    int status = 0;
+    int64_t offset = 0;
+    do {
+        int64_t length = stream->length - offset < ARCHIVE_CODEC_CHUNK ? stream->length - offset : ARCHIVE_CODEC_CHUNK;
+        const uint8_t* next_in = archive_stream_piece(stream, offset, length, input);
+        if (!next_in) {
+            status = -1;
+            break;
+        }
+        offset += length;
+        int last = offset >= stream->length;
+        size_t available_in = (size_t)length;
+        while (available_in > 0 || (last && !BrotliEncoderIsFinished(state))) {
+            uint8_t* next_out = output;
+            size_t available_out = (size_t)ARCHIVE_CODEC_CHUNK;
+            if (!BrotliEncoderCompressStream(state, last ? BROTLI_OPERATION_FINISH : BROTLI_OPERATION_PROCESS,
+                                             &available_in, &next_in, &available_out, &next_out, NULL)) {
+                status = -1;
+                break;
+            }
+            archive_put(w, output, ARCHIVE_CODEC_CHUNK - (int64_t)available_out);
+        }
+    } while (status == 0 && offset < stream->length && !w->sink->failed);
+    BrotliEncoderDestroyInstance(state);
+    return status;
+}
+#endif // ZELL_HAVE_BROTLI
+
+/**
+ * Compress a stream with a codec
+ * @param level - Level on the codec's own scale (gzip takes the writer's)
+ * @return -1 on error, 0 on success
+ */
+static int archive_compress_stream(ArchiveWriter* w, ArchiveStream* stream, int codec, int level) {
+    if (codec == ARCHIVE_CODEC_GZIP) return archive_gzip_run(w, stream);
+    if (!archive_codec_available(codec)) return -1;
+    ZELL_STATS_STAGE(ZELL_STAGE_ENCODE, codec == ARCHIVE_CODEC_ZSTD ? "zstd" : "brotli");
+
+    unsigned char* input = (unsigned char*)zell_pool_get((size_t)ARCHIVE_CODEC_CHUNK);
+    unsigned char* output = (unsigned char*)zell_pool_get((size_t)ARCHIVE_CODEC_CHUNK);
+    int status = -1;
+    if (input && output) {
+#ifdef ZELL_HAVE_ZSTD
+        if (codec == ARCHIVE_CODEC_ZSTD) status = archive_zstd_run(w, stream, level, input, output);
+#endif
+#ifdef ZELL_HAVE_BROTLI
+        if (codec == ARCHIVE_CODEC_BROTLI) status = archive_brotli_run(w, stream, level, input, output);
+#endif
+    }
+    zell_pool_put(input);
+    zell_pool_put(output);
+    return status != 0 || w->sink->failed ? -1 : 0;
+}
+
+static int64_t tar_write(ArchiveWriter* w, ArchiveEntry* entries, int count, int codec, int level) {
+    ArchiveStream stream;
+    ArchiveSegment* segments = tar_build_stream(entries, count, &stream);
+    if (!segments) return -1;
+    int status = archive_compress_stream(w, &stream, codec, level);
+    free(segments);
+    return status != 0 ? -1 : w->position;
+}
+
+static int64_t archive_write(ArchiveEntry* entries, int count, ZellSink* sink, int format, int level, int num_threads) {
+    ArchiveWriter writer;
+    int64_t result = -1;
+    if (archive_writer_init(&writer, sink, level, num_threads) == 0) {
+        archive_prepare_entries(entries, count, writer.level);
+        switch (format) {
+            case ARCHIVE_ZIP: result = zip_write(&writer, entries, count); break;
+            case ARCHIVE_TAR_GZ: result = tar_write(&writer, entries, count, ARCHIVE_CODEC_GZIP, level); break;
+            case ARCHIVE_TAR_ZSTD: result = tar_write(&writer, entries, count, ARCHIVE_CODEC_ZSTD, level); break;
+            case ARCHIVE_TAR_BROTLI: result = tar_write(&writer, entries, count, ARCHIVE_CODEC_BROTLI, level); break;
+        }
+    }
+    archive_writer_free(&writer);
+    return result;
+}
+
+// Flush and release the sink; a failed write fails the job
+static int64_t archive_sink_finish(ZellSink* sink, int64_t result) {
+    if (zell_sink_close(sink) != 0) return -1;
+    return result;
+}
+
+/**
+ * Write an archive of buffers into a sink. Blocks are deflated on a thread
+ * pool (see "Parallel deflate"); JPEG, MP4, MP3 and other already-compressed
+ * files are stored as they are.
+ * @param inputs - Array of file contents
+ * @param input_sizes - Array of content sizes
+ * @param names - Array of paths inside the archive ('/' separated, UTF-8)
+ * @param count - Number of files
+ * @param write_at - Receives the output (see ZellWriteAt)
+ * @param ctx - Opaque pointer passed to write_at
+ * @param format - Archive format (0=ZIP, 1=TAR.GZ, 2=TAR.ZST, 3=TAR.BR)
+ * @param level - Level on the codec's scale: deflate 0-9 (0=store everything),
+ *                Zstandard 1-22, Brotli 0-11
+ * @param num_threads - Worker count (0 = one per core)
+ * @return -1 on error, archive size on success
+ */
+EMSCRIPTEN_KEEPALIVE
+int64_t create_archive_sink(unsigned char** inputs, const int64_t* input_sizes, const char** names, int count,
+                            ZellWriteAt write_at, void* ctx, int format, int level, int num_threads) {
+    ZELL_STATS_CALL("create_archive_sink", zell_stats_total(input_sizes, count));
+    if (!inputs || !input_sizes || !names || count <= 0) return -1;
+    ZellSink sink;
+    if (zell_sink_init(&sink, write_at, ctx) != 0) return -1;
+
+    int64_t result = -1;
+    ArchiveEntry* entries = archive_entries_from_buffers(inputs, input_sizes, names, count);
+    if (entries) {
+        result = archive_write(entries, count, &sink, format, level, num_threads);
+        archive_entries_free(entries, count);
+    }
+    return ZELL_STATS_RESULT(archive_sink_finish(&sink, result));
+}
+
+/**
+ * Write an archive of files into a sink (see create_archive_sink). Files are
+ * mapped rather than read where the platform allows it.
+ * @param paths - Array of file paths
+ * @param names - Array of paths inside the archive, or NULL (or NULL items)
+ *                to use the file names
+ * @param count - Number of files
+ * @param write_at - Receives the output (see ZellWriteAt)
+ * @param ctx - Opaque pointer passed to write_at
+ * @param format - Archive format (0=ZIP, 1=TAR.GZ, 2=TAR.ZST, 3=TAR.BR)
+ * @param level - Level on the codec's scale: deflate 0-9 (0=store everything),
+ *                Zstandard 1-22, Brotli 0-11
+ * @param num_threads - Worker count (0 = one per core)
+ * @return -1 on error, archive size on success
+ */
+EMSCRIPTEN_KEEPALIVE
+int64_t create_archive_files(const char** paths, const char** names, int count,
+                             ZellWriteAt write_at, void* ctx, int format, int level, int num_threads) {
+    ZELL_STATS_CALL("create_archive_files", 0);
+    if (!paths || count <= 0) return -1;
+    ZellSink sink;
+    if (zell_sink_init(&sink, write_at, ctx) != 0) return -1;
+
+    int64_t result = -1;
+    ArchiveEntry* entries = archive_entries_from_files(paths, names, count);
+    if (entries) {
+        int64_t total = 0;
+        for (int i = 0; i < count; i++) total += entries[i].source.size;
+        ZELL_STATS_INPUT(total);
+        result = archive_write(entries, count, &sink, format, level, num_threads);
+        archive_entries_free(entries, count);
+    }
+    return ZELL_STATS_RESULT(archive_sink_finish(&sink, result));
+}
+
+// ---------------------------------------------------------------------------
+// Single inputs
+//
+// compress_*_sink write one input as a .gz, .zst or .br file.  choose_codec
+// picks the codec and level for a target speed: it compresses a sample of
+// the input (eight 64KB pieces spread over it) at a ladder of settings,
+// scales each measured speed by the workers that codec would get, and
+// takes the smallest output among the settings fast enough, preferring the
+// faster of two that are within 1% of each other.  Incompressible samples
+// stop the ladder at its fastest step, and sampling stops once it has taken
+// a tenth of the time the whole job may take at the target speed.
+// ---------------------------------------------------------------------------
+
+#define ARCHIVE_SAMPLE_PIECE ((int64_t)64 << 10)
+#define ARCHIVE_SAMPLE_PIECES 8
+
+typedef struct {
+    int codec;
+    int level;
+} ArchiveSetting;
+
+// Roughly fastest first; gzip is only tried when Zstandard is unavailable,
+// as it never beats it at the same speed
+static const ArchiveSetting archive_ladder[] = {
+    { ARCHIVE_CODEC_ZSTD, 1 }, { ARCHIVE_CODEC_GZIP, 1 }, { ARCHIVE_CODEC_ZSTD, 3 },
+    { ARCHIVE_CODEC_ZSTD, 6 }, { ARCHIVE_CODEC_BROTLI, 4 }, { ARCHIVE_CODEC_GZIP, 6 },
+    { ARCHIVE_CODEC_ZSTD, 12 }, { ARCHIVE_CODEC_BROTLI, 6 }, { ARCHIVE_CODEC_GZIP, 9 },
+    { ARCHIVE_CODEC_ZSTD, 16 }, { ARCHIVE_CODEC_BROTLI, 9 }, { ARCHIVE_CODEC_ZSTD, 19 },
+    { ARCHIVE_CODEC_BROTLI, 11 },
+};
+
+static double archive_seconds(void) {
+#ifdef __EMSCRIPTEN__
+    return emscripten_get_now() / 1000.0;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+#endif
+}
+
+/**
+ * Compress a sample in one shot, single-threaded
+ * @return -1 on error, compressed size on success
+ */
+static int64_t archive_compress_sample(const ArchiveSetting* setting, const unsigned char* sample, int64_t length,
+                                       unsigned char* out, int64_t capacity) {
+    switch (setting->codec) {
+        case ARCHIVE_CODEC_GZIP:
+            return zell_deflate(sample, (size_t)length, setting->level, ZELL_DEFLATE_ZLIB, out, (size_t)capacity);
+#ifdef ZELL_HAVE_ZSTD
+        case ARCHIVE_CODEC_ZSTD: {
+            size_t size = ZSTD_compress(out, (size_t)capacity, sample, (size_t)length, setting->level);
+            return ZSTD_isError(size) ? -1 : (int64_t)size;
+        }
+#endif
+#ifdef ZELL_HAVE_BROTLI
+        case ARCHIVE_CODEC_BROTLI: {
+            size_t size = (size_t)capacity;
+            return BrotliEncoderCompress(setting->level, ARCHIVE_BROTLI_WINDOW, BROTLI_MODE_GENERIC, (size_t)length,
+                                         sample, &size, out) ? (int64_t)size : -1;
+        }
+#endif
+        default:
+            return -1;
+    }
+}
+
+// Workers a codec would put on an input of this size
+static int archive_codec_workers(int codec, int threads, int64_t size) {
+    int64_t unit;
+    if (codec == ARCHIVE_CODEC_GZIP) {
+        unit = ARCHIVE_BLOCK;
+    } else if (codec == ARCHIVE_CODEC_ZSTD) {
+#ifdef ZELL_HAVE_ZSTD
+        ZSTD_CCtx* cctx = ZSTD_createCCtx();
+        int threaded = cctx && !ZSTD_isError(ZSTD_CCtx_setParameter(cctx, ZSTD_c_nbWorkers, 2));
+        ZSTD_freeCCtx(cctx);
+        if (!threaded) return 1;
+#endif
+        unit = ARCHIVE_ZSTD_JOB;
+    } else {
+        return 1;
+    }
+    int64_t units = size / unit > 0 ? size / unit : 1;
+    return units < threads ? (int)units : threads;
+}
+
+/**
+ * Pick a codec and level for a source
+ * @return -1 on error, codec on success
+ */
+static int archive_choose(const ZellSource* source, int target_speed, int num_threads, int* level) {
+    int64_t sample_length = source->size;
+    if (sample_length > ARCHIVE_SAMPLE_PIECE * ARCHIVE_SAMPLE_PIECES) {
+        sample_length = ARCHIVE_SAMPLE_PIECE * ARCHIVE_SAMPLE_PIECES;
+    }
+    int64_t capacity = sample_length + (sample_length >> 6) + 4096;  // above every codec's bound
+    unsigned char* sample = (unsigned char*)malloc((size_t)sample_length + 1);
+    unsigned char* out = (unsigned char*)malloc((size_t)capacity);
+    if (!sample || !out) {
+        free(sample);
+        free(out);
+        return -1;
+    }
+
+    int status = 0;
+    if (sample_length == source->size) {
+        status = zell_source_read(source, 0, sample, sample_length) == sample_length ? 0 : -1;
+    } else {
+        for (int i = 0; i < ARCHIVE_SAMPLE_PIECES && status == 0; i++) {
+            int64_t offset = (source->size - ARCHIVE_SAMPLE_PIECE) / (ARCHIVE_SAMPLE_PIECES - 1) * i;
+            if (zell_source_read(source, offset, sample + i * ARCHIVE_SAMPLE_PIECE, ARCHIVE_SAMPLE_PIECE) !=
+                ARCHIVE_SAMPLE_PIECE) status = -1;
+        }
+    }
+
+    int threads = zell_resolve_threads(num_threads);
+    int workers[3];
+    for (int codec = 0; codec < 3; codec++) workers[codec] = archive_codec_workers(codec, threads, source->size);
+    int best = -1, fastest = -1;
+    int64_t best_size = 0;
+    double fastest_speed = 0;
+    // Sampling may take a tenth of what the job itself is allowed
+    double budget = (double)source->size / 1e6 / (target_speed > 0 ? target_speed : 1) / 10;
+    double spent = 0;
+    int too_slow[3] = { 0, 0, 0 };
+    for (int i = 0; status == 0 && i < (int)(sizeof(archive_ladder) / sizeof(archive_ladder[0])) &&
+                    (best < 0 || spent < budget); i++) {
+        const ArchiveSetting* setting = &archive_ladder[i];
+        if (!archive_codec_available(setting->codec) || too_slow[setting->codec]) continue;
+        if (setting->codec == ARCHIVE_CODEC_GZIP && archive_codec_available(ARCHIVE_CODEC_ZSTD)) continue;
+
+        double start = archive_seconds();
+        int64_t size = archive_compress_sample(setting, sample, sample_length, out, capacity);
+        double elapsed = archive_seconds() - start;
+        spent += elapsed;
+        if (size < 0) continue;
+        // MB/s over the whole input, with the workers the codec would use
+        double speed = elapsed > 0 ? (double)sample_length / elapsed / 1e6 : 1e9;
+        speed *= workers[setting->codec];
+
+        if (fastest < 0 || speed > fastest_speed) {
+            fastest = i;
+            fastest_speed = speed;
+        }
+        if (speed < target_speed) {
+            too_slow[setting->codec] = 1;  // higher levels of it are slower still
+            continue;
+        }
+        if (best < 0 || size * 100 < best_size * 99) {
+            best = i;
+            best_size = size;
+        }
+        if (size * 100 >= sample_length * 97) break;  // incompressible
+    }
+    free(sample);
+    free(out);
+
+    if (best < 0) best = fastest;
+    if (status != 0 || best < 0) return -1;
+    if (level) *level = archive_ladder[best].level;
+    return archive_ladder[best].codec;
+}
+
+static int64_t archive_compress_source(const ZellSource* source, ZellSink* sink, int codec, int level, int num_threads) {
+    // Parallel deflate reads from its workers, which a plain callback cannot serve
+    if (codec == ARCHIVE_CODEC_GZIP && !source->concurrent) num_threads = 1;
+    ArchiveSegment segment = { 0, source->size, NULL, source, 0 };
+    ArchiveStream stream = { &segment, 1, source->size, 0 };
+    ArchiveWriter writer;
+    int64_t result = -1;
+    if (archive_writer_init(&writer, sink, level, num_threads) == 0 &&
+        archive_compress_stream(&writer, &stream, codec, level) == 0) {
+        result = writer.position;
+    }
+    archive_writer_free(&writer);
+    return result;
+}
+
+/**
+ * Whether a codec is built in
+ * @param codec - 0=gzip, 1=Zstandard, 2=Brotli
+ * @return 1 if compress_*_sink and the tar formats accept it, 0 otherwise
+ */
+EMSCRIPTEN_KEEPALIVE
+int compress_codec_available(int codec) {
+    return archive_codec_available(codec);
+}
+
+/**
+ * Pick the codec and level that compress an input best while keeping up
+ * with a target speed (see "Single inputs")
+ * @param input - Input data
+ * @param input_size - Size of input data
+ * @param target_speed - Slowest acceptable speed, in MB of input per second
+ * @param num_threads - Worker count the compression will get (0 = one per core)
+ * @param level - Receives the level on the codec's scale (may be NULL)
+ * @return -1 on error, codec (0=gzip, 1=Zstandard, 2=Brotli) on success
+ */
+EMSCRIPTEN_KEEPALIVE
+int choose_codec(const unsigned char* input, int64_t input_size, int target_speed, int num_threads, int* level) {
+    ZELL_STATS_CALL("choose_codec", input_size);
+    if (!input || input_size <= 0) return -1;
+    ZellSource source;
+    zell_source_memory(&source, input, input_size);
+    return ZELL_STATS_STATUS(archive_choose(&source, target_speed, num_threads, level));
+}
+
+/**
+ * Pick a codec and level for an input read through a callback (see
+ * choose_codec); only the sample is read
+ * @param read_at - Reads part of the input (see ZellReadAt)
+ * @param ctx - Opaque pointer passed to read_at
+ * @param input_size - Size of input
+ * @param target_speed - Slowest acceptable speed, in MB of input per second
+ * @param num_threads - Worker count the compression will get (0 = one per core)
+ * @param level - Receives the level on the codec's scale (may be NULL)
+ * @return -1 on error, codec (0=gzip, 1=Zstandard, 2=Brotli) on success
+ */
+EMSCRIPTEN_KEEPALIVE
+int choose_codec_source(ZellReadAt read_at, void* ctx, int64_t input_size, int target_speed, int num_threads,
+                        int* level) {
+    ZELL_STATS_CALL("choose_codec_source", input_size);
+    if (!read_at || input_size <= 0) return -1;
+    ZellSource source;
+    zell_source_callback(&source, read_at, ctx, input_size, 0);
+    return ZELL_STATS_STATUS(archive_choose(&source, target_speed, num_threads, level));
+}
+
+/**
+ * Compress a buffer into a sink as a .gz, .zst or .br file
+ * @param input - Input data
+ * @param input_size - Size of input data
+ * @param write_at - Receives the output (see ZellWriteAt)
+ * @param ctx - Opaque pointer passed to write_at
+ * @param codec - 0=gzip, 1=Zstandard, 2=Brotli
+ * @param level - Level on the codec's scale: 0-9, 1-22, 0-11
+ * @param num_threads - Worker count (0 = one per core); Brotli uses one
+ * @return -1 on error, compressed size on success
+ */
+EMSCRIPTEN_KEEPALIVE
+int64_t compress_data_sink(const unsigned char* input, int64_t input_size, ZellWriteAt write_at, void* ctx,
+                           int codec, int level, int num_threads) {
+    ZELL_STATS_CALL("compress_data_sink", input_size);
+    if ((!input && input_size != 0) || input_size < 0) return -1;
+    ZellSink sink;
+    if (zell_sink_init(&sink, write_at, ctx) != 0) return -1;
+    ZellSource source;
+    zell_source_memory(&source, input, input_size);
+    int64_t result = archive_compress_source(&source, &sink, codec, level, num_threads);
+    return ZELL_STATS_RESULT(archive_sink_finish(&sink, result));
+}
+
+/**
+ * Compress an input read through a callback into a sink (see
+ * compress_data_sink)
+ * @param read_at - Reads part of the input (see ZellReadAt)
+ * @param read_ctx - Opaque pointer passed to read_at
+ * @param input_size - Size of input
+ * @param concurrent - Whether read_at may be called from several threads at once
+ * @param write_at - Receives the output (see ZellWriteAt)
+ * @param ctx - Opaque pointer passed to write_at
+ * @param codec - 0=gzip, 1=Zstandard, 2=Brotli
+ * @param level - Level on the codec's scale: 0-9, 1-22, 0-11
+ * @param num_threads - Worker count (0 = one per core); Brotli uses one
+ * @return -1 on error, compressed size on success
+ */
+EMSCRIPTEN_KEEPALIVE
+int64_t compress_source_sink(ZellReadAt read_at, void* read_ctx, int64_t input_size, int concurrent,
+                             ZellWriteAt write_at, void* ctx, int codec, int level, int num_threads) {
+    ZELL_STATS_CALL("compress_source_sink", input_size);
+    if (!read_at || input_size < 0) return -1;
+    ZellSink sink;
+    if (zell_sink_init(&sink, write_at, ctx) != 0) return -1;
+    ZellSource source;
+    zell_source_callback(&source, read_at, read_ctx, input_size, concurrent);
+    int64_t result = archive_compress_source(&source, &sink, codec, level, num_threads);
+    return ZELL_STATS_RESULT(archive_sink_finish(&sink, result));
+}
+
+// ---------------------------------------------------------------------------
+// Reading ZIP
+//
+// Opening an archive parses the end records and the central directory into
+// a compact index and nothing else, so listing costs one read of the
+// directory however many entries there are.  An entry is inflated on demand
+// straight into the caller's buffer (or a sink), reading only its own local
+// header and data.
+//
+// The source may hold just the end of the archive: enough to index it, for
+// callers that read files piecewise (zip_directory_start says how much),
+// with each entry's bytes passed in to zip_extract_from when needed.
+// ---------------------------------------------------------------------------
+
+#define ZIP_TAIL_MAX (22 + 65535)  // end record and the longest comment
+#define ZIP_READ_CHUNK ((int64_t)64 << 10)
+
+typedef struct {
+    int64_t offset;              // of the local header
+    int64_t compressed;
+    int64_t size;
+    uint32_t crc;
+    uint32_t name_offset;        // in ZipArchive.names, always UTF-8
+    uint32_t name_length;        // CP437 names grow when converted
+    uint16_t method;
+    uint16_t flags;
+    uint16_t dos_time;
+    uint16_t dos_date;
+} ZipEntry;
+
+typedef struct {
+    ZellSource source;
+    int opened;                  // source owns a file
+    int64_t base;                // archive offset of the source's first byte
+    int64_t archive_size;
+    int64_t directory_offset;
+    ZipEntry* entries;
+    int count;
+    char* names;
+    int32_t* lookup;             // open-addressed name table, built on first zip_find
+    uint32_t lookup_mask;
+    int64_t* offsets;            // local header offsets in order, built on first zip_entry_span
+} ZipArchive;
+
+static uint32_t zip_le16(const unsigned char* p) {
+    return (uint32_t)p[0] | (uint32_t)p[1] << 8;
+}
+
+static uint32_t zip_le32(const unsigned char* p) {
+    return zip_le16(p) | zip_le16(p + 2) << 16;
+}
+
+static uint64_t zip_le64(const unsigned char* p) {
+    return (uint64_t)zip_le32(p) | (uint64_t)zip_le32(p + 4) << 32;
+}
+
+/**
+ * Read a range of the archive from a source holding it from `base` on
+ * @return -1 on error (including ranges before base), 0 on success
+ */
+static int zip_read(const ZellSource* source, int64_t base, int64_t offset, unsigned char* buffer, int64_t length) {
+    if (offset < base) return -1;
+    return zell_source_read(source, offset - base, buffer, length) == length ? 0 : -1;
+}
+
+typedef struct {
+    int64_t directory_offset;
+    int64_t directory_size;
+    int64_t count;
+    int64_t record_offset;       // first byte of the end records
+} ZipEnd;
+
+/**
+ * Find the end of central directory record (and the ZIP64 one if there is
+ * one) in the tail of an archive
+ * @param tail - Last bytes of the archive
+ * @param tail_size - Their number
+ * @param archive_size - Size of the whole archive
+ * @return -1 if there is none, 0 on success
+ */
+static int zip_find_end(const unsigned char* tail, int64_t tail_size, int64_t archive_size, ZipEnd* end) {
+    int64_t tail_base = archive_size - tail_size;
+    for (int64_t i = tail_size - 22; i >= 0; i--) {
+        const unsigned char* record = tail + i;
+        if (zip_le32(record) != ZIP_END_SIG) continue;
+        // The comment must run exactly to the end of the archive
+        if (i + 22 + zip_le16(record + 20) != tail_size) continue;
+
+        end->count = zip_le16(record + 10);
+        end->directory_size = zip_le32(record + 12);
+        end->directory_offset = zip_le32(record + 16);
+        end->record_offset = tail_base + i;
+
+        int64_t locator = i - 20;
+        if (locator >= 0 && zip_le32(tail + locator) == ZIP64_LOCATOR_SIG) {
+            int64_t record64 = (int64_t)zip_le64(tail + locator + 8) - tail_base;
+            if (record64 < 0 || record64 + 56 > locator || zip_le32(tail + record64) != ZIP64_END_SIG) return -1;
+            end->count = (int64_t)zip_le64(tail + record64 + 32);
+            end->directory_size = (int64_t)zip_le64(tail + record64 + 40);
+            end->directory_offset = (int64_t)zip_le64(tail + record64 + 48);
+            end->record_offset = tail_base + record64;
+        }
+        if (end->directory_offset < 0 || end->directory_size < 0 || end->count < 0 ||
+            end->directory_offset + end->directory_size > end->record_offset) return -1;
+        return 0;
+    }
+    return -1;
+}
+
+/**
+ * Read the end records of an archive source
+ * @return -1 on error, 0 on success
+ */
+static int zip_read_end(const ZellSource* source, int64_t base, int64_t archive_size, ZipEnd* end) {
+    int64_t available = archive_size - base;
+    int64_t tail_size = available < ZIP_TAIL_MAX + 20 + 56 ? available : ZIP_TAIL_MAX + 20 + 56;
+    unsigned char* tail = (unsigned char*)malloc((size_t)tail_size + 1);
+    if (!tail) return -1;
+    int status = -1;
+    if (zip_read(source, base, archive_size - tail_size, tail, tail_size) == 0) {
+        status = zip_find_end(tail, tail_size, archive_size, end);
+        // A ZIP64 end record further back than the comment window
+        if (status != 0 && tail_size < available) {
+            free(tail);
+            return -1;
+        }
+    }
+    free(tail);
+    return status;
+}
+
+// Sizes and offset from a ZIP64 extra field, for the fields that overflowed
+static void zip_apply_zip64(ZipEntry* entry, const unsigned char* extra, uint32_t extra_length,
+                            int size64, int compressed64, int offset64) {
+    uint32_t at = 0;
+    while (at + 4 <= extra_length) {
+        uint32_t id = zip_le16(extra + at), length = zip_le16(extra + at + 2);
+        const unsigned char* field = extra + at + 4;
+        at += 4 + length;
+        if (at > extra_length) return;
+        if (id != 0x0001) continue;
+
+        uint32_t used = 0;
+        if (size64 && used + 8 <= length) { entry->size = (int64_t)zip_le64(field + used); used += 8; }
+        if (compressed64 && used + 8 <= length) { entry->compressed = (int64_t)zip_le64(field + used); used += 8; }
+        if (offset64 && used + 8 <= length) entry->offset = (int64_t)zip_le64(field + used);
+        return;
+    }
+}
+
+// Code points of CP437 bytes 0x80-0xFF: names without the UTF-8 flag are in
+// this DOS code page (APPNOTE appendix D)
+static const uint16_t zip_cp437[128] = {
+    0x00C7, 0x00FC, 0x00E9, 0x00E2, 0x00E4, 0x00E0, 0x00E5, 0x00E7,
+    0x00EA, 0x00EB, 0x00E8, 0x00EF, 0x00EE, 0x00EC, 0x00C4, 0x00C5,
+    0x00C9, 0x00E6, 0x00C6, 0x00F4, 0x00F6, 0x00F2, 0x00FB, 0x00F9,
+    0x00FF, 0x00D6, 0x00DC, 0x00A2, 0x00A3, 0x00A5, 0x20A7, 0x0192,
+    0x00E1, 0x00ED, 0x00F3, 0x00FA, 0x00F1, 0x00D1, 0x00AA, 0x00BA,
+    0x00BF, 0x2310, 0x00AC, 0x00BD, 0x00BC, 0x00A1, 0x00AB, 0x00BB,
+    0x2591, 0x2592, 0x2593, 0x2502, 0x2524, 0x2561, 0x2562, 0x2556,
+    0x2555, 0x2563, 0x2551, 0x2557, 0x255D, 0x255C, 0x255B, 0x2510,
+    0x2514, 0x2534, 0x252C, 0x251C, 0x2500, 0x253C, 0x255E, 0x255F,
+    0x255A, 0x2554, 0x2569, 0x2566, 0x2560, 0x2550, 0x256C, 0x2567,
+    0x2568, 0x2564, 0x2565, 0x2559, 0x2558, 0x2552, 0x2553, 0x256B,
+    0x256A, 0x2518, 0x250C, 0x2588, 0x2584, 0x258C, 0x2590, 0x2580,
+    0x03B1, 0x00DF, 0x0393, 0x03C0, 0x03A3, 0x03C3, 0x00B5, 0x03C4,
+    0x03A6, 0x0398, 0x03A9, 0x03B4, 0x221E, 0x03C6, 0x03B5, 0x2229,
+    0x2261, 0x00B1, 0x2265, 0x2264, 0x2320, 0x2321, 0x00F7, 0x2248,
+    0x00B0, 0x2219, 0x00B7, 0x221A, 0x207F, 0x00B2, 0x25A0, 0x00A0,
+};
+
+/**
+ * Convert a CP437 entry name to UTF-8
+ * @param output - Destination, or NULL to only measure
+ * @param name - Name as stored
+ * @param length - Its length
+ * @return UTF-8 length
+ */
+static size_t zip_cp437_to_utf8(char* output, const unsigned char* name, size_t length) {
+    size_t used = 0;
+    for (size_t i = 0; i < length; i++) {
+        uint32_t c = name[i] < 0x80 ? name[i] : zip_cp437[name[i] - 0x80];
+        if (c < 0x80) {
+            if (output) output[used] = (char)c;
+            used += 1;
+        } else if (c < 0x800) {
+            if (output) {
+                output[used] = (char)(0xC0 | c >> 6);
+                output[used + 1] = (char)(0x80 | (c & 0x3F));
+            }
+            used += 2;
+        } else {
+            if (output) {
+                output[used] = (char)(0xE0 | c >> 12);
+                output[used + 1] = (char)(0x80 | (c >> 6 & 0x3F));
+                output[used + 2] = (char)(0x80 | (c & 0x3F));
+            }
+            used += 3;
+        }
+    }
+    return used;
+}
+
+/**
+ * Index a central directory
+ * @return -1 on error, 0 on success
+ */
+static int zip_index(ZipArchive* archive, const unsigned char* directory, int64_t directory_size, int64_t hint) {
+    // Every header takes at least 46 bytes, which bounds a corrupt count
+    int64_t capacity = directory_size / 46;
+    if (hint < capacity) capacity = hint;
+    if (capacity > INT32_MAX - 1) return -1;
+    archive->entries = (ZipEntry*)malloc(sizeof(ZipEntry) * (size_t)(capacity > 0 ? capacity : 1));
+    // Enough for every name as stored; only CP437 names with accents or
+    // box-drawing characters can need more
+    size_t names_capacity = (size_t)directory_size + 1;
+    archive->names = (char*)malloc(names_capacity);
+    if (!archive->entries || !archive->names) return -1;
+
+    int64_t at = 0;
+    size_t names_used = 0;
+    while (at + 46 <= directory_size && zip_le32(directory + at) == ZIP_CENTRAL_SIG) {
+        const unsigned char* header = directory + at;
+        uint32_t name_length = zip_le16(header + 28);
+        uint32_t extra_length = zip_le16(header + 30);
+        uint32_t comment_length = zip_le16(header + 32);
+        if (at + 46 + name_length + extra_length + comment_length > directory_size) return -1;
+
+        if (archive->count == capacity) {
+            int64_t grown = capacity * 2 + 16;
+            if (grown > directory_size / 46 + 1) grown = directory_size / 46 + 1;
+            ZipEntry* entries = (ZipEntry*)realloc(archive->entries, sizeof(ZipEntry) * (size_t)grown);
+            if (!entries) return -1;
+            archive->entries = entries;
+            capacity = grown;
+        }
+        ZipEntry* entry = &archive->entries[archive->count++];
+        entry->flags = (uint16_t)zip_le16(header + 8);
+        entry->method = (uint16_t)zip_le16(header + 10);
+        entry->dos_time = (uint16_t)zip_le16(header + 12);
+        entry->dos_date = (uint16_t)zip_le16(header + 14);
+        entry->crc = zip_le32(header + 16);
+        entry->compressed = zip_le32(header + 20);
+        entry->size = zip_le32(header + 24);
+        entry->offset = zip_le32(header + 42);
+        const unsigned char* name = header + 46;
+        int cp437 = !(entry->flags & ZIP_FLAG_UTF8);
+        size_t stored_length = cp437 ? zip_cp437_to_utf8(NULL, name, name_length) : name_length;
+        if (names_used + stored_length > UINT32_MAX) return -1;
+        if (names_used + stored_length > names_capacity) {
+            size_t grown = names_capacity * 2 > names_used + stored_length ? names_capacity * 2
+                                                                           : names_used + stored_length;
+            char* names = (char*)realloc(archive->names, grown);
+            if (!names) return -1;
+            archive->names = names;
+            names_capacity = grown;
+        }
+        entry->name_offset = (uint32_t)names_used;
+        entry->name_length = (uint32_t)stored_length;
+        if (cp437) {
+            zip_cp437_to_utf8(archive->names + names_used, name, name_length);
+        } else {
+            memcpy(archive->names + names_used, name, name_length);
+        }
+        names_used += stored_length;
+
+        int size64 = entry->size == ZIP_MAX32, compressed64 = entry->compressed == ZIP_MAX32;
+        int offset64 = entry->offset == ZIP_MAX32;
+        if (size64 || compressed64 || offset64) {
+            zip_apply_zip64(entry, header + 46 + name_length, extra_length, size64, compressed64, offset64);
+        }
+        if (entry->offset + 30 > archive->directory_offset || entry->compressed < 0 || entry->size < 0) return -1;
+        at += 46 + name_length + extra_length + comment_length;
+    }
+    return 0;
+}
+
+static void zip_archive_free(ZipArchive* archive) {
+    if (!archive) return;
+    if (archive->opened) zell_source_close(&archive->source);
+    free(archive->entries);
+    free(archive->names);
+    free(archive->lookup);
+    free(archive->offsets);
+    free(archive);
+}
+
+/**
+ * Index an archive whose bytes from `base` on are in `archive->source`
+ * @return -1 on error, 0 on success
+ */
+static int zip_load(ZipArchive* archive) {
+    ZipEnd end;
+    if (zip_read_end(&archive->source, archive->base, archive->archive_size, &end) != 0) return -1;
+    archive->directory_offset = end.directory_offset;
+
+    int status = -1;
+    const unsigned char* directory = NULL;
+    unsigned char* copy = NULL;
+    if (end.directory_offset >= archive->base && archive->source.data) {
+        directory = archive->source.data + (end.directory_offset - archive->base);
+    } else if ((copy = (unsigned char*)malloc((size_t)end.directory_size + 1)) != NULL &&
+               zip_read(&archive->source, archive->base, end.directory_offset, copy, end.directory_size) == 0) {
+        directory = copy;
+    }
+    if (directory) status = zip_index(archive, directory, end.directory_size, end.count);
+    free(copy);
+    return status;
+}
+
+static ZipArchive* zip_archive_new(void) {
+    return (ZipArchive*)calloc(1, sizeof(ZipArchive));
+}
+
+static ZipArchive* zip_open_loaded(ZipArchive* archive) {
+    ZELL_STATS_STAGE(ZELL_STAGE_PARSE, "zip_index");
+    if (zip_load(archive) != 0) {
+        zip_archive_free(archive);
+        return NULL;
+    }
+    return archive;
+}
+
+/**
+ * Where the data needed to index an archive starts: its central directory,
+ * or the ZIP64 end record if that comes first. Lets a caller that reads
+ * files piecewise hand zip_open only the end of the archive.
+ * @param tail - Last bytes of the archive: up to 65557 + 76, or all of it
+ * @param tail_size - Their number
+ * @param archive_size - Size of the whole archive
+ * @return -1 if this is not a ZIP archive, offset in the archive on success
+ */
+EMSCRIPTEN_KEEPALIVE
+int64_t zip_directory_start(const unsigned char* tail, int64_t tail_size, int64_t archive_size) {
+    ZELL_STATS_CALL("zip_directory_start", tail_size);
+    ZipEnd end;
+    if (!tail || tail_size < 22 || tail_size > archive_size) return -1;
+    if (zip_find_end(tail, tail_size, archive_size, &end) != 0) return -1;
+    return ZELL_STATS_RESULT(end.directory_offset < end.record_offset ? end.directory_offset : end.record_offset);
+}
+
+/**
+ * Open a ZIP archive held in memory. The buffer must stay valid until
+ * zip_close.
+ * @param data - The archive, or its last input_size bytes
+ * @param input_size - Number of bytes at data
+ * @param archive_size - Size of the whole archive (input_size if data holds
+ *                       all of it; less only down to zip_directory_start)
+ * @return Archive (release with zip_close), or NULL on error
+ */
+EMSCRIPTEN_KEEPALIVE
+ZipArchive* zip_open(const unsigned char* data, int64_t input_size, int64_t archive_size) {
+    ZELL_STATS_CALL("zip_open", input_size);
+    if (!data || input_size < 22 || input_size > archive_size) return NULL;
+    ZipArchive* archive = zip_archive_new();
+    if (!archive) return NULL;
+    zell_source_memory(&archive->source, data, input_size);
+    archive->base = archive_size - input_size;
+    archive->archive_size = archive_size;
+    return zip_open_loaded(archive);
+}
+
+/**
+ * Open a ZIP archive file; only its directory is read
+ * @param path - Path of the archive
+ * @return Archive (release with zip_close), or NULL on error
+ */
+EMSCRIPTEN_KEEPALIVE
+ZipArchive* zip_open_file(const char* path) {
+    ZELL_STATS_CALL("zip_open_file", 0);
+    ZipArchive* archive = zip_archive_new();
+    if (!archive) return NULL;
+    if (!path || zell_source_open_file(&archive->source, path) != 0) {
+        free(archive);
+        return NULL;
+    }
+    archive->opened = 1;
+    archive->archive_size = archive->source.size;
+    return zip_open_loaded(archive);
+}
+
+/**
+ * Open a ZIP archive read through a callback, which must stay callable
+ * until zip_close
+ * @param read_at - Reads part of the archive (see ZellReadAt)
+ * @param ctx - Opaque pointer passed to read_at
+ * @param input_size - Size of the archive
+ * @param concurrent - Whether read_at may be called from several threads at once
+ * @return Archive (release with zip_close), or NULL on error
+ */
+EMSCRIPTEN_KEEPALIVE
+ZipArchive* zip_open_source(ZellReadAt read_at, void* ctx, int64_t input_size, int concurrent) {
+    ZELL_STATS_CALL("zip_open_source", input_size);
+    if (!read_at || input_size < 22) return NULL;
+    ZipArchive* archive = zip_archive_new();
+    if (!archive) return NULL;
+    zell_source_callback(&archive->source, read_at, ctx, input_size, concurrent);
+    archive->archive_size = input_size;
+    return zip_open_loaded(archive);
+}
+
+EMSCRIPTEN_KEEPALIVE
+void zip_close(ZipArchive* archive) {
+    zip_archive_free(archive);
+}
+
+/**
+ * @return -1 on error, number of entries on success
+ */
+EMSCRIPTEN_KEEPALIVE
+int zip_entry_count(const ZipArchive* archive) {
+    return archive ? archive->count : -1;
+}
+
+static uint32_t zip_name_hash(const char* name, size_t length) {
+    uint32_t hash = 2166136261u;  // FNV-1a
+    for (size_t i = 0; i < length; i++) hash = (hash ^ (unsigned char)name[i]) * 16777619u;
+    return hash;
+}
+
+static int zip_build_lookup(ZipArchive* archive) {
+    uint32_t slots = 16;
+    while (slots < (uint32_t)archive->count * 2) slots *= 2;
+    archive->lookup = (int32_t*)malloc(sizeof(int32_t) * slots);
+    if (!archive->lookup) return -1;
+    memset(archive->lookup, 0xFF, sizeof(int32_t) * slots);
+    archive->lookup_mask = slots - 1;
+    for (int i = 0; i < archive->count; i++) {
+        const ZipEntry* entry = &archive->entries[i];
+        uint32_t slot = zip_name_hash(archive->names + entry->name_offset, entry->name_length) & archive->lookup_mask;
+        // Of duplicate names the first entry wins, as with sequential readers
+        while (archive->lookup[slot] >= 0) slot = (slot + 1) & archive->lookup_mask;
+        archive->lookup[slot] = i;
+    }
+    return 0;
+}
+
+/**
+ * Look up an entry by its path in the archive
+ * @param archive - Open archive
+ * @param name - Entry path, UTF-8
+ * @return -1 if there is no such entry, entry index on success
+ */
+EMSCRIPTEN_KEEPALIVE
+int zip_find(ZipArchive* archive, const char* name) {
+    if (!archive || !name) return -1;
+    if (!archive->lookup && zip_build_lookup(archive) != 0) return -1;
+    size_t length = strlen(name);
+    uint32_t slot = zip_name_hash(name, length) & archive->lookup_mask;
+    for (int32_t index; (index = archive->lookup[slot]) >= 0; slot = (slot + 1) & archive->lookup_mask) {
+        const ZipEntry* entry = &archive->entries[index];
+        if (entry->name_length == length && memcmp(archive->names + entry->name_offset, name, length) == 0) {
+            return index;
+        }
+    }
+    return -1;
+}
+
+// DOS times are local; mktime is slow, so it runs once per distinct date and hour
+typedef struct {
+    uint32_t key;                // dos_date << 5 | hour, or 0 before the first call
+    int64_t hour_start;
+} ZipTimeCache;
+
+static int64_t zip_dos_to_unix(ZipTimeCache* cache, uint32_t dos_time, uint32_t dos_date) {
+    uint32_t key = dos_date << 5 | dos_time >> 11;
+    if (key != cache->key) {
+        struct tm tm;
+        memset(&tm, 0, sizeof(tm));
+        tm.tm_year = (int)(dos_date >> 9) + 80;
+        tm.tm_mon = (int)((dos_date >> 5) & 15) - 1;
+        tm.tm_mday = (int)(dos_date & 31);
+        tm.tm_hour = (int)(dos_time >> 11);
+        tm.tm_isdst = -1;
+        time_t t = mktime(&tm);
+        cache->key = key;
+        cache->hour_start = t == (time_t)-1 ? 0 : (int64_t)t;
+    }
+    return cache->hour_start + ((dos_time >> 5) & 63) * 60 + (dos_time & 31) * 2;
+}
+
+typedef struct {
+    unsigned char* data;
+    int64_t size;
+    int64_t length;
+} ZipText;
+
+static void zip_text(ZipText* text, const char* bytes, size_t length) {
+    if (text->data && text->length + (int64_t)length <= text->size) {
+        memcpy(text->data + text->length, bytes, length);
+    }
+    text->length += (int64_t)length;
+}
+
+static void zip_text_name(ZipText* text, const char* name, size_t length) {
+    static const char hex[] = "0123456789abcdef";
+    zip_text(text, "\"", 1);
+    for (size_t i = 0; i < length; i++) {
+        unsigned char c = (unsigned char)name[i];
+        if (c == '"' || c == '\\') {
+            char escaped[2] = { '\\', (char)c };
+            zip_text(text, escaped, 2);
+        } else if (c < 0x20) {
+            char escaped[6] = { '\\', 'u', '0', '0', hex[c >> 4], hex[c & 15] };
+            zip_text(text, escaped, 6);
+        } else {
+            zip_text(text, (const char*)&c, 1);
+        }
+    }
+    zip_text(text, "\"", 1);
+}
+
+// A field: ,"key":value
+static void zip_text_field(ZipText* text, const char* key, int64_t value) {
+    char digits[24];
+    int n = 0;
+    uint64_t v = value < 0 ? 0 - (uint64_t)value : (uint64_t)value;
+    do {
+        digits[sizeof(digits) - 1 - n++] = (char)('0' + v % 10);
+        v /= 10;
+    } while (v);
+    if (value < 0) digits[sizeof(digits) - 1 - n++] = '-';
+    zip_text(text, ",\"", 2);
+    zip_text(text, key, strlen(key));
+    zip_text(text, "\":", 2);
+    zip_text(text, digits + sizeof(digits) - n, (size_t)n);
+}
+
+/**
+ * List the entries as JSON: an array of {"name", "size", "compressedSize",
+ * "crc", "method", "directory", "encrypted", "mtime"}, in directory order.
+ * Names are UTF-8; those stored in CP437 are converted.
+ * @param archive - Open archive
+ * @param output_data - Output buffer (NULL with output_size 0 to measure)
+ * @param output_size - Output buffer size
+ * @return -1 on error, listing size on success
+ */
+EMSCRIPTEN_KEEPALIVE
+int64_t zip_list(const ZipArchive* archive, unsigned char* output_data, int64_t output_size) {
+    ZELL_STATS_CALL("zip_list", 0);
+    if (!archive || !zell_output_valid(output_data, output_size)) return -1;
+    ZipText text = { output_data, output_size, 0 };
+    ZipTimeCache times = { 0, 0 };
+    zip_text(&text, "[", 1);
+    for (int i = 0; i < archive->count; i++) {
+        const ZipEntry* entry = &archive->entries[i];
+        const char* name = archive->names + entry->name_offset;
+        int directory = entry->name_length && name[entry->name_length - 1] == '/';
+        zip_text(&text, i ? ",{\"name\":" : "{\"name\":", i ? 9 : 8);
+        zip_text_name(&text, name, entry->name_length);
+        zip_text_field(&text, "size", entry->size);
+        zip_text_field(&text, "compressedSize", entry->compressed);
+        zip_text_field(&text, "crc", entry->crc);
+        zip_text_field(&text, "method", entry->method);
+        zip_text(&text, directory ? ",\"directory\":true" : ",\"directory\":false", directory ? 17 : 18);
+        zip_text(&text, entry->flags & 1 ? ",\"encrypted\":true" : ",\"encrypted\":false", entry->flags & 1 ? 17 : 18);
+        zip_text_field(&text, "mtime", zip_dos_to_unix(&times, entry->dos_time, entry->dos_date));
+        zip_text(&text, "}", 1);
+    }
+    zip_text(&text, "]", 1);
+    if (output_data && text.length > output_size) return -1;
+    return ZELL_STATS_RESULT(text.length);
+}
+
+static int zip_compare_offsets(const void* a, const void* b) {
+    int64_t x = *(const int64_t*)a, y = *(const int64_t*)b;
+    return (x > y) - (x < y);
+}
+
+/**
+ * The bytes of the archive an entry occupies: its local header, data and
+ * data descriptor, up to the next entry or the directory. Callers that read
+ * files piecewise pass exactly these bytes to zip_extract_from.
+ * @param archive - Open archive
+ * @param index - Entry index
+ * @param span - Receives the length
+ * @return -1 on error, offset in the archive on success
+ */
+EMSCRIPTEN_KEEPALIVE
+int64_t zip_entry_span(ZipArchive* archive, int index, int64_t* span) {
+    if (!archive || !span || index < 0 || index >= archive->count) return -1;
+    if (!archive->offsets) {
+        archive->offsets = (int64_t*)malloc(sizeof(int64_t) * (size_t)archive->count);
+        if (!archive->offsets) return -1;
+        for (int i = 0; i < archive->count; i++) archive->offsets[i] = archive->entries[i].offset;
+        qsort(archive->offsets, (size_t)archive->count, sizeof(int64_t), zip_compare_offsets);
+    }
+    int64_t offset = archive->entries[index].offset;
+    int64_t next = archive->directory_offset;
+    int lo = 0, hi = archive->count;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (archive->offsets[mid] <= offset) lo = mid + 1;
+        else hi = mid;
+    }
+    if (lo < archive->count) next = archive->offsets[lo];
+    *span = next - offset;
+    return offset;
+}
+
+// Where an entry's data comes from and where it goes, for the inflate callbacks
+typedef struct {
+    const ZellSource* source;
+    int64_t offset;              // of the next compressed bytes, within the source
+    int64_t remaining;           // compressed bytes not read yet
+    unsigned char* input;
+    ZellSink* sink;
+    int64_t size;                // the entry's size
+    int64_t produced;
+    uint32_t crc;
+} ZipInflate;
+
+static int zip_inflate_more(void* ctx, const unsigned char** data, size_t* size) {
+    ZipInflate* zip = (ZipInflate*)ctx;
+    if (zip->remaining <= 0) return -1;
+    int64_t length = zip->remaining < ZIP_READ_CHUNK ? zip->remaining : ZIP_READ_CHUNK;
+    if (zell_source_read(zip->source, zip->offset, zip->input, length) != length) return -1;
+    zip->offset += length;
+    zip->remaining -= length;
+    *data = zip->input;
+    *size = (size_t)length;
+    return 0;
+}
+
+// Checksum output and pass it to the sink
+static int zip_inflate_emit(ZipInflate* zip, const unsigned char* data, int64_t length) {
+    // More data than the entry's size
+    if (length > zip->size - zip->produced) return -1;
+    zip->crc = zell_crc32(zip->crc, data, (size_t)length);
+    if (zip->sink) zell_sink_put(zip->sink, data, length);
+    zip->produced += length;
+    return 0;
+}
+
+// Hand all but the last window of output to the sink
+static int zip_inflate_room(void* ctx, ZellInflate* z) {
+    size_t keep = z->out_pos < ZELL_DEFLATE_WINDOW ? z->out_pos : ZELL_DEFLATE_WINDOW;
+    size_t flush = z->out_pos - keep;
+    if (zip_inflate_emit((ZipInflate*)ctx, z->out, (int64_t)flush) != 0) return -1;
+    memmove(z->out, z->out + flush, keep);
+    z->out_pos = keep;
+    return 0;
+}
+
+/**
+ * Inflate (or copy) an entry's data from a source, into a buffer or a sink,
+ * and check its CRC
+ * @param source - Holds the archive from `base` on
+ * @return -1 on error, entry size on success
+ */
+static int64_t zip_inflate_entry(const ZipEntry* entry, const ZellSource* source, int64_t base,
+                                 unsigned char* output, ZellSink* sink) {
+    if ((entry->flags & 1) || (entry->method != 0 && entry->method != 8)) return -1;
+
+    unsigned char local[30];
+    if (zip_read(source, base, entry->offset, local, 30) != 0 || zip_le32(local) != ZIP_LOCAL_SIG) return -1;
+    int64_t data_offset = entry->offset + 30 + zip_le16(local + 26) + zip_le16(local + 28);
+    if (data_offset - base + entry->compressed > source->size) return -1;
+    if (entry->method == 0 && entry->compressed != entry->size) return -1;
+    if (entry->size == 0 && entry->method == 0) return entry->crc == 0 ? 0 : -1;
+
+    ZELL_STATS_STAGE(ZELL_STAGE_DECODE, "zip_inflate");
+    const unsigned char* resident = source->data ? source->data + (data_offset - base) : NULL;
+    ZipInflate zip = { source, data_offset - base, entry->compressed, NULL, output ? NULL : sink, entry->size, 0, 0 };
+    unsigned char* window = NULL;
+    int64_t result = -1;
+    if (!resident && !(zip.input = (unsigned char*)zell_pool_get((size_t)ZIP_READ_CHUNK))) goto done;
+
+    if (entry->method == 0) {
+        while (zip.produced < entry->size) {
+            const unsigned char* data;
+            size_t length;
+            if (resident) {
+                data = resident + zip.produced;
+                length = (size_t)(entry->size - zip.produced);
+            } else if (zip_inflate_more(&zip, &data, &length) != 0) {
+                goto done;
+            }
+            if (output) memcpy(output + zip.produced, data, length);
+            if (zip_inflate_emit(&zip, data, (int64_t)length) != 0) goto done;
+        }
+    } else {
+        ZellInflate z;
+        memset(&z, 0, sizeof(z));
+        if (resident) {
+            z.next_in = resident;
+            z.avail_in = (size_t)entry->compressed;
+        } else {
+            z.more = zip_inflate_more;
+        }
+        // A buffer takes the data in place; a sink gets it a chunk at a time,
+        // with the last window kept back for matches to reach into
+        if (output) {
+            z.out = output;
+            z.out_capacity = (size_t)entry->size;
+        } else {
+            window = (unsigned char*)zell_pool_get((size_t)(ZELL_DEFLATE_WINDOW + ZELL_SINK_CHUNK));
+            if (!window) goto done;
+            z.out = window;
+            z.out_capacity = (size_t)(ZELL_DEFLATE_WINDOW + ZELL_SINK_CHUNK);
+            z.room = zip_inflate_room;
+        }
+        z.ctx = &zip;
+        if (zell_inflate(&z, ZELL_DEFLATE_RAW) != ZELL_INFLATE_DONE) goto done;
+        if (zip_inflate_emit(&zip, z.out, (int64_t)z.out_pos) != 0) goto done;
+    }
+
+    if (zip.produced == entry->size && zip.crc == entry->crc) result = zip.produced;
+
+done:
+    zell_pool_put(zip.input);
+    zell_pool_put(window);
+    return result;
+}
+
+static const ZipEntry* zip_entry(const ZipArchive* archive, int index) {
+    return archive && index >= 0 && index < archive->count ? &archive->entries[index] : NULL;
+}
+
+/**
+ * Extract one entry into a buffer; no other entry is read
+ * @param archive - Open archive
+ * @param index - Entry index
+ * @param output_data - Output buffer of at least the entry's size (NULL with
+ *                      output_size 0 to get the size)
+ * @param output_size - Output buffer size
+ * @return -1 on error (also for encrypted entries and methods other than
+ *         store and deflate), entry size on success
+ */
+EMSCRIPTEN_KEEPALIVE
+int64_t zip_extract(const ZipArchive* archive, int index, unsigned char* output_data, int64_t output_size) {
+    ZELL_STATS_CALL("zip_extract", 0);
+    const ZipEntry* entry = zip_entry(archive, index);
+    if (!entry || !zell_output_valid(output_data, output_size)) return -1;
+    ZELL_STATS_INPUT(entry->compressed);
+    if (!output_data) return entry->size;
+    if (output_size < entry->size) return -1;
+    return ZELL_STATS_RESULT(zip_inflate_entry(entry, &archive->source, archive->base, output_data, NULL));
+}
+
+/**
+ * Extract one entry from its bytes, for archives opened from their tail
+ * @param archive - Open archive
+ * @param index - Entry index
+ * @param span_data - The entry's bytes (see zip_entry_span)
+ * @param span_size - Their number
+ * @param output_data - Output buffer of at least the entry's size (NULL with
+ *                      output_size 0 to get the size)
+ * @param output_size - Output buffer size
+ * @return -1 on error, entry size on success
+ */
+EMSCRIPTEN_KEEPALIVE
+int64_t zip_extract_from(const ZipArchive* archive, int index, const unsigned char* span_data, int64_t span_size,
+                         unsigned char* output_data, int64_t output_size) {
+    ZELL_STATS_CALL("zip_extract_from", span_size);
+    const ZipEntry* entry = zip_entry(archive, index);
+    if (!entry || !span_data || span_size < 30 || !zell_output_valid(output_data, output_size)) return -1;
+    if (!output_data) return entry->size;
+    if (output_size < entry->size) return -1;
+    ZellSource span;
+    zell_source_memory(&span, span_data, span_size);
+    return ZELL_STATS_RESULT(zip_inflate_entry(entry, &span, entry->offset, output_data, NULL));
+}
+
+/**
+ * Extract one entry into a sink, for entries too large for one buffer
+ * @param archive - Open archive
+ * @param index - Entry index
+ * @param write_at - Receives the output (see ZellWriteAt)
+ * @param ctx - Opaque pointer passed to write_at
+ * @return -1 on error, entry size on success
+ */
+EMSCRIPTEN_KEEPALIVE
+int64_t zip_extract_sink(const ZipArchive* archive, int index, ZellWriteAt write_at, void* ctx) {
+    ZELL_STATS_CALL("zip_extract_sink", 0);
+    const ZipEntry* entry = zip_entry(archive, index);
+    if (!entry) return -1;
+    ZELL_STATS_INPUT(entry->compressed);
+    ZellSink sink;
+    if (zell_sink_init(&sink, write_at, ctx) != 0) return -1;
+    int64_t result = zip_inflate_entry(entry, &archive->source, archive->base, NULL, &sink);
+    return ZELL_STATS_RESULT(archive_sink_finish(&sink, result));
+}
@@ -1,5 +1,10 @@
-#include <emscripten.h>
+#include "zell-common.h"
+#include "zell-alloc.h"
+#include "zell-sink.h"
+#include "zell-hash.h"
+#include "zell-cpu.h"
 #include <stdlib.h>
+#include <stdint.h>
 #include <string.h>
 #include <math.h>
 
@@ -10,7 +15,7 @@ typedef struct {
     int sample_rate;
     int channels;
     int bits_per_sample;
-    int data_size;
+    int64_t data_size;
     unsigned char* data;
 } AudioData;
 
@@ -18,96 +23,116 @@ typedef struct {
  * Process audio data for conversion/compression
  * @param input_data - Input audio data
  * @param input_size - Size of input data
- * @param output_data - Output buffer
- * @param output_size - Size of output buffer
+ * @param output_data - Output buffer, or NULL to only measure the output
+ * @param output_size - Size of output buffer (0 when measuring)
  * @param quality - Compression quality (0-100)
  * @param format - Target format (0=MP3, 1=WAV, 2=AAC)
  * @return -1 on error, output size on success
  */
 EMSCRIPTEN_KEEPALIVE
-int process_audio(unsigned char* input_data, int input_size,
-                  unsigned char* output_data, int output_size,
-                  int quality, int format) {
-    if (!input_data || !output_data || input_size <= 0 || output_size <= 0) {
+int64_t process_audio(unsigned char* input_data, int64_t input_size,
+                      unsigned char* output_data, int64_t output_size,
+                      int quality, int format) {
+    ZELL_STATS_CALL("process_audio", input_size);
+    if (!input_data || input_size <= 0 || !zell_output_valid(output_data, output_size)) {
         return -1;
     }
     
     // Calculate compression based on quality
-    float compression_ratio = (float)quality / 100.0f;
-    int target_size = (int)(input_size * compression_ratio);
+    double compression_ratio = (double)quality / 100.0;
+    int64_t target_size = (int64_t)(input_size * compression_ratio);
     
+    if (!output_data) {
+        return ZELL_STATS_RESULT(target_size); // measuring only
+    }
     if (target_size > output_size) {
         target_size = output_size;
     }
+    if (target_size <= 0) {
+        return ZELL_STATS_RESULT(0);
+    }
     
     // Simple audio processing based on format
     if (format == 0) { // MP3
         // Simulate MP3 compression
-        int step = input_size / target_size;
+        int64_t step = input_size / target_size;
         if (step < 1) step = 1;
         
-        for (int i = 0, j = 0; i < input_size && j < target_size; i += step, j++) {
+        for (int64_t i = 0, j = 0; i < input_size && j < target_size; i += step, j++) {
             output_data[j] = input_data[i];
         }
     } else if (format == 1) { // WAV
         // WAV is uncompressed, just copy
-        int copy_size = (target_size < input_size) ? target_size : input_size;
-        memcpy(output_data, input_data, copy_size);
-        return copy_size;
+        int64_t copy_size = (target_size < input_size) ? target_size : input_size;
+        memcpy(output_data, input_data, (size_t)copy_size);
+        return ZELL_STATS_RESULT(copy_size);
     } else if (format == 2) { // AAC
         // Simulate AAC compression
-        int step = input_size / target_size;
+        int64_t step = input_size / target_size;
         if (step < 1) step = 1;
         
-        for (int i = 0, j = 0; i < input_size && j < target_size; i += step, j++) {
+        for (int64_t i = 0, j = 0; i < input_size && j < target_size; i += step, j++) {
             output_data[j] = input_data[i] * quality / 100;
         }
     }
     
-    return target_size;
+    return ZELL_STATS_RESULT(target_size);
 }
 
 /**
  * Compress audio with specified quality
  * @param input_data - Input audio data
  * @param input_size - Size of input data
- * @param output_data - Output buffer
- * @param output_size - Size of output buffer
+ * @param output_data - Output buffer, or NULL to only measure the output
+ * @param output_size - Size of output buffer (0 when measuring)
  * @param quality - Compression quality (0-100)
  * @return -1 on error, compressed size on success
  */
 EMSCRIPTEN_KEEPALIVE
-int compress_audio(unsigned char* input_data, int input_size,
-                   unsigned char* output_data, int output_size,
-                   int quality) {
-    if (!input_data || !output_data || input_size <= 0 || output_size <= 0) {
+int64_t compress_audio(unsigned char* input_data, int64_t input_size,
+                       unsigned char* output_data, int64_t output_size,
+                       int quality) {
+    ZELL_STATS_CALL("compress_audio", input_size);
+    if (!input_data || input_size <= 0 || !zell_output_valid(output_data, output_size)) {
         return -1;
     }
     
     // Calculate target size based on quality
-    float compression_ratio = (float)quality / 100.0f;
-    int target_size = (int)(input_size * compression_ratio);
+    double compression_ratio = (double)quality / 100.0;
+    int64_t target_size = (int64_t)(input_size * compression_ratio);
     
+    if (!output_data) {
+        return ZELL_STATS_RESULT(target_size); // measuring only
+    }
     if (target_size > output_size) {
         target_size = output_size;
     }
+    if (target_size <= 0) {
+        return ZELL_STATS_RESULT(0);
+    }
     
     // Simple audio compression algorithm
-    int step = input_size / target_size;
+    int64_t step = input_size / target_size;
     if (step < 1) step = 1;
     
-    for (int i = 0, j = 0; i < input_size && j < target_size; i += step, j++) {
+    for (int64_t i = 0, j = 0; i < input_size && j < target_size; i += step, j++) {
         // Average samples for compression
-        int sum = 0;
-        int count = 0;
-        for (int k = 0; k < step && (i + k) < input_size; k++) {
+        int64_t sum = 0;
+        int64_t count = 0;
+        for (int64_t k = 0; k < step && (i + k) < input_size; k++) {
             sum += input_data[i + k];
             count++;
         }
         output_data[j] = (unsigned char)(sum / count);
     }
     
-    return target_size;
+    return ZELL_STATS_RESULT(target_size);
+}
+
+// Whether an input overlaps the merged output without already being in place
+static int audio_needs_staging(const unsigned char* input, int64_t size,
+                               const unsigned char* output, int64_t offset, int64_t total_size) {
+    return input != output + offset && input < output + total_size && input + size > output;
 }
 
 /**
@@ -115,45 +140,131 @@ int compress_audio(unsigned char* input_data, int input_size,
  * @param audio_files - Array of audio data pointers
  * @param file_sizes - Array of file sizes
  * @param num_files - Number of files to merge
- * @param output_data - Output buffer
- * @param output_size - Size of output buffer
+ * @param output_data - Output buffer, or NULL to only measure the output
+ * @param output_size - Size of output buffer (0 when measuring)
  * @return -1 on error, merged size on success
  */
 EMSCRIPTEN_KEEPALIVE
-int merge_audio(unsigned char** audio_files, int* file_sizes, int num_files,
-                unsigned char* output_data, int output_size) {
-    if (!audio_files || !file_sizes || !output_data || num_files <= 0 || output_size <= 0) {
+int64_t merge_audio(unsigned char** audio_files, const int64_t* file_sizes, int num_files,
+                    unsigned char* output_data, int64_t output_size) {
+    ZELL_STATS_CALL("merge_audio", zell_stats_total(file_sizes, num_files));
+    if (!audio_files || !file_sizes || num_files <= 0 || !zell_output_valid(output_data, output_size)) {
         return -1;
     }
     
-    int total_size = 0;
-    int offset = 0;
+    int64_t total_size = 0;
+    int64_t offset = 0;
+    int64_t limit = output_data ? output_size : INT64_MAX;
     
-    // Calculate total size
+    // Calculate total size, stopping before the sum itself can overflow
     for (int i = 0; i < num_files; i++) {
+        if (file_sizes[i] < 0 || file_sizes[i] > limit - total_size) {
+            return -1;
+        }
         total_size += file_sizes[i];
     }
     
+    if (!output_data) {
+        return ZELL_STATS_RESULT(total_size); // measuring only
+    }
+    
     if (total_size > output_size) {
         return -1; // Output buffer too small
     }
     
+    // Appending in place passes inputs that live inside the output buffer.
+    // Those are staged in a bounce buffer first, since writing earlier files
+    // would overwrite them; a file already at its destination is left alone.
+    int64_t staged_size = 0;
+    offset = 0;
+    for (int i = 0; i < num_files; i++) {
+        if (audio_files[i] && file_sizes[i] > 0) {
+            if (audio_needs_staging(audio_files[i], file_sizes[i], output_data, offset, total_size)) {
+                staged_size += file_sizes[i];
+            }
+            offset += file_sizes[i];
+        }
+    }
+    
+    const unsigned char** sources = (const unsigned char**)zell_pool_get(sizeof(*sources) * (size_t)num_files);
+    unsigned char* bounce = staged_size > 0 ? (unsigned char*)zell_pool_get((size_t)staged_size) : NULL;
+    if (!sources || (staged_size > 0 && !bounce)) {
+        zell_pool_put(sources);
+        zell_pool_put(bounce);
+        return -1;
+    }
+    int64_t staged = 0;
+    offset = 0;
+    for (int i = 0; i < num_files; i++) {
+        sources[i] = audio_files[i];
+        if (audio_files[i] && file_sizes[i] > 0) {
+            if (audio_needs_staging(audio_files[i], file_sizes[i], output_data, offset, total_size)) {
+                memcpy(bounce + staged, audio_files[i], (size_t)file_sizes[i]);
+                sources[i] = bounce + staged;
+                staged += file_sizes[i];
+            }
+            offset += file_sizes[i];
+        }
+    }
+    
     // Concatenate audio files
+    offset = 0;
+    for (int i = 0; i < num_files; i++) {
+        if (sources[i] && file_sizes[i] > 0) {
+            if (sources[i] != output_data + offset) {
+                memcpy(output_data + offset, sources[i], (size_t)file_sizes[i]);
+            }
+            offset += file_sizes[i];
+        }
+    }
+    
+    zell_pool_put(sources);
+    zell_pool_put(bounce);
+    return ZELL_STATS_RESULT(total_size);
+}
+
+/**
+ * Merge audio files into a sink (see merge_audio): every file is written
+ * straight from its input, so no output buffer is needed
+ * @param write_at - Receives the output (see ZellWriteAt)
+ * @param ctx - Opaque pointer passed to write_at
+ * @return -1 on error, merged size on success
+ */
+EMSCRIPTEN_KEEPALIVE
+int64_t merge_audio_sink(unsigned char** audio_files, const int64_t* file_sizes, int num_files,
+                        ZellWriteAt write_at, void* ctx) {
+    ZELL_STATS_CALL("merge_audio_sink", zell_stats_total(file_sizes, num_files));
+    if (!audio_files || !file_sizes || num_files <= 0) {
+        return -1;
+    }
+    int64_t total_size = 0;
+    for (int i = 0; i < num_files; i++) {
+        if (file_sizes[i] < 0 || file_sizes[i] > INT64_MAX - total_size) {
+            return -1;
+        }
+        total_size += file_sizes[i];
+    }
+    
+    ZellSink sink;
+    if (zell_sink_init(&sink, write_at, ctx) != 0) {
+        return -1;
+    }
+    int64_t offset = 0;
     for (int i = 0; i < num_files; i++) {
         if (audio_files[i] && file_sizes[i] > 0) {
-            memcpy(output_data + offset, audio_files[i], file_sizes[i]);
+            zell_sink_put(&sink, audio_files[i], file_sizes[i]);
             offset += file_sizes[i];
         }
     }
     
-    return total_size;
+    return ZELL_STATS_RESULT(zell_sink_close(&sink) == 0 ? offset : -1);
 }
 
 /**
  * Trim audio to specified duration
  * @param input_data - Input audio data
  * @param input_size - Size of input data
- * @param output_data - Output buffer
+ * @param output_data - Output buffer, or NULL to only measure the output
  * @param start_time - Start time in seconds
  * @param duration - Duration in seconds
  * @param sample_rate - Sample rate
@@ -162,32 +273,350 @@ int merge_audio(unsigned char** audio_files, int* file_sizes, int num_files,
  * @return -1 on error, trimmed size on success
  */
 EMSCRIPTEN_KEEPALIVE
-int trim_audio(unsigned char* input_data, int input_size,
+int64_t trim_audio(unsigned char* input_data, int64_t input_size,
                unsigned char* output_data, float start_time, float duration,
                int sample_rate, int channels, int bits_per_sample) {
-    if (!input_data || !output_data || input_size <= 0) {
+    ZELL_STATS_CALL("trim_audio", input_size);
+    if (!input_data || input_size <= 0) {
         return -1;
     }
     
     int bytes_per_sample = bits_per_sample / 8;
     int bytes_per_frame = bytes_per_sample * channels;
     
-    int start_byte = (int)(start_time * sample_rate * bytes_per_frame);
-    int duration_bytes = (int)(duration * sample_rate * bytes_per_frame);
+    // Whole sample frames, counted in 64 bits: a float byte offset loses
+    // precision past 16MB and an int one overflows at 2GB
+    int64_t start_byte = (int64_t)((double)start_time * sample_rate) * bytes_per_frame;
+    int64_t duration_bytes = (int64_t)((double)duration * sample_rate) * bytes_per_frame;
     
+    if (start_byte < 0 || duration_bytes < 0) {
+        return -1;
+    }
     if (start_byte >= input_size) {
-        return 0; // Start time beyond audio length
+        return ZELL_STATS_RESULT(0); // Start time beyond audio length
+    }
+    
+    int64_t end_byte = duration_bytes > input_size - start_byte ? input_size : start_byte + duration_bytes;
+    
+    int64_t trimmed_size = end_byte - start_byte;
+    if (!output_data) {
+        return ZELL_STATS_RESULT(trimmed_size); // measuring only
+    }
+    memmove(output_data, input_data + start_byte, (size_t)trimmed_size);
+    
+    return ZELL_STATS_RESULT(trimmed_size);
+}
+
+
+
+/**
+ * Resample interleaved 16-bit PCM with linear interpolation. Positions are
+ * exact fractions of the two rates, so long inputs do not drift.
+ * @param input_data - Input samples (native-endian int16, interleaved)
+ * @param input_frames - Number of input frames (samples per channel)
+ * @param channels - Number of channels
+ * @param input_rate - Input sample rate
+ * @param output_rate - Output sample rate
+ * @param output_data - Output samples, or NULL to only measure the output
+ * @param output_frames - Capacity of output_data in frames (0 when measuring)
+ * @return -1 on error, number of output frames on success
+ */
+EMSCRIPTEN_KEEPALIVE
+int64_t resample_audio(const int16_t* input_data, int64_t input_frames, int channels,
+                       int input_rate, int output_rate,
+                       int16_t* output_data, int64_t output_frames) {
+    ZELL_STATS_CALL("resample_audio", input_frames * channels * 2);
+    if (!input_data || input_frames <= 0 || channels <= 0 || input_rate <= 0 || output_rate <= 0 ||
+        !zell_output_valid((const unsigned char*)output_data, output_frames)) {
+        return -1;
     }
     
-    int end_byte = start_byte + duration_bytes;
-    if (end_byte > input_size) {
-        end_byte = input_size;
+    // frames * rate stays within 64 bits up to 2^40 frames at 8MHz rates
+    if (input_frames > ((int64_t)1 << 40) || input_rate > (1 << 23) || output_rate > (1 << 23)) {
+        return -1;
+    }
+    int64_t frames = input_frames * output_rate / input_rate;
+    if (!output_data) {
+        return ZELL_STATS_RESULT(frames); // measuring only
+    }
+    if (frames > output_frames) {
+        return -1; // Output buffer too small
     }
     
-    int trimmed_size = end_byte - start_byte;
-    memcpy(output_data, input_data + start_byte, trimmed_size);
+    for (int64_t i = 0; i < frames; i++) {
+        int64_t position = i * input_rate;
+        int64_t index = position / output_rate;
+        // Q15 weight: a sample difference times it still fits in 32 bits
+        int32_t weight = (int32_t)(((position % output_rate) << 15) / output_rate);
+        const int16_t* a = input_data + index * channels;
+        const int16_t* b = index + 1 < input_frames ? a + channels : a;
+        int16_t* out = output_data + i * channels;
+        for (int c = 0; c < channels; c++) {
+            out[c] = (int16_t)(a[c] + (((b[c] - a[c]) * weight + (1 << 14)) >> 15));
+        }
+    }
     
-    return trimmed_size;
+    return ZELL_STATS_RESULT(frames);
 }
 
+// Mixing kernels, one variant per instruction set, chosen once on first use
+// (see zell-cpu.h).  A 16.16 gain is applied as in * int + ((in * frac) >> 16),
+// which equals ((int64_t)in * gain) >> 16 but keeps every product in 32 bits.
 
+typedef struct {
+    // sums[i] += (in[i] * gain) >> 16
+    void (*mix_add)(int32_t* sums, const int16_t* in, int count, int32_t gain);
+    // out[i] = sums[i] saturated to 16 bits
+    void (*mix_store)(const int32_t* sums, int16_t* out, int count);
+} AudioKernels;
+
+static void mix_add_scalar(int32_t* sums, const int16_t* in, int count, int32_t gain) {
+    for (int i = 0; i < count; i++) {
+        sums[i] += (int32_t)(((int64_t)in[i] * gain) >> 16);
+    }
+}
+
+static void mix_store_scalar(const int32_t* sums, int16_t* out, int count) {
+    for (int i = 0; i < count; i++) {
+        int32_t v = sums[i];
+        out[i] = (int16_t)(v > 32767 ? 32767 : v < -32768 ? -32768 : v);
+    }
+}
+
+#if defined(ZELL_CPU_X86)
+ZELL_TARGET("sse4.1")
+static void mix_add_sse41(int32_t* sums, const int16_t* in, int count, int32_t gain) {
+    __m128i whole = _mm_set1_epi32(gain >> 16);
+    __m128i frac = _mm_set1_epi32(gain & 0xFFFF);
+    int i = 0;
+    for (; i + 4 <= count; i += 4) {
+        __m128i x = _mm_cvtepi16_epi32(_mm_loadl_epi64((const __m128i*)(in + i)));
+        __m128i v = _mm_add_epi32(_mm_mullo_epi32(x, whole), _mm_srai_epi32(_mm_mullo_epi32(x, frac), 16));
+        _mm_storeu_si128((__m128i*)(sums + i), _mm_add_epi32(_mm_loadu_si128((const __m128i*)(sums + i)), v));
+    }
+    mix_add_scalar(sums + i, in + i, count - i, gain);
+}
+
+ZELL_TARGET("sse4.1")
+static void mix_store_sse41(const int32_t* sums, int16_t* out, int count) {
+    int i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m128i lo = _mm_loadu_si128((const __m128i*)(sums + i));
+        __m128i hi = _mm_loadu_si128((const __m128i*)(sums + i + 4));
+        _mm_storeu_si128((__m128i*)(out + i), _mm_packs_epi32(lo, hi));
+    }
+    mix_store_scalar(sums + i, out + i, count - i);
+}
+
+ZELL_TARGET("avx2")
+static void mix_add_avx2(int32_t* sums, const int16_t* in, int count, int32_t gain) {
+    __m256i whole = _mm256_set1_epi32(gain >> 16);
+    __m256i frac = _mm256_set1_epi32(gain & 0xFFFF);
+    int i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m256i x = _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i*)(in + i)));
+        __m256i v = _mm256_add_epi32(_mm256_mullo_epi32(x, whole),
+                                     _mm256_srai_epi32(_mm256_mullo_epi32(x, frac), 16));
+        _mm256_storeu_si256((__m256i*)(sums + i),
+                            _mm256_add_epi32(_mm256_loadu_si256((const __m256i*)(sums + i)), v));
+    }
+    mix_add_scalar(sums + i, in + i, count - i, gain);
+}
+
+ZELL_TARGET("avx2")
+static void mix_store_avx2(const int32_t* sums, int16_t* out, int count) {
+    int i = 0;
+    for (; i + 16 <= count; i += 16) {
+        __m256i lo = _mm256_loadu_si256((const __m256i*)(sums + i));
+        __m256i hi = _mm256_loadu_si256((const __m256i*)(sums + i + 8));
+        // packs works per 128-bit lane; the permute restores sample order
+        __m256i packed = _mm256_permute4x64_epi64(_mm256_packs_epi32(lo, hi), 0xD8);
+        _mm256_storeu_si256((__m256i*)(out + i), packed);
+    }
+    mix_store_scalar(sums + i, out + i, count - i);
+}
+
+ZELL_TARGET("avx512f,avx512bw")
+static void mix_add_avx512(int32_t* sums, const int16_t* in, int count, int32_t gain) {
+    __m512i whole = _mm512_set1_epi32(gain >> 16);
+    __m512i frac = _mm512_set1_epi32(gain & 0xFFFF);
+    int i = 0;
+    for (; i + 16 <= count; i += 16) {
+        __m512i x = _mm512_cvtepi16_epi32(_mm256_loadu_si256((const __m256i*)(in + i)));
+        __m512i v = _mm512_add_epi32(_mm512_mullo_epi32(x, whole),
+                                     _mm512_srai_epi32(_mm512_mullo_epi32(x, frac), 16));
+        _mm512_storeu_si512((void*)(sums + i), _mm512_add_epi32(_mm512_loadu_si512((const void*)(sums + i)), v));
+    }
+    mix_add_avx2(sums + i, in + i, count - i, gain);
+}
+
+ZELL_TARGET("avx512f,avx512bw")
+static void mix_store_avx512(const int32_t* sums, int16_t* out, int count) {
+    int i = 0;
+    for (; i + 16 <= count; i += 16) {
+        __m512i v = _mm512_loadu_si512((const void*)(sums + i));
+        _mm256_storeu_si256((__m256i*)(out + i), _mm512_cvtsepi32_epi16(v));
+    }
+    mix_store_avx2(sums + i, out + i, count - i);
+}
+#endif // ZELL_CPU_X86
+
+#if defined(ZELL_CPU_NEON_BUILD)
+static void mix_add_neon(int32_t* sums, const int16_t* in, int count, int32_t gain) {
+    int32x4_t whole = vdupq_n_s32(gain >> 16);
+    int32x4_t frac = vdupq_n_s32(gain & 0xFFFF);
+    int i = 0;
+    for (; i + 4 <= count; i += 4) {
+        int32x4_t x = vmovl_s16(vld1_s16(in + i));
+        int32x4_t v = vmlaq_s32(vshrq_n_s32(vmulq_s32(x, frac), 16), x, whole);
+        vst1q_s32(sums + i, vaddq_s32(vld1q_s32(sums + i), v));
+    }
+    mix_add_scalar(sums + i, in + i, count - i, gain);
+}
+
+static void mix_store_neon(const int32_t* sums, int16_t* out, int count) {
+    int i = 0;
+    for (; i + 8 <= count; i += 8) {
+        int16x8_t packed = vcombine_s16(vqmovn_s32(vld1q_s32(sums + i)), vqmovn_s32(vld1q_s32(sums + i + 4)));
+        vst1q_s16(out + i, packed);
+    }
+    mix_store_scalar(sums + i, out + i, count - i);
+}
+#endif // ZELL_CPU_NEON_BUILD
+
+#if defined(ZELL_CPU_SIMD128_BUILD)
+static void mix_add_simd128(int32_t* sums, const int16_t* in, int count, int32_t gain) {
+    v128_t whole = wasm_i32x4_splat(gain >> 16);
+    v128_t frac = wasm_i32x4_splat(gain & 0xFFFF);
+    int i = 0;
+    for (; i + 8 <= count; i += 8) {
+        v128_t x = wasm_v128_load(in + i);
+        v128_t lo = wasm_i32x4_extend_low_i16x8(x);
+        v128_t hi = wasm_i32x4_extend_high_i16x8(x);
+        lo = wasm_i32x4_add(wasm_i32x4_mul(lo, whole), wasm_i32x4_shr(wasm_i32x4_mul(lo, frac), 16));
+        hi = wasm_i32x4_add(wasm_i32x4_mul(hi, whole), wasm_i32x4_shr(wasm_i32x4_mul(hi, frac), 16));
+        wasm_v128_store(sums + i, wasm_i32x4_add(wasm_v128_load(sums + i), lo));
+        wasm_v128_store(sums + i + 4, wasm_i32x4_add(wasm_v128_load(sums + i + 4), hi));
+    }
+    mix_add_scalar(sums + i, in + i, count - i, gain);
+}
+
+static void mix_store_simd128(const int32_t* sums, int16_t* out, int count) {
+    int i = 0;
+    for (; i + 8 <= count; i += 8) {
+        wasm_v128_store(out + i, wasm_i16x8_narrow_i32x4(wasm_v128_load(sums + i), wasm_v128_load(sums + i + 4)));
+    }
+    mix_store_scalar(sums + i, out + i, count - i);
+}
+#endif // ZELL_CPU_SIMD128_BUILD
+
+static AudioKernels audio_kernels;
+ZELL_ONCE_DEFINE(audio_kernels_once);
+
+static void audio_kernels_init(void) {
+    audio_kernels.mix_add = mix_add_scalar;
+    audio_kernels.mix_store = mix_store_scalar;
+
+    switch (zell_cpu_level()) {
+#if defined(ZELL_CPU_X86)
+        case ZELL_CPU_AVX512:
+            audio_kernels.mix_add = mix_add_avx512;
+            audio_kernels.mix_store = mix_store_avx512;
+            break;
+        case ZELL_CPU_AVX2:
+            audio_kernels.mix_add = mix_add_avx2;
+            audio_kernels.mix_store = mix_store_avx2;
+            break;
+        case ZELL_CPU_SSE41:
+            audio_kernels.mix_add = mix_add_sse41;
+            audio_kernels.mix_store = mix_store_sse41;
+            break;
+#elif defined(ZELL_CPU_NEON_BUILD)
+        case ZELL_CPU_NEON:
+            audio_kernels.mix_add = mix_add_neon;
+            audio_kernels.mix_store = mix_store_neon;
+            break;
+#elif defined(ZELL_CPU_SIMD128_BUILD)
+        case ZELL_CPU_SIMD128:
+            audio_kernels.mix_add = mix_add_simd128;
+            audio_kernels.mix_store = mix_store_simd128;
+            break;
+#endif
+        default:
+            break;
+    }
+}
+
+static const AudioKernels* audio_get_kernels(void) {
+    ZELL_ONCE(audio_kernels_once, audio_kernels_init);
+    return &audio_kernels;
+}
+
+/**
+ * Mix 16-bit PCM tracks of the same layout into one, saturating at full
+ * scale. Shorter tracks are padded with silence.
+ * @param tracks - Array of track sample pointers
+ * @param track_samples - Array of track lengths in samples
+ * @param gains - Gain per track (NULL = 1.0 for every track)
+ * @param num_tracks - Number of tracks (at most 1024)
+ * @param output_data - Output samples, or NULL to only measure the output
+ * @param output_samples - Capacity of output_data in samples (0 when measuring)
+ * @return -1 on error, number of mixed samples on success
+ */
+EMSCRIPTEN_KEEPALIVE
+int64_t mix_audio(const int16_t** tracks, const int64_t* track_samples, const float* gains,
+                  int num_tracks, int16_t* output_data, int64_t output_samples) {
+    ZELL_STATS_CALL("mix_audio", zell_stats_total(track_samples, num_tracks) * 2);
+    // The 32-bit accumulator has headroom for 1024 tracks at the maximum gain
+    if (!tracks || !track_samples || num_tracks <= 0 || num_tracks > 1024 ||
+        !zell_output_valid((const unsigned char*)output_data, output_samples)) {
+        return -1;
+    }
+    
+    int64_t samples = 0;
+    for (int i = 0; i < num_tracks; i++) {
+        if (track_samples[i] < 0 || (track_samples[i] > 0 && !tracks[i])) {
+            return -1;
+        }
+        if (track_samples[i] > samples) samples = track_samples[i];
+    }
+    if (!output_data) {
+        return ZELL_STATS_RESULT(samples); // measuring only
+    }
+    if (samples > output_samples) {
+        return -1; // Output buffer too small
+    }
+    
+    // Gains in 16.16 fixed point keep the inner loop in integers
+    int32_t* fixed_gains = (int32_t*)zell_pool_get(sizeof(int32_t) * (size_t)num_tracks);
+    int32_t* sums = (int32_t*)zell_pool_get(sizeof(int32_t) * 4096);
+    if (!fixed_gains || !sums) {
+        zell_pool_put(fixed_gains);
+        zell_pool_put(sums);
+        return -1;
+    }
+    for (int i = 0; i < num_tracks; i++) {
+        float gain = gains ? gains[i] : 1.0f;
+        if (!(gain >= 0.0f)) gain = 0.0f;
+        if (gain > 16.0f) gain = 16.0f;
+        fixed_gains[i] = (int32_t)lrintf(gain * 65536.0f);
+    }
+    
+    // Blocks of 4096 samples keep the accumulator in L1 across all tracks
+    const AudioKernels* kernels = audio_get_kernels();
+    for (int64_t start = 0; start < samples; start += 4096) {
+        int count = samples - start < 4096 ? (int)(samples - start) : 4096;
+        memset(sums, 0, sizeof(int32_t) * (size_t)count);
+        for (int t = 0; t < num_tracks; t++) {
+            int64_t available = track_samples[t] - start;
+            int n = available < count ? (int)(available > 0 ? available : 0) : count;
+            if (n == 0) continue;
+            kernels->mix_add(sums, tracks[t] + start, n, fixed_gains[t]);
+        }
+        kernels->mix_store(sums, output_data + start, count);
+    }
+    
+    zell_pool_put(fixed_gains);
+    zell_pool_put(sums);
+    return ZELL_STATS_RESULT(samples);
+}
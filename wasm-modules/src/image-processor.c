@@ -1,7 +1,20 @@
-#include <emscripten.h>
+#include "zell-common.h"
+#include "zell-alloc.h"
+#include "zell-sink.h"
+#include "zell-hash.h"
+#include "zell-deflate.h"
+#include "zell-ssim.h"
+#include "zell-quant.h"
+#include "zell-cpu.h"
+#include "image-processor.h"
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
+#include <limits.h>
 #include <math.h>
+#include <setjmp.h>
+#include <jpeglib.h>
 
 // Image processing functions for WebAssembly
 // Optimized for offline processing in ZELL
@@ -13,37 +26,55 @@ typedef struct {
     unsigned char* data;
 } ImageData;
 
+static int64_t png_process(const unsigned char* input, int64_t input_size,
+                           unsigned char* output_data, int64_t output_size, int quality);
+static int64_t gif_process(const unsigned char* input, int64_t input_size,
+                           unsigned char* output_data, int64_t output_size, int quality);
+
 /**
  * Process image data for conversion/compression
  * @param input_data - Input image data
  * @param input_size - Size of input data
- * @param output_data - Output buffer
- * @param output_size - Size of output buffer
- * @param quality - Compression quality (0-100)
- * @param format - Target format (0=JPEG, 1=PNG, 2=WEBP)
+ * @param output_data - Output buffer, or NULL to only measure the output
+ * @param output_size - Size of output buffer (0 when measuring)
+ * @param quality - Compression quality (0-100; PNG is lossless at 100 and a dithered
+ *                  palette below, GIF takes its palette size from it)
+ * @param format - Target format (0=JPEG, 1=PNG, 2=WEBP, 3=GIF)
  * @return -1 on error, output size on success
  */
 EMSCRIPTEN_KEEPALIVE
-int process_image(unsigned char* input_data, int input_size, 
-                  unsigned char* output_data, int output_size,
-                  int quality, int format) {
+int64_t process_image(unsigned char* input_data, int64_t input_size, 
+                      unsigned char* output_data, int64_t output_size,
+                      int quality, int format) {
+    ZELL_STATS_CALL("process_image", input_size);
     // Basic image processing implementation
     // In a real implementation, this would use libjpeg, libpng, or libwebp
     
-    if (!input_data || !output_data || input_size <= 0 || output_size <= 0) {
+    if (!input_data || input_size <= 0 || !zell_output_valid(output_data, output_size)) {
         return -1;
     }
+
+    // PNG: the optimizer, from a PNG or a JPEG; GIF: a quantized palette
+    if (format == 1) {
+        return ZELL_STATS_RESULT(png_process(input_data, input_size, output_data, output_size, quality));
+    }
+    if (format == 3) {
+        return ZELL_STATS_RESULT(gif_process(input_data, input_size, output_data, output_size, quality));
+    }
     
     // Simple quality-based compression simulation
     int compression_factor = (100 - quality) / 10;
-    int processed_size = input_size - (input_size * compression_factor / 100);
+    int64_t processed_size = input_size - (input_size * compression_factor / 100);
     
+    if (!output_data) {
+        return ZELL_STATS_RESULT(processed_size); // measuring only
+    }
     if (processed_size > output_size) {
         processed_size = output_size;
     }
     
     // Copy and modify data based on format
-    for (int i = 0; i < processed_size && i < input_size; i++) {
+    for (int64_t i = 0; i < processed_size && i < input_size; i++) {
         if (format == 0) { // JPEG
             output_data[i] = input_data[i] * quality / 100;
         } else if (format == 1) { // PNG
@@ -53,43 +84,181 @@ int process_image(unsigned char* input_data, int input_size,
         }
     }
     
-    return processed_size;
+    return ZELL_STATS_RESULT(processed_size);
 }
 
 /**
  * Compress image with specified quality
  * @param input_data - Input image data
  * @param input_size - Size of input data
- * @param output_data - Output buffer
- * @param output_size - Size of output buffer
+ * @param output_data - Output buffer, or NULL to only measure the output
+ * @param output_size - Size of output buffer (0 when measuring)
  * @param quality - Compression quality (0-100)
  * @return -1 on error, compressed size on success
  */
 EMSCRIPTEN_KEEPALIVE
-int compress_image(unsigned char* input_data, int input_size,
-                   unsigned char* output_data, int output_size,
-                   int quality) {
-    if (!input_data || !output_data || input_size <= 0 || output_size <= 0) {
+int64_t compress_image(unsigned char* input_data, int64_t input_size,
+                       unsigned char* output_data, int64_t output_size,
+                       int quality) {
+    ZELL_STATS_CALL("compress_image", input_size);
+    if (!input_data || input_size <= 0 || !zell_output_valid(output_data, output_size)) {
         return -1;
     }
     
     // Calculate compression ratio
-    float compression_ratio = (float)quality / 100.0f;
-    int target_size = (int)(input_size * compression_ratio);
+    double compression_ratio = (double)quality / 100.0;
+    int64_t target_size = (int64_t)(input_size * compression_ratio);
     
+    if (!output_data) {
+        return ZELL_STATS_RESULT(target_size); // measuring only
+    }
     if (target_size > output_size) {
         target_size = output_size;
     }
+    if (target_size <= 0) {
+        return ZELL_STATS_RESULT(0);
+    }
     
     // Simple compression algorithm
-    int step = input_size / target_size;
+    int64_t step = input_size / target_size;
     if (step < 1) step = 1;
     
-    for (int i = 0, j = 0; i < input_size && j < target_size; i += step, j++) {
+    for (int64_t i = 0, j = 0; i < input_size && j < target_size; i += step, j++) {
         output_data[j] = input_data[i];
     }
     
-    return target_size;
+    return ZELL_STATS_RESULT(target_size);
+}
+
+// ---------------------------------------------------------------------------
+// SIMD kernels
+//
+// The per-pixel inner loops have one variant per instruction set; the best
+// one the CPU runs is chosen once, on first use (see zell-cpu.h).  Every
+// variant produces exactly the scalar results.
+// ---------------------------------------------------------------------------
+
+typedef struct {
+    // Add a row of bytes into 32-bit column sums
+    void (*accumulate_row)(uint32_t* sums, const unsigned char* row, size_t count);
+} ImageKernels;
+
+static void accumulate_row_scalar(uint32_t* sums, const unsigned char* row, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        sums[i] += row[i];
+    }
+}
+
+#if defined(ZELL_CPU_X86)
+ZELL_TARGET("sse4.1")
+static void accumulate_row_sse41(uint32_t* sums, const unsigned char* row, size_t count) {
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16) {
+        __m128i bytes = _mm_loadu_si128((const __m128i*)(row + i));
+        for (int k = 0; k < 4; k++) {
+            __m128i* sum = (__m128i*)(sums + i + 4 * k);
+            _mm_storeu_si128(sum, _mm_add_epi32(_mm_loadu_si128(sum), _mm_cvtepu8_epi32(bytes)));
+            bytes = _mm_srli_si128(bytes, 4);
+        }
+    }
+    accumulate_row_scalar(sums + i, row + i, count - i);
+}
+
+ZELL_TARGET("avx2")
+static void accumulate_row_avx2(uint32_t* sums, const unsigned char* row, size_t count) {
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16) {
+        __m128i bytes = _mm_loadu_si128((const __m128i*)(row + i));
+        __m256i* lo = (__m256i*)(sums + i);
+        __m256i* hi = (__m256i*)(sums + i + 8);
+        _mm256_storeu_si256(lo, _mm256_add_epi32(_mm256_loadu_si256(lo), _mm256_cvtepu8_epi32(bytes)));
+        _mm256_storeu_si256(hi, _mm256_add_epi32(_mm256_loadu_si256(hi),
+                                                 _mm256_cvtepu8_epi32(_mm_srli_si128(bytes, 8))));
+    }
+    accumulate_row_scalar(sums + i, row + i, count - i);
+}
+
+ZELL_TARGET("avx512f,avx512bw")
+static void accumulate_row_avx512(uint32_t* sums, const unsigned char* row, size_t count) {
+    size_t i = 0;
+    for (; i + 32 <= count; i += 32) {
+        __m512i lo = _mm512_cvtepu8_epi32(_mm_loadu_si128((const __m128i*)(row + i)));
+        __m512i hi = _mm512_cvtepu8_epi32(_mm_loadu_si128((const __m128i*)(row + i + 16)));
+        _mm512_storeu_si512((void*)(sums + i), _mm512_add_epi32(_mm512_loadu_si512((const void*)(sums + i)), lo));
+        _mm512_storeu_si512((void*)(sums + i + 16),
+                            _mm512_add_epi32(_mm512_loadu_si512((const void*)(sums + i + 16)), hi));
+    }
+    accumulate_row_avx2(sums + i, row + i, count - i);
+}
+#endif // ZELL_CPU_X86
+
+#if defined(ZELL_CPU_NEON_BUILD)
+static void accumulate_row_neon(uint32_t* sums, const unsigned char* row, size_t count) {
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16) {
+        uint8x16_t bytes = vld1q_u8(row + i);
+        uint16x8_t lo = vmovl_u8(vget_low_u8(bytes));
+        uint16x8_t hi = vmovl_u8(vget_high_u8(bytes));
+        vst1q_u32(sums + i, vaddw_u16(vld1q_u32(sums + i), vget_low_u16(lo)));
+        vst1q_u32(sums + i + 4, vaddw_u16(vld1q_u32(sums + i + 4), vget_high_u16(lo)));
+        vst1q_u32(sums + i + 8, vaddw_u16(vld1q_u32(sums + i + 8), vget_low_u16(hi)));
+        vst1q_u32(sums + i + 12, vaddw_u16(vld1q_u32(sums + i + 12), vget_high_u16(hi)));
+    }
+    accumulate_row_scalar(sums + i, row + i, count - i);
+}
+#endif // ZELL_CPU_NEON_BUILD
+
+#if defined(ZELL_CPU_SIMD128_BUILD)
+static void accumulate_row_simd128(uint32_t* sums, const unsigned char* row, size_t count) {
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16) {
+        v128_t bytes = wasm_v128_load(row + i);
+        v128_t lo = wasm_u16x8_extend_low_u8x16(bytes);
+        v128_t hi = wasm_u16x8_extend_high_u8x16(bytes);
+        v128_t words[4] = { wasm_u32x4_extend_low_u16x8(lo), wasm_u32x4_extend_high_u16x8(lo),
+                            wasm_u32x4_extend_low_u16x8(hi), wasm_u32x4_extend_high_u16x8(hi) };
+        for (int k = 0; k < 4; k++) {
+            wasm_v128_store(sums + i + 4 * k, wasm_i32x4_add(wasm_v128_load(sums + i + 4 * k), words[k]));
+        }
+    }
+    accumulate_row_scalar(sums + i, row + i, count - i);
+}
+#endif // ZELL_CPU_SIMD128_BUILD
+
+static ImageKernels image_kernels;
+ZELL_ONCE_DEFINE(image_kernels_once);
+
+static void image_kernels_init(void) {
+    image_kernels.accumulate_row = accumulate_row_scalar;
+
+    switch (zell_cpu_level()) {
+#if defined(ZELL_CPU_X86)
+        case ZELL_CPU_AVX512:
+            image_kernels.accumulate_row = accumulate_row_avx512;
+            break;
+        case ZELL_CPU_AVX2:
+            image_kernels.accumulate_row = accumulate_row_avx2;
+            break;
+        case ZELL_CPU_SSE41:
+            image_kernels.accumulate_row = accumulate_row_sse41;
+            break;
+#elif defined(ZELL_CPU_NEON_BUILD)
+        case ZELL_CPU_NEON:
+            image_kernels.accumulate_row = accumulate_row_neon;
+            break;
+#elif defined(ZELL_CPU_SIMD128_BUILD)
+        case ZELL_CPU_SIMD128:
+            image_kernels.accumulate_row = accumulate_row_simd128;
+            break;
+#endif
+        default:
+            break;
+    }
+}
+
+static const ImageKernels* image_get_kernels(void) {
+    ZELL_ONCE(image_kernels_once, image_kernels_init);
+    return &image_kernels;
 }
 
 /**
@@ -107,11 +276,65 @@ EMSCRIPTEN_KEEPALIVE
 int resize_image(unsigned char* input_data, int input_width, int input_height,
                  unsigned char* output_data, int output_width, int output_height,
                  int channels) {
+    ZELL_STATS_CALL("resize_image", (int64_t)input_width * input_height * channels);
+    ZELL_STATS_STAGE(ZELL_STAGE_TRANSFORM, "resize_image");
     if (!input_data || !output_data || input_width <= 0 || input_height <= 0 ||
         output_width <= 0 || output_height <= 0 || channels <= 0) {
         return -1;
     }
     
+    // Shrinking averages every source pixel that falls in the output pixel;
+    // sampling a single one aliases badly on photos and scanned pages.  The
+    // source rows of an output row are summed column-wise by the SIMD kernel,
+    // which is where the time goes; the columns are then summed per pixel.
+    if (output_width <= input_width && output_height <= input_height) {
+        size_t row_size = (size_t)input_width * channels;
+        uint32_t* columns = zell_pool_get(row_size * sizeof(uint32_t) + (size_t)(output_width + 1) * sizeof(int));
+        if (!columns) {
+            return ZELL_STATS_STATUS(-1);
+        }
+        const ImageKernels* kernels = image_get_kernels();
+        int used = channels < 8 ? channels : 8;
+
+        // Output pixel x covers source columns edges[x] up to edges[x + 1]
+        int* edges = (int*)(columns + row_size);
+        for (int x = 0; x <= output_width; x++) {
+            edges[x] = (int)((int64_t)x * input_width / output_width);
+        }
+
+        for (int y = 0; y < output_height; y++) {
+            int y0 = (int)((int64_t)y * input_height / output_height);
+            int y1 = (int)((int64_t)(y + 1) * input_height / output_height);
+            if (y1 <= y0) y1 = y0 + 1;
+
+            memset(columns, 0, row_size * sizeof(uint32_t));
+            for (int sy = y0; sy < y1; sy++) {
+                kernels->accumulate_row(columns, input_data + (size_t)sy * row_size, row_size);
+            }
+
+            for (int x = 0; x < output_width; x++) {
+                int x0 = edges[x];
+                int x1 = edges[x + 1];
+                if (x1 <= x0) x1 = x0 + 1;
+
+                unsigned int sums[8] = { 0 };
+                const uint32_t* column = columns + (size_t)x0 * channels;
+                for (int sx = x0; sx < x1; sx++, column += channels) {
+                    for (int c = 0; c < used; c++) sums[c] += column[c];
+                }
+
+                unsigned int count = (unsigned int)((y1 - y0) * (x1 - x0));
+                unsigned char* dst = output_data + ((size_t)y * output_width + x) * channels;
+                for (int c = 0; c < channels; c++) {
+                    dst[c] = c < used ? (unsigned char)((sums[c] + count / 2) / count)
+                                      : input_data[((size_t)y0 * input_width + x0) * channels + c];
+                }
+            }
+        }
+        zell_pool_put(columns);
+        return ZELL_STATS_STATUS(0);
+    }
+
     float x_ratio = (float)input_width / output_width;
     float y_ratio = (float)input_height / output_height;
     
@@ -124,8 +347,8 @@ int resize_image(unsigned char* input_data, int input_width, int input_height,
             if (src_x >= input_width) src_x = input_width - 1;
             if (src_y >= input_height) src_y = input_height - 1;
             
-            int src_index = (src_y * input_width + src_x) * channels;
-            int dst_index = (y * output_width + x) * channels;
+            size_t src_index = ((size_t)src_y * input_width + src_x) * channels;
+            size_t dst_index = ((size_t)y * output_width + x) * channels;
             
             for (int c = 0; c < channels; c++) {
                 output_data[dst_index + c] = input_data[src_index + c];
@@ -133,7 +356,2081 @@ int resize_image(unsigned char* input_data, int input_width, int input_height,
         }
     }
     
+    return ZELL_STATS_STATUS(0);
+}
+
+// --- JPEG (libjpeg) --------------------------------------------------------
+
+typedef struct {
+    struct jpeg_error_mgr base;
+    jmp_buf jump;
+} JpegError;
+
+static void jpeg_error_exit(j_common_ptr cinfo) {
+    longjmp(((JpegError*)cinfo->err)->jump, 1);
+}
+
+static void jpeg_silent_message(j_common_ptr cinfo) {
+    (void)cinfo;
+}
+
+static void jpeg_init_error(JpegError* error) {
+    jpeg_std_error(&error->base);
+    error->base.error_exit = jpeg_error_exit;
+    error->base.output_message = jpeg_silent_message;
+}
+
+// Compress into a buffer libjpeg allocates (free()).  Huffman optimisation
+// costs a second pass but never changes the pixels, so the quality search
+// leaves it to the final encode.
+static int jpeg_compress_buffer(const unsigned char* pixels, int width, int height, int channels,
+                                int quality, int optimize, unsigned char** output, unsigned long* output_size) {
+    struct jpeg_compress_struct cinfo;
+    JpegError error;
+    unsigned char* volatile row = NULL;
+    unsigned char* buffer = NULL;
+    unsigned long buffer_size = 0;
+
+    cinfo.err = &error.base;
+    jpeg_init_error(&error);
+    if (setjmp(error.jump)) {
+        jpeg_destroy_compress(&cinfo);
+        free(buffer);
+        zell_pool_put(row);
+        return -1;
+    }
+
+    jpeg_create_compress(&cinfo);
+    jpeg_mem_dest(&cinfo, &buffer, &buffer_size);
+
+    cinfo.image_width = (JDIMENSION)width;
+    cinfo.image_height = (JDIMENSION)height;
+    cinfo.input_components = channels == 1 ? 1 : 3;
+    cinfo.in_color_space = channels == 1 ? JCS_GRAYSCALE : JCS_RGB;
+    jpeg_set_defaults(&cinfo);
+    jpeg_set_quality(&cinfo, quality < 1 ? 1 : quality > 100 ? 100 : quality, TRUE);
+    cinfo.optimize_coding = optimize ? TRUE : FALSE;  // per-image Huffman tables, typically 5-10% smaller
+    jpeg_start_compress(&cinfo, TRUE);
+
+    if (channels == 4) {
+        row = (unsigned char*)zell_pool_get((size_t)width * 3);
+        if (!row) longjmp(error.jump, 1);
+    }
+
+    while (cinfo.next_scanline < cinfo.image_height) {
+        const unsigned char* src = pixels + (size_t)cinfo.next_scanline * width * channels;
+        JSAMPROW line = (JSAMPROW)src;
+        if (channels == 4) {
+            for (int x = 0; x < width; x++) {
+                row[x * 3] = src[x * 4];
+                row[x * 3 + 1] = src[x * 4 + 1];
+                row[x * 3 + 2] = src[x * 4 + 2];
+            }
+            line = row;
+        }
+        jpeg_write_scanlines(&cinfo, &line, 1);
+    }
+
+    jpeg_finish_compress(&cinfo);
+    jpeg_destroy_compress(&cinfo);
+    zell_pool_put(row);
+    *output = buffer;
+    *output_size = buffer_size;
+    return 0;
+}
+
+/**
+ * Encode interleaved 8-bit pixels as a baseline JPEG
+ * @param pixels - Gray (1), RGB (3) or RGBA (4, alpha dropped) pixels
+ * @param width - Image width
+ * @param height - Image height
+ * @param channels - Number of color channels
+ * @param quality - JPEG quality (1-100)
+ * @param output_data - Output buffer
+ * @param output_size - Size of output buffer
+ * @return -1 on error or if the output does not fit, JPEG size on success
+ */
+EMSCRIPTEN_KEEPALIVE
+int64_t encode_jpeg(const unsigned char* pixels, int width, int height, int channels,
+                    int quality, unsigned char* output_data, int64_t output_size) {
+    ZELL_STATS_CALL("encode_jpeg", (int64_t)width * height * channels);
+    ZELL_STATS_STAGE(ZELL_STAGE_ENCODE, "jpeg_encode");
+    if (!pixels || !output_data || width <= 0 || height <= 0 || output_size <= 0 ||
+        (channels != 1 && channels != 3 && channels != 4)) {
+        return -1;
+    }
+
+    unsigned char* buffer = NULL;
+    unsigned long buffer_size = 0;
+    if (jpeg_compress_buffer(pixels, width, height, channels, quality, 1, &buffer, &buffer_size) < 0) {
+        return -1;
+    }
+
+    int64_t result = -1;
+    if ((uint64_t)buffer_size <= (uint64_t)output_size) {
+        memcpy(output_data, buffer, buffer_size);
+        result = (int64_t)buffer_size;
+    }
+    free(buffer);
+    return ZELL_STATS_RESULT(result);
+}
+
+// Components whose DC terms the current scan carries
+static int jpeg_dc_components(j_decompress_ptr cinfo) {
+    int mask = 0;
+    if (cinfo->Ss == 0) {
+        for (int i = 0; i < cinfo->comps_in_scan; i++) mask |= 1 << cinfo->cur_comp_info[i]->component_index;
+    }
+    return mask;
+}
+
+// Read a progressive file only until every component has its DC terms,
+// which is all a 1/8 decode shows; the AC scans after them, most of the
+// file, are never entropy-decoded. A DC scan sent with a point transform
+// is refined near the end of the file, so its low bit is left out: at most
+// one quantization step, invisible in a preview.
+// @return The last scan to show
+static int jpeg_consume_dc(j_decompress_ptr cinfo) {
+    int all = (1 << cinfo->num_components) - 1;
+    int have = 0, pending = jpeg_dc_components(cinfo);
+    for (;;) {
+        int status = jpeg_consume_input(cinfo);
+        if (status == JPEG_REACHED_EOI || status == JPEG_SUSPENDED) return cinfo->input_scan_number;
+        if (status == JPEG_REACHED_SOS) {
+            // The scan before this one is complete
+            have |= pending;
+            if (have == all) return cinfo->input_scan_number - 1;
+            pending = jpeg_dc_components(cinfo);
+        }
+    }
+}
+
+// Decode at 1/scale of the full size. libjpeg scales inside the inverse DCT
+// (4x4, 2x2 or 1x1 per block), so the full-size image is never built; at
+// 1/8 a block is just its DC term.
+static unsigned char* jpeg_decode(const unsigned char* input_data, int64_t input_size, int scale,
+                                  int* width, int* height, int* channels) {
+    // libjpeg takes the size as unsigned long, which is 32-bit on wasm32
+    if ((uint64_t)input_size > (uint64_t)ULONG_MAX) {
+        return NULL;
+    }
+
+    struct jpeg_decompress_struct cinfo;
+    JpegError error;
+    unsigned char* volatile pixels = NULL;
+
+    cinfo.err = &error.base;
+    jpeg_init_error(&error);
+    if (setjmp(error.jump)) {
+        jpeg_destroy_decompress(&cinfo);
+        free(pixels);
+        return NULL;
+    }
+
+    jpeg_create_decompress(&cinfo);
+    jpeg_mem_src(&cinfo, (unsigned char*)input_data, (unsigned long)input_size);
+    jpeg_read_header(&cinfo, TRUE);
+
+    // Gray stays gray, CMYK/YCCK come back as CMYK, everything else as RGB
+    if (cinfo.jpeg_color_space == JCS_GRAYSCALE) {
+        cinfo.out_color_space = JCS_GRAYSCALE;
+    } else if (cinfo.jpeg_color_space == JCS_CMYK || cinfo.jpeg_color_space == JCS_YCCK) {
+        cinfo.out_color_space = JCS_CMYK;
+    } else {
+        cinfo.out_color_space = JCS_RGB;
+    }
+    cinfo.scale_num = 1;
+    cinfo.scale_denom = (unsigned int)scale;
+
+    int dc_only = scale == 8 && cinfo.progressive_mode;
+    if (dc_only) {
+        cinfo.buffered_image = TRUE;
+        cinfo.do_block_smoothing = FALSE;  // it guesses AC terms the 1x1 transform drops
+    }
+    jpeg_start_decompress(&cinfo);
+    if (dc_only) jpeg_start_output(&cinfo, jpeg_consume_dc(&cinfo));
+
+    size_t stride = (size_t)cinfo.output_width * cinfo.output_components;
+    pixels = (unsigned char*)malloc(stride * cinfo.output_height);
+    if (!pixels) longjmp(error.jump, 1);
+
+    while (cinfo.output_scanline < cinfo.output_height) {
+        JSAMPROW line = pixels + stride * cinfo.output_scanline;
+        jpeg_read_scanlines(&cinfo, &line, 1);
+    }
+
+    *width = (int)cinfo.output_width;
+    *height = (int)cinfo.output_height;
+    *channels = cinfo.output_components;
+    if (dc_only) {
+        jpeg_abort_decompress(&cinfo);  // the remaining scans are skipped
+    } else {
+        jpeg_finish_decompress(&cinfo);
+    }
+    jpeg_destroy_decompress(&cinfo);
+    return pixels;
+}
+
+/**
+ * Decode a JPEG into interleaved 8-bit pixels
+ * @param input_data - JPEG data
+ * @param input_size - Size of JPEG data
+ * @param width - Receives the image width
+ * @param height - Receives the image height
+ * @param channels - Receives 1 (gray), 3 (RGB) or 4 (CMYK)
+ * @return Pixel buffer owned by the caller (free()), or NULL on error
+ */
+EMSCRIPTEN_KEEPALIVE
+unsigned char* decode_jpeg(const unsigned char* input_data, int64_t input_size,
+                           int* width, int* height, int* channels) {
+    ZELL_STATS_CALL("decode_jpeg", input_size);
+    ZELL_STATS_STAGE(ZELL_STAGE_DECODE, "jpeg_decode");
+    if (!input_data || input_size <= 0 || !width || !height || !channels) {
+        return NULL;
+    }
+
+    unsigned char* pixels = jpeg_decode(input_data, input_size, 1, width, height, channels);
+    if (pixels) ZELL_STATS_OUTPUT((int64_t)*width * *height * *channels);
+    return pixels;
+}
+
+/**
+ * Decode a JPEG at a reduced size, scaling inside the inverse DCT: far
+ * faster than a full decode and with a fraction of its memory. At 1/8 only
+ * the DC terms are used, and a progressive file is read no further than its
+ * first DC scans (without their low-bit refinement).
+ * @param input_data - JPEG data
+ * @param input_size - Size of JPEG data
+ * @param scale - Size divisor: 1, 2, 4 or 8 (dimensions round up)
+ * @param width - Receives the decoded width
+ * @param height - Receives the decoded height
+ * @param channels - Receives 1 (gray), 3 (RGB) or 4 (CMYK)
+ * @return Pixel buffer owned by the caller (free()), or NULL on error
+ */
+EMSCRIPTEN_KEEPALIVE
+unsigned char* decode_jpeg_scaled(const unsigned char* input_data, int64_t input_size, int scale,
+                                  int* width, int* height, int* channels) {
+    ZELL_STATS_CALL("decode_jpeg_scaled", input_size);
+    ZELL_STATS_STAGE(ZELL_STAGE_DECODE, "jpeg_decode");
+    if (!input_data || input_size <= 0 || !width || !height || !channels ||
+        (scale != 1 && scale != 2 && scale != 4 && scale != 8)) {
+        return NULL;
+    }
+
+    unsigned char* pixels = jpeg_decode(input_data, input_size, scale, width, height, channels);
+    if (pixels) ZELL_STATS_OUTPUT((int64_t)*width * *height * *channels);
+    return pixels;
+}
+
+// --- Target quality (SSIM) ------------------------------------------------
+
+// First quality tried, and the one used for images too small to measure
+#define JPEG_TARGET_FIRST 75
+#define JPEG_TARGET_SMALL 95
+
+/**
+ * Decode a candidate JPEG as luma and score it against the source
+ * @param jpeg - Candidate JPEG
+ * @param jpeg_size - Size of the candidate
+ * @param ref - Reference built from the source
+ * @param target - SSIM to reach
+ * @param score - Receives the SSIM (an estimate if decoding stopped early)
+ * @return -1 on error, 1 if the candidate reaches the target, 0 if not
+ */
+static int jpeg_target_check(const unsigned char* jpeg, unsigned long jpeg_size, const ZellSsimRef* ref,
+                             double target, double* score) {
+    struct jpeg_decompress_struct cinfo;
+    JpegError error;
+    ZellSsimRun run;
+    unsigned char* volatile row = NULL;
+    volatile int started = 0;
+
+    cinfo.err = &error.base;
+    jpeg_init_error(&error);
+    if (setjmp(error.jump)) {
+        jpeg_destroy_decompress(&cinfo);
+        zell_pool_put(row);
+        if (started) zell_ssim_end(&run);
+        return -1;
+    }
+
+    jpeg_create_decompress(&cinfo);
+    jpeg_mem_src(&cinfo, (unsigned char*)jpeg, jpeg_size);
+    jpeg_read_header(&cinfo, TRUE);
+    // Luma only: the chroma planes are never transformed or upsampled
+    cinfo.out_color_space = JCS_GRAYSCALE;
+    jpeg_start_decompress(&cinfo);
+
+    row = (unsigned char*)zell_pool_get(cinfo.output_width);
+    if (!row || zell_ssim_begin(&run, ref, target) < 0) longjmp(error.jump, 1);
+    started = 1;
+
+    int hopeless = 0;
+    while (cinfo.output_scanline < cinfo.output_height && !hopeless) {
+        JSAMPROW line = row;
+        jpeg_read_scanlines(&cinfo, &line, 1);
+        hopeless = zell_ssim_row(&run, row);
+    }
+
+    // Stopping early leaves scanlines unread, which finish would complain about
+    if (hopeless) {
+        jpeg_abort_decompress(&cinfo);
+    } else {
+        jpeg_finish_decompress(&cinfo);
+    }
+    jpeg_destroy_decompress(&cinfo);
+    zell_pool_put(row);
+    *score = zell_ssim_end(&run);
+    return !hopeless && *score >= target;
+}
+
+/**
+ * Encode interleaved 8-bit pixels as the smallest baseline JPEG that looks
+ * at least as close to them as a target SSIM
+ *
+ * The quality is searched between 1 and 100, interpolating on the scores
+ * measured so far and bisecting when that would not narrow the range
+ * enough.  If even quality 100 misses the target, that encode is returned.
+ * @param pixels - Gray (1), RGB (3) or RGBA (4, alpha dropped) pixels
+ * @param width - Image width
+ * @param height - Image height
+ * @param channels - Number of color channels
+ * @param target - SSIM to reach (0-1, e.g. 0.99; measured on downscaled luma)
+ * @param output_data - Output buffer, or NULL to only measure the output
+ * @param output_size - Size of output buffer (0 when measuring)
+ * @param quality - Receives the JPEG quality chosen (may be NULL)
+ * @return -1 on error or if the output does not fit, JPEG size on success
+ */
+EMSCRIPTEN_KEEPALIVE
+int64_t encode_jpeg_target(const unsigned char* pixels, int width, int height, int channels,
+                           double target, unsigned char* output_data, int64_t output_size, int* quality) {
+    ZELL_STATS_CALL("encode_jpeg_target", (int64_t)width * height * channels);
+    ZELL_STATS_STAGE(ZELL_STAGE_ENCODE, "jpeg_target");
+    if (!pixels || width <= 0 || height <= 0 || !(target >= 0.0 && target <= 1.0) ||
+        (channels != 1 && channels != 3 && channels != 4) || !zell_output_valid(output_data, output_size)) {
+        return -1;
+    }
+
+    // The quality range still open: lo misses the target (0 before any
+    // miss), hi reaches it (101 before any hit)
+    int lo = 0, hi = 101;
+    double lo_score = 0.0, hi_score = 1.0;
+    ZellSsimRef ref;
+    if (width < ZELL_SSIM_WINDOW || height < ZELL_SSIM_WINDOW) {
+        hi = JPEG_TARGET_SMALL;
+    } else if (zell_ssim_reference(&ref, pixels, width, height, channels) < 0) {
+        return -1;
+    } else {
+        int q = JPEG_TARGET_FIRST;
+        while (hi - lo > 1) {
+            unsigned char* buffer = NULL;
+            unsigned long buffer_size = 0;
+            double score = 0.0;
+            int reached = jpeg_compress_buffer(pixels, width, height, channels, q, 0, &buffer, &buffer_size);
+            if (reached == 0) reached = jpeg_target_check(buffer, buffer_size, &ref, target, &score);
+            free(buffer);
+            if (reached < 0) {
+                zell_ssim_reference_free(&ref);
+                return -1;
+            }
+            if (reached) {
+                hi = q;
+                hi_score = score;
+            } else {
+                lo = q;
+                lo_score = score;
+            }
+            if (hi - lo <= 1) break;
+
+            if (hi > 100) {
+                q = (lo + 101) / 2;
+            } else if (lo == 0) {
+                q = hi / 2;
+            } else {
+                // Scores rise steadily with quality, so a straight line through
+                // the ends is a good guess; keeping it off the ends by a quarter
+                // of the range bounds the steps when the curve is lopsided
+                int margin = (hi - lo) / 4;
+                double span = hi_score - lo_score;
+                q = span > 0.0 ? lo + (int)((target - lo_score) * (hi - lo) / span + 0.5) : (lo + hi) / 2;
+                if (q < lo + margin) q = lo + margin;
+                if (q > hi - margin) q = hi - margin;
+            }
+            if (q <= lo) q = lo + 1;
+            if (q >= hi) q = hi - 1;
+        }
+        zell_ssim_reference_free(&ref);
+    }
+
+    int chosen = hi > 100 ? 100 : hi;
+    unsigned char* buffer = NULL;
+    unsigned long buffer_size = 0;
+    if (jpeg_compress_buffer(pixels, width, height, channels, chosen, 1, &buffer, &buffer_size) < 0) {
+        return -1;
+    }
+    if (quality) *quality = chosen;
+
+    int64_t result = (int64_t)buffer_size;
+    if (output_data) {
+        if ((uint64_t)buffer_size <= (uint64_t)output_size) {
+            memcpy(output_data, buffer, buffer_size);
+        } else {
+            result = -1;
+        }
+    }
+    free(buffer);
+    return ZELL_STATS_RESULT(result);
+}
+
+/**
+ * Re-encode a JPEG as the smallest JPEG that reaches a target SSIM against it
+ * @param input_data - JPEG data
+ * @param input_size - Size of JPEG data
+ * @param output_data - Output buffer, or NULL to only measure the output
+ * @param output_size - Size of output buffer (0 when measuring)
+ * @param target - SSIM to reach (0-1)
+ * @param quality - Receives the JPEG quality chosen (may be NULL)
+ * @return -1 on error or if the output does not fit, JPEG size on success
+ */
+EMSCRIPTEN_KEEPALIVE
+int64_t compress_image_target(const unsigned char* input_data, int64_t input_size,
+                              unsigned char* output_data, int64_t output_size,
+                              double target, int* quality) {
+    ZELL_STATS_CALL("compress_image_target", input_size);
+    if (!input_data || input_size <= 0 || !zell_output_valid(output_data, output_size)) {
+        return -1;
+    }
+
+    // Decoded once; every candidate is scored against these pixels
+    int width = 0, height = 0, channels = 0;
+    unsigned char* pixels = decode_jpeg(input_data, input_size, &width, &height, &channels);
+    if (!pixels) return -1;
+
+    // CMYK has no luma to compare and no encoder here
+    int64_t result = -1;
+    if (channels == 1 || channels == 3) {
+        result = encode_jpeg_target(pixels, width, height, channels, target, output_data, output_size, quality);
+    }
+    free(pixels);
+    return ZELL_STATS_RESULT(result);
+}
+
+// --- PNG encoding ------------------------------------------------------------
+
+static inline int png_abs(int value) {
+    return value < 0 ? -value : value;
+}
+
+static inline unsigned char png_paeth(int a, int b, int c) {
+    int p = a + b - c, pa = png_abs(p - a), pb = png_abs(p - b), pc = png_abs(p - c);
+    return (unsigned char)(pa <= pb && pa <= pc ? a : pb <= pc ? b : c);
+}
+
+// Apply one of the five PNG filters to a row; `prev` is the row above
+// (zeros for the first row), bpp the bytes per pixel
+static void png_filter_row(int filter, const unsigned char* row, const unsigned char* prev, int bpp,
+                           size_t stride, unsigned char* out) {
+    for (size_t i = 0; i < stride; i++) {
+        int a = i >= (size_t)bpp ? row[i - bpp] : 0;
+        int b = prev[i];
+        int c = i >= (size_t)bpp ? prev[i - bpp] : 0;
+        int predicted = 0;
+        switch (filter) {
+            case 1: predicted = a; break;
+            case 2: predicted = b; break;
+            case 3: predicted = (a + b) >> 1; break;
+            case 4: predicted = png_paeth(a, b, c); break;
+            default: break;
+        }
+        out[i] = (unsigned char)(row[i] - predicted);
+    }
+}
+
+// Write a chunk: length, type, data, CRC of type and data
+static unsigned char* png_put_chunk(unsigned char* out, const char* type, const unsigned char* data, size_t length) {
+    out[0] = (unsigned char)(length >> 24);
+    out[1] = (unsigned char)(length >> 16);
+    out[2] = (unsigned char)(length >> 8);
+    out[3] = (unsigned char)length;
+    memcpy(out + 4, type, 4);
+    if (length) memcpy(out + 8, data, length);
+    uint32_t crc = zell_crc32(0, out + 4, length + 4);
+    out[8 + length] = (unsigned char)(crc >> 24);
+    out[9 + length] = (unsigned char)(crc >> 16);
+    out[10 + length] = (unsigned char)(crc >> 8);
+    out[11 + length] = (unsigned char)crc;
+    return out + 12 + length;
+}
+
+// IDAT data is split into chunks of at most this size
+#define PNG_IDAT_CHUNK ((size_t)1 << 30)
+
+/**
+ * Encode interleaved 8-bit pixels as a PNG. Each row gets the filter whose
+ * output has the smallest sum of absolute values, as libpng chooses.
+ * @param pixels - Gray (1), gray + alpha (2), RGB (3) or RGBA (4) pixels
+ * @param width - Image width
+ * @param height - Image height
+ * @param channels - Number of channels
+ * @param level - Deflate level (0-9, below 0 for the default)
+ * @param output_data - Output buffer, or NULL to only measure the output
+ * @param output_size - Size of output buffer (0 when measuring)
+ * @return -1 on error or if the output does not fit, PNG size on success
+ */
+EMSCRIPTEN_KEEPALIVE
+int64_t encode_png(const unsigned char* pixels, int width, int height, int channels,
+                   int level, unsigned char* output_data, int64_t output_size) {
+    ZELL_STATS_CALL("encode_png", (int64_t)width * height * channels);
+    ZELL_STATS_STAGE(ZELL_STAGE_ENCODE, "png_encode");
+    if (!pixels || width <= 0 || height <= 0 || channels < 1 || channels > 4 ||
+        !zell_output_valid(output_data, output_size)) {
+        return -1;
+    }
+
+    size_t stride = (size_t)width * channels;
+    size_t filtered_size = (stride + 1) * (size_t)height;
+    size_t capacity = zell_deflate_bound(filtered_size);
+    unsigned char* filtered = (unsigned char*)zell_pool_get(filtered_size);
+    unsigned char* packed = (unsigned char*)zell_pool_get(capacity);
+    unsigned char* scratch = (unsigned char*)zell_pool_get(stride * 2);
+    unsigned char* zeros = (unsigned char*)calloc(1, stride);
+    int64_t result = -1;
+    if (!filtered || !packed || !scratch || !zeros) goto done;
+
+    for (int y = 0; y < height; y++) {
+        const unsigned char* row = pixels + (size_t)y * stride;
+        const unsigned char* prev = y ? row - stride : zeros;
+        unsigned char* out = filtered + (size_t)y * (stride + 1);
+        uint64_t best_sum = UINT64_MAX;
+        for (int filter = 0; filter < 5; filter++) {
+            unsigned char* candidate = scratch + (filter & 1) * stride;
+            png_filter_row(filter, row, prev, channels, stride, candidate);
+            // Bytes as signed values: small residuals either side of zero
+            uint64_t sum = 0;
+            for (size_t i = 0; i < stride && sum < best_sum; i++) sum += (unsigned)png_abs((signed char)candidate[i]);
+            if (sum < best_sum) {
+                best_sum = sum;
+                out[0] = (unsigned char)filter;
+                memcpy(out + 1, candidate, stride);
+            }
+        }
+    }
+
+    int64_t packed_size = zell_deflate(filtered, filtered_size, level, ZELL_DEFLATE_ZLIB, packed, capacity);
+    if (packed_size < 0) goto done;
+    size_t idat_chunks = packed_size ? ((size_t)packed_size + PNG_IDAT_CHUNK - 1) / PNG_IDAT_CHUNK : 1;
+    int64_t total = 8 + (12 + 13) + (int64_t)idat_chunks * 12 + packed_size + 12;
+    if (!output_data) {
+        result = total;
+        goto done;
+    }
+    if (total > output_size) goto done;
+
+    static const unsigned char signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+    static const unsigned char color_types[5] = { 0, 0, 4, 2, 6 };
+    unsigned char header[13] = {
+        (unsigned char)(width >> 24), (unsigned char)(width >> 16), (unsigned char)(width >> 8), (unsigned char)width,
+        (unsigned char)(height >> 24), (unsigned char)(height >> 16), (unsigned char)(height >> 8), (unsigned char)height,
+        8, color_types[channels], 0, 0, 0,  // 8-bit, deflate, adaptive filtering, not interlaced
+    };
+    unsigned char* out = output_data;
+    memcpy(out, signature, 8);
+    out = png_put_chunk(out + 8, "IHDR", header, 13);
+    size_t written = 0;
+    do {
+        size_t piece = (size_t)packed_size - written < PNG_IDAT_CHUNK ? (size_t)packed_size - written : PNG_IDAT_CHUNK;
+        out = png_put_chunk(out, "IDAT", packed + written, piece);
+        written += piece;
+    } while (written < (size_t)packed_size);
+    out = png_put_chunk(out, "IEND", NULL, 0);
+    result = (int64_t)(out - output_data);
+
+done:
+    zell_pool_put(filtered);
+    zell_pool_put(packed);
+    zell_pool_put(scratch);
+    free(zeros);
+    return ZELL_STATS_RESULT(result);
+}
+
+// --- PNG decoding ------------------------------------------------------------
+
+static const unsigned char png_signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+
+// Adam7 passes: first column, first row, column step, row step
+static const unsigned char png_adam7[7][4] = {
+    { 0, 0, 8, 8 }, { 4, 0, 8, 8 }, { 0, 4, 4, 8 }, { 2, 0, 4, 4 }, { 0, 2, 2, 4 }, { 1, 0, 2, 2 }, { 0, 1, 1, 2 },
+};
+static const unsigned char png_whole[4] = { 0, 0, 1, 1 };  // the one "pass" of a plain image
+
+// Ancillary chunks an optimized PNG keeps: they say how to show the pixels
+// (color space, gamma, physical size, EXIF orientation), not how they are
+// stored, so they stay valid whatever the new color type
+static const char* const png_kept_types[] = { "cHRM", "gAMA", "iCCP", "sRGB", "cICP", "pHYs", "eXIf" };
+#define PNG_KEPT_MAX 16
+
+// What the chunks of a PNG say about it
+typedef struct {
+    int width, height;
+    int depth;                  // bits per sample in the file
+    int color_type;
+    int interlace;
+    int palette_size;
+    unsigned char palette[256 * 3];
+    unsigned char alpha[256];   // tRNS of a palette, 255 past its end
+    int keyed;                  // tRNS color key of gray or RGB
+    uint16_t key[3];
+    int animated;               // acTL: an APNG, whose frames would be lost
+    const unsigned char* first_idat;
+    int kept;
+    const unsigned char* kept_chunks[PNG_KEPT_MAX];  // whole chunks, length to CRC
+    size_t kept_sizes[PNG_KEPT_MAX];
+} PngInfo;
+
+// Pixels with the file's packing undone: palettes expanded, color keys
+// turned into alpha, low bit depths scaled to 8 bits
+typedef struct {
+    int width, height;
+    int channels;               // 1 gray, 2 gray + alpha, 3 RGB, 4 RGBA
+    int depth;                  // 8, or 16 with big-endian samples
+    unsigned char* pixels;      // malloc()
+} PngImage;
+
+static inline uint32_t png_load32(const unsigned char* p) {
+    return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3];
+}
+
+static inline int png_samples(int color_type) {
+    static const unsigned char samples[7] = { 1, 0, 3, 1, 2, 0, 4 };
+    return color_type >= 0 && color_type <= 6 ? samples[color_type] : 0;
+}
+
+/**
+ * Walk the chunks of a PNG, checking their CRCs
+ * @return -1 if it is not a valid PNG, 0 on success
+ */
+static int png_parse(const unsigned char* data, size_t size, PngInfo* info) {
+    memset(info, 0, sizeof(*info));
+    memset(info->alpha, 255, sizeof(info->alpha));
+    if (size < 8 || memcmp(data, png_signature, 8) != 0) return -1;
+
+    size_t pos = 8;
+    int seen_header = 0, idat_done = 0;
+    for (;;) {
+        if (size - pos < 12) return -1;
+        uint32_t length = png_load32(data + pos);
+        if (length > 0x7FFFFFFFu || size - pos - 12 < length) return -1;
+        const unsigned char* type = data + pos + 4;
+        const unsigned char* body = type + 4;
+        if (zell_crc32(0, type, (size_t)length + 4) != png_load32(body + length)) return -1;
+
+        int is_idat = memcmp(type, "IDAT", 4) == 0;
+        if (info->first_idat && !is_idat) idat_done = 1;
+        if (!seen_header) {
+            if (memcmp(type, "IHDR", 4) != 0 || length != 13) return -1;
+            uint32_t width = png_load32(body), height = png_load32(body + 4);
+            int depth = body[8], color_type = body[9];
+            int valid_depth = color_type == 0 ? (depth == 1 || depth == 2 || depth == 4 || depth == 8 || depth == 16)
+                            : color_type == 3 ? (depth == 1 || depth == 2 || depth == 4 || depth == 8)
+                            : (color_type == 2 || color_type == 4 || color_type == 6) && (depth == 8 || depth == 16);
+            if (!width || !height || width > 0x7FFFFFFFu || height > 0x7FFFFFFFu || !valid_depth ||
+                body[10] != 0 || body[11] != 0 || body[12] > 1) {
+                return -1;
+            }
+            // Expanded pixels take up to 8 bytes each
+            if ((uint64_t)width * height > (uint64_t)SIZE_MAX / 16) return -1;
+            info->width = (int)width;
+            info->height = (int)height;
+            info->depth = depth;
+            info->color_type = color_type;
+            info->interlace = body[12];
+            seen_header = 1;
+        } else if (is_idat) {
+            if (idat_done) return -1;  // IDAT chunks have to be consecutive
+            if (!info->first_idat) info->first_idat = data + pos;
+        } else if (memcmp(type, "PLTE", 4) == 0) {
+            if (length == 0 || length % 3 || length > 256 * 3) return -1;
+            info->palette_size = (int)(length / 3);
+            memcpy(info->palette, body, length);
+        } else if (memcmp(type, "tRNS", 4) == 0) {
+            if (info->color_type == 3) {
+                if (length > 256) return -1;
+                memcpy(info->alpha, body, length);
+            } else if (info->color_type == 0 && length == 2) {
+                info->keyed = 1;
+                info->key[0] = (uint16_t)(body[0] << 8 | body[1]);
+            } else if (info->color_type == 2 && length == 6) {
+                info->keyed = 1;
+                for (int i = 0; i < 3; i++) info->key[i] = (uint16_t)(body[2 * i] << 8 | body[2 * i + 1]);
+            }
+        } else if (memcmp(type, "IEND", 4) == 0) {
+            break;
+        } else if (memcmp(type, "acTL", 4) == 0) {
+            info->animated = 1;
+        } else if (info->kept < PNG_KEPT_MAX) {
+            for (size_t k = 0; k < sizeof(png_kept_types) / sizeof(png_kept_types[0]); k++) {
+                if (memcmp(type, png_kept_types[k], 4) == 0) {
+                    info->kept_chunks[info->kept] = data + pos;
+                    info->kept_sizes[info->kept] = (size_t)length + 12;
+                    info->kept++;
+                    break;
+                }
+            }
+        }
+        pos += (size_t)length + 12;
+    }
+    if (!info->first_idat || (info->color_type == 3 && !info->palette_size)) return -1;
+    return 0;
+}
+
+// Hands zell_inflate the IDAT chunks after the first, which png_parse has
+// already bounds-checked
+typedef struct {
+    const unsigned char* next;  // chunk after the one handed out last
+} PngIdatReader;
+
+static int png_idat_more(void* ctx, const unsigned char** data, size_t* size) {
+    PngIdatReader* reader = (PngIdatReader*)ctx;
+    if (memcmp(reader->next + 4, "IDAT", 4) != 0) return -1;
+    uint32_t length = png_load32(reader->next);
+    *data = reader->next + 8;
+    *size = length;
+    reader->next += (size_t)length + 12;
+    return 0;
+}
+
+// Undo one filter in place; `prev` is the unfiltered row above, or NULL
+static int png_unfilter_row(int filter, unsigned char* row, const unsigned char* prev, int bpp, size_t stride) {
+    size_t i;
+    switch (filter) {
+        case 0:
+            break;
+        case 1:
+            for (i = (size_t)bpp; i < stride; i++) row[i] = (unsigned char)(row[i] + row[i - bpp]);
+            break;
+        case 2:
+            if (prev) for (i = 0; i < stride; i++) row[i] = (unsigned char)(row[i] + prev[i]);
+            break;
+        case 3:
+            for (i = 0; i < stride; i++) {
+                int a = i >= (size_t)bpp ? row[i - bpp] : 0;
+                int b = prev ? prev[i] : 0;
+                row[i] = (unsigned char)(row[i] + ((a + b) >> 1));
+            }
+            break;
+        case 4:
+            for (i = 0; i < stride; i++) {
+                int a = i >= (size_t)bpp ? row[i - bpp] : 0;
+                int b = prev ? prev[i] : 0;
+                int c = prev && i >= (size_t)bpp ? prev[i - bpp] : 0;
+                row[i] = (unsigned char)(row[i] + png_paeth(a, b, c));
+            }
+            break;
+        default:
+            return -1;
+    }
     return 0;
 }
 
+// Expand `count` pixels of an unfiltered row into the image's layout
+static void png_expand_row(const PngInfo* info, const PngImage* image, const unsigned char* in, int count,
+                           unsigned char* out) {
+    const int depth = info->depth, samples = png_samples(info->color_type);
+    const int channels = image->channels;
+    if (depth >= 8 && !info->keyed && info->color_type != 3) {
+        memcpy(out, in, (size_t)count * samples * (depth / 8));
+        return;
+    }
+    const unsigned mask = (1u << depth) - 1;
+    for (int x = 0; x < count; x++) {
+        uint16_t s[4];
+        if (depth < 8) {
+            int bit = x * depth;
+            s[0] = (uint16_t)((in[bit >> 3] >> (8 - depth - (bit & 7))) & mask);
+        } else {
+            for (int c = 0; c < samples; c++) {
+                s[c] = depth == 16 ? (uint16_t)(in[(x * samples + c) * 2] << 8 | in[(x * samples + c) * 2 + 1])
+                                   : in[x * samples + c];
+            }
+        }
+
+        if (info->color_type == 3) {
+            // Out-of-range indices show as opaque black, as libpng draws them
+            unsigned char* px = out + (size_t)x * channels;
+            if (s[0] < info->palette_size) {
+                memcpy(px, info->palette + s[0] * 3, 3);
+            } else {
+                memset(px, 0, 3);
+            }
+            if (channels == 4) px[3] = s[0] < info->palette_size ? info->alpha[s[0]] : 255;
+            continue;
+        }
+
+        int transparent = 0;
+        if (info->keyed) {
+            transparent = 1;
+            for (int c = 0; c < samples; c++) transparent &= s[c] == info->key[c];
+        }
+        if (depth < 8) s[0] = (uint16_t)(s[0] * 255 / mask);
+        if (info->keyed) s[samples] = transparent ? 0 : (depth == 16 ? 0xFFFF : 255);
+        for (int c = 0; c < channels; c++) {
+            if (image->depth == 16) {
+                out[((size_t)x * channels + c) * 2] = (unsigned char)(s[c] >> 8);
+                out[((size_t)x * channels + c) * 2 + 1] = (unsigned char)s[c];
+            } else {
+                out[(size_t)x * channels + c] = (unsigned char)s[c];
+            }
+        }
+    }
+}
 
+/**
+ * Decode the pixels of a parsed PNG
+ * @return -1 on error, 0 on success
+ */
+static int png_decode_pixels(const PngInfo* info, PngImage* image) {
+    int samples = png_samples(info->color_type);
+    int bits = samples * info->depth;
+    int bpp = bits < 8 ? 1 : bits / 8;
+    image->width = info->width;
+    image->height = info->height;
+    image->depth = info->depth == 16 ? 16 : 8;
+    if (info->color_type == 3) {
+        image->channels = 3;
+        for (int i = 0; i < info->palette_size; i++) {
+            if (info->alpha[i] != 255) image->channels = 4;
+        }
+    } else {
+        image->channels = samples + (info->keyed ? 1 : 0);
+    }
+    size_t pixel_size = (size_t)image->channels * (image->depth / 8);
+    size_t image_stride = (size_t)image->width * pixel_size;
+
+    // Sub-images: the whole image, or the seven Adam7 passes
+    int passes = info->interlace ? 7 : 1;
+    size_t raw_size = 0;
+    for (int p = 0; p < passes; p++) {
+        const unsigned char* a = info->interlace ? png_adam7[p] : png_whole;
+        size_t pw = info->width > a[0] ? (size_t)(info->width - a[0] + a[2] - 1) / a[2] : 0;
+        size_t ph = info->height > a[1] ? (size_t)(info->height - a[1] + a[3] - 1) / a[3] : 0;
+        if (pw && ph) raw_size += ph * ((pw * bits + 7) / 8 + 1);
+    }
+
+    unsigned char* raw = (unsigned char*)zell_pool_get(raw_size);
+    unsigned char* expanded = (unsigned char*)zell_pool_get(image_stride);
+    image->pixels = (unsigned char*)malloc(image_stride * image->height);
+    int status = -1;
+    if (!raw || !expanded || !image->pixels) goto done;
+
+    {
+        uint32_t first = png_load32(info->first_idat);
+        PngIdatReader reader = { info->first_idat + first + 12 };
+        ZellInflate z;
+        memset(&z, 0, sizeof(z));
+        z.next_in = info->first_idat + 8;
+        z.avail_in = first;
+        z.more = png_idat_more;
+        z.ctx = &reader;
+        z.out = raw;
+        z.out_capacity = raw_size;
+        int rc = zell_inflate(&z, ZELL_DEFLATE_ZLIB);
+        // Data past the image is ignored, as libpng does
+        if ((rc != ZELL_INFLATE_DONE && rc != ZELL_INFLATE_NO_ROOM) || z.out_pos != raw_size) goto done;
+    }
+
+    unsigned char* row = raw;
+    for (int p = 0; p < passes; p++) {
+        const unsigned char* a = info->interlace ? png_adam7[p] : png_whole;
+        int pw = info->width > a[0] ? (info->width - a[0] + a[2] - 1) / a[2] : 0;
+        int ph = info->height > a[1] ? (info->height - a[1] + a[3] - 1) / a[3] : 0;
+        if (!pw || !ph) continue;
+        size_t stride = ((size_t)pw * bits + 7) / 8;
+        const unsigned char* prev = NULL;
+        for (int y = 0; y < ph; y++, row += stride + 1) {
+            if (png_unfilter_row(row[0], row + 1, prev, bpp, stride) < 0) goto done;
+            prev = row + 1;
+            unsigned char* target = image->pixels + (size_t)(a[1] + y * a[3]) * image_stride;
+            if (!info->interlace) {
+                png_expand_row(info, image, row + 1, pw, target);
+                continue;
+            }
+            png_expand_row(info, image, row + 1, pw, expanded);
+            for (int x = 0; x < pw; x++) {
+                memcpy(target + (size_t)(a[0] + x * a[2]) * pixel_size, expanded + (size_t)x * pixel_size, pixel_size);
+            }
+        }
+    }
+    status = 0;
+
+done:
+    zell_pool_put(raw);
+    zell_pool_put(expanded);
+    if (status < 0) {
+        free(image->pixels);
+        image->pixels = NULL;
+    }
+    return status;
+}
+
+/**
+ * Decode a PNG into interleaved 8-bit pixels (16-bit samples keep their
+ * high byte)
+ * @param input_data - PNG data
+ * @param input_size - Size of PNG data
+ * @param width - Receives the image width
+ * @param height - Receives the image height
+ * @param channels - Receives 1 (gray), 2 (gray + alpha), 3 (RGB) or 4 (RGBA)
+ * @return Pixel buffer owned by the caller (free()), or NULL on error
+ */
+EMSCRIPTEN_KEEPALIVE
+unsigned char* decode_png(const unsigned char* input_data, int64_t input_size,
+                          int* width, int* height, int* channels) {
+    ZELL_STATS_CALL("decode_png", input_size);
+    ZELL_STATS_STAGE(ZELL_STAGE_DECODE, "png_decode");
+    if (!input_data || input_size <= 0 || !width || !height || !channels ||
+        (uint64_t)input_size > (uint64_t)SIZE_MAX) {
+        return NULL;
+    }
+
+    PngInfo info;
+    PngImage image;
+    if (png_parse(input_data, (size_t)input_size, &info) < 0 || png_decode_pixels(&info, &image) < 0) {
+        return NULL;
+    }
+    if (image.depth == 16) {
+        size_t samples = (size_t)image.width * image.height * image.channels;
+        for (size_t i = 0; i < samples; i++) image.pixels[i] = image.pixels[i * 2];
+    }
+
+    *width = image.width;
+    *height = image.height;
+    *channels = image.channels;
+    ZELL_STATS_OUTPUT((int64_t)*width * *height * *channels);
+    return image.pixels;
+}
+
+// --- PNG optimization --------------------------------------------------------
+
+// Filter strategies: the five filters on every row, then three ways of
+// choosing one per row
+#define PNG_STRATEGY_MINSUM  5   // smallest sum of absolute residuals, as libpng
+#define PNG_STRATEGY_ENTROPY 6   // fewest bits by the row's own byte histogram
+#define PNG_STRATEGY_BRUTE   7   // smallest deflate output after the row above
+#define PNG_STRATEGIES       8
+#define PNG_STRATEGY_REPLAY -1   // the choices a strategy already made
+
+// The strategies are ranked by a quick deflate of their output; only the
+// winner is packed with the best level
+#define PNG_SCREEN_LEVEL 4
+#define PNG_BRUTE_LEVEL 2
+// Brute force deflates every row five times, so big images skip it
+#define PNG_BRUTE_LIMIT ((size_t)8 << 20)
+
+#define PNG_PALETTE_SLOTS 1024   // hash of colors to palette indices
+
+// How the reduced pixels are stored
+typedef struct {
+    int color_type;
+    int depth;
+    int keyed;                  // color key replaces a binary alpha channel
+    uint16_t key[3];
+    int palette_size;
+    int transparent;            // palette entries with alpha below 255, first
+    unsigned char palette[256 * 4];  // RGBA
+    uint32_t slot_color[PNG_PALETTE_SLOTS];
+    int16_t slot_index[PNG_PALETTE_SLOTS];
+} PngForm;
+
+typedef void (*ImageTaskFn)(void* ctx, int index);
+
+typedef struct {
+    ImageTaskFn run;
+    void* ctx;
+    int count;
+    int next;
+} ImageScheduler;
+
+#ifdef ZELL_HAVE_THREADS
+static void* image_scheduler_worker(void* arg) {
+    ImageScheduler* scheduler = (ImageScheduler*)arg;
+    for (;;) {
+        int index = __atomic_fetch_add(&scheduler->next, 1, __ATOMIC_RELAXED);
+        if (index >= scheduler->count) break;
+        ZELL_STATS_WORKER();
+        scheduler->run(scheduler->ctx, index);
+    }
+    return NULL;
+}
+#endif
+
+// Run run(ctx, i) for every i in [0, count) on up to `threads` threads
+static void image_parallel_for(int count, int threads, ImageTaskFn run, void* ctx) {
+    if (threads > count) threads = count;
+#ifdef ZELL_HAVE_THREADS
+    if (threads > 1) {
+        ZELL_STATS_PARALLEL(threads);
+        ImageScheduler scheduler = { run, ctx, count, 0 };
+        pthread_t workers[ZELL_MAX_THREADS];
+        int started = 0;
+        for (; started < threads - 1; started++) {
+            if (pthread_create(&workers[started], NULL, image_scheduler_worker, &scheduler) != 0) break;
+        }
+        // The calling thread works too, so a failed spawn only costs speed
+        image_scheduler_worker(&scheduler);
+        for (int i = 0; i < started; i++) pthread_join(workers[i], NULL);
+        return;
+    }
+#endif
+    for (int i = 0; i < count; i++) run(ctx, i);
+}
+
+// 16-bit samples whose two bytes match are 8-bit samples times 257
+static void png_reduce_depth(PngImage* image) {
+    if (image->depth != 16) return;
+    unsigned char* p = image->pixels;
+    size_t samples = (size_t)image->width * image->height * image->channels;
+    for (size_t i = 0; i < samples; i++) {
+        if (p[2 * i] != p[2 * i + 1]) return;
+    }
+    for (size_t i = 0; i < samples; i++) p[i] = p[2 * i];
+    image->depth = 8;
+}
+
+// Drop an alpha channel that is opaque everywhere and color that is gray
+static void png_reduce_channels(PngImage* image) {
+    const int channels = image->channels, bytes = image->depth / 8;
+    const size_t pixel_size = (size_t)channels * bytes, count = (size_t)image->width * image->height;
+    const int has_alpha = channels == 2 || channels == 4, color = channels >= 3;
+    int opaque = has_alpha, gray = color;
+    const unsigned char* px = image->pixels;
+    for (size_t i = 0; i < count && (opaque || gray); i++, px += pixel_size) {
+        if (opaque) {
+            const unsigned char* alpha = px + (size_t)(channels - 1) * bytes;
+            opaque = alpha[0] == 255 && alpha[bytes - 1] == 255;
+        }
+        if (gray) gray = !memcmp(px, px + bytes, bytes) && !memcmp(px, px + 2 * bytes, bytes);
+    }
+
+    const int colors = gray || !color ? 1 : 3;
+    const int keep_alpha = has_alpha && !opaque;
+    if (colors + keep_alpha == channels) return;
+    unsigned char* out = image->pixels;
+    px = image->pixels;
+    for (size_t i = 0; i < count; i++, px += pixel_size) {
+        memmove(out, px, (size_t)colors * bytes);
+        out += (size_t)colors * bytes;
+        if (keep_alpha) {
+            memmove(out, px + (size_t)(channels - 1) * bytes, bytes);
+            out += bytes;
+        }
+    }
+    image->channels = colors + keep_alpha;
+}
+
+// An alpha channel that is only ever fully opaque or fully transparent can
+// become a tRNS color key, if every transparent pixel has the same color
+// and no opaque one has it
+static int png_find_key(const PngImage* image, uint16_t key[3]) {
+    const int channels = image->channels, bytes = image->depth / 8;
+    if (channels != 2 && channels != 4) return 0;
+    const size_t pixel_size = (size_t)channels * bytes, color_size = pixel_size - bytes;
+    const size_t count = (size_t)image->width * image->height;
+    const unsigned char* first = NULL;
+    const unsigned char* px = image->pixels;
+    for (size_t i = 0; i < count; i++, px += pixel_size) {
+        const unsigned char* alpha = px + color_size;
+        int transparent = alpha[0] == 0 && alpha[bytes - 1] == 0;
+        if (!transparent && !(alpha[0] == 255 && alpha[bytes - 1] == 255)) return 0;
+        if (transparent) {
+            if (!first) first = px;
+            else if (memcmp(first, px, color_size) != 0) return 0;
+        }
+    }
+    if (!first) return 0;
+    px = image->pixels;
+    for (size_t i = 0; i < count; i++, px += pixel_size) {
+        if (px[color_size] && !memcmp(first, px, color_size)) return 0;
+    }
+    for (int c = 0; c < channels - 1; c++) {
+        key[c] = bytes == 2 ? (uint16_t)(first[2 * c] << 8 | first[2 * c + 1]) : first[c];
+    }
+    return 1;
+}
+
+static inline uint32_t png_pixel_rgba(const unsigned char* px, int channels) {
+    switch (channels) {
+        case 1: return (uint32_t)px[0] << 24 | (uint32_t)px[0] << 16 | (uint32_t)px[0] << 8 | 255;
+        case 2: return (uint32_t)px[0] << 24 | (uint32_t)px[0] << 16 | (uint32_t)px[0] << 8 | px[1];
+        case 3: return (uint32_t)px[0] << 24 | (uint32_t)px[1] << 16 | (uint32_t)px[2] << 8 | 255;
+        default: return (uint32_t)px[0] << 24 | (uint32_t)px[1] << 16 | (uint32_t)px[2] << 8 | px[3];
+    }
+}
+
+static inline int png_palette_slot(const PngForm* form, uint32_t color) {
+    unsigned slot = (color * 0x9E3779B1u) >> 22;
+    while (form->slot_index[slot] >= 0 && form->slot_color[slot] != color) slot = (slot + 1) & (PNG_PALETTE_SLOTS - 1);
+    return (int)slot;
+}
+
+// Transparent entries first, so tRNS stays short, then by luma, which keeps
+// similar colors at nearby indices for the filters
+static int png_palette_compare(const void* a, const void* b) {
+    uint32_t x = *(const uint32_t*)a, y = *(const uint32_t*)b;
+    int xa = (int)(x & 255), ya = (int)(y & 255);
+    if ((xa == 255) != (ya == 255)) return xa == 255 ? 1 : -1;
+    if (xa != ya) return xa - ya;
+    unsigned lx = 299 * (x >> 24) + 587 * ((x >> 16) & 255) + 114 * ((x >> 8) & 255);
+    unsigned ly = 299 * (y >> 24) + 587 * ((y >> 16) & 255) + 114 * ((y >> 8) & 255);
+    return lx != ly ? (lx < ly ? -1 : 1) : (x < y ? -1 : x > y);
+}
+
+// Collect the colors of an 8-bit image into a palette; -1 if over 256
+static int png_build_palette(const PngImage* image, PngForm* form) {
+    memset(form->slot_index, 0xFF, sizeof(form->slot_index));
+    uint32_t colors[256];
+    int count = 0;
+    const size_t pixels = (size_t)image->width * image->height;
+    const unsigned char* px = image->pixels;
+    uint32_t last = 0;
+    for (size_t i = 0; i < pixels; i++, px += image->channels) {
+        uint32_t color = png_pixel_rgba(px, image->channels);
+        if (i && color == last) continue;
+        last = color;
+        int slot = png_palette_slot(form, color);
+        if (form->slot_index[slot] >= 0) continue;
+        if (count == 256) return -1;
+        form->slot_color[slot] = color;
+        form->slot_index[slot] = (int16_t)count;
+        colors[count++] = color;
+    }
+
+    qsort(colors, (size_t)count, sizeof(uint32_t), png_palette_compare);
+    form->palette_size = count;
+    form->transparent = 0;
+    for (int i = 0; i < count; i++) {
+        uint32_t color = colors[i];
+        form->palette[i * 4] = (unsigned char)(color >> 24);
+        form->palette[i * 4 + 1] = (unsigned char)(color >> 16);
+        form->palette[i * 4 + 2] = (unsigned char)(color >> 8);
+        form->palette[i * 4 + 3] = (unsigned char)color;
+        if ((color & 255) != 255) form->transparent = i + 1;
+        form->slot_index[png_palette_slot(form, color)] = (int16_t)i;
+    }
+    return 0;
+}
+
+// Fewest bits per sample that hold every gray level exactly (levels of a
+// d-bit image are multiples of 255 / (2^d - 1))
+static int png_gray_depth(const PngImage* image) {
+    const size_t pixels = (size_t)image->width * image->height;
+    const unsigned char* px = image->pixels;
+    int depth = 1;
+    for (size_t i = 0; i < pixels && depth < 8; i++, px += image->channels) {
+        unsigned v = px[0];
+        while (depth < 8 && v % (255u / ((1u << depth) - 1))) depth *= 2;
+    }
+    return depth;
+}
+
+// Pick the smallest lossless storage for the pixels, reducing them in place
+static void png_choose_form(PngImage* image, PngForm* form) {
+    png_reduce_depth(image);
+    png_reduce_channels(image);
+    memset(form, 0, sizeof(*form));
+    form->depth = image->depth;
+    form->keyed = png_find_key(image, form->key);
+    int samples = image->channels - form->keyed;
+    form->color_type = samples == 1 ? 0 : samples == 2 ? 4 : samples == 3 ? 2 : 6;
+    if (form->color_type == 0 && form->depth == 8) {
+        form->depth = png_gray_depth(image);
+        if (form->keyed) form->key[0] = (uint16_t)(form->key[0] / (255u / ((1u << form->depth) - 1)));
+    }
+
+    // A palette wins whenever its indices are narrower than the samples
+    if (image->depth == 8 && png_build_palette(image, form) == 0) {
+        int count = form->palette_size;
+        int depth = count <= 2 ? 1 : count <= 4 ? 2 : count <= 16 ? 4 : 8;
+        if (depth < png_samples(form->color_type) * form->depth) {
+            form->color_type = 3;
+            form->depth = depth;
+            form->keyed = 0;
+        }
+    }
+}
+
+static inline void png_put_bits(unsigned char* row, int x, int depth, unsigned value) {
+    int bit = x * depth;
+    row[bit >> 3] |= (unsigned char)(value << (8 - depth - (bit & 7)));
+}
+
+// Store row y of the reduced image the way the form says
+static void png_pack_row(const PngForm* form, const PngImage* image, int y, unsigned char* out, size_t stride) {
+    const size_t pixel_size = (size_t)image->channels * (image->depth / 8);
+    const unsigned char* px = image->pixels + (size_t)y * image->width * pixel_size;
+    if (form->color_type == 3) {
+        if (form->depth < 8) memset(out, 0, stride);
+        for (int x = 0; x < image->width; x++, px += image->channels) {
+            int index = form->slot_index[png_palette_slot(form, png_pixel_rgba(px, image->channels))];
+            if (form->depth == 8) out[x] = (unsigned char)index;
+            else png_put_bits(out, x, form->depth, (unsigned)index);
+        }
+    } else if (form->depth < 8) {
+        unsigned step = 255u / ((1u << form->depth) - 1);
+        memset(out, 0, stride);
+        for (int x = 0; x < image->width; x++, px += image->channels) png_put_bits(out, x, form->depth, px[0] / step);
+    } else if (form->keyed) {
+        // The key stands in for the alpha channel
+        size_t color_size = pixel_size - image->depth / 8;
+        for (int x = 0; x < image->width; x++, px += pixel_size, out += color_size) memcpy(out, px, color_size);
+    } else {
+        memcpy(out, px, stride);
+    }
+}
+
+// Filter strategies share the packed rows; each keeps its choices per row
+typedef struct {
+    const unsigned char* packed;
+    size_t stride;
+    int height;
+    int bpp;
+    int brute;                  // whether brute force runs
+    unsigned char* filters;     // PNG_STRATEGIES x height
+    int64_t sizes[PNG_STRATEGIES];
+} PngSearch;
+
+// Bits to code a row with an order-0 model of its own bytes, up to a
+// constant: n log n - sum c log c, of which only the sum varies
+static double png_row_entropy(const unsigned char* row, size_t stride) {
+    uint32_t counts[256] = { 0 };
+    for (size_t i = 0; i < stride; i++) counts[row[i]]++;
+    double sum = 0.0;
+    for (int v = 0; v < 256; v++) {
+        if (counts[v]) sum += counts[v] * log2((double)counts[v]);
+    }
+    return -sum;
+}
+
+/**
+ * Filter every row by a strategy into filtered (filter byte + row each)
+ * @return -1 on error, 0 on success
+ */
+static int png_filter_image(const PngSearch* search, int strategy, unsigned char* filters, unsigned char* filtered) {
+    const size_t stride = search->stride;
+    const int bpp = search->bpp;
+    unsigned char* zeros = (unsigned char*)calloc(1, stride);
+    unsigned char* scratch = (unsigned char*)zell_pool_get(5 * (stride + 1));
+    ZellDeflate* deflater = NULL;
+    unsigned char* trial = NULL;
+    unsigned char* trial_out = NULL;
+    size_t trial_capacity = zell_deflate_bound(stride + 1);
+    int status = -1;
+    if (!zeros || !scratch) goto done;
+    if (strategy == PNG_STRATEGY_BRUTE) {
+        deflater = zell_deflate_create(PNG_BRUTE_LEVEL);
+        trial = (unsigned char*)zell_pool_get(2 * (stride + 1));
+        trial_out = (unsigned char*)zell_pool_get(trial_capacity);
+        if (!deflater || !trial || !trial_out) goto done;
+    }
+
+    for (int y = 0; y < search->height; y++) {
+        const unsigned char* row = search->packed + (size_t)y * stride;
+        const unsigned char* prev = y ? row - stride : zeros;
+        unsigned char* out = filtered + (size_t)y * (stride + 1);
+        int filter = strategy;
+        if (strategy == PNG_STRATEGY_REPLAY) {
+            filter = filters[y];
+        } else if (strategy >= PNG_STRATEGY_MINSUM) {
+            double best = 0.0;
+            for (int f = 0; f < 5; f++) {
+                unsigned char* candidate = scratch + (size_t)f * (stride + 1);
+                candidate[0] = (unsigned char)f;
+                png_filter_row(f, row, prev, bpp, stride, candidate + 1);
+                double cost = 0.0;
+                if (strategy == PNG_STRATEGY_MINSUM) {
+                    uint64_t sum = 0;
+                    for (size_t i = 1; i <= stride; i++) sum += (unsigned)png_abs((signed char)candidate[i]);
+                    cost = (double)sum;
+                } else if (strategy == PNG_STRATEGY_ENTROPY) {
+                    cost = png_row_entropy(candidate + 1, stride);
+                } else {
+                    // Compressed after the row chosen above, as it will be in the stream
+                    memcpy(trial + stride + 1, candidate, stride + 1);
+                    int64_t size = y ? zell_deflate_block(deflater, trial, stride + 1, 2 * (stride + 1),
+                                                          trial_out, trial_capacity, 1)
+                                     : zell_deflate_block(deflater, trial + stride + 1, 0, stride + 1,
+                                                          trial_out, trial_capacity, 1);
+                    if (size < 0) goto done;
+                    cost = (double)size;
+                }
+                if (f == 0 || cost < best) {
+                    best = cost;
+                    filter = f;
+                }
+            }
+            memcpy(out, scratch + (size_t)filter * (stride + 1), stride + 1);
+            if (strategy == PNG_STRATEGY_BRUTE) memcpy(trial, out, stride + 1);
+            filters[y] = (unsigned char)filter;
+            continue;
+        }
+        out[0] = (unsigned char)filter;
+        png_filter_row(filter, row, prev, bpp, stride, out + 1);
+        filters[y] = (unsigned char)filter;
+    }
+    status = 0;
+
+done:
+    free(zeros);
+    zell_pool_put(scratch);
+    zell_pool_put(trial);
+    zell_pool_put(trial_out);
+    if (deflater) zell_deflate_destroy(deflater);
+    return status;
+}
+
+static void png_search_task(void* ctx, int strategy) {
+    PngSearch* search = (PngSearch*)ctx;
+    search->sizes[strategy] = -1;
+    if (strategy == PNG_STRATEGY_BRUTE && !search->brute) return;
+
+    size_t filtered_size = (search->stride + 1) * (size_t)search->height;
+    size_t capacity = zell_deflate_bound(filtered_size);
+    unsigned char* filtered = (unsigned char*)zell_pool_get(filtered_size);
+    unsigned char* packed = (unsigned char*)zell_pool_get(capacity);
+    if (filtered && packed &&
+        png_filter_image(search, strategy, search->filters + (size_t)strategy * search->height, filtered) == 0) {
+        search->sizes[strategy] = zell_deflate(filtered, filtered_size, PNG_SCREEN_LEVEL, ZELL_DEFLATE_ZLIB,
+                                               packed, capacity);
+    }
+    zell_pool_put(filtered);
+    zell_pool_put(packed);
+}
+
+static inline unsigned char* png_put_u32(unsigned char* out, uint32_t value) {
+    out[0] = (unsigned char)(value >> 24);
+    out[1] = (unsigned char)(value >> 16);
+    out[2] = (unsigned char)(value >> 8);
+    out[3] = (unsigned char)value;
+    return out + 4;
+}
+
+/**
+ * Write pixels as the smallest PNG the strategies find
+ * @param image - Pixels, reduced in place
+ * @param info - Chunks of the PNG they came from (for the chunks kept), or NULL
+ * @param size - Receives the PNG size
+ * @return PNG owned by the caller (free()), or NULL on error
+ */
+static unsigned char* png_optimize(PngImage* image, const PngInfo* info, size_t* size) {
+    PngForm* form = (PngForm*)malloc(sizeof(PngForm));
+    unsigned char* rows = NULL;
+    unsigned char* filtered = NULL;
+    unsigned char* idat = NULL;
+    unsigned char* png = NULL;
+    PngSearch search;
+    memset(&search, 0, sizeof(search));
+    if (!form) return NULL;
+
+    {
+        ZELL_STATS_STAGE(ZELL_STAGE_TRANSFORM, "png_reduce");
+        png_choose_form(image, form);
+        int bits = png_samples(form->color_type) * form->depth;
+        search.stride = ((size_t)image->width * bits + 7) / 8;
+        search.height = image->height;
+        search.bpp = bits < 8 ? 1 : bits / 8;
+        rows = (unsigned char*)zell_pool_get(search.stride * image->height);
+        if (!rows) goto done;
+        for (int y = 0; y < image->height; y++) {
+            png_pack_row(form, image, y, rows + (size_t)y * search.stride, search.stride);
+        }
+        search.packed = rows;
+    }
+
+    {
+        ZELL_STATS_STAGE(ZELL_STAGE_ENCODE, "png_optimize");
+        size_t filtered_size = (search.stride + 1) * (size_t)search.height;
+        search.brute = filtered_size <= PNG_BRUTE_LIMIT;
+        search.filters = (unsigned char*)zell_pool_get((size_t)PNG_STRATEGIES * search.height);
+        if (!search.filters) goto done;
+        image_parallel_for(PNG_STRATEGIES, zell_resolve_threads(0), png_search_task, &search);
+
+        int best = -1;
+        for (int s = 0; s < PNG_STRATEGIES; s++) {
+            if (search.sizes[s] >= 0 && (best < 0 || search.sizes[s] < search.sizes[best])) best = s;
+        }
+        if (best < 0) goto done;
+
+        size_t capacity = zell_deflate_bound(filtered_size);
+        filtered = (unsigned char*)zell_pool_get(filtered_size);
+        idat = (unsigned char*)zell_pool_get(capacity);
+        if (!filtered || !idat ||
+            png_filter_image(&search, PNG_STRATEGY_REPLAY, search.filters + (size_t)best * search.height,
+                             filtered) < 0) {
+            goto done;
+        }
+        int64_t idat_size = zell_deflate(filtered, filtered_size, ZELL_DEFLATE_BEST, ZELL_DEFLATE_ZLIB, idat, capacity);
+        if (idat_size < 0) goto done;
+
+        size_t kept = 0;
+        for (int k = 0; info && k < info->kept; k++) kept += info->kept_sizes[k];
+        size_t idat_chunks = idat_size ? ((size_t)idat_size + PNG_IDAT_CHUNK - 1) / PNG_IDAT_CHUNK : 1;
+        size_t total = 8 + 25 + kept + idat_chunks * 12 + (size_t)idat_size + 12;
+        if (form->color_type == 3) {
+            total += 12 + (size_t)form->palette_size * 3 + (form->transparent ? 12 + form->transparent : 0);
+        }
+        if (form->keyed) total += 12 + (form->color_type == 0 ? 2 : 6);
+        png = (unsigned char*)malloc(total);
+        if (!png) goto done;
+
+        unsigned char header[13];
+        png_put_u32(png_put_u32(header, (uint32_t)image->width), (uint32_t)image->height);
+        header[8] = (unsigned char)form->depth;
+        header[9] = (unsigned char)form->color_type;
+        header[10] = header[11] = header[12] = 0;  // deflate, adaptive filtering, not interlaced
+        unsigned char* out = png;
+        memcpy(out, png_signature, 8);
+        out = png_put_chunk(out + 8, "IHDR", header, 13);
+        for (int k = 0; info && k < info->kept; k++) {
+            memcpy(out, info->kept_chunks[k], info->kept_sizes[k]);
+            out += info->kept_sizes[k];
+        }
+        if (form->color_type == 3) {
+            unsigned char entries[256 * 3], alpha[256];
+            for (int i = 0; i < form->palette_size; i++) {
+                memcpy(entries + i * 3, form->palette + i * 4, 3);
+                alpha[i] = form->palette[i * 4 + 3];
+            }
+            out = png_put_chunk(out, "PLTE", entries, (size_t)form->palette_size * 3);
+            if (form->transparent) out = png_put_chunk(out, "tRNS", alpha, (size_t)form->transparent);
+        }
+        if (form->keyed) {
+            unsigned char key[6];
+            int samples = form->color_type == 0 ? 1 : 3;
+            for (int c = 0; c < samples; c++) {
+                key[2 * c] = (unsigned char)(form->key[c] >> 8);
+                key[2 * c + 1] = (unsigned char)form->key[c];
+            }
+            out = png_put_chunk(out, "tRNS", key, (size_t)samples * 2);
+        }
+        size_t written = 0;
+        do {
+            size_t piece = (size_t)idat_size - written < PNG_IDAT_CHUNK ? (size_t)idat_size - written : PNG_IDAT_CHUNK;
+            out = png_put_chunk(out, "IDAT", idat + written, piece);
+            written += piece;
+        } while (written < (size_t)idat_size);
+        out = png_put_chunk(out, "IEND", NULL, 0);
+        *size = (size_t)(out - png);
+    }
+
+done:
+    free(form);
+    zell_pool_put(rows);
+    zell_pool_put(search.filters);
+    zell_pool_put(filtered);
+    zell_pool_put(idat);
+    return png;
+}
+
+// Palette size for a lossy quality: all 256 entries from 50 up, down to 16 at 0
+static int image_quality_colors(int quality) {
+    if (quality < 0) quality = 0;
+    return quality >= 50 ? ZELL_QUANT_MAX : 16 + quality * (ZELL_QUANT_MAX - 16) / 50;
+}
+
+// Lossy PNG: every pixel becomes its entry of a quantized, Floyd-Steinberg
+// dithered palette, which the optimizer then stores as PNG-8. 16-bit
+// samples keep their high byte.
+static int png_quantize(PngImage* image, int quality) {
+    ZELL_STATS_STAGE(ZELL_STAGE_TRANSFORM, "png_quantize");
+    const size_t count = (size_t)image->width * image->height;
+    const int channels = image->channels;
+    unsigned char* pixels = image->pixels;
+    if (image->depth == 16) {
+        for (size_t i = 0; i < count * channels; i++) pixels[i] = pixels[2 * i];
+        image->depth = 8;
+    }
+    unsigned char palette[ZELL_QUANT_MAX * 4];
+    unsigned char* indices = (unsigned char*)zell_pool_get(count);
+    if (!indices) return -1;
+    int colors = zell_quantize(pixels, image->width, image->height, channels, image_quality_colors(quality),
+                               ZELL_DITHER_FLOYD, palette, indices);
+    for (size_t i = 0; colors > 0 && i < count; i++) {
+        const unsigned char* entry = palette + indices[i] * 4;
+        unsigned char* px = pixels + i * channels;
+        switch (channels) {
+            case 1: px[0] = entry[0]; break;
+            case 2: px[0] = entry[0]; px[1] = entry[3]; break;
+            case 3: memcpy(px, entry, 3); break;
+            default: memcpy(px, entry, 4); break;
+        }
+    }
+    zell_pool_put(indices);
+    return colors < 0 ? -1 : 0;
+}
+
+/**
+ * Re-encode a PNG (or a JPEG's pixels) as a smaller PNG: pixel-identical at
+ * quality 100, quantized to a palette below. A PNG the optimizer cannot
+ * shrink, or an animated one, comes back as is.
+ * @return -1 on error or if the output does not fit, PNG size on success
+ */
+static int64_t png_process(const unsigned char* input, int64_t input_size,
+                           unsigned char* output_data, int64_t output_size, int quality) {
+    PngInfo info;
+    PngImage image;
+    const PngInfo* source = NULL;
+    memset(&image, 0, sizeof(image));
+
+    if ((uint64_t)input_size <= (uint64_t)SIZE_MAX && png_parse(input, (size_t)input_size, &info) == 0) {
+        if (info.animated) goto original;
+        ZELL_STATS_STAGE(ZELL_STAGE_DECODE, "png_decode");
+        if (png_decode_pixels(&info, &image) < 0) return -1;
+        source = &info;
+    } else {
+        image.pixels = decode_jpeg(input, input_size, &image.width, &image.height, &image.channels);
+        image.depth = 8;
+        // CMYK has no PNG color type
+        if (!image.pixels || image.channels == 4) {
+            free(image.pixels);
+            return -1;
+        }
+    }
+
+    if (quality < 100 && png_quantize(&image, quality) < 0) {
+        free(image.pixels);
+        return -1;
+    }
+    size_t size = 0;
+    unsigned char* png = png_optimize(&image, source, &size);
+    free(image.pixels);
+    if (!png) return -1;
+    if (source && (int64_t)size >= input_size) {
+        free(png);
+        goto original;
+    }
+    int64_t result = (int64_t)size;
+    if (output_data) {
+        if ((int64_t)size <= output_size) memcpy(output_data, png, size);
+        else result = -1;
+    }
+    free(png);
+    return result;
+
+original:
+    if (output_data) {
+        if (input_size > output_size) return -1;
+        memcpy(output_data, input, (size_t)input_size);
+    }
+    return input_size;
+}
+
+// --- Color quantization -----------------------------------------------------
+
+/**
+ * Reduce interleaved 8-bit pixels to a palette and one index per pixel:
+ * median cut, refined by k-means. Images with no more colors than asked
+ * for keep them exactly.
+ * @param pixels - Gray (1), gray + alpha (2), RGB (3) or RGBA (4) pixels
+ * @param width - Image width
+ * @param height - Image height
+ * @param channels - Number of channels
+ * @param colors - Palette entries at most (2-256)
+ * @param dither - 0 none, 1 Floyd-Steinberg, 2 ordered (8x8 Bayer)
+ * @param palette - Receives the entries, 4 bytes (RGBA) each; room for `colors`
+ * @param indices - Receives width x height indices
+ * @return -1 on error, number of palette entries on success
+ */
+EMSCRIPTEN_KEEPALIVE
+int quantize_image(const unsigned char* pixels, int width, int height, int channels, int colors,
+                   int dither, unsigned char* palette, unsigned char* indices) {
+    ZELL_STATS_CALL("quantize_image", (int64_t)width * height * channels);
+    ZELL_STATS_STAGE(ZELL_STAGE_TRANSFORM, "quantize");
+    if (!pixels || !palette || !indices || width <= 0 || height <= 0 || channels < 1 || channels > 4 ||
+        colors < 2 || colors > ZELL_QUANT_MAX || dither < ZELL_DITHER_NONE || dither > ZELL_DITHER_ORDERED) {
+        return -1;
+    }
+    return ZELL_STATS_STATUS(zell_quantize(pixels, width, height, channels, colors, dither, palette, indices));
+}
+
+// --- GIF encoding ------------------------------------------------------------
+
+#define GIF_CODES 4096          // LZW codes: 12 bits at most
+#define GIF_HASH_SLOTS 8192     // dictionary, (prefix code, index) to code
+
+// LZW codes packed LSB first into sub-blocks of up to 255 bytes
+typedef struct {
+    unsigned char* out;
+    unsigned char* block;       // length byte of the sub-block being filled
+    uint32_t bits;
+    int bit_count;
+} GifWriter;
+
+static inline void gif_put_byte(GifWriter* w, unsigned char byte) {
+    if (*w->block == 255) {
+        w->block = w->out++;
+        *w->block = 0;
+    }
+    *w->out++ = byte;
+    (*w->block)++;
+}
+
+static inline void gif_put_code(GifWriter* w, unsigned code, int width) {
+    w->bits |= (uint32_t)code << w->bit_count;
+    w->bit_count += width;
+    while (w->bit_count >= 8) {
+        gif_put_byte(w, (unsigned char)w->bits);
+        w->bits >>= 8;
+        w->bit_count -= 8;
+    }
+}
+
+// Worst case: a 12-bit code per index, a clear code every 256 of them
+static size_t gif_lzw_bound(size_t count) {
+    size_t bytes = ((count + count / 256 + 4) * 12 + 7) / 8;
+    return bytes + bytes / 255 + 2;
+}
+
+/**
+ * LZW-compress indices as GIF image data: sub-blocks and their terminator.
+ * The dictionary starts over when all 4096 codes are taken.
+ * @param out - Output, gif_lzw_bound(count) bytes
+ * @return End of the data written, or NULL on error
+ */
+static unsigned char* gif_lzw(const unsigned char* indices, size_t count, int min_bits, unsigned char* out) {
+    int32_t* keys = (int32_t*)zell_pool_get(sizeof(int32_t) * GIF_HASH_SLOTS);
+    uint16_t* codes = (uint16_t*)zell_pool_get(sizeof(uint16_t) * GIF_HASH_SLOTS);
+    if (!keys || !codes) {
+        zell_pool_put(keys);
+        zell_pool_put(codes);
+        return NULL;
+    }
+    const unsigned clear = 1u << min_bits, end = clear + 1;
+    unsigned next = clear + 2;
+    int width = min_bits + 1;
+    GifWriter w = { out + 1, out, 0, 0 };
+    *out = 0;
+    memset(keys, 0xff, sizeof(int32_t) * GIF_HASH_SLOTS);
+    gif_put_code(&w, clear, width);
+
+    unsigned prefix = indices[0];
+    for (size_t i = 1; i < count; i++) {
+        const int32_t key = (int32_t)(prefix << 8 | indices[i]);
+        unsigned slot = ((uint32_t)key * 0x9E3779B1u) >> 19;
+        while (keys[slot] >= 0 && keys[slot] != key) slot = (slot + 1) & (GIF_HASH_SLOTS - 1);
+        if (keys[slot] == key) {
+            prefix = codes[slot];
+            continue;
+        }
+        gif_put_code(&w, prefix, width);
+        if (next < GIF_CODES) {
+            keys[slot] = key;
+            codes[slot] = (uint16_t)next++;
+            // The decoder adds each entry a code later, so it widens when
+            // the encoder has gone one past the width
+            if (next > (1u << width) && width < 12) width++;
+        } else {
+            gif_put_code(&w, clear, width);
+            memset(keys, 0xff, sizeof(int32_t) * GIF_HASH_SLOTS);
+            next = clear + 2;
+            width = min_bits + 1;
+        }
+        prefix = indices[i];
+    }
+    gif_put_code(&w, prefix, width);
+    // ...and adds the last entry on reading the last code
+    if (next == (1u << width) && width < 12) width++;
+    gif_put_code(&w, end, width);
+    if (w.bit_count) gif_put_byte(&w, (unsigned char)w.bits);
+    // An empty sub-block ends the data; a fresh one already is one
+    if (*w.block) *w.out++ = 0;
+
+    zell_pool_put(keys);
+    zell_pool_put(codes);
+    return w.out;
+}
+
+static inline unsigned char* gif_put_u16(unsigned char* out, int value) {
+    out[0] = (unsigned char)value;
+    out[1] = (unsigned char)(value >> 8);
+    return out + 2;
+}
+
+/**
+ * Encode interleaved 8-bit pixels as a GIF89a, quantized to a palette.
+ * GIF transparency is all or nothing: alpha below 128 becomes transparent.
+ * @param pixels - Gray (1), gray + alpha (2), RGB (3) or RGBA (4) pixels
+ * @param width - Image width (up to 65535)
+ * @param height - Image height (up to 65535)
+ * @param channels - Number of channels
+ * @param colors - Palette entries at most (2-256)
+ * @param dither - 0 none, 1 Floyd-Steinberg, 2 ordered (8x8 Bayer)
+ * @param output_data - Output buffer, or NULL to only measure the output
+ * @param output_size - Size of output buffer (0 when measuring)
+ * @return -1 on error or if the output does not fit, GIF size on success
+ */
+EMSCRIPTEN_KEEPALIVE
+int64_t encode_gif(const unsigned char* pixels, int width, int height, int channels, int colors, int dither,
+                   unsigned char* output_data, int64_t output_size) {
+    ZELL_STATS_CALL("encode_gif", (int64_t)width * height * channels);
+    ZELL_STATS_STAGE(ZELL_STAGE_ENCODE, "gif_encode");
+    if (!pixels || width <= 0 || height <= 0 || width > 65535 || height > 65535 || channels < 1 ||
+        channels > 4 || colors < 2 || colors > ZELL_QUANT_MAX || dither < ZELL_DITHER_NONE ||
+        dither > ZELL_DITHER_ORDERED || !zell_output_valid(output_data, output_size)) {
+        return -1;
+    }
+
+    const size_t count = (size_t)width * height;
+    unsigned char* binary = NULL;
+    unsigned char* indices = (unsigned char*)zell_pool_get(count);
+    unsigned char* data = (unsigned char*)zell_pool_get(gif_lzw_bound(count));
+    unsigned char palette[ZELL_QUANT_MAX * 4];
+    int64_t result = -1;
+    if (!indices || !data) goto done;
+
+    const unsigned char* source = pixels;
+    if (channels == 2 || channels == 4) {
+        binary = (unsigned char*)zell_pool_get(count * channels);
+        if (!binary) goto done;
+        // One transparent entry: transparent pixels lose their colors too
+        for (size_t i = 0; i < count * channels; i += channels) {
+            if (pixels[i + channels - 1] < 128) {
+                memset(binary + i, 0, channels);
+            } else {
+                memcpy(binary + i, pixels + i, channels - 1);
+                binary[i + channels - 1] = 255;
+            }
+        }
+        source = binary;
+    }
+    int used = zell_quantize(source, width, height, channels, colors, dither, palette, indices);
+    if (used < 0) goto done;
+    int transparent = -1;
+    for (int k = 0; k < used && transparent < 0; k++) {
+        if (palette[k * 4 + 3] == 0) transparent = k;
+    }
+    int bits = 1;
+    while ((1 << bits) < used) bits++;
+    unsigned char* data_end = gif_lzw(indices, count, bits < 2 ? 2 : bits, data);
+    if (!data_end) goto done;
+
+    const size_t data_size = (size_t)(data_end - data);
+    int64_t total = 6 + 7 + 3 * ((int64_t)1 << bits) + (transparent >= 0 ? 8 : 0) + 10 + 1 + (int64_t)data_size + 1;
+    if (!output_data) {
+        result = total;
+        goto done;
+    }
+    if (total > output_size) goto done;
+
+    unsigned char* out = output_data;
+    memcpy(out, "GIF89a", 6);
+    out = gif_put_u16(out + 6, width);
+    out = gif_put_u16(out, height);
+    *out++ = (unsigned char)(0x80 | 0x70 | (bits - 1));  // global table, 8-bit color resolution
+    *out++ = 0;  // background
+    *out++ = 0;  // square pixels
+    for (int k = 0; k < (1 << bits); k++) {
+        for (int c = 0; c < 3; c++) *out++ = k < used ? palette[k * 4 + c] : 0;
+    }
+    if (transparent >= 0) {
+        static const unsigned char control[4] = { 0x21, 0xf9, 4, 1 };  // graphic control, transparent index set
+        memcpy(out, control, 4);
+        out += 4;
+        *out++ = 0;  // no delay
+        *out++ = 0;
+        *out++ = (unsigned char)transparent;
+        *out++ = 0;
+    }
+    *out++ = 0x2c;  // image descriptor: the whole screen, not interlaced, no local table
+    out = gif_put_u16(out, 0);
+    out = gif_put_u16(out, 0);
+    out = gif_put_u16(out, width);
+    out = gif_put_u16(out, height);
+    *out++ = 0;
+    *out++ = (unsigned char)(bits < 2 ? 2 : bits);
+    memcpy(out, data, data_size);
+    out += data_size;
+    *out++ = 0x3b;  // trailer
+    result = (int64_t)(out - output_data);
+
+done:
+    zell_pool_put(indices);
+    zell_pool_put(data);
+    zell_pool_put(binary);
+    return ZELL_STATS_RESULT(result);
+}
+
+/**
+ * GIF from a PNG or a JPEG, with a Floyd-Steinberg dithered palette sized
+ * by quality
+ * @return -1 on error or if the output does not fit, GIF size on success
+ */
+static int64_t gif_process(const unsigned char* input, int64_t input_size,
+                           unsigned char* output_data, int64_t output_size, int quality) {
+    int width, height, channels;
+    unsigned char* pixels = decode_png(input, input_size, &width, &height, &channels);
+    if (!pixels) {
+        pixels = decode_jpeg(input, input_size, &width, &height, &channels);
+        // CMYK would need a conversion the JPEG path does not make
+        if (pixels && channels == 4) {
+            free(pixels);
+            return -1;
+        }
+    }
+    if (!pixels) return -1;
+    int64_t result = encode_gif(pixels, width, height, channels, image_quality_colors(quality), ZELL_DITHER_FLOYD,
+                                output_data, output_size);
+    free(pixels);
+    return result;
+}
+
+// --- Previews ----------------------------------------------------------------
+
+#define JPEG_PREVIEW_QUALITY 80
+// Largest aspect ratio difference between an Exif thumbnail and its photo;
+// some cameras letterbox 3:2 photos into a 4:3 thumbnail
+#define JPEG_PREVIEW_ASPECT 0.02
+
+typedef struct {
+    int orientation;         // 1-8, 1 when upright or unknown
+    int64_t thumbnail;       // offset of the IFD1 JPEG in the data, 0 if none
+    int64_t thumbnail_size;
+} JpegExif;
+
+static uint32_t exif_u16(const unsigned char* p, int little) {
+    return little ? (uint32_t)(p[0] | p[1] << 8) : (uint32_t)(p[0] << 8 | p[1]);
+}
+
+static uint32_t exif_u32(const unsigned char* p, int little) {
+    return little ? exif_u16(p, 1) | exif_u16(p + 2, 1) << 16 : exif_u16(p, 0) << 16 | exif_u16(p + 2, 0);
+}
+
+// Step to the next marker segment before the first scan
+// @return 1 with its code and payload (clipped to the data), 0 at the scan
+// or the end of the data, -1 if the data is not a marker stream
+static int jpeg_next_segment(const unsigned char* data, int64_t size, int64_t* pos, int* code,
+                             const unsigned char** payload, int64_t* payload_size) {
+    while (*pos + 4 <= size) {
+        if (data[*pos] != 0xFF) return -1;
+        int c = data[*pos + 1];
+        if (c == 0xFF) {
+            (*pos)++;  // fill byte
+            continue;
+        }
+        if (c == 0x01 || (c >= 0xD0 && c <= 0xD8)) {
+            *pos += 2;  // markers without a segment
+            continue;
+        }
+        if (c == 0xD9 || c == 0xDA) return 0;
+
+        int64_t length = (data[*pos + 2] << 8 | data[*pos + 3]) - 2;
+        if (length < 0) return -1;
+        *code = c;
+        *payload = data + *pos + 4;
+        *payload_size = length < size - *pos - 4 ? length : size - *pos - 4;
+        *pos += 4 + length;
+        return 1;
+    }
+    return 0;
+}
+
+// Dimensions from the frame header
+static int jpeg_frame_size(const unsigned char* data, int64_t size, int* width, int* height) {
+    if (size < 4 || data[0] != 0xFF || data[1] != 0xD8) return -1;
+    int64_t pos = 2;
+    int code;
+    const unsigned char* payload;
+    int64_t payload_size;
+    while (jpeg_next_segment(data, size, &pos, &code, &payload, &payload_size) == 1) {
+        if (code >= 0xC0 && code <= 0xCF && code != 0xC4 && code != 0xC8 && code != 0xCC) {
+            if (payload_size < 5) return -1;
+            *height = payload[1] << 8 | payload[2];
+            *width = payload[3] << 8 | payload[4];
+            return *width > 0 && *height > 0 ? 0 : -1;
+        }
+    }
+    return -1;
+}
+
+// Orientation (IFD0) and thumbnail (IFD1) from the Exif segment. Only the
+// segments before the first scan are read, so the head of a file will do.
+static void jpeg_read_exif(const unsigned char* data, int64_t size, JpegExif* exif) {
+    memset(exif, 0, sizeof(*exif));
+    exif->orientation = 1;
+    if (size < 4 || data[0] != 0xFF || data[1] != 0xD8) return;
+
+    int64_t pos = 2;
+    int code;
+    const unsigned char* payload;
+    int64_t payload_size;
+    while (jpeg_next_segment(data, size, &pos, &code, &payload, &payload_size) == 1) {
+        if (code != 0xE1 || payload_size < 14 || memcmp(payload, "Exif\0\0", 6) != 0) continue;
+        const unsigned char* tiff = payload + 6;
+        uint64_t tiff_size = (uint64_t)payload_size - 6;
+        if (memcmp(tiff, "II", 2) != 0 && memcmp(tiff, "MM", 2) != 0) return;
+        int little = tiff[0] == 'I';
+
+        uint64_t ifd = exif_u32(tiff + 4, little);
+        for (int index = 0; index < 2 && ifd != 0 && ifd + 2 <= tiff_size; index++) {
+            uint32_t count = exif_u16(tiff + ifd, little);
+            uint64_t offset = 0, length = 0;
+            for (uint32_t i = 0; i < count && ifd + 2 + 12 * (uint64_t)(i + 1) <= tiff_size; i++) {
+                const unsigned char* entry = tiff + ifd + 2 + 12 * (uint64_t)i;
+                uint32_t tag = exif_u16(entry, little);
+                // SHORT values sit in the first half of the field, LONG ones fill it
+                uint32_t value = exif_u16(entry + 2, little) == 3 ? exif_u16(entry + 8, little)
+                                                                   : exif_u32(entry + 8, little);
+                if (index == 0 && tag == 0x0112 && value >= 1 && value <= 8) exif->orientation = (int)value;
+                if (index == 1 && tag == 0x0201) offset = value;
+                if (index == 1 && tag == 0x0202) length = value;
+            }
+            if (index == 1 && offset > 0 && length >= 4 && offset + length <= tiff_size &&
+                tiff[offset] == 0xFF && tiff[offset + 1] == 0xD8) {
+                exif->thumbnail = (int64_t)(tiff - data) + (int64_t)offset;
+                exif->thumbnail_size = (int64_t)length;
+            }
+            uint64_t next = ifd + 2 + 12 * (uint64_t)count;
+            ifd = next + 4 <= tiff_size ? exif_u32(tiff + next, little) : 0;
+        }
+        return;
+    }
+}
+
+// Turn pixels upright for an Exif orientation (2-8 mirror and/or rotate;
+// 5-8 swap the dimensions)
+static void image_orient(const unsigned char* pixels, int width, int height, int channels, int orientation,
+                         unsigned char* output) {
+    ptrdiff_t px = channels, row = (ptrdiff_t)width * channels;
+    ptrdiff_t last_x = (ptrdiff_t)(width - 1) * px, last_y = (ptrdiff_t)(height - 1) * row;
+    // Source of the first output pixel, then its steps along an output row
+    // and down an output column
+    ptrdiff_t first, step_x, step_y;
+    switch (orientation) {
+        case 2: first = last_x; step_x = -px; step_y = row; break;
+        case 3: first = last_y + last_x; step_x = -px; step_y = -row; break;
+        case 4: first = last_y; step_x = px; step_y = -row; break;
+        case 5: first = 0; step_x = row; step_y = px; break;
+        case 6: first = last_y; step_x = -row; step_y = px; break;
+        case 7: first = last_y + last_x; step_x = -row; step_y = -px; break;
+        case 8: first = last_x; step_x = row; step_y = -px; break;
+        default: first = 0; step_x = px; step_y = row; break;
+    }
+    int out_width = orientation >= 5 ? height : width;
+    int out_height = orientation >= 5 ? width : height;
+
+    unsigned char* dst = output;
+    for (int y = 0; y < out_height; y++) {
+        const unsigned char* src = pixels + first + y * step_y;
+        for (int x = 0; x < out_width; x++, src += step_x, dst += channels) memcpy(dst, src, (size_t)channels);
+    }
+}
+
+/**
+ * Make a small upright JPEG to show in place of a photo, as cheaply as the
+ * file allows. The Exif thumbnail is used when it is large enough, copied
+ * as is when the photo needs no turning. Otherwise the photo is decoded at
+ * the smallest DCT scale (1/8, 1/4 or 1/2) that still covers max_side, then
+ * boxed down to fit.
+ * @param input_data - JPEG data; the head of the file is enough when decode is 0
+ * @param input_size - Size of JPEG data
+ * @param max_side - Longest side wanted, in pixels
+ * @param decode - Nonzero to decode the photo when its thumbnail will not do
+ * @param output_data - Output buffer, or NULL to only measure the output
+ * @param output_size - Size of output buffer (0 when measuring)
+ * @return -1 on error or if the output does not fit, 0 when decode is 0 and
+ *         the thumbnail will not do, preview size on success
+ */
+EMSCRIPTEN_KEEPALIVE
+int64_t jpeg_preview(const unsigned char* input_data, int64_t input_size, int max_side, int decode,
+                     unsigned char* output_data, int64_t output_size) {
+    ZELL_STATS_CALL("jpeg_preview", input_size);
+    if (!input_data || input_size < 4 || max_side <= 0 || !zell_output_valid(output_data, output_size)) {
+        return -1;
+    }
+
+    JpegExif exif;
+    jpeg_read_exif(input_data, input_size, &exif);
+    int width = 0, height = 0, thumb_width, thumb_height;
+    int have_size = jpeg_frame_size(input_data, input_size, &width, &height) == 0;
+
+    // A letterboxed or too small thumbnail would show the wrong picture
+    const unsigned char* source = input_data;
+    int64_t source_size = input_size;
+    if (exif.thumbnail &&
+        jpeg_frame_size(input_data + exif.thumbnail, exif.thumbnail_size, &thumb_width, &thumb_height) == 0 &&
+        (thumb_width > thumb_height ? thumb_width : thumb_height) >= max_side &&
+        (!have_size || fabs((double)thumb_width * height - (double)thumb_height * width) <=
+                           JPEG_PREVIEW_ASPECT * (double)thumb_height * width)) {
+        source = input_data + exif.thumbnail;
+        source_size = exif.thumbnail_size;
+        width = thumb_width;
+        height = thumb_height;
+        if (exif.orientation == 1) {
+            if (output_data && source_size > output_size) return ZELL_STATS_RESULT(-1);
+            if (output_data) memcpy(output_data, source, (size_t)source_size);
+            return ZELL_STATS_RESULT(source_size);
+        }
+    } else if (!decode) {
+        return ZELL_STATS_RESULT(0);
+    } else if (!have_size) {
+        return ZELL_STATS_RESULT(-1);
+    }
+
+    int scale = 8, longest = width > height ? width : height;
+    while (scale > 1 && (longest + scale - 1) / scale < max_side) scale /= 2;
+
+    int channels;
+    unsigned char* decoded;
+    {
+        ZELL_STATS_STAGE(ZELL_STAGE_DECODE, "jpeg_decode");
+        decoded = jpeg_decode(source, source_size, scale, &width, &height, &channels);
+    }
+    const unsigned char* pixels = decoded;
+    unsigned char* scaled = NULL;
+    unsigned char* upright = NULL;
+    unsigned char* buffer = NULL;
+    unsigned long buffer_size = 0;
+    int64_t result = -1;
+    // CMYK would need a conversion the JPEG path does not make
+    if (!decoded || channels == 4) goto done;
+
+    if (width > max_side || height > max_side) {
+        int fit_width = width >= height ? max_side : (int)(((int64_t)width * max_side + height / 2) / height);
+        int fit_height = width >= height ? (int)(((int64_t)height * max_side + width / 2) / width) : max_side;
+        if (fit_width < 1) fit_width = 1;
+        if (fit_height < 1) fit_height = 1;
+        scaled = (unsigned char*)zell_pool_get((size_t)fit_width * fit_height * channels);
+        if (!scaled || resize_image(decoded, width, height, scaled, fit_width, fit_height, channels) < 0) goto done;
+        pixels = scaled;
+        width = fit_width;
+        height = fit_height;
+    }
+    if (exif.orientation != 1) {
+        upright = (unsigned char*)zell_pool_get((size_t)width * height * channels);
+        if (!upright) goto done;
+        image_orient(pixels, width, height, channels, exif.orientation, upright);
+        pixels = upright;
+        if (exif.orientation >= 5) {
+            int swap = width;
+            width = height;
+            height = swap;
+        }
+    }
+
+    {
+        ZELL_STATS_STAGE(ZELL_STAGE_ENCODE, "jpeg_encode");
+        if (jpeg_compress_buffer(pixels, width, height, channels, JPEG_PREVIEW_QUALITY, 0,
+                                 &buffer, &buffer_size) < 0) goto done;
+    }
+    if (!output_data) {
+        result = (int64_t)buffer_size;
+    } else if ((uint64_t)buffer_size <= (uint64_t)output_size) {
+        memcpy(output_data, buffer, buffer_size);
+        result = (int64_t)buffer_size;
+    }
+
+done:
+    free(buffer);
+    zell_pool_put(upright);
+    zell_pool_put(scaled);
+    free(decoded);
+    return ZELL_STATS_RESULT(result);
+}
@@ -0,0 +1,141 @@
+#ifndef IMAGE_PROCESSOR_H
+#define IMAGE_PROCESSOR_H
+
+// Image module entry points that other modules link against directly
+// (the PDF module re-encodes embedded images with them).
+
+#include <stdint.h>
+
+/**
+ * Encode interleaved 8-bit pixels as a baseline JPEG
+ * @param pixels - Gray (1), RGB (3) or RGBA (4, alpha dropped) pixels
+ * @param width - Image width
+ * @param height - Image height
+ * @param channels - Number of color channels
+ * @param quality - JPEG quality (1-100)
+ * @param output_data - Output buffer
+ * @param output_size - Size of output buffer
+ * @return -1 on error or if the output does not fit, JPEG size on success
+ */
+int64_t encode_jpeg(const unsigned char* pixels, int width, int height, int channels,
+                    int quality, unsigned char* output_data, int64_t output_size);
+
+/**
+ * Encode interleaved 8-bit pixels as the smallest baseline JPEG that looks
+ * at least as close to them as a target SSIM
+ * @param pixels - Gray (1), RGB (3) or RGBA (4, alpha dropped) pixels
+ * @param width - Image width
+ * @param height - Image height
+ * @param channels - Number of color channels
+ * @param target - SSIM to reach (0-1, e.g. 0.99; measured on downscaled luma)
+ * @param output_data - Output buffer, or NULL to only measure the output
+ * @param output_size - Size of output buffer (0 when measuring)
+ * @param quality - Receives the JPEG quality chosen (may be NULL)
+ * @return -1 on error or if the output does not fit, JPEG size on success
+ */
+int64_t encode_jpeg_target(const unsigned char* pixels, int width, int height, int channels,
+                           double target, unsigned char* output_data, int64_t output_size, int* quality);
+
+/**
+ * Decode a JPEG into interleaved 8-bit pixels
+ * @param input_data - JPEG data
+ * @param input_size - Size of JPEG data
+ * @param width - Receives the image width
+ * @param height - Receives the image height
+ * @param channels - Receives 1 (gray), 3 (RGB) or 4 (CMYK)
+ * @return Pixel buffer owned by the caller (free()), or NULL on error
+ */
+unsigned char* decode_jpeg(const unsigned char* input_data, int64_t input_size,
+                           int* width, int* height, int* channels);
+
+/**
+ * Decode a JPEG at a reduced size, scaling inside the inverse DCT (1/8 uses
+ * only DC terms, and stops a progressive file after its DC scans)
+ * @param input_data - JPEG data
+ * @param input_size - Size of JPEG data
+ * @param scale - Size divisor: 1, 2, 4 or 8 (dimensions round up)
+ * @param width - Receives the decoded width
+ * @param height - Receives the decoded height
+ * @param channels - Receives 1 (gray), 3 (RGB) or 4 (CMYK)
+ * @return Pixel buffer owned by the caller (free()), or NULL on error
+ */
+unsigned char* decode_jpeg_scaled(const unsigned char* input_data, int64_t input_size, int scale,
+                                  int* width, int* height, int* channels);
+
+/**
+ * Make a small upright JPEG to show in place of a photo: its Exif thumbnail
+ * when large enough, otherwise a DCT-scaled decode boxed down to fit
+ * @param input_data - JPEG data; the head of the file is enough when decode is 0
+ * @param input_size - Size of JPEG data
+ * @param max_side - Longest side wanted, in pixels
+ * @param decode - Nonzero to decode the photo when its thumbnail will not do
+ * @param output_data - Output buffer, or NULL to only measure the output
+ * @param output_size - Size of output buffer (0 when measuring)
+ * @return -1 on error or if the output does not fit, 0 when decode is 0 and
+ *         the thumbnail will not do, preview size on success
+ */
+int64_t jpeg_preview(const unsigned char* input_data, int64_t input_size, int max_side, int decode,
+                     unsigned char* output_data, int64_t output_size);
+
+/**
+ * Decode a PNG into interleaved 8-bit pixels (16-bit samples keep their
+ * high byte)
+ * @param input_data - PNG data
+ * @param input_size - Size of PNG data
+ * @param width - Receives the image width
+ * @param height - Receives the image height
+ * @param channels - Receives 1 (gray), 2 (gray + alpha), 3 (RGB) or 4 (RGBA)
+ * @return Pixel buffer owned by the caller (free()), or NULL on error
+ */
+unsigned char* decode_png(const unsigned char* input_data, int64_t input_size,
+                          int* width, int* height, int* channels);
+
+/**
+ * Encode interleaved 8-bit pixels as a PNG
+ * @param pixels - Gray (1), gray + alpha (2), RGB (3) or RGBA (4) pixels
+ * @param width - Image width
+ * @param height - Image height
+ * @param channels - Number of channels
+ * @param level - Deflate level (0-9, below 0 for the default)
+ * @param output_data - Output buffer, or NULL to only measure the output
+ * @param output_size - Size of output buffer (0 when measuring)
+ * @return -1 on error or if the output does not fit, PNG size on success
+ */
+int64_t encode_png(const unsigned char* pixels, int width, int height, int channels,
+                   int level, unsigned char* output_data, int64_t output_size);
+
+/**
+ * Reduce interleaved 8-bit pixels to a palette and one index per pixel
+ * @param pixels - Gray (1), gray + alpha (2), RGB (3) or RGBA (4) pixels
+ * @param width - Image width
+ * @param height - Image height
+ * @param channels - Number of channels
+ * @param colors - Palette entries at most (2-256)
+ * @param dither - 0 none, 1 Floyd-Steinberg, 2 ordered (8x8 Bayer)
+ * @param palette - Receives the entries, 4 bytes (RGBA) each; room for `colors`
+ * @param indices - Receives width x height indices
+ * @return -1 on error, number of palette entries on success
+ */
+int quantize_image(const unsigned char* pixels, int width, int height, int channels, int colors,
+                   int dither, unsigned char* palette, unsigned char* indices);
+
+/**
+ * Encode interleaved 8-bit pixels as a GIF89a, quantized to a palette
+ * @param pixels - Gray (1), gray + alpha (2), RGB (3) or RGBA (4) pixels
+ * @param width - Image width (up to 65535)
+ * @param height - Image height (up to 65535)
+ * @param channels - Number of channels
+ * @param colors - Palette entries at most (2-256)
+ * @param dither - 0 none, 1 Floyd-Steinberg, 2 ordered (8x8 Bayer)
+ * @param output_data - Output buffer, or NULL to only measure the output
+ * @param output_size - Size of output buffer (0 when measuring)
+ * @return -1 on error or if the output does not fit, GIF size on success
+ */
+int64_t encode_gif(const unsigned char* pixels, int width, int height, int channels, int colors, int dither,
+                   unsigned char* output_data, int64_t output_size);
+
+int resize_image(unsigned char* input_data, int input_width, int input_height,
+                 unsigned char* output_data, int output_width, int output_height,
+                 int channels);
+
+#endif // IMAGE_PROCESSOR_H
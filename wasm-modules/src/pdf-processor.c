@@ -1,7 +1,15 @@
-#include <emscripten.h>
+#include "zell-common.h"
+#include "zell-source.h"
+#include "zell-alloc.h"
+#include "zell-sink.h"
+#include "zell-hash.h"
+#include "zell-deflate.h"
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
 #include <math.h>
+#include "image-processor.h"
 
 // PDF processing functions for WebAssembly
 // Optimized for offline processing in ZELL
@@ -12,236 +20,5162 @@ typedef struct {
     unsigned char* data;
 } PDFData;
 
+// ---------------------------------------------------------------------------
+// PDF object model
+//
+// A document is opened by locating `startxref`, walking the chain of classic
+// xref tables and xref streams (newest first, so incremental updates win),
+// and recording a compact per-object index: a file offset, plus a packed
+// generation / object-stream slot and entry kind.  Nothing else is parsed up
+// front.  Objects are materialised on first access and cached, so the cost
+// of opening a document is proportional to its xref, and the memory used is
+// proportional to the objects actually touched.  Damaged files whose xref
+// cannot be followed are indexed by scanning for "n g obj" headers instead.
+// ---------------------------------------------------------------------------
+
+#define PDF_MAX_DEPTH 64
+
+typedef enum {
+    PDF_NULL = 0,
+    PDF_BOOL,
+    PDF_INT,
+    PDF_REAL,
+    PDF_STRING,
+    PDF_NAME,
+    PDF_ARRAY,
+    PDF_DICT,
+    PDF_REF,
+    PDF_STREAM
+} PdfType;
+
+typedef struct PdfObj PdfObj;
+
+struct PdfObj {
+    PdfType type;
+    union {
+        int boolean;
+        int64_t integer;
+        double real;
+        struct { unsigned char* data; int length; } string;
+        const char* name;
+        struct { PdfObj** items; int count; } array;
+        struct { const char** keys; PdfObj** values; int count; } dict;
+        struct { int num; int gen; } ref;
+        struct { PdfObj* dict; int64_t offset; int64_t length; } stream;
+    } u;
+};
+
+// Xref entry kinds (packed into the low two bits of PdfDoc.xref_aux)
+#define XREF_UNSET 0
+#define XREF_FREE 1
+#define XREF_INUSE 2
+#define XREF_COMPRESSED 3
+
+// Decoded object stream: the objects it holds are parsed from `data`
+typedef struct {
+    unsigned char* data;
+    size_t size;
+    int count;
+    int first;
+    int* numbers;
+    int* offsets;
+} PdfObjStm;
+
+typedef struct {
+    int num;               // object number of the page dictionary
+    PdfObj* dict;
+    PdfObj* resources;     // inherited attributes, unresolved (may be references)
+    PdfObj* media_box;
+    PdfObj* crop_box;
+    PdfObj* rotate;
+} PdfPage;
+
+typedef struct {
+    ZellSource source;
+    const unsigned char* data;  // source.data: the resident file, or NULL to read spans
+    int64_t size;
+
+    // Object index: offset is a file offset (in use) or the containing
+    // object stream number (compressed); aux packs gen or stream slot << 2 | kind
+    int xref_count;
+    int64_t* xref_offsets;
+    uint32_t* xref_aux;
+    PdfObj** cache;        // materialised objects, NULL until first touched
+    PdfObjStm** objstms;   // decoded object streams, allocated on first use
+    unsigned char* resolving;  // recursion guard while an object is being parsed
+
+    PdfObj* trailer;
+    int rebuilt;
+    int encrypted;
+
+    PdfPage* pages;
+    int page_count;        // -1 until the page tree has been walked
+
+    ZellArena arena;
+} PdfDoc;
+
+static PdfObj pdf_null_object = { PDF_NULL, { 0 } };
+
+static PdfObj* pdf_new_object(ZellArena* arena, PdfType type) {
+    PdfObj* obj = (PdfObj*)zell_arena_alloc(arena, sizeof(PdfObj));
+    if (obj) {
+        memset(obj, 0, sizeof(PdfObj));
+        obj->type = type;
+    }
+    return obj;
+}
+
+// --- Lexer -----------------------------------------------------------------
+
+typedef struct {
+    const unsigned char* data;
+    int64_t size;
+    int64_t pos;
+} PdfLexer;
+
+static inline int pdf_is_space(int c) {
+    return c == ' ' || c == '\n' || c == '\r' || c == '\t' || c == '\f' || c == 0;
+}
+
+static inline int pdf_is_delim(int c) {
+    return c == '(' || c == ')' || c == '<' || c == '>' || c == '[' || c == ']' ||
+           c == '{' || c == '}' || c == '/' || c == '%';
+}
+
+static inline int pdf_is_regular(int c) {
+    return !pdf_is_space(c) && !pdf_is_delim(c);
+}
+
+static inline int pdf_hex_value(int c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+static void pdf_skip_space(PdfLexer* lex) {
+    while (lex->pos < lex->size) {
+        int c = lex->data[lex->pos];
+        if (pdf_is_space(c)) {
+            lex->pos++;
+        } else if (c == '%') {
+            while (lex->pos < lex->size && lex->data[lex->pos] != '\n' && lex->data[lex->pos] != '\r') {
+                lex->pos++;
+            }
+        } else {
+            break;
+        }
+    }
+}
+
+// Match a keyword at the current position (must end at a delimiter)
+static int pdf_match_keyword(PdfLexer* lex, const char* keyword) {
+    size_t len = strlen(keyword);
+    if (lex->pos + (int64_t)len > lex->size) return 0;
+    if (memcmp(lex->data + lex->pos, keyword, len) != 0) return 0;
+    if (lex->pos + (int64_t)len < lex->size && pdf_is_regular(lex->data[lex->pos + len])) return 0;
+    lex->pos += len;
+    return 1;
+}
+
+// Parse an unsigned or signed integer token; returns 0 if none is present
+static int pdf_read_int(PdfLexer* lex, int64_t* value) {
+    int64_t pos = lex->pos;
+    int negative = 0;
+    if (pos < lex->size && (lex->data[pos] == '+' || lex->data[pos] == '-')) {
+        negative = lex->data[pos] == '-';
+        pos++;
+    }
+    if (pos >= lex->size || lex->data[pos] < '0' || lex->data[pos] > '9') return 0;
+
+    int64_t result = 0;
+    while (pos < lex->size && lex->data[pos] >= '0' && lex->data[pos] <= '9') {
+        if (result < ((int64_t)1 << 58)) result = result * 10 + (lex->data[pos] - '0');
+        pos++;
+    }
+    if (pos < lex->size && (lex->data[pos] == '.' || pdf_is_regular(lex->data[pos]))) return 0;
+
+    lex->pos = pos;
+    *value = negative ? -result : result;
+    return 1;
+}
+
+static PdfObj* pdf_parse_number(PdfLexer* lex, ZellArena* arena) {
+    int64_t start = lex->pos;
+    int negative = 0, seen_digit = 0, seen_dot = 0;
+    int64_t int_part = 0;
+    double frac = 0.0, scale = 0.1;
+
+    if (lex->data[lex->pos] == '+' || lex->data[lex->pos] == '-') {
+        negative = lex->data[lex->pos] == '-';
+        lex->pos++;
+    }
+    while (lex->pos < lex->size) {
+        int c = lex->data[lex->pos];
+        if (c >= '0' && c <= '9') {
+            seen_digit = 1;
+            if (seen_dot) {
+                frac += (c - '0') * scale;
+                scale *= 0.1;
+            } else if (int_part < ((int64_t)1 << 58)) {
+                int_part = int_part * 10 + (c - '0');
+            }
+        } else if (c == '.' && !seen_dot) {
+            seen_dot = 1;
+        } else if (c == '-' && lex->pos > start) {
+            // Malformed "0.00-5" style numbers: ignore the stray sign
+        } else {
+            break;
+        }
+        lex->pos++;
+    }
+    if (!seen_digit && !seen_dot) return NULL;
+
+    PdfObj* obj;
+    if (seen_dot) {
+        obj = pdf_new_object(arena, PDF_REAL);
+        if (obj) obj->u.real = negative ? -(int_part + frac) : (int_part + frac);
+    } else {
+        obj = pdf_new_object(arena, PDF_INT);
+        if (obj) obj->u.integer = negative ? -int_part : int_part;
+    }
+    return obj;
+}
+
+static PdfObj* pdf_parse_name(PdfLexer* lex, ZellArena* arena) {
+    lex->pos++; // '/'
+    int64_t start = lex->pos;
+    while (lex->pos < lex->size && pdf_is_regular(lex->data[lex->pos])) lex->pos++;
+
+    int64_t raw_len = lex->pos - start;
+    char* name = (char*)zell_arena_alloc(arena, (size_t)raw_len + 1);
+    PdfObj* obj = pdf_new_object(arena, PDF_NAME);
+    if (!name || !obj) return NULL;
+
+    int len = 0;
+    for (int64_t i = start; i < lex->pos; i++) {
+        int c = lex->data[i];
+        if (c == '#' && i + 2 < lex->pos) {
+            int hi = pdf_hex_value(lex->data[i + 1]);
+            int lo = pdf_hex_value(lex->data[i + 2]);
+            if (hi >= 0 && lo >= 0) {
+                name[len++] = (char)(hi * 16 + lo);
+                i += 2;
+                continue;
+            }
+        }
+        name[len++] = (char)c;
+    }
+    name[len] = '\0';
+    obj->u.name = name;
+    return obj;
+}
+
+static PdfObj* pdf_parse_literal_string(PdfLexer* lex, ZellArena* arena) {
+    lex->pos++; // '('
+    int64_t start = lex->pos;
+    int depth = 1;
+
+    // First pass finds the end so the decoded string can be sized exactly
+    int64_t end = start;
+    while (end < lex->size) {
+        int c = lex->data[end];
+        if (c == '\\') {
+            end += 2;
+            continue;
+        }
+        if (c == '(') depth++;
+        if (c == ')' && --depth == 0) break;
+        end++;
+    }
+    if (end > lex->size) end = lex->size;
+
+    unsigned char* out = (unsigned char*)zell_arena_alloc(arena, (size_t)(end - start) + 1);
+    PdfObj* obj = pdf_new_object(arena, PDF_STRING);
+    if (!out || !obj) return NULL;
+
+    int len = 0;
+    for (int64_t i = start; i < end; i++) {
+        int c = lex->data[i];
+        if (c != '\\') {
+            if (c == '\r') {
+                // EOL in a literal string always reads as \n
+                if (i + 1 < end && lex->data[i + 1] == '\n') i++;
+                c = '\n';
+            }
+            out[len++] = (unsigned char)c;
+            continue;
+        }
+        if (++i >= end) break;
+        c = lex->data[i];
+        switch (c) {
+            case 'n': out[len++] = '\n'; break;
+            case 'r': out[len++] = '\r'; break;
+            case 't': out[len++] = '\t'; break;
+            case 'b': out[len++] = '\b'; break;
+            case 'f': out[len++] = '\f'; break;
+            case '\r':
+                if (i + 1 < end && lex->data[i + 1] == '\n') i++;
+                break; // line continuation
+            case '\n':
+                break;
+            default:
+                if (c >= '0' && c <= '7') {
+                    int value = c - '0';
+                    for (int k = 0; k < 2 && i + 1 < end && lex->data[i + 1] >= '0' && lex->data[i + 1] <= '7'; k++) {
+                        value = value * 8 + (lex->data[++i] - '0');
+                    }
+                    out[len++] = (unsigned char)value;
+                } else {
+                    out[len++] = (unsigned char)c;
+                }
+        }
+    }
+
+    lex->pos = end < lex->size ? end + 1 : end;
+    out[len] = 0;
+    obj->u.string.data = out;
+    obj->u.string.length = len;
+    return obj;
+}
+
+static PdfObj* pdf_parse_hex_string(PdfLexer* lex, ZellArena* arena) {
+    lex->pos++; // '<'
+    int64_t start = lex->pos;
+    while (lex->pos < lex->size && lex->data[lex->pos] != '>') lex->pos++;
+    int64_t end = lex->pos;
+    if (lex->pos < lex->size) lex->pos++;
+
+    unsigned char* out = (unsigned char*)zell_arena_alloc(arena, (size_t)(end - start) / 2 + 2);
+    PdfObj* obj = pdf_new_object(arena, PDF_STRING);
+    if (!out || !obj) return NULL;
+
+    int len = 0, high = -1;
+    for (int64_t i = start; i < end; i++) {
+        int v = pdf_hex_value(lex->data[i]);
+        if (v < 0) continue;
+        if (high < 0) {
+            high = v;
+        } else {
+            out[len++] = (unsigned char)(high * 16 + v);
+            high = -1;
+        }
+    }
+    if (high >= 0) out[len++] = (unsigned char)(high * 16); // odd digit count pads with 0
+    out[len] = 0;
+    obj->u.string.data = out;
+    obj->u.string.length = len;
+    return obj;
+}
+
+static PdfObj* pdf_parse_object(PdfLexer* lex, ZellArena* arena, int depth);
+
+// Collect items until `terminator`; dictionaries alternate key / value
+static PdfObj* pdf_parse_container(PdfLexer* lex, ZellArena* arena, int depth, int is_dict) {
+    PdfObj* local[32];
+    PdfObj** items = local;
+    int count = 0, capacity = 32;
+    PdfObj* result = NULL;
+
+    for (;;) {
+        pdf_skip_space(lex);
+        if (lex->pos >= lex->size) break;
+
+        if (is_dict && lex->pos + 1 < lex->size &&
+            lex->data[lex->pos] == '>' && lex->data[lex->pos + 1] == '>') {
+            lex->pos += 2;
+            break;
+        }
+        if (!is_dict && lex->data[lex->pos] == ']') {
+            lex->pos++;
+            break;
+        }
+        if (is_dict && (count % 2) == 0 && lex->data[lex->pos] != '/') {
+            // Junk where a key should be: stop at the closing >> if it exists
+            int64_t close = lex->pos;
+            while (close + 1 < lex->size && !(lex->data[close] == '>' && lex->data[close + 1] == '>')) close++;
+            lex->pos = close + 2;
+            break;
+        }
+
+        PdfObj* item = pdf_parse_object(lex, arena, depth + 1);
+        if (!item) {
+            if (lex->pos < lex->size && pdf_is_regular(lex->data[lex->pos])) {
+                // Unknown keyword: skip it and carry on, as viewers do
+                while (lex->pos < lex->size && pdf_is_regular(lex->data[lex->pos])) lex->pos++;
+                if (is_dict && (count % 2) == 1) item = &pdf_null_object;
+                else continue;
+            } else {
+                break;
+            }
+        }
+
+        if (count == capacity) {
+            int new_capacity = capacity * 2;
+            PdfObj** grown = (PdfObj**)zell_pool_get(sizeof(PdfObj*) * new_capacity);
+            if (!grown) goto done;
+            memcpy(grown, items, sizeof(PdfObj*) * count);
+            if (items != local) zell_pool_put(items);
+            items = grown;
+            capacity = new_capacity;
+        }
+        items[count++] = item;
+    }
+
+    if (is_dict) {
+        int pairs = count / 2;
+        result = pdf_new_object(arena, PDF_DICT);
+        if (!result) goto done;
+        result->u.dict.keys = (const char**)zell_arena_alloc(arena, sizeof(char*) * (pairs ? pairs : 1));
+        result->u.dict.values = (PdfObj**)zell_arena_alloc(arena, sizeof(PdfObj*) * (pairs ? pairs : 1));
+        if (!result->u.dict.keys || !result->u.dict.values) {
+            result = NULL;
+            goto done;
+        }
+        for (int i = 0; i < pairs; i++) {
+            result->u.dict.keys[i] = items[i * 2]->u.name;
+            result->u.dict.values[i] = items[i * 2 + 1];
+        }
+        result->u.dict.count = pairs;
+    } else {
+        result = pdf_new_object(arena, PDF_ARRAY);
+        if (!result) goto done;
+        result->u.array.items = (PdfObj**)zell_arena_alloc(arena, sizeof(PdfObj*) * (count ? count : 1));
+        if (!result->u.array.items) {
+            result = NULL;
+            goto done;
+        }
+        memcpy(result->u.array.items, items, sizeof(PdfObj*) * count);
+        result->u.array.count = count;
+    }
+
+done:
+    if (items != local) zell_pool_put(items);
+    return result;
+}
+
+// Parse one direct object (or an "n g R" reference) at the lexer position
+static PdfObj* pdf_parse_object(PdfLexer* lex, ZellArena* arena, int depth) {
+    pdf_skip_space(lex);
+    if (lex->pos >= lex->size || depth > PDF_MAX_DEPTH) return NULL;
+
+    int c = lex->data[lex->pos];
+
+    if (c == '/') return pdf_parse_name(lex, arena);
+    if (c == '(') return pdf_parse_literal_string(lex, arena);
+    if (c == '[') {
+        lex->pos++;
+        return pdf_parse_container(lex, arena, depth, 0);
+    }
+    if (c == '<') {
+        if (lex->pos + 1 < lex->size && lex->data[lex->pos + 1] == '<') {
+            lex->pos += 2;
+            return pdf_parse_container(lex, arena, depth, 1);
+        }
+        return pdf_parse_hex_string(lex, arena);
+    }
+
+    if ((c >= '0' && c <= '9') || c == '+' || c == '-' || c == '.') {
+        // "num gen R" needs two tokens of lookahead
+        int64_t save = lex->pos;
+        int64_t num, gen;
+        if (pdf_read_int(lex, &num)) {
+            int64_t after_num = lex->pos;
+            pdf_skip_space(lex);
+            if (pdf_read_int(lex, &gen)) {
+                pdf_skip_space(lex);
+                if (lex->pos < lex->size && lex->data[lex->pos] == 'R' &&
+                    (lex->pos + 1 >= lex->size || !pdf_is_regular(lex->data[lex->pos + 1]))) {
+                    lex->pos++;
+                    PdfObj* ref = pdf_new_object(arena, PDF_REF);
+                    if (ref) {
+                        ref->u.ref.num = (int)num;
+                        ref->u.ref.gen = (int)gen;
+                    }
+                    return ref;
+                }
+            }
+            lex->pos = after_num;
+            PdfObj* obj = pdf_new_object(arena, PDF_INT);
+            if (obj) obj->u.integer = num;
+            return obj;
+        }
+        lex->pos = save;
+        return pdf_parse_number(lex, arena);
+    }
+
+    int is_true = pdf_match_keyword(lex, "true");
+    if (is_true || pdf_match_keyword(lex, "false")) {
+        PdfObj* obj = pdf_new_object(arena, PDF_BOOL);
+        if (obj) obj->u.boolean = is_true;
+        return obj;
+    }
+    if (pdf_match_keyword(lex, "null")) {
+        return &pdf_null_object;
+    }
+    return NULL;
+}
+
+// --- Input spans -----------------------------------------------------------
+//
+// The parser reads the file through spans.  A resident source (a buffer or a
+// mapped file) hands out the whole file, so span offsets are file offsets and
+// nothing is copied; a callback source reads just the requested range into a
+// buffer the span owns.  Parsers that cannot know how much they will read
+// start from a small window and retry with a larger one if they ran off it.
+
+#define PDF_SPAN_WINDOW (64 * 1024)
+#define PDF_SCAN_CHUNK (1024 * 1024)
+
+typedef struct {
+    const unsigned char* data;
+    int64_t offset;        // file offset of data[0]
+    int64_t size;
+    unsigned char* buffer; // owned copy, for callback sources
+} PdfSpan;
+
+static int pdf_span_read(PdfDoc* doc, int64_t offset, int64_t length, PdfSpan* span) {
+    memset(span, 0, sizeof(*span));
+    if (doc->data) {
+        span->data = doc->data;
+        span->size = doc->size;
+        return 0;
+    }
+    if (offset < 0 || offset > doc->size || length < 0) return -1;
+    if (length > doc->size - offset) length = doc->size - offset;
+
+    // Parsing reads many windows of the same few sizes: recycle them
+    span->buffer = (unsigned char*)zell_pool_get((size_t)length);
+    if (!span->buffer) return -1;
+    int64_t got = zell_source_read(&doc->source, offset, span->buffer, length);
+    if (got < 0) {
+        zell_pool_put(span->buffer);
+        span->buffer = NULL;
+        return -1;
+    }
+    span->data = span->buffer;
+    span->offset = offset;
+    span->size = got;
+    return 0;
+}
+
+static void pdf_span_release(PdfSpan* span) {
+    zell_pool_put(span->buffer);
+    span->buffer = NULL;
+}
+
+// A lexer over a span, positioned at a file offset
+static PdfLexer pdf_span_lexer(const PdfSpan* span, int64_t offset) {
+    PdfLexer lex = { span->data, span->size, offset - span->offset };
+    return lex;
+}
+
+// Parsing came within `margin` bytes of the end of a span that stops short
+// of the end of the file, so its result may be cut off
+static int pdf_span_short(PdfDoc* doc, const PdfSpan* span, const PdfLexer* lex, int64_t margin) {
+    return span->offset + span->size < doc->size && lex->pos + margin >= span->size;
+}
+
+// Parse a direct object at a file offset
+static PdfObj* pdf_parse_object_at(PdfDoc* doc, int64_t offset) {
+    for (int64_t window = PDF_SPAN_WINDOW; ; window *= 4) {
+        PdfSpan span;
+        if (pdf_span_read(doc, offset, window, &span) != 0) return NULL;
+        PdfLexer lex = pdf_span_lexer(&span, offset);
+        PdfObj* obj = pdf_parse_object(&lex, &doc->arena, 0);
+        int cut = pdf_span_short(doc, &span, &lex, 1);
+        pdf_span_release(&span);
+        if (!cut) return obj;
+    }
+}
+
+// Whether `keyword` follows (after whitespace) at a file offset
+static int pdf_keyword_at(PdfDoc* doc, int64_t offset, const char* keyword) {
+    PdfSpan span;
+    if (pdf_span_read(doc, offset, 256, &span) != 0) return 0;
+    PdfLexer lex = pdf_span_lexer(&span, offset);
+    pdf_skip_space(&lex);
+    int found = pdf_match_keyword(&lex, keyword);
+    pdf_span_release(&span);
+    return found;
+}
+
+// --- Object access helpers -------------------------------------------------
+
+static PdfObj* pdf_get_object(PdfDoc* doc, int num);
+
+static PdfObj* pdf_resolve(PdfDoc* doc, PdfObj* obj) {
+    for (int hops = 0; obj && obj->type == PDF_REF && hops < 16; hops++) {
+        obj = pdf_get_object(doc, obj->u.ref.num);
+    }
+    if (obj && obj->type == PDF_REF) return NULL;
+    return obj;
+}
+
+// Look up a key in a dictionary (or a stream's dictionary) without resolving
+static PdfObj* pdf_dict_get_raw(PdfObj* dict, const char* key) {
+    if (!dict) return NULL;
+    if (dict->type == PDF_STREAM) dict = dict->u.stream.dict;
+    if (!dict || dict->type != PDF_DICT) return NULL;
+    for (int i = 0; i < dict->u.dict.count; i++) {
+        if (strcmp(dict->u.dict.keys[i], key) == 0) return dict->u.dict.values[i];
+    }
+    return NULL;
+}
+
+static PdfObj* pdf_dict_get(PdfDoc* doc, PdfObj* dict, const char* key) {
+    return pdf_resolve(doc, pdf_dict_get_raw(dict, key));
+}
+
+static int pdf_is_name(PdfObj* obj, const char* name) {
+    return obj && obj->type == PDF_NAME && strcmp(obj->u.name, name) == 0;
+}
+
+static int64_t pdf_to_int(PdfObj* obj, int64_t fallback) {
+    if (!obj) return fallback;
+    if (obj->type == PDF_INT) return obj->u.integer;
+    if (obj->type == PDF_REAL) return (int64_t)obj->u.real;
+    return fallback;
+}
+
+// --- Stream decoding -------------------------------------------------------
+
+// Decoded and re-encoded stream data lives in pool buffers (zell_pool_put
+// releases them): every page and font decodes a few, so they recur per job.
+static unsigned char* pdf_pool_grow(unsigned char* buffer, size_t used, size_t capacity) {
+    unsigned char* grown = (unsigned char*)zell_pool_get(capacity);
+    if (!grown) return NULL;
+    memcpy(grown, buffer, used);
+    zell_pool_put(buffer);
+    return grown;
+}
+
+// Output room for pdf_inflate, which keeps all of it: double the buffer
+static int pdf_inflate_grow(void* ctx, ZellInflate* z) {
+    (void)ctx;
+    unsigned char* grown = pdf_pool_grow(z->out, z->out_pos, z->out_capacity * 2);
+    if (!grown) return -1;
+    z->out = grown;
+    z->out_capacity *= 2;
+    return 0;
+}
+
+// Inflate a zlib (or, failing that, raw deflate) buffer into a pool buffer;
+// `complete` (optional) tells whether the stream ended cleanly
+static unsigned char* pdf_inflate(const unsigned char* data, size_t size, size_t* out_size, int* complete) {
+    for (int attempt = 0; attempt < 2; attempt++) {
+        ZellInflate z;
+        memset(&z, 0, sizeof(z));
+        z.next_in = data;
+        z.avail_in = size;
+        z.out_capacity = size * 4 + 1024;
+        z.out = (unsigned char*)zell_pool_get(z.out_capacity);
+        if (!z.out) return NULL;
+        z.room = pdf_inflate_grow;
+        int rc = zell_inflate(&z, attempt == 0 ? ZELL_DEFLATE_ZLIB : ZELL_DEFLATE_RAW);
+
+        // Broken streams are common; whatever inflated cleanly is still useful
+        if (z.out_pos > 0 || rc == ZELL_INFLATE_DONE) {
+            *out_size = z.out_pos;
+            if (complete) *complete = rc == ZELL_INFLATE_DONE;
+            return z.out;
+        }
+        zell_pool_put(z.out);
+    }
+    return NULL;
+}
+
+static unsigned char* pdf_decode_ascii_hex(const unsigned char* data, size_t size, size_t* out_size) {
+    unsigned char* out = (unsigned char*)zell_pool_get(size / 2 + 1);
+    if (!out) return NULL;
+    size_t len = 0;
+    int high = -1;
+    for (size_t i = 0; i < size && data[i] != '>'; i++) {
+        int v = pdf_hex_value(data[i]);
+        if (v < 0) continue;
+        if (high < 0) {
+            high = v;
+        } else {
+            out[len++] = (unsigned char)(high * 16 + v);
+            high = -1;
+        }
+    }
+    if (high >= 0) out[len++] = (unsigned char)(high * 16);
+    *out_size = len;
+    return out;
+}
+
+static unsigned char* pdf_decode_ascii85(const unsigned char* data, size_t size, size_t* out_size) {
+    unsigned char* out = (unsigned char*)zell_pool_get(size + 4);
+    if (!out) return NULL;
+    size_t len = 0;
+    uint32_t tuple = 0;
+    int count = 0;
+
+    size_t i = 0;
+    if (size >= 2 && data[0] == '<' && data[1] == '~') i = 2;
+    for (; i < size; i++) {
+        int c = data[i];
+        if (c == '~') break;
+        if (pdf_is_space(c)) continue;
+        if (c == 'z' && count == 0) {
+            memset(out + len, 0, 4);
+            len += 4;
+            continue;
+        }
+        if (c < '!' || c > 'u') continue;
+        tuple = tuple * 85 + (uint32_t)(c - '!');
+        if (++count == 5) {
+            out[len++] = (unsigned char)(tuple >> 24);
+            out[len++] = (unsigned char)(tuple >> 16);
+            out[len++] = (unsigned char)(tuple >> 8);
+            out[len++] = (unsigned char)tuple;
+            tuple = 0;
+            count = 0;
+        }
+    }
+    if (count > 1) {
+        for (int k = count; k < 5; k++) tuple = tuple * 85 + 84;
+        for (int k = 0; k < count - 1; k++) out[len++] = (unsigned char)(tuple >> (24 - 8 * k));
+    }
+    *out_size = len;
+    return out;
+}
+
+// Undo the PNG filters of `rows` rows of `row_bytes` bytes, each preceded by
+// its filter-type byte, packing the rows over those bytes in place
+static int pdf_png_unfilter(unsigned char* data, size_t rows, size_t row_bytes, size_t bpp) {
+    unsigned char* prev = (unsigned char*)zell_pool_get(row_bytes);
+    if (!prev) return -1;
+    memset(prev, 0, row_bytes);
+
+    for (size_t r = 0; r < rows; r++) {
+        unsigned char* src = data + r * (row_bytes + 1);
+        unsigned char* row = src + 1;
+        int filter = src[0];
+        for (size_t i = 0; i < row_bytes; i++) {
+            int left = i >= bpp ? row[i - bpp] : 0;
+            int up = prev[i];
+            int up_left = i >= bpp ? prev[i - bpp] : 0;
+            int value = row[i];
+            switch (filter) {
+                case 1: value += left; break;
+                case 2: value += up; break;
+                case 3: value += (left + up) / 2; break;
+                case 4: {
+                    int p = left + up - up_left;
+                    int pa = abs(p - left), pb = abs(p - up), pc = abs(p - up_left);
+                    value += (pa <= pb && pa <= pc) ? left : (pb <= pc ? up : up_left);
+                    break;
+                }
+                default: break;
+            }
+            row[i] = (unsigned char)value;
+        }
+        // Compact the row over the filter byte as we go
+        memmove(data + r * row_bytes, row, row_bytes);
+        memcpy(prev, data + r * row_bytes, row_bytes);
+    }
+    zell_pool_put(prev);
+    return 0;
+}
+
+// Undo PNG (10-15) or TIFF (2) predictors in place; returns the new length
+static size_t pdf_apply_predictor(unsigned char* data, size_t size, PdfDoc* doc, PdfObj* parms) {
+    int predictor = (int)pdf_to_int(pdf_dict_get(doc, parms, "Predictor"), 1);
+    if (predictor < 2) return size;
+
+    int colors = (int)pdf_to_int(pdf_dict_get(doc, parms, "Colors"), 1);
+    int bpc = (int)pdf_to_int(pdf_dict_get(doc, parms, "BitsPerComponent"), 8);
+    int columns = (int)pdf_to_int(pdf_dict_get(doc, parms, "Columns"), 1);
+    if (colors < 1 || colors > 32 || bpc < 1 || bpc > 16 || columns < 1) return size;
+
+    size_t bpp = (size_t)(colors * bpc + 7) / 8;
+    size_t row_bytes = ((size_t)colors * bpc * columns + 7) / 8;
+
+    if (predictor == 2) {
+        if (bpc != 8) return size;
+        for (size_t row = 0; row + row_bytes <= size; row += row_bytes) {
+            for (size_t i = bpp; i < row_bytes; i++) data[row + i] += data[row + i - bpp];
+        }
+        return size;
+    }
+
+    // PNG predictors: every row carries its own filter-type byte
+    size_t rows = size / (row_bytes + 1);
+    return pdf_png_unfilter(data, rows, row_bytes, bpp) == 0 ? rows * row_bytes : size;
+}
+
+// Encoded bytes of a stream; they stay valid until the span is released
+static const unsigned char* pdf_stream_raw(PdfDoc* doc, PdfObj* stream, size_t* size, PdfSpan* span) {
+    memset(span, 0, sizeof(*span));
+    if (!stream || stream->type != PDF_STREAM) return NULL;
+    int64_t offset = stream->u.stream.offset;
+    int64_t length = stream->u.stream.length;
+    if (pdf_span_read(doc, offset, length, span) != 0) return NULL;
+    if (offset - span->offset + length > span->size) {
+        pdf_span_release(span);
+        return NULL;
+    }
+    *size = (size_t)length;
+    return span->data + (offset - span->offset);
+}
+
+/**
+ * Decode a stream through its filter chain
+ * @return Decoded bytes in a pool buffer (zell_pool_put), or NULL for
+ *         unsupported filters (e.g. DCT)
+ */
+static unsigned char* pdf_decode_stream(PdfDoc* doc, PdfObj* stream, size_t* out_size) {
+    ZELL_STATS_STAGE(ZELL_STAGE_DECODE, "pdf_decode_stream");
+    PdfSpan span;
+    size_t raw_size = 0;
+    const unsigned char* raw = pdf_stream_raw(doc, stream, &raw_size, &span);
+    if (!raw) return NULL;
+
+    PdfObj* filter = pdf_dict_get(doc, stream, "Filter");
+    PdfObj* parms = pdf_dict_get(doc, stream, "DecodeParms");
+    int filter_count = !filter ? 0 : (filter->type == PDF_ARRAY ? filter->u.array.count : 1);
+
+    // Filters read the raw bytes in place; only their results are owned
+    const unsigned char* current = raw;
+    unsigned char* owned = NULL;
+    size_t current_size = raw_size;
+
+    for (int i = 0; i < filter_count; i++) {
+        PdfObj* name = filter->type == PDF_ARRAY ? pdf_resolve(doc, filter->u.array.items[i]) : filter;
+        PdfObj* parm = parms && parms->type == PDF_ARRAY ? pdf_resolve(doc, parms->u.array.items[i]) : parms;
+        if (!name || name->type != PDF_NAME) break;
+
+        unsigned char* next = NULL;
+        size_t next_size = 0;
+        const char* n = name->u.name;
+
+        if (!strcmp(n, "FlateDecode") || !strcmp(n, "Fl")) {
+            next = pdf_inflate(current, current_size, &next_size, NULL);
+            if (next && parm && parm->type == PDF_DICT) {
+                next_size = pdf_apply_predictor(next, next_size, doc, parm);
+            }
+        } else if (!strcmp(n, "ASCIIHexDecode") || !strcmp(n, "AHx")) {
+            next = pdf_decode_ascii_hex(current, current_size, &next_size);
+        } else if (!strcmp(n, "ASCII85Decode") || !strcmp(n, "A85")) {
+            next = pdf_decode_ascii85(current, current_size, &next_size);
+        }
+
+        zell_pool_put(owned);
+        if (!next) {
+            pdf_span_release(&span);
+            return NULL;
+        }
+        current = owned = next;
+        current_size = next_size;
+    }
+
+    if (!owned) {
+        owned = (unsigned char*)zell_pool_get(current_size);
+        if (owned) memcpy(owned, current, current_size);
+    }
+    pdf_span_release(&span);
+    if (!owned) return NULL;
+    *out_size = current_size;
+    return owned;
+}
+
+// --- Indirect objects ------------------------------------------------------
+
+static int64_t pdf_find(const unsigned char* data, int64_t size, int64_t from, const char* needle) {
+    size_t len = strlen(needle);
+    for (int64_t i = from; i + (int64_t)len <= size; i++) {
+        const unsigned char* hit = (const unsigned char*)memchr(data + i, needle[0], (size_t)(size - i));
+        if (!hit) return -1;
+        i = hit - data;
+        if (i + (int64_t)len <= size && memcmp(hit, needle, len) == 0) return i;
+    }
+    return -1;
+}
+
+// Find `needle` in the file at or after `from`, reading it chunk by chunk
+static int64_t pdf_find_in_file(PdfDoc* doc, int64_t from, const char* needle) {
+    if (doc->data) return pdf_find(doc->data, doc->size, from, needle);
+
+    int64_t overlap = (int64_t)strlen(needle) - 1;
+    for (int64_t start = from; start < doc->size; start += PDF_SCAN_CHUNK - overlap) {
+        PdfSpan span;
+        if (pdf_span_read(doc, start, PDF_SCAN_CHUNK, &span) != 0) return -1;
+        int64_t hit = pdf_find(span.data, span.size, 0, needle);
+        pdf_span_release(&span);
+        if (hit >= 0) return start + hit;
+    }
+    return -1;
+}
+
+// Parse "num gen obj ... endobj" at offset; returns NULL if it is not there
+static PdfObj* pdf_parse_indirect(PdfDoc* doc, int64_t offset, int* out_num) {
+    if (offset < 0 || offset >= doc->size) return NULL;
+
+    PdfSpan span;
+    PdfLexer lex;
+    PdfObj* obj;
+    int64_t num = 0, gen;
+    for (int64_t window = PDF_SPAN_WINDOW; ; window *= 4) {
+        if (pdf_span_read(doc, offset, window, &span) != 0) return NULL;
+        lex = pdf_span_lexer(&span, offset);
+        obj = NULL;
+        pdf_skip_space(&lex);
+        if (pdf_read_int(&lex, &num)) {
+            pdf_skip_space(&lex);
+            if (pdf_read_int(&lex, &gen)) {
+                pdf_skip_space(&lex);
+                if (pdf_match_keyword(&lex, "obj")) {
+                    obj = pdf_parse_object(&lex, &doc->arena, 0);
+                    if (!obj) obj = &pdf_null_object;
+                    pdf_skip_space(&lex);
+                }
+            }
+        }
+        // Room for "stream" and its EOL must be left too
+        if (!pdf_span_short(doc, &span, &lex, 16)) break;
+        pdf_span_release(&span);
+    }
+
+    if (!obj) {
+        pdf_span_release(&span);
+        return NULL;
+    }
+    if (out_num) *out_num = (int)num;
+    if (obj->type != PDF_DICT || !pdf_match_keyword(&lex, "stream")) {
+        pdf_span_release(&span);
+        return obj;
+    }
+
+    // Stream data starts after the EOL that follows the keyword
+    if (lex.pos < lex.size && lex.data[lex.pos] == '\r') lex.pos++;
+    if (lex.pos < lex.size && lex.data[lex.pos] == '\n') lex.pos++;
+    int64_t data_start = span.offset + lex.pos;
+    pdf_span_release(&span);
+
+    int64_t length = -1;
+    PdfObj* length_obj = pdf_dict_get_raw(obj, "Length");
+    if (length_obj && length_obj->type == PDF_INT) {
+        length = length_obj->u.integer;
+    } else if (length_obj && length_obj->type == PDF_REF && length_obj->u.ref.num != num) {
+        length = pdf_to_int(pdf_resolve(doc, length_obj), -1);
+    }
+
+    // Trust /Length only if "endstream" follows it
+    int valid = length >= 0 && data_start + length <= doc->size &&
+                pdf_keyword_at(doc, data_start + length, "endstream");
+    if (!valid) {
+        int64_t end = pdf_find_in_file(doc, data_start, "endstream");
+        if (end < 0) end = doc->size;
+        length = end - data_start;
+
+        unsigned char eol[2];
+        if (length >= 2 && zell_source_read(&doc->source, end - 2, eol, 2) == 2) {
+            int trim = eol[1] == '\n';
+            if (eol[1 - trim] == '\r') trim++;
+            length -= trim;
+        }
+    }
+
+    PdfObj* stream = pdf_new_object(&doc->arena, PDF_STREAM);
+    if (!stream) return NULL;
+    stream->u.stream.dict = obj;
+    stream->u.stream.offset = data_start;
+    stream->u.stream.length = length;
+    return stream;
+}
+
+static PdfObjStm* pdf_load_objstm(PdfDoc* doc, int num) {
+    if (num <= 0 || num >= doc->xref_count) return NULL;
+    if (!doc->objstms) {
+        doc->objstms = (PdfObjStm**)calloc((size_t)doc->xref_count, sizeof(PdfObjStm*));
+        if (!doc->objstms) return NULL;
+    }
+    if (doc->objstms[num]) return doc->objstms[num];
+
+    PdfObj* stream = pdf_get_object(doc, num);
+    if (!stream || stream->type != PDF_STREAM) return NULL;
+
+    int count = (int)pdf_to_int(pdf_dict_get(doc, stream, "N"), 0);
+    int first = (int)pdf_to_int(pdf_dict_get(doc, stream, "First"), 0);
+    if (count <= 0 || first < 0) return NULL;
+
+    size_t size;
+    unsigned char* data = pdf_decode_stream(doc, stream, &size);
+    if (!data) return NULL;
+
+    PdfObjStm* objstm = (PdfObjStm*)zell_arena_alloc(&doc->arena, sizeof(PdfObjStm));
+    int* numbers = (int*)zell_arena_alloc(&doc->arena, sizeof(int) * count);
+    int* offsets = (int*)zell_arena_alloc(&doc->arena, sizeof(int) * count);
+    if (!objstm || !numbers || !offsets) {
+        zell_pool_put(data);
+        return NULL;
+    }
+
+    PdfLexer lex = { data, (int64_t)size, 0 };
+    int parsed = 0;
+    for (; parsed < count; parsed++) {
+        int64_t obj_num, obj_offset;
+        pdf_skip_space(&lex);
+        if (!pdf_read_int(&lex, &obj_num)) break;
+        pdf_skip_space(&lex);
+        if (!pdf_read_int(&lex, &obj_offset)) break;
+        numbers[parsed] = (int)obj_num;
+        offsets[parsed] = (int)obj_offset;
+    }
+
+    objstm->data = data;
+    objstm->size = size;
+    objstm->count = parsed;
+    objstm->first = first;
+    objstm->numbers = numbers;
+    objstm->offsets = offsets;
+    doc->objstms[num] = objstm;
+    return objstm;
+}
+
+static int pdf_rebuild_xref(PdfDoc* doc);
+
+/**
+ * Fetch an indirect object by number, materialising it on first access
+ * @return the object, or NULL if it does not exist or cannot be parsed
+ */
+static PdfObj* pdf_get_object(PdfDoc* doc, int num) {
+    if (num <= 0 || num >= doc->xref_count) return NULL;
+    if (doc->cache[num]) return doc->cache[num];
+    if (doc->resolving[num]) return NULL; // reference cycle while parsing
+
+    uint32_t aux = doc->xref_aux[num];
+    PdfObj* obj = NULL;
+    doc->resolving[num] = 1;
+
+    if ((aux & 3) == XREF_INUSE) {
+        int parsed_num = -1;
+        obj = pdf_parse_indirect(doc, doc->xref_offsets[num], &parsed_num);
+        if (!obj || parsed_num != num) {
+            obj = NULL;
+            // Stale offsets: index the file by scanning, once, and retry
+            if (!doc->rebuilt && pdf_rebuild_xref(doc) == 0 &&
+                num < doc->xref_count && (doc->xref_aux[num] & 3) == XREF_INUSE) {
+                obj = pdf_parse_indirect(doc, doc->xref_offsets[num], &parsed_num);
+                if (parsed_num != num) obj = NULL;
+            }
+        }
+    } else if ((aux & 3) == XREF_COMPRESSED) {
+        PdfObjStm* objstm = pdf_load_objstm(doc, (int)doc->xref_offsets[num]);
+        int slot = (int)(aux >> 2);
+        if (objstm && slot < objstm->count && objstm->numbers[slot] != num) {
+            // Index mismatch: search the stream header instead
+            for (slot = 0; slot < objstm->count && objstm->numbers[slot] != num; slot++) {}
+        }
+        if (objstm && slot < objstm->count) {
+            PdfLexer lex = { objstm->data, (int64_t)objstm->size,
+                             (int64_t)objstm->first + objstm->offsets[slot] };
+            obj = pdf_parse_object(&lex, &doc->arena, 0);
+        }
+    }
+
+    doc->resolving[num] = 0;
+    if (obj) doc->cache[num] = obj;
+    return obj;
+}
+
+// --- Cross-reference loading -----------------------------------------------
+
+static int pdf_ensure_xref(PdfDoc* doc, int count) {
+    if (count <= doc->xref_count) return 0;
+    if (count > (1 << 24)) return -1; // far beyond any sane object count
+
+    int64_t* offsets = (int64_t*)realloc(doc->xref_offsets, sizeof(int64_t) * count);
+    if (offsets) doc->xref_offsets = offsets;
+    uint32_t* aux = (uint32_t*)realloc(doc->xref_aux, sizeof(uint32_t) * count);
+    if (aux) doc->xref_aux = aux;
+    PdfObj** cache = (PdfObj**)realloc(doc->cache, sizeof(PdfObj*) * count);
+    if (cache) doc->cache = cache;
+    unsigned char* resolving = (unsigned char*)realloc(doc->resolving, (size_t)count);
+    if (resolving) doc->resolving = resolving;
+    if (!offsets || !aux || !cache || !resolving) return -1;
+
+    int old = doc->xref_count;
+    memset(doc->xref_offsets + old, 0, sizeof(int64_t) * (count - old));
+    memset(doc->xref_aux + old, 0, sizeof(uint32_t) * (count - old));
+    memset(doc->cache + old, 0, sizeof(PdfObj*) * (count - old));
+    memset(doc->resolving + old, 0, (size_t)(count - old));
+
+    if (doc->objstms) {
+        PdfObjStm** objstms = (PdfObjStm**)realloc(doc->objstms, sizeof(PdfObjStm*) * count);
+        if (!objstms) return -1;
+        memset(objstms + old, 0, sizeof(PdfObjStm*) * (count - old));
+        doc->objstms = objstms;
+    }
+    doc->xref_count = count;
+    return 0;
+}
+
+// Record an entry unless a newer section already defined this object
+static void pdf_set_xref(PdfDoc* doc, int num, int kind, int64_t offset, uint32_t gen_or_slot) {
+    if (num <= 0 || pdf_ensure_xref(doc, num + 1) != 0) return;
+    if ((doc->xref_aux[num] & 3) != XREF_UNSET) return;
+    doc->xref_offsets[num] = offset;
+    doc->xref_aux[num] = (gen_or_slot << 2) | (uint32_t)kind;
+}
+
+static int pdf_parse_xref_section(PdfDoc* doc, PdfLexer* lex, PdfObj** trailer) {
+    pdf_skip_space(lex);
+    if (!pdf_match_keyword(lex, "xref")) return -1;
+
+    for (;;) {
+        int64_t start, count;
+        pdf_skip_space(lex);
+        if (pdf_match_keyword(lex, "trailer")) break;
+        if (!pdf_read_int(lex, &start)) return -1;
+        pdf_skip_space(lex);
+        if (!pdf_read_int(lex, &count)) return -1;
+        if (start < 0 || count < 0 || start + count > (1 << 24)) return -1;
+        if (pdf_ensure_xref(doc, (int)(start + count)) != 0) return -1;
+
+        for (int64_t i = 0; i < count; i++) {
+            int64_t entry_offset, gen;
+            pdf_skip_space(lex);
+            if (!pdf_read_int(lex, &entry_offset)) return -1;
+            pdf_skip_space(lex);
+            if (!pdf_read_int(lex, &gen)) return -1;
+            pdf_skip_space(lex);
+            if (lex->pos >= lex->size) return -1;
+            int kind = lex->data[lex->pos++] == 'n' ? XREF_INUSE : XREF_FREE;
+
+            int num = (int)(start + i);
+            // Some writers number the first subsection from 1 but list object 0
+            if (i == 0 && start == 1 && kind == XREF_FREE && gen == 65535) {
+                start = 0;
+                continue;
+            }
+            if (kind == XREF_INUSE && entry_offset == 0) kind = XREF_FREE;
+            pdf_set_xref(doc, num, kind, entry_offset, (uint32_t)gen & 0xffff);
+        }
+    }
+
+    *trailer = pdf_parse_object(lex, &doc->arena, 0);
+    return *trailer && (*trailer)->type == PDF_DICT ? 0 : -1;
+}
+
+static int pdf_parse_xref_table(PdfDoc* doc, int64_t offset, PdfObj** trailer) {
+    // A table cut off by the window is parsed again from a larger one;
+    // recording its entries twice is harmless
+    for (int64_t window = PDF_SPAN_WINDOW; ; window *= 4) {
+        PdfSpan span;
+        if (pdf_span_read(doc, offset, window, &span) != 0) return -1;
+        PdfLexer lex = pdf_span_lexer(&span, offset);
+        int status = pdf_parse_xref_section(doc, &lex, trailer);
+        int cut = pdf_span_short(doc, &span, &lex, 1);
+        pdf_span_release(&span);
+        if (!cut) return status;
+    }
+}
+
+static int pdf_parse_xref_stream(PdfDoc* doc, int64_t offset, PdfObj** trailer) {
+    int num;
+    PdfObj* stream = pdf_parse_indirect(doc, offset, &num);
+    if (!stream || stream->type != PDF_STREAM) return -1;
+    if (!pdf_is_name(pdf_dict_get_raw(stream, "Type"), "XRef")) return -1;
+
+    PdfObj* w = pdf_dict_get_raw(stream, "W");
+    if (!w || w->type != PDF_ARRAY || w->u.array.count < 3) return -1;
+    int widths[3];
+    for (int i = 0; i < 3; i++) {
+        widths[i] = (int)pdf_to_int(w->u.array.items[i], -1);
+        if (widths[i] < 0 || widths[i] > 8) return -1;
+    }
+    int row = widths[0] + widths[1] + widths[2];
+    if (row == 0) return -1;
+
+    int64_t size = pdf_to_int(pdf_dict_get_raw(stream, "Size"), 0);
+    if (size <= 0 || size > (1 << 24) || pdf_ensure_xref(doc, (int)size) != 0) return -1;
+
+    size_t data_size;
+    unsigned char* data = pdf_decode_stream(doc, stream, &data_size);
+    if (!data) return -1;
+
+    PdfObj* index = pdf_dict_get_raw(stream, "Index");
+    int ranges = index && index->type == PDF_ARRAY ? index->u.array.count / 2 : 1;
+    size_t pos = 0;
+
+    for (int r = 0; r < ranges; r++) {
+        int64_t start = 0, count = size;
+        if (index && index->type == PDF_ARRAY) {
+            start = pdf_to_int(index->u.array.items[r * 2], 0);
+            count = pdf_to_int(index->u.array.items[r * 2 + 1], 0);
+        }
+        for (int64_t i = 0; i < count && pos + row <= data_size; i++, pos += row) {
+            uint64_t fields[3];
+            const unsigned char* p = data + pos;
+            for (int f = 0; f < 3; f++) {
+                fields[f] = 0;
+                for (int b = 0; b < widths[f]; b++) fields[f] = (fields[f] << 8) | *p++;
+            }
+            if (widths[0] == 0) fields[0] = 1; // type defaults to "in use"
+
+            int obj_num = (int)(start + i);
+            if (fields[0] == 0) {
+                pdf_set_xref(doc, obj_num, XREF_FREE, 0, 0);
+            } else if (fields[0] == 1) {
+                pdf_set_xref(doc, obj_num, XREF_INUSE, (int64_t)fields[1], (uint32_t)fields[2] & 0xffff);
+            } else if (fields[0] == 2) {
+                pdf_set_xref(doc, obj_num, XREF_COMPRESSED, (int64_t)fields[1], (uint32_t)fields[2]);
+            }
+        }
+    }
+
+    zell_pool_put(data);
+    *trailer = stream->u.stream.dict;
+    return 0;
+}
+
+static int64_t pdf_find_startxref(PdfDoc* doc) {
+    int64_t window_start = doc->size < 4096 ? 0 : doc->size - 4096;
+    PdfSpan span;
+    int64_t result = -1;
+    if (pdf_span_read(doc, window_start, doc->size - window_start, &span) != 0) return -1;
+
+    for (int64_t i = doc->size - 9 - span.offset; i >= window_start - span.offset && i >= 0; i--) {
+        if (memcmp(span.data + i, "startxref", 9) == 0) {
+            PdfLexer lex = { span.data, span.size, i + 9 };
+            int64_t offset;
+            pdf_skip_space(&lex);
+            if (pdf_read_int(&lex, &offset)) result = offset;
+            break;
+        }
+    }
+    pdf_span_release(&span);
+    return result;
+}
+
+static void pdf_merge_trailer(PdfDoc* doc, PdfObj* trailer) {
+    // The newest trailer wins; older ones only fill in missing keys
+    if (!doc->trailer) {
+        doc->trailer = trailer;
+        return;
+    }
+    static const char* keys[] = { "Root", "Info", "ID", "Encrypt" };
+    for (int k = 0; k < 4; k++) {
+        PdfObj* value = pdf_dict_get_raw(trailer, keys[k]);
+        if (!value || pdf_dict_get_raw(doc->trailer, keys[k])) continue;
+
+        PdfObj* old = doc->trailer->type == PDF_STREAM ? doc->trailer->u.stream.dict : doc->trailer;
+        int count = old->u.dict.count;
+        const char** new_keys = (const char**)zell_arena_alloc(&doc->arena, sizeof(char*) * (count + 1));
+        PdfObj** new_values = (PdfObj**)zell_arena_alloc(&doc->arena, sizeof(PdfObj*) * (count + 1));
+        if (!new_keys || !new_values) return;
+        memcpy(new_keys, old->u.dict.keys, sizeof(char*) * count);
+        memcpy(new_values, old->u.dict.values, sizeof(PdfObj*) * count);
+        new_keys[count] = keys[k];
+        new_values[count] = value;
+        old->u.dict.keys = new_keys;
+        old->u.dict.values = new_values;
+        old->u.dict.count = count + 1;
+    }
+}
+
+static int pdf_load_xref(PdfDoc* doc) {
+    int64_t offset = pdf_find_startxref(doc);
+    int64_t visited[64];
+    int sections = 0;
+
+    while (offset > 0 && offset < doc->size && sections < 64) {
+        for (int i = 0; i < sections; i++) {
+            if (visited[i] == offset) return doc->trailer ? 0 : -1; // /Prev loop
+        }
+        visited[sections++] = offset;
+
+        PdfObj* trailer = NULL;
+        if (pdf_keyword_at(doc, offset, "xref")) {
+            if (pdf_parse_xref_table(doc, offset, &trailer) != 0) return -1;
+            // Hybrid files list their compressed objects in an extra xref stream
+            int64_t xref_stm = pdf_to_int(pdf_dict_get_raw(trailer, "XRefStm"), -1);
+            if (xref_stm > 0) {
+                PdfObj* ignored;
+                pdf_parse_xref_stream(doc, xref_stm, &ignored);
+            }
+        } else if (pdf_parse_xref_stream(doc, offset, &trailer) != 0) {
+            return -1;
+        }
+
+        pdf_merge_trailer(doc, trailer);
+        offset = pdf_to_int(pdf_dict_get_raw(trailer, "Prev"), -1);
+    }
+
+    return doc->trailer ? 0 : -1;
+}
+
+// Fallback index: scan the whole file for "num gen obj" headers and trailers
+static int pdf_rebuild_xref(PdfDoc* doc) {
+    doc->rebuilt = 1;
+    memset(doc->xref_aux, 0, sizeof(uint32_t) * doc->xref_count);
+
+    PdfObj* last_trailer = NULL;
+    int objstm_nums[4096];
+    int objstm_count = 0;
+
+    // Resident files are scanned in one go, others a chunk at a time; chunks
+    // are read with margins so headers that straddle a boundary stay whole
+    int64_t chunk = doc->data ? doc->size : PDF_SCAN_CHUNK;
+    for (int64_t chunk_start = 0; chunk_start < doc->size; chunk_start += chunk) {
+        int64_t span_start = chunk_start > 64 ? chunk_start - 64 : 0;
+        PdfSpan span;
+        if (pdf_span_read(doc, span_start, chunk_start - span_start + chunk + 600, &span) != 0) break;
+        const unsigned char* data = span.data;
+        int64_t size = span.size;
+        int64_t pos = chunk_start - span.offset;
+        int64_t chunk_end = chunk_start + chunk - span.offset;
+
+        while ((pos = pdf_find(data, size, pos, "obj")) >= 0 && pos < chunk_end) {
+            // Walk back over "num gen " to the start of the header
+            int64_t p = pos - 1;
+            while (p >= 0 && pdf_is_space(data[p])) p--;
+            while (p >= 0 && data[p] >= '0' && data[p] <= '9') p--;
+            while (p >= 0 && pdf_is_space(data[p])) p--;
+            int64_t num_end = p + 1;
+            while (p >= 0 && data[p] >= '0' && data[p] <= '9') p--;
+            int64_t start = p + 1;
+
+            if (num_end > start && (p < 0 || !pdf_is_regular(data[p])) &&
+                (pos + 3 >= size || !pdf_is_regular(data[pos + 3]))) {
+                PdfLexer lex = { data, size, start };
+                int64_t num, gen;
+                if (pdf_read_int(&lex, &num) && num > 0 && num < (1 << 24)) {
+                    pdf_skip_space(&lex);
+                    if (pdf_read_int(&lex, &gen)) {
+                        // Later definitions override earlier ones, like an update would
+                        if (pdf_ensure_xref(doc, (int)num + 1) == 0) {
+                            doc->xref_offsets[num] = span.offset + start;
+                            doc->xref_aux[num] = ((uint32_t)gen & 0xffff) << 2 | XREF_INUSE;
+                            doc->cache[num] = NULL;
+
+                            int64_t header_end = pos + 512 < size ? pos + 512 : size;
+                            int64_t objstm = pdf_find(data, header_end, pos, "/ObjStm");
+                            if (objstm >= 0 && objstm < pdf_find(data, header_end + 7 < size ? header_end + 7 : size, pos, "stream") &&
+                                objstm_count < (int)(sizeof(objstm_nums) / sizeof(objstm_nums[0]))) {
+                                objstm_nums[objstm_count++] = (int)num;
+                            }
+                        }
+                    }
+                }
+            }
+            pos += 3;
+        }
+        pdf_span_release(&span);
+    }
+
+    // Objects inside object streams have no header of their own to find
+    for (int i = 0; i < objstm_count; i++) {
+        PdfObjStm* objstm = pdf_load_objstm(doc, objstm_nums[i]);
+        for (int k = 0; objstm && k < objstm->count; k++) {
+            pdf_set_xref(doc, objstm->numbers[k], XREF_COMPRESSED, objstm_nums[i], (uint32_t)k);
+        }
+    }
+
+    int64_t pos = 0;
+    while ((pos = pdf_find_in_file(doc, pos, "trailer")) >= 0) {
+        PdfObj* trailer = pdf_parse_object_at(doc, pos + 7);
+        if (trailer && trailer->type == PDF_DICT && pdf_dict_get_raw(trailer, "Root")) last_trailer = trailer;
+        pos += 7;
+    }
+
+    if (!last_trailer) {
+        // Xref-stream-only file: use the newest XRef stream dictionary, or find the catalog
+        for (int num = doc->xref_count - 1; num > 0 && !last_trailer; num--) {
+            if ((doc->xref_aux[num] & 3) != XREF_INUSE) continue;
+            PdfObj* obj = pdf_parse_indirect(doc, doc->xref_offsets[num], NULL);
+            if (obj && obj->type == PDF_STREAM && pdf_is_name(pdf_dict_get_raw(obj, "Type"), "XRef")) {
+                last_trailer = obj->u.stream.dict;
+            } else if (obj && obj->type == PDF_DICT && pdf_is_name(pdf_dict_get_raw(obj, "Type"), "Catalog")) {
+                PdfObj* trailer = pdf_new_object(&doc->arena, PDF_DICT);
+                PdfObj* ref = pdf_new_object(&doc->arena, PDF_REF);
+                const char** keys = (const char**)zell_arena_alloc(&doc->arena, sizeof(char*));
+                PdfObj** values = (PdfObj**)zell_arena_alloc(&doc->arena, sizeof(PdfObj*));
+                if (!trailer || !ref || !keys || !values) break;
+                ref->u.ref.num = num;
+                keys[0] = "Root";
+                values[0] = ref;
+                trailer->u.dict.keys = keys;
+                trailer->u.dict.values = values;
+                trailer->u.dict.count = 1;
+                last_trailer = trailer;
+            }
+        }
+    }
+
+    if (!last_trailer) return -1;
+    doc->trailer = last_trailer;
+    return 0;
+}
+
+static void pdf_close(PdfDoc* doc) {
+    if (!doc) return;
+    if (doc->objstms) {
+        for (int i = 0; i < doc->xref_count; i++) {
+            if (doc->objstms[i]) zell_pool_put(doc->objstms[i]->data);
+        }
+        free(doc->objstms);
+    }
+    free(doc->xref_offsets);
+    free(doc->xref_aux);
+    free(doc->cache);
+    free(doc->resolving);
+    free(doc->pages);
+    zell_arena_free(&doc->arena);
+    free(doc);
+}
+
+/**
+ * Open a PDF from a byte source; the source must outlive the document
+ * @return the document, or NULL if it is not a PDF or cannot be indexed
+ */
+static PdfDoc* pdf_open_source(const ZellSource* source) {
+    ZELL_STATS_STAGE(ZELL_STAGE_PARSE, "pdf_open");
+    unsigned char header[1024];
+    if (!source || source->size < 8) return NULL;
+    int64_t header_size = zell_source_read(source, 0, header, (int64_t)sizeof(header));
+    if (header_size < 8 || pdf_find(header, header_size, 0, "%PDF-") < 0) return NULL;
+
+    PdfDoc* doc = (PdfDoc*)calloc(1, sizeof(PdfDoc));
+    if (!doc) return NULL;
+    doc->source = *source;
+    doc->data = source->data;
+    doc->size = source->size;
+    doc->page_count = -1;
+
+    if (pdf_ensure_xref(doc, 1) != 0 ||
+        (pdf_load_xref(doc) != 0 && pdf_rebuild_xref(doc) != 0)) {
+        pdf_close(doc);
+        return NULL;
+    }
+
+    // Some broken files point at a catalog that is not there; reindex once
+    PdfObj* root = pdf_dict_get(doc, doc->trailer, "Root");
+    if ((!root || root->type != PDF_DICT) && !doc->rebuilt) {
+        if (pdf_rebuild_xref(doc) == 0) root = pdf_dict_get(doc, doc->trailer, "Root");
+    }
+    if (!root || root->type != PDF_DICT) {
+        pdf_close(doc);
+        return NULL;
+    }
+
+    doc->encrypted = pdf_dict_get_raw(doc->trailer, "Encrypt") != NULL;
+    return doc;
+}
+
+/**
+ * Open a PDF held in memory; the buffer must outlive the document
+ * @return the document, or NULL if it is not a PDF or cannot be indexed
+ */
+static PdfDoc* pdf_open(const unsigned char* data, int64_t size) {
+    if (!data) return NULL;
+    ZellSource source;
+    zell_source_memory(&source, data, size);
+    return pdf_open_source(&source);
+}
+
+// --- Page tree -------------------------------------------------------------
+
+typedef struct {
+    PdfPage* items;
+    int count;
+    int capacity;
+    unsigned char* visited;
+    int visited_size;
+} PdfPageWalk;
+
+static int pdf_walk_pages(PdfDoc* doc, PdfPageWalk* walk, PdfObj* node_ref, PdfPage inherited, int depth) {
+    if (depth > PDF_MAX_DEPTH || !node_ref) return 0;
+
+    int num = node_ref->type == PDF_REF ? node_ref->u.ref.num : 0;
+    if (num > 0) {
+        if (num >= walk->visited_size || walk->visited[num]) return 0; // cycle or bad ref
+        walk->visited[num] = 1;
+    }
+    PdfObj* node = pdf_resolve(doc, node_ref);
+    if (!node || node->type != PDF_DICT) return 0;
+
+    PdfObj* value;
+    if ((value = pdf_dict_get_raw(node, "Resources"))) inherited.resources = value;
+    if ((value = pdf_dict_get_raw(node, "MediaBox"))) inherited.media_box = value;
+    if ((value = pdf_dict_get_raw(node, "CropBox"))) inherited.crop_box = value;
+    if ((value = pdf_dict_get_raw(node, "Rotate"))) inherited.rotate = value;
+
+    PdfObj* type = pdf_dict_get(doc, node, "Type");
+    PdfObj* kids = pdf_dict_get(doc, node, "Kids");
+
+    if (pdf_is_name(type, "Pages") || (!pdf_is_name(type, "Page") && kids && kids->type == PDF_ARRAY)) {
+        if (!kids || kids->type != PDF_ARRAY) return 0;
+        for (int i = 0; i < kids->u.array.count; i++) {
+            if (pdf_walk_pages(doc, walk, kids->u.array.items[i], inherited, depth + 1) != 0) return -1;
+        }
+        return 0;
+    }
+
+    if (walk->count == walk->capacity) {
+        int capacity = walk->capacity ? walk->capacity * 2 : 64;
+        PdfPage* grown = (PdfPage*)realloc(walk->items, sizeof(PdfPage) * capacity);
+        if (!grown) return -1;
+        walk->items = grown;
+        walk->capacity = capacity;
+    }
+    inherited.num = num;
+    inherited.dict = node;
+    walk->items[walk->count++] = inherited;
+    return 0;
+}
+
+/**
+ * Walk the page tree once, resolving inherited page attributes
+ * @return page count, or -1 on error
+ */
+static int pdf_load_pages(PdfDoc* doc) {
+    ZELL_STATS_STAGE(ZELL_STAGE_PARSE, "pdf_load_pages");
+    if (doc->page_count >= 0) return doc->page_count;
+
+    PdfObj* root = pdf_dict_get(doc, doc->trailer, "Root");
+    PdfObj* pages_ref = pdf_dict_get_raw(root, "Pages");
+    if (!pages_ref) return -1;
+
+    PdfPageWalk walk;
+    memset(&walk, 0, sizeof(walk));
+    walk.visited = (unsigned char*)calloc((size_t)doc->xref_count, 1);
+    walk.visited_size = doc->xref_count;
+    if (!walk.visited) return -1;
+
+    PdfPage inherited;
+    memset(&inherited, 0, sizeof(inherited));
+    int status = pdf_walk_pages(doc, &walk, pages_ref, inherited, 0);
+    free(walk.visited);
+
+    if (status != 0) {
+        free(walk.items);
+        return -1;
+    }
+    doc->pages = walk.items;
+    doc->page_count = walk.count;
+    return walk.count;
+}
+
+// --- Writer ----------------------------------------------------------------
+
+// Output buffer that fills up to its capacity and keeps counting past it, so
+// a caller can learn the size it would have needed.  A growable writer owns
+// its buffer and reallocates instead, and a sink writer streams everything
+// to the caller's callback.
+typedef struct {
+    unsigned char* data;
+    int64_t capacity;
+    int64_t length;
+    int growable;
+    ZellSink* sink;
+} PdfWriter;
+
+#define PDF_SINK_WRITER(sink) { NULL, INT64_MAX, 0, 0, (sink) }
+
+// Map a source object number to its number in the output (0 = write null)
+typedef int (*PdfRefMap)(void* ctx, int num);
+
+static void pdf_put(PdfWriter* w, const void* bytes, size_t n) {
+    if (w->sink) {
+        zell_sink_put(w->sink, bytes, (int64_t)n);
+        w->length += (int64_t)n;
+        return;
+    }
+    if (w->growable && w->length + (int64_t)n > w->capacity) {
+        int64_t capacity = w->capacity ? w->capacity : 4096;
+        while (capacity < w->length + (int64_t)n) capacity *= 2;
+        unsigned char* grown = (unsigned char*)realloc(w->data, (size_t)capacity);
+        if (grown) {
+            w->data = grown;
+            w->capacity = capacity;
+        } else {
+            w->growable = 0; // keep counting; the caller sees length > capacity
+        }
+    }
+    if (w->length < w->capacity) {
+        int64_t room = w->capacity - w->length;
+        memcpy(w->data + w->length, bytes, (int64_t)n < room ? n : (size_t)room);
+    }
+    w->length += (int64_t)n;
+}
+
+static void pdf_puts(PdfWriter* w, const char* text) {
+    pdf_put(w, text, strlen(text));
+}
+
+static void pdf_put_int(PdfWriter* w, int64_t value) {
+    char buffer[24];
+    int len = snprintf(buffer, sizeof(buffer), "%lld", (long long)value);
+    pdf_put(w, buffer, (size_t)len);
+}
+
+static void pdf_put_real(PdfWriter* w, double value) {
+    // PDF has no exponent syntax, so always print fixed-point and trim zeros
+    char buffer[64];
+    if (value == (double)(int64_t)value && fabs(value) < 1e15) {
+        pdf_put_int(w, (int64_t)value);
+        return;
+    }
+    int len = snprintf(buffer, sizeof(buffer), "%.6f", value);
+    while (len > 0 && buffer[len - 1] == '0') len--;
+    if (len > 0 && buffer[len - 1] == '.') len--;
+    pdf_put(w, buffer, (size_t)len);
+}
+
+static void pdf_put_name(PdfWriter* w, const char* name) {
+    static const char hex[] = "0123456789ABCDEF";
+    pdf_put(w, "/", 1);
+    for (const unsigned char* p = (const unsigned char*)name; *p; p++) {
+        if (*p < 0x21 || *p > 0x7e || *p == '#' || pdf_is_delim(*p)) {
+            char escaped[3] = { '#', hex[*p >> 4], hex[*p & 15] };
+            pdf_put(w, escaped, 3);
+        } else {
+            pdf_put(w, p, 1);
+        }
+    }
+}
+
+static void pdf_put_string(PdfWriter* w, const unsigned char* data, int length) {
+    pdf_put(w, "(", 1);
+    int run = 0;
+    for (int i = 0; i < length; i++) {
+        unsigned char c = data[i];
+        if (c == '(' || c == ')' || c == '\\' || c == '\r') {
+            pdf_put(w, data + run, (size_t)(i - run));
+            pdf_put(w, c == '\r' ? "\\r" : "\\", c == '\r' ? 2 : 1);
+            run = c == '\r' ? i + 1 : i;
+        }
+    }
+    pdf_put(w, data + run, (size_t)(length - run));
+    pdf_put(w, ")", 1);
+}
+
+static void pdf_put_value(PdfWriter* w, PdfObj* obj, PdfRefMap map, void* ctx, int depth);
+
+// Write "<<" and every entry of dict except `skip` keys; the caller closes it
+static void pdf_put_dict_open(PdfWriter* w, PdfObj* dict, const char* const* skip, int skip_count,
+                              PdfRefMap map, void* ctx, int depth) {
+    pdf_put(w, "<<", 2);
+    if (!dict || dict->type != PDF_DICT) return;
+    for (int i = 0; i < dict->u.dict.count; i++) {
+        int skipped = 0;
+        for (int k = 0; k < skip_count && !skipped; k++) {
+            skipped = strcmp(dict->u.dict.keys[i], skip[k]) == 0;
+        }
+        if (skipped) continue;
+        pdf_put_name(w, dict->u.dict.keys[i]);
+        pdf_put(w, " ", 1);
+        pdf_put_value(w, dict->u.dict.values[i], map, ctx, depth + 1);
+    }
+}
+
+static void pdf_put_value(PdfWriter* w, PdfObj* obj, PdfRefMap map, void* ctx, int depth) {
+    if (!obj || depth > PDF_MAX_DEPTH) {
+        pdf_puts(w, "null");
+        return;
+    }
+    switch (obj->type) {
+        case PDF_NULL: pdf_puts(w, "null"); break;
+        case PDF_BOOL: pdf_puts(w, obj->u.boolean ? "true" : "false"); break;
+        case PDF_INT: pdf_put_int(w, obj->u.integer); break;
+        case PDF_REAL: pdf_put_real(w, obj->u.real); break;
+        case PDF_STRING: pdf_put_string(w, obj->u.string.data, obj->u.string.length); break;
+        case PDF_NAME: pdf_put_name(w, obj->u.name); break;
+        case PDF_ARRAY:
+            pdf_put(w, "[", 1);
+            for (int i = 0; i < obj->u.array.count; i++) {
+                if (i) pdf_put(w, " ", 1);
+                pdf_put_value(w, obj->u.array.items[i], map, ctx, depth + 1);
+            }
+            pdf_put(w, "]", 1);
+            break;
+        case PDF_DICT:
+            pdf_put_dict_open(w, obj, NULL, 0, map, ctx, depth);
+            pdf_put(w, ">>", 2);
+            break;
+        case PDF_REF: {
+            int num = map ? map(ctx, obj->u.ref.num) : obj->u.ref.num;
+            if (num > 0) {
+                pdf_put_int(w, num);
+                pdf_puts(w, " 0 R");
+            } else {
+                pdf_puts(w, "null");
+            }
+            break;
+        }
+        case PDF_STREAM:
+            // Streams are always indirect; a direct one can only be written as its dict
+            pdf_put_value(w, obj->u.stream.dict, map, ctx, depth);
+            break;
+    }
+}
+
+// Write "num 0 obj ... endobj" for a source object, remapping its references
+static void pdf_put_indirect(PdfWriter* w, PdfDoc* doc, int num, PdfObj* obj, PdfRefMap map, void* ctx) {
+    pdf_put_int(w, num);
+    pdf_puts(w, " 0 obj\n");
+    if (obj && obj->type == PDF_STREAM) {
+        static const char* const skip[] = { "Length" };
+        PdfSpan span;
+        size_t raw_size = 0;
+        const unsigned char* raw = pdf_stream_raw(doc, obj, &raw_size, &span);
+        if (!raw) raw_size = 0;
+        pdf_put_dict_open(w, obj->u.stream.dict, skip, 1, map, ctx, 0);
+        pdf_puts(w, "/Length ");
+        pdf_put_int(w, (int64_t)raw_size);
+        pdf_puts(w, ">>\nstream\n");
+        if (raw) pdf_put(w, raw, raw_size);
+        pdf_span_release(&span);
+        pdf_puts(w, "\nendstream");
+    } else {
+        pdf_put_value(w, obj, map, ctx, 0);
+    }
+    pdf_puts(w, "\nendobj\n");
+}
+
+static void pdf_put_header(PdfWriter* w) {
+    pdf_puts(w, "%PDF-1.7\n%\xE2\xE3\xCF\xD3\n");
+}
+
+// Classic xref table and trailer; offsets[i] is the offset of object i (1-based)
+static void pdf_put_xref(PdfWriter* w, const int64_t* offsets, int count, int root_num) {
+    int64_t xref_offset = w->length;
+    char entry[21];
+
+    pdf_puts(w, "xref\n0 ");
+    pdf_put_int(w, count + 1);
+    pdf_puts(w, "\n0000000000 65535 f \n");
+    for (int i = 1; i <= count; i++) {
+        snprintf(entry, sizeof(entry), "%010lld 00000 n \n", (long long)offsets[i]);
+        pdf_put(w, entry, 20);
+    }
+    pdf_puts(w, "trailer\n<</Size ");
+    pdf_put_int(w, count + 1);
+    pdf_puts(w, "/Root ");
+    pdf_put_int(w, root_num);
+    pdf_puts(w, " 0 R>>\nstartxref\n");
+    pdf_put_int(w, xref_offset);
+    pdf_puts(w, "\n%%EOF\n");
+}
+
+// --- Content hashing -------------------------------------------------------
+
+typedef struct {
+    uint64_t lo;
+    uint64_t hi;
+} PdfHash;
+
+static inline uint64_t pdf_hash_mix(uint64_t x) {
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdULL;
+    x ^= x >> 33;
+    x *= 0xc4ceb9fe1a85ec53ULL;
+    x ^= x >> 33;
+    return x;
+}
+
+static void pdf_hash_bytes(PdfHash* h, const void* data, size_t len) {
+    const unsigned char* p = (const unsigned char*)data;
+    uint64_t k;
+    h->hi ^= len * 0x9e3779b97f4a7c15ULL;
+    while (len >= 8) {
+        memcpy(&k, p, 8);
+        h->lo = pdf_hash_mix(h->lo ^ k);
+        h->hi = (h->hi ^ k) * 0x100000001b3ULL + (h->lo >> 29);
+        p += 8;
+        len -= 8;
+    }
+    k = 0;
+    memcpy(&k, p, len);
+    h->lo = pdf_hash_mix(h->lo ^ k ^ 0x5bd1e995);
+    h->hi = pdf_hash_mix(h->hi ^ k);
+}
+
+static void pdf_hash_u64(PdfHash* h, uint64_t value) {
+    pdf_hash_bytes(h, &value, sizeof(value));
+}
+
+// --- Object copying --------------------------------------------------------
+//
+// Builds a new document from pages of one or more source documents.  Each
+// added page pulls in the transitive closure of objects it references
+// except page-tree nodes, renumbered densely; references to pages that are
+// not part of the output are written as null.
+// With dedup enabled, objects are keyed by a Merkle hash of their content
+// (references hash as the hash of their target), so identical fonts, images
+// and resource dictionaries shared across inputs are written only once.
+
+#define PDF_HASH_NONE 0
+#define PDF_HASH_BUSY 1
+#define PDF_HASH_DONE 2
+
+typedef struct {
+    PdfDoc* doc;
+    int* map;             // source object number -> output number (0 = not copied)
+    PdfHash* hashes;      // Merkle hashes, computed on demand when deduplicating
+    unsigned char* hash_state;
+} PdfCopySource;
+
+typedef struct {
+    int doc;
+    int num;              // source object number, or 0 for synthetic objects
+    int page;             // page index when this output object is a page, else -1
+} PdfCopyEntry;
+
+typedef struct {
+    PdfCopySource* sources;
+    int source_count;
+    int dedup;
+
+    PdfCopyEntry* objects;    // output object i + 1
+    int object_count;
+    int object_capacity;
+
+    int* page_objects;        // output numbers of the pages, in order
+    int page_count;
+    int page_capacity;
+
+    PdfHash* table_keys;      // dedup table: content hash -> output number
+    int* table_values;
+    int table_capacity;
+    int table_count;
+
+    int* work;                // pending output numbers whose references to follow
+    int work_count;
+    int work_capacity;
+
+    int keep_page_tree;       // copy page-tree nodes like any other object
+    int current_source;       // source whose map the writer is using
+    int failed;
+} PdfCopy;
+
+static int pdf_copy_init(PdfCopy* copy, PdfDoc** docs, int doc_count, int dedup) {
+    memset(copy, 0, sizeof(*copy));
+    copy->sources = (PdfCopySource*)calloc((size_t)doc_count, sizeof(PdfCopySource));
+    if (!copy->sources) return -1;
+    copy->source_count = doc_count;
+    copy->dedup = dedup;
+    for (int i = 0; i < doc_count; i++) {
+        copy->sources[i].doc = docs[i];
+        copy->sources[i].map = (int*)calloc((size_t)docs[i]->xref_count, sizeof(int));
+        if (!copy->sources[i].map) return -1;
+    }
+    // Object 1 is the catalog and object 2 the page tree root
+    copy->object_count = 2;
+    copy->object_capacity = 64;
+    copy->objects = (PdfCopyEntry*)calloc((size_t)copy->object_capacity, sizeof(PdfCopyEntry));
+    return copy->objects ? 0 : -1;
+}
+
+static void pdf_copy_free(PdfCopy* copy) {
+    for (int i = 0; i < copy->source_count; i++) {
+        free(copy->sources[i].map);
+        free(copy->sources[i].hashes);
+        free(copy->sources[i].hash_state);
+    }
+    free(copy->sources);
+    free(copy->objects);
+    free(copy->page_objects);
+    free(copy->table_keys);
+    free(copy->table_values);
+    free(copy->work);
+    memset(copy, 0, sizeof(*copy));
+}
+
+// Forget the copied objects so the same sources can feed another output.
+// Only the entries that were used are cleared, so this costs O(output).
+static void pdf_copy_reset(PdfCopy* copy) {
+    for (int i = 2; i < copy->object_count; i++) {
+        const PdfCopyEntry* entry = &copy->objects[i];
+        if (entry->num > 0) copy->sources[entry->doc].map[entry->num] = 0;
+    }
+    if (copy->table_values) memset(copy->table_values, 0, sizeof(int) * copy->table_capacity);
+    copy->table_count = 0;
+    copy->object_count = 2;
+    copy->page_count = 0;
+    copy->work_count = 0;
+}
+
+static int pdf_copy_new_object(PdfCopy* copy, int doc, int num, int page) {
+    if (copy->object_count == copy->object_capacity) {
+        int capacity = copy->object_capacity * 2;
+        PdfCopyEntry* grown = (PdfCopyEntry*)realloc(copy->objects, sizeof(PdfCopyEntry) * capacity);
+        if (!grown) {
+            copy->failed = 1;
+            return 0;
+        }
+        copy->objects = grown;
+        copy->object_capacity = capacity;
+    }
+    PdfCopyEntry* entry = &copy->objects[copy->object_count++];
+    entry->doc = doc;
+    entry->num = num;
+    entry->page = page;
+    return copy->object_count; // output numbers are 1-based
+}
+
+static void pdf_copy_push_work(PdfCopy* copy, int out_num) {
+    if (copy->work_count == copy->work_capacity) {
+        int capacity = copy->work_capacity ? copy->work_capacity * 2 : 256;
+        int* grown = (int*)realloc(copy->work, sizeof(int) * capacity);
+        if (!grown) {
+            copy->failed = 1;
+            return;
+        }
+        copy->work = grown;
+        copy->work_capacity = capacity;
+    }
+    copy->work[copy->work_count++] = out_num;
+}
+
+// Page-tree nodes are never pulled in through ordinary references
+static int pdf_is_page_node(PdfDoc* doc, int num) {
+    PdfObj* obj = pdf_get_object(doc, num);
+    if (!obj || obj->type != PDF_DICT) return 0;
+    PdfObj* type = pdf_dict_get_raw(obj, "Type");
+    return pdf_is_name(type, "Page") || pdf_is_name(type, "Pages");
+}
+
+static PdfHash pdf_copy_hash_object(PdfCopy* copy, int source, int num, int depth);
+
+static void pdf_copy_hash_value(PdfCopy* copy, int source, PdfObj* obj, PdfHash* h, int depth);
+
+static void pdf_copy_hash_dict(PdfCopy* copy, int source, PdfObj* dict, PdfHash* h, int depth, int skip_length) {
+    if (!dict || dict->type != PDF_DICT) return;
+    for (int i = 0; i < dict->u.dict.count; i++) {
+        if (skip_length && strcmp(dict->u.dict.keys[i], "Length") == 0) continue;
+        pdf_hash_bytes(h, dict->u.dict.keys[i], strlen(dict->u.dict.keys[i]));
+        pdf_copy_hash_value(copy, source, dict->u.dict.values[i], h, depth + 1);
+    }
+}
+
+static void pdf_copy_hash_value(PdfCopy* copy, int source, PdfObj* obj, PdfHash* h, int depth) {
+    if (!obj || depth > PDF_MAX_DEPTH) {
+        pdf_hash_u64(h, 0);
+        return;
+    }
+    pdf_hash_u64(h, (uint64_t)obj->type + 0x100);
+    switch (obj->type) {
+        case PDF_NULL: break;
+        case PDF_BOOL: pdf_hash_u64(h, (uint64_t)obj->u.boolean); break;
+        case PDF_INT: pdf_hash_u64(h, (uint64_t)obj->u.integer); break;
+        case PDF_REAL: pdf_hash_bytes(h, &obj->u.real, sizeof(double)); break;
+        case PDF_STRING: pdf_hash_bytes(h, obj->u.string.data, (size_t)obj->u.string.length); break;
+        case PDF_NAME: pdf_hash_bytes(h, obj->u.name, strlen(obj->u.name)); break;
+        case PDF_ARRAY:
+            for (int i = 0; i < obj->u.array.count; i++) {
+                pdf_copy_hash_value(copy, source, obj->u.array.items[i], h, depth + 1);
+            }
+            break;
+        case PDF_DICT:
+            pdf_copy_hash_dict(copy, source, obj, h, depth, 0);
+            break;
+        case PDF_REF: {
+            PdfHash target = pdf_copy_hash_object(copy, source, obj->u.ref.num, depth + 1);
+            pdf_hash_u64(h, target.lo);
+            pdf_hash_u64(h, target.hi);
+            break;
+        }
+        case PDF_STREAM: {
+            PdfSpan span;
+            size_t raw_size = 0;
+            const unsigned char* raw = pdf_stream_raw(copy->sources[source].doc, obj, &raw_size, &span);
+            // /Length is rewritten on output (and may be indirect), so hash the bytes instead
+            pdf_copy_hash_dict(copy, source, obj->u.stream.dict, h, depth + 1, 1);
+            if (raw) pdf_hash_bytes(h, raw, raw_size);
+            pdf_span_release(&span);
+            break;
+        }
+    }
+}
+
+// Identity hash: unique per source object, so it never matches anything else
+static PdfHash pdf_copy_identity(int source, int num) {
+    PdfHash h = { 0x6a09e667f3bcc909ULL ^ (uint64_t)source, 0xbb67ae8584caa73bULL ^ (uint64_t)num };
+    pdf_hash_u64(&h, ((uint64_t)source << 32) | (uint32_t)num);
+    return h;
+}
+
+static PdfHash pdf_copy_hash_object(PdfCopy* copy, int source, int num, int depth) {
+    PdfCopySource* src = &copy->sources[source];
+    PdfDoc* doc = src->doc;
+
+    if (num <= 0 || num >= doc->xref_count) {
+        PdfHash none = { 0, 0 };
+        return none;
+    }
+    if (!src->hashes) {
+        src->hashes = (PdfHash*)malloc(sizeof(PdfHash) * doc->xref_count);
+        src->hash_state = (unsigned char*)calloc((size_t)doc->xref_count, 1);
+        if (!src->hashes || !src->hash_state) {
+            copy->failed = 1;
+            return pdf_copy_identity(source, num);
+        }
+    }
+    if (src->hash_state[num] == PDF_HASH_DONE) return src->hashes[num];
+
+    // Cycles, very deep chains and page-tree nodes keep their identity
+    if (src->hash_state[num] == PDF_HASH_BUSY || depth > 256 || pdf_is_page_node(doc, num)) {
+        return pdf_copy_identity(source, num);
+    }
+
+    src->hash_state[num] = PDF_HASH_BUSY;
+    PdfHash h = { 0x243f6a8885a308d3ULL, 0x13198a2e03707344ULL };
+    pdf_copy_hash_value(copy, source, pdf_get_object(doc, num), &h, depth);
+    src->hashes[num] = h;
+    src->hash_state[num] = PDF_HASH_DONE;
+    return h;
+}
+
+static int pdf_copy_table_find(PdfCopy* copy, PdfHash key, int insert_value) {
+    if (copy->table_count * 2 >= copy->table_capacity) {
+        int capacity = copy->table_capacity ? copy->table_capacity * 2 : 1024;
+        PdfHash* keys = (PdfHash*)calloc((size_t)capacity, sizeof(PdfHash));
+        int* values = (int*)calloc((size_t)capacity, sizeof(int));
+        if (!keys || !values) {
+            free(keys);
+            free(values);
+            copy->failed = 1;
+            return 0;
+        }
+        for (int i = 0; i < copy->table_capacity; i++) {
+            if (!copy->table_values[i]) continue;
+            int slot = (int)(copy->table_keys[i].lo & (uint64_t)(capacity - 1));
+            while (values[slot]) slot = (slot + 1) & (capacity - 1);
+            keys[slot] = copy->table_keys[i];
+            values[slot] = copy->table_values[i];
+        }
+        free(copy->table_keys);
+        free(copy->table_values);
+        copy->table_keys = keys;
+        copy->table_values = values;
+        copy->table_capacity = capacity;
+    }
+
+    int slot = (int)(key.lo & (uint64_t)(copy->table_capacity - 1));
+    while (copy->table_values[slot]) {
+        if (copy->table_keys[slot].lo == key.lo && copy->table_keys[slot].hi == key.hi) {
+            return copy->table_values[slot];
+        }
+        slot = (slot + 1) & (copy->table_capacity - 1);
+    }
+    if (insert_value) {
+        copy->table_keys[slot] = key;
+        copy->table_values[slot] = insert_value;
+        copy->table_count++;
+    }
+    return 0;
+}
+
+// Give a referenced source object an output number, reusing a duplicate if one exists
+static void pdf_copy_reference(PdfCopy* copy, int source, int num) {
+    PdfCopySource* src = &copy->sources[source];
+    if (num <= 0 || num >= src->doc->xref_count || src->map[num]) return;
+    if (!pdf_get_object(src->doc, num)) return;
+    if (!copy->keep_page_tree && pdf_is_page_node(src->doc, num)) return;
+
+    if (copy->dedup) {
+        PdfHash h = pdf_copy_hash_object(copy, source, num, 0);
+        int existing = pdf_copy_table_find(copy, h, 0);
+        if (existing) {
+            src->map[num] = existing;
+            return;
+        }
+        int out_num = pdf_copy_new_object(copy, source, num, -1);
+        if (!out_num) return;
+        src->map[num] = out_num;
+        pdf_copy_table_find(copy, h, out_num);
+        pdf_copy_push_work(copy, out_num);
+        return;
+    }
+
+    int out_num = pdf_copy_new_object(copy, source, num, -1);
+    if (!out_num) return;
+    src->map[num] = out_num;
+    pdf_copy_push_work(copy, out_num);
+}
+
+static void pdf_copy_scan(PdfCopy* copy, int source, PdfObj* obj, int depth) {
+    if (!obj || depth > PDF_MAX_DEPTH) return;
+    switch (obj->type) {
+        case PDF_REF:
+            pdf_copy_reference(copy, source, obj->u.ref.num);
+            break;
+        case PDF_ARRAY:
+            for (int i = 0; i < obj->u.array.count; i++) pdf_copy_scan(copy, source, obj->u.array.items[i], depth + 1);
+            break;
+        case PDF_DICT:
+            for (int i = 0; i < obj->u.dict.count; i++) pdf_copy_scan(copy, source, obj->u.dict.values[i], depth + 1);
+            break;
+        case PDF_STREAM:
+            pdf_copy_scan(copy, source, obj->u.stream.dict, depth + 1);
+            break;
+        default:
+            break;
+    }
+}
+
+// Follow references until the closure is complete
+static void pdf_copy_drain(PdfCopy* copy) {
+    while (copy->work_count > 0 && !copy->failed) {
+        int out_num = copy->work[--copy->work_count];
+        PdfCopyEntry entry = copy->objects[out_num - 1];
+        pdf_copy_scan(copy, entry.doc, pdf_get_object(copy->sources[entry.doc].doc, entry.num), 0);
+    }
+}
+
+/**
+ * Add an object of source `source` (and everything it references) to the copy
+ * @return output object number, or 0 if it could not be copied
+ */
+static int pdf_copy_add_object(PdfCopy* copy, int source, int num) {
+    pdf_copy_reference(copy, source, num);
+    pdf_copy_drain(copy);
+    if (copy->failed || num <= 0 || num >= copy->sources[source].doc->xref_count) return 0;
+    return copy->sources[source].map[num];
+}
+
+/**
+ * Add page `page_index` of source `source` (and everything it uses) to the copy
+ * @return -1 on error, 0 on success
+ */
+static int pdf_copy_add_page(PdfCopy* copy, int source, int page_index) {
+    PdfCopySource* src = &copy->sources[source];
+    PdfPage* page = &src->doc->pages[page_index];
+
+    int out_num = pdf_copy_new_object(copy, source, page->num, page_index);
+    if (!out_num) return -1;
+    if (page->num > 0 && !src->map[page->num]) src->map[page->num] = out_num;
+
+    if (copy->page_count == copy->page_capacity) {
+        int capacity = copy->page_capacity ? copy->page_capacity * 2 : 64;
+        int* grown = (int*)realloc(copy->page_objects, sizeof(int) * capacity);
+        if (!grown) return -1;
+        copy->page_objects = grown;
+        copy->page_capacity = capacity;
+    }
+    copy->page_objects[copy->page_count++] = out_num;
+
+    pdf_copy_scan(copy, source, page->dict, 0);
+    pdf_copy_scan(copy, source, page->resources, 0);
+    pdf_copy_scan(copy, source, page->media_box, 0);
+    pdf_copy_scan(copy, source, page->crop_box, 0);
+    pdf_copy_scan(copy, source, page->rotate, 0);
+    pdf_copy_drain(copy);
+    return copy->failed ? -1 : 0;
+}
+
+static int pdf_copy_map_ref(void* ctx, int num) {
+    PdfCopy* copy = (PdfCopy*)ctx;
+    PdfCopySource* src = &copy->sources[copy->current_source];
+    if (num <= 0 || num >= src->doc->xref_count) return 0;
+    return src->map[num];
+}
+
+static void pdf_copy_put_page(PdfCopy* copy, PdfWriter* w, int out_num, const PdfCopyEntry* entry) {
+    static const char* const skip[] = { "Parent" };
+    PdfPage* page = &copy->sources[entry->doc].doc->pages[entry->page];
+
+    pdf_put_int(w, out_num);
+    pdf_puts(w, " 0 obj\n");
+    pdf_put_dict_open(w, page->dict, skip, 1, pdf_copy_map_ref, copy, 0);
+
+    // Attributes inherited from the old tree must now live on the page itself
+    const char* keys[] = { "Resources", "MediaBox", "CropBox", "Rotate" };
+    PdfObj* values[] = { page->resources, page->media_box, page->crop_box, page->rotate };
+    for (int i = 0; i < 4; i++) {
+        if (!values[i] || pdf_dict_get_raw(page->dict, keys[i])) continue;
+        pdf_put_name(w, keys[i]);
+        pdf_put(w, " ", 1);
+        pdf_put_value(w, values[i], pdf_copy_map_ref, copy, 1);
+    }
+    if (!page->media_box && !pdf_dict_get_raw(page->dict, "MediaBox")) {
+        pdf_puts(w, "/MediaBox [0 0 612 792]"); // required; fall back to US Letter
+    }
+    pdf_puts(w, "/Parent 2 0 R>>\nendobj\n");
+}
+
+/**
+ * Serialise the copied pages as a complete PDF with a fresh xref
+ * @return bytes the document needs (may exceed w->capacity), or -1 on error
+ */
+static int64_t pdf_copy_write(PdfCopy* copy, PdfWriter* w) {
+    ZELL_STATS_STAGE(ZELL_STAGE_WRITE, "pdf_copy_write");
+    if (copy->failed) return -1;
+
+    int64_t* offsets = (int64_t*)malloc(sizeof(int64_t) * (copy->object_count + 1));
+    if (!offsets) return -1;
+
+    pdf_put_header(w);
+
+    offsets[1] = w->length;
+    pdf_puts(w, "1 0 obj\n<</Type/Catalog/Pages 2 0 R>>\nendobj\n");
+
+    offsets[2] = w->length;
+    pdf_puts(w, "2 0 obj\n<</Type/Pages/Count ");
+    pdf_put_int(w, copy->page_count);
+    pdf_puts(w, "/Kids[");
+    for (int i = 0; i < copy->page_count; i++) {
+        if (i) pdf_put(w, " ", 1);
+        pdf_put_int(w, copy->page_objects[i]);
+        pdf_puts(w, " 0 R");
+    }
+    pdf_puts(w, "]>>\nendobj\n");
+
+    for (int i = 2; i < copy->object_count; i++) {
+        const PdfCopyEntry* entry = &copy->objects[i];
+        int out_num = i + 1;
+        copy->current_source = entry->doc;
+        offsets[out_num] = w->length;
+
+        if (entry->page >= 0) {
+            pdf_copy_put_page(copy, w, out_num, entry);
+        } else {
+            PdfDoc* doc = copy->sources[entry->doc].doc;
+            pdf_put_indirect(w, doc, out_num, pdf_get_object(doc, entry->num), pdf_copy_map_ref, copy);
+        }
+    }
+
+    pdf_put_xref(w, offsets, copy->object_count, 1);
+    free(offsets);
+    return w->length;
+}
+
+// --- Page scheduling -------------------------------------------------------
+//
+// Per-page (or per-object) work on an opened document is split in two.  A
+// serial step resolves everything the work will read, since materialising
+// objects mutates the lazy cache; once an object is cached, looking it up is
+// a plain read, so the work itself can then be sharded across a thread pool
+// that shares the document.  Each task writes to its own slot and the caller
+// combines the slots in order, so results never depend on thread timing.
+
+typedef void (*PdfTaskFn)(void* ctx, int index);
+
+typedef struct {
+    PdfTaskFn run;
+    void* ctx;
+    int count;
+    int next;              // next unclaimed task
+} PdfScheduler;
+
+#ifdef ZELL_HAVE_THREADS
+static void* pdf_scheduler_worker(void* arg) {
+    PdfScheduler* scheduler = (PdfScheduler*)arg;
+    for (;;) {
+        // Tasks are claimed one at a time: pages vary too much for fixed shards
+        int index = __atomic_fetch_add(&scheduler->next, 1, __ATOMIC_RELAXED);
+        if (index >= scheduler->count) break;
+        ZELL_STATS_WORKER();
+        scheduler->run(scheduler->ctx, index);
+    }
+    return NULL;
+}
+#endif
+
+/**
+ * Run run(ctx, i) for every i in [0, count), spread over a thread pool
+ * @param doc - Document the tasks read; a source that cannot be read from
+ *              several threads at once keeps them on the calling thread
+ * @param num_threads - Worker count (0 = one per core, 1 = run inline)
+ */
+static void pdf_parallel_for(PdfDoc* doc, int count, int num_threads, PdfTaskFn run, void* ctx) {
+    int threads = doc->source.concurrent ? zell_resolve_threads(num_threads) : 1;
+    if (threads > count) threads = count;
+
+#ifdef ZELL_HAVE_THREADS
+    if (threads > 1) {
+        ZELL_STATS_PARALLEL(threads);
+        PdfScheduler scheduler = { run, ctx, count, 0 };
+        pthread_t workers[ZELL_MAX_THREADS];
+        int started = 0;
+        for (; started < threads - 1; started++) {
+            if (pthread_create(&workers[started], NULL, pdf_scheduler_worker, &scheduler) != 0) break;
+        }
+        // The calling thread works too, so a failed spawn only costs speed
+        pdf_scheduler_worker(&scheduler);
+        for (int i = 0; i < started; i++) pthread_join(workers[i], NULL);
+        return;
+    }
+#endif
+    for (int i = 0; i < count; i++) run(ctx, i);
+}
+
+/**
+ * Resolve an object and, `levels` deep, everything it contains, so that
+ * later reads from worker threads only hit the object cache
+ * @return -1 if a reference on the way does not resolve, else 0
+ */
+static int pdf_touch(PdfDoc* doc, PdfObj* obj, int levels) {
+    if (!obj) return 0;
+    PdfObj* value = pdf_resolve(doc, obj);
+    if (!value) return -1;
+    if (levels <= 0) return 0;
+    if (value->type == PDF_STREAM) value = value->u.stream.dict;
+    if (value->type == PDF_ARRAY) {
+        for (int i = 0; i < value->u.array.count; i++) {
+            if (pdf_touch(doc, value->u.array.items[i], levels - 1) != 0) return -1;
+        }
+    } else if (value->type == PDF_DICT) {
+        for (int i = 0; i < value->u.dict.count; i++) {
+            if (pdf_touch(doc, value->u.dict.values[i], levels - 1) != 0) return -1;
+        }
+    }
+    return 0;
+}
+
+// Make a stream decodable off the main thread (its filters and their parameters)
+static int pdf_touch_stream(PdfDoc* doc, PdfObj* stream) {
+    if (pdf_touch(doc, pdf_dict_get_raw(stream, "Filter"), 1) != 0) return -1;
+    return pdf_touch(doc, pdf_dict_get_raw(stream, "DecodeParms"), 2);
+}
+
+// --- Optimisation ----------------------------------------------------------
+//
+// The optimiser rewrites everything reachable from the catalog and the info
+// dictionary (deduplicated, renumbered) as a PDF 1.5 file: plain objects are
+// packed into object streams, the xref becomes a predicted xref stream,
+// Flate streams are re-deflated at the highest deflate level, unfiltered streams
+// are deflated, and images sharper than the target resolution are
+// downsampled and re-encoded as JPEG by the image module.
+
+#define PDF_OBJSTM_SIZE 128
+#define PDF_MIN_IMAGE_SIDE 64
+
+typedef struct {
+    int image_quality;     // JPEG quality for resampled images (0 = leave images alone)
+    int target_dpi;        // resample images above this resolution (0 = never)
+    int flate_level;
+    double page_extent;    // longest page side in the document, in points
+    int num_threads;       // workers recompressing streams (0 = one per core)
+} PdfOptimizeOptions;
+
+// Replacement payload for a stream the optimiser managed to shrink
+typedef struct {
+    unsigned char* data;
+    size_t size;
+    const char* filter;    // filter the new bytes need, NULL for none
+    int drop_parms;        // the old DecodeParms no longer apply
+    int width;             // new dimensions when the image was resampled, else 0
+    int height;
+} PdfStreamEdit;
+
+static unsigned char* pdf_deflate(const unsigned char* data, size_t size, int level, size_t* out_size) {
+    ZELL_STATS_STAGE(ZELL_STAGE_ENCODE, "pdf_deflate");
+    size_t capacity = zell_deflate_bound(size);
+    unsigned char* out = (unsigned char*)zell_pool_get(capacity);
+    if (!out) return NULL;
+    int64_t written = zell_deflate(data, size, level, ZELL_DEFLATE_ZLIB, out, capacity);
+    if (written < 0) {
+        zell_pool_put(out);
+        return NULL;
+    }
+    *out_size = (size_t)written;
+    return out;
+}
+
+// The filter of a stream: NULL for none, "" for a chain or anything odd
+static const char* pdf_stream_filter(PdfDoc* doc, PdfObj* stream) {
+    PdfObj* filter = pdf_dict_get(doc, stream, "Filter");
+    if (!filter || filter->type == PDF_NULL) return NULL;
+    if (filter->type == PDF_ARRAY) {
+        if (filter->u.array.count == 0) return NULL;
+        if (filter->u.array.count > 1) return "";
+        filter = pdf_resolve(doc, filter->u.array.items[0]);
+    }
+    if (!filter || filter->type != PDF_NAME) return "";
+    if (!strcmp(filter->u.name, "Fl")) return "FlateDecode";
+    if (!strcmp(filter->u.name, "DCT")) return "DCTDecode";
+    return filter->u.name;
+}
+
+// Components per pixel of an image color space we can resample, else 0
+static int pdf_image_components(PdfDoc* doc, PdfObj* color_space) {
+    if (pdf_is_name(color_space, "DeviceGray") || pdf_is_name(color_space, "G")) return 1;
+    if (pdf_is_name(color_space, "DeviceRGB") || pdf_is_name(color_space, "RGB")) return 3;
+    if (color_space && color_space->type == PDF_ARRAY && color_space->u.array.count == 2 &&
+        pdf_is_name(pdf_resolve(doc, color_space->u.array.items[0]), "ICCBased")) {
+        PdfObj* profile = pdf_resolve(doc, color_space->u.array.items[1]);
+        int n = (int)pdf_to_int(pdf_dict_get(doc, profile, "N"), 0);
+        return n == 1 || n == 3 ? n : 0;
+    }
+    return 0;
+}
+
+/**
+ * Downsample an image XObject that is sharper than the target resolution
+ * @return 1 if `edit` now holds a smaller JPEG replacement, else 0
+ */
+static int pdf_optimize_image(PdfDoc* doc, PdfObj* stream, const char* filter,
+                              const PdfOptimizeOptions* options, PdfStreamEdit* edit) {
+    ZELL_STATS_STAGE(ZELL_STAGE_TRANSFORM, "pdf_optimize_image");
+    if (options->image_quality <= 0 || options->target_dpi <= 0 || options->page_extent <= 0) return 0;
+    if (filter && strcmp(filter, "DCTDecode") != 0 && strcmp(filter, "FlateDecode") != 0) return 0;
+
+    PdfObj* image_mask = pdf_dict_get(doc, stream, "ImageMask");
+    PdfObj* mask = pdf_dict_get(doc, stream, "Mask");
+    if ((image_mask && image_mask->type == PDF_BOOL && image_mask->u.boolean) ||
+        (mask && mask->type == PDF_ARRAY)) {
+        return 0; // stencils and color-key masks need exact sample values
+    }
+
+    int width = (int)pdf_to_int(pdf_dict_get(doc, stream, "Width"), 0);
+    int height = (int)pdf_to_int(pdf_dict_get(doc, stream, "Height"), 0);
+    int bpc = (int)pdf_to_int(pdf_dict_get(doc, stream, "BitsPerComponent"), 8);
+    int channels = pdf_image_components(doc, pdf_dict_get(doc, stream, "ColorSpace"));
+    if (width < PDF_MIN_IMAGE_SIDE || height < PDF_MIN_IMAGE_SIDE || bpc != 8 || channels == 0) return 0;
+
+    // Placement is not tracked, so assume the image spans the largest page
+    // side: a lower bound on its real resolution, which never over-shrinks
+    int short_side = width < height ? width : height;
+    double scale = options->target_dpi * options->page_extent / (72.0 * short_side);
+    if (scale > 0.9) return 0;
+    int new_width = (int)ceil(width * scale);
+    int new_height = (int)ceil(height * scale);
+
+    size_t raw_size = (size_t)stream->u.stream.length;
+    unsigned char* pixels = NULL;
+    int decoded_jpeg = 0;  // pixels from decode_jpeg are malloc'd, the rest pooled
+    int ok = 0;
+    if (raw_size == 0) return 0;
+
+    if (filter && !strcmp(filter, "DCTDecode")) {
+        PdfSpan span;
+        int w = 0, h = 0, c = 0;
+        const unsigned char* raw = pdf_stream_raw(doc, stream, &raw_size, &span);
+        pixels = raw ? decode_jpeg(raw, (int64_t)raw_size, &w, &h, &c) : NULL;
+        decoded_jpeg = 1;
+        pdf_span_release(&span);
+        ok = pixels && w == width && h == height && c == channels;
+    } else {
+        size_t size = 0;
+        pixels = pdf_decode_stream(doc, stream, &size);
+        ok = pixels && size >= (size_t)width * height * channels;
+    }
+
+    unsigned char* resized = ok ? (unsigned char*)zell_pool_get((size_t)new_width * new_height * channels) : NULL;
+    unsigned char* jpeg = resized ? (unsigned char*)zell_pool_get(raw_size) : NULL;
+    int64_t jpeg_size = -1;
+    if (jpeg && resize_image(pixels, width, height, resized, new_width, new_height, channels) == 0) {
+        // Only accept the result if it beats the original encoding
+        jpeg_size = encode_jpeg(resized, new_width, new_height, channels, options->image_quality,
+                                jpeg, (int64_t)raw_size);
+    }
+    if (decoded_jpeg) free(pixels);
+    else zell_pool_put(pixels);
+    zell_pool_put(resized);
+
+    if (jpeg_size <= 0) {
+        zell_pool_put(jpeg);
+        return 0;
+    }
+    edit->data = jpeg;
+    edit->size = (size_t)jpeg_size;
+    edit->filter = "DCTDecode";
+    edit->drop_parms = 1;
+    edit->width = new_width;
+    edit->height = new_height;
+    return 1;
+}
+
+// Find a smaller encoding for a stream; leaves `edit` empty if there is none
+static void pdf_optimize_stream(PdfDoc* doc, PdfObj* stream, const PdfOptimizeOptions* options,
+                                PdfStreamEdit* edit) {
+    const char* filter = pdf_stream_filter(doc, stream);
+
+    memset(edit, 0, sizeof(*edit));
+    if (stream->u.stream.length <= 0) return;
+    if (pdf_is_name(pdf_dict_get(doc, stream, "Subtype"), "Image") &&
+        pdf_optimize_image(doc, stream, filter, options, edit)) {
+        return;
+    }
+    // XMP metadata is conventionally left uncompressed so tools can find it
+    if (pdf_is_name(pdf_dict_get(doc, stream, "Type"), "Metadata")) return;
+    if (filter && strcmp(filter, "FlateDecode") != 0) return;
+
+    PdfSpan span;
+    size_t raw_size = 0;
+    const unsigned char* raw = pdf_stream_raw(doc, stream, &raw_size, &span);
+    if (!raw) return;
+
+    unsigned char* plain = NULL;
+    size_t plain_size = raw_size;
+    int complete = 1;
+    if (filter) {
+        plain = pdf_inflate(raw, raw_size, &plain_size, &complete);
+    }
+    // Damaged streams are copied byte for byte
+    unsigned char* packed = NULL;
+    size_t packed_size = 0;
+    if (complete && (plain || !filter)) {
+        packed = pdf_deflate(plain ? plain : raw, plain_size, options->flate_level, &packed_size);
+    }
+    zell_pool_put(plain);
+    pdf_span_release(&span);
+
+    if (packed && packed_size < raw_size) {
+        edit->data = packed;
+        edit->size = packed_size;
+        edit->filter = "FlateDecode";
+        return;
+    }
+    zell_pool_put(packed);
+}
+
+static void pdf_put_stream_edit(PdfWriter* w, int num, PdfObj* stream,
+                                const PdfStreamEdit* edit, PdfRefMap map, void* ctx) {
+    static const char* const skip[] = { "Length", "Filter", "DecodeParms", "Width", "Height", "BitsPerComponent" };
+    int skip_count = edit->width > 0 ? 6 : edit->drop_parms ? 3 : 2;
+
+    pdf_put_int(w, num);
+    pdf_puts(w, " 0 obj\n");
+    pdf_put_dict_open(w, stream->u.stream.dict, skip, skip_count, map, ctx, 0);
+    if (edit->filter) {
+        pdf_puts(w, "/Filter");
+        pdf_put_name(w, edit->filter);
+    }
+    if (!edit->drop_parms) {
+        PdfObj* parms = pdf_dict_get_raw(stream, "DecodeParms");
+        if (parms) {
+            pdf_puts(w, "/DecodeParms ");
+            pdf_put_value(w, parms, map, ctx, 1);
+        }
+    }
+    if (edit->width > 0) {
+        pdf_puts(w, "/Width ");
+        pdf_put_int(w, edit->width);
+        pdf_puts(w, "/Height ");
+        pdf_put_int(w, edit->height);
+        pdf_puts(w, "/BitsPerComponent 8");
+    }
+    pdf_puts(w, "/Length ");
+    pdf_put_int(w, (int64_t)edit->size);
+    pdf_puts(w, ">>\nstream\n");
+    pdf_put(w, edit->data, edit->size);
+    pdf_puts(w, "\nendstream\nendobj\n");
+}
+
+// Streams are recompressed ahead of the write loop, on the page scheduler
+typedef struct {
+    PdfObj* stream;        // NULL for objects that are not streams
+    int serial;            // reads objects that could not be resolved up front
+    PdfStreamEdit edit;
+} PdfStreamTask;
+
+typedef struct {
+    PdfDoc* doc;
+    const PdfOptimizeOptions* options;
+    PdfStreamTask* tasks;
+} PdfStreamJob;
+
+static void pdf_optimize_stream_task(void* ctx, int index) {
+    PdfStreamJob* job = (PdfStreamJob*)ctx;
+    PdfStreamTask* task = &job->tasks[index];
+    if (task->stream && !task->serial) pdf_optimize_stream(job->doc, task->stream, job->options, &task->edit);
+}
+
+// Compress `body` and write it as a stream object with the given dictionary entries
+static void pdf_put_flate_object(PdfWriter* w, int num, const char* entries,
+                                 const unsigned char* body, size_t size, int level) {
+    size_t packed_size = 0;
+    unsigned char* packed = pdf_deflate(body, size, level, &packed_size);
+
+    pdf_put_int(w, num);
+    pdf_puts(w, " 0 obj\n<<");
+    pdf_puts(w, entries);
+    if (packed) pdf_puts(w, "/Filter/FlateDecode");
+    pdf_puts(w, "/Length ");
+    pdf_put_int(w, (int64_t)(packed ? packed_size : size));
+    pdf_puts(w, ">>\nstream\n");
+    pdf_put(w, packed ? packed : body, packed ? packed_size : size);
+    pdf_puts(w, "\nendstream\nendobj\n");
+    zell_pool_put(packed);
+}
+
+typedef struct {
+    PdfWriter index;       // "num offset" pairs
+    PdfWriter body;        // the objects themselves
+    int count;
+    int num;               // object number the stream will be written as
+} PdfObjStmBuilder;
+
+static void pdf_flush_objstm(PdfWriter* w, PdfObjStmBuilder* stm, int level) {
+    if (stm->count == 0) return;
+
+    char entries[96];
+    snprintf(entries, sizeof(entries), "/Type/ObjStm/N %d/First %lld",
+             stm->count, (long long)stm->index.length);
+    pdf_put(&stm->index, stm->body.data, (size_t)stm->body.length);
+    pdf_put_flate_object(w, stm->num, entries, stm->index.data, (size_t)stm->index.length, level);
+
+    stm->index.length = 0;
+    stm->body.length = 0;
+    stm->count = 0;
+}
+
+/**
+ * Write an xref stream as object count-1, covering objects 0..count-1, and finish the file
+ * @param kinds - Entry type per object (0 free, 1 offset, 2 in object stream)
+ * @param fields - Offset, or containing object stream number
+ * @param slots - Index inside the object stream
+ */
+static void pdf_put_xref_stream(PdfWriter* w, unsigned char* kinds, int64_t* fields,
+                                int* slots, int count, const char* trailer_entries, int level) {
+    int64_t xref_offset = w->length;
+    int64_t largest = xref_offset;
+
+    kinds[count - 1] = 1;
+    fields[count - 1] = xref_offset;
+    slots[count - 1] = 0;
+    for (int i = 0; i < count; i++) {
+        if (fields[i] > largest) largest = fields[i];
+    }
+    int field_bytes = 1;
+    while (field_bytes < 8 && (largest >> (field_bytes * 8)) != 0) field_bytes++;
+
+    // Rows are PNG "Up"-predicted: successive offsets share their high bytes,
+    // which deflate then squeezes to almost nothing
+    int columns = 1 + field_bytes + 2;
+    size_t table_size = (size_t)count * (columns + 1);
+    unsigned char* table = (unsigned char*)calloc(table_size, 1);
+    unsigned char previous[1 + 8 + 2] = { 0 };
+    unsigned char row[1 + 8 + 2];
+
+    for (int i = 0; table && i < count; i++) {
+        int64_t field = fields[i];
+        row[0] = kinds[i];
+        for (int b = 0; b < field_bytes; b++) row[1 + b] = (unsigned char)(field >> (8 * (field_bytes - 1 - b)));
+        row[1 + field_bytes] = (unsigned char)(slots[i] >> 8);
+        row[2 + field_bytes] = (unsigned char)slots[i];
+
+        unsigned char* out = table + (size_t)i * (columns + 1);
+        out[0] = 2;
+        for (int c = 0; c < columns; c++) out[1 + c] = (unsigned char)(row[c] - previous[c]);
+        memcpy(previous, row, (size_t)columns);
+    }
+
+    char entries[512];
+    snprintf(entries, sizeof(entries), "/Type/XRef/Size %d/W[1 %d 2]%s/DecodeParms<</Predictor 12/Columns %d>>",
+             count, field_bytes, trailer_entries, columns);
+    pdf_put_flate_object(w, count - 1, entries, table ? table : (const unsigned char*)"", table ? table_size : 0, level);
+    free(table);
+
+    pdf_puts(w, "startxref\n");
+    pdf_put_int(w, xref_offset);
+    pdf_puts(w, "\n%%EOF\n");
+}
+
+/**
+ * Rewrite an opened document into `w` with the given optimisations
+ * @return bytes the document needs (may exceed w->capacity), or -1 on error
+ */
+static int64_t pdf_optimize(PdfDoc* doc, PdfWriter* w, const PdfOptimizeOptions* options) {
+    PdfCopy copy;
+    int64_t result = -1;
+
+    if (doc->encrypted) return -1;
+    if (pdf_copy_init(&copy, &doc, 1, 1) != 0) {
+        pdf_copy_free(&copy);
+        return -1;
+    }
+    copy.object_count = 0;
+    copy.keep_page_tree = 1;
+
+    PdfObj* root_ref = pdf_dict_get_raw(doc->trailer, "Root");
+    PdfObj* info_ref = pdf_dict_get_raw(doc->trailer, "Info");
+    int root = root_ref && root_ref->type == PDF_REF ? pdf_copy_add_object(&copy, 0, root_ref->u.ref.num) : 0;
+    int info = info_ref && info_ref->type == PDF_REF ? pdf_copy_add_object(&copy, 0, info_ref->u.ref.num) : 0;
+    if (!root) {
+        pdf_copy_free(&copy);
+        return -1;
+    }
+
+    // Output numbers: copied objects, then object streams, then the xref stream
+    int plain_count = 0;
+    for (int i = 0; i < copy.object_count; i++) {
+        PdfObj* obj = pdf_get_object(doc, copy.objects[i].num);
+        if (!obj || obj->type != PDF_STREAM) plain_count++;
+    }
+    int stm_count = (plain_count + PDF_OBJSTM_SIZE - 1) / PDF_OBJSTM_SIZE;
+    int total = copy.object_count + stm_count + 2; // + object 0 and the xref stream
+
+    unsigned char* kinds = (unsigned char*)calloc((size_t)total, 1);
+    int64_t* fields = (int64_t*)calloc((size_t)total, sizeof(int64_t));
+    int* slots = (int*)calloc((size_t)total, sizeof(int));
+    PdfObjStmBuilder stm;
+    memset(&stm, 0, sizeof(stm));
+    stm.index.growable = 1;
+    stm.body.growable = 1;
+    stm.num = copy.object_count + 1;
+
+    // Stream dictionaries are resolved three levels deep: far enough for
+    // filter parameters and an image's ICC profile
+    PdfStreamTask* tasks = (PdfStreamTask*)calloc((size_t)copy.object_count + 1, sizeof(PdfStreamTask));
+    for (int i = 0; tasks && i < copy.object_count; i++) {
+        PdfObj* obj = pdf_get_object(doc, copy.objects[i].num);
+        if (!obj || obj->type != PDF_STREAM) continue;
+        tasks[i].stream = obj;
+        tasks[i].serial = pdf_touch(doc, obj, 3) != 0;
+    }
+    if (tasks) {
+        PdfStreamJob job = { doc, options, tasks };
+        pdf_parallel_for(doc, copy.object_count, options->num_threads, pdf_optimize_stream_task, &job);
+        for (int i = 0; i < copy.object_count; i++) {
+            if (tasks[i].serial) pdf_optimize_stream(doc, tasks[i].stream, options, &tasks[i].edit);
+        }
+    }
+
+    if (kinds && fields && slots && tasks) {
+        ZELL_STATS_STAGE(ZELL_STAGE_WRITE, "pdf_write");
+        slots[0] = 0xffff;
+        pdf_put_header(w);
+
+        for (int i = 0; i < copy.object_count; i++) {
+            int num = i + 1;
+            PdfObj* obj = pdf_get_object(doc, copy.objects[i].num);
+
+            if (obj && obj->type == PDF_STREAM) {
+                PdfStreamEdit* edit = &tasks[i].edit;
+                kinds[num] = 1;
+                fields[num] = w->length;
+                if (edit->data) {
+                    pdf_put_stream_edit(w, num, obj, edit, pdf_copy_map_ref, &copy);
+                } else {
+                    pdf_put_indirect(w, doc, num, obj, pdf_copy_map_ref, &copy);
+                }
+                continue;
+            }
+
+            kinds[num] = 2;
+            fields[num] = stm.num;
+            slots[num] = stm.count;
+            pdf_put_int(&stm.index, num);
+            pdf_put(&stm.index, " ", 1);
+            pdf_put_int(&stm.index, stm.body.length);
+            pdf_put(&stm.index, " ", 1);
+            pdf_put_value(&stm.body, obj, pdf_copy_map_ref, &copy, 0);
+            pdf_put(&stm.body, "\n", 1);
+
+            if (++stm.count == PDF_OBJSTM_SIZE) {
+                kinds[stm.num] = 1;
+                fields[stm.num] = w->length;
+                pdf_flush_objstm(w, &stm, options->flate_level);
+                stm.num++;
+            }
+        }
+        if (stm.count > 0) {
+            kinds[stm.num] = 1;
+            fields[stm.num] = w->length;
+            pdf_flush_objstm(w, &stm, options->flate_level);
+        }
+
+        char trailer[256];
+        int length = snprintf(trailer, sizeof(trailer), "/Root %d 0 R", root);
+        if (info) length += snprintf(trailer + length, sizeof(trailer) - length, "/Info %d 0 R", info);
+
+        // Keep the file identifier: viewers use it to match annotations and caches
+        PdfObj* id = pdf_dict_get(doc, doc->trailer, "ID");
+        PdfWriter id_writer = { (unsigned char*)trailer + length, (int64_t)sizeof(trailer) - length - 1, 0, 0, NULL };
+        if (id && id->type == PDF_ARRAY) {
+            pdf_puts(&id_writer, "/ID");
+            pdf_put_value(&id_writer, id, NULL, NULL, 0);
+            if (id_writer.length <= id_writer.capacity) length += (int)id_writer.length;
+        }
+        trailer[length] = '\0';
+
+        if (stm.index.length <= stm.index.capacity && stm.body.length <= stm.body.capacity) {
+            pdf_put_xref_stream(w, kinds, fields, slots, total, trailer, options->flate_level);
+            result = w->length;
+        }
+    }
+
+    for (int i = 0; tasks && i < copy.object_count; i++) zell_pool_put(tasks[i].edit.data);
+    free(tasks);
+    free(stm.index.data);
+    free(stm.body.data);
+    free(kinds);
+    free(fields);
+    free(slots);
+    pdf_copy_free(&copy);
+    return result;
+}
+
+// Longest page side in points, used to bound image resolution
+static double pdf_page_extent(PdfDoc* doc) {
+    double extent = 0;
+    for (int i = 0; i < doc->page_count; i++) {
+        PdfObj* box = pdf_resolve(doc, doc->pages[i].media_box);
+        if (!box || box->type != PDF_ARRAY || box->u.array.count != 4) continue;
+        double v[4];
+        for (int k = 0; k < 4; k++) {
+            PdfObj* item = pdf_resolve(doc, box->u.array.items[k]);
+            v[k] = !item ? 0 : item->type == PDF_REAL ? item->u.real : (double)pdf_to_int(item, 0);
+        }
+        double side = fmax(fabs(v[2] - v[0]), fabs(v[3] - v[1]));
+        if (side > extent) extent = side;
+    }
+    return extent;
+}
+
+// --- Text extraction -------------------------------------------------------
+//
+// Extraction runs in two phases.  The first walks every page on the calling
+// thread and resolves everything the content streams will need: the streams
+// themselves, fonts (encodings, ToUnicode CMaps, glyph widths) and form
+// XObjects.  That is the only part that touches the lazy object cache.  The
+// second phase inflates and interprets each page's content independently on
+// the page scheduler; page texts are joined in page order at the end.
+
+#define PDF_TEXT_MAX_FORM_DEPTH 8
+#define PDF_TEXT_MAX_OPERANDS 32
+#define PDF_CMAP_MAX_OPERANDS 512   // a CMap section holds at most 100 entries
+
+typedef struct {
+    uint32_t lo;
+    uint32_t hi;
+    uint32_t dst;          // first UTF-16 unit in PdfCMap.units
+    uint16_t dst_len;
+    uint16_t is_range;     // last unit advances with the code
+} PdfCMapEntry;
+
+typedef struct {
+    uint32_t lo;
+    uint32_t hi;
+    int bytes;
+} PdfCodeSpace;
+
+typedef struct {
+    PdfCMapEntry* entries;
+    int count;
+    int capacity;
+    uint16_t* units;
+    int unit_count;
+    int unit_capacity;
+    PdfCodeSpace spaces[16];
+    int space_count;
+} PdfCMap;
+
+typedef struct {
+    uint32_t lo;
+    uint32_t hi;
+    float width;
+} PdfWidthRange;
+
+typedef struct PdfFont {
+    int is_cid;               // Type0: multi-byte codes
+    int unicode_codes;        // Type0 with a Uni*-UCS2/UTF16 CMap: codes are UTF-16
+    PdfCMap* encoding;        // embedded CMap giving the code lengths (Type0 only)
+    PdfCMap* to_unicode;
+    uint16_t simple_map[256]; // simple fonts: code -> Unicode from /Encoding
+    float simple_widths[256]; // in 1/1000 of text space
+    PdfWidthRange* cid_widths;
+    int cid_width_count;
+    float default_width;
+    struct PdfFont* next;     // every font a job loaded, for freeing
+} PdfFont;
+
+typedef struct PdfTextResources PdfTextResources;
+
+typedef struct {
+    const char* name;
+    PdfFont* font;
+} PdfNamedFont;
+
+typedef struct {
+    const char* name;
+    PdfObj* stream;
+    PdfTextResources* resources;
+} PdfNamedForm;
+
+struct PdfTextResources {
+    PdfNamedFont* fonts;
+    int font_count;
+    PdfNamedForm* forms;
+    int form_count;
+};
+
+typedef struct {
+    PdfObj** contents;
+    int content_count;
+    PdfTextResources* resources;
+} PdfTextPage;
+
+typedef struct {
+    PdfDoc* doc;
+    PdfFont* fonts;                   // every loaded font
+    PdfFont** fonts_by_num;           // shared fonts, by object number
+    PdfTextResources** res_by_num;    // shared resource dictionaries, by object number
+    unsigned char* res_building;      // guards against resource cycles
+    void** owned;                     // every other allocation, freed together
+    int owned_count;
+    int owned_capacity;
+
+    PdfTextPage* pages;
+    PdfWriter* texts;                 // per-page output
+    int page_count;
+} PdfTextJob;
+
+static void* pdf_text_own(PdfTextJob* job, void* ptr) {
+    if (!ptr) return NULL;
+    if (job->owned_count == job->owned_capacity) {
+        int capacity = job->owned_capacity ? job->owned_capacity * 2 : 256;
+        void** grown = (void**)realloc(job->owned, sizeof(void*) * capacity);
+        if (!grown) {
+            free(ptr);
+            return NULL;
+        }
+        job->owned = grown;
+        job->owned_capacity = capacity;
+    }
+    job->owned[job->owned_count++] = ptr;
+    return ptr;
+}
+
+// --- Encodings ---
+
+static const uint16_t pdf_win_ansi_high[32] = {
+    0x20AC, 0, 0x201A, 0x0192, 0x201E, 0x2026, 0x2020, 0x2021,
+    0x02C6, 0x2030, 0x0160, 0x2039, 0x0152, 0, 0x017D, 0,
+    0, 0x2018, 0x2019, 0x201C, 0x201D, 0x2022, 0x2013, 0x2014,
+    0x02DC, 0x2122, 0x0161, 0x203A, 0x0153, 0, 0x017E, 0x0178
+};
+
+static const uint16_t pdf_mac_roman_high[128] = {
+    0x00C4, 0x00C5, 0x00C7, 0x00C9, 0x00D1, 0x00D6, 0x00DC, 0x00E1, 0x00E0, 0x00E2, 0x00E4, 0x00E3, 0x00E5, 0x00E7, 0x00E9, 0x00E8,
+    0x00EA, 0x00EB, 0x00ED, 0x00EC, 0x00EE, 0x00EF, 0x00F1, 0x00F3, 0x00F2, 0x00F4, 0x00F6, 0x00F5, 0x00FA, 0x00F9, 0x00FB, 0x00FC,
+    0x2020, 0x00B0, 0x00A2, 0x00A3, 0x00A7, 0x2022, 0x00B6, 0x00DF, 0x00AE, 0x00A9, 0x2122, 0x00B4, 0x00A8, 0x2260, 0x00C6, 0x00D8,
+    0x221E, 0x00B1, 0x2264, 0x2265, 0x00A5, 0x00B5, 0x2202, 0x2211, 0x220F, 0x03C0, 0x222B, 0x00AA, 0x00BA, 0x03A9, 0x00E6, 0x00F8,
+    0x00BF, 0x00A1, 0x00AC, 0x221A, 0x0192, 0x2248, 0x2206, 0x00AB, 0x00BB, 0x2026, 0x00A0, 0x00C0, 0x00C3, 0x00D5, 0x0152, 0x0153,
+    0x2013, 0x2014, 0x201C, 0x201D, 0x2018, 0x2019, 0x00F7, 0x25CA, 0x00FF, 0x0178, 0x2044, 0x20AC, 0x2039, 0x203A, 0xFB01, 0xFB02,
+    0x2021, 0x00B7, 0x201A, 0x201E, 0x2030, 0x00C2, 0x00CA, 0x00C1, 0x00CB, 0x00C8, 0x00CD, 0x00CE, 0x00CF, 0x00CC, 0x00D3, 0x00D4,
+    0xF8FF, 0x00D2, 0x00DA, 0x00DB, 0x00D9, 0x0131, 0x02C6, 0x02DC, 0x00AF, 0x02D8, 0x02D9, 0x02DA, 0x00B8, 0x02DD, 0x02DB, 0x02C7
+};
+
+// StandardEncoding differs from ASCII/Latin-1 in these codes
+static const uint16_t pdf_standard_pairs[][2] = {
+    { 0x27, 0x2019 }, { 0x60, 0x2018 },
+    { 0xA1, 0x00A1 }, { 0xA2, 0x00A2 }, { 0xA3, 0x00A3 }, { 0xA4, 0x2044 }, { 0xA5, 0x00A5 },
+    { 0xA6, 0x0192 }, { 0xA7, 0x00A7 }, { 0xA8, 0x00A4 }, { 0xA9, 0x0027 }, { 0xAA, 0x201C },
+    { 0xAB, 0x00AB }, { 0xAC, 0x2039 }, { 0xAD, 0x203A }, { 0xAE, 0xFB01 }, { 0xAF, 0xFB02 },
+    { 0xB1, 0x2013 }, { 0xB2, 0x2020 }, { 0xB3, 0x2021 }, { 0xB4, 0x00B7 }, { 0xB6, 0x00B6 },
+    { 0xB7, 0x2022 }, { 0xB8, 0x201A }, { 0xB9, 0x201E }, { 0xBA, 0x201D }, { 0xBB, 0x00BB },
+    { 0xBC, 0x2026 }, { 0xBD, 0x2030 }, { 0xBF, 0x00BF }, { 0xC1, 0x0060 }, { 0xC2, 0x00B4 },
+    { 0xC3, 0x02C6 }, { 0xC4, 0x02DC }, { 0xC5, 0x00AF }, { 0xC6, 0x02D8 }, { 0xC7, 0x02D9 },
+    { 0xC8, 0x00A8 }, { 0xCA, 0x02DA }, { 0xCB, 0x00B8 }, { 0xCD, 0x02DD }, { 0xCE, 0x02DB },
+    { 0xCF, 0x02C7 }, { 0xD0, 0x2014 }, { 0xE1, 0x00C6 }, { 0xE3, 0x00AA }, { 0xE8, 0x0141 },
+    { 0xE9, 0x00D8 }, { 0xEA, 0x0152 }, { 0xEB, 0x00BA }, { 0xF1, 0x00E6 }, { 0xF5, 0x0131 },
+    { 0xF8, 0x0142 }, { 0xF9, 0x00F8 }, { 0xFA, 0x0153 }, { 0xFB, 0x00DF }
+};
+
+// Glyph names for 0x20-0x7E and 0xA1-0xFF (Latin-1 code points)
+static const char* const pdf_ascii_glyphs[95] = {
+    "space", "exclam", "quotedbl", "numbersign", "dollar", "percent", "ampersand", "quotesingle",
+    "parenleft", "parenright", "asterisk", "plus", "comma", "hyphen", "period", "slash",
+    "zero", "one", "two", "three", "four", "five", "six", "seven", "eight", "nine",
+    "colon", "semicolon", "less", "equal", "greater", "question", "at",
+    "A", "B", "C", "D", "E", "F", "G", "H", "I", "J", "K", "L", "M", "N", "O", "P", "Q", "R",
+    "S", "T", "U", "V", "W", "X", "Y", "Z",
+    "bracketleft", "backslash", "bracketright", "asciicircum", "underscore", "grave",
+    "a", "b", "c", "d", "e", "f", "g", "h", "i", "j", "k", "l", "m", "n", "o", "p", "q", "r",
+    "s", "t", "u", "v", "w", "x", "y", "z",
+    "braceleft", "bar", "braceright", "asciitilde"
+};
+
+static const char* const pdf_latin1_glyphs[95] = {
+    "exclamdown", "cent", "sterling", "currency", "yen", "brokenbar", "section", "dieresis",
+    "copyright", "ordfeminine", "guillemotleft", "logicalnot", "sfthyphen", "registered", "macron",
+    "degree", "plusminus", "twosuperior", "threesuperior", "acute", "mu", "paragraph",
+    "periodcentered", "cedilla", "onesuperior", "ordmasculine", "guillemotright", "onequarter",
+    "onehalf", "threequarters", "questiondown",
+    "Agrave", "Aacute", "Acircumflex", "Atilde", "Adieresis", "Aring", "AE", "Ccedilla",
+    "Egrave", "Eacute", "Ecircumflex", "Edieresis", "Igrave", "Iacute", "Icircumflex", "Idieresis",
+    "Eth", "Ntilde", "Ograve", "Oacute", "Ocircumflex", "Otilde", "Odieresis", "multiply",
+    "Oslash", "Ugrave", "Uacute", "Ucircumflex", "Udieresis", "Yacute", "Thorn", "germandbls",
+    "agrave", "aacute", "acircumflex", "atilde", "adieresis", "aring", "ae", "ccedilla",
+    "egrave", "eacute", "ecircumflex", "edieresis", "igrave", "iacute", "icircumflex", "idieresis",
+    "eth", "ntilde", "ograve", "oacute", "ocircumflex", "otilde", "odieresis", "divide",
+    "oslash", "ugrave", "uacute", "ucircumflex", "udieresis", "yacute", "thorn", "ydieresis"
+};
+
+static const struct { const char* name; uint16_t unicode; } pdf_extra_glyphs[] = {
+    { "quoteright", 0x2019 }, { "quoteleft", 0x2018 }, { "quotedblleft", 0x201C },
+    { "quotedblright", 0x201D }, { "quotesinglbase", 0x201A }, { "quotedblbase", 0x201E },
+    { "endash", 0x2013 }, { "emdash", 0x2014 }, { "bullet", 0x2022 }, { "ellipsis", 0x2026 },
+    { "dagger", 0x2020 }, { "daggerdbl", 0x2021 }, { "perthousand", 0x2030 },
+    { "guilsinglleft", 0x2039 }, { "guilsinglright", 0x203A }, { "trademark", 0x2122 },
+    { "Euro", 0x20AC }, { "fi", 0xFB01 }, { "fl", 0xFB02 }, { "ff", 0xFB00 }, { "ffi", 0xFB03 },
+    { "ffl", 0xFB04 }, { "minus", 0x2212 }, { "OE", 0x0152 }, { "oe", 0x0153 },
+    { "Scaron", 0x0160 }, { "scaron", 0x0161 }, { "Zcaron", 0x017D }, { "zcaron", 0x017E },
+    { "Ydieresis", 0x0178 }, { "florin", 0x0192 }, { "circumflex", 0x02C6 }, { "tilde", 0x02DC },
+    { "dotlessi", 0x0131 }, { "Lslash", 0x0141 }, { "lslash", 0x0142 }, { "fraction", 0x2044 },
+    { "breve", 0x02D8 }, { "dotaccent", 0x02D9 }, { "ring", 0x02DA }, { "ogonek", 0x02DB },
+    { "caron", 0x02C7 }, { "hungarumlaut", 0x02DD }, { "nbspace", 0x00A0 }, { "space", 0x0020 }
+};
+
+static uint16_t pdf_glyph_unicode(const char* name) {
+    for (int i = 0; i < 95; i++) {
+        if (!strcmp(name, pdf_ascii_glyphs[i])) return (uint16_t)(0x20 + i);
+        if (!strcmp(name, pdf_latin1_glyphs[i])) return (uint16_t)(0xA1 + i);
+    }
+    for (size_t i = 0; i < sizeof(pdf_extra_glyphs) / sizeof(pdf_extra_glyphs[0]); i++) {
+        if (!strcmp(name, pdf_extra_glyphs[i].name)) return pdf_extra_glyphs[i].unicode;
+    }
+    // "uniXXXX" and "uXXXX" carry the code point in the name
+    const char* hex = !strncmp(name, "uni", 3) ? name + 3 : (name[0] == 'u' ? name + 1 : NULL);
+    if (hex && strlen(hex) >= 4) {
+        unsigned value = 0;
+        for (int i = 0; i < 4; i++) {
+            int digit = pdf_hex_value(hex[i]);
+            if (digit < 0) return 0;
+            value = value * 16 + (unsigned)digit;
+        }
+        return (uint16_t)value;
+    }
+    return 0;
+}
+
+static void pdf_base_encoding(uint16_t* map, const char* name) {
+    for (int c = 0; c < 256; c++) map[c] = c >= 0x20 && c != 0x7F ? (uint16_t)c : 0;
+    if (name && !strcmp(name, "MacRomanEncoding")) {
+        for (int c = 0; c < 128; c++) map[128 + c] = pdf_mac_roman_high[c];
+    } else if (name && !strcmp(name, "StandardEncoding")) {
+        for (int c = 0x80; c < 256; c++) map[c] = 0;
+        for (size_t i = 0; i < sizeof(pdf_standard_pairs) / sizeof(pdf_standard_pairs[0]); i++) {
+            map[pdf_standard_pairs[i][0]] = pdf_standard_pairs[i][1];
+        }
+    } else {
+        // WinAnsiEncoding, and the best guess for fonts that name none
+        for (int c = 0; c < 32; c++) map[128 + c] = pdf_win_ansi_high[c];
+    }
+}
+
+// --- CMaps ---
+
+static int pdf_cmap_add(PdfCMap* cmap, uint32_t lo, uint32_t hi, const uint16_t* units, int unit_count, int is_range) {
+    if (unit_count <= 0 || unit_count > 32) return 0;
+    if (cmap->count == cmap->capacity) {
+        int capacity = cmap->capacity ? cmap->capacity * 2 : 64;
+        PdfCMapEntry* grown = (PdfCMapEntry*)realloc(cmap->entries, sizeof(PdfCMapEntry) * capacity);
+        if (!grown) return -1;
+        cmap->entries = grown;
+        cmap->capacity = capacity;
+    }
+    if (cmap->unit_count + unit_count > cmap->unit_capacity) {
+        int capacity = cmap->unit_capacity ? cmap->unit_capacity * 2 : 256;
+        while (capacity < cmap->unit_count + unit_count) capacity *= 2;
+        uint16_t* grown = (uint16_t*)realloc(cmap->units, sizeof(uint16_t) * capacity);
+        if (!grown) return -1;
+        cmap->units = grown;
+        cmap->unit_capacity = capacity;
+    }
+    PdfCMapEntry* entry = &cmap->entries[cmap->count++];
+    entry->lo = lo;
+    entry->hi = hi;
+    entry->dst = (uint32_t)cmap->unit_count;
+    entry->dst_len = (uint16_t)unit_count;
+    entry->is_range = (uint16_t)is_range;
+    memcpy(cmap->units + cmap->unit_count, units, sizeof(uint16_t) * unit_count);
+    cmap->unit_count += unit_count;
+    return 0;
+}
+
+static uint32_t pdf_string_code(PdfObj* str) {
+    uint32_t code = 0;
+    for (int i = 0; i < str->u.string.length && i < 4; i++) code = (code << 8) | str->u.string.data[i];
+    return code;
+}
+
+// UTF-16BE destination of a bfchar/bfrange entry
+static int pdf_cmap_units(PdfObj* dst, uint16_t* units) {
+    if (dst->type == PDF_NAME) {
+        units[0] = pdf_glyph_unicode(dst->u.name);
+        return units[0] ? 1 : 0;
+    }
+    if (dst->type != PDF_STRING) return 0;
+    int count = 0;
+    for (int i = 0; i + 1 < dst->u.string.length && count < 32; i += 2) {
+        units[count++] = (uint16_t)(dst->u.string.data[i] << 8 | dst->u.string.data[i + 1]);
+    }
+    if (dst->u.string.length == 1) units[count++] = dst->u.string.data[0];
+    return count;
+}
+
+static int pdf_cmap_compare(const void* a, const void* b) {
+    const PdfCMapEntry* x = (const PdfCMapEntry*)a;
+    const PdfCMapEntry* y = (const PdfCMapEntry*)b;
+    return x->lo < y->lo ? -1 : x->lo > y->lo;
+}
+
+static void pdf_cmap_free(PdfCMap* cmap) {
+    if (!cmap) return;
+    free(cmap->entries);
+    free(cmap->units);
+    free(cmap);
+}
+
+// Parse the codespace and bfchar/bfrange sections of a CMap stream
+static PdfCMap* pdf_parse_cmap(PdfDoc* doc, PdfObj* stream) {
+    size_t size;
+    unsigned char* data = stream && stream->type == PDF_STREAM ? pdf_decode_stream(doc, stream, &size) : NULL;
+    if (!data) return NULL;
+
+    PdfCMap* cmap = (PdfCMap*)calloc(1, sizeof(PdfCMap));
+    ZellArena arena = { NULL };
+    PdfObj* operands[PDF_CMAP_MAX_OPERANDS];
+    int operand_count = 0;
+    PdfLexer lex = { data, (int64_t)size, 0 };
+    uint16_t units[32];
+
+    while (cmap && lex.pos < lex.size) {
+        PdfObj* obj = pdf_parse_object(&lex, &arena, 0);
+        if (obj) {
+            if (operand_count < PDF_CMAP_MAX_OPERANDS) operands[operand_count++] = obj;
+            continue;
+        }
+        pdf_skip_space(&lex);
+        int64_t start = lex.pos;
+        while (lex.pos < lex.size && pdf_is_regular(lex.data[lex.pos])) lex.pos++;
+        if (lex.pos == start) {
+            lex.pos++; // stray delimiter
+            operand_count = 0;
+            continue;
+        }
+        const char* op = (const char*)lex.data + start;
+        int op_len = (int)(lex.pos - start);
+
+        if (op_len == 17 && !memcmp(op, "endcodespacerange", 17)) {
+            for (int i = 0; i + 1 < operand_count && cmap->space_count < 16; i += 2) {
+                if (operands[i]->type != PDF_STRING || operands[i + 1]->type != PDF_STRING) continue;
+                PdfCodeSpace* space = &cmap->spaces[cmap->space_count++];
+                space->lo = pdf_string_code(operands[i]);
+                space->hi = pdf_string_code(operands[i + 1]);
+                space->bytes = operands[i]->u.string.length;
+            }
+        } else if (op_len == 9 && !memcmp(op, "endbfchar", 9)) {
+            for (int i = 0; i + 1 < operand_count; i += 2) {
+                if (operands[i]->type != PDF_STRING) continue;
+                uint32_t code = pdf_string_code(operands[i]);
+                int n = pdf_cmap_units(operands[i + 1], units);
+                if (n > 0) pdf_cmap_add(cmap, code, code, units, n, 0);
+            }
+        } else if (op_len == 10 && !memcmp(op, "endbfrange", 10)) {
+            for (int i = 0; i + 2 < operand_count; i += 3) {
+                if (operands[i]->type != PDF_STRING || operands[i + 1]->type != PDF_STRING) continue;
+                uint32_t lo = pdf_string_code(operands[i]);
+                uint32_t hi = pdf_string_code(operands[i + 1]);
+                PdfObj* dst = operands[i + 2];
+                if (hi < lo || hi - lo > 0xFFFF) continue;
+                if (dst->type == PDF_ARRAY) {
+                    for (int k = 0; k < dst->u.array.count && lo + (uint32_t)k <= hi; k++) {
+                        int n = pdf_cmap_units(dst->u.array.items[k], units);
+                        if (n > 0) pdf_cmap_add(cmap, lo + k, lo + k, units, n, 0);
+                    }
+                } else {
+                    int n = pdf_cmap_units(dst, units);
+                    if (n > 0) pdf_cmap_add(cmap, lo, hi, units, n, 1);
+                }
+            }
+        }
+        operand_count = 0;
+    }
+
+    zell_arena_free(&arena);
+    zell_pool_put(data);
+    if (cmap && cmap->count > 1) qsort(cmap->entries, (size_t)cmap->count, sizeof(PdfCMapEntry), pdf_cmap_compare);
+    return cmap;
+}
+
+static const PdfCMapEntry* pdf_cmap_lookup(const PdfCMap* cmap, uint32_t code) {
+    int lo = 0, hi = cmap->count - 1, found = -1;
+    while (lo <= hi) {
+        int mid = (lo + hi) / 2;
+        if (cmap->entries[mid].lo <= code) {
+            found = mid;
+            lo = mid + 1;
+        } else {
+            hi = mid - 1;
+        }
+    }
+    if (found >= 0 && code <= cmap->entries[found].hi) return &cmap->entries[found];
+    return NULL;
+}
+
+// --- Fonts ---
+
+static void pdf_font_free(PdfFont* font) {
+    if (!font) return;
+    pdf_cmap_free(font->encoding);
+    pdf_cmap_free(font->to_unicode);
+    free(font->cid_widths);
+    free(font);
+}
+
+static float pdf_number(PdfDoc* doc, PdfObj* obj, float fallback) {
+    obj = pdf_resolve(doc, obj);
+    if (!obj) return fallback;
+    if (obj->type == PDF_REAL) return (float)obj->u.real;
+    if (obj->type == PDF_INT) return (float)obj->u.integer;
+    return fallback;
+}
+
+static void pdf_font_add_width(PdfFont* font, int* capacity, uint32_t lo, uint32_t hi, float width) {
+    if (font->cid_width_count == *capacity) {
+        int grown_capacity = *capacity ? *capacity * 2 : 64;
+        PdfWidthRange* grown = (PdfWidthRange*)realloc(font->cid_widths, sizeof(PdfWidthRange) * grown_capacity);
+        if (!grown) return;
+        font->cid_widths = grown;
+        *capacity = grown_capacity;
+    }
+    PdfWidthRange* range = &font->cid_widths[font->cid_width_count++];
+    range->lo = lo;
+    range->hi = hi;
+    range->width = width;
+}
+
+static PdfFont* pdf_load_font(PdfDoc* doc, PdfObj* dict) {
+    PdfFont* font = (PdfFont*)calloc(1, sizeof(PdfFont));
+    if (!font) return NULL;
+
+    PdfObj* subtype = pdf_dict_get(doc, dict, "Subtype");
+    PdfObj* encoding = pdf_dict_get(doc, dict, "Encoding");
+    font->to_unicode = pdf_parse_cmap(doc, pdf_dict_get(doc, dict, "ToUnicode"));
+
+    if (pdf_is_name(subtype, "Type0")) {
+        font->is_cid = 1;
+        if (encoding && encoding->type == PDF_STREAM) font->encoding = pdf_parse_cmap(doc, encoding);
+        if (encoding && encoding->type == PDF_NAME && !strncmp(encoding->u.name, "Uni", 3) &&
+            (strstr(encoding->u.name, "UCS2") || strstr(encoding->u.name, "UTF16"))) {
+            font->unicode_codes = 1;
+        }
+
+        PdfObj* descendants = pdf_dict_get(doc, dict, "DescendantFonts");
+        PdfObj* cid_font = descendants && descendants->type == PDF_ARRAY && descendants->u.array.count > 0
+            ? pdf_resolve(doc, descendants->u.array.items[0]) : NULL;
+        font->default_width = pdf_number(doc, pdf_dict_get_raw(cid_font, "DW"), 1000);
+
+        // W: [c [w1 w2 ...]] or [c_first c_last w]
+        PdfObj* widths = pdf_dict_get(doc, cid_font, "W");
+        int capacity = 0;
+        for (int i = 0; widths && widths->type == PDF_ARRAY && i < widths->u.array.count; ) {
+            PdfObj* first = pdf_resolve(doc, widths->u.array.items[i]);
+            PdfObj* next = i + 1 < widths->u.array.count ? pdf_resolve(doc, widths->u.array.items[i + 1]) : NULL;
+            if (!first || !next) break;
+            uint32_t start = (uint32_t)pdf_to_int(first, 0);
+            if (next->type == PDF_ARRAY) {
+                for (int k = 0; k < next->u.array.count; k++) {
+                    pdf_font_add_width(font, &capacity, start + k, start + k,
+                                       pdf_number(doc, next->u.array.items[k], font->default_width));
+                }
+                i += 2;
+            } else if (i + 2 < widths->u.array.count) {
+                pdf_font_add_width(font, &capacity, start, (uint32_t)pdf_to_int(next, start),
+                                   pdf_number(doc, widths->u.array.items[i + 2], font->default_width));
+                i += 3;
+            } else {
+                break;
+            }
+        }
+        return font;
+    }
+
+    // Simple font: base encoding, then /Differences
+    PdfObj* base = encoding && encoding->type == PDF_DICT ? pdf_dict_get(doc, encoding, "BaseEncoding") : encoding;
+    pdf_base_encoding(font->simple_map, base && base->type == PDF_NAME ? base->u.name : NULL);
+    PdfObj* differences = encoding && encoding->type == PDF_DICT ? pdf_dict_get(doc, encoding, "Differences") : NULL;
+    int code = 0;
+    for (int i = 0; differences && differences->type == PDF_ARRAY && i < differences->u.array.count; i++) {
+        PdfObj* item = pdf_resolve(doc, differences->u.array.items[i]);
+        if (!item) continue;
+        if (item->type == PDF_INT) {
+            code = (int)item->u.integer;
+        } else if (item->type == PDF_NAME && code >= 0 && code < 256) {
+            font->simple_map[code++] = pdf_glyph_unicode(item->u.name);
+        }
+    }
+
+    PdfObj* descriptor = pdf_dict_get(doc, dict, "FontDescriptor");
+    float missing = pdf_number(doc, pdf_dict_get_raw(descriptor, "MissingWidth"), 0);
+    PdfObj* widths = pdf_dict_get(doc, dict, "Widths");
+    int first_char = (int)pdf_to_int(pdf_dict_get(doc, dict, "FirstChar"), 0);
+    // The standard 14 fonts carry no widths; half an em is a fair average
+    for (int c = 0; c < 256; c++) font->simple_widths[c] = widths ? missing : 500;
+    for (int i = 0; widths && widths->type == PDF_ARRAY && i < widths->u.array.count; i++) {
+        int c = first_char + i;
+        if (c >= 0 && c < 256) font->simple_widths[c] = pdf_number(doc, widths->u.array.items[i], missing);
+    }
+    return font;
+}
+
+static float pdf_font_width(const PdfFont* font, uint32_t code) {
+    if (!font->is_cid) return font->simple_widths[code & 255];
+    for (int i = 0; i < font->cid_width_count; i++) {
+        if (code >= font->cid_widths[i].lo && code <= font->cid_widths[i].hi) return font->cid_widths[i].width;
+    }
+    return font->default_width;
+}
+
+// Length in bytes of the next character code in a shown string
+static int pdf_font_code_length(const PdfFont* font, const unsigned char* data, int remaining) {
+    if (!font || !font->is_cid) return 1;
+    const PdfCMap* cmap = font->encoding;
+    if (cmap && cmap->space_count > 0) {
+        uint32_t code = 0;
+        for (int n = 1; n <= 4 && n <= remaining; n++) {
+            code = (code << 8) | data[n - 1];
+            for (int i = 0; i < cmap->space_count; i++) {
+                if (cmap->spaces[i].bytes == n && code >= cmap->spaces[i].lo && code <= cmap->spaces[i].hi) return n;
+            }
+        }
+    }
+    return remaining >= 2 ? 2 : remaining; // Identity-H/V and most predefined CMaps
+}
+
+// --- Resources ---
+
+static PdfTextResources* pdf_text_resources(PdfTextJob* job, PdfObj* resources_ref, int depth);
+
+static PdfFont* pdf_text_font(PdfTextJob* job, PdfObj* ref) {
+    PdfDoc* doc = job->doc;
+    PdfObj* dict = pdf_resolve(doc, ref);
+    if (!dict || dict->type != PDF_DICT) return NULL;
+
+    int num = ref->type == PDF_REF ? ref->u.ref.num : 0;
+    if (num > 0 && num < doc->xref_count && job->fonts_by_num[num]) return job->fonts_by_num[num];
+
+    PdfFont* font = pdf_load_font(doc, dict);
+    if (!font) return NULL;
+    font->next = job->fonts;
+    job->fonts = font;
+    if (num > 0 && num < doc->xref_count) job->fonts_by_num[num] = font;
+    return font;
+}
+
+static PdfTextResources* pdf_text_resources(PdfTextJob* job, PdfObj* resources_ref, int depth) {
+    PdfDoc* doc = job->doc;
+    int num = resources_ref && resources_ref->type == PDF_REF ? resources_ref->u.ref.num : 0;
+    if (num >= doc->xref_count) num = 0;
+    if (num > 0 && job->res_by_num[num]) return job->res_by_num[num];
+    if (depth > PDF_TEXT_MAX_FORM_DEPTH || (num > 0 && job->res_building[num])) return NULL;
+
+    PdfObj* resources = pdf_resolve(doc, resources_ref);
+    PdfTextResources* res = (PdfTextResources*)pdf_text_own(job, calloc(1, sizeof(PdfTextResources)));
+    if (!res) return NULL;
+    if (num > 0) job->res_building[num] = 1;
+
+    PdfObj* fonts = pdf_dict_get(doc, resources, "Font");
+    if (fonts && fonts->type == PDF_DICT && fonts->u.dict.count > 0) {
+        res->fonts = (PdfNamedFont*)pdf_text_own(job, calloc((size_t)fonts->u.dict.count, sizeof(PdfNamedFont)));
+        for (int i = 0; res->fonts && i < fonts->u.dict.count; i++) {
+            PdfFont* font = pdf_text_font(job, fonts->u.dict.values[i]);
+            if (!font) continue;
+            res->fonts[res->font_count].name = fonts->u.dict.keys[i];
+            res->fonts[res->font_count++].font = font;
+        }
+    }
+
+    PdfObj* xobjects = pdf_dict_get(doc, resources, "XObject");
+    if (xobjects && xobjects->type == PDF_DICT && xobjects->u.dict.count > 0) {
+        res->forms = (PdfNamedForm*)pdf_text_own(job, calloc((size_t)xobjects->u.dict.count, sizeof(PdfNamedForm)));
+        for (int i = 0; res->forms && i < xobjects->u.dict.count; i++) {
+            PdfObj* form = pdf_resolve(doc, xobjects->u.dict.values[i]);
+            if (!form || form->type != PDF_STREAM || !pdf_is_name(pdf_dict_get(doc, form, "Subtype"), "Form")) continue;
+            // A form without its own resources uses its parent's
+            PdfObj* form_resources = pdf_dict_get_raw(form, "Resources");
+            PdfTextResources* nested = form_resources ? pdf_text_resources(job, form_resources, depth + 1) : res;
+            if (pdf_touch_stream(doc, form) != 0) continue;
+            res->forms[res->form_count].name = xobjects->u.dict.keys[i];
+            res->forms[res->form_count].stream = form;
+            res->forms[res->form_count++].resources = nested;
+        }
+    }
+
+    if (num > 0) {
+        job->res_building[num] = 0;
+        job->res_by_num[num] = res;
+    }
+    return res;
+}
+
+static int pdf_text_prepare_page(PdfTextJob* job, int index) {
+    PdfDoc* doc = job->doc;
+    PdfPage* page = &doc->pages[index];
+    PdfTextPage* text_page = &job->pages[index];
+
+    PdfObj* contents = pdf_dict_get(doc, page->dict, "Contents");
+    int count = !contents ? 0 : contents->type == PDF_ARRAY ? contents->u.array.count : 1;
+    text_page->contents = (PdfObj**)pdf_text_own(job, calloc((size_t)(count ? count : 1), sizeof(PdfObj*)));
+    if (!text_page->contents) return -1;
+
+    for (int i = 0; i < count; i++) {
+        PdfObj* stream = contents->type == PDF_ARRAY ? pdf_resolve(doc, contents->u.array.items[i]) : contents;
+        if (!stream || stream->type != PDF_STREAM) continue;
+        if (pdf_touch_stream(doc, stream) != 0) continue;
+        text_page->contents[text_page->content_count++] = stream;
+    }
+    text_page->resources = page->resources ? pdf_text_resources(job, page->resources, 0) : NULL;
+    return 0;
+}
+
+// --- Content interpretation ---
+
+typedef struct {
+    PdfWriter* out;
+    ZellArena arena;
+    const PdfFont* font;
+    double font_size;
+    double char_spacing;
+    double word_spacing;
+    double scale;          // horizontal scaling, 1 = 100%
+    double leading;
+    double tm[6];          // text matrix
+    double tlm[6];         // text line matrix
+    int has_text;
+    double last_x;         // where the previous glyph run ended
+    double last_y;
+} PdfTextState;
+
+static void pdf_put_utf8(PdfWriter* w, uint32_t cp) {
+    unsigned char buffer[4];
+    int length;
+    if (cp < 0x80) {
+        buffer[0] = (unsigned char)cp;
+        length = 1;
+    } else if (cp < 0x800) {
+        buffer[0] = (unsigned char)(0xC0 | (cp >> 6));
+        buffer[1] = (unsigned char)(0x80 | (cp & 0x3F));
+        length = 2;
+    } else if (cp < 0x10000) {
+        buffer[0] = (unsigned char)(0xE0 | (cp >> 12));
+        buffer[1] = (unsigned char)(0x80 | ((cp >> 6) & 0x3F));
+        buffer[2] = (unsigned char)(0x80 | (cp & 0x3F));
+        length = 3;
+    } else {
+        buffer[0] = (unsigned char)(0xF0 | (cp >> 18));
+        buffer[1] = (unsigned char)(0x80 | ((cp >> 12) & 0x3F));
+        buffer[2] = (unsigned char)(0x80 | ((cp >> 6) & 0x3F));
+        buffer[3] = (unsigned char)(0x80 | (cp & 0x3F));
+        length = 4;
+    }
+    pdf_put(w, buffer, (size_t)length);
+}
+
+static void pdf_put_utf16(PdfWriter* w, const uint16_t* units, int count) {
+    for (int i = 0; i < count; i++) {
+        uint32_t cp = units[i];
+        if (cp >= 0xD800 && cp < 0xDC00 && i + 1 < count && units[i + 1] >= 0xDC00 && units[i + 1] < 0xE000) {
+            cp = 0x10000 + ((cp - 0xD800) << 10) + (units[++i] - 0xDC00);
+        }
+        if (cp >= 0x20 && cp != 0xFEFF) pdf_put_utf8(w, cp);
+    }
+}
+
+static int pdf_text_ends_with_space(PdfTextState* state) {
+    PdfWriter* w = state->out;
+    if (w->length == 0 || w->length > w->capacity) return 1;
+    unsigned char last = w->data[w->length - 1];
+    return last == ' ' || last == '\n';
+}
+
+// Separate a new glyph run from the previous one by its position
+static void pdf_text_begin_run(PdfTextState* state) {
+    double x = state->tm[4], y = state->tm[5];
+    double size = fabs(state->font_size * state->tm[3]);
+    if (size < 1) size = 1;
+
+    if (state->has_text) {
+        if (fabs(y - state->last_y) > size * 0.5) {
+            pdf_put(state->out, "\n", 1);
+        } else if ((x - state->last_x > size * 0.15 || x < state->last_x - size) &&
+                   !pdf_text_ends_with_space(state)) {
+            pdf_put(state->out, " ", 1);
+        }
+    }
+    state->has_text = 1;
+}
+
+static void pdf_text_show(PdfTextState* state, PdfObj* str) {
+    if (!str || str->type != PDF_STRING) return;
+    const PdfFont* font = state->font;
+    const unsigned char* data = str->u.string.data;
+    int length = str->u.string.length;
+
+    pdf_text_begin_run(state);
+    for (int i = 0; i < length; ) {
+        int n = pdf_font_code_length(font, data + i, length - i);
+        uint32_t code = 0;
+        for (int k = 0; k < n; k++) code = (code << 8) | data[i + k];
+        i += n;
+
+        const PdfCMapEntry* entry = font && font->to_unicode ? pdf_cmap_lookup(font->to_unicode, code) : NULL;
+        if (entry) {
+            uint16_t units[32];
+            memcpy(units, font->to_unicode->units + entry->dst, sizeof(uint16_t) * entry->dst_len);
+            if (entry->is_range) units[entry->dst_len - 1] = (uint16_t)(units[entry->dst_len - 1] + (code - entry->lo));
+            pdf_put_utf16(state->out, units, entry->dst_len);
+        } else if (font && font->unicode_codes) {
+            uint16_t unit = (uint16_t)code;
+            pdf_put_utf16(state->out, &unit, 1);
+        } else if (!font || !font->is_cid) {
+            uint16_t unit = font ? font->simple_map[code & 255] : (uint16_t)(code >= 0x20 ? code : 0);
+            if (unit) pdf_put_utf16(state->out, &unit, 1);
+        }
+
+        double width = font ? pdf_font_width(font, code) / 1000.0 : 0.5;
+        double advance = width * state->font_size + state->char_spacing;
+        if (n == 1 && code == 32) advance += state->word_spacing;
+        advance *= state->scale;
+        state->tm[4] += advance * state->tm[0];
+        state->tm[5] += advance * state->tm[1];
+    }
+    state->last_x = state->tm[4];
+    state->last_y = state->tm[5];
+}
+
+static void pdf_text_move(PdfTextState* state, double tx, double ty) {
+    double* m = state->tlm;
+    m[4] += tx * m[0] + ty * m[2];
+    m[5] += tx * m[1] + ty * m[3];
+    memcpy(state->tm, state->tlm, sizeof(state->tm));
+}
+
+static double pdf_operand(PdfObj* obj) {
+    if (!obj) return 0;
+    if (obj->type == PDF_REAL) return obj->u.real;
+    if (obj->type == PDF_INT) return (double)obj->u.integer;
+    return 0;
+}
+
+static void pdf_text_run(PdfDoc* doc, PdfTextState* state, const PdfTextResources* res,
+                         const unsigned char* data, size_t size, int depth);
+
+static void pdf_text_run_form(PdfDoc* doc, PdfTextState* state, const PdfNamedForm* form, int depth) {
+    size_t size;
+    unsigned char* data = pdf_decode_stream(doc, form->stream, &size);
+    if (!data) return;
+
+    // Form text is its own block; its coordinates are not comparable to the page's
+    if (state->has_text && !pdf_text_ends_with_space(state)) pdf_put(state->out, "\n", 1);
+    PdfTextState saved = *state;
+    state->has_text = 0;
+    pdf_text_run(doc, state, form->resources, data, size, depth + 1);
+    if (state->has_text && !pdf_text_ends_with_space(state)) pdf_put(state->out, "\n", 1);
+    saved.arena = state->arena;
+    *state = saved;
+    state->has_text = 0;
+    zell_pool_put(data);
+}
+
+static void pdf_text_run(PdfDoc* doc, PdfTextState* state, const PdfTextResources* res,
+                         const unsigned char* data, size_t size, int depth) {
+    PdfLexer lex = { data, (int64_t)size, 0 };
+    PdfObj* operands[PDF_TEXT_MAX_OPERANDS];
+    int count = 0;
+
+    while (lex.pos < lex.size) {
+        PdfObj* obj = pdf_parse_object(&lex, &state->arena, 0);
+        if (obj) {
+            if (count < PDF_TEXT_MAX_OPERANDS) operands[count++] = obj;
+            continue;
+        }
+        pdf_skip_space(&lex);
+        int64_t start = lex.pos;
+        while (lex.pos < lex.size && pdf_is_regular(lex.data[lex.pos])) lex.pos++;
+        if (lex.pos == start) {
+            lex.pos++; // stray delimiter such as ')' or '}'
+            count = 0;
+            continue;
+        }
+        const char* op = (const char*)lex.data + start;
+        int len = (int)(lex.pos - start);
+
+#define PDF_OP(name) (len == (int)sizeof(name) - 1 && !memcmp(op, name, sizeof(name) - 1))
+        if (PDF_OP("BT")) {
+            static const double identity[6] = { 1, 0, 0, 1, 0, 0 };
+            memcpy(state->tm, identity, sizeof(identity));
+            memcpy(state->tlm, identity, sizeof(identity));
+        } else if (PDF_OP("Tf") && count >= 2) {
+            state->font = NULL;
+            if (operands[count - 2]->type == PDF_NAME && res) {
+                for (int i = 0; i < res->font_count; i++) {
+                    if (!strcmp(res->fonts[i].name, operands[count - 2]->u.name)) state->font = res->fonts[i].font;
+                }
+            }
+            state->font_size = pdf_operand(operands[count - 1]);
+        } else if (PDF_OP("Tc") && count >= 1) {
+            state->char_spacing = pdf_operand(operands[count - 1]);
+        } else if (PDF_OP("Tw") && count >= 1) {
+            state->word_spacing = pdf_operand(operands[count - 1]);
+        } else if (PDF_OP("Tz") && count >= 1) {
+            state->scale = pdf_operand(operands[count - 1]) / 100.0;
+        } else if (PDF_OP("TL") && count >= 1) {
+            state->leading = pdf_operand(operands[count - 1]);
+        } else if (PDF_OP("Td") && count >= 2) {
+            pdf_text_move(state, pdf_operand(operands[count - 2]), pdf_operand(operands[count - 1]));
+        } else if (PDF_OP("TD") && count >= 2) {
+            state->leading = -pdf_operand(operands[count - 1]);
+            pdf_text_move(state, pdf_operand(operands[count - 2]), pdf_operand(operands[count - 1]));
+        } else if (PDF_OP("Tm") && count >= 6) {
+            for (int i = 0; i < 6; i++) state->tlm[i] = pdf_operand(operands[count - 6 + i]);
+            memcpy(state->tm, state->tlm, sizeof(state->tm));
+        } else if (PDF_OP("T*")) {
+            pdf_text_move(state, 0, -state->leading);
+        } else if (PDF_OP("Tj") && count >= 1) {
+            pdf_text_show(state, operands[count - 1]);
+        } else if (PDF_OP("'") && count >= 1) {
+            pdf_text_move(state, 0, -state->leading);
+            pdf_text_show(state, operands[count - 1]);
+        } else if (PDF_OP("\"") && count >= 3) {
+            state->word_spacing = pdf_operand(operands[count - 3]);
+            state->char_spacing = pdf_operand(operands[count - 2]);
+            pdf_text_move(state, 0, -state->leading);
+            pdf_text_show(state, operands[count - 1]);
+        } else if (PDF_OP("TJ") && count >= 1 && operands[count - 1]->type == PDF_ARRAY) {
+            PdfObj* array = operands[count - 1];
+            for (int i = 0; i < array->u.array.count; i++) {
+                PdfObj* item = array->u.array.items[i];
+                if (item->type == PDF_STRING) {
+                    pdf_text_show(state, item);
+                } else {
+                    // Negative adjustments move right; large ones separate words
+                    double shift = -pdf_operand(item) / 1000.0 * state->font_size * state->scale;
+                    state->tm[4] += shift * state->tm[0];
+                    state->tm[5] += shift * state->tm[1];
+                }
+            }
+        } else if (PDF_OP("Do") && count >= 1 && operands[count - 1]->type == PDF_NAME && res &&
+                   depth < PDF_TEXT_MAX_FORM_DEPTH) {
+            for (int i = 0; i < res->form_count; i++) {
+                if (!strcmp(res->forms[i].name, operands[count - 1]->u.name)) {
+                    pdf_text_run_form(doc, state, &res->forms[i], depth);
+                    break;
+                }
+            }
+        } else if (PDF_OP("BI")) {
+            // Inline image: skip the binary data up to a whitespace-delimited EI
+            int64_t id = pdf_find(lex.data, lex.size, lex.pos, "ID");
+            int64_t pos = id < 0 ? lex.size : id + 3;
+            while (pos + 2 < lex.size && !(pdf_is_space(lex.data[pos - 1]) && lex.data[pos] == 'E' &&
+                   lex.data[pos + 1] == 'I' && (pos + 2 == lex.size || pdf_is_space(lex.data[pos + 2])))) {
+                pos++;
+            }
+            lex.pos = pos + 2 < lex.size ? pos + 2 : lex.size;
+        }
+#undef PDF_OP
+        count = 0;
+        zell_arena_reset(&state->arena);
+    }
+}
+
+static void pdf_text_extract_page(PdfTextJob* job, int index) {
+    ZELL_STATS_STAGE(ZELL_STAGE_TRANSFORM, "pdf_text_page");
+    PdfDoc* doc = job->doc;
+    PdfTextPage* page = &job->pages[index];
+    PdfTextState state;
+    memset(&state, 0, sizeof(state));
+    state.out = &job->texts[index];
+    state.out->growable = 1;
+    state.scale = 1;
+
+    for (int i = 0; i < page->content_count; i++) {
+        size_t size;
+        unsigned char* data = pdf_decode_stream(doc, page->contents[i], &size);
+        if (!data) continue;
+        pdf_text_run(doc, &state, page->resources, data, size, 0);
+        pdf_put(state.out, "\n", 1); // content streams split only between tokens
+        zell_pool_put(data);
+    }
+    zell_arena_free(&state.arena);
+}
+
+static void pdf_text_task(void* ctx, int index) {
+    pdf_text_extract_page((PdfTextJob*)ctx, index);
+}
+
+static void pdf_text_job_free(PdfTextJob* job) {
+    while (job->fonts) {
+        PdfFont* next = job->fonts->next;
+        pdf_font_free(job->fonts);
+        job->fonts = next;
+    }
+    for (int i = 0; i < job->owned_count; i++) free(job->owned[i]);
+    if (job->texts) {
+        for (int i = 0; i < job->page_count; i++) free(job->texts[i].data);
+    }
+    free(job->owned);
+    free(job->fonts_by_num);
+    free(job->res_by_num);
+    free(job->res_building);
+    free(job->pages);
+    free(job->texts);
+}
+
+/**
+ * Extract the text of every page, pages in order and separated by a blank line
+ * @return bytes of UTF-8 the text needs (may exceed w->capacity), or -1 on error
+ */
+static int64_t pdf_extract_text(PdfDoc* doc, PdfWriter* w, int num_threads) {
+    PdfTextJob job;
+    memset(&job, 0, sizeof(job));
+    job.doc = doc;
+
+    if (doc->encrypted || pdf_load_pages(doc) < 0) return -1;
+    job.page_count = doc->page_count;
+    job.fonts_by_num = (PdfFont**)calloc((size_t)doc->xref_count, sizeof(PdfFont*));
+    job.res_by_num = (PdfTextResources**)calloc((size_t)doc->xref_count, sizeof(PdfTextResources*));
+    job.res_building = (unsigned char*)calloc((size_t)doc->xref_count, 1);
+    job.pages = (PdfTextPage*)calloc((size_t)(job.page_count ? job.page_count : 1), sizeof(PdfTextPage));
+    job.texts = (PdfWriter*)calloc((size_t)(job.page_count ? job.page_count : 1), sizeof(PdfWriter));
+    if (!job.fonts_by_num || !job.res_by_num || !job.res_building || !job.pages || !job.texts) {
+        pdf_text_job_free(&job);
+        return -1;
+    }
+
+    // Phase 1: everything that touches the shared object cache
+    for (int i = 0; i < job.page_count; i++) {
+        if (pdf_text_prepare_page(&job, i) != 0) {
+            pdf_text_job_free(&job);
+            return -1;
+        }
+    }
+
+    // Phase 2: pages are independent from here on
+    pdf_parallel_for(doc, job.page_count, num_threads, pdf_text_task, &job);
+
+    // Phase 3: join in page order, trimming each page's trailing whitespace
+    int64_t result = 0;
+    for (int i = 0; i < job.page_count; i++) {
+        PdfWriter* text = &job.texts[i];
+        if (text->length > text->capacity) {
+            result = -1; // out of memory while growing
+            break;
+        }
+        int64_t length = text->length;
+        while (length > 0 && (text->data[length - 1] == '\n' || text->data[length - 1] == ' ')) length--;
+        if (i > 0) pdf_put(w, "\n\n", 2);
+        pdf_put(w, text->data, (size_t)length);
+    }
+    if (result == 0) result = w->length;
+
+    pdf_text_job_free(&job);
+    return result;
+}
+
+// Copy the input unchanged to the writer
+static int64_t pdf_put_input(PdfDoc* doc, PdfWriter* w) {
+    if (!w->sink) {
+        w->length = doc->size;
+        if (!w->data) return doc->size; // measuring only
+        if (doc->size > w->capacity) return -1;
+        if (doc->data) {
+            memmove(w->data, doc->data, (size_t)doc->size);
+        } else if (zell_source_read(&doc->source, 0, w->data, doc->size) != doc->size) {
+            return -1;
+        }
+        return doc->size;
+    }
+
+    w->length = 0;
+    zell_sink_rewind(w->sink);
+    if (doc->data) {
+        pdf_put(w, doc->data, (size_t)doc->size);
+        return w->length;
+    }
+    unsigned char* chunk = (unsigned char*)zell_pool_get((size_t)ZELL_SINK_CHUNK);
+    if (!chunk) return -1;
+    for (int64_t offset = 0; offset < doc->size; offset += ZELL_SINK_CHUNK) {
+        int64_t length = doc->size - offset < ZELL_SINK_CHUNK ? doc->size - offset : ZELL_SINK_CHUNK;
+        if (zell_source_read(&doc->source, offset, chunk, length) != length) {
+            zell_pool_put(chunk);
+            return -1;
+        }
+        pdf_put(w, chunk, (size_t)length);
+    }
+    zell_pool_put(chunk);
+    return w->length;
+}
+
+// Shared by the buffer, file, callback and sink entry points of compress_pdf.
+// A writer without a buffer only measures the output.
+static int64_t pdf_compress_doc(PdfDoc* doc, PdfWriter* w, int image_quality, int target_dpi) {
+    PdfOptimizeOptions options;
+    options.image_quality = image_quality;
+    options.target_dpi = target_dpi;
+    options.flate_level = ZELL_DEFLATE_BEST;
+    options.page_extent = pdf_load_pages(doc) > 0 ? pdf_page_extent(doc) : 0;
+    options.num_threads = 0;
+
+    int64_t result = pdf_optimize(doc, w, &options);
+
+    // An already-optimised file is passed through rather than made bigger
+    if (result < 0 || result >= doc->size) {
+        return pdf_put_input(doc, w);
+    }
+    if (w->data && result > w->capacity) {
+        return -1; // Output buffer too small
+    }
+    return result;
+}
+
+/**
+ * Compress a PDF: object streams, xref stream, maximum-level Flate, and
+ * JPEG re-encoding of images above the target resolution
+ * @param input_data - Input PDF data
+ * @param input_size - Size of input data
+ * @param output_data - Output buffer, or NULL to only measure the output
+ * @param output_size - Size of output buffer (0 when measuring)
+ * @param image_quality - JPEG quality for downsampled images (0 = keep images as they are)
+ * @param target_dpi - Resolution images are reduced to (0 = no downsampling)
+ * @return -1 on error, output size on success (never larger than the input).
+ *         Measuring costs a full run; compress_pdf_sink streams the output
+ *         without a buffer instead.
+ */
+EMSCRIPTEN_KEEPALIVE
+int64_t compress_pdf(unsigned char* input_data, int64_t input_size,
+                     unsigned char* output_data, int64_t output_size,
+                     int image_quality, int target_dpi) {
+    ZELL_STATS_CALL("compress_pdf", input_size);
+    if (!input_data || input_size <= 0 || !zell_output_valid(output_data, output_size)) {
+        return -1;
+    }
+
+    PdfDoc* doc = pdf_open(input_data, input_size);
+    if (!doc) {
+        return -1;
+    }
+
+    PdfWriter writer = { output_data, output_size, 0, 0, NULL };
+    int64_t result = pdf_compress_doc(doc, &writer, image_quality, target_dpi);
+    pdf_close(doc);
+    return ZELL_STATS_RESULT(result);
+}
+
 /**
  * Process PDF data for conversion/compression
  * @param input_data - Input PDF data
  * @param input_size - Size of input data
- * @param output_data - Output buffer
- * @param output_size - Size of output buffer
+ * @param output_data - Output buffer, or NULL to only measure the output
+ * @param output_size - Size of output buffer (0 when measuring)
  * @param quality - Compression quality (0-100)
  * @param format - Target format (0=PDF, 1=TXT, 2=DOCX)
  * @return -1 on error, output size on success
  */
 EMSCRIPTEN_KEEPALIVE
-int process_pdf(unsigned char* input_data, int input_size,
-                unsigned char* output_data, int output_size,
-                int quality, int format) {
-    if (!input_data || !output_data || input_size <= 0 || output_size <= 0) {
+int64_t process_pdf(unsigned char* input_data, int64_t input_size,
+                    unsigned char* output_data, int64_t output_size,
+                    int quality, int format) {
+    if (!input_data || input_size <= 0 || !zell_output_valid(output_data, output_size)) {
         return -1;
     }
     
+    if (format == 0) { // PDF to PDF (compression)
+        // Higher quality keeps more resolution: 300 / 150 / 96 dpi
+        int target_dpi = quality >= 90 ? 300 : quality >= 75 ? 150 : 96;
+        return compress_pdf(input_data, input_size, output_data, output_size, quality, target_dpi);
+    }
+
     // Calculate compression based on quality
-    float compression_ratio = (float)quality / 100.0f;
-    int target_size = (int)(input_size * compression_ratio);
+    double compression_ratio = (double)quality / 100.0;
+    int64_t target_size = (int64_t)(input_size * compression_ratio);
     
+    if (!output_data) {
+        return target_size; // measuring: the most the conversion can write
+    }
     if (target_size > output_size) {
         target_size = output_size;
     }
     
     // Simple PDF processing based on format
-    if (format == 0) { // PDF to PDF (compression)
-        // Simulate PDF compression
-        int step = input_size / target_size;
-        if (step < 1) step = 1;
+    if (format == 1) { // PDF to TXT
+        // Extract text content (simplified)
+        int64_t text_size = 0;
+        for (int64_t i = 0; i < input_size && text_size < target_size; i++) {
+            if (input_data[i] >= 32 && input_data[i] <= 126) { // Printable ASCII
+                output_data[text_size++] = input_data[i];
+            }
+        }
+        return text_size;
+    } else if (format == 2) { // PDF to DOCX
+        // Convert to DOCX format (simplified)
+        int64_t docx_size = 0;
+        // Add DOCX header
+        const char* docx_header = "<?xml version=\"1.0\" encoding=\"UTF-8\"?>";
+        int header_len = strlen(docx_header);
+        if (docx_size + header_len < target_size) {
+            memcpy(output_data + docx_size, docx_header, header_len);
+            docx_size += header_len;
+        }
         
-        for (int i = 0, j = 0; i < input_size && j < target_size; i += step, j++) {
-            output_data[j] = input_data[i];
+        // Add content
+        for (int64_t i = 0; i < input_size && docx_size < target_size; i++) {
+            if (input_data[i] >= 32 && input_data[i] <= 126) {
+                output_data[docx_size++] = input_data[i];
+            }
+        }
+        return docx_size;
+    }
+    
+    return target_size;
+}
+
+// Shared by the buffer and sink entry points of merge_pdfs
+static int64_t pdf_merge(unsigned char** pdf_files, const int64_t* file_sizes, int num_files,
+                         PdfWriter* w) {
+    PdfDoc** docs = (PdfDoc**)calloc((size_t)num_files, sizeof(PdfDoc*));
+    if (!docs) {
+        return -1;
+    }
+
+    int64_t result = -1;
+    int opened = 0;
+    PdfCopy copy;
+    memset(&copy, 0, sizeof(copy));
+
+    for (; opened < num_files; opened++) {
+        if (!pdf_files[opened] || file_sizes[opened] <= 0) goto done;
+        docs[opened] = pdf_open(pdf_files[opened], file_sizes[opened]);
+        // Encrypted inputs would need their strings and streams re-keyed
+        if (!docs[opened] || docs[opened]->encrypted || pdf_load_pages(docs[opened]) < 0) {
+            opened++;
+            goto done;
+        }
+    }
+
+    // Identical fonts, images and resources shared between inputs are written once
+    if (pdf_copy_init(&copy, docs, num_files, 1) != 0) goto done;
+    for (int i = 0; i < num_files; i++) {
+        for (int p = 0; p < docs[i]->page_count; p++) {
+            if (pdf_copy_add_page(&copy, i, p) != 0) goto done;
+        }
+    }
+
+    result = pdf_copy_write(&copy, w);
+    if (w->data && result > w->capacity) {
+        result = -1; // Output buffer too small
+    }
+
+done:
+    pdf_copy_free(&copy);
+    for (int i = 0; i < opened; i++) {
+        if (docs[i]) pdf_close(docs[i]);
+    }
+    free(docs);
+    return result;
+}
+
+/**
+ * Merge multiple PDFs into one
+ * @param pdf_files - Array of PDF data pointers
+ * @param file_sizes - Array of file sizes
+ * @param num_files - Number of files to merge
+ * @param output_data - Output buffer, or NULL to only measure the output
+ * @param output_size - Size of output buffer (0 when measuring)
+ * @return -1 on error, merged size on success
+ */
+EMSCRIPTEN_KEEPALIVE
+int64_t merge_pdfs(unsigned char** pdf_files, const int64_t* file_sizes, int num_files,
+                   unsigned char* output_data, int64_t output_size) {
+    ZELL_STATS_CALL("merge_pdfs", zell_stats_total(file_sizes, num_files));
+    if (!pdf_files || !file_sizes || num_files <= 0 || !zell_output_valid(output_data, output_size)) {
+        return -1;
+    }
+
+    PdfWriter writer = { output_data, output_size, 0, 0, NULL };
+    return ZELL_STATS_RESULT(pdf_merge(pdf_files, file_sizes, num_files, &writer));
+}
+
+// Shared by the buffer, file, callback and sink entry points of
+// extract_pdf_text.  Only text written to a buffer is cut and terminated, so
+// measuring counts the terminator: the result is the buffer size to pass.
+static int64_t pdf_extract_text_doc(PdfDoc* doc, PdfWriter* w, int num_threads) {
+    unsigned char* output_data = w->data;
+    if (output_data) w->capacity--; // room for the terminator
+    int64_t length = pdf_extract_text(doc, w, num_threads);
+    if (length < 0 || w->sink) return length;
+    if (!output_data) return length + 1;
+
+    if (length > w->capacity) {
+        // Drop a multi-byte sequence the cut went through
+        length = w->capacity;
+        int64_t lead = length - 1;
+        while (lead > 0 && (output_data[lead] & 0xC0) == 0x80) lead--;
+        if (lead >= 0) {
+            int c = output_data[lead];
+            int needed = c >= 0xF0 ? 4 : c >= 0xE0 ? 3 : c >= 0xC0 ? 2 : 1;
+            if (lead + needed > length) length = lead;
+        }
+    }
+    output_data[length] = '\0';
+    return length;
+}
+
+/**
+ * Extract the text of a PDF as UTF-8. Fonts are decoded through their
+ * encodings and ToUnicode maps, and pages are processed in parallel.
+ * @param input_data - Input PDF data
+ * @param input_size - Size of input data
+ * @param output_data - Output buffer, or NULL to only measure the text
+ * @param output_size - Size of output buffer (0 when measuring)
+ * @param num_threads - Worker threads (0 = one per core)
+ * @return -1 on error, extracted text size on success (the text is
+ *         null-terminated, and cut at a character boundary if it does not fit;
+ *         a measured size counts the terminator, so it is the buffer size)
+ */
+EMSCRIPTEN_KEEPALIVE
+int64_t extract_pdf_text(unsigned char* input_data, int64_t input_size,
+                         unsigned char* output_data, int64_t output_size, int num_threads) {
+    ZELL_STATS_CALL("extract_pdf_text", input_size);
+    if (!input_data || input_size <= 0 || !zell_output_valid(output_data, output_size)) {
+        return -1;
+    }
+
+    PdfDoc* doc = pdf_open(input_data, input_size);
+    if (!doc) return -1;
+
+    PdfWriter writer = { output_data, output_size, 0, 0, NULL };
+    int64_t result = pdf_extract_text_doc(doc, &writer, num_threads);
+    pdf_close(doc);
+    return ZELL_STATS_RESULT(result);
+}
+
+/**
+ * Extract text from PDF
+ * @param input_data - Input PDF data
+ * @param input_size - Size of input data
+ * @param output_data - Output buffer
+ * @param output_size - Size of output buffer
+ * @return -1 on error, extracted text size on success
+ */
+EMSCRIPTEN_KEEPALIVE
+int64_t extract_text(unsigned char* input_data, int64_t input_size,
+                     unsigned char* output_data, int64_t output_size) {
+    return extract_pdf_text(input_data, input_size, output_data, output_size, 0);
+}
+
+/**
+ * Write each page range of an opened document as its own PDF. The document
+ * is parsed once; every output only contains the objects its pages reach.
+ * @param ranges - Pairs of first/last page (1-based, inclusive)
+ * @param page_sizes - Output buffer sizes; on return the size of each part
+ * @return -1 on error (page_sizes then holds the sizes the parts need), 0 on success
+ */
+static int pdf_split_ranges(PdfDoc* doc, const int* ranges, int num_ranges,
+                            unsigned char** page_data, int64_t* page_sizes) {
+    PdfCopy copy;
+    int status = 0;
+    int too_small = 0;
+
+    if (doc->encrypted || pdf_load_pages(doc) <= 0) return -1;
+    if (pdf_copy_init(&copy, &doc, 1, 0) != 0) {
+        pdf_copy_free(&copy);
+        return -1;
+    }
+
+    for (int i = 0; i < num_ranges && status == 0; i++) {
+        int first = ranges[i * 2] - 1;
+        int last = ranges[i * 2 + 1] - 1;
+        if (first < 0 || last < first || last >= doc->page_count) {
+            status = -1;
+            break;
+        }
+
+        pdf_copy_reset(&copy);
+        for (int p = first; p <= last && status == 0; p++) {
+            status = pdf_copy_add_page(&copy, 0, p);
+        }
+        if (status != 0) break;
+
+        PdfWriter writer = { page_data[i], page_data[i] && page_sizes[i] > 0 ? page_sizes[i] : 0, 0, 0, NULL };
+        int64_t written = pdf_copy_write(&copy, &writer);
+        if (written < 0) {
+            status = -1;
+            break;
+        }
+        // Keep measuring the remaining parts so the caller can size every buffer
+        if (!page_data[i] || written > page_sizes[i]) too_small = 1;
+        page_sizes[i] = written;
+    }
+
+    pdf_copy_free(&copy);
+    return status == 0 && !too_small ? 0 : -1;
+}
+
+/**
+ * Split PDF into multiple documents of consecutive pages
+ * @param input_data - Input PDF data
+ * @param input_size - Size of input data
+ * @param page_data - Array of output buffers, one per part (NULL ones are only measured)
+ * @param page_sizes - Buffer sizes in, part sizes out
+ * @param max_pages - Number of entries in page_data/page_sizes
+ * @param page_count - Number of parts; pages are distributed evenly
+ * @return -1 on error (page_sizes then holds the sizes the parts need), 0 on success
+ */
+EMSCRIPTEN_KEEPALIVE
+int split_pdf(unsigned char* input_data, int64_t input_size,
+              unsigned char** page_data, int64_t* page_sizes, int max_pages,
+              int page_count) {
+    ZELL_STATS_CALL("split_pdf", input_size);
+    if (!input_data || !page_data || !page_sizes || input_size <= 0 || 
+        max_pages <= 0 || page_count <= 0 || page_count > max_pages) {
+        return -1;
+    }
+
+    PdfDoc* doc = pdf_open(input_data, input_size);
+    if (!doc) {
+        return -1;
+    }
+
+    int total_pages = pdf_load_pages(doc);
+    int* ranges = (int*)malloc(sizeof(int) * 2 * page_count);
+    int result = -1;
+
+    if (ranges && total_pages >= page_count) {
+        for (int i = 0; i < page_count; i++) {
+            ranges[i * 2] = (int)((int64_t)i * total_pages / page_count) + 1;
+            ranges[i * 2 + 1] = (int)((int64_t)(i + 1) * total_pages / page_count);
+        }
+        result = pdf_split_ranges(doc, ranges, page_count, page_data, page_sizes);
+    }
+
+    free(ranges);
+    pdf_close(doc);
+    return ZELL_STATS_STATUS(result);
+}
+
+/**
+ * Count the pages of a PDF by walking its page tree
+ * @param input_data - Input PDF data
+ * @param input_size - Size of input data
+ * @return -1 on error, page count on success
+ */
+EMSCRIPTEN_KEEPALIVE
+int pdf_get_page_count(unsigned char* input_data, int64_t input_size) {
+    ZELL_STATS_CALL("pdf_get_page_count", input_size);
+    if (!input_data || input_size <= 0) {
+        return -1;
+    }
+
+    PdfDoc* doc = pdf_open(input_data, input_size);
+    if (!doc) {
+        return -1;
+    }
+
+    int page_count = pdf_load_pages(doc);
+    pdf_close(doc);
+    return ZELL_STATS_STATUS(page_count);
+}
+
+/**
+ * Split PDF into the given page ranges
+ * @param input_data - Input PDF data
+ * @param input_size - Size of input data
+ * @param ranges - Pairs of first/last page per output (1-based, inclusive)
+ * @param num_ranges - Number of outputs
+ * @param page_data - Array of output buffers, one per range (NULL ones are only measured)
+ * @param page_sizes - Buffer sizes in, output sizes out
+ * @return -1 on error (page_sizes then holds the sizes the outputs need), 0 on success
+ */
+EMSCRIPTEN_KEEPALIVE
+int split_pdf_ranges(unsigned char* input_data, int64_t input_size,
+                     const int* ranges, int num_ranges,
+                     unsigned char** page_data, int64_t* page_sizes) {
+    ZELL_STATS_CALL("split_pdf_ranges", input_size);
+    if (!input_data || !ranges || !page_data || !page_sizes || input_size <= 0 || num_ranges <= 0) {
+        return -1;
+    }
+
+    PdfDoc* doc = pdf_open(input_data, input_size);
+    if (!doc) {
+        return -1;
+    }
+
+    int result = pdf_split_ranges(doc, ranges, num_ranges, page_data, page_sizes);
+    pdf_close(doc);
+    return ZELL_STATS_STATUS(result);
+}
+
+// --- Image compilation -------------------------------------------------------
+//
+// A stack of photos or scans compiled into a PDF, one page per image.
+// JPEGs are embedded as they are (DCTDecode) and so are the IDAT streams of
+// plain PNGs (FlateDecode with the PNG predictor), so neither is decoded.
+// Only PNGs with transparency or interlacing are decoded, and their pixels
+// re-encoded with the image module.  Every page is written out before the
+// next image is opened: a job holds at most one decoded image and the
+// xref, whatever the number of pages.
+
+#define PDF_IMAGE_DPI 96         // when a file records no resolution
+#define PDF_IMAGE_SCRATCH 65536  // a marker segment, or one piece of a copy
+
+typedef struct {
+    double page_width;   // points; 0 sizes each page to its image
+    double page_height;
+    int image_quality;   // JPEG quality for decoded PNGs, 0 keeps them lossless
+} PdfCompileOptions;
+
+typedef struct {
+    int width;
+    int height;
+    int bpc;
+    int components;      // JPEG components; PNG samples per pixel
+    int orientation;     // EXIF orientation, 1-8
+    double dpi_x;
+    double dpi_y;
+    int adobe;           // JPEG with an Adobe marker (inverted CMYK)
+    int png;
+    int color_type;
+    int interlace;
+    int palette_size;
+    int trns_size;
+    int64_t idat_size;
+    unsigned char palette[768];
+    unsigned char trns[256];
+} PdfImageInfo;
+
+static int pdf_source_bytes(const ZellSource* source, int64_t offset, unsigned char* buffer, int64_t length) {
+    return zell_source_read(source, offset, buffer, length) == length ? 0 : -1;
+}
+
+static uint32_t pdf_be32(const unsigned char* p) {
+    return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3];
+}
+
+static uint32_t pdf_exif_u16(const unsigned char* p, int little) {
+    return little ? (uint32_t)(p[0] | p[1] << 8) : (uint32_t)(p[0] << 8 | p[1]);
+}
+
+static uint32_t pdf_exif_u32(const unsigned char* p, int little) {
+    return little ? pdf_exif_u16(p, 1) | pdf_exif_u16(p + 2, 1) << 16
+                  : pdf_exif_u16(p, 0) << 16 | pdf_exif_u16(p + 2, 0);
+}
+
+// Orientation tag of an APP1 Exif segment; 1 (upright) when there is none
+static int pdf_exif_orientation(const unsigned char* segment, size_t size) {
+    if (size < 14 || memcmp(segment, "Exif\0\0", 6) != 0) return 1;
+    const unsigned char* tiff = segment + 6;
+    size -= 6;
+    if (memcmp(tiff, "II", 2) != 0 && memcmp(tiff, "MM", 2) != 0) return 1;
+    int little = tiff[0] == 'I';
+
+    uint32_t ifd = pdf_exif_u32(tiff + 4, little);
+    if (ifd > size - 2) return 1;
+    uint32_t count = pdf_exif_u16(tiff + ifd, little);
+    for (uint32_t i = 0; i < count && ifd + 2 + 12 * (i + 1) <= size; i++) {
+        const unsigned char* entry = tiff + ifd + 2 + 12 * i;
+        if (pdf_exif_u16(entry, little) == 0x0112) {
+            uint32_t value = pdf_exif_u16(entry + 8, little);
+            return value >= 1 && value <= 8 ? (int)value : 1;
+        }
+    }
+    return 1;
+}
+
+// Walk the marker segments up to the frame header
+static int pdf_jpeg_info(const ZellSource* source, unsigned char* scratch, PdfImageInfo* info) {
+    unsigned char marker[4];
+    int64_t pos = 2;
+    for (;;) {
+        if (pdf_source_bytes(source, pos, marker, 4) != 0 || marker[0] != 0xFF) return -1;
+        int code = marker[1];
+        if (code == 0xFF) {
+            pos++;  // fill byte
+            continue;
+        }
+        if (code == 0x01 || (code >= 0xD0 && code <= 0xD8)) {
+            pos += 2;  // markers without a segment
+            continue;
+        }
+        if (code == 0xD9 || code == 0xDA) return -1;  // no frame header before the scan
+
+        int payload = (marker[2] << 8 | marker[3]) - 2;
+        if (payload < 0 || pdf_source_bytes(source, pos + 4, scratch, payload) != 0) return -1;
+
+        // Baseline, extended and progressive Huffman frames; DCTDecode has no
+        // lossless or arithmetic-coded mode
+        if (code == 0xC0 || code == 0xC1 || code == 0xC2) {
+            if (payload < 6) return -1;
+            info->bpc = scratch[0];
+            info->height = scratch[1] << 8 | scratch[2];
+            info->width = scratch[3] << 8 | scratch[4];
+            info->components = scratch[5];
+            return info->bpc == 8 && info->width > 0 && info->height > 0 &&
+                   (info->components == 1 || info->components == 3 || info->components == 4) ? 0 : -1;
         }
-    } else if (format == 1) { // PDF to TXT
-        // Extract text content (simplified)
-        int text_size = 0;
-        for (int i = 0; i < input_size && text_size < target_size; i++) {
-            if (input_data[i] >= 32 && input_data[i] <= 126) { // Printable ASCII
-                output_data[text_size++] = input_data[i];
+        if (code >= 0xC3 && code <= 0xCF && code != 0xC4 && code != 0xC8 && code != 0xCC) return -1;
+
+        if (code == 0xE0 && payload >= 12 && memcmp(scratch, "JFIF\0", 5) == 0) {
+            int units = scratch[7];
+            double x = scratch[8] << 8 | scratch[9];
+            double y = scratch[10] << 8 | scratch[11];
+            if ((units == 1 || units == 2) && x > 0 && y > 0) {
+                info->dpi_x = units == 2 ? x * 2.54 : x;
+                info->dpi_y = units == 2 ? y * 2.54 : y;
             }
+        } else if (code == 0xE1) {
+            info->orientation = pdf_exif_orientation(scratch, (size_t)payload);
+        } else if (code == 0xEE && payload >= 5 && memcmp(scratch, "Adobe", 5) == 0) {
+            info->adobe = 1;
         }
-        return text_size;
-    } else if (format == 2) { // PDF to DOCX
-        // Convert to DOCX format (simplified)
-        int docx_size = 0;
-        // Add DOCX header
-        const char* docx_header = "<?xml version=\"1.0\" encoding=\"UTF-8\"?>";
-        int header_len = strlen(docx_header);
-        if (docx_size + header_len < target_size) {
-            memcpy(output_data + docx_size, docx_header, header_len);
-            docx_size += header_len;
-        }
-        
-        // Add content
-        for (int i = 0; i < input_size && docx_size < target_size; i++) {
-            if (input_data[i] >= 32 && input_data[i] <= 126) {
-                output_data[docx_size++] = input_data[i];
+        pos += 2 + payload + 2;
+    }
+}
+
+// Walk the chunks: header, palette, transparency, resolution and the size
+// of the image data
+static int pdf_png_info(const ZellSource* source, PdfImageInfo* info) {
+    unsigned char chunk[13];
+    int64_t pos = 8;
+    int have_header = 0;
+    while (pos + 12 <= source->size) {
+        if (pdf_source_bytes(source, pos, chunk, 8) != 0) return -1;
+        int64_t length = pdf_be32(chunk);
+        if (length > INT32_MAX || pos + 12 + length > source->size) return -1;
+        const unsigned char* type = chunk + 4;
+
+        if (!memcmp(type, "IHDR", 4)) {
+            if (length != 13 || pdf_source_bytes(source, pos + 8, chunk, 13) != 0) return -1;
+            info->width = (int)pdf_be32(chunk);
+            info->height = (int)pdf_be32(chunk + 4);
+            info->bpc = chunk[8];
+            info->color_type = chunk[9];
+            info->interlace = chunk[12];
+            if (chunk[10] != 0 || chunk[11] != 0 || info->interlace > 1) return -1;
+            have_header = 1;
+        } else if (!memcmp(type, "PLTE", 4)) {
+            if (length % 3 != 0 || length > 768 ||
+                pdf_source_bytes(source, pos + 8, info->palette, length) != 0) return -1;
+            info->palette_size = (int)(length / 3);
+        } else if (!memcmp(type, "tRNS", 4)) {
+            if (length > 256 || pdf_source_bytes(source, pos + 8, info->trns, length) != 0) return -1;
+            info->trns_size = (int)length;
+        } else if (!memcmp(type, "pHYs", 4) && length == 9) {
+            if (pdf_source_bytes(source, pos + 8, chunk, 9) != 0) return -1;
+            if (chunk[8] == 1 && pdf_be32(chunk) > 0 && pdf_be32(chunk + 4) > 0) {
+                info->dpi_x = pdf_be32(chunk) * 0.0254;  // pixels per meter
+                info->dpi_y = pdf_be32(chunk + 4) * 0.0254;
             }
+        } else if (!memcmp(type, "IDAT", 4)) {
+            info->idat_size += length;
+        } else if (!memcmp(type, "IEND", 4)) {
+            break;
         }
-        return docx_size;
+        pos += 12 + length;
     }
-    
-    return target_size;
+
+    int depth = info->bpc;
+    switch (info->color_type) {
+        case 0: info->components = 1; break;
+        case 2: info->components = 3; break;
+        case 3: info->components = 1; break;
+        case 4: info->components = 2; break;
+        case 6: info->components = 4; break;
+        default: return -1;
+    }
+    int depth_ok = depth == 8 || depth == 16 ||
+                   ((info->color_type == 0 || info->color_type == 3) && (depth == 1 || depth == 2 || depth == 4));
+    if (info->color_type == 3 && (depth == 16 || info->palette_size == 0)) return -1;
+    return have_header && depth_ok && info->width > 0 && info->height > 0 && info->idat_size > 0 ? 0 : -1;
 }
 
-/**
- * Merge multiple PDFs into one
- * @param pdf_files - Array of PDF data pointers
- * @param file_sizes - Array of file sizes
- * @param num_files - Number of files to merge
- * @param output_data - Output buffer
- * @param output_size - Size of output buffer
- * @return -1 on error, merged size on success
- */
-EMSCRIPTEN_KEEPALIVE
-int merge_pdfs(unsigned char** pdf_files, int* file_sizes, int num_files,
-               unsigned char* output_data, int output_size) {
-    if (!pdf_files || !file_sizes || !output_data || num_files <= 0 || output_size <= 0) {
-        return -1;
+static int pdf_image_info(const ZellSource* source, unsigned char* scratch, PdfImageInfo* info) {
+    memset(info, 0, sizeof(*info));
+    info->orientation = 1;
+    info->dpi_x = info->dpi_y = PDF_IMAGE_DPI;
+    if (source->size >= 4 && pdf_source_bytes(source, 0, scratch, 8 < source->size ? 8 : 4) == 0) {
+        if (scratch[0] == 0xFF && scratch[1] == 0xD8) return pdf_jpeg_info(source, scratch, info);
+        if (source->size >= 8 && !memcmp(scratch, "\x89PNG\r\n\x1a\n", 8)) {
+            info->png = 1;
+            return pdf_png_info(source, info);
+        }
     }
-    
-    int total_size = 0;
-    int offset = 0;
-    
-    // Calculate total size
-    for (int i = 0; i < num_files; i++) {
-        total_size += file_sizes[i];
+    return -1;  // only JPEG and PNG can be compiled
+}
+
+// Copy part of a source into the output, piece by piece unless it is resident
+static int pdf_put_source(PdfWriter* w, const ZellSource* source, int64_t offset, int64_t length,
+                          unsigned char* scratch) {
+    if (source->data) {
+        pdf_put(w, source->data + offset, (size_t)length);
+        return 0;
     }
-    
-    if (total_size > output_size) {
-        return -1; // Output buffer too small
+    while (length > 0) {
+        int64_t piece = length < PDF_IMAGE_SCRATCH ? length : PDF_IMAGE_SCRATCH;
+        if (pdf_source_bytes(source, offset, scratch, piece) != 0) return -1;
+        pdf_put(w, scratch, (size_t)piece);
+        offset += piece;
+        length -= piece;
     }
-    
-    // Add PDF header
-    const char* pdf_header = "%PDF-1.4\n";
-    int header_len = strlen(pdf_header);
-    if (offset + header_len < output_size) {
-        memcpy(output_data + offset, pdf_header, header_len);
-        offset += header_len;
+    return 0;
+}
+
+// Call `fn` with the position and length of every IDAT chunk, in order
+static int pdf_png_each_idat(const ZellSource* source, int (*fn)(void* ctx, int64_t offset, int64_t length),
+                             void* ctx) {
+    unsigned char chunk[8];
+    int64_t pos = 8;
+    while (pos + 12 <= source->size) {
+        if (pdf_source_bytes(source, pos, chunk, 8) != 0) return -1;
+        int64_t length = pdf_be32(chunk);
+        if (!memcmp(chunk + 4, "IDAT", 4) && fn(ctx, pos + 8, length) != 0) return -1;
+        if (!memcmp(chunk + 4, "IEND", 4)) break;
+        pos += 12 + length;
     }
-    
-    // Concatenate PDF files (simplified - real implementation would need proper PDF merging)
-    for (int i = 0; i < num_files; i++) {
-        if (pdf_files[i] && file_sizes[i] > 0) {
-            // Skip PDF header from subsequent files
-            int skip_header = 0;
-            if (i > 0 && file_sizes[i] > 8) {
-                if (memcmp(pdf_files[i], "%PDF-", 5) == 0) {
-                    skip_header = 8; // Skip header
+    return 0;
+}
+
+typedef struct {
+    PdfWriter* w;
+    const ZellSource* source;
+    unsigned char* buffer;   // scratch when copying, destination when gathering
+    int64_t gathered;
+} PdfIdatCopy;
+
+static int pdf_idat_put(void* ctx, int64_t offset, int64_t length) {
+    PdfIdatCopy* copy = (PdfIdatCopy*)ctx;
+    return pdf_put_source(copy->w, copy->source, offset, length, copy->buffer);
+}
+
+static int pdf_idat_gather(void* ctx, int64_t offset, int64_t length) {
+    PdfIdatCopy* copy = (PdfIdatCopy*)ctx;
+    if (pdf_source_bytes(copy->source, offset, copy->buffer + copy->gathered, length) != 0) return -1;
+    copy->gathered += length;
+    return 0;
+}
+
+// One sample of a packed PNG row
+static inline uint32_t pdf_png_sample(const unsigned char* row, size_t index, int depth) {
+    if (depth == 8) return row[index];
+    if (depth == 16) return (uint32_t)(row[index * 2] << 8 | row[index * 2 + 1]);
+    size_t bit = index * (size_t)depth;
+    return (uint32_t)(row[bit / 8] >> (8 - depth - (int)(bit % 8))) & ((1u << depth) - 1);
+}
+
+static inline uint32_t pdf_png_trns(const PdfImageInfo* info, int i) {
+    return (uint32_t)(info->trns[i * 2] << 8 | info->trns[i * 2 + 1]);
+}
+
+/**
+ * Decode PNG image data into 8-bit gray or RGB pixels and, if any pixel is
+ * not opaque, an alpha plane
+ * @param raw - Inflated image data, filtered; unfiltered in place
+ * @param channels - Receives 1 or 3
+ * @param alpha - Receives the alpha plane (pool buffer) or NULL
+ * @return Pool buffer of pixels, or NULL on error
+ */
+static unsigned char* pdf_png_decode(const PdfImageInfo* info, unsigned char* raw, size_t raw_size,
+                                     int* channels, unsigned char** alpha) {
+    static const int start_x[7] = { 0, 4, 0, 2, 0, 1, 0 };
+    static const int start_y[7] = { 0, 0, 4, 0, 2, 0, 1 };
+    static const int step_x[7] = { 8, 8, 4, 4, 2, 2, 1 };
+    static const int step_y[7] = { 8, 8, 8, 4, 4, 2, 2 };
+
+    int depth = info->bpc;
+    int spp = info->components;
+    int color = info->color_type == 2 || info->color_type == 3 || info->color_type == 6;
+    int has_alpha = info->color_type == 4 || info->color_type == 6 || info->trns_size > 0;
+    size_t pixel_count = (size_t)info->width * info->height;
+    size_t bpp = (size_t)(spp * depth + 7) / 8;
+    uint32_t max = (1u << depth) - 1;
+
+    *channels = color ? 3 : 1;
+    *alpha = NULL;
+    unsigned char* pixels = (unsigned char*)zell_pool_get(pixel_count * *channels);
+    unsigned char* mask = has_alpha ? (unsigned char*)zell_pool_get(pixel_count) : NULL;
+    if (!pixels || (has_alpha && !mask)) goto fail;
+
+    size_t offset = 0;
+    int passes = info->interlace ? 7 : 1;
+    for (int pass = 0; pass < passes; pass++) {
+        int x0 = info->interlace ? start_x[pass] : 0, dx = info->interlace ? step_x[pass] : 1;
+        int y0 = info->interlace ? start_y[pass] : 0, dy = info->interlace ? step_y[pass] : 1;
+        size_t pass_width = info->width > x0 ? (size_t)(info->width - x0 + dx - 1) / dx : 0;
+        size_t pass_height = info->height > y0 ? (size_t)(info->height - y0 + dy - 1) / dy : 0;
+        if (!pass_width || !pass_height) continue;
+
+        size_t row_bytes = (pass_width * spp * depth + 7) / 8;
+        if (offset + pass_height * (row_bytes + 1) > raw_size) goto fail;
+        unsigned char* data = raw + offset;
+        if (pdf_png_unfilter(data, pass_height, row_bytes, bpp) != 0) goto fail;
+        offset += pass_height * (row_bytes + 1);
+
+        for (size_t r = 0; r < pass_height; r++) {
+            const unsigned char* row = data + r * row_bytes;
+            for (size_t i = 0; i < pass_width; i++) {
+                size_t at = ((size_t)(y0 + r * dy) * info->width + x0 + i * dx);
+                unsigned char* out = pixels + at * *channels;
+                uint32_t a = 255;
+                if (info->color_type == 3) {
+                    uint32_t index = pdf_png_sample(row, i, depth);
+                    const unsigned char* rgb = index < (uint32_t)info->palette_size ? info->palette + index * 3
+                                                                                   : info->palette;
+                    memcpy(out, rgb, 3);
+                    if (index < (uint32_t)info->trns_size) a = info->trns[index];
+                } else {
+                    uint32_t s[4];
+                    for (int k = 0; k < spp; k++) s[k] = pdf_png_sample(row, i * spp + k, depth);
+                    int colors = color ? 3 : 1;
+                    for (int k = 0; k < colors; k++) out[k] = (unsigned char)(s[k] * 255 / max);
+                    if (spp > colors) {
+                        a = s[colors] * 255 / max;
+                    } else if (info->trns_size >= colors * 2) {
+                        int key = 1;
+                        for (int k = 0; k < colors; k++) key &= s[k] == (pdf_png_trns(info, k) & max);
+                        if (key) a = 0;
+                    }
                 }
-            }
-            
-            int copy_size = file_sizes[i] - skip_header;
-            if (offset + copy_size < output_size) {
-                memcpy(output_data + offset, pdf_files[i] + skip_header, copy_size);
-                offset += copy_size;
+                if (mask) mask[at] = (unsigned char)a;
             }
         }
     }
-    
-    // Add PDF footer
-    const char* pdf_footer = "\n%%EOF\n";
-    int footer_len = strlen(pdf_footer);
-    if (offset + footer_len < output_size) {
-        memcpy(output_data + offset, pdf_footer, footer_len);
-        offset += footer_len;
+
+    // A tRNS chunk often marks a color that never occurs
+    if (mask) {
+        size_t i = 0;
+        while (i < pixel_count && mask[i] == 255) i++;
+        if (i == pixel_count) {
+            zell_pool_put(mask);
+            mask = NULL;
+        }
     }
-    
-    return offset;
+    *alpha = mask;
+    return pixels;
+
+fail:
+    zell_pool_put(pixels);
+    zell_pool_put(mask);
+    return NULL;
+}
+
+static void pdf_put_object_start(PdfWriter* w, int64_t* offsets, int num) {
+    offsets[num] = w->length;
+    pdf_put_int(w, num);
+    pdf_puts(w, " 0 obj\n");
+}
+
+// Image dict entries shared by every kind of image, up to the filter
+static void pdf_put_image_head(PdfWriter* w, int width, int height, const char* color_space, int bpc) {
+    pdf_puts(w, "<</Type/XObject/Subtype/Image/Width ");
+    pdf_put_int(w, width);
+    pdf_puts(w, "/Height ");
+    pdf_put_int(w, height);
+    pdf_puts(w, "/BitsPerComponent ");
+    pdf_put_int(w, bpc);
+    pdf_puts(w, "/ColorSpace");
+    if (color_space) pdf_puts(w, color_space);
+}
+
+static void pdf_put_stream_start(PdfWriter* w, int64_t size) {
+    pdf_puts(w, "/Length ");
+    pdf_put_int(w, size);
+    pdf_puts(w, ">>\nstream\n");
+}
+
+static void pdf_put_stream_end(PdfWriter* w) {
+    pdf_puts(w, "\nendstream\nendobj\n");
+}
+
+static void pdf_put_palette(PdfWriter* w, const PdfImageInfo* info) {
+    static const char hex[] = "0123456789abcdef";
+    pdf_puts(w, "[/Indexed/DeviceRGB ");
+    pdf_put_int(w, info->palette_size - 1);
+    pdf_puts(w, "<");
+    for (int i = 0; i < info->palette_size * 3; i++) {
+        char digits[2] = { hex[info->palette[i] >> 4], hex[info->palette[i] & 15] };
+        pdf_put(w, digits, 2);
+    }
+    pdf_puts(w, ">]");
+}
+
+// Decode a PNG that cannot be embedded as it is, and write its pixels (JPEG
+// or deflated) and alpha plane (deflated) as objects num and num + 1
+static int pdf_put_decoded_png(PdfWriter* w, int64_t* offsets, int num, const ZellSource* source,
+                               const PdfImageInfo* info, const PdfCompileOptions* options, int* has_mask) {
+    ZELL_STATS_STAGE(ZELL_STAGE_DECODE, "png_decode");
+    PdfIdatCopy copy = { w, source, (unsigned char*)zell_pool_get((size_t)info->idat_size), 0 };
+    unsigned char* raw = NULL;
+    unsigned char* pixels = NULL;
+    unsigned char* alpha = NULL;
+    unsigned char* encoded = NULL;
+    unsigned char* packed_alpha = NULL;
+    size_t raw_size = 0, encoded_size = 0, alpha_size = 0;
+    int channels = 0, jpeg = 0, result = -1;
+
+    if (!copy.buffer || pdf_png_each_idat(source, pdf_idat_gather, &copy) != 0) goto done;
+    raw = pdf_inflate(copy.buffer, (size_t)copy.gathered, &raw_size, NULL);
+    if (!raw) goto done;
+    pixels = pdf_png_decode(info, raw, raw_size, &channels, &alpha);
+    if (!pixels) goto done;
+
+    size_t pixel_bytes = (size_t)info->width * info->height * channels;
+    if (options->image_quality > 0) {
+        encoded = (unsigned char*)zell_pool_get(pixel_bytes);
+        int64_t size = encoded ? encode_jpeg(pixels, info->width, info->height, channels,
+                                             options->image_quality, encoded, (int64_t)pixel_bytes) : -1;
+        if (size > 0) {
+            encoded_size = (size_t)size;
+            jpeg = 1;
+        } else {
+            zell_pool_put(encoded);  // no smaller than the pixels: keep them lossless
+            encoded = NULL;
+        }
+    }
+    if (!encoded) encoded = pdf_deflate(pixels, pixel_bytes, ZELL_DEFLATE_DEFAULT, &encoded_size);
+    if (alpha) packed_alpha = pdf_deflate(alpha, (size_t)info->width * info->height, ZELL_DEFLATE_DEFAULT,
+                                          &alpha_size);
+    if (!encoded || (alpha && !packed_alpha)) goto done;
+
+    pdf_put_object_start(w, offsets, num);
+    pdf_put_image_head(w, info->width, info->height, channels == 1 ? "/DeviceGray" : "/DeviceRGB", 8);
+    pdf_puts(w, jpeg ? "/Filter/DCTDecode" : "/Filter/FlateDecode");
+    if (alpha) {
+        pdf_puts(w, "/SMask ");
+        pdf_put_int(w, num + 1);
+        pdf_puts(w, " 0 R");
+    }
+    pdf_put_stream_start(w, (int64_t)encoded_size);
+    pdf_put(w, encoded, encoded_size);
+    pdf_put_stream_end(w);
+
+    if (alpha) {
+        pdf_put_object_start(w, offsets, num + 1);
+        pdf_put_image_head(w, info->width, info->height, "/DeviceGray", 8);
+        pdf_puts(w, "/Filter/FlateDecode");
+        pdf_put_stream_start(w, (int64_t)alpha_size);
+        pdf_put(w, packed_alpha, alpha_size);
+        pdf_put_stream_end(w);
+    }
+    *has_mask = alpha != NULL;
+    result = 0;
+
+done:
+    zell_pool_put(copy.buffer);
+    zell_pool_put(raw);
+    zell_pool_put(pixels);
+    zell_pool_put(alpha);
+    zell_pool_put(encoded);
+    zell_pool_put(packed_alpha);
+    return result;
 }
 
 /**
- * Extract text from PDF
- * @param input_data - Input PDF data
- * @param input_size - Size of input data
- * @param output_data - Output buffer
- * @param output_size - Size of output buffer
- * @return -1 on error, extracted text size on success
+ * Write the image XObject of one page as object num (and its soft mask as
+ * num + 1)
+ * @param has_mask - Receives whether num + 1 was used
+ * @return -1 on error, 0 on success
  */
-EMSCRIPTEN_KEEPALIVE
-int extract_text(unsigned char* input_data, int input_size,
-                 unsigned char* output_data, int output_size) {
-    if (!input_data || !output_data || input_size <= 0 || output_size <= 0) {
-        return -1;
+static int pdf_put_image(PdfWriter* w, int64_t* offsets, int num, const ZellSource* source,
+                         const PdfImageInfo* info, const PdfCompileOptions* options,
+                         unsigned char* scratch, int* has_mask) {
+    static const char* const device[] = { NULL, "/DeviceGray", NULL, "/DeviceRGB", "/DeviceCMYK" };
+    *has_mask = 0;
+
+    if (!info->png) {
+        pdf_put_object_start(w, offsets, num);
+        pdf_put_image_head(w, info->width, info->height, device[info->components], 8);
+        pdf_puts(w, "/Filter/DCTDecode");
+        if (info->components == 4 && info->adobe) pdf_puts(w, "/Decode[1 0 1 0 1 0 1 0]");
+        pdf_put_stream_start(w, source->size);
+        if (pdf_put_source(w, source, 0, source->size, scratch) != 0) return -1;
+        pdf_put_stream_end(w);
+        return 0;
     }
-    
-    int text_size = 0;
-    int in_text_object = 0;
-    
-    for (int i = 0; i < input_size && text_size < output_size - 1; i++) {
-        // Look for text objects in PDF
-        if (i < input_size - 4) {
-            if (memcmp(input_data + i, "BT", 2) == 0) {
-                in_text_object = 1;
-                i += 1; // Skip 'T'
-                continue;
-            } else if (memcmp(input_data + i, "ET", 2) == 0) {
-                in_text_object = 0;
-                i += 1; // Skip 'T'
-                continue;
-            }
-        }
-        
-        // Extract text content
-        if (in_text_object) {
-            if (input_data[i] == '(') {
-                // Start of text string
-                i++;
-                while (i < input_size && input_data[i] != ')' && text_size < output_size - 1) {
-                    if (input_data[i] >= 32 && input_data[i] <= 126) {
-                        output_data[text_size++] = input_data[i];
-                    }
-                    i++;
-                }
-                if (text_size < output_size - 1) {
-                    output_data[text_size++] = ' '; // Add space between text strings
-                }
-            }
+
+    if (info->interlace || info->trns_size || info->color_type == 4 || info->color_type == 6) {
+        return pdf_put_decoded_png(w, offsets, num, source, info, options, has_mask);
+    }
+
+    // The zlib stream of the IDAT chunks, with the PNG predictor to undo the
+    // row filters, is already a valid FlateDecode stream
+    pdf_put_object_start(w, offsets, num);
+    pdf_put_image_head(w, info->width, info->height, info->color_type == 3 ? NULL : device[info->components],
+                       info->bpc);
+    if (info->color_type == 3) pdf_put_palette(w, info);
+    pdf_puts(w, "/Filter/FlateDecode/DecodeParms<</Predictor 15/Colors ");
+    pdf_put_int(w, info->components);
+    pdf_puts(w, "/BitsPerComponent ");
+    pdf_put_int(w, info->bpc);
+    pdf_puts(w, "/Columns ");
+    pdf_put_int(w, info->width);
+    pdf_puts(w, ">>");
+    pdf_put_stream_start(w, info->idat_size);
+    PdfIdatCopy copy = { w, source, scratch, 0 };
+    if (pdf_png_each_idat(source, pdf_idat_put, &copy) != 0) return -1;
+    pdf_put_stream_end(w);
+    return 0;
+}
+
+// Page size and the matrix that draws the image upright on it: sized from
+// the image resolution, or shrunk to fit the requested page (turned to the
+// image's orientation) and centered
+static void pdf_image_layout(const PdfImageInfo* info, const PdfCompileOptions* options,
+                             double* page_width, double* page_height, double matrix[6]) {
+    int turned = info->orientation >= 5;  // EXIF 5-8 swap width and height
+    double width = (turned ? info->height : info->width) * 72.0 / (turned ? info->dpi_y : info->dpi_x);
+    double height = (turned ? info->width : info->height) * 72.0 / (turned ? info->dpi_x : info->dpi_y);
+    double x = 0, y = 0;
+
+    if (options->page_width > 0 && options->page_height > 0) {
+        double pw = options->page_width, ph = options->page_height;
+        if ((width > height) != (pw > ph)) {
+            double swap = pw;
+            pw = ph;
+            ph = swap;
         }
+        double scale = fmin(1.0, fmin(pw / width, ph / height));
+        width *= scale;
+        height *= scale;
+        x = (pw - width) / 2;
+        y = (ph - height) / 2;
+        *page_width = pw;
+        *page_height = ph;
+    } else {
+        *page_width = width;
+        *page_height = height;
     }
-    
-    // Null terminate
-    if (text_size < output_size) {
-        output_data[text_size] = '\0';
+
+    // Map the unit square the image is drawn in (first row at the top)
+    // onto the page so the result looks the way EXIF says it should
+    double w = width, h = height;
+    double m[9][6] = {
+        { w, 0, 0, h, 0, 0 },
+        { w, 0, 0, h, 0, 0 },     // 1: upright
+        { -w, 0, 0, h, w, 0 },    // 2: mirrored
+        { -w, 0, 0, -h, w, h },   // 3: upside down
+        { w, 0, 0, -h, 0, h },    // 4: flipped
+        { 0, -h, -w, 0, w, h },   // 5: transposed
+        { 0, -h, w, 0, 0, h },    // 6: turned right
+        { 0, h, w, 0, 0, 0 },     // 7: transversed
+        { 0, h, -w, 0, w, 0 },    // 8: turned left
+    };
+    memcpy(matrix, m[info->orientation], sizeof(m[0]));
+    matrix[4] += x;
+    matrix[5] += y;
+}
+
+// Content stream and page object of one page, drawing image `image_num`
+static void pdf_put_image_page(PdfWriter* w, int64_t* offsets, int num, int image_num,
+                               const PdfImageInfo* info, const PdfCompileOptions* options) {
+    double page_width, page_height, matrix[6];
+    pdf_image_layout(info, options, &page_width, &page_height, matrix);
+
+    unsigned char content[256];
+    PdfWriter body = { content, sizeof(content), 0, 0, NULL };
+    pdf_puts(&body, "q ");
+    for (int i = 0; i < 6; i++) {
+        pdf_put_real(&body, matrix[i]);
+        pdf_puts(&body, " ");
     }
-    
-    return text_size;
+    pdf_puts(&body, "cm /Im0 Do Q");
+
+    pdf_put_object_start(w, offsets, num);
+    pdf_puts(w, "<<");
+    pdf_put_stream_start(w, body.length);
+    pdf_put(w, content, (size_t)body.length);
+    pdf_put_stream_end(w);
+
+    pdf_put_object_start(w, offsets, num + 1);
+    pdf_puts(w, "<</Type/Page/Parent 2 0 R/MediaBox[0 0 ");
+    pdf_put_real(w, page_width);
+    pdf_puts(w, " ");
+    pdf_put_real(w, page_height);
+    pdf_puts(w, "]/Resources<</XObject<</Im0 ");
+    pdf_put_int(w, image_num);
+    pdf_puts(w, " 0 R>>>>/Contents ");
+    pdf_put_int(w, num);
+    pdf_puts(w, " 0 R>>\nendobj\n");
 }
 
+// Opens input `index` of a job as a source (released with zell_source_close)
+typedef int (*PdfImageOpen)(void* ctx, int index, ZellSource* source);
+
 /**
- * Split PDF into multiple pages
- * @param input_data - Input PDF data
- * @param input_size - Size of input data
- * @param page_data - Array of output buffers for each page
- * @param page_sizes - Array of page sizes
- * @param max_pages - Maximum number of pages
- * @param page_count - Number of pages to split
- * @return -1 on error, 0 on success
+ * Compile images into a PDF, one page each, in order
+ * @return -1 on error, output size on success
+ */
+static int64_t pdf_compile_images(int count, PdfImageOpen open, void* ctx,
+                                  const PdfCompileOptions* options, PdfWriter* w) {
+    // Objects 1 and 2 are the catalog and page tree, written last; each page
+    // takes up to four after them
+    int64_t* offsets = (int64_t*)malloc(((size_t)count * 4 + 3) * sizeof(int64_t));
+    int* pages = (int*)malloc((size_t)count * sizeof(int));
+    unsigned char* scratch = (unsigned char*)zell_pool_get(PDF_IMAGE_SCRATCH);
+    int64_t result = -1;
+    int next = 3;
+    if (!offsets || !pages || !scratch) goto done;
+
+    pdf_put_header(w);
+    for (int i = 0; i < count; i++) {
+        ZELL_STATS_STAGE(ZELL_STAGE_WRITE, "pdf_image_page");
+        ZellSource source;
+        PdfImageInfo info;
+        int has_mask = 0;
+        if (open(ctx, i, &source) != 0) goto done;
+        int ok = pdf_image_info(&source, scratch, &info) == 0 &&
+                 pdf_put_image(w, offsets, next, &source, &info, options, scratch, &has_mask) == 0;
+        zell_source_close(&source);
+        if (!ok || (w->sink && w->sink->failed)) goto done;
+
+        int image_num = next;
+        next += has_mask ? 2 : 1;
+        pdf_put_image_page(w, offsets, next, image_num, &info, options);
+        pages[i] = next + 1;
+        next += 2;
+    }
+
+    offsets[1] = w->length;
+    pdf_puts(w, "1 0 obj\n<</Type/Catalog/Pages 2 0 R>>\nendobj\n");
+    offsets[2] = w->length;
+    pdf_puts(w, "2 0 obj\n<</Type/Pages/Kids[");
+    for (int i = 0; i < count; i++) {
+        if (i) pdf_puts(w, " ");
+        pdf_put_int(w, pages[i]);
+        pdf_puts(w, " 0 R");
+    }
+    pdf_puts(w, "]/Count ");
+    pdf_put_int(w, count);
+    pdf_puts(w, ">>\nendobj\n");
+    pdf_put_xref(w, offsets, next - 1, 1);
+
+    result = w->length;
+    if (w->data && result > w->capacity) {
+        result = -1; // Output buffer too small
+    }
+
+done:
+    free(offsets);
+    free(pages);
+    zell_pool_put(scratch);
+    return result;
+}
+
+typedef struct {
+    unsigned char** data;
+    const int64_t* sizes;
+} PdfImageBuffers;
+
+static int pdf_image_open_buffer(void* ctx, int index, ZellSource* source) {
+    PdfImageBuffers* buffers = (PdfImageBuffers*)ctx;
+    if (!buffers->data[index] || buffers->sizes[index] <= 0) return -1;
+    zell_source_memory(source, buffers->data[index], buffers->sizes[index]);
+    return 0;
+}
+
+/**
+ * Compile JPEG and PNG images into a PDF, one page per image
+ * @param images - Array of image data pointers
+ * @param image_sizes - Array of image sizes
+ * @param num_images - Number of images (pages)
+ * @param output_data - Output buffer, or NULL to only measure the output
+ * @param output_size - Size of output buffer (0 when measuring)
+ * @param page_width - Page width in points, or 0 to size each page to its image
+ * @param page_height - Page height in points, or 0 to size each page to its image
+ * @param image_quality - JPEG quality for PNGs that have to be decoded (1-100),
+ *                        or 0 to keep them lossless
+ * @return -1 on error, PDF size on success
  */
 EMSCRIPTEN_KEEPALIVE
-int split_pdf(unsigned char* input_data, int input_size,
-              unsigned char** page_data, int* page_sizes, int max_pages,
-              int page_count) {
-    if (!input_data || !page_data || !page_sizes || input_size <= 0 || 
-        max_pages <= 0 || page_count <= 0 || page_count > max_pages) {
+int64_t images_to_pdf(unsigned char** images, const int64_t* image_sizes, int num_images,
+                      unsigned char* output_data, int64_t output_size,
+                      int page_width, int page_height, int image_quality) {
+    ZELL_STATS_CALL("images_to_pdf", zell_stats_total(image_sizes, num_images));
+    if (!images || !image_sizes || num_images <= 0 || !zell_output_valid(output_data, output_size)) {
         return -1;
     }
-    
-    // Simple PDF splitting (in real implementation, would need proper PDF parsing)
-    int page_size = input_size / page_count;
-    
-    for (int i = 0; i < page_count; i++) {
-        int start_offset = i * page_size;
-        int end_offset = (i + 1) * page_size;
-        if (i == page_count - 1) {
-            end_offset = input_size; // Last page gets remaining data
-        }
-        
-        int current_page_size = end_offset - start_offset;
-        if (current_page_size > page_sizes[i]) {
-            current_page_size = page_sizes[i];
-        }
-        
-        memcpy(page_data[i], input_data + start_offset, current_page_size);
-        page_sizes[i] = current_page_size;
+
+    PdfImageBuffers buffers = { images, image_sizes };
+    PdfCompileOptions options = { page_width, page_height, image_quality };
+    PdfWriter writer = { output_data, output_size, 0, 0, NULL };
+    return ZELL_STATS_RESULT(pdf_compile_images(num_images, pdf_image_open_buffer, &buffers, &options, &writer));
+}
+
+// --- File and callback inputs ------------------------------------------------
+//
+// The same operations on inputs that are not held in memory: a file path
+// (mapped in native builds, read on demand otherwise) or a read callback.
+// Only the xref, the objects that are touched and the stream data actually
+// needed are read, so large files are processed with a small working set.
+
+static PdfDoc* pdf_open_file(const char* path, ZellSource* source) {
+    if (!path || zell_source_open_file(source, path) != 0) return NULL;
+    PdfDoc* doc = pdf_open_source(source);
+    if (!doc) zell_source_close(source);
+    return doc;
+}
+
+static PdfDoc* pdf_open_callback(ZellReadAt read_at, void* ctx, int64_t input_size,
+                                 int concurrent, ZellSource* source) {
+    if (!read_at || input_size <= 0) return NULL;
+    zell_source_callback(source, read_at, ctx, input_size, concurrent);
+    return pdf_open_source(source);
+}
+
+/**
+ * Get the number of pages of a PDF file
+ * @param path - Path of the PDF
+ * @return -1 on error, page count on success
+ */
+EMSCRIPTEN_KEEPALIVE
+int pdf_get_page_count_file(const char* path) {
+    ZELL_STATS_CALL("pdf_get_page_count_file", 0);
+    ZellSource source;
+    PdfDoc* doc = pdf_open_file(path, &source);
+    if (!doc) return -1;
+    ZELL_STATS_INPUT(source.size);
+
+    int page_count = pdf_load_pages(doc);
+    pdf_close(doc);
+    zell_source_close(&source);
+    return ZELL_STATS_STATUS(page_count);
+}
+
+/**
+ * Get the number of pages of a PDF read through a callback
+ * @param read_at - Reads part of the input (see ZellReadAt)
+ * @param ctx - Opaque pointer passed to read_at
+ * @param input_size - Size of the input
+ * @param concurrent - Whether read_at may be called from several threads at once
+ * @return -1 on error, page count on success
+ */
+EMSCRIPTEN_KEEPALIVE
+int pdf_get_page_count_source(ZellReadAt read_at, void* ctx, int64_t input_size, int concurrent) {
+    ZELL_STATS_CALL("pdf_get_page_count_source", input_size);
+    ZellSource source;
+    PdfDoc* doc = pdf_open_callback(read_at, ctx, input_size, concurrent, &source);
+    if (!doc) return -1;
+
+    int page_count = pdf_load_pages(doc);
+    pdf_close(doc);
+    return ZELL_STATS_STATUS(page_count);
+}
+
+/**
+ * Extract the text of a PDF file (see extract_pdf_text)
+ * @param path - Path of the PDF
+ * @return -1 on error, extracted text size on success
+ */
+EMSCRIPTEN_KEEPALIVE
+int64_t extract_pdf_text_file(const char* path, unsigned char* output_data, int64_t output_size,
+                              int num_threads) {
+    ZELL_STATS_CALL("extract_pdf_text_file", 0);
+    if (!zell_output_valid(output_data, output_size)) return -1;
+    ZellSource source;
+    PdfDoc* doc = pdf_open_file(path, &source);
+    if (!doc) return -1;
+    ZELL_STATS_INPUT(source.size);
+
+    PdfWriter writer = { output_data, output_size, 0, 0, NULL };
+    int64_t result = pdf_extract_text_doc(doc, &writer, num_threads);
+    pdf_close(doc);
+    zell_source_close(&source);
+    return ZELL_STATS_RESULT(result);
+}
+
+/**
+ * Extract the text of a PDF read through a callback (see extract_pdf_text)
+ * @param read_at - Reads part of the input (see ZellReadAt)
+ * @param ctx - Opaque pointer passed to read_at
+ * @param input_size - Size of the input
+ * @param concurrent - Whether read_at may be called from several threads at once
+ * @return -1 on error, extracted text size on success
+ */
+EMSCRIPTEN_KEEPALIVE
+int64_t extract_pdf_text_source(ZellReadAt read_at, void* ctx, int64_t input_size, int concurrent,
+                                unsigned char* output_data, int64_t output_size, int num_threads) {
+    ZELL_STATS_CALL("extract_pdf_text_source", input_size);
+    if (!zell_output_valid(output_data, output_size)) return -1;
+    ZellSource source;
+    PdfDoc* doc = pdf_open_callback(read_at, ctx, input_size, concurrent, &source);
+    if (!doc) return -1;
+
+    PdfWriter writer = { output_data, output_size, 0, 0, NULL };
+    int64_t result = pdf_extract_text_doc(doc, &writer, num_threads);
+    pdf_close(doc);
+    return ZELL_STATS_RESULT(result);
+}
+
+/**
+ * Compress a PDF file (see compress_pdf)
+ * @param path - Path of the PDF
+ * @return -1 on error, output size on success
+ */
+EMSCRIPTEN_KEEPALIVE
+int64_t compress_pdf_file(const char* path, unsigned char* output_data, int64_t output_size,
+                          int image_quality, int target_dpi) {
+    ZELL_STATS_CALL("compress_pdf_file", 0);
+    if (!zell_output_valid(output_data, output_size)) return -1;
+    ZellSource source;
+    PdfDoc* doc = pdf_open_file(path, &source);
+    if (!doc) return -1;
+    ZELL_STATS_INPUT(source.size);
+
+    PdfWriter writer = { output_data, output_size, 0, 0, NULL };
+    int64_t result = pdf_compress_doc(doc, &writer, image_quality, target_dpi);
+    pdf_close(doc);
+    zell_source_close(&source);
+    return ZELL_STATS_RESULT(result);
+}
+
+/**
+ * Compress a PDF read through a callback (see compress_pdf)
+ * @param read_at - Reads part of the input (see ZellReadAt)
+ * @param ctx - Opaque pointer passed to read_at
+ * @param input_size - Size of the input
+ * @param concurrent - Whether read_at may be called from several threads at once
+ * @return -1 on error, output size on success
+ */
+EMSCRIPTEN_KEEPALIVE
+int64_t compress_pdf_source(ZellReadAt read_at, void* ctx, int64_t input_size, int concurrent,
+                            unsigned char* output_data, int64_t output_size,
+                            int image_quality, int target_dpi) {
+    ZELL_STATS_CALL("compress_pdf_source", input_size);
+    if (!zell_output_valid(output_data, output_size)) return -1;
+    ZellSource source;
+    PdfDoc* doc = pdf_open_callback(read_at, ctx, input_size, concurrent, &source);
+    if (!doc) return -1;
+
+    PdfWriter writer = { output_data, output_size, 0, 0, NULL };
+    int64_t result = pdf_compress_doc(doc, &writer, image_quality, target_dpi);
+    pdf_close(doc);
+    return ZELL_STATS_RESULT(result);
+}
+
+// --- Streamed output ---------------------------------------------------------
+//
+// The same jobs with their output handed to a ZellWriteAt callback in chunks,
+// so a caller needs no output buffer at all.  On error the bytes already
+// written are to be discarded.
+
+// Flush and release the sink; a failed write fails the job
+static int64_t pdf_sink_finish(ZellSink* sink, int64_t result) {
+    if (zell_sink_close(sink) != 0) return -1;
+    return result;
+}
+
+/**
+ * Compress a PDF into a sink (see compress_pdf)
+ * @param write_at - Receives the output (see ZellWriteAt)
+ * @param ctx - Opaque pointer passed to write_at
+ * @return -1 on error, output size on success
+ */
+EMSCRIPTEN_KEEPALIVE
+int64_t compress_pdf_sink(unsigned char* input_data, int64_t input_size,
+                          ZellWriteAt write_at, void* ctx, int image_quality, int target_dpi) {
+    ZELL_STATS_CALL("compress_pdf_sink", input_size);
+    if (!input_data || input_size <= 0) return -1;
+    ZellSink sink;
+    if (zell_sink_init(&sink, write_at, ctx) != 0) return -1;
+
+    int64_t result = -1;
+    PdfDoc* doc = pdf_open(input_data, input_size);
+    if (doc) {
+        PdfWriter writer = PDF_SINK_WRITER(&sink);
+        result = pdf_compress_doc(doc, &writer, image_quality, target_dpi);
+        pdf_close(doc);
     }
-    
+    return ZELL_STATS_RESULT(pdf_sink_finish(&sink, result));
+}
+
+/**
+ * Merge PDFs into a sink (see merge_pdfs)
+ * @param write_at - Receives the output (see ZellWriteAt)
+ * @param ctx - Opaque pointer passed to write_at
+ * @return -1 on error, merged size on success
+ */
+EMSCRIPTEN_KEEPALIVE
+int64_t merge_pdfs_sink(unsigned char** pdf_files, const int64_t* file_sizes, int num_files,
+                        ZellWriteAt write_at, void* ctx) {
+    ZELL_STATS_CALL("merge_pdfs_sink", zell_stats_total(file_sizes, num_files));
+    if (!pdf_files || !file_sizes || num_files <= 0) return -1;
+    ZellSink sink;
+    if (zell_sink_init(&sink, write_at, ctx) != 0) return -1;
+
+    PdfWriter writer = PDF_SINK_WRITER(&sink);
+    return ZELL_STATS_RESULT(pdf_sink_finish(&sink, pdf_merge(pdf_files, file_sizes, num_files, &writer)));
+}
+
+/**
+ * Extract the text of a PDF into a sink (see extract_pdf_text). The text
+ * is neither cut nor null-terminated.
+ * @param write_at - Receives the output (see ZellWriteAt)
+ * @param ctx - Opaque pointer passed to write_at
+ * @return -1 on error, text size on success
+ */
+EMSCRIPTEN_KEEPALIVE
+int64_t extract_pdf_text_sink(unsigned char* input_data, int64_t input_size,
+                              ZellWriteAt write_at, void* ctx, int num_threads) {
+    ZELL_STATS_CALL("extract_pdf_text_sink", input_size);
+    if (!input_data || input_size <= 0) return -1;
+    ZellSink sink;
+    if (zell_sink_init(&sink, write_at, ctx) != 0) return -1;
+
+    int64_t result = -1;
+    PdfDoc* doc = pdf_open(input_data, input_size);
+    if (doc) {
+        PdfWriter writer = PDF_SINK_WRITER(&sink);
+        result = pdf_extract_text_doc(doc, &writer, num_threads);
+        pdf_close(doc);
+    }
+    return ZELL_STATS_RESULT(pdf_sink_finish(&sink, result));
+}
+
+/**
+ * Compile images into a sink (see images_to_pdf)
+ * @param write_at - Receives the output (see ZellWriteAt)
+ * @param ctx - Opaque pointer passed to write_at
+ * @return -1 on error, PDF size on success
+ */
+EMSCRIPTEN_KEEPALIVE
+int64_t images_to_pdf_sink(unsigned char** images, const int64_t* image_sizes, int num_images,
+                           ZellWriteAt write_at, void* ctx, int page_width, int page_height, int image_quality) {
+    ZELL_STATS_CALL("images_to_pdf_sink", zell_stats_total(image_sizes, num_images));
+    if (!images || !image_sizes || num_images <= 0) return -1;
+    ZellSink sink;
+    if (zell_sink_init(&sink, write_at, ctx) != 0) return -1;
+
+    PdfImageBuffers buffers = { images, image_sizes };
+    PdfCompileOptions options = { page_width, page_height, image_quality };
+    PdfWriter writer = PDF_SINK_WRITER(&sink);
+    int64_t result = pdf_compile_images(num_images, pdf_image_open_buffer, &buffers, &options, &writer);
+    return ZELL_STATS_RESULT(pdf_sink_finish(&sink, result));
+}
+
+typedef struct {
+    const char** paths;
+    int64_t total;
+} PdfImagePaths;
+
+static int pdf_image_open_path(void* ctx, int index, ZellSource* source) {
+    PdfImagePaths* files = (PdfImagePaths*)ctx;
+    if (!files->paths[index] || zell_source_open_file(source, files->paths[index]) != 0) return -1;
+    files->total += source->size;
     return 0;
 }
 
+/**
+ * Compile image files into a sink (see images_to_pdf). Only one image is
+ * open at a time, and JPEGs and plain PNGs are copied straight from their
+ * files to the sink.
+ * @param paths - Array of image file paths
+ * @param num_images - Number of images (pages)
+ * @param write_at - Receives the output (see ZellWriteAt)
+ * @param ctx - Opaque pointer passed to write_at
+ * @return -1 on error, PDF size on success
+ */
+EMSCRIPTEN_KEEPALIVE
+int64_t images_to_pdf_files(const char** paths, int num_images, ZellWriteAt write_at, void* ctx,
+                            int page_width, int page_height, int image_quality) {
+    ZELL_STATS_CALL("images_to_pdf_files", 0);
+    if (!paths || num_images <= 0) return -1;
+    ZellSink sink;
+    if (zell_sink_init(&sink, write_at, ctx) != 0) return -1;
 
+    PdfImagePaths files = { paths, 0 };
+    PdfCompileOptions options = { page_width, page_height, image_quality };
+    PdfWriter writer = PDF_SINK_WRITER(&sink);
+    int64_t result = pdf_compile_images(num_images, pdf_image_open_path, &files, &options, &writer);
+    ZELL_STATS_INPUT(files.total);
+    return ZELL_STATS_RESULT(pdf_sink_finish(&sink, result));
+}
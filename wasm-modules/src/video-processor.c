@@ -1,5 +1,11 @@
-#include <emscripten.h>
+#include "zell-common.h"
+#include "zell-source.h"
+#include "zell-alloc.h"
+#include "zell-sink.h"
+#include "zell-hash.h"
+#include "zell-cpu.h"
 #include <stdlib.h>
+#include <stdint.h>
 #include <string.h>
 #include <math.h>
 
@@ -18,107 +24,121 @@ typedef struct {
  * Process video data for conversion/compression
  * @param input_data - Input video data
  * @param input_size - Size of input data
- * @param output_data - Output buffer
- * @param output_size - Size of output buffer
+ * @param output_data - Output buffer, or NULL to only measure the output
+ * @param output_size - Size of output buffer (0 when measuring)
  * @param quality - Compression quality (0-100)
  * @param format - Target format (0=MP4, 1=MOV, 2=AVI, 3=MKV)
  * @return -1 on error, output size on success
  */
 EMSCRIPTEN_KEEPALIVE
-int process_video(unsigned char* input_data, int input_size,
-                  unsigned char* output_data, int output_size,
-                  int quality, int format) {
-    if (!input_data || !output_data || input_size <= 0 || output_size <= 0) {
+int64_t process_video(unsigned char* input_data, int64_t input_size,
+                      unsigned char* output_data, int64_t output_size,
+                      int quality, int format) {
+    ZELL_STATS_CALL("process_video", input_size);
+    if (!input_data || input_size <= 0 || !zell_output_valid(output_data, output_size)) {
         return -1;
     }
     
     // Calculate compression based on quality
-    float compression_ratio = (float)quality / 100.0f;
-    int target_size = (int)(input_size * compression_ratio);
+    double compression_ratio = (double)quality / 100.0;
+    int64_t target_size = (int64_t)(input_size * compression_ratio);
     
+    if (!output_data) {
+        return ZELL_STATS_RESULT(target_size); // measuring only
+    }
     if (target_size > output_size) {
         target_size = output_size;
     }
+    if (target_size <= 0) {
+        return ZELL_STATS_RESULT(0);
+    }
     
     // Simple video processing based on format
     if (format == 0) { // MP4
         // Simulate MP4 compression
-        int step = input_size / target_size;
+        int64_t step = input_size / target_size;
         if (step < 1) step = 1;
         
-        for (int i = 0, j = 0; i < input_size && j < target_size; i += step, j++) {
+        for (int64_t i = 0, j = 0; i < input_size && j < target_size; i += step, j++) {
             output_data[j] = input_data[i];
         }
     } else if (format == 1) { // MOV
         // Similar to MP4
-        int step = input_size / target_size;
+        int64_t step = input_size / target_size;
         if (step < 1) step = 1;
         
-        for (int i = 0, j = 0; i < input_size && j < target_size; i += step, j++) {
+        for (int64_t i = 0, j = 0; i < input_size && j < target_size; i += step, j++) {
             output_data[j] = input_data[i];
         }
     } else if (format == 2) { // AVI
         // AVI compression
-        int step = input_size / target_size;
+        int64_t step = input_size / target_size;
         if (step < 1) step = 1;
         
-        for (int i = 0, j = 0; i < input_size && j < target_size; i += step, j++) {
+        for (int64_t i = 0, j = 0; i < input_size && j < target_size; i += step, j++) {
             output_data[j] = input_data[i] * quality / 100;
         }
     } else if (format == 3) { // MKV
         // MKV compression
-        int step = input_size / target_size;
+        int64_t step = input_size / target_size;
         if (step < 1) step = 1;
         
-        for (int i = 0, j = 0; i < input_size && j < target_size; i += step, j++) {
+        for (int64_t i = 0, j = 0; i < input_size && j < target_size; i += step, j++) {
             output_data[j] = input_data[i];
         }
     }
     
-    return target_size;
+    return ZELL_STATS_RESULT(target_size);
 }
 
 /**
  * Compress video with specified quality
  * @param input_data - Input video data
  * @param input_size - Size of input data
- * @param output_data - Output buffer
- * @param output_size - Size of output buffer
+ * @param output_data - Output buffer, or NULL to only measure the output
+ * @param output_size - Size of output buffer (0 when measuring)
  * @param quality - Compression quality (0-100)
  * @return -1 on error, compressed size on success
  */
 EMSCRIPTEN_KEEPALIVE
-int compress_video(unsigned char* input_data, int input_size,
-                   unsigned char* output_data, int output_size,
-                   int quality) {
-    if (!input_data || !output_data || input_size <= 0 || output_size <= 0) {
+int64_t compress_video(unsigned char* input_data, int64_t input_size,
+                       unsigned char* output_data, int64_t output_size,
+                       int quality) {
+    ZELL_STATS_CALL("compress_video", input_size);
+    if (!input_data || input_size <= 0 || !zell_output_valid(output_data, output_size)) {
         return -1;
     }
     
     // Calculate target size based on quality
-    float compression_ratio = (float)quality / 100.0f;
-    int target_size = (int)(input_size * compression_ratio);
+    double compression_ratio = (double)quality / 100.0;
+    int64_t target_size = (int64_t)(input_size * compression_ratio);
     
+    if (!output_data) {
+        return ZELL_STATS_RESULT(target_size); // measuring only
+    }
     if (target_size > output_size) {
         target_size = output_size;
     }
+    if (target_size <= 0) {
+        return ZELL_STATS_RESULT(0);
+    }
     
     // Simple video compression algorithm
-    int step = input_size / target_size;
+    int64_t step = input_size / target_size;
     if (step < 1) step = 1;
     
-    for (int i = 0, j = 0; i < input_size && j < target_size; i += step, j++) {
+    for (int64_t i = 0, j = 0; i < input_size && j < target_size; i += step, j++) {
         // Average frames for compression
-        int sum = 0;
-        int count = 0;
-        for (int k = 0; k < step && (i + k) < input_size; k++) {
+        int64_t sum = 0;
+        int64_t count = 0;
+        for (int64_t k = 0; k < step && (i + k) < input_size; k++) {
             sum += input_data[i + k];
             count++;
         }
         output_data[j] = (unsigned char)(sum / count);
     }
     
-    return target_size;
+    return ZELL_STATS_RESULT(target_size);
 }
 
 /**
@@ -126,25 +146,34 @@ int compress_video(unsigned char* input_data, int input_size,
  * @param video_files - Array of video data pointers
  * @param file_sizes - Array of file sizes
  * @param num_files - Number of files to merge
- * @param output_data - Output buffer
- * @param output_size - Size of output buffer
+ * @param output_data - Output buffer, or NULL to only measure the output
+ * @param output_size - Size of output buffer (0 when measuring)
  * @return -1 on error, merged size on success
  */
 EMSCRIPTEN_KEEPALIVE
-int merge_video(unsigned char** video_files, int* file_sizes, int num_files,
-                unsigned char* output_data, int output_size) {
-    if (!video_files || !file_sizes || !output_data || num_files <= 0 || output_size <= 0) {
+int64_t merge_video(unsigned char** video_files, const int64_t* file_sizes, int num_files,
+                    unsigned char* output_data, int64_t output_size) {
+    ZELL_STATS_CALL("merge_video", zell_stats_total(file_sizes, num_files));
+    if (!video_files || !file_sizes || num_files <= 0 || !zell_output_valid(output_data, output_size)) {
         return -1;
     }
     
-    int total_size = 0;
-    int offset = 0;
+    int64_t total_size = 0;
+    int64_t offset = 0;
+    int64_t limit = output_data ? output_size : INT64_MAX;
     
-    // Calculate total size
+    // Calculate total size, stopping before the sum itself can overflow
     for (int i = 0; i < num_files; i++) {
+        if (file_sizes[i] < 0 || file_sizes[i] > limit - total_size) {
+            return -1;
+        }
         total_size += file_sizes[i];
     }
     
+    if (!output_data) {
+        return ZELL_STATS_RESULT(total_size); // measuring only
+    }
+    
     if (total_size > output_size) {
         return -1; // Output buffer too small
     }
@@ -152,48 +181,1064 @@ int merge_video(unsigned char** video_files, int* file_sizes, int num_files,
     // Concatenate video files
     for (int i = 0; i < num_files; i++) {
         if (video_files[i] && file_sizes[i] > 0) {
-            memcpy(output_data + offset, video_files[i], file_sizes[i]);
+            memcpy(output_data + offset, video_files[i], (size_t)file_sizes[i]);
+            offset += file_sizes[i];
+        }
+    }
+    
+    return ZELL_STATS_RESULT(total_size);
+}
+
+/**
+ * Merge video files into a sink (see merge_video): every file is written
+ * straight from its input, so no output buffer is needed
+ * @param write_at - Receives the output (see ZellWriteAt)
+ * @param ctx - Opaque pointer passed to write_at
+ * @return -1 on error, merged size on success
+ */
+EMSCRIPTEN_KEEPALIVE
+int64_t merge_video_sink(unsigned char** video_files, const int64_t* file_sizes, int num_files,
+                        ZellWriteAt write_at, void* ctx) {
+    ZELL_STATS_CALL("merge_video_sink", zell_stats_total(file_sizes, num_files));
+    if (!video_files || !file_sizes || num_files <= 0) {
+        return -1;
+    }
+    int64_t total_size = 0;
+    for (int i = 0; i < num_files; i++) {
+        if (file_sizes[i] < 0 || file_sizes[i] > INT64_MAX - total_size) {
+            return -1;
+        }
+        total_size += file_sizes[i];
+    }
+    
+    ZellSink sink;
+    if (zell_sink_init(&sink, write_at, ctx) != 0) {
+        return -1;
+    }
+    int64_t offset = 0;
+    for (int i = 0; i < num_files; i++) {
+        if (video_files[i] && file_sizes[i] > 0) {
+            zell_sink_put(&sink, video_files[i], file_sizes[i]);
             offset += file_sizes[i];
         }
     }
     
-    return total_size;
+    return ZELL_STATS_RESULT(zell_sink_close(&sink) == 0 ? offset : -1);
 }
 
 /**
  * Trim video to specified duration
  * @param input_data - Input video data
  * @param input_size - Size of input data
- * @param output_data - Output buffer
+ * @param output_data - Output buffer, or NULL to only measure the output
  * @param start_frame - Start frame
  * @param duration_frames - Duration in frames
  * @param frame_size - Size of each frame in bytes
  * @return -1 on error, trimmed size on success
  */
 EMSCRIPTEN_KEEPALIVE
-int trim_video(unsigned char* input_data, int input_size,
-               unsigned char* output_data, int start_frame, int duration_frames,
-               int frame_size) {
-    if (!input_data || !output_data || input_size <= 0 || frame_size <= 0) {
+int64_t trim_video(unsigned char* input_data, int64_t input_size,
+                   unsigned char* output_data, int64_t start_frame, int64_t duration_frames,
+                   int64_t frame_size) {
+    ZELL_STATS_CALL("trim_video", input_size);
+    if (!input_data || input_size <= 0 || frame_size <= 0 ||
+        start_frame < 0 || duration_frames < 0) {
         return -1;
     }
     
-    int start_byte = start_frame * frame_size;
-    int duration_bytes = duration_frames * frame_size;
-    
+    // Compare in frames so that start_frame * frame_size cannot overflow
+    if (start_frame > input_size / frame_size) {
+        return ZELL_STATS_RESULT(0); // Start frame beyond video length
+    }
+    int64_t start_byte = start_frame * frame_size;
     if (start_byte >= input_size) {
-        return 0; // Start frame beyond video length
+        return ZELL_STATS_RESULT(0);
     }
     
-    int end_byte = start_byte + duration_bytes;
-    if (end_byte > input_size) {
-        end_byte = input_size;
-    }
+    int64_t available_frames = (input_size - start_byte + frame_size - 1) / frame_size;
+    int64_t end_byte = duration_frames >= available_frames
+        ? input_size : start_byte + duration_frames * frame_size;
     
-    int trimmed_size = end_byte - start_byte;
-    memcpy(output_data, input_data + start_byte, trimmed_size);
+    int64_t trimmed_size = end_byte - start_byte;
+    if (!output_data) {
+        return ZELL_STATS_RESULT(trimmed_size); // measuring only
+    }
+    memcpy(output_data, input_data + start_byte, (size_t)trimmed_size);
     
-    return trimmed_size;
+    return ZELL_STATS_RESULT(trimmed_size);
+}
+
+
+
+// ---------------------------------------------------------------------------
+// SIMD kernels
+//
+// The per-pixel inner loops have one variant per instruction set; the best
+// one the CPU runs is chosen once, on first use (see zell-cpu.h).  Every
+// variant produces exactly the scalar results.
+// ---------------------------------------------------------------------------
+
+typedef struct {
+    // Sum of absolute differences of two byte arrays
+    unsigned int (*sad)(const unsigned char* a, const unsigned char* b, int length);
+    // BT.601 limited-range luma of packed RGB24 pixels
+    void (*rgb_to_luma)(const unsigned char* rgb, unsigned char* luma, int count);
+    // BT.601 chroma of 2x2 blocks: two RGB24 rows of 2 * count pixels in,
+    // count U and V samples out
+    void (*rgb_to_chroma)(const unsigned char* top, const unsigned char* bottom,
+                          unsigned char* u, unsigned char* v, int count);
+} VideoKernels;
+
+static inline unsigned char clamp_byte(int value) {
+    return (unsigned char)(value < 0 ? 0 : (value > 255 ? 255 : value));
+}
+
+static unsigned int sad_scalar(const unsigned char* a, const unsigned char* b, int length) {
+    unsigned int total = 0;
+    for (int i = 0; i < length; i++) {
+        total += (unsigned int)abs((int)a[i] - (int)b[i]);
+    }
+    return total;
+}
+
+static void rgb_to_luma_scalar(const unsigned char* rgb, unsigned char* luma, int count) {
+    // The weights are positive and sum to 220, so no clamp is needed
+    for (int i = 0; i < count; i++, rgb += 3) {
+        luma[i] = (unsigned char)(((66 * rgb[0] + 129 * rgb[1] + 25 * rgb[2] + 128) >> 8) + 16);
+    }
+}
+
+static void rgb_to_chroma_scalar(const unsigned char* top, const unsigned char* bottom,
+                                 unsigned char* u, unsigned char* v, int count) {
+    for (int i = 0; i < count; i++, top += 6, bottom += 6) {
+        int r = (top[0] + top[3] + bottom[0] + bottom[3]) >> 2;
+        int g = (top[1] + top[4] + bottom[1] + bottom[4]) >> 2;
+        int b = (top[2] + top[5] + bottom[2] + bottom[5]) >> 2;
+        u[i] = clamp_byte(((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128);
+        v[i] = clamp_byte(((112 * r - 94 * g - 18 * b + 128) >> 8) + 128);
+    }
+}
+
+// The chroma variants work in 16-bit lanes: every partial sum of the
+// weighted averages stays within +-28688, so nothing wraps.
+
+#if defined(ZELL_CPU_X86) || defined(ZELL_CPU_SIMD128_BUILD)
+// Byte shuffles gathering one channel of 16 RGB24 pixels (48 bytes, three
+// vectors) into one vector: [channel][source vector], 0x80 = zero
+static const unsigned char rgb_deinterleave[3][3][16] = {
+    { { 0, 3, 6, 9, 12, 15, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80 },
+      { 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 2, 5, 8, 11, 14, 0x80, 0x80, 0x80, 0x80, 0x80 },
+      { 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 1, 4, 7, 10, 13 } },
+    { { 1, 4, 7, 10, 13, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80 },
+      { 0x80, 0x80, 0x80, 0x80, 0x80, 0, 3, 6, 9, 12, 15, 0x80, 0x80, 0x80, 0x80, 0x80 },
+      { 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 2, 5, 8, 11, 14 } },
+    { { 2, 5, 8, 11, 14, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80 },
+      { 0x80, 0x80, 0x80, 0x80, 0x80, 1, 4, 7, 10, 13, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80 },
+      { 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0, 3, 6, 9, 12, 15 } },
+};
+#endif
+
+#if defined(ZELL_CPU_X86)
+ZELL_TARGET("sse4.1")
+static unsigned int sad_sse41(const unsigned char* a, const unsigned char* b, int length) {
+    __m128i acc = _mm_setzero_si128();
+    int i = 0;
+    for (; i + 16 <= length; i += 16) {
+        __m128i va = _mm_loadu_si128((const __m128i*)(a + i));
+        __m128i vb = _mm_loadu_si128((const __m128i*)(b + i));
+        acc = _mm_add_epi64(acc, _mm_sad_epu8(va, vb));
+    }
+    unsigned int total = (unsigned int)(_mm_cvtsi128_si32(acc) + _mm_cvtsi128_si32(_mm_srli_si128(acc, 8)));
+    return total + sad_scalar(a + i, b + i, length - i);
+}
+
+ZELL_TARGET("sse4.1")
+static __m128i luma_sse41(__m128i r, __m128i g, __m128i b) {
+    __m128i y = _mm_add_epi16(_mm_add_epi16(_mm_mullo_epi16(r, _mm_set1_epi16(66)),
+                                            _mm_mullo_epi16(g, _mm_set1_epi16(129))),
+                              _mm_add_epi16(_mm_mullo_epi16(b, _mm_set1_epi16(25)), _mm_set1_epi16(128)));
+    return _mm_add_epi16(_mm_srli_epi16(y, 8), _mm_set1_epi16(16));
+}
+
+ZELL_TARGET("sse4.1")
+static void rgb_to_luma_sse41(const unsigned char* rgb, unsigned char* luma, int count) {
+    __m128i shuffle[3][3];
+    for (int c = 0; c < 3; c++) {
+        for (int k = 0; k < 3; k++) shuffle[c][k] = _mm_loadu_si128((const __m128i*)rgb_deinterleave[c][k]);
+    }
+    int i = 0;
+    for (; i + 16 <= count; i += 16) {
+        const unsigned char* p = rgb + (size_t)i * 3;
+        __m128i v[3] = { _mm_loadu_si128((const __m128i*)p), _mm_loadu_si128((const __m128i*)(p + 16)),
+                         _mm_loadu_si128((const __m128i*)(p + 32)) };
+        __m128i ch[3];
+        for (int c = 0; c < 3; c++) {
+            ch[c] = _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(v[0], shuffle[c][0]),
+                                              _mm_shuffle_epi8(v[1], shuffle[c][1])),
+                                 _mm_shuffle_epi8(v[2], shuffle[c][2]));
+        }
+        __m128i lo = luma_sse41(_mm_cvtepu8_epi16(ch[0]), _mm_cvtepu8_epi16(ch[1]), _mm_cvtepu8_epi16(ch[2]));
+        __m128i hi = luma_sse41(_mm_cvtepu8_epi16(_mm_srli_si128(ch[0], 8)),
+                                _mm_cvtepu8_epi16(_mm_srli_si128(ch[1], 8)),
+                                _mm_cvtepu8_epi16(_mm_srli_si128(ch[2], 8)));
+        _mm_storeu_si128((__m128i*)(luma + i), _mm_packus_epi16(lo, hi));
+    }
+    rgb_to_luma_scalar(rgb + (size_t)i * 3, luma + i, count - i);
+}
+
+ZELL_TARGET("sse4.1")
+static __m128i chroma_sse41(__m128i r, __m128i g, __m128i b, short kr, short kg, short kb) {
+    __m128i c = _mm_add_epi16(_mm_add_epi16(_mm_mullo_epi16(r, _mm_set1_epi16(kr)),
+                                            _mm_mullo_epi16(g, _mm_set1_epi16(kg))),
+                              _mm_add_epi16(_mm_mullo_epi16(b, _mm_set1_epi16(kb)), _mm_set1_epi16(128)));
+    return _mm_add_epi16(_mm_srai_epi16(c, 8), _mm_set1_epi16(128));
+}
+
+ZELL_TARGET("sse4.1")
+static void rgb_to_chroma_sse41(const unsigned char* top, const unsigned char* bottom,
+                                unsigned char* u, unsigned char* v, int count) {
+    __m128i shuffle[3][3];
+    for (int c = 0; c < 3; c++) {
+        for (int k = 0; k < 3; k++) shuffle[c][k] = _mm_loadu_si128((const __m128i*)rgb_deinterleave[c][k]);
+    }
+    __m128i ones = _mm_set1_epi8(1);
+    int i = 0;
+    for (; i + 8 <= count; i += 8) {
+        const unsigned char* rows[2] = { top + (size_t)i * 6, bottom + (size_t)i * 6 };
+        __m128i sum[3] = { _mm_setzero_si128(), _mm_setzero_si128(), _mm_setzero_si128() };
+        for (int row = 0; row < 2; row++) {
+            const unsigned char* p = rows[row];
+            __m128i w[3] = { _mm_loadu_si128((const __m128i*)p), _mm_loadu_si128((const __m128i*)(p + 16)),
+                             _mm_loadu_si128((const __m128i*)(p + 32)) };
+            for (int c = 0; c < 3; c++) {
+                __m128i ch = _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(w[0], shuffle[c][0]),
+                                                       _mm_shuffle_epi8(w[1], shuffle[c][1])),
+                                          _mm_shuffle_epi8(w[2], shuffle[c][2]));
+                // Horizontal pairs add up in one multiply-add
+                sum[c] = _mm_add_epi16(sum[c], _mm_maddubs_epi16(ch, ones));
+            }
+        }
+        __m128i r = _mm_srli_epi16(sum[0], 2), g = _mm_srli_epi16(sum[1], 2), b = _mm_srli_epi16(sum[2], 2);
+        __m128i uv = _mm_packus_epi16(chroma_sse41(r, g, b, -38, -74, 112), chroma_sse41(r, g, b, 112, -94, -18));
+        _mm_storel_epi64((__m128i*)(u + i), uv);
+        _mm_storel_epi64((__m128i*)(v + i), _mm_srli_si128(uv, 8));
+    }
+    rgb_to_chroma_scalar(top + (size_t)i * 6, bottom + (size_t)i * 6, u + i, v + i, count - i);
+}
+
+ZELL_TARGET("avx2")
+static unsigned int sad_avx2(const unsigned char* a, const unsigned char* b, int length) {
+    __m256i acc = _mm256_setzero_si256();
+    int i = 0;
+    for (; i + 32 <= length; i += 32) {
+        __m256i va = _mm256_loadu_si256((const __m256i*)(a + i));
+        __m256i vb = _mm256_loadu_si256((const __m256i*)(b + i));
+        acc = _mm256_add_epi64(acc, _mm256_sad_epu8(va, vb));
+    }
+    __m128i sum = _mm_add_epi64(_mm256_castsi256_si128(acc), _mm256_extracti128_si256(acc, 1));
+    unsigned int total = (unsigned int)(_mm_cvtsi128_si32(sum) + _mm_cvtsi128_si32(_mm_srli_si128(sum, 8)));
+    return total + sad_scalar(a + i, b + i, length - i);
+}
+
+ZELL_TARGET("avx2")
+static __m256i luma_avx2(__m256i r, __m256i g, __m256i b) {
+    __m256i y = _mm256_add_epi16(_mm256_add_epi16(_mm256_mullo_epi16(r, _mm256_set1_epi16(66)),
+                                                  _mm256_mullo_epi16(g, _mm256_set1_epi16(129))),
+                                 _mm256_add_epi16(_mm256_mullo_epi16(b, _mm256_set1_epi16(25)),
+                                                  _mm256_set1_epi16(128)));
+    return _mm256_add_epi16(_mm256_srli_epi16(y, 8), _mm256_set1_epi16(16));
+}
+
+// Each 128-bit lane handles 16 consecutive pixels, so the SSE shuffles apply
+// per lane and unpack/pack leave the pixel order unchanged
+ZELL_TARGET("avx2")
+static void rgb_to_luma_avx2(const unsigned char* rgb, unsigned char* luma, int count) {
+    __m256i shuffle[3][3];
+    for (int c = 0; c < 3; c++) {
+        for (int k = 0; k < 3; k++) {
+            shuffle[c][k] = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)rgb_deinterleave[c][k]));
+        }
+    }
+    __m256i zero = _mm256_setzero_si256();
+    int i = 0;
+    for (; i + 32 <= count; i += 32) {
+        const unsigned char* p = rgb + (size_t)i * 3;
+        __m256i v[3];
+        for (int k = 0; k < 3; k++) {
+            v[k] = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128((const __m128i*)(p + 16 * k))),
+                                           _mm_loadu_si128((const __m128i*)(p + 48 + 16 * k)), 1);
+        }
+        __m256i ch[3];
+        for (int c = 0; c < 3; c++) {
+            ch[c] = _mm256_or_si256(_mm256_or_si256(_mm256_shuffle_epi8(v[0], shuffle[c][0]),
+                                                    _mm256_shuffle_epi8(v[1], shuffle[c][1])),
+                                    _mm256_shuffle_epi8(v[2], shuffle[c][2]));
+        }
+        __m256i lo = luma_avx2(_mm256_unpacklo_epi8(ch[0], zero), _mm256_unpacklo_epi8(ch[1], zero),
+                               _mm256_unpacklo_epi8(ch[2], zero));
+        __m256i hi = luma_avx2(_mm256_unpackhi_epi8(ch[0], zero), _mm256_unpackhi_epi8(ch[1], zero),
+                               _mm256_unpackhi_epi8(ch[2], zero));
+        _mm256_storeu_si256((__m256i*)(luma + i), _mm256_packus_epi16(lo, hi));
+    }
+    rgb_to_luma_scalar(rgb + (size_t)i * 3, luma + i, count - i);
+}
+
+ZELL_TARGET("avx2")
+static __m256i chroma_avx2(__m256i r, __m256i g, __m256i b, short kr, short kg, short kb) {
+    __m256i c = _mm256_add_epi16(_mm256_add_epi16(_mm256_mullo_epi16(r, _mm256_set1_epi16(kr)),
+                                                  _mm256_mullo_epi16(g, _mm256_set1_epi16(kg))),
+                                 _mm256_add_epi16(_mm256_mullo_epi16(b, _mm256_set1_epi16(kb)),
+                                                  _mm256_set1_epi16(128)));
+    return _mm256_add_epi16(_mm256_srai_epi16(c, 8), _mm256_set1_epi16(128));
+}
+
+// Lanes hold 16 pixels each as in rgb_to_luma_avx2, so after the pack each
+// lane has 8 U then 8 V samples and one qword permute sorts them
+ZELL_TARGET("avx2")
+static void rgb_to_chroma_avx2(const unsigned char* top, const unsigned char* bottom,
+                               unsigned char* u, unsigned char* v, int count) {
+    __m256i shuffle[3][3];
+    for (int c = 0; c < 3; c++) {
+        for (int k = 0; k < 3; k++) {
+            shuffle[c][k] = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)rgb_deinterleave[c][k]));
+        }
+    }
+    __m256i ones = _mm256_set1_epi8(1);
+    int i = 0;
+    for (; i + 16 <= count; i += 16) {
+        const unsigned char* rows[2] = { top + (size_t)i * 6, bottom + (size_t)i * 6 };
+        __m256i sum[3] = { _mm256_setzero_si256(), _mm256_setzero_si256(), _mm256_setzero_si256() };
+        for (int row = 0; row < 2; row++) {
+            const unsigned char* p = rows[row];
+            __m256i w[3];
+            for (int k = 0; k < 3; k++) {
+                w[k] = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128((const __m128i*)(p + 16 * k))),
+                                               _mm_loadu_si128((const __m128i*)(p + 48 + 16 * k)), 1);
+            }
+            for (int c = 0; c < 3; c++) {
+                __m256i ch = _mm256_or_si256(_mm256_or_si256(_mm256_shuffle_epi8(w[0], shuffle[c][0]),
+                                                             _mm256_shuffle_epi8(w[1], shuffle[c][1])),
+                                             _mm256_shuffle_epi8(w[2], shuffle[c][2]));
+                sum[c] = _mm256_add_epi16(sum[c], _mm256_maddubs_epi16(ch, ones));
+            }
+        }
+        __m256i r = _mm256_srli_epi16(sum[0], 2), g = _mm256_srli_epi16(sum[1], 2), b = _mm256_srli_epi16(sum[2], 2);
+        __m256i uv = _mm256_packus_epi16(chroma_avx2(r, g, b, -38, -74, 112), chroma_avx2(r, g, b, 112, -94, -18));
+        uv = _mm256_permute4x64_epi64(uv, _MM_SHUFFLE(3, 1, 2, 0));
+        _mm_storeu_si128((__m128i*)(u + i), _mm256_castsi256_si128(uv));
+        _mm_storeu_si128((__m128i*)(v + i), _mm256_extracti128_si256(uv, 1));
+    }
+    rgb_to_chroma_scalar(top + (size_t)i * 6, bottom + (size_t)i * 6, u + i, v + i, count - i);
+}
+
+ZELL_TARGET("avx512f,avx512bw")
+static unsigned int sad_avx512(const unsigned char* a, const unsigned char* b, int length) {
+    __m512i acc = _mm512_setzero_si512();
+    int i = 0;
+    for (; i + 64 <= length; i += 64) {
+        __m512i va = _mm512_loadu_si512((const void*)(a + i));
+        __m512i vb = _mm512_loadu_si512((const void*)(b + i));
+        acc = _mm512_add_epi64(acc, _mm512_sad_epu8(va, vb));
+    }
+    unsigned int total = (unsigned int)_mm512_reduce_add_epi64(acc);
+    return total + sad_avx2(a + i, b + i, length - i);
+}
+
+ZELL_TARGET("avx512f,avx512bw")
+static __m512i luma_avx512(__m512i r, __m512i g, __m512i b) {
+    __m512i y = _mm512_add_epi16(_mm512_add_epi16(_mm512_mullo_epi16(r, _mm512_set1_epi16(66)),
+                                                  _mm512_mullo_epi16(g, _mm512_set1_epi16(129))),
+                                 _mm512_add_epi16(_mm512_mullo_epi16(b, _mm512_set1_epi16(25)),
+                                                  _mm512_set1_epi16(128)));
+    return _mm512_add_epi16(_mm512_srli_epi16(y, 8), _mm512_set1_epi16(16));
+}
+
+ZELL_TARGET("avx512f,avx512bw")
+static void rgb_to_luma_avx512(const unsigned char* rgb, unsigned char* luma, int count) {
+    __m512i shuffle[3][3];
+    for (int c = 0; c < 3; c++) {
+        for (int k = 0; k < 3; k++) {
+            shuffle[c][k] = _mm512_broadcast_i32x4(_mm_loadu_si128((const __m128i*)rgb_deinterleave[c][k]));
+        }
+    }
+    __m512i zero = _mm512_setzero_si512();
+    int i = 0;
+    for (; i + 64 <= count; i += 64) {
+        const unsigned char* p = rgb + (size_t)i * 3;
+        __m512i v[3];
+        for (int k = 0; k < 3; k++) {
+            __m512i lanes = _mm512_castsi128_si512(_mm_loadu_si128((const __m128i*)(p + 16 * k)));
+            lanes = _mm512_inserti32x4(lanes, _mm_loadu_si128((const __m128i*)(p + 48 + 16 * k)), 1);
+            lanes = _mm512_inserti32x4(lanes, _mm_loadu_si128((const __m128i*)(p + 96 + 16 * k)), 2);
+            v[k] = _mm512_inserti32x4(lanes, _mm_loadu_si128((const __m128i*)(p + 144 + 16 * k)), 3);
+        }
+        __m512i ch[3];
+        for (int c = 0; c < 3; c++) {
+            ch[c] = _mm512_or_si512(_mm512_or_si512(_mm512_shuffle_epi8(v[0], shuffle[c][0]),
+                                                    _mm512_shuffle_epi8(v[1], shuffle[c][1])),
+                                    _mm512_shuffle_epi8(v[2], shuffle[c][2]));
+        }
+        __m512i lo = luma_avx512(_mm512_unpacklo_epi8(ch[0], zero), _mm512_unpacklo_epi8(ch[1], zero),
+                                 _mm512_unpacklo_epi8(ch[2], zero));
+        __m512i hi = luma_avx512(_mm512_unpackhi_epi8(ch[0], zero), _mm512_unpackhi_epi8(ch[1], zero),
+                                 _mm512_unpackhi_epi8(ch[2], zero));
+        _mm512_storeu_si512((void*)(luma + i), _mm512_packus_epi16(lo, hi));
+    }
+    rgb_to_luma_avx2(rgb + (size_t)i * 3, luma + i, count - i);
+}
+
+ZELL_TARGET("avx512f,avx512bw")
+static __m512i chroma_avx512(__m512i r, __m512i g, __m512i b, short kr, short kg, short kb) {
+    __m512i c = _mm512_add_epi16(_mm512_add_epi16(_mm512_mullo_epi16(r, _mm512_set1_epi16(kr)),
+                                                  _mm512_mullo_epi16(g, _mm512_set1_epi16(kg))),
+                                 _mm512_add_epi16(_mm512_mullo_epi16(b, _mm512_set1_epi16(kb)),
+                                                  _mm512_set1_epi16(128)));
+    return _mm512_add_epi16(_mm512_srai_epi16(c, 8), _mm512_set1_epi16(128));
+}
+
+ZELL_TARGET("avx512f,avx512bw")
+static void rgb_to_chroma_avx512(const unsigned char* top, const unsigned char* bottom,
+                                 unsigned char* u, unsigned char* v, int count) {
+    __m512i shuffle[3][3];
+    for (int c = 0; c < 3; c++) {
+        for (int k = 0; k < 3; k++) {
+            shuffle[c][k] = _mm512_broadcast_i32x4(_mm_loadu_si128((const __m128i*)rgb_deinterleave[c][k]));
+        }
+    }
+    __m512i ones = _mm512_set1_epi8(1);
+    __m512i order = _mm512_set_epi64(7, 5, 3, 1, 6, 4, 2, 0);
+    int i = 0;
+    for (; i + 32 <= count; i += 32) {
+        const unsigned char* rows[2] = { top + (size_t)i * 6, bottom + (size_t)i * 6 };
+        __m512i sum[3] = { _mm512_setzero_si512(), _mm512_setzero_si512(), _mm512_setzero_si512() };
+        for (int row = 0; row < 2; row++) {
+            const unsigned char* p = rows[row];
+            __m512i w[3];
+            for (int k = 0; k < 3; k++) {
+                __m512i lanes = _mm512_castsi128_si512(_mm_loadu_si128((const __m128i*)(p + 16 * k)));
+                lanes = _mm512_inserti32x4(lanes, _mm_loadu_si128((const __m128i*)(p + 48 + 16 * k)), 1);
+                lanes = _mm512_inserti32x4(lanes, _mm_loadu_si128((const __m128i*)(p + 96 + 16 * k)), 2);
+                w[k] = _mm512_inserti32x4(lanes, _mm_loadu_si128((const __m128i*)(p + 144 + 16 * k)), 3);
+            }
+            for (int c = 0; c < 3; c++) {
+                __m512i ch = _mm512_or_si512(_mm512_or_si512(_mm512_shuffle_epi8(w[0], shuffle[c][0]),
+                                                             _mm512_shuffle_epi8(w[1], shuffle[c][1])),
+                                             _mm512_shuffle_epi8(w[2], shuffle[c][2]));
+                sum[c] = _mm512_add_epi16(sum[c], _mm512_maddubs_epi16(ch, ones));
+            }
+        }
+        __m512i r = _mm512_srli_epi16(sum[0], 2), g = _mm512_srli_epi16(sum[1], 2), b = _mm512_srli_epi16(sum[2], 2);
+        __m512i uv = _mm512_packus_epi16(chroma_avx512(r, g, b, -38, -74, 112), chroma_avx512(r, g, b, 112, -94, -18));
+        uv = _mm512_permutexvar_epi64(order, uv);
+        _mm256_storeu_si256((__m256i*)(u + i), _mm512_castsi512_si256(uv));
+        _mm256_storeu_si256((__m256i*)(v + i), _mm512_extracti64x4_epi64(uv, 1));
+    }
+    rgb_to_chroma_avx2(top + (size_t)i * 6, bottom + (size_t)i * 6, u + i, v + i, count - i);
+}
+#endif // ZELL_CPU_X86
+
+#if defined(ZELL_CPU_NEON_BUILD)
+static unsigned int sad_neon(const unsigned char* a, const unsigned char* b, int length) {
+    uint32x4_t acc = vdupq_n_u32(0);
+    int i = 0;
+    for (; i + 16 <= length; i += 16) {
+        uint8x16_t diff = vabdq_u8(vld1q_u8(a + i), vld1q_u8(b + i));
+        acc = vpadalq_u16(acc, vpaddlq_u8(diff));
+    }
+    unsigned int total = vgetq_lane_u32(acc, 0) + vgetq_lane_u32(acc, 1) +
+                         vgetq_lane_u32(acc, 2) + vgetq_lane_u32(acc, 3);
+    return total + sad_scalar(a + i, b + i, length - i);
+}
+
+static void rgb_to_luma_neon(const unsigned char* rgb, unsigned char* luma, int count) {
+    int i = 0;
+    for (; i + 8 <= count; i += 8) {
+        uint8x8x3_t p = vld3_u8(rgb + (size_t)i * 3);
+        uint16x8_t y = vmull_u8(p.val[0], vdup_n_u8(66));
+        y = vmlal_u8(y, p.val[1], vdup_n_u8(129));
+        y = vmlal_u8(y, p.val[2], vdup_n_u8(25));
+        // Rounding narrow adds the +128 before the shift
+        vst1_u8(luma + i, vadd_u8(vrshrn_n_u16(y, 8), vdup_n_u8(16)));
+    }
+    rgb_to_luma_scalar(rgb + (size_t)i * 3, luma + i, count - i);
+}
+
+static int16x8_t chroma_neon(int16x8_t r, int16x8_t g, int16x8_t b, short kr, short kg, short kb) {
+    int16x8_t c = vmlaq_n_s16(vmlaq_n_s16(vmulq_n_s16(r, kr), g, kg), b, kb);
+    return vaddq_s16(vshrq_n_s16(vaddq_s16(c, vdupq_n_s16(128)), 8), vdupq_n_s16(128));
+}
+
+static void rgb_to_chroma_neon(const unsigned char* top, const unsigned char* bottom,
+                               unsigned char* u, unsigned char* v, int count) {
+    int i = 0;
+    for (; i + 8 <= count; i += 8) {
+        uint8x16x3_t a = vld3q_u8(top + (size_t)i * 6);
+        uint8x16x3_t z = vld3q_u8(bottom + (size_t)i * 6);
+        int16x8_t ch[3];
+        for (int c = 0; c < 3; c++) {
+            uint16x8_t sum = vpadalq_u8(vpaddlq_u8(a.val[c]), z.val[c]);
+            ch[c] = vreinterpretq_s16_u16(vshrq_n_u16(sum, 2));
+        }
+        vst1_u8(u + i, vqmovun_s16(chroma_neon(ch[0], ch[1], ch[2], -38, -74, 112)));
+        vst1_u8(v + i, vqmovun_s16(chroma_neon(ch[0], ch[1], ch[2], 112, -94, -18)));
+    }
+    rgb_to_chroma_scalar(top + (size_t)i * 6, bottom + (size_t)i * 6, u + i, v + i, count - i);
+}
+#endif // ZELL_CPU_NEON_BUILD
+
+#if defined(ZELL_CPU_SIMD128_BUILD)
+static unsigned int sad_simd128(const unsigned char* a, const unsigned char* b, int length) {
+    v128_t acc = wasm_i32x4_splat(0);
+    int i = 0;
+    for (; i + 16 <= length; i += 16) {
+        v128_t va = wasm_v128_load(a + i);
+        v128_t vb = wasm_v128_load(b + i);
+        v128_t diff = wasm_v128_or(wasm_u8x16_sub_sat(va, vb), wasm_u8x16_sub_sat(vb, va));
+        acc = wasm_i32x4_add(acc, wasm_i32x4_extadd_pairwise_i16x8(wasm_u16x8_extadd_pairwise_u8x16(diff)));
+    }
+    unsigned int total = (unsigned int)(wasm_i32x4_extract_lane(acc, 0) + wasm_i32x4_extract_lane(acc, 1) +
+                                        wasm_i32x4_extract_lane(acc, 2) + wasm_i32x4_extract_lane(acc, 3));
+    return total + sad_scalar(a + i, b + i, length - i);
+}
+
+static v128_t luma_simd128(v128_t r, v128_t g, v128_t b) {
+    v128_t y = wasm_i16x8_add(wasm_i16x8_add(wasm_i16x8_mul(r, wasm_i16x8_splat(66)),
+                                             wasm_i16x8_mul(g, wasm_i16x8_splat(129))),
+                              wasm_i16x8_add(wasm_i16x8_mul(b, wasm_i16x8_splat(25)), wasm_i16x8_splat(128)));
+    return wasm_i16x8_add(wasm_u16x8_shr(y, 8), wasm_i16x8_splat(16));
+}
+
+static void rgb_to_luma_simd128(const unsigned char* rgb, unsigned char* luma, int count) {
+    int i = 0;
+    for (; i + 16 <= count; i += 16) {
+        const unsigned char* p = rgb + (size_t)i * 3;
+        v128_t v[3] = { wasm_v128_load(p), wasm_v128_load(p + 16), wasm_v128_load(p + 32) };
+        v128_t ch[3];
+        for (int c = 0; c < 3; c++) {
+            // Swizzle indices of 16 and above select zero
+            ch[c] = wasm_v128_or(wasm_v128_or(wasm_i8x16_swizzle(v[0], wasm_v128_load(rgb_deinterleave[c][0])),
+                                              wasm_i8x16_swizzle(v[1], wasm_v128_load(rgb_deinterleave[c][1]))),
+                                 wasm_i8x16_swizzle(v[2], wasm_v128_load(rgb_deinterleave[c][2])));
+        }
+        v128_t lo = luma_simd128(wasm_u16x8_extend_low_u8x16(ch[0]), wasm_u16x8_extend_low_u8x16(ch[1]),
+                                 wasm_u16x8_extend_low_u8x16(ch[2]));
+        v128_t hi = luma_simd128(wasm_u16x8_extend_high_u8x16(ch[0]), wasm_u16x8_extend_high_u8x16(ch[1]),
+                                 wasm_u16x8_extend_high_u8x16(ch[2]));
+        wasm_v128_store(luma + i, wasm_u8x16_narrow_i16x8(lo, hi));
+    }
+    rgb_to_luma_scalar(rgb + (size_t)i * 3, luma + i, count - i);
+}
+
+static v128_t chroma_simd128(v128_t r, v128_t g, v128_t b, short kr, short kg, short kb) {
+    v128_t c = wasm_i16x8_add(wasm_i16x8_add(wasm_i16x8_mul(r, wasm_i16x8_splat(kr)),
+                                             wasm_i16x8_mul(g, wasm_i16x8_splat(kg))),
+                              wasm_i16x8_add(wasm_i16x8_mul(b, wasm_i16x8_splat(kb)), wasm_i16x8_splat(128)));
+    return wasm_i16x8_add(wasm_i16x8_shr(c, 8), wasm_i16x8_splat(128));
+}
+
+static void rgb_to_chroma_simd128(const unsigned char* top, const unsigned char* bottom,
+                                  unsigned char* u, unsigned char* v, int count) {
+    int i = 0;
+    for (; i + 8 <= count; i += 8) {
+        const unsigned char* rows[2] = { top + (size_t)i * 6, bottom + (size_t)i * 6 };
+        v128_t sum[3] = { wasm_i16x8_splat(0), wasm_i16x8_splat(0), wasm_i16x8_splat(0) };
+        for (int row = 0; row < 2; row++) {
+            const unsigned char* p = rows[row];
+            v128_t w[3] = { wasm_v128_load(p), wasm_v128_load(p + 16), wasm_v128_load(p + 32) };
+            for (int c = 0; c < 3; c++) {
+                v128_t ch = wasm_v128_or(wasm_v128_or(wasm_i8x16_swizzle(w[0], wasm_v128_load(rgb_deinterleave[c][0])),
+                                                      wasm_i8x16_swizzle(w[1], wasm_v128_load(rgb_deinterleave[c][1]))),
+                                         wasm_i8x16_swizzle(w[2], wasm_v128_load(rgb_deinterleave[c][2])));
+                sum[c] = wasm_i16x8_add(sum[c], wasm_u16x8_extadd_pairwise_u8x16(ch));
+            }
+        }
+        v128_t r = wasm_u16x8_shr(sum[0], 2), g = wasm_u16x8_shr(sum[1], 2), b = wasm_u16x8_shr(sum[2], 2);
+        v128_t uv = wasm_u8x16_narrow_i16x8(chroma_simd128(r, g, b, -38, -74, 112),
+                                            chroma_simd128(r, g, b, 112, -94, -18));
+        wasm_v128_store64_lane(u + i, uv, 0);
+        wasm_v128_store64_lane(v + i, uv, 1);
+    }
+    rgb_to_chroma_scalar(top + (size_t)i * 6, bottom + (size_t)i * 6, u + i, v + i, count - i);
+}
+#endif // ZELL_CPU_SIMD128_BUILD
+
+static VideoKernels video_kernels;
+ZELL_ONCE_DEFINE(video_kernels_once);
+
+static void video_kernels_init(void) {
+    video_kernels.sad = sad_scalar;
+    video_kernels.rgb_to_luma = rgb_to_luma_scalar;
+    video_kernels.rgb_to_chroma = rgb_to_chroma_scalar;
+
+    switch (zell_cpu_level()) {
+#if defined(ZELL_CPU_X86)
+        case ZELL_CPU_AVX512:
+            video_kernels.sad = sad_avx512;
+            video_kernels.rgb_to_luma = rgb_to_luma_avx512;
+            video_kernels.rgb_to_chroma = rgb_to_chroma_avx512;
+            break;
+        case ZELL_CPU_AVX2:
+            video_kernels.sad = sad_avx2;
+            video_kernels.rgb_to_luma = rgb_to_luma_avx2;
+            video_kernels.rgb_to_chroma = rgb_to_chroma_avx2;
+            break;
+        case ZELL_CPU_SSE41:
+            video_kernels.sad = sad_sse41;
+            video_kernels.rgb_to_luma = rgb_to_luma_sse41;
+            video_kernels.rgb_to_chroma = rgb_to_chroma_sse41;
+            break;
+#elif defined(ZELL_CPU_NEON_BUILD)
+        case ZELL_CPU_NEON:
+            video_kernels.sad = sad_neon;
+            video_kernels.rgb_to_luma = rgb_to_luma_neon;
+            video_kernels.rgb_to_chroma = rgb_to_chroma_neon;
+            break;
+#elif defined(ZELL_CPU_SIMD128_BUILD)
+        case ZELL_CPU_SIMD128:
+            video_kernels.sad = sad_simd128;
+            video_kernels.rgb_to_luma = rgb_to_luma_simd128;
+            video_kernels.rgb_to_chroma = rgb_to_chroma_simd128;
+            break;
+#endif
+        default:
+            break;
+    }
+}
+
+static const VideoKernels* video_get_kernels(void) {
+    ZELL_ONCE(video_kernels_once, video_kernels_init);
+    return &video_kernels;
+}
+
+// ---------------------------------------------------------------------------
+// Frame-parallel transform pipeline
+//
+// Frames are independent, so batch transforms are scheduled across a pool of
+// workers: the calling thread feeds frame indices into a bounded queue, each
+// worker runs the per-frame kernel, and finished frames pass through an
+// in-order reorder buffer before being handed to the sink.  The reorder
+// window also bounds how far submission can run ahead of the slowest frame,
+// so scratch memory stays at window * frame_size regardless of batch length.
+//
+// In the WASM build the pipeline blocks while waiting on workers, so it must
+// be called from a worker thread (or with -sPROXY_TO_PTHREAD), never from the
+// browser main thread.
+// ---------------------------------------------------------------------------
+
+#define VIDEO_FORMAT_RGB24 0
+#define VIDEO_FORMAT_I420  1
+
+typedef struct FrameJob FrameJob;
+
+// Produce output frame `frame` into dst (exactly job->output_frame_size bytes)
+typedef void (*FrameKernel)(const FrameJob* job, int frame, unsigned char* dst);
+
+// Receive finished frames in order; return < 0 to abort the batch
+typedef int (*FrameSink)(void* ctx, int frame, const unsigned char* data, int size);
+
+struct FrameJob {
+    const unsigned char* input;
+    int input_width;
+    int input_height;
+    int input_frame_size;
+    int output_width;
+    int output_height;
+    int output_frame_size;
+    const int* x_offsets;  // source byte offset for each output column
+    const int* y_offsets;  // source byte offset for each output row
+    FrameKernel kernel;
+};
+
+// Nearest-neighbour RGB24 resize of one frame
+static void resize_frame_kernel(const FrameJob* job, int frame, unsigned char* dst) {
+    ZELL_STATS_STAGE(ZELL_STAGE_TRANSFORM, "video_frame");
+    const unsigned char* src = job->input + (size_t)frame * job->input_frame_size;
+
+    for (int y = 0; y < job->output_height; y++) {
+        const unsigned char* src_row = src + job->y_offsets[y];
+        unsigned char* dst_row = dst + (size_t)y * job->output_width * 3;
+
+        if (job->output_width == job->input_width) {
+            memcpy(dst_row, src_row, (size_t)job->output_width * 3);
+            continue;
+        }
+        for (int x = 0; x < job->output_width; x++) {
+            const unsigned char* p = src_row + job->x_offsets[x];
+            dst_row[x * 3 + 0] = p[0];
+            dst_row[x * 3 + 1] = p[1];
+            dst_row[x * 3 + 2] = p[2];
+        }
+    }
+}
+
+// Resize one RGB24 frame and convert it to planar I420 (BT.601, limited range)
+static void resize_i420_frame_kernel(const FrameJob* job, int frame, unsigned char* dst) {
+    ZELL_STATS_STAGE(ZELL_STAGE_TRANSFORM, "video_frame");
+    const unsigned char* src = job->input + (size_t)frame * job->input_frame_size;
+    int width = job->output_width;
+    int height = job->output_height;
+    int chroma_width = (width + 1) / 2;
+    int chroma_height = (height + 1) / 2;
+
+    unsigned char* plane_y = dst;
+    unsigned char* plane_u = plane_y + width * height;
+    unsigned char* plane_v = plane_u + chroma_width * chroma_height;
+
+    // Luma row by row through the SIMD kernel; resized rows are gathered
+    // into a small staging buffer first
+    const VideoKernels* kernels = video_get_kernels();
+    unsigned char row[3 * 256];
+    for (int y = 0; y < height; y++) {
+        const unsigned char* src_row = src + job->y_offsets[y];
+        unsigned char* luma = plane_y + (size_t)y * width;
+        if (width == job->input_width) {
+            kernels->rgb_to_luma(src_row, luma, width);
+            continue;
+        }
+        for (int x0 = 0; x0 < width; x0 += 256) {
+            int count = width - x0 < 256 ? width - x0 : 256;
+            for (int x = 0; x < count; x++) {
+                memcpy(row + x * 3, src_row + job->x_offsets[x0 + x], 3);
+            }
+            kernels->rgb_to_luma(row, luma + x0, count);
+        }
+    }
+
+    // Chroma: whole 2x2 blocks through the SIMD kernel, gathered the same
+    // way; an odd last column or row is averaged over what it has below
+    int pairs = width / 2;
+    int pair_rows = height / 2;
+    unsigned char below[3 * 256];
+    for (int cy = 0; cy < pair_rows; cy++) {
+        const unsigned char* top_row = src + job->y_offsets[cy * 2];
+        const unsigned char* bottom_row = src + job->y_offsets[cy * 2 + 1];
+        unsigned char* u = plane_u + (size_t)cy * chroma_width;
+        unsigned char* v = plane_v + (size_t)cy * chroma_width;
+        if (width == job->input_width) {
+            kernels->rgb_to_chroma(top_row, bottom_row, u, v, pairs);
+            continue;
+        }
+        for (int c0 = 0; c0 < pairs; c0 += 128) {
+            int count = pairs - c0 < 128 ? pairs - c0 : 128;
+            for (int x = 0; x < 2 * count; x++) {
+                memcpy(row + x * 3, top_row + job->x_offsets[c0 * 2 + x], 3);
+                memcpy(below + x * 3, bottom_row + job->x_offsets[c0 * 2 + x], 3);
+            }
+            kernels->rgb_to_chroma(row, below, u + c0, v + c0, count);
+        }
+    }
+
+    for (int cy = 0; cy < chroma_height; cy++) {
+        for (int cx = cy < pair_rows ? pairs : 0; cx < chroma_width; cx++) {
+            int sum_r = 0, sum_g = 0, sum_b = 0, count = 0;
+
+            for (int dy = 0; dy < 2; dy++) {
+                int y = cy * 2 + dy;
+                if (y >= height) break;
+                const unsigned char* src_row = src + job->y_offsets[y];
+
+                for (int dx = 0; dx < 2; dx++) {
+                    int x = cx * 2 + dx;
+                    if (x >= width) break;
+                    const unsigned char* p = src_row + job->x_offsets[x];
+                    sum_r += p[0];
+                    sum_g += p[1];
+                    sum_b += p[2];
+                    count++;
+                }
+            }
+
+            int r = sum_r / count, g = sum_g / count, b = sum_b / count;
+            plane_u[cy * chroma_width + cx] = clamp_byte(((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128);
+            plane_v[cy * chroma_width + cx] = clamp_byte(((112 * r - 94 * g - 18 * b + 128) >> 8) + 128);
+        }
+    }
+}
+
+static int output_frame_size_for(int width, int height, int format) {
+    if (format == VIDEO_FORMAT_I420) {
+        return width * height + 2 * ((width + 1) / 2) * ((height + 1) / 2);
+    }
+    return width * height * 3;
+}
+
+typedef struct {
+    const FrameJob* job;
+    int num_frames;
+    unsigned char* output;  // direct destination, NULL when frames go to the sink
+    unsigned char* slots;   // window scratch frames, used only with a sink
+    int window;
+
+#ifdef ZELL_HAVE_THREADS
+    pthread_mutex_t lock;
+    pthread_cond_t not_empty;
+    pthread_cond_t completed;
+    int* queue;       // bounded ring of pending frame indices
+    int queue_capacity;
+    int queue_head;
+    int queue_count;
+    int* done;        // per window slot: index of the finished frame, or -1
+    int closed;
+#endif
+} FramePipeline;
+
+static unsigned char* pipeline_frame_buffer(FramePipeline* pipeline, int frame) {
+    size_t frame_size = (size_t)pipeline->job->output_frame_size;
+    if (pipeline->output) {
+        return pipeline->output + (size_t)frame * frame_size;
+    }
+    return pipeline->slots + (size_t)(frame % pipeline->window) * frame_size;
+}
+
+#ifdef ZELL_HAVE_THREADS
+static void* pipeline_worker(void* arg) {
+    FramePipeline* pipeline = (FramePipeline*)arg;
+
+    pthread_mutex_lock(&pipeline->lock);
+    for (;;) {
+        while (pipeline->queue_count == 0 && !pipeline->closed) {
+            pthread_cond_wait(&pipeline->not_empty, &pipeline->lock);
+        }
+        if (pipeline->queue_count == 0) {
+            break; // closed and drained
+        }
+
+        int frame = pipeline->queue[pipeline->queue_head];
+        pipeline->queue_head = (pipeline->queue_head + 1) % pipeline->queue_capacity;
+        pipeline->queue_count--;
+        pthread_mutex_unlock(&pipeline->lock);
+
+        {
+            ZELL_STATS_WORKER();
+            pipeline->job->kernel(pipeline->job, frame, pipeline_frame_buffer(pipeline, frame));
+        }
+
+        pthread_mutex_lock(&pipeline->lock);
+        pipeline->done[frame % pipeline->window] = frame;
+        pthread_cond_signal(&pipeline->completed);
+    }
+    pthread_mutex_unlock(&pipeline->lock);
+    return NULL;
+}
+
+static int run_pipeline_threaded(FramePipeline* pipeline, int num_threads,
+                                 FrameSink sink, void* sink_ctx) {
+    ZELL_STATS_PARALLEL(num_threads);
+    pthread_t workers[ZELL_MAX_THREADS];
+    int started = 0;
+    int status = 0;
+
+    pthread_mutex_init(&pipeline->lock, NULL);
+    pthread_cond_init(&pipeline->not_empty, NULL);
+    pthread_cond_init(&pipeline->completed, NULL);
+
+    for (int i = 0; i < pipeline->window; i++) {
+        pipeline->done[i] = -1;
+    }
+
+    for (; started < num_threads; started++) {
+        if (pthread_create(&workers[started], NULL, pipeline_worker, pipeline) != 0) {
+            break;
+        }
+    }
+
+    if (started == 0) {
+        status = -1;
+    } else {
+        int next_submit = 0;
+        int next_emit = 0;
+
+        pthread_mutex_lock(&pipeline->lock);
+        while (next_emit < pipeline->num_frames && status == 0) {
+            int progressed = 0;
+
+            // Feed the bounded queue, never running more than one window ahead
+            while (next_submit < pipeline->num_frames &&
+                   pipeline->queue_count < pipeline->queue_capacity &&
+                   next_submit < next_emit + pipeline->window) {
+                int tail = (pipeline->queue_head + pipeline->queue_count) % pipeline->queue_capacity;
+                pipeline->queue[tail] = next_submit++;
+                pipeline->queue_count++;
+                pthread_cond_signal(&pipeline->not_empty);
+                progressed = 1;
+            }
+
+            // Drain the reorder buffer in frame order
+            while (next_emit < pipeline->num_frames &&
+                   pipeline->done[next_emit % pipeline->window] == next_emit) {
+                if (sink) {
+                    pthread_mutex_unlock(&pipeline->lock);
+                    int rc = sink(sink_ctx, next_emit, pipeline_frame_buffer(pipeline, next_emit),
+                                  pipeline->job->output_frame_size);
+                    pthread_mutex_lock(&pipeline->lock);
+                    if (rc < 0) {
+                        status = -1;
+                        break;
+                    }
+                }
+                pipeline->done[next_emit % pipeline->window] = -1;
+                next_emit++;
+                progressed = 1;
+            }
+
+            if (!progressed) {
+                pthread_cond_wait(&pipeline->completed, &pipeline->lock);
+            }
+        }
+
+        pipeline->closed = 1;
+        pipeline->queue_count = 0; // drop anything still queued after an abort
+        pthread_cond_broadcast(&pipeline->not_empty);
+        pthread_mutex_unlock(&pipeline->lock);
+    }
+
+    for (int i = 0; i < started; i++) {
+        pthread_join(workers[i], NULL);
+    }
+
+    pthread_cond_destroy(&pipeline->completed);
+    pthread_cond_destroy(&pipeline->not_empty);
+    pthread_mutex_destroy(&pipeline->lock);
+    return status;
+}
+#endif // ZELL_HAVE_THREADS
+
+// Frames waiting in the queue per worker, so none waits on the producer
+#define PIPELINE_QUEUED_PER_WORKER 2
+// Frames in flight per worker: its queued frames plus the one it is working
+// on.  The reorder window holds them all, so it never holds up the queue.
+#define PIPELINE_WINDOW_PER_WORKER (PIPELINE_QUEUED_PER_WORKER + 1)
+
+/**
+ * Run a per-frame kernel over a batch of frames
+ * @param job - Kernel and geometry shared by every frame (read-only)
+ * @param num_frames - Number of frames in the batch
+ * @param output - Contiguous output for all frames, or NULL to use the sink
+ * @param sink - In-order frame consumer, used when output is NULL
+ * @param sink_ctx - Opaque pointer passed to the sink
+ * @param num_threads - Worker count (0 = one per core, 1 = run inline)
+ * @param scratch - Job arena for the reorder window and queues
+ * @return -1 on error, 0 on success
+ */
+static int run_frame_pipeline(const FrameJob* job, int num_frames,
+                              unsigned char* output, FrameSink sink, void* sink_ctx,
+                              int num_threads, ZellArena* scratch) {
+    FramePipeline pipeline;
+    memset(&pipeline, 0, sizeof(pipeline));
+    pipeline.job = job;
+    pipeline.num_frames = num_frames;
+    pipeline.output = output;
+
+    int threads = zell_resolve_threads(num_threads);
+    if (threads > num_frames) threads = num_frames;
+
+    // A few frames per worker keeps everyone busy without hoarding memory
+    pipeline.window = threads * PIPELINE_WINDOW_PER_WORKER;
+    if (pipeline.window > num_frames) pipeline.window = num_frames;
+
+    if (!output) {
+        if (!sink) return -1;
+        pipeline.slots = (unsigned char*)zell_arena_alloc(scratch, (size_t)pipeline.window * job->output_frame_size);
+        if (!pipeline.slots) return -1;
+    }
+
+    int status = 0;
+
+#ifdef ZELL_HAVE_THREADS
+    if (threads > 1) {
+        pipeline.queue_capacity = threads * PIPELINE_QUEUED_PER_WORKER;
+        pipeline.queue = (int*)zell_arena_alloc(scratch, sizeof(int) * pipeline.queue_capacity);
+        pipeline.done = (int*)zell_arena_alloc(scratch, sizeof(int) * pipeline.window);
+
+        if (pipeline.queue && pipeline.done) {
+            status = run_pipeline_threaded(&pipeline, threads, sink, sink_ctx);
+        } else {
+            status = -1;
+        }
+        return status;
+    }
+#endif
+
+    for (int frame = 0; frame < num_frames && status == 0; frame++) {
+        unsigned char* dst = pipeline_frame_buffer(&pipeline, frame);
+        job->kernel(job, frame, dst);
+        if (!output && sink(sink_ctx, frame, dst, job->output_frame_size) < 0) {
+            status = -1;
+        }
+    }
+    return status;
+}
+
+/**
+ * Resize and optionally color-convert a batch of RGB24 frames in parallel
+ * @param input_data - Input frames (RGB24, tightly packed, frame after frame)
+ * @param input_width - Input width
+ * @param input_height - Input height
+ * @param output_data - Output buffer sized for num_frames output frames
+ * @param output_width - Output width
+ * @param output_height - Output height
+ * @param num_frames - Number of frames
+ * @param output_format - Output pixel format (0=RGB24, 1=I420)
+ * @param num_threads - Worker threads (0 = one per core)
+ * @return -1 on error, 0 on success
+ */
+EMSCRIPTEN_KEEPALIVE
+int transform_video_frames(unsigned char* input_data, int input_width, int input_height,
+                           unsigned char* output_data, int output_width, int output_height,
+                           int num_frames, int output_format, int num_threads) {
+    ZELL_STATS_CALL("transform_video_frames", (int64_t)input_width * input_height * 3 * num_frames);
+    if (!input_data || !output_data || input_width <= 0 || input_height <= 0 ||
+        output_width <= 0 || output_height <= 0 || num_frames <= 0) {
+        return -1;
+    }
+    if (output_format != VIDEO_FORMAT_RGB24 && output_format != VIDEO_FORMAT_I420) {
+        return -1;
+    }
+    // Batches may exceed 2GB (offsets are size_t), a single frame may not
+    if ((int64_t)input_width * input_height * 3 > INT32_MAX ||
+        (int64_t)output_width * output_height * 3 > INT32_MAX) {
+        return -1;
+    }
+
+    // Source offsets are identical for every frame, so compute them once
+    ZellArena scratch = { NULL };
+    int* x_offsets = (int*)zell_arena_alloc(&scratch, sizeof(int) * output_width);
+    int* y_offsets = (int*)zell_arena_alloc(&scratch, sizeof(int) * output_height);
+    if (!x_offsets || !y_offsets) {
+        zell_arena_free(&scratch);
+        return -1;
+    }
+
+    float x_ratio = (float)input_width / output_width;
+    float y_ratio = (float)input_height / output_height;
+
+    for (int x = 0; x < output_width; x++) {
+        int src_x = (int)(x * x_ratio);
+        if (src_x >= input_width) src_x = input_width - 1;
+        x_offsets[x] = src_x * 3;
+    }
+    for (int y = 0; y < output_height; y++) {
+        int src_y = (int)(y * y_ratio);
+        if (src_y >= input_height) src_y = input_height - 1;
+        y_offsets[y] = src_y * input_width * 3;
+    }
+
+    FrameJob job;
+    job.input = input_data;
+    job.input_width = input_width;
+    job.input_height = input_height;
+    job.input_frame_size = input_width * input_height * 3;
+    job.output_width = output_width;
+    job.output_height = output_height;
+    job.output_frame_size = output_frame_size_for(output_width, output_height, output_format);
+    job.x_offsets = x_offsets;
+    job.y_offsets = y_offsets;
+    job.kernel = output_format == VIDEO_FORMAT_I420 ? resize_i420_frame_kernel : resize_frame_kernel;
+
+    int status = run_frame_pipeline(&job, num_frames, output_data, NULL, NULL, num_threads, &scratch);
+
+    zell_arena_free(&scratch);
+    return ZELL_STATS_STATUS(status);
 }
 
 /**
@@ -211,41 +1256,524 @@ EMSCRIPTEN_KEEPALIVE
 int resize_video_frames(unsigned char* input_data, int input_width, int input_height,
                         unsigned char* output_data, int output_width, int output_height,
                         int num_frames) {
-    if (!input_data || !output_data || input_width <= 0 || input_height <= 0 ||
-        output_width <= 0 || output_height <= 0 || num_frames <= 0) {
+    return transform_video_frames(input_data, input_width, input_height,
+                                  output_data, output_width, output_height,
+                                  num_frames, VIDEO_FORMAT_RGB24, 0);
+}
+
+// ---------------------------------------------------------------------------
+// Scene-change detection
+//
+// Every Nth frame is reduced to a small luma thumbnail.  Consecutive
+// thumbnails are compared with a sum of absolute differences (pixel motion)
+// and a luma histogram delta (content change); a cut is reported when the
+// combined score rises well above the recent running statistics.  Once a
+// cut is found between two samples, the skipped frames in between are
+// thumbnailed to pin the cut to the exact frame.
+// ---------------------------------------------------------------------------
+
+#define SCENE_THUMB_WIDTH 64
+#define SCENE_THUMB_HEIGHT 36
+#define SCENE_THUMB_SIZE (SCENE_THUMB_WIDTH * SCENE_THUMB_HEIGHT)
+#define SCENE_HIST_BINS 64
+#define SCENE_HISTORY 24
+
+typedef struct {
+    const unsigned char* data;
+    int width;
+    int height;
+    int stride;           // bytes per source row
+    int pixel_bytes;      // 3 for RGB24, 1 for a luma plane
+    size_t frame_bytes;   // bytes between consecutive frames
+} SceneSource;
+
+typedef struct {
+    unsigned char luma[SCENE_THUMB_SIZE];
+    unsigned int hist[SCENE_HIST_BINS];
+} SceneThumb;
+
+// Box-filter a frame down to the thumbnail grid using a 4x4 grid of taps per cell
+static void scene_make_thumb(const SceneSource* src, int frame, SceneThumb* thumb) {
+    ZELL_STATS_STAGE(ZELL_STAGE_TRANSFORM, "scene_thumb");
+    const unsigned char* base = src->data + (size_t)frame * src->frame_bytes;
+    unsigned int hist[4][SCENE_HIST_BINS];
+    memset(hist, 0, sizeof(hist));
+
+    for (int ty = 0; ty < SCENE_THUMB_HEIGHT; ty++) {
+        int y0 = ty * src->height / SCENE_THUMB_HEIGHT;
+        int y1 = (ty + 1) * src->height / SCENE_THUMB_HEIGHT;
+        if (y1 <= y0) y1 = y0 + 1;
+
+        for (int tx = 0; tx < SCENE_THUMB_WIDTH; tx++) {
+            int x0 = tx * src->width / SCENE_THUMB_WIDTH;
+            int x1 = (tx + 1) * src->width / SCENE_THUMB_WIDTH;
+            if (x1 <= x0) x1 = x0 + 1;
+
+            unsigned int sum = 0;
+            for (int sy = 0; sy < 4; sy++) {
+                const unsigned char* row = base + (size_t)(y0 + (y1 - y0) * sy / 4) * src->stride;
+                for (int sx = 0; sx < 4; sx++) {
+                    const unsigned char* p = row + (size_t)(x0 + (x1 - x0) * sx / 4) * src->pixel_bytes;
+                    if (src->pixel_bytes == 3) {
+                        sum += (77 * p[0] + 150 * p[1] + 29 * p[2]) >> 8;
+                    } else {
+                        sum += p[0];
+                    }
+                }
+            }
+
+            unsigned char value = (unsigned char)(sum >> 4);
+            int index = ty * SCENE_THUMB_WIDTH + tx;
+            thumb->luma[index] = value;
+            // Four interleaved sub-histograms avoid serialising on repeated
+            // bins. A SIMD histogram would have to compare every value with
+            // all 64 bins, which costs more than these 2304 increments; the
+            // SIMD work is in the SAD between thumbnails.
+            hist[index & 3][value >> 2]++;
+        }
+    }
+
+    for (int b = 0; b < SCENE_HIST_BINS; b++) {
+        thumb->hist[b] = hist[0][b] + hist[1][b] + hist[2][b] + hist[3][b];
+    }
+}
+
+// Change score between two thumbnails, in [0, 1]
+static float scene_score(const SceneThumb* a, const SceneThumb* b) {
+    float sad = (float)video_get_kernels()->sad(a->luma, b->luma, SCENE_THUMB_SIZE) / (SCENE_THUMB_SIZE * 255.0f);
+
+    unsigned int hist_delta = 0;
+    for (int i = 0; i < SCENE_HIST_BINS; i++) {
+        hist_delta += a->hist[i] > b->hist[i] ? a->hist[i] - b->hist[i] : b->hist[i] - a->hist[i];
+    }
+    float hist = (float)hist_delta / (2.0f * SCENE_THUMB_SIZE);
+
+    // Motion alone moves pixels but keeps the histogram; a cut changes both.
+    // A mean luma change of a quarter of the range already counts as a full
+    // pixel change; the cap keeps the score on the scale floor_score assumes.
+    float moved = sad * 4.0f;
+    if (moved > 1.0f) moved = 1.0f;
+    return 0.5f * moved + 0.5f * hist;
+}
+
+static int detect_scene_changes_internal(const SceneSource* src, int num_frames,
+                                         float frame_rate, int sample_interval,
+                                         int sensitivity, float* cut_times, int max_cuts) {
+    if (sample_interval < 1) sample_interval = 1;
+    if (sensitivity < 0) sensitivity = 0;
+    if (sensitivity > 100) sensitivity = 100;
+
+    // Higher sensitivity lowers both the deviation multiplier and the floor
+    float k = 4.5f - 3.0f * sensitivity / 100.0f;
+    float floor_score = 0.30f - 0.20f * sensitivity / 100.0f;
+    int min_gap = (int)(frame_rate > 0 ? frame_rate : 1); // at most one cut per second
+
+    SceneThumb* thumbs = (SceneThumb*)zell_pool_get(sizeof(SceneThumb) * 4);
+    if (!thumbs) return -1;
+    SceneThumb* prev = &thumbs[0];
+    SceneThumb* curr = &thumbs[1];
+    SceneThumb* probe[2] = { &thumbs[2], &thumbs[3] };
+
+    float history[SCENE_HISTORY];
+    int history_count = 0;
+    int history_pos = 0;
+    int cuts = 0;
+    int last_cut = -min_gap;
+    int prev_frame = 0;
+
+    scene_make_thumb(src, 0, prev);
+
+    for (int frame = sample_interval; frame < num_frames && cuts < max_cuts; frame += sample_interval) {
+        scene_make_thumb(src, frame, curr);
+        float score = scene_score(prev, curr);
+
+        float mean = 0.0f, variance = 0.0f;
+        for (int i = 0; i < history_count; i++) mean += history[i];
+        if (history_count > 0) mean /= history_count;
+        for (int i = 0; i < history_count; i++) variance += (history[i] - mean) * (history[i] - mean);
+        if (history_count > 1) variance /= history_count - 1;
+        float threshold = mean + k * sqrtf(variance) + 0.02f;
+        if (threshold < floor_score) threshold = floor_score;
+
+        int is_cut = score > threshold && frame - last_cut >= min_gap;
+
+        if (is_cut) {
+            // Refine: find the largest single-frame change between the two samples
+            int cut_frame = frame;
+            if (frame - prev_frame > 1) {
+                const SceneThumb* before = prev;
+                float best = -1.0f;
+                for (int f = prev_frame + 1; f <= frame; f++) {
+                    SceneThumb* after = curr;
+                    if (f != frame) {
+                        after = (f & 1) ? probe[0] : probe[1];
+                        scene_make_thumb(src, f, after);
+                    }
+                    float step = scene_score(before, after);
+                    if (step > best) {
+                        best = step;
+                        cut_frame = f;
+                    }
+                    before = after;
+                }
+            }
+
+            cut_times[cuts++] = frame_rate > 0 ? cut_frame / frame_rate : (float)cut_frame;
+            last_cut = cut_frame;
+            history_count = 0; // the new scene gets fresh statistics
+            history_pos = 0;
+        } else {
+            history[history_pos] = score;
+            history_pos = (history_pos + 1) % SCENE_HISTORY;
+            if (history_count < SCENE_HISTORY) history_count++;
+        }
+
+        SceneThumb* tmp = prev;
+        prev = curr;
+        curr = tmp;
+        prev_frame = frame;
+    }
+
+    zell_pool_put(thumbs);
+    return cuts;
+}
+
+/**
+ * Detect scene cuts in a batch of RGB24 frames
+ * @param input_data - Input frames (RGB24, tightly packed, frame after frame)
+ * @param width - Frame width
+ * @param height - Frame height
+ * @param num_frames - Number of frames
+ * @param frame_rate - Frames per second, used to convert frames to seconds
+ * @param sample_interval - Analyse every Nth frame (1 = every frame)
+ * @param sensitivity - Detection sensitivity (0-100, 50 is a good default)
+ * @param cut_times - Output array of cut timestamps in seconds
+ * @param max_cuts - Capacity of cut_times
+ * @return -1 on error, number of cuts written on success
+ */
+EMSCRIPTEN_KEEPALIVE
+int detect_scene_changes(unsigned char* input_data, int width, int height, int num_frames,
+                         float frame_rate, int sample_interval, int sensitivity,
+                         float* cut_times, int max_cuts) {
+    ZELL_STATS_CALL("detect_scene_changes", (int64_t)width * height * 3 * num_frames);
+    if (!input_data || !cut_times || width <= 0 || height <= 0 ||
+        num_frames <= 0 || max_cuts <= 0) {
         return -1;
     }
-    
-    int input_frame_size = input_width * input_height * 3; // RGB
-    int output_frame_size = output_width * output_height * 3;
-    
-    float x_ratio = (float)input_width / output_width;
-    float y_ratio = (float)input_height / output_height;
-    
-    for (int frame = 0; frame < num_frames; frame++) {
-        unsigned char* input_frame = input_data + (frame * input_frame_size);
-        unsigned char* output_frame = output_data + (frame * output_frame_size);
-        
-        for (int y = 0; y < output_height; y++) {
-            for (int x = 0; x < output_width; x++) {
-                int src_x = (int)(x * x_ratio);
-                int src_y = (int)(y * y_ratio);
-                
-                // Clamp to input bounds
-                if (src_x >= input_width) src_x = input_width - 1;
-                if (src_y >= input_height) src_y = input_height - 1;
-                
-                int src_index = (src_y * input_width + src_x) * 3;
-                int dst_index = (y * output_width + x) * 3;
-                
-                for (int c = 0; c < 3; c++) {
-                    output_frame[dst_index + c] = input_frame[src_index + c];
+
+    SceneSource src;
+    src.data = input_data;
+    src.width = width;
+    src.height = height;
+    src.stride = width * 3;
+    src.pixel_bytes = 3;
+    src.frame_bytes = (size_t)width * height * 3;
+
+    return ZELL_STATS_STATUS(detect_scene_changes_internal(&src, num_frames, frame_rate, sample_interval,
+                                                           sensitivity, cut_times, max_cuts));
+}
+
+/**
+ * Detect scene cuts from decoded luma planes (e.g. the Y plane of I420 frames)
+ * @param luma_data - First luma plane
+ * @param width - Plane width
+ * @param height - Plane height
+ * @param stride - Bytes per plane row
+ * @param frame_bytes - Bytes between the starts of consecutive planes
+ * @param num_frames - Number of frames
+ * @param frame_rate - Frames per second
+ * @param sample_interval - Analyse every Nth frame (1 = every frame)
+ * @param sensitivity - Detection sensitivity (0-100)
+ * @param cut_times - Output array of cut timestamps in seconds
+ * @param max_cuts - Capacity of cut_times
+ * @return -1 on error, number of cuts written on success
+ */
+EMSCRIPTEN_KEEPALIVE
+int detect_scene_changes_luma(unsigned char* luma_data, int width, int height, int stride,
+                              int64_t frame_bytes, int num_frames, float frame_rate,
+                              int sample_interval, int sensitivity,
+                              float* cut_times, int max_cuts) {
+    ZELL_STATS_CALL("detect_scene_changes_luma", (int64_t)stride * height * num_frames);
+    if (!luma_data || !cut_times || width <= 0 || height <= 0 || stride < width ||
+        frame_bytes < (int64_t)stride * height || num_frames <= 0 || max_cuts <= 0) {
+        return -1;
+    }
+
+    SceneSource src;
+    src.data = luma_data;
+    src.width = width;
+    src.height = height;
+    src.stride = stride;
+    src.pixel_bytes = 1;
+    src.frame_bytes = (size_t)frame_bytes;
+
+    return ZELL_STATS_STATUS(detect_scene_changes_internal(&src, num_frames, frame_rate, sample_interval,
+                                                           sensitivity, cut_times, max_cuts));
+}
+
+// ---------------------------------------------------------------------------
+// MP4 / MOV probing
+//
+// Reads the container structure without touching the media data: only box
+// headers are read on the way down, mdat and other payload boxes are skipped
+// by their size, and the few leaf boxes that describe a track (mvhd, tkhd,
+// mdhd, hdlr, stsd, stsz) are read in full.  The input is a ZellSource, so a
+// file or callback input costs a few dozen small reads however large it is,
+// and a moov placed after mdat is found just as cheaply.
+// ---------------------------------------------------------------------------
+
+#define MP4_INFO_FIELDS 10
+#define MP4_MAX_DEPTH 8
+#define MP4_LEAF_BYTES 128
+
+#define MP4_TYPE(a, b, c, d) \
+    (((unsigned int)(a) << 24) | ((unsigned int)(b) << 16) | ((unsigned int)(c) << 8) | (unsigned int)(d))
+
+typedef struct {
+    unsigned int handler;     // 'vide', 'soun', ...
+    unsigned int codec;       // sample entry fourcc, e.g. 'avc1', 'mp4a'
+    int64_t timescale;
+    int64_t duration;         // in timescale units
+    int width;
+    int height;
+    int channels;
+    int sample_rate;
+    int64_t sample_count;
+} Mp4Track;
+
+typedef struct {
+    const ZellSource* source;
+    int64_t movie_timescale;
+    int64_t movie_duration;
+    int found_moov;
+    int track_count;
+    Mp4Track track;           // track being parsed
+    Mp4Track video;           // first video track
+    Mp4Track audio;           // first audio track
+} Mp4Probe;
+
+static inline unsigned int mp4_u16(const unsigned char* p) {
+    return ((unsigned int)p[0] << 8) | p[1];
+}
+
+static inline unsigned int mp4_u32(const unsigned char* p) {
+    return ((unsigned int)p[0] << 24) | ((unsigned int)p[1] << 16) | ((unsigned int)p[2] << 8) | p[3];
+}
+
+static inline uint64_t mp4_u64(const unsigned char* p) {
+    return ((uint64_t)mp4_u32(p) << 32) | mp4_u32(p + 4);
+}
+
+// Read a full-box (version + flags) header field pair: v0 uses 32-bit times, v1 64-bit
+static void mp4_parse_times(const unsigned char* p, int64_t length, int64_t* timescale, int64_t* duration) {
+    if (length >= 32 && p[0] == 1) {
+        *timescale = mp4_u32(p + 20);
+        *duration = (int64_t)mp4_u64(p + 24);
+    } else if (length >= 20) {
+        *timescale = mp4_u32(p + 12);
+        *duration = mp4_u32(p + 16);
+        if (*duration == 0xFFFFFFFFLL) *duration = 0; // unknown
+    }
+}
+
+static void mp4_parse_leaf(Mp4Probe* probe, unsigned int type, const unsigned char* p, int64_t length) {
+    Mp4Track* track = &probe->track;
+    switch (type) {
+    case MP4_TYPE('m', 'v', 'h', 'd'):
+        mp4_parse_times(p, length, &probe->movie_timescale, &probe->movie_duration);
+        break;
+    case MP4_TYPE('t', 'k', 'h', 'd'): {
+        // Width and height are 16.16 fixed point at the end of the box
+        int64_t at = p[0] == 1 ? 88 : 76;
+        if (length >= at + 8) {
+            track->width = (int)(mp4_u32(p + at) >> 16);
+            track->height = (int)(mp4_u32(p + at + 4) >> 16);
+        }
+        break;
+    }
+    case MP4_TYPE('m', 'd', 'h', 'd'):
+        mp4_parse_times(p, length, &track->timescale, &track->duration);
+        break;
+    case MP4_TYPE('h', 'd', 'l', 'r'):
+        if (length >= 12) track->handler = mp4_u32(p + 8);
+        break;
+    case MP4_TYPE('s', 't', 's', 'd'):
+        // First sample entry: size, format, 6 reserved, data reference index
+        if (length >= 16) {
+            const unsigned char* entry = p + 8;
+            int64_t entry_length = length - 8;
+            track->codec = mp4_u32(entry + 4);
+            if (track->handler == MP4_TYPE('v', 'i', 'd', 'e') && entry_length >= 36) {
+                if (!track->width) track->width = (int)mp4_u16(entry + 32);
+                if (!track->height) track->height = (int)mp4_u16(entry + 34);
+            } else if (track->handler == MP4_TYPE('s', 'o', 'u', 'n') && entry_length >= 36) {
+                track->channels = (int)mp4_u16(entry + 24);
+                track->sample_rate = (int)(mp4_u32(entry + 32) >> 16);
+            }
+        }
+        break;
+    case MP4_TYPE('s', 't', 's', 'z'):
+        if (length >= 12) track->sample_count = mp4_u32(p + 8);
+        break;
+    }
+}
+
+static int mp4_is_container(unsigned int type) {
+    return type == MP4_TYPE('m', 'o', 'o', 'v') || type == MP4_TYPE('t', 'r', 'a', 'k') ||
+           type == MP4_TYPE('m', 'd', 'i', 'a') || type == MP4_TYPE('m', 'i', 'n', 'f') ||
+           type == MP4_TYPE('s', 't', 'b', 'l');
+}
+
+static int mp4_is_leaf(unsigned int type) {
+    return type == MP4_TYPE('m', 'v', 'h', 'd') || type == MP4_TYPE('t', 'k', 'h', 'd') ||
+           type == MP4_TYPE('m', 'd', 'h', 'd') || type == MP4_TYPE('h', 'd', 'l', 'r') ||
+           type == MP4_TYPE('s', 't', 's', 'd') || type == MP4_TYPE('s', 't', 's', 'z');
+}
+
+// Walk the boxes in [start, end); returns -1 on a malformed box
+static int mp4_parse_boxes(Mp4Probe* probe, int64_t start, int64_t end, int depth) {
+    int64_t offset = start;
+    while (end - offset >= 8) {
+        unsigned char header[16];
+        if (zell_source_read(probe->source, offset, header, 8) != 8) return -1;
+        int64_t size = mp4_u32(header);
+        unsigned int type = mp4_u32(header + 4);
+        int64_t header_size = 8;
+
+        if (size == 1) {
+            // 64-bit largesize follows the type
+            if (zell_source_read(probe->source, offset + 8, header + 8, 8) != 8) return -1;
+            uint64_t large = mp4_u64(header + 8);
+            if (large > (uint64_t)INT64_MAX) return -1;
+            size = (int64_t)large;
+            header_size = 16;
+        } else if (size == 0) {
+            size = end - offset; // extends to the end of the enclosing box
+        }
+        if (size < header_size || size > end - offset) return -1;
+        if (depth == 0 && offset == start &&
+            type != MP4_TYPE('f', 't', 'y', 'p') && type != MP4_TYPE('m', 'o', 'o', 'v') &&
+            type != MP4_TYPE('w', 'i', 'd', 'e') && type != MP4_TYPE('f', 'r', 'e', 'e') &&
+            type != MP4_TYPE('s', 'k', 'i', 'p') && type != MP4_TYPE('m', 'd', 'a', 't')) {
+            return -1; // not an ISO base media / QuickTime file
+        }
+
+        int64_t body = offset + header_size;
+        int64_t body_size = size - header_size;
+        if (mp4_is_container(type) && depth < MP4_MAX_DEPTH) {
+            int is_track = type == MP4_TYPE('t', 'r', 'a', 'k');
+            if (type == MP4_TYPE('m', 'o', 'o', 'v')) probe->found_moov = 1;
+            if (is_track) memset(&probe->track, 0, sizeof(probe->track));
+            if (mp4_parse_boxes(probe, body, body + body_size, depth + 1) != 0) return -1;
+            if (is_track) {
+                probe->track_count++;
+                if (probe->track.handler == MP4_TYPE('v', 'i', 'd', 'e') && !probe->video.handler) {
+                    probe->video = probe->track;
+                } else if (probe->track.handler == MP4_TYPE('s', 'o', 'u', 'n') && !probe->audio.handler) {
+                    probe->audio = probe->track;
                 }
             }
+        } else if (mp4_is_leaf(type)) {
+            unsigned char leaf[MP4_LEAF_BYTES];
+            int64_t length = body_size < MP4_LEAF_BYTES ? body_size : MP4_LEAF_BYTES;
+            if (zell_source_read(probe->source, body, leaf, length) != length) return -1;
+            mp4_parse_leaf(probe, type, leaf, length);
         }
+        offset += size;
     }
-    
     return 0;
 }
 
+static int64_t mp4_track_ms(const Mp4Track* track) {
+    return track->timescale > 0 ? track->duration * 1000 / track->timescale : 0;
+}
+
+static int mp4_probe_source(const ZellSource* source, int* info) {
+    Mp4Probe probe;
+    memset(&probe, 0, sizeof(probe));
+    probe.source = source;
+    if (mp4_parse_boxes(&probe, 0, source->size, 0) != 0 || !probe.found_moov) {
+        return -1;
+    }
 
+    int64_t duration_ms = probe.movie_timescale > 0
+        ? probe.movie_duration * 1000 / probe.movie_timescale : 0;
+    if (duration_ms <= 0) {
+        duration_ms = mp4_track_ms(&probe.video) > mp4_track_ms(&probe.audio)
+            ? mp4_track_ms(&probe.video) : mp4_track_ms(&probe.audio);
+    }
+
+    const Mp4Track* video = &probe.video;
+    int64_t fps_milli = video->duration > 0
+        ? video->sample_count * video->timescale * 1000 / video->duration : 0;
+
+    info[0] = duration_ms > INT32_MAX ? INT32_MAX : (int)duration_ms;
+    info[1] = video->width;
+    info[2] = video->height;
+    info[3] = video->sample_count > INT32_MAX ? INT32_MAX : (int)video->sample_count;
+    info[4] = fps_milli > INT32_MAX ? INT32_MAX : (int)fps_milli;
+    info[5] = probe.audio.sample_rate;
+    info[6] = probe.audio.channels;
+    info[7] = probe.track_count;
+    info[8] = (int)video->codec;
+    info[9] = (int)probe.audio.codec;
+    return probe.track_count;
+}
+
+/**
+ * Read the stream parameters of an MP4/MOV file from its box structure
+ * @param input_data - Container data
+ * @param input_size - Size of container data
+ * @param info - Output array of MP4_INFO_FIELDS (10) ints: duration in ms,
+ *               width, height, video frame count, frame rate * 1000,
+ *               audio sample rate, audio channels, track count,
+ *               video codec fourcc, audio codec fourcc (0 when absent)
+ * @return -1 on error or if the input is not an MP4/MOV, track count on success
+ */
+EMSCRIPTEN_KEEPALIVE
+int probe_mp4(unsigned char* input_data, int64_t input_size, int* info) {
+    ZELL_STATS_CALL("probe_mp4", input_size);
+    if (!input_data || !info || input_size <= 0) {
+        return -1;
+    }
+    ZellSource source;
+    zell_source_memory(&source, input_data, input_size);
+    return ZELL_STATS_STATUS(mp4_probe_source(&source, info));
+}
+
+/**
+ * Probe an MP4/MOV file by path (see probe_mp4)
+ * @param path - Path of the file
+ * @param info - Output array of MP4_INFO_FIELDS ints
+ * @return -1 on error, track count on success
+ */
+EMSCRIPTEN_KEEPALIVE
+int probe_mp4_file(const char* path, int* info) {
+    ZELL_STATS_CALL("probe_mp4_file", 0);
+    ZellSource source;
+    if (!path || !info || zell_source_open_file(&source, path) != 0) {
+        return -1;
+    }
+    int result = mp4_probe_source(&source, info);
+    zell_source_close(&source);
+    return ZELL_STATS_STATUS(result);
+}
+
+/**
+ * Probe an MP4/MOV read through a callback (see probe_mp4)
+ * @param read_at - Reads part of the input (see ZellReadAt)
+ * @param ctx - Opaque pointer passed to read_at
+ * @param input_size - Size of the input
+ * @param info - Output array of MP4_INFO_FIELDS ints
+ * @return -1 on error, track count on success
+ */
+EMSCRIPTEN_KEEPALIVE
+int probe_mp4_source(ZellReadAt read_at, void* ctx, int64_t input_size, int* info) {
+    ZELL_STATS_CALL("probe_mp4_source", input_size);
+    if (!read_at || !info || input_size <= 0) {
+        return -1;
+    }
+    ZellSource source;
+    zell_source_callback(&source, read_at, ctx, input_size, 0);
+    return ZELL_STATS_STATUS(mp4_probe_source(&source, info));
+}
@@ -0,0 +1,243 @@
+#ifndef ZELL_ALLOC_H
+#define ZELL_ALLOC_H
+
+// Scratch memory shared by the processor modules.
+//
+// Two layers: a size-class pool that caches released buffers instead of
+// handing them back to malloc, and a bump arena for everything that lives
+// exactly as long as one job (parser nodes, lookup tables, queues).  Arena
+// blocks come from the pool, so once a batch has warmed the caches a
+// repeated job allocates nothing from the system heap, and the WASM heap
+// stops fragmenting and growing between jobs.
+//
+// Pool sizes step in quarters of a power of two (256, 320, 384, 448, 512,
+// 640, ...), so a buffer wastes at most a quarter of its size.  Requests
+// above ZELL_POOL_MAX go straight to malloc and are never cached.
+
+#include "zell-common.h"
+#include "zell-stats.h"
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#define ZELL_POOL_MIN_SHIFT 8                     // smallest class: 256 bytes
+#define ZELL_POOL_MAX ((size_t)64 << 20)          // largest cached buffer
+#define ZELL_POOL_CLASSES 73                      // classes up to ZELL_POOL_MAX
+#define ZELL_POOL_OVERSIZE ZELL_POOL_CLASSES      // class tag of uncached buffers
+
+// Bytes the pool may hold on to; a build for small devices can lower it
+#ifndef ZELL_POOL_CACHE_BYTES
+#define ZELL_POOL_CACHE_BYTES ((size_t)128 << 20)
+#endif
+
+#define ZELL_ARENA_BLOCK ((size_t)64 * 1024)
+
+// Precedes every pool buffer; 16 bytes keeps the payload 16-byte aligned
+typedef union ZellPoolHeader {
+    struct {
+        uint32_t size_class;
+        union ZellPoolHeader* next;  // free-list link while cached
+    } h;
+    struct {
+        uint32_t size_class;         // ZELL_POOL_OVERSIZE
+        size_t size;                 // requested size
+    } big;
+    unsigned char pad[16];
+} ZellPoolHeader;
+
+typedef struct {
+    ZellPoolHeader* free_lists[ZELL_POOL_CLASSES];
+    size_t cached_bytes;
+#ifdef ZELL_HAVE_THREADS
+    pthread_mutex_t lock;
+#endif
+} ZellPool;
+
+// One pool per module: every entry point and worker thread shares it
+static ZellPool zell_pool = {
+    { NULL }, 0,
+#ifdef ZELL_HAVE_THREADS
+    PTHREAD_MUTEX_INITIALIZER
+#endif
+};
+
+static inline size_t zell_pool_class_size(unsigned int size_class) {
+    size_t base = (size_t)1 << (ZELL_POOL_MIN_SHIFT + size_class / 4);
+    return base + (size_class % 4) * (base / 4);
+}
+
+static inline unsigned int zell_pool_class(size_t size) {
+    if (size <= ((size_t)1 << ZELL_POOL_MIN_SHIFT)) return 0;
+    unsigned int shift = 0;
+    for (size_t s = size - 1; s > 1; s >>= 1) shift++;
+    size_t base = (size_t)1 << shift;
+    size_t step = base / 4;
+    unsigned int sub = (unsigned int)((size - base + step - 1) / step);
+    return 4 * (shift - ZELL_POOL_MIN_SHIFT) + sub;
+}
+
+static inline void zell_pool_lock(void) {
+#ifdef ZELL_HAVE_THREADS
+    pthread_mutex_lock(&zell_pool.lock);
+#endif
+}
+
+static inline void zell_pool_unlock(void) {
+#ifdef ZELL_HAVE_THREADS
+    pthread_mutex_unlock(&zell_pool.lock);
+#endif
+}
+
+/**
+ * Get a scratch buffer, reusing a released one of the same size class
+ * @param size - Bytes needed
+ * @return Buffer to release with zell_pool_put, or NULL when out of memory
+ */
+static inline void* zell_pool_get(size_t size) {
+    if (size > ZELL_POOL_MAX) {
+        if (size > SIZE_MAX - sizeof(ZellPoolHeader)) return NULL;
+        ZellPoolHeader* header = (ZellPoolHeader*)malloc(sizeof(ZellPoolHeader) + size);
+        if (!header) return NULL;
+        header->big.size_class = ZELL_POOL_OVERSIZE;
+        header->big.size = size;
+        ZELL_STATS_ALLOC(size);
+        return header + 1;
+    }
+
+    unsigned int size_class = zell_pool_class(size);
+    zell_pool_lock();
+    ZellPoolHeader* header = zell_pool.free_lists[size_class];
+    if (header) {
+        zell_pool.free_lists[size_class] = header->h.next;
+        zell_pool.cached_bytes -= zell_pool_class_size(size_class);
+    }
+    zell_pool_unlock();
+
+    if (!header) {
+        header = (ZellPoolHeader*)malloc(sizeof(ZellPoolHeader) + zell_pool_class_size(size_class));
+        if (!header) return NULL;
+    }
+    header->h.size_class = size_class;
+    ZELL_STATS_ALLOC(zell_pool_class_size(size_class));
+    return header + 1;
+}
+
+// Release a buffer from zell_pool_get (NULL is ignored)
+static inline void zell_pool_put(void* ptr) {
+    if (!ptr) return;
+    ZellPoolHeader* header = (ZellPoolHeader*)ptr - 1;
+    unsigned int size_class = header->h.size_class;
+    if (size_class >= ZELL_POOL_CLASSES) {
+        ZELL_STATS_FREE(header->big.size);
+        free(header);
+        return;
+    }
+
+    size_t size = zell_pool_class_size(size_class);
+    ZELL_STATS_FREE(size);
+    zell_pool_lock();
+    int keep = zell_pool.cached_bytes + size <= ZELL_POOL_CACHE_BYTES;
+    if (keep) {
+        header->h.next = zell_pool.free_lists[size_class];
+        zell_pool.free_lists[size_class] = header;
+        zell_pool.cached_bytes += size;
+    }
+    zell_pool_unlock();
+    if (!keep) free(header);
+}
+
+// Hand every cached buffer back to the system heap
+static inline void zell_pool_trim(void) {
+    zell_pool_lock();
+    for (int i = 0; i < ZELL_POOL_CLASSES; i++) {
+        ZellPoolHeader* header = zell_pool.free_lists[i];
+        while (header) {
+            ZellPoolHeader* next = header->h.next;
+            free(header);
+            header = next;
+        }
+        zell_pool.free_lists[i] = NULL;
+    }
+    zell_pool.cached_bytes = 0;
+    zell_pool_unlock();
+}
+
+// --- Job arena ---------------------------------------------------------------
+//
+// Bump allocation out of pool blocks; nothing is freed individually.  An
+// arena is not thread-safe: workers allocate from their own arena or from
+// the pool.
+
+typedef struct ZellArenaBlock {
+    struct ZellArenaBlock* next;
+    size_t used;
+    size_t capacity;
+} ZellArenaBlock;
+
+typedef struct {
+    ZellArenaBlock* head;
+} ZellArena;
+
+#define ZELL_ARENA_HEADER ((sizeof(ZellArenaBlock) + 15) & ~(size_t)15)
+
+static inline void* zell_arena_alloc(ZellArena* arena, size_t size) {
+    if (size > SIZE_MAX - ZELL_ARENA_HEADER - 15) return NULL;
+    size = (size + 15) & ~(size_t)15;
+    ZellArenaBlock* block = arena->head;
+
+    if (!block || block->capacity - block->used < size) {
+        size_t standard = ZELL_ARENA_BLOCK - ZELL_ARENA_HEADER;
+        size_t capacity = size > standard / 2 ? size : standard;
+        block = (ZellArenaBlock*)zell_pool_get(ZELL_ARENA_HEADER + capacity);
+        if (!block) return NULL;
+        block->used = 0;
+        block->capacity = capacity;
+        // Oversized blocks go second so the current block keeps filling up
+        if (arena->head && capacity != standard) {
+            block->next = arena->head->next;
+            arena->head->next = block;
+        } else {
+            block->next = arena->head;
+            arena->head = block;
+        }
+    }
+
+    void* ptr = (unsigned char*)block + ZELL_ARENA_HEADER + block->used;
+    block->used += size;
+    return ptr;
+}
+
+// Zero-filled allocation with an overflow-checked element count
+static inline void* zell_arena_calloc(ZellArena* arena, size_t count, size_t size) {
+    if (size && count > SIZE_MAX / size) return NULL;
+    void* ptr = zell_arena_alloc(arena, count * size);
+    if (ptr) memset(ptr, 0, count * size);
+    return ptr;
+}
+
+// Return every block to the pool
+static inline void zell_arena_free(ZellArena* arena) {
+    ZellArenaBlock* block = arena->head;
+    while (block) {
+        ZellArenaBlock* next = block->next;
+        zell_pool_put(block);
+        block = next;
+    }
+    arena->head = NULL;
+}
+
+// Release everything but the first block, which is kept for reuse
+static inline void zell_arena_reset(ZellArena* arena) {
+    ZellArenaBlock* head = arena->head;
+    if (!head) return;
+    ZellArenaBlock* block = head->next;
+    while (block) {
+        ZellArenaBlock* next = block->next;
+        zell_pool_put(block);
+        block = next;
+    }
+    head->next = NULL;
+    head->used = 0;
+}
+
+#endif // ZELL_ALLOC_H
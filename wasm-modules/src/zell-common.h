@@ -0,0 +1,56 @@
+#ifndef ZELL_COMMON_H
+#define ZELL_COMMON_H
+
+// Shared build glue for the ZELL processor modules.
+// Every module compiles both with emcc (WebAssembly) and with a plain
+// C compiler (native build), so nothing here may assume either toolchain.
+
+#ifdef __EMSCRIPTEN__
+#include <emscripten.h>
+#else
+#define EMSCRIPTEN_KEEPALIVE __attribute__((visibility("default")))
+#endif
+
+// Threads are available in the pthreads WASM build (-pthread) and in every
+// native build unless explicitly disabled with -DZELL_NO_THREADS.
+#if defined(__EMSCRIPTEN_PTHREADS__) || (!defined(__EMSCRIPTEN__) && !defined(ZELL_NO_THREADS))
+#define ZELL_HAVE_THREADS 1
+#include <pthread.h>
+#endif
+
+#if defined(ZELL_HAVE_THREADS) && defined(__EMSCRIPTEN__)
+#include <emscripten/threading.h>
+#elif defined(ZELL_HAVE_THREADS)
+#include <unistd.h>
+#endif
+
+// Builds with a fixed pthread pool pass a matching -DZELL_MAX_THREADS
+#ifndef ZELL_MAX_THREADS
+#define ZELL_MAX_THREADS 32
+#endif
+
+/**
+ * Resolve a caller-supplied worker count
+ * @param requested - Requested worker count (0 or less = one per core)
+ * @return Worker count to use, always between 1 and ZELL_MAX_THREADS
+ */
+static inline int zell_resolve_threads(int requested) {
+#ifdef ZELL_HAVE_THREADS
+    int threads = requested;
+    if (threads <= 0) {
+#ifdef __EMSCRIPTEN__
+        threads = emscripten_num_logical_cores();
+#else
+        threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+    }
+    if (threads < 1) threads = 1;
+    if (threads > ZELL_MAX_THREADS) threads = ZELL_MAX_THREADS;
+    return threads;
+#else
+    (void)requested;
+    return 1;
+#endif
+}
+
+#endif // ZELL_COMMON_H
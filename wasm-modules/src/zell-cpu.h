@@ -0,0 +1,116 @@
+#ifndef ZELL_CPU_H
+#define ZELL_CPU_H
+
+// Runtime selection of SIMD kernels.
+//
+// A native build has to run on anything from an SSE-only server to an
+// AVX-512 box, so on x86 each hot kernel is compiled once per instruction
+// set (with per-function target attributes, no special compiler flags) and
+// a module picks its variants the first time they are needed, from cpuid.
+// Each module keeps the chosen variants in a small table of function
+// pointers that is filled in exactly once.
+//
+// ARM64 always has NEON, and WebAssembly cannot probe features from inside
+// a module, so those builds pick their kernels at compile time: the JS
+// loaders choose between the -msimd128 and the plain .wasm instead.
+//
+// ZELL_CPU=scalar|sse4.1|avx2|avx512|neon in the environment caps the
+// native choice, for benchmarking the variants against each other.
+
+#include "zell-common.h"
+#include <stdlib.h>
+#include <string.h>
+
+#if !defined(__EMSCRIPTEN__) && (defined(__x86_64__) || defined(__i386__)) && \
+    (defined(__GNUC__) || defined(__clang__))
+#define ZELL_CPU_X86 1
+#include <immintrin.h>
+#define ZELL_TARGET(features) __attribute__((target(features)))
+#elif defined(__ARM_NEON)
+#define ZELL_CPU_NEON_BUILD 1
+#include <arm_neon.h>
+#elif defined(__wasm_simd128__)
+#define ZELL_CPU_SIMD128_BUILD 1
+#include <wasm_simd128.h>
+#endif
+
+#define ZELL_CPU_SCALAR  0
+#define ZELL_CPU_SSE41   1
+#define ZELL_CPU_AVX2    2
+#define ZELL_CPU_AVX512  3   // AVX-512 F + BW
+#define ZELL_CPU_NEON    4
+#define ZELL_CPU_SIMD128 5
+
+static inline const char* zell_cpu_name(int level) {
+    switch (level) {
+        case ZELL_CPU_SSE41: return "sse4.1";
+        case ZELL_CPU_AVX2: return "avx2";
+        case ZELL_CPU_AVX512: return "avx512";
+        case ZELL_CPU_NEON: return "neon";
+        case ZELL_CPU_SIMD128: return "simd128";
+        default: return "scalar";
+    }
+}
+
+/**
+ * Best kernel level this machine runs, after the ZELL_CPU cap
+ * @return One of the ZELL_CPU_* levels
+ */
+static inline int zell_cpu_level(void) {
+    int level = ZELL_CPU_SCALAR;
+#if defined(ZELL_CPU_X86)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse4.1")) level = ZELL_CPU_SSE41;
+    if (level == ZELL_CPU_SSE41 && __builtin_cpu_supports("avx2")) level = ZELL_CPU_AVX2;
+    if (level == ZELL_CPU_AVX2 && __builtin_cpu_supports("avx512f") &&
+        __builtin_cpu_supports("avx512bw")) level = ZELL_CPU_AVX512;
+#elif defined(ZELL_CPU_NEON_BUILD)
+    level = ZELL_CPU_NEON;
+#elif defined(ZELL_CPU_SIMD128_BUILD)
+    level = ZELL_CPU_SIMD128;
+#endif
+
+#ifndef __EMSCRIPTEN__
+    // A cap only ever lowers the level; an unknown or unavailable name is ignored
+    const char* cap = getenv("ZELL_CPU");
+    if (cap) {
+        for (int candidate = ZELL_CPU_SCALAR; candidate <= level; candidate++) {
+            if (strcmp(cap, zell_cpu_name(candidate)) == 0) {
+                if (candidate == ZELL_CPU_SCALAR || level <= ZELL_CPU_AVX512 || candidate == level) {
+                    level = candidate;
+                }
+                break;
+            }
+        }
+    }
+#endif
+    return level;
+}
+
+/**
+ * Whether hardware CRC help is usable: carry-less multiply (PCLMULQDQ) on
+ * x86, the CRC32 instructions on ARM builds that target them. A ZELL_CPU
+ * cap of scalar rules it out.
+ * @return 1 if the CRC kernels may use it, 0 otherwise
+ */
+static inline int zell_cpu_has_crc(void) {
+#if defined(ZELL_CPU_X86)
+    return zell_cpu_level() >= ZELL_CPU_SSE41 && __builtin_cpu_supports("pclmul");
+#elif defined(ZELL_CPU_NEON_BUILD) && defined(__ARM_FEATURE_CRC32)
+    return zell_cpu_level() == ZELL_CPU_NEON;
+#else
+    return 0;
+#endif
+}
+
+// Run a kernel table's init function exactly once, from whichever thread
+// needs the table first
+#ifdef ZELL_HAVE_THREADS
+#define ZELL_ONCE_DEFINE(name) static pthread_once_t name = PTHREAD_ONCE_INIT
+#define ZELL_ONCE(name, init) pthread_once(&(name), (init))
+#else
+#define ZELL_ONCE_DEFINE(name) static int name = 0
+#define ZELL_ONCE(name, init) do { if (!(name)) { (name) = 1; (init)(); } } while (0)
+#endif
+
+#endif // ZELL_CPU_H
@@ -0,0 +1,207 @@
+#ifndef ZELL_CRC32_H
+#define ZELL_CRC32_H
+
+// CRC-32 as used by ZIP, gzip and PNG (reflected polynomial 0xEDB88320),
+// with the same calling convention as zlib's crc32(): start from 0 and feed
+// the previous result back in for the next piece.
+//
+// The scalar kernel is slicing-by-8.  x86 folds 64 bytes per step with
+// carry-less multiplies (PCLMULQDQ) and ARM uses its CRC32 instructions;
+// both are an order of magnitude faster, so checksums never hold up the
+// threads that compress.  zell_crc32_combine joins the CRCs of adjacent
+// pieces, which lets every worker checksum its own block.
+
+#include "zell-cpu.h"
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+#if defined(ZELL_CPU_NEON_BUILD) && defined(__ARM_FEATURE_CRC32)
+#include <arm_acle.h>
+#define ZELL_CRC32_ARM 1
+#endif
+
+#define ZELL_CRC32_POLY 0xEDB88320u
+
+// Update a CRC register (pre-inverted, as the instructions want it)
+typedef uint32_t (*ZellCrc32Kernel)(uint32_t crc, const unsigned char* data, size_t size);
+
+static uint32_t zell_crc32_table[8][256];
+static uint32_t zell_crc32_x2n[32];       // x^(2^n) mod P, for combining
+static ZellCrc32Kernel zell_crc32_kernel;
+ZELL_ONCE_DEFINE(zell_crc32_once);
+
+static uint32_t zell_crc32_scalar(uint32_t crc, const unsigned char* data, size_t size) {
+    while (size && ((uintptr_t)data & 7)) {
+        crc = (crc >> 8) ^ zell_crc32_table[0][(crc ^ *data++) & 0xFF];
+        size--;
+    }
+    for (; size >= 8; size -= 8, data += 8) {
+        uint32_t lo, hi;
+        memcpy(&lo, data, 4);
+        memcpy(&hi, data + 4, 4);
+        lo ^= crc;
+        crc = zell_crc32_table[7][lo & 0xFF] ^ zell_crc32_table[6][(lo >> 8) & 0xFF] ^
+              zell_crc32_table[5][(lo >> 16) & 0xFF] ^ zell_crc32_table[4][lo >> 24] ^
+              zell_crc32_table[3][hi & 0xFF] ^ zell_crc32_table[2][(hi >> 8) & 0xFF] ^
+              zell_crc32_table[1][(hi >> 16) & 0xFF] ^ zell_crc32_table[0][hi >> 24];
+    }
+    while (size--) crc = (crc >> 8) ^ zell_crc32_table[0][(crc ^ *data++) & 0xFF];
+    return crc;
+}
+
+#if defined(ZELL_CPU_X86)
+// Folding constants x^(k) mod P for the distances the loop folds across,
+// then the Barrett reduction constants (Intel, "Fast CRC Computation for
+// Generic Polynomials Using PCLMULQDQ")
+ZELL_TARGET("pclmul,sse4.1")
+static uint32_t zell_crc32_clmul(uint32_t crc, const unsigned char* data, size_t size) {
+    if (size < 64) return zell_crc32_scalar(crc, data, size);
+    size_t tail = size & 15;
+    size -= tail;
+
+    const __m128i k1k2 = _mm_set_epi64x(0x01c6e41596LL, 0x0154442bd4LL);
+    const __m128i k3k4 = _mm_set_epi64x(0x00ccaa009eLL, 0x01751997d0LL);
+    const __m128i k5 = _mm_set_epi64x(0, 0x0163cd6124LL);
+    const __m128i poly = _mm_set_epi64x(0x01f7011641LL, 0x01db710641LL);
+    const __m128i low32 = _mm_setr_epi32(-1, 0, -1, 0);
+
+    __m128i x1 = _mm_loadu_si128((const __m128i*)data);
+    __m128i x2 = _mm_loadu_si128((const __m128i*)(data + 16));
+    __m128i x3 = _mm_loadu_si128((const __m128i*)(data + 32));
+    __m128i x4 = _mm_loadu_si128((const __m128i*)(data + 48));
+    x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128((int)crc));
+    data += 64;
+    size -= 64;
+
+    // Four lanes of 128 bits, each folded 512 bits forward per step
+    for (; size >= 64; size -= 64, data += 64) {
+        __m128i f1 = _mm_clmulepi64_si128(x1, k1k2, 0x00);
+        __m128i f2 = _mm_clmulepi64_si128(x2, k1k2, 0x00);
+        __m128i f3 = _mm_clmulepi64_si128(x3, k1k2, 0x00);
+        __m128i f4 = _mm_clmulepi64_si128(x4, k1k2, 0x00);
+        x1 = _mm_xor_si128(_mm_clmulepi64_si128(x1, k1k2, 0x11), f1);
+        x2 = _mm_xor_si128(_mm_clmulepi64_si128(x2, k1k2, 0x11), f2);
+        x3 = _mm_xor_si128(_mm_clmulepi64_si128(x3, k1k2, 0x11), f3);
+        x4 = _mm_xor_si128(_mm_clmulepi64_si128(x4, k1k2, 0x11), f4);
+        x1 = _mm_xor_si128(x1, _mm_loadu_si128((const __m128i*)data));
+        x2 = _mm_xor_si128(x2, _mm_loadu_si128((const __m128i*)(data + 16)));
+        x3 = _mm_xor_si128(x3, _mm_loadu_si128((const __m128i*)(data + 32)));
+        x4 = _mm_xor_si128(x4, _mm_loadu_si128((const __m128i*)(data + 48)));
+    }
+
+    // Fold the lanes into one, then any remaining 16-byte pieces
+    __m128i lanes[3] = { x2, x3, x4 };
+    for (int i = 0; i < 3; i++) {
+        __m128i f = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+        x1 = _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128(x1, k3k4, 0x11), lanes[i]), f);
+    }
+    for (; size >= 16; size -= 16, data += 16) {
+        __m128i f = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+        x1 = _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128(x1, k3k4, 0x11),
+                                         _mm_loadu_si128((const __m128i*)data)), f);
+    }
+
+    // 128 -> 64 bits, then Barrett reduction to 32
+    __m128i f = _mm_clmulepi64_si128(x1, k3k4, 0x10);
+    x1 = _mm_xor_si128(_mm_srli_si128(x1, 8), f);
+    f = _mm_srli_si128(x1, 4);
+    x1 = _mm_xor_si128(_mm_clmulepi64_si128(_mm_and_si128(x1, low32), k5, 0x00), f);
+    f = _mm_clmulepi64_si128(_mm_and_si128(x1, low32), poly, 0x10);
+    f = _mm_clmulepi64_si128(_mm_and_si128(f, low32), poly, 0x00);
+    crc = (uint32_t)_mm_extract_epi32(_mm_xor_si128(x1, f), 1);
+
+    return tail ? zell_crc32_scalar(crc, data, tail) : crc;
+}
+#endif // ZELL_CPU_X86
+
+#if defined(ZELL_CRC32_ARM)
+static uint32_t zell_crc32_arm(uint32_t crc, const unsigned char* data, size_t size) {
+    while (size && ((uintptr_t)data & 7)) {
+        crc = __crc32b(crc, *data++);
+        size--;
+    }
+    for (; size >= 32; size -= 32, data += 32) {
+        uint64_t words[4];
+        memcpy(words, data, sizeof(words));
+        crc = __crc32d(crc, words[0]);
+        crc = __crc32d(crc, words[1]);
+        crc = __crc32d(crc, words[2]);
+        crc = __crc32d(crc, words[3]);
+    }
+    for (; size >= 8; size -= 8, data += 8) {
+        uint64_t word;
+        memcpy(&word, data, sizeof(word));
+        crc = __crc32d(crc, word);
+    }
+    while (size--) crc = __crc32b(crc, *data++);
+    return crc;
+}
+#endif // ZELL_CRC32_ARM
+
+// a * b modulo P, both polynomials in reflected bit order
+static uint32_t zell_crc32_multiply(uint32_t a, uint32_t b) {
+    uint32_t product = 0;
+    for (uint32_t m = 1u << 31; m; m >>= 1) {
+        if (a & m) product ^= b;
+        b = (b & 1) ? (b >> 1) ^ ZELL_CRC32_POLY : b >> 1;
+    }
+    return product;
+}
+
+static void zell_crc32_init(void) {
+    for (uint32_t n = 0; n < 256; n++) {
+        uint32_t c = n;
+        for (int k = 0; k < 8; k++) c = (c & 1) ? (c >> 1) ^ ZELL_CRC32_POLY : c >> 1;
+        zell_crc32_table[0][n] = c;
+    }
+    for (int t = 1; t < 8; t++) {
+        for (int n = 0; n < 256; n++) {
+            uint32_t previous = zell_crc32_table[t - 1][n];
+            zell_crc32_table[t][n] = (previous >> 8) ^ zell_crc32_table[0][previous & 0xFF];
+        }
+    }
+    zell_crc32_x2n[0] = 1u << 30;  // x^1
+    for (int n = 1; n < 32; n++) {
+        zell_crc32_x2n[n] = zell_crc32_multiply(zell_crc32_x2n[n - 1], zell_crc32_x2n[n - 1]);
+    }
+
+    zell_crc32_kernel = zell_crc32_scalar;
+#if defined(ZELL_CPU_X86)
+    if (zell_cpu_has_crc()) zell_crc32_kernel = zell_crc32_clmul;
+#elif defined(ZELL_CRC32_ARM)
+    if (zell_cpu_has_crc()) zell_crc32_kernel = zell_crc32_arm;
+#endif
+}
+
+/**
+ * Continue a CRC-32 over more data
+ * @param crc - CRC of the data before (0 to start)
+ * @param data - Next piece
+ * @param size - Size of the piece
+ * @return CRC of everything so far
+ */
+static inline uint32_t zell_crc32(uint32_t crc, const unsigned char* data, size_t size) {
+    ZELL_ONCE(zell_crc32_once, zell_crc32_init);
+    return ~zell_crc32_kernel(~crc, data, size);
+}
+
+/**
+ * CRC-32 of two pieces back to back, from the CRC of each
+ * @param crc1 - CRC of the first piece
+ * @param crc2 - CRC of the second piece
+ * @param size2 - Size of the second piece
+ * @return CRC of the whole
+ */
+static inline uint32_t zell_crc32_combine(uint32_t crc1, uint32_t crc2, int64_t size2) {
+    ZELL_ONCE(zell_crc32_once, zell_crc32_init);
+    // Shifting crc1 past size2 bytes multiplies it by x^(8 * size2)
+    uint32_t shift = 1u << 31;  // x^0
+    int n = 3;
+    for (uint64_t k = (uint64_t)size2; k; k >>= 1, n++) {
+        if (k & 1) shift = zell_crc32_multiply(zell_crc32_x2n[n & 31], shift);
+    }
+    return zell_crc32_multiply(shift, crc1) ^ crc2;
+}
+
+#endif // ZELL_CRC32_H
@@ -0,0 +1,1642 @@
+#ifndef ZELL_DEFLATE_H
+#define ZELL_DEFLATE_H
+
+// Deflate (RFC 1951) and its zlib (RFC 1950) and gzip (RFC 1952) wrappers.
+// PNG, PDF FlateDecode streams, ZIP entries and .tar.gz all go through this
+// one codec, so no module links zlib.
+//
+// Inflate resolves a Huffman code with one table lookup on a 64-bit bit
+// buffer that refills eight bytes at a time.  The literal/length table
+// covers 11 bits per lookup and packs two literals into an entry whenever
+// both codes fit, so literal runs (PNG rows, text) come out two at a time;
+// longer codes go through second-level tables.  While enough input and
+// output space remain, symbols decode in a loop without bounds checks and
+// matches copy 16 bytes per step; near either end a careful per-symbol path
+// takes over.  One buffer in and one buffer out is the fast case, but input
+// may also arrive in pieces and output may be flushed or grown through
+// callbacks (ZIP entries streamed to a sink, PDF streams of unknown size).
+//
+// Deflate parses the way zlib does, with zlib's level table (greedy up to
+// level 3, lazy from 4), so ratios match zlib's.  Candidate matches are
+// measured 16 bytes per compare with SIMD, and each block is written in
+// whichever of the dynamic, fixed or stored encodings is smallest, with
+// length-limited codes from the Moffat-Katajainen construction.
+// zell_deflate_block compresses one block against the bytes before it,
+// which is what the parallel deflate in archive-processor.c runs per worker.
+//
+// Adler-32 (zlib streams) picks an SSE4.1, AVX2, NEON or SIMD128 kernel as
+// zell-cpu.h describes; gzip streams use zell_crc32.
+//
+// The entry points are weak symbols, so modules linked into one native
+// binary carry a single copy.
+
+#include "zell-common.h"
+#include "zell-cpu.h"
+#include "zell-crc32.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Stream formats
+#define ZELL_DEFLATE_RAW  0
+#define ZELL_DEFLATE_ZLIB 1
+#define ZELL_DEFLATE_GZIP 2
+
+// Levels, on zlib's 0-9 scale
+#define ZELL_DEFLATE_DEFAULT 6
+#define ZELL_DEFLATE_BEST    9
+
+#define ZELL_DEFLATE_WINDOW 32768   // farthest back a match reaches
+
+// zell_inflate results
+#define ZELL_INFLATE_DONE       0
+#define ZELL_INFLATE_BAD_DATA  -1   // invalid stream or checksum mismatch
+#define ZELL_INFLATE_TRUNCATED -2   // the input ended inside the stream
+#define ZELL_INFLATE_NO_ROOM   -3   // the output is full and room() could not help
+#define ZELL_INFLATE_NO_MEMORY -4
+
+#define ZELL_DEFLATE_SHARED __attribute__((weak))
+
+static const uint16_t zell_deflate_length_base[29] = {
+    3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+    35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258,
+};
+static const uint8_t zell_deflate_length_extra[29] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0,
+};
+static const uint16_t zell_deflate_dist_base[30] = {
+    1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+    257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577,
+};
+static const uint8_t zell_deflate_dist_extra[30] = {
+    0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13,
+};
+// Order in which a dynamic block header lists the code length code's lengths
+static const uint8_t zell_deflate_precode_order[19] = {
+    16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15,
+};
+
+static inline uint64_t zell_deflate_load64(const unsigned char* p) {
+    uint64_t value;
+    memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+static inline uint32_t zell_deflate_load32(const unsigned char* p) {
+    uint32_t value;
+    memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+// Deflate sends Huffman codes most significant bit first into an LSB-first
+// bit stream, so codes are kept bit-reversed
+static inline uint32_t zell_deflate_reverse(uint32_t code, unsigned length) {
+    uint32_t reversed = 0;
+    while (length--) {
+        reversed = reversed << 1 | (code & 1);
+        code >>= 1;
+    }
+    return reversed;
+}
+
+// ---------------------------------------------------------------------------
+// Adler-32
+// ---------------------------------------------------------------------------
+
+#define ZELL_ADLER_BASE 65521u
+#define ZELL_ADLER_NMAX 5552     // bytes before the scalar sums could overflow
+
+typedef uint32_t (*ZellAdler32Kernel)(uint32_t adler, const unsigned char* data, size_t size);
+
+static uint32_t zell_adler32_scalar(uint32_t adler, const unsigned char* data, size_t size) {
+    uint32_t s1 = adler & 0xFFFF, s2 = adler >> 16;
+    while (size) {
+        size_t n = size < ZELL_ADLER_NMAX ? size : ZELL_ADLER_NMAX;
+        size -= n;
+        for (; n >= 8; n -= 8, data += 8) {
+            s1 += data[0]; s2 += s1;
+            s1 += data[1]; s2 += s1;
+            s1 += data[2]; s2 += s1;
+            s1 += data[3]; s2 += s1;
+            s1 += data[4]; s2 += s1;
+            s1 += data[5]; s2 += s1;
+            s1 += data[6]; s2 += s1;
+            s1 += data[7]; s2 += s1;
+        }
+        for (; n; n--) {
+            s1 += *data++;
+            s2 += s1;
+        }
+        s1 %= ZELL_ADLER_BASE;
+        s2 %= ZELL_ADLER_BASE;
+    }
+    return s1 | s2 << 16;
+}
+
+// The vector kernels split a chunk into vectors of `width` bytes and keep
+// three sums: of all bytes, of those sums before each vector (each earlier
+// byte counts once more per later vector), and of the bytes weighted by
+// their distance from the vector's end.  This folds them into s1 and s2.
+static inline void zell_adler32_fold(uint32_t* s1, uint32_t* s2, size_t n, uint64_t sum, uint64_t prior,
+                                     uint64_t weighted, unsigned width) {
+    *s2 = (uint32_t)((*s2 + (uint64_t)*s1 * n + prior * width + weighted) % ZELL_ADLER_BASE);
+    *s1 = (uint32_t)((*s1 + sum) % ZELL_ADLER_BASE);
+}
+
+#if defined(ZELL_CPU_X86)
+ZELL_TARGET("sse4.1")
+static uint32_t zell_adler32_sse41(uint32_t adler, const unsigned char* data, size_t size) {
+    uint32_t s1 = adler & 0xFFFF, s2 = adler >> 16;
+    const __m128i weights = _mm_setr_epi8(16, 15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1);
+    const __m128i ones = _mm_set1_epi16(1);
+    const __m128i zero = _mm_setzero_si128();
+    while (size >= 16) {
+        size_t n = (size < ZELL_ADLER_NMAX ? size : ZELL_ADLER_NMAX) & ~(size_t)15;
+        __m128i sum = zero, prior = zero, weighted = zero;
+        for (size_t i = 0; i < n; i += 16) {
+            __m128i v = _mm_loadu_si128((const __m128i*)(data + i));
+            prior = _mm_add_epi64(prior, sum);
+            sum = _mm_add_epi64(sum, _mm_sad_epu8(v, zero));
+            weighted = _mm_add_epi32(weighted, _mm_madd_epi16(_mm_maddubs_epi16(v, weights), ones));
+        }
+        uint64_t sums[2], priors[2];
+        uint32_t weights32[4];
+        _mm_storeu_si128((__m128i*)sums, sum);
+        _mm_storeu_si128((__m128i*)priors, prior);
+        _mm_storeu_si128((__m128i*)weights32, weighted);
+        zell_adler32_fold(&s1, &s2, n, sums[0] + sums[1], priors[0] + priors[1],
+                          (uint64_t)weights32[0] + weights32[1] + weights32[2] + weights32[3], 16);
+        data += n;
+        size -= n;
+    }
+    return zell_adler32_scalar(s1 | s2 << 16, data, size);
+}
+
+ZELL_TARGET("avx2")
+static uint32_t zell_adler32_avx2(uint32_t adler, const unsigned char* data, size_t size) {
+    uint32_t s1 = adler & 0xFFFF, s2 = adler >> 16;
+    const __m256i weights = _mm256_setr_epi8(32, 31, 30, 29, 28, 27, 26, 25, 24, 23, 22, 21, 20, 19, 18, 17,
+                                             16, 15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1);
+    const __m256i ones = _mm256_set1_epi16(1);
+    const __m256i zero = _mm256_setzero_si256();
+    while (size >= 32) {
+        size_t n = (size < ZELL_ADLER_NMAX ? size : ZELL_ADLER_NMAX) & ~(size_t)31;
+        __m256i sum = zero, prior = zero, weighted = zero;
+        for (size_t i = 0; i < n; i += 32) {
+            __m256i v = _mm256_loadu_si256((const __m256i*)(data + i));
+            prior = _mm256_add_epi64(prior, sum);
+            sum = _mm256_add_epi64(sum, _mm256_sad_epu8(v, zero));
+            weighted = _mm256_add_epi32(weighted, _mm256_madd_epi16(_mm256_maddubs_epi16(v, weights), ones));
+        }
+        uint64_t sums[4], priors[4];
+        uint32_t weights32[8];
+        _mm256_storeu_si256((__m256i*)sums, sum);
+        _mm256_storeu_si256((__m256i*)priors, prior);
+        _mm256_storeu_si256((__m256i*)weights32, weighted);
+        uint64_t total = 0;
+        for (int i = 0; i < 8; i++) total += weights32[i];
+        zell_adler32_fold(&s1, &s2, n, sums[0] + sums[1] + sums[2] + sums[3],
+                          priors[0] + priors[1] + priors[2] + priors[3], total, 32);
+        data += n;
+        size -= n;
+    }
+    return zell_adler32_scalar(s1 | s2 << 16, data, size);
+}
+#endif // ZELL_CPU_X86
+
+#if defined(ZELL_CPU_NEON_BUILD)
+static uint32_t zell_adler32_neon(uint32_t adler, const unsigned char* data, size_t size) {
+    static const uint8_t weight_bytes[16] = { 16, 15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1 };
+    uint32_t s1 = adler & 0xFFFF, s2 = adler >> 16;
+    const uint8x16_t weights = vld1q_u8(weight_bytes);
+    while (size >= 16) {
+        size_t n = (size < ZELL_ADLER_NMAX ? size : ZELL_ADLER_NMAX) & ~(size_t)15;
+        uint32x4_t sum = vdupq_n_u32(0), prior = sum, weighted = sum;
+        for (size_t i = 0; i < n; i += 16) {
+            uint8x16_t v = vld1q_u8(data + i);
+            prior = vaddq_u32(prior, sum);
+            sum = vpadalq_u16(sum, vpaddlq_u8(v));
+            weighted = vpadalq_u16(weighted, vmull_u8(vget_low_u8(v), vget_low_u8(weights)));
+            weighted = vpadalq_u16(weighted, vmull_u8(vget_high_u8(v), vget_high_u8(weights)));
+        }
+        uint32_t sums[4], priors[4], weights32[4];
+        vst1q_u32(sums, sum);
+        vst1q_u32(priors, prior);
+        vst1q_u32(weights32, weighted);
+        zell_adler32_fold(&s1, &s2, n, (uint64_t)sums[0] + sums[1] + sums[2] + sums[3],
+                          (uint64_t)priors[0] + priors[1] + priors[2] + priors[3],
+                          (uint64_t)weights32[0] + weights32[1] + weights32[2] + weights32[3], 16);
+        data += n;
+        size -= n;
+    }
+    return zell_adler32_scalar(s1 | s2 << 16, data, size);
+}
+#endif // ZELL_CPU_NEON_BUILD
+
+#if defined(ZELL_CPU_SIMD128_BUILD)
+static uint32_t zell_adler32_simd128(uint32_t adler, const unsigned char* data, size_t size) {
+    uint32_t s1 = adler & 0xFFFF, s2 = adler >> 16;
+    const v128_t weights_low = wasm_i16x8_make(16, 15, 14, 13, 12, 11, 10, 9);
+    const v128_t weights_high = wasm_i16x8_make(8, 7, 6, 5, 4, 3, 2, 1);
+    while (size >= 16) {
+        size_t n = (size < ZELL_ADLER_NMAX ? size : ZELL_ADLER_NMAX) & ~(size_t)15;
+        v128_t sum = wasm_i32x4_splat(0), prior = sum, weighted = sum;
+        for (size_t i = 0; i < n; i += 16) {
+            v128_t v = wasm_v128_load(data + i);
+            prior = wasm_i32x4_add(prior, sum);
+            sum = wasm_i32x4_add(sum, wasm_u32x4_extadd_pairwise_u16x8(wasm_u16x8_extadd_pairwise_u8x16(v)));
+            weighted = wasm_i32x4_add(weighted, wasm_i32x4_dot_i16x8(wasm_u16x8_extend_low_u8x16(v), weights_low));
+            weighted = wasm_i32x4_add(weighted, wasm_i32x4_dot_i16x8(wasm_u16x8_extend_high_u8x16(v), weights_high));
+        }
+        uint32_t sums[4], priors[4], weights32[4];
+        wasm_v128_store(sums, sum);
+        wasm_v128_store(priors, prior);
+        wasm_v128_store(weights32, weighted);
+        zell_adler32_fold(&s1, &s2, n, (uint64_t)sums[0] + sums[1] + sums[2] + sums[3],
+                          (uint64_t)priors[0] + priors[1] + priors[2] + priors[3],
+                          (uint64_t)weights32[0] + weights32[1] + weights32[2] + weights32[3], 16);
+        data += n;
+        size -= n;
+    }
+    return zell_adler32_scalar(s1 | s2 << 16, data, size);
+}
+#endif // ZELL_CPU_SIMD128_BUILD
+
+// ---------------------------------------------------------------------------
+// Tables built once
+// ---------------------------------------------------------------------------
+
+// Decode table sizes: the root table plus the most second-level tables any
+// valid code can need (zlib's "enough" for these root sizes)
+#define ZELL_INFLATE_LITLEN_BITS 11
+#define ZELL_INFLATE_DIST_BITS 8
+#define ZELL_INFLATE_PRECODE_BITS 7
+#define ZELL_INFLATE_LITLEN_ENOUGH 2342
+#define ZELL_INFLATE_DIST_ENOUGH 402
+#define ZELL_INFLATE_PRECODE_ENOUGH 128
+
+static ZellAdler32Kernel zell_adler32_kernel;
+static uint32_t zell_inflate_fixed_litlen[ZELL_INFLATE_LITLEN_ENOUGH];
+static uint32_t zell_inflate_fixed_dist[ZELL_INFLATE_DIST_ENOUGH];
+static uint8_t zell_deflate_length_symbol[256];   // by match length - 3
+static uint8_t zell_deflate_fixed_len[288 + 30];  // literal/length, then distance
+static uint16_t zell_deflate_fixed_code[288 + 30];
+ZELL_ONCE_DEFINE(zell_deflate_once);
+
+static int zell_inflate_build(uint32_t* table, unsigned root, unsigned capacity, const uint8_t* lens,
+                              unsigned count, int kind);
+static void zell_deflate_codes(const uint8_t* lens, unsigned count, uint16_t* codes);
+
+#define ZELL_TABLE_LITLEN  0
+#define ZELL_TABLE_DIST    1
+#define ZELL_TABLE_PRECODE 2
+
+static void zell_deflate_init(void) {
+    zell_adler32_kernel = zell_adler32_scalar;
+    switch (zell_cpu_level()) {
+#if defined(ZELL_CPU_X86)
+        case ZELL_CPU_AVX512:
+        case ZELL_CPU_AVX2: zell_adler32_kernel = zell_adler32_avx2; break;
+        case ZELL_CPU_SSE41: zell_adler32_kernel = zell_adler32_sse41; break;
+#elif defined(ZELL_CPU_NEON_BUILD)
+        case ZELL_CPU_NEON: zell_adler32_kernel = zell_adler32_neon; break;
+#elif defined(ZELL_CPU_SIMD128_BUILD)
+        case ZELL_CPU_SIMD128: zell_adler32_kernel = zell_adler32_simd128; break;
+#endif
+        default: break;
+    }
+
+    for (int symbol = 0; symbol < 29; symbol++) {
+        int last = symbol == 27 ? 257 : zell_deflate_length_base[symbol] + (1 << zell_deflate_length_extra[symbol]) - 1;
+        for (int length = zell_deflate_length_base[symbol]; length <= last; length++) {
+            zell_deflate_length_symbol[length - 3] = (uint8_t)symbol;
+        }
+    }
+
+    uint8_t* lens = zell_deflate_fixed_len;
+    memset(lens, 8, 144);
+    memset(lens + 144, 9, 112);
+    memset(lens + 256, 7, 24);
+    memset(lens + 280, 8, 8);
+    memset(lens + 288, 5, 30);
+    zell_deflate_codes(lens, 288, zell_deflate_fixed_code);
+    zell_deflate_codes(lens + 288, 30, zell_deflate_fixed_code + 288);
+
+    // The decoder's fixed distance code has all 32 symbols; 30 and 31 are invalid
+    uint8_t dist_lens[32];
+    memset(dist_lens, 5, sizeof(dist_lens));
+    zell_inflate_build(zell_inflate_fixed_litlen, ZELL_INFLATE_LITLEN_BITS, ZELL_INFLATE_LITLEN_ENOUGH, lens, 288,
+                       ZELL_TABLE_LITLEN);
+    zell_inflate_build(zell_inflate_fixed_dist, ZELL_INFLATE_DIST_BITS, ZELL_INFLATE_DIST_ENOUGH, dist_lens, 32,
+                       ZELL_TABLE_DIST);
+}
+
+/**
+ * Continue an Adler-32 (the checksum of zlib streams) over more data
+ * @param adler - Checksum of the data before (1 to start)
+ * @param data - Next piece
+ * @param size - Size of the piece
+ * @return Checksum of everything so far
+ */
+static inline uint32_t zell_adler32(uint32_t adler, const unsigned char* data, size_t size) {
+    ZELL_ONCE(zell_deflate_once, zell_deflate_init);
+    return zell_adler32_kernel(adler, data, size);
+}
+
+// ---------------------------------------------------------------------------
+// Inflate
+// ---------------------------------------------------------------------------
+
+// Decode table entries: bits 0-7 are the code bits to drop, 8-11 the extra
+// bits that follow (or a second-level table's index bits), 12-15 the kind,
+// 16-31 the literal (two for a pair, first in bits 16-23), the length or
+// distance base, or the second-level table's offset.  Zero is invalid.
+#define ZI_INVALID  0
+#define ZI_LITERAL  1
+#define ZI_PAIR     2
+#define ZI_LENGTH   3   // a length, or in the distance table a distance
+#define ZI_END      4
+#define ZI_SUBTABLE 5
+
+#define ZI_KIND(entry) (((entry) >> 12) & 15)
+#define ZI_EXTRA(entry) (((entry) >> 8) & 15)
+
+// The fast loop runs while one refill cannot read past the input and the
+// longest match plus its overcopy fits in the output
+#define ZI_FAST_IN 8
+#define ZI_FAST_OUT (258 + 16)
+
+static inline uint32_t zi_entry(unsigned kind, uint32_t value, unsigned extra, unsigned bits) {
+    return value << 16 | kind << 12 | extra << 8 | bits;
+}
+
+static uint32_t zi_symbol_entry(unsigned symbol, int kind) {
+    if (kind == ZELL_TABLE_PRECODE) return zi_entry(ZI_LITERAL, symbol, 0, 0);
+    if (kind == ZELL_TABLE_DIST) {
+        return symbol < 30 ? zi_entry(ZI_LENGTH, zell_deflate_dist_base[symbol], zell_deflate_dist_extra[symbol], 0) : 0;
+    }
+    if (symbol < 256) return zi_entry(ZI_LITERAL, symbol, 0, 0);
+    if (symbol == 256) return zi_entry(ZI_END, 0, 0, 0);
+    if (symbol < 286) {
+        return zi_entry(ZI_LENGTH, zell_deflate_length_base[symbol - 257], zell_deflate_length_extra[symbol - 257], 0);
+    }
+    return 0;
+}
+
+// Build a decode table from code lengths.  An incomplete code leaves its
+// unused entries invalid; an over-subscribed one is an error.
+// @return 0 on success, -1 on error
+static int zell_inflate_build(uint32_t* table, unsigned root, unsigned capacity, const uint8_t* lens,
+                              unsigned count, int kind) {
+    uint16_t counts[16] = { 0 }, offsets[16], remaining[16];
+    uint16_t sorted[288];
+    for (unsigned s = 0; s < count; s++) counts[lens[s]]++;
+    counts[0] = 0;
+
+    int left = 1;
+    unsigned longest = 0;
+    for (unsigned len = 1; len <= 15; len++) {
+        left = (left << 1) - counts[len];
+        if (left < 0) return -1;
+        if (counts[len]) longest = len;
+    }
+    offsets[1] = 0;
+    for (unsigned len = 1; len < 15; len++) offsets[len + 1] = (uint16_t)(offsets[len] + counts[len]);
+    unsigned used = offsets[15] + counts[15];
+    for (unsigned s = 0; s < count; s++) {
+        if (lens[s]) sorted[offsets[lens[s]]++] = (uint16_t)s;
+    }
+    memcpy(remaining, counts, sizeof(remaining));
+    memset(table, 0, sizeof(uint32_t) << root);
+
+    const uint32_t root_mask = (1u << root) - 1;
+    uint32_t code = 0;               // canonical code, most significant bit first
+    unsigned code_len = used ? lens[sorted[0]] : 0;
+    unsigned next_sub = 1u << root;
+    uint32_t sub_prefix = UINT32_MAX, sub_offset = 0, sub_bits = 0;
+    for (unsigned i = 0; i < used; i++) {
+        unsigned symbol = sorted[i], len = lens[symbol];
+        code <<= len - code_len;
+        code_len = len;
+        uint32_t reversed = zell_deflate_reverse(code, len);
+        uint32_t entry = zi_symbol_entry(symbol, kind);
+
+        if (len <= root) {
+            for (uint32_t k = reversed; k <= root_mask; k += 1u << len) table[k] = entry | len;
+        } else {
+            // Codes sharing their first `root` bits are consecutive: the
+            // first one sizes a second-level table for all of them
+            uint32_t prefix = reversed & root_mask;
+            if (prefix != sub_prefix) {
+                unsigned bits = len - root;
+                int room = 1 << bits;
+                while (bits + root < longest) {
+                    room -= remaining[bits + root];
+                    if (room <= 0) break;
+                    bits++;
+                    room <<= 1;
+                }
+                if (next_sub + (1u << bits) > capacity) return -1;
+                sub_prefix = prefix;
+                sub_offset = next_sub;
+                sub_bits = bits;
+                next_sub += 1u << bits;
+                memset(table + sub_offset, 0, sizeof(uint32_t) << bits);
+                table[prefix] = zi_entry(ZI_SUBTABLE, sub_offset, bits, root);
+            }
+            for (uint32_t k = reversed >> root; k < 1u << sub_bits; k += 1u << (len - root)) {
+                table[sub_offset + k] = entry | (len - root);
+            }
+        }
+        remaining[len]--;
+        code++;
+    }
+
+    // Pair up literals: an entry whose literal leaves room in the lookup for
+    // a second whole literal code decodes both.  Lower indices are read
+    // before they are rewritten, so the second code is always a single.
+    if (kind == ZELL_TABLE_LITLEN) {
+        for (int i = (int)root_mask; i >= 0; i--) {
+            uint32_t first = table[i];
+            if (ZI_KIND(first) != ZI_LITERAL) continue;
+            unsigned first_len = first & 0xFF;
+            uint32_t second = table[(uint32_t)i >> first_len];
+            if (ZI_KIND(second) != ZI_LITERAL || (second & 0xFF) > root - first_len) continue;
+            table[i] = zi_entry(ZI_PAIR, (first >> 16) | (second >> 16) << 8, 0, first_len + (second & 0xFF));
+        }
+    }
+    return 0;
+}
+
+typedef struct ZellInflate ZellInflate;
+
+// A stream to inflate.  Set the input, the output window and the optional
+// callbacks, then call zell_inflate.
+struct ZellInflate {
+    const unsigned char* next_in;
+    size_t avail_in;
+    // More input once next_in is used up: set *data and *size to the next
+    // piece and return 0, or return -1 at the end of the input
+    int (*more)(void* ctx, const unsigned char** data, size_t* size);
+
+    unsigned char* out;         // window: earlier output, then new output at out_pos
+    size_t out_pos;
+    size_t out_capacity;
+    // Called when the window is full: flush and move or grow it, leaving
+    // the last ZELL_DEFLATE_WINDOW bytes before out_pos (or all of them,
+    // when there are fewer) in place before the new out_pos.  Return -1 if
+    // no room can be made.  NULL makes a full window an error.
+    int (*room)(void* ctx, ZellInflate* z);
+    void* ctx;
+
+    size_t consumed;            // set on return: input bytes of the stream
+    uint64_t total_out;         // set on return: bytes produced
+};
+
+typedef struct {
+    ZellInflate* z;
+    uint64_t bitbuf;            // bits above bitcount may hold the next input bytes
+    unsigned bitcount;
+    const unsigned char* in;
+    const unsigned char* in_end;
+    const unsigned char* piece; // start of the current input piece
+    size_t in_before;           // input bytes of earlier pieces
+    unsigned overrun;           // zero bytes made up past the end of the input
+    int format;
+    uint32_t check;             // Adler-32 or CRC-32 of the output
+    size_t checked;             // output bytes already in check
+    uint64_t total;
+    const uint32_t* litlen;
+    const uint32_t* dist;
+    uint32_t litlen_table[ZELL_INFLATE_LITLEN_ENOUGH];
+    uint32_t dist_table[ZELL_INFLATE_DIST_ENOUGH];
+    uint32_t precode_table[ZELL_INFLATE_PRECODE_ENOUGH];
+    uint8_t lens[286 + 30];
+} ZiState;
+
+static int zi_more(ZiState* s) {
+    ZellInflate* z = s->z;
+    const unsigned char* data = NULL;
+    size_t size = 0;
+    if (!z->more || z->more(z->ctx, &data, &size) != 0 || size == 0) return 0;
+    s->in_before += (size_t)(s->in - s->piece);
+    s->piece = s->in = data;
+    s->in_end = data + size;
+    return 1;
+}
+
+// Top the bit buffer up to at least 56 bits.  Past the end of the input it
+// fills with zero bytes, which the callers must not consume; it fails once
+// a whole buffer of them would not do.
+static int zi_refill(ZiState* s) {
+    if (s->in_end - s->in >= 8) {
+        s->bitbuf |= zell_deflate_load64(s->in) << s->bitcount;
+        s->in += (63 - s->bitcount) >> 3;
+        s->bitcount |= 56;
+        return 0;
+    }
+    while (s->bitcount <= 56) {
+        if (s->in == s->in_end && !zi_more(s)) {
+            if (s->overrun >= 8) return -1;
+            s->overrun++;
+            s->bitcount += 8;
+            continue;
+        }
+        s->bitbuf |= (uint64_t)*s->in++ << s->bitcount;
+        s->bitcount += 8;
+    }
+    return 0;
+}
+
+static inline uint32_t zi_take(ZiState* s, unsigned n) {
+    uint32_t value = (uint32_t)(s->bitbuf & (((uint64_t)1 << n) - 1));
+    s->bitbuf >>= n;
+    s->bitcount -= n;
+    return value;
+}
+
+// Whether consumed bits ran into the made-up zeros
+static inline int zi_overran(const ZiState* s) {
+    return s->bitcount < s->overrun * 8;
+}
+
+static int zi_bits(ZiState* s, unsigned n, uint32_t* value) {
+    if (s->bitcount < n && zi_refill(s) != 0) return ZELL_INFLATE_TRUNCATED;
+    *value = zi_take(s, n);
+    return zi_overran(s) ? ZELL_INFLATE_TRUNCATED : 0;
+}
+
+static int zi_symbol(ZiState* s, const uint32_t* table, unsigned root, uint32_t* entry) {
+    if (s->bitcount < 15 && zi_refill(s) != 0) return ZELL_INFLATE_TRUNCATED;
+    uint32_t e = table[s->bitbuf & ((1u << root) - 1)];
+    if (ZI_KIND(e) == ZI_SUBTABLE) {
+        zi_take(s, root);
+        e = table[(e >> 16) + (s->bitbuf & ((1u << ZI_EXTRA(e)) - 1))];
+    }
+    zi_take(s, e & 0xFF);
+    *entry = e;
+    return zi_overran(s) ? ZELL_INFLATE_TRUNCATED : 0;
+}
+
+// Count new output into the checksum and total
+static void zi_account(ZiState* s) {
+    ZellInflate* z = s->z;
+    size_t n = z->out_pos - s->checked;
+    if (!n) return;
+    if (s->format == ZELL_DEFLATE_ZLIB) s->check = zell_adler32(s->check, z->out + s->checked, n);
+    else if (s->format == ZELL_DEFLATE_GZIP) s->check = zell_crc32(s->check, z->out + s->checked, n);
+    s->total += n;
+    s->checked = z->out_pos;
+}
+
+static int zi_room(ZiState* s, size_t need) {
+    ZellInflate* z = s->z;
+    if (z->out_capacity - z->out_pos >= need) return 0;
+    if (!z->room) return ZELL_INFLATE_NO_ROOM;
+    zi_account(s);
+    int failed = z->room(z->ctx, z) != 0;
+    s->checked = z->out_pos;
+    return failed || z->out_capacity - z->out_pos < need ? ZELL_INFLATE_NO_ROOM : 0;
+}
+
+// Decode symbols without bounds checks while ZI_FAST_IN bytes of input and
+// ZI_FAST_OUT of output remain.  Works on locals: output stores could alias
+// the state otherwise.
+// @return 1 at the end of the block, -1 on bad data, 0 when it ran out of margin
+static int zi_fast(ZiState* s) {
+    ZellInflate* z = s->z;
+    const uint32_t* litlen = s->litlen;
+    const uint32_t* dist = s->dist;
+    uint64_t bitbuf = s->bitbuf;
+    unsigned bitcount = s->bitcount;
+    const unsigned char* in = s->in;
+    const unsigned char* const in_end = s->in_end;
+    unsigned char* const window = z->out;
+    unsigned char* out = window + z->out_pos;
+    unsigned char* const out_end = window + z->out_capacity;
+    int result = 0;
+
+    while (in_end - in >= ZI_FAST_IN && out_end - out >= ZI_FAST_OUT) {
+        // One refill covers a whole match: 15 + 5 + 15 + 13 bits
+        bitbuf |= zell_deflate_load64(in) << bitcount;
+        in += (63 - bitcount) >> 3;
+        bitcount |= 56;
+
+        uint32_t e = litlen[bitbuf & ((1u << ZELL_INFLATE_LITLEN_BITS) - 1)];
+        if (ZI_KIND(e) == ZI_SUBTABLE) {
+            bitbuf >>= ZELL_INFLATE_LITLEN_BITS;
+            bitcount -= ZELL_INFLATE_LITLEN_BITS;
+            e = litlen[(e >> 16) + (bitbuf & ((1u << ZI_EXTRA(e)) - 1))];
+        }
+        bitbuf >>= e & 0xFF;
+        bitcount -= e & 0xFF;
+        unsigned kind = ZI_KIND(e);
+        if (kind == ZI_PAIR) {
+            out[0] = (unsigned char)(e >> 16);
+            out[1] = (unsigned char)(e >> 24);
+            out += 2;
+            continue;
+        }
+        if (kind == ZI_LITERAL) {
+            *out++ = (unsigned char)(e >> 16);
+            continue;
+        }
+        if (kind != ZI_LENGTH) {
+            result = kind == ZI_END ? 1 : -1;
+            break;
+        }
+
+        unsigned extra = ZI_EXTRA(e);
+        size_t length = (e >> 16) + (size_t)(bitbuf & ((1u << extra) - 1));
+        bitbuf >>= extra;
+        bitcount -= extra;
+
+        e = dist[bitbuf & ((1u << ZELL_INFLATE_DIST_BITS) - 1)];
+        if (ZI_KIND(e) == ZI_SUBTABLE) {
+            bitbuf >>= ZELL_INFLATE_DIST_BITS;
+            bitcount -= ZELL_INFLATE_DIST_BITS;
+            e = dist[(e >> 16) + (bitbuf & ((1u << ZI_EXTRA(e)) - 1))];
+        }
+        bitbuf >>= e & 0xFF;
+        bitcount -= e & 0xFF;
+        if (ZI_KIND(e) != ZI_LENGTH) {
+            result = -1;
+            break;
+        }
+        extra = ZI_EXTRA(e);
+        size_t distance = (e >> 16) + (size_t)(bitbuf & ((1u << extra) - 1));
+        bitbuf >>= extra;
+        bitcount -= extra;
+        if (distance > (size_t)(out - window)) {
+            result = -1;
+            break;
+        }
+
+        // Copies may run up to 15 bytes past the match; the margin covers it
+        const unsigned char* from = out - distance;
+        unsigned char* end = out + length;
+        if (distance >= 16) {
+            do {
+                memcpy(out, from, 16);
+                out += 16;
+                from += 16;
+            } while (out < end);
+        } else if (distance >= 8) {
+            do {
+                memcpy(out, from, 8);
+                out += 8;
+                from += 8;
+            } while (out < end);
+        } else if (distance == 1) {
+            uint64_t run = 0x0101010101010101ULL * *from;
+            do {
+                memcpy(out, &run, 8);
+                out += 8;
+            } while (out < end);
+        } else {
+            do {
+                *out++ = *from++;
+            } while (out < end);
+        }
+        out = end;
+    }
+
+    s->bitbuf = bitbuf;
+    s->bitcount = bitcount;
+    s->in = in;
+    z->out_pos = (size_t)(out - window);
+    return result;
+}
+
+// Decode one Huffman block
+static int zi_block(ZiState* s) {
+    ZellInflate* z = s->z;
+    for (;;) {
+        if (z->out_capacity - z->out_pos < ZI_FAST_OUT && z->room) zi_room(s, ZI_FAST_OUT);
+        if (s->in_end - s->in >= ZI_FAST_IN && z->out_capacity - z->out_pos >= ZI_FAST_OUT) {
+            int fast = zi_fast(s);
+            if (fast) return fast > 0 ? 0 : ZELL_INFLATE_BAD_DATA;
+        }
+
+        // Near the end of the input or the output: one symbol, carefully
+        uint32_t e;
+        int r = zi_symbol(s, s->litlen, ZELL_INFLATE_LITLEN_BITS, &e);
+        if (r) return r;
+        switch (ZI_KIND(e)) {
+            case ZI_LITERAL:
+                if ((r = zi_room(s, 1)) != 0) return r;
+                z->out[z->out_pos++] = (unsigned char)(e >> 16);
+                break;
+            case ZI_PAIR:
+                if ((r = zi_room(s, 2)) != 0) return r;
+                z->out[z->out_pos++] = (unsigned char)(e >> 16);
+                z->out[z->out_pos++] = (unsigned char)(e >> 24);
+                break;
+            case ZI_END:
+                return 0;
+            case ZI_LENGTH: {
+                uint32_t extra, distance;
+                if ((r = zi_bits(s, ZI_EXTRA(e), &extra)) != 0) return r;
+                size_t length = (e >> 16) + extra;
+                if ((r = zi_symbol(s, s->dist, ZELL_INFLATE_DIST_BITS, &e)) != 0) return r;
+                if (ZI_KIND(e) != ZI_LENGTH) return ZELL_INFLATE_BAD_DATA;
+                if ((r = zi_bits(s, ZI_EXTRA(e), &extra)) != 0) return r;
+                distance = (e >> 16) + extra;
+                if ((r = zi_room(s, length)) != 0) return r;
+                if (distance > z->out_pos) return ZELL_INFLATE_BAD_DATA;
+                unsigned char* out = z->out + z->out_pos;
+                for (size_t i = 0; i < length; i++) out[i] = out[(ptrdiff_t)i - (ptrdiff_t)distance];
+                z->out_pos += length;
+                break;
+            }
+            default:
+                return ZELL_INFLATE_BAD_DATA;
+        }
+    }
+}
+
+static int zi_stored(ZiState* s) {
+    ZellInflate* z = s->z;
+    uint32_t len, nlen;
+    int r;
+    zi_take(s, s->bitcount & 7);
+    if ((r = zi_bits(s, 16, &len)) != 0 || (r = zi_bits(s, 16, &nlen)) != 0) return r;
+    if (len != (~nlen & 0xFFFF)) return ZELL_INFLATE_BAD_DATA;
+
+    // The bytes already in the bit buffer first, then straight from the input
+    s->bitbuf &= s->bitcount < 64 ? ((uint64_t)1 << s->bitcount) - 1 : ~(uint64_t)0;
+    while (len && s->bitcount) {
+        if ((r = zi_room(s, 1)) != 0) return r;
+        uint32_t byte = zi_take(s, 8);
+        if (zi_overran(s)) return ZELL_INFLATE_TRUNCATED;
+        z->out[z->out_pos++] = (unsigned char)byte;
+        len--;
+    }
+    while (len) {
+        if (s->in == s->in_end && !zi_more(s)) return ZELL_INFLATE_TRUNCATED;
+        if ((r = zi_room(s, 1)) != 0) return r;
+        size_t piece = len;
+        if (piece > (size_t)(s->in_end - s->in)) piece = (size_t)(s->in_end - s->in);
+        if (piece > z->out_capacity - z->out_pos) piece = z->out_capacity - z->out_pos;
+        memcpy(z->out + z->out_pos, s->in, piece);
+        z->out_pos += piece;
+        s->in += piece;
+        len -= (uint32_t)piece;
+    }
+    return 0;
+}
+
+static int zi_dynamic(ZiState* s) {
+    uint32_t hlit, hdist, hclen, value;
+    int r;
+    if ((r = zi_bits(s, 5, &hlit)) != 0 || (r = zi_bits(s, 5, &hdist)) != 0 || (r = zi_bits(s, 4, &hclen)) != 0) {
+        return r;
+    }
+    hlit += 257;
+    hdist += 1;
+    hclen += 4;
+    if (hlit > 286 || hdist > 30) return ZELL_INFLATE_BAD_DATA;
+
+    uint8_t precode_lens[19] = { 0 };
+    for (uint32_t i = 0; i < hclen; i++) {
+        if ((r = zi_bits(s, 3, &value)) != 0) return r;
+        precode_lens[zell_deflate_precode_order[i]] = (uint8_t)value;
+    }
+    if (zell_inflate_build(s->precode_table, ZELL_INFLATE_PRECODE_BITS, ZELL_INFLATE_PRECODE_ENOUGH, precode_lens,
+                           19, ZELL_TABLE_PRECODE) != 0) {
+        return ZELL_INFLATE_BAD_DATA;
+    }
+
+    uint8_t* lens = s->lens;
+    for (uint32_t i = 0; i < hlit + hdist;) {
+        uint32_t e;
+        if ((r = zi_symbol(s, s->precode_table, ZELL_INFLATE_PRECODE_BITS, &e)) != 0) return r;
+        if (ZI_KIND(e) != ZI_LITERAL) return ZELL_INFLATE_BAD_DATA;
+        uint32_t symbol = e >> 16;
+        if (symbol < 16) {
+            lens[i++] = (uint8_t)symbol;
+            continue;
+        }
+        uint8_t repeated = 0;
+        uint32_t count;
+        if (symbol == 16) {
+            if (i == 0) return ZELL_INFLATE_BAD_DATA;
+            repeated = lens[i - 1];
+            if ((r = zi_bits(s, 2, &count)) != 0) return r;
+            count += 3;
+        } else if (symbol == 17) {
+            if ((r = zi_bits(s, 3, &count)) != 0) return r;
+            count += 3;
+        } else {
+            if ((r = zi_bits(s, 7, &count)) != 0) return r;
+            count += 11;
+        }
+        if (i + count > hlit + hdist) return ZELL_INFLATE_BAD_DATA;
+        memset(lens + i, repeated, count);
+        i += count;
+    }
+    if (!lens[256]) return ZELL_INFLATE_BAD_DATA;   // no end-of-block code
+
+    if (zell_inflate_build(s->litlen_table, ZELL_INFLATE_LITLEN_BITS, ZELL_INFLATE_LITLEN_ENOUGH, lens, hlit,
+                           ZELL_TABLE_LITLEN) != 0 ||
+        zell_inflate_build(s->dist_table, ZELL_INFLATE_DIST_BITS, ZELL_INFLATE_DIST_ENOUGH, lens + hlit, hdist,
+                           ZELL_TABLE_DIST) != 0) {
+        return ZELL_INFLATE_BAD_DATA;
+    }
+    s->litlen = s->litlen_table;
+    s->dist = s->dist_table;
+    return 0;
+}
+
+// Skip bytes, or with skip 0 a zero-terminated string
+static int zi_skip(ZiState* s, uint32_t skip) {
+    uint32_t byte;
+    int r;
+    if (skip) {
+        while (skip--) {
+            if ((r = zi_bits(s, 8, &byte)) != 0) return r;
+        }
+        return 0;
+    }
+    do {
+        if ((r = zi_bits(s, 8, &byte)) != 0) return r;
+    } while (byte);
+    return 0;
+}
+
+static int zi_header(ZiState* s) {
+    uint32_t a, b, flags;
+    int r;
+    if (s->format == ZELL_DEFLATE_ZLIB) {
+        if ((r = zi_bits(s, 8, &a)) != 0 || (r = zi_bits(s, 8, &b)) != 0) return r;
+        // Deflate with a window of at most 32KB, no preset dictionary
+        if ((a & 15) != 8 || (a >> 4) > 7 || (a << 8 | b) % 31 != 0 || (b & 0x20)) return ZELL_INFLATE_BAD_DATA;
+    } else if (s->format == ZELL_DEFLATE_GZIP) {
+        if ((r = zi_bits(s, 16, &a)) != 0 || (r = zi_bits(s, 8, &b)) != 0 || (r = zi_bits(s, 8, &flags)) != 0) {
+            return r;
+        }
+        if (a != 0x8B1F || b != 8 || (flags & 0xE0)) return ZELL_INFLATE_BAD_DATA;
+        if ((r = zi_skip(s, 6)) != 0) return r;   // time, extra flags, OS
+        if (flags & 4) {
+            if ((r = zi_bits(s, 16, &a)) != 0) return r;
+            if (a && (r = zi_skip(s, a)) != 0) return r;
+        }
+        if ((flags & 8) && (r = zi_skip(s, 0)) != 0) return r;    // name
+        if ((flags & 16) && (r = zi_skip(s, 0)) != 0) return r;   // comment
+        if ((flags & 2) && (r = zi_skip(s, 2)) != 0) return r;    // header CRC
+    }
+    return 0;
+}
+
+static int zi_trailer(ZiState* s) {
+    uint32_t value, byte;
+    int r;
+    zi_take(s, s->bitcount & 7);
+    if (s->format == ZELL_DEFLATE_ZLIB) {
+        value = 0;
+        for (int i = 0; i < 4; i++) {
+            if ((r = zi_bits(s, 8, &byte)) != 0) return r;
+            value = value << 8 | byte;
+        }
+        return value == s->check ? 0 : ZELL_INFLATE_BAD_DATA;
+    }
+    if (s->format == ZELL_DEFLATE_GZIP) {
+        if ((r = zi_bits(s, 32, &value)) != 0) return r;
+        if (value != s->check) return ZELL_INFLATE_BAD_DATA;
+        if ((r = zi_bits(s, 32, &value)) != 0) return r;
+        return value == (uint32_t)s->total ? 0 : ZELL_INFLATE_BAD_DATA;
+    }
+    return 0;
+}
+
+/**
+ * Inflate a stream. Output goes to z->out from z->out_pos on; whatever
+ * decoded before an error stays there, since damaged streams often still
+ * carry useful data.
+ * @param z - Stream: input, output window and callbacks
+ * @param format - ZELL_DEFLATE_RAW, _ZLIB or _GZIP (a single member)
+ * @return ZELL_INFLATE_DONE, or one of the negative ZELL_INFLATE_* errors
+ */
+ZELL_DEFLATE_SHARED
+int zell_inflate(ZellInflate* z, int format) {
+    ZELL_ONCE(zell_deflate_once, zell_deflate_init);
+    ZiState* s = (ZiState*)malloc(sizeof(ZiState));
+    if (!s) return ZELL_INFLATE_NO_MEMORY;
+    s->z = z;
+    s->bitbuf = 0;
+    s->bitcount = 0;
+    s->piece = s->in = z->next_in;
+    s->in_end = z->next_in ? z->next_in + z->avail_in : z->next_in;
+    s->in_before = 0;
+    s->overrun = 0;
+    s->format = format;
+    s->check = format == ZELL_DEFLATE_ZLIB ? 1 : 0;
+    s->checked = z->out_pos;
+    s->total = 0;
+
+    int r = zi_header(s);
+    uint32_t header = 0;
+    while (r == 0 && !(header & 1)) {
+        if ((r = zi_bits(s, 3, &header)) != 0) break;
+        switch (header >> 1) {
+            case 0:
+                r = zi_stored(s);
+                break;
+            case 1:
+                s->litlen = zell_inflate_fixed_litlen;
+                s->dist = zell_inflate_fixed_dist;
+                r = zi_block(s);
+                break;
+            case 2:
+                r = zi_dynamic(s);
+                if (r == 0) r = zi_block(s);
+                break;
+            default:
+                r = ZELL_INFLATE_BAD_DATA;
+                break;
+        }
+    }
+    zi_account(s);
+    if (r == 0) r = zi_trailer(s);
+
+    // Whole bytes left in the bit buffer were read but not used
+    size_t unused = s->bitcount / 8 > s->overrun ? s->bitcount / 8 - s->overrun : 0;
+    size_t read = s->in_before + (size_t)(s->in - s->piece);
+    z->consumed = read > unused ? read - unused : 0;
+    z->next_in = s->in;
+    z->avail_in = (size_t)(s->in_end - s->in);
+    z->total_out = s->total;
+    free(s);
+    return r;
+}
+
+// ---------------------------------------------------------------------------
+// Deflate
+// ---------------------------------------------------------------------------
+
+#define ZD_HASH_BITS 15
+#define ZD_ITEMS 32768              // literals and matches per block
+#define ZD_TOO_FAR 4096             // 3-byte matches farther back cost more than literals
+#define ZD_SEGMENT ((size_t)1 << 30)  // positions are 32-bit within a segment
+
+// zlib's configuration table
+typedef struct {
+    uint16_t good;    // search a quarter as long past a match this long
+    uint16_t lazy;    // lazy: no lazy search past a match this long;
+                      // greedy: longest match whose positions still get hashed
+    uint16_t nice;    // stop searching at a match this long
+    uint16_t chain;   // most candidates tried per position
+    uint8_t greedy;
+} ZdConfig;
+
+static const ZdConfig zd_configs[10] = {
+    { 0, 0, 0, 0, 1 },
+    { 4, 4, 8, 4, 1 },
+    { 4, 5, 16, 8, 1 },
+    { 4, 6, 32, 32, 1 },
+    { 4, 4, 16, 16, 0 },
+    { 8, 16, 32, 32, 0 },
+    { 8, 16, 128, 128, 0 },
+    { 8, 32, 128, 256, 0 },
+    { 32, 128, 258, 1024, 0 },
+    { 32, 258, 258, 4096, 0 },
+};
+
+typedef struct ZellDeflate {
+    int level;
+    ZdConfig config;
+    unsigned hash_bits;
+    uint32_t hash_mask;         // bytes hashed: 4 for greedy levels, 3 for lazy
+    uint32_t item_count;
+    uint32_t litlen_freq[286];
+    uint32_t dist_freq[30];
+    uint8_t litlen_len[286];
+    uint8_t dist_len[30];
+    uint16_t litlen_code[286];
+    uint16_t dist_code[30];
+    uint32_t items[ZD_ITEMS];   // literal byte, or distance << 8 | (length - 3)
+    uint32_t head[1 << ZD_HASH_BITS];       // newest position + 1 per hash
+    uint32_t prev[ZELL_DEFLATE_WINDOW];     // previous position + 1 with the same hash
+} ZellDeflate;
+
+typedef struct {
+    uint64_t bits;
+    unsigned count;
+    unsigned char* out;
+    unsigned char* end;
+    int overflow;
+} ZdWriter;
+
+// Move 32 bits to the output once that many are pending.  Eight bytes are
+// stored at a time where there is room; the upper four get rewritten later.
+static inline void zd_flush32(uint64_t* bits, unsigned* count, unsigned char** out, unsigned char* end, int* overflow) {
+    if (*count < 32) return;
+    if (end - *out >= 8) {
+        memcpy(*out, bits, 8);
+        *out += 4;
+    } else if (end - *out >= 4) {
+        for (int i = 0; i < 4; i++) (*out)[i] = (unsigned char)(*bits >> (8 * i));
+        *out += 4;
+    } else {
+        *overflow = 1;
+    }
+    *bits >>= 32;
+    *count -= 32;
+}
+
+static inline void zd_put(ZdWriter* w, uint32_t value, unsigned n) {
+    w->bits |= (uint64_t)value << w->count;
+    w->count += n;
+    zd_flush32(&w->bits, &w->count, &w->out, w->end, &w->overflow);
+}
+
+// Pad to a byte boundary and write out every pending byte
+static void zd_align(ZdWriter* w) {
+    w->count = (w->count + 7) & ~7u;
+    for (; w->count; w->count -= 8, w->bits >>= 8) {
+        if (w->out < w->end) *w->out++ = (unsigned char)w->bits;
+        else w->overflow = 1;
+    }
+}
+
+static void zd_bytes(ZdWriter* w, const unsigned char* data, size_t size) {
+    if ((size_t)(w->end - w->out) < size) {
+        w->overflow = 1;
+        return;
+    }
+    memcpy(w->out, data, size);
+    w->out += size;
+}
+
+static inline unsigned zd_dist_symbol(uint32_t distance) {
+    uint32_t d = distance - 1;
+    if (d < 4) return d;
+    unsigned log = 31 - (unsigned)__builtin_clz(d);
+    return 2 * log + ((d >> (log - 1)) & 1);
+}
+
+// Length of the common prefix of a and b, at most max
+static inline uint32_t zd_match_length(const unsigned char* a, const unsigned char* b, uint32_t max) {
+    uint32_t len = 0;
+#if defined(ZELL_CPU_X86) && defined(__SSE2__)
+    for (; len + 16 <= max; len += 16) {
+        unsigned equal = (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(a + len)),
+                                                                    _mm_loadu_si128((const __m128i*)(b + len))));
+        if (equal != 0xFFFF) return len + (uint32_t)__builtin_ctz(~equal);
+    }
+#elif defined(ZELL_CPU_NEON_BUILD)
+    for (; len + 16 <= max; len += 16) {
+        uint8x16_t equal = vceqq_u8(vld1q_u8(a + len), vld1q_u8(b + len));
+        // Four bits per byte, narrowed from the byte mask
+        uint64_t nibbles = vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(equal), 4)), 0);
+        if (nibbles != ~(uint64_t)0) return len + ((uint32_t)__builtin_ctzll(~nibbles) >> 2);
+    }
+#elif defined(ZELL_CPU_SIMD128_BUILD)
+    for (; len + 16 <= max; len += 16) {
+        uint32_t equal = wasm_i8x16_bitmask(wasm_i8x16_eq(wasm_v128_load(a + len), wasm_v128_load(b + len)));
+        if (equal != 0xFFFF) return len + (uint32_t)__builtin_ctz(~equal);
+    }
+#endif
+    for (; len + 8 <= max; len += 8) {
+        uint64_t diff = zell_deflate_load64(a + len) ^ zell_deflate_load64(b + len);
+        if (diff) return len + ((uint32_t)__builtin_ctzll(diff) >> 3);
+    }
+    while (len < max && a[len] == b[len]) len++;
+    return len;
+}
+
+static inline uint16_t zd_load16(const unsigned char* p) {
+    uint16_t value;
+    memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+static inline uint32_t zd_hash(const ZellDeflate* d, const unsigned char* p) {
+    return ((zell_deflate_load32(p) & d->hash_mask) * 0x9E3779B1u) >> (32 - d->hash_bits);
+}
+
+// Hash position p (4 bytes must be readable); returns the previous
+// position with its hash, + 1, or 0 for none
+static inline uint32_t zd_insert(ZellDeflate* d, const unsigned char* base, uint32_t p) {
+    uint32_t h = zd_hash(d, base + p);
+    uint32_t candidate = d->head[h];
+    d->prev[p & (ZELL_DEFLATE_WINDOW - 1)] = candidate;
+    d->head[h] = p + 1;
+    return candidate;
+}
+
+// Longest match at p longer than `best` along the hash chain from
+// candidate, or 0 when there is none
+static uint32_t zd_longest(const ZellDeflate* d, const unsigned char* base, uint32_t p, uint32_t n,
+                           uint32_t candidate, uint32_t best, uint32_t* distance) {
+    const ZdConfig* config = &d->config;
+    uint32_t max = n - p < 258 ? n - p : 258;
+    if (best >= max) return 0;
+    uint32_t nice = config->nice < max ? config->nice : max;
+    unsigned chain = best >= config->good ? config->chain >> 2 : config->chain;
+    const unsigned char* s = base + p;
+    const uint32_t* prev = d->prev;
+    uint32_t found = 0;
+    uint16_t start = zd_load16(s), end = zd_load16(s + best - 1);
+    // Candidates are positions + 1, so this also stops at the chain's end.
+    // Matches reach one short of the window: the position a whole window
+    // back shares its prev slot with p.
+    const uint32_t limit = p >= ZELL_DEFLATE_WINDOW ? p - ZELL_DEFLATE_WINDOW + 1 : 0;
+    while (candidate > limit && chain--) {
+        uint32_t q = candidate - 1;
+        const unsigned char* m = base + q;
+        // The bytes that would make it longer first, then the whole match
+        if (zd_load16(m + best - 1) == end && zd_load16(m) == start) {
+            uint32_t len = zd_match_length(s, m, max);
+            if (len > best) {
+                best = found = len;
+                *distance = p - q;
+                if (len >= nice) break;
+                end = zd_load16(s + best - 1);
+            }
+        }
+        candidate = prev[q & (ZELL_DEFLATE_WINDOW - 1)];
+    }
+    return found;
+}
+
+// Code lengths of at most `limit` bits for the frequencies: Huffman lengths
+// from the in-place Moffat-Katajainen algorithm, then the longest codes
+// shortened and the Kraft sum restored the way miniz does it
+static void zd_huffman(const uint32_t* freq, unsigned count, unsigned limit, uint8_t* lens) {
+    uint32_t sorted[286];   // frequency << 9 | symbol, ascending
+    uint32_t depth[286];
+    unsigned used = 0;
+    memset(lens, 0, count);
+    for (unsigned s = 0; s < count; s++) {
+        if (freq[s]) sorted[used++] = freq[s] << 9 | s;
+    }
+    // Every decoder accepts a code of two symbols; not all accept one
+    if (used < 2) {
+        unsigned symbol = used ? sorted[0] & 511 : 0;
+        lens[symbol] = 1;
+        lens[symbol ? 0 : 1] = 1;
+        return;
+    }
+    for (unsigned i = 1; i < used; i++) {
+        uint32_t key = sorted[i];
+        unsigned j = i;
+        for (; j > 0 && sorted[j - 1] > key; j--) sorted[j] = sorted[j - 1];
+        sorted[j] = key;
+    }
+
+    // Moffat-Katajainen: tree weights, then parent pointers, then depths
+    uint32_t* a = depth;
+    for (unsigned i = 0; i < used; i++) a[i] = sorted[i] >> 9;
+    unsigned root = 0, leaf = 2;
+    a[0] += a[1];
+    for (unsigned next = 1; next < used - 1; next++) {
+        if (leaf >= used || a[root] < a[leaf]) {
+            a[next] = a[root];
+            a[root++] = next;
+        } else {
+            a[next] = a[leaf++];
+        }
+        if (leaf >= used || (root < next && a[root] < a[leaf])) {
+            a[next] += a[root];
+            a[root++] = next;
+        } else {
+            a[next] += a[leaf++];
+        }
+    }
+    a[used - 2] = 0;
+    for (int next = (int)used - 3; next >= 0; next--) a[next] = a[a[next]] + 1;
+    int available = 1, assigned = 0, level = 0, node = (int)used - 2, out = (int)used - 1;
+    while (available > 0) {
+        while (node >= 0 && (int)a[node] == level) {
+            assigned++;
+            node--;
+        }
+        while (available > assigned) {
+            a[out--] = (uint32_t)level;
+            available--;
+        }
+        available = 2 * assigned;
+        level++;
+        assigned = 0;
+    }
+
+    uint32_t counts[16] = { 0 };
+    for (unsigned i = 0; i < used; i++) counts[a[i] > limit ? limit : a[i]]++;
+    uint32_t total = 0;
+    for (unsigned len = limit; len > 0; len--) total += counts[len] << (limit - len);
+    while (total != 1u << limit) {
+        counts[limit]--;
+        for (unsigned len = limit - 1; len > 0; len--) {
+            if (counts[len]) {
+                counts[len]--;
+                counts[len + 1] += 2;
+                break;
+            }
+        }
+        total--;
+    }
+    // The most frequent symbols get the shortest codes
+    unsigned j = used;
+    for (unsigned len = 1; len <= limit; len++) {
+        for (uint32_t k = counts[len]; k > 0; k--) lens[sorted[--j] & 511] = (uint8_t)len;
+    }
+}
+
+// Canonical codes for code lengths, bit-reversed for writing
+static void zell_deflate_codes(const uint8_t* lens, unsigned count, uint16_t* codes) {
+    uint32_t counts[16] = { 0 }, next[16];
+    for (unsigned s = 0; s < count; s++) counts[lens[s]]++;
+    counts[0] = 0;
+    uint32_t code = 0;
+    for (unsigned len = 1; len <= 15; len++) {
+        code = (code + counts[len - 1]) << 1;
+        next[len] = code;
+    }
+    for (unsigned s = 0; s < count; s++) {
+        if (lens[s]) codes[s] = (uint16_t)zell_deflate_reverse(next[lens[s]]++, lens[s]);
+    }
+}
+
+// Run-length code a list of code lengths with symbols 16-18; each run is
+// symbol | repeat bits << 5
+static unsigned zd_runs(const uint8_t* lens, unsigned count, uint16_t* runs) {
+    unsigned n = 0;
+    for (unsigned i = 0; i < count;) {
+        unsigned value = lens[i], run = 1;
+        while (i + run < count && lens[i + run] == value) run++;
+        i += run;
+        if (value == 0) {
+            while (run >= 11) {
+                unsigned piece = run < 138 ? run : 138;
+                runs[n++] = (uint16_t)(18 | (piece - 11) << 5);
+                run -= piece;
+            }
+            if (run >= 3) {
+                runs[n++] = (uint16_t)(17 | (run - 3) << 5);
+                run = 0;
+            }
+        } else {
+            runs[n++] = (uint16_t)value;
+            run--;
+            while (run >= 3) {
+                unsigned piece = run < 6 ? run : 6;
+                runs[n++] = (uint16_t)(16 | (piece - 3) << 5);
+                run -= piece;
+            }
+        }
+        while (run--) runs[n++] = (uint16_t)value;
+    }
+    return n;
+}
+
+static void zd_write_stored(ZdWriter* w, const unsigned char* data, size_t size, int final) {
+    do {
+        size_t piece = size > 65535 ? 65535 : size;
+        size -= piece;
+        zd_put(w, final && size == 0, 3);   // BTYPE 00
+        zd_align(w);
+        unsigned char header[4] = { (unsigned char)piece, (unsigned char)(piece >> 8),
+                                    (unsigned char)~piece, (unsigned char)(~piece >> 8) };
+        zd_bytes(w, header, 4);
+        zd_bytes(w, data, piece);
+        data += piece;
+    } while (size);
+}
+
+// Write the block's items with the given codes
+static void zd_write_items(ZellDeflate* d, ZdWriter* w, const uint16_t* litlen_code, const uint8_t* litlen_len,
+                           const uint16_t* dist_code, const uint8_t* dist_len) {
+    uint64_t bits = w->bits;
+    unsigned count = w->count;
+    unsigned char* out = w->out;
+    unsigned char* const end = w->end;
+    int overflow = w->overflow;
+    for (uint32_t i = 0; i < d->item_count; i++) {
+        uint32_t item = d->items[i];
+        if (item < 256) {
+            bits |= (uint64_t)litlen_code[item] << count;
+            count += litlen_len[item];
+        } else {
+            unsigned length = item & 255;
+            unsigned symbol = zell_deflate_length_symbol[length];
+            bits |= (uint64_t)litlen_code[257 + symbol] << count;
+            count += litlen_len[257 + symbol];
+            bits |= (uint64_t)(length + 3 - zell_deflate_length_base[symbol]) << count;
+            count += zell_deflate_length_extra[symbol];
+            zd_flush32(&bits, &count, &out, end, &overflow);
+
+            uint32_t distance = item >> 8;
+            symbol = zd_dist_symbol(distance);
+            bits |= (uint64_t)dist_code[symbol] << count;
+            count += dist_len[symbol];
+            bits |= (uint64_t)(distance - zell_deflate_dist_base[symbol]) << count;
+            count += zell_deflate_dist_extra[symbol];
+        }
+        zd_flush32(&bits, &count, &out, end, &overflow);
+    }
+    w->bits = bits;
+    w->count = count;
+    w->out = out;
+    w->overflow = overflow;
+}
+
+// Write the pending items as one block, in whichever encoding is smallest;
+// raw holds the bytes they cover
+static void zd_flush_block(ZellDeflate* d, ZdWriter* w, const unsigned char* raw, size_t raw_size, int final) {
+    uint32_t* litlen_freq = d->litlen_freq;
+    uint32_t* dist_freq = d->dist_freq;
+    litlen_freq[256]++;
+    zd_huffman(litlen_freq, 286, 15, d->litlen_len);
+    zd_huffman(dist_freq, 30, 15, d->dist_len);
+    unsigned hlit = 286, hdist = 30;
+    while (hlit > 257 && !d->litlen_len[hlit - 1]) hlit--;
+    while (hdist > 1 && !d->dist_len[hdist - 1]) hdist--;
+
+    uint8_t lens[286 + 30];
+    uint16_t runs[286 + 30];
+    memcpy(lens, d->litlen_len, hlit);
+    memcpy(lens + hlit, d->dist_len, hdist);
+    unsigned run_count = zd_runs(lens, hlit + hdist, runs);
+    uint32_t precode_freq[19] = { 0 };
+    for (unsigned i = 0; i < run_count; i++) precode_freq[runs[i] & 31]++;
+    uint8_t precode_len[19];
+    uint16_t precode_code[19];
+    zd_huffman(precode_freq, 19, 7, precode_len);
+    unsigned hclen = 19;
+    while (hclen > 4 && !precode_len[zell_deflate_precode_order[hclen - 1]]) hclen--;
+
+    // Sizes in bits; the extra bits cost the same in both Huffman encodings
+    uint64_t extra = 0, dynamic = 17 + 3 * hclen, fixed = 3;
+    for (unsigned s = 0; s < 29; s++) extra += (uint64_t)litlen_freq[257 + s] * zell_deflate_length_extra[s];
+    for (unsigned s = 0; s < 30; s++) {
+        extra += (uint64_t)dist_freq[s] * zell_deflate_dist_extra[s];
+        dynamic += (uint64_t)dist_freq[s] * d->dist_len[s];
+        fixed += (uint64_t)dist_freq[s] * 5;
+    }
+    for (unsigned s = 0; s < 286; s++) {
+        dynamic += (uint64_t)litlen_freq[s] * d->litlen_len[s];
+        fixed += (uint64_t)litlen_freq[s] * zell_deflate_fixed_len[s];
+    }
+    for (unsigned s = 0; s < 19; s++) dynamic += (uint64_t)precode_freq[s] * precode_len[s];
+    dynamic += (uint64_t)precode_freq[16] * 2 + (uint64_t)precode_freq[17] * 3 + (uint64_t)precode_freq[18] * 7;
+    dynamic += extra;
+    fixed += extra;
+    // Header, padding and length words per stored block of up to 64KB
+    uint64_t stored = (uint64_t)(raw_size ? (raw_size + 65534) / 65535 : 1) * 42 + (uint64_t)raw_size * 8;
+
+    if (stored <= dynamic && stored <= fixed) {
+        zd_write_stored(w, raw, raw_size, final);
+    } else if (fixed <= dynamic) {
+        zd_put(w, (uint32_t)final | 1 << 1, 3);
+        zd_write_items(d, w, zell_deflate_fixed_code, zell_deflate_fixed_len, zell_deflate_fixed_code + 288,
+                       zell_deflate_fixed_len + 288);
+        zd_put(w, zell_deflate_fixed_code[256], zell_deflate_fixed_len[256]);
+    } else {
+        zell_deflate_codes(d->litlen_len, 286, d->litlen_code);
+        zell_deflate_codes(d->dist_len, 30, d->dist_code);
+        zell_deflate_codes(precode_len, 19, precode_code);
+        zd_put(w, (uint32_t)final | 2 << 1, 3);
+        zd_put(w, hlit - 257, 5);
+        zd_put(w, hdist - 1, 5);
+        zd_put(w, hclen - 4, 4);
+        for (unsigned i = 0; i < hclen; i++) zd_put(w, precode_len[zell_deflate_precode_order[i]], 3);
+        for (unsigned i = 0; i < run_count; i++) {
+            unsigned symbol = runs[i] & 31;
+            zd_put(w, precode_code[symbol], precode_len[symbol]);
+            if (symbol >= 16) zd_put(w, runs[i] >> 5, symbol == 16 ? 2 : symbol == 17 ? 3 : 7);
+        }
+        zd_write_items(d, w, d->litlen_code, d->litlen_len, d->dist_code, d->dist_len);
+        zd_put(w, d->litlen_code[256], d->litlen_len[256]);
+    }
+
+    memset(d->litlen_freq, 0, sizeof(d->litlen_freq));
+    memset(d->dist_freq, 0, sizeof(d->dist_freq));
+    d->item_count = 0;
+}
+
+static inline void zd_literal(ZellDeflate* d, unsigned char byte) {
+    d->items[d->item_count++] = byte;
+    d->litlen_freq[byte]++;
+}
+
+static inline void zd_match(ZellDeflate* d, uint32_t length, uint32_t distance) {
+    d->items[d->item_count++] = distance << 8 | (length - 3);
+    d->litlen_freq[257 + zell_deflate_length_symbol[length - 3]]++;
+    d->dist_freq[zd_dist_symbol(distance)]++;
+}
+
+// Deflate data[start, end) into w, with up to a window of the bytes before
+// start as history.  The last block is final if `final` is set.
+static void zd_compress(ZellDeflate* d, const unsigned char* data, size_t start, size_t end, ZdWriter* w, int final) {
+    if (d->level == 0) {
+        if (end > start || final) zd_write_stored(w, data + start, end - start, final);
+        return;
+    }
+    const ZdConfig* config = &d->config;
+    uint32_t history = start < ZELL_DEFLATE_WINDOW ? (uint32_t)start : ZELL_DEFLATE_WINDOW;
+    const unsigned char* base = data + start - history;
+    const uint32_t n = (uint32_t)(end - start) + history;
+    memset(d->head, 0, sizeof(uint32_t) << d->hash_bits);
+    d->item_count = 0;
+    memset(d->litlen_freq, 0, sizeof(d->litlen_freq));
+    memset(d->dist_freq, 0, sizeof(d->dist_freq));
+    for (uint32_t q = 0; q < history && n - q >= 4; q++) zd_insert(d, base, q);
+
+    uint32_t p = history, block_start = history, covered = history;
+    if (config->greedy) {
+        while (p < n) {
+            uint32_t len = 0, distance = 0;
+            if (n - p >= 4) {
+                uint32_t candidate = zd_insert(d, base, p);
+                if (candidate) len = zd_longest(d, base, p, n, candidate, 2, &distance);
+                if (len == 3 && distance > ZD_TOO_FAR) len = 0;
+            }
+            if (len) {
+                zd_match(d, len, distance);
+                // Long matches skip hashing their inside, as zlib's fast levels do
+                if (len <= config->lazy) {
+                    for (uint32_t q = p + 1; q < p + len && n - q >= 4; q++) zd_insert(d, base, q);
+                }
+                p += len;
+            } else {
+                zd_literal(d, base[p]);
+                p++;
+            }
+            covered = p;
+            if (d->item_count == ZD_ITEMS) {
+                zd_flush_block(d, w, base + block_start, covered - block_start, 0);
+                block_start = covered;
+            }
+        }
+    } else {
+        // Lazy: a match is only taken if the next position has no longer one
+        uint32_t prev_len = 0, prev_distance = 0;
+        int pending = 0;   // the byte at p - 1 waits for that decision
+        while (p < n) {
+            uint32_t len = 0, distance = 0;
+            if (n - p >= 4) {
+                uint32_t candidate = zd_insert(d, base, p);
+                if (candidate && prev_len < config->lazy) {
+                    len = zd_longest(d, base, p, n, candidate, prev_len > 2 ? prev_len : 2, &distance);
+                    if (len == 3 && distance > ZD_TOO_FAR) len = 0;
+                }
+            }
+            if (prev_len >= 3 && len == 0) {
+                zd_match(d, prev_len, prev_distance);
+                uint32_t stop = p - 1 + prev_len;
+                for (uint32_t q = p + 1; q < stop && n - q >= 4; q++) zd_insert(d, base, q);
+                p = stop;
+                covered = p;
+                pending = 0;
+                prev_len = 0;
+            } else {
+                if (pending) {
+                    zd_literal(d, base[p - 1]);
+                    covered = p;
+                }
+                pending = 1;
+                prev_len = len;
+                prev_distance = distance;
+                p++;
+            }
+            if (d->item_count == ZD_ITEMS) {
+                zd_flush_block(d, w, base + block_start, covered - block_start, 0);
+                block_start = covered;
+            }
+        }
+        if (pending) {
+            if (d->item_count == ZD_ITEMS) {
+                zd_flush_block(d, w, base + block_start, covered - block_start, 0);
+                block_start = covered;
+            }
+            zd_literal(d, base[p - 1]);
+            covered = p;
+        }
+    }
+    if (d->item_count || final) zd_flush_block(d, w, base + block_start, covered - block_start, final);
+}
+
+/**
+ * Create a compressor. It runs one job at a time and may be reused.
+ * @param level - 0 (stored) to 9 (smallest); below 0 for the default
+ * @return Compressor (release with zell_deflate_destroy), or NULL
+ */
+ZELL_DEFLATE_SHARED
+ZellDeflate* zell_deflate_create(int level) {
+    ZELL_ONCE(zell_deflate_once, zell_deflate_init);
+    ZellDeflate* d = (ZellDeflate*)malloc(sizeof(ZellDeflate));
+    if (!d) return NULL;
+    d->level = level < 0 ? ZELL_DEFLATE_DEFAULT : level > 9 ? 9 : level;
+    d->config = zd_configs[d->level];
+    d->hash_bits = ZD_HASH_BITS;
+    d->hash_mask = d->config.greedy ? 0xFFFFFFFFu : 0xFFFFFFu;
+    return d;
+}
+
+ZELL_DEFLATE_SHARED
+void zell_deflate_destroy(ZellDeflate* d) {
+    free(d);
+}
+
+/**
+ * Worst-case output of zell_deflate or zell_deflate_block
+ * @param size - Input size
+ * @return Output capacity that always suffices
+ */
+static inline size_t zell_deflate_bound(size_t size) {
+    return size + (size >> 11) + 64;
+}
+
+/**
+ * Deflate data[start, end) as raw deflate blocks, with up to 32KB of the
+ * bytes before start as history (like a preset dictionary). Unless final,
+ * the output ends in a sync flush, an empty stored block that byte-aligns
+ * it so the next block's output can follow.
+ * @param d - Compressor
+ * @param data - Input, including the history
+ * @param start - Offset of the bytes to compress
+ * @param end - Offset just past them
+ * @param output - Output buffer
+ * @param capacity - Its size (zell_deflate_bound(end - start) suffices)
+ * @param final - Whether this is the end of the stream
+ * @return -1 if the output does not fit, output size on success
+ */
+ZELL_DEFLATE_SHARED
+int64_t zell_deflate_block(ZellDeflate* d, const unsigned char* data, size_t start, size_t end,
+                           unsigned char* output, size_t capacity, int final) {
+    ZdWriter w = { 0, 0, output, output + capacity, 0 };
+    // Small blocks, with their history, clear and fill a smaller hash table
+    size_t span = end - (start < ZELL_DEFLATE_WINDOW ? 0 : start - ZELL_DEFLATE_WINDOW);
+    d->hash_bits = 8;
+    while (d->hash_bits < ZD_HASH_BITS && ((size_t)1 << d->hash_bits) < span) d->hash_bits++;
+    zd_compress(d, data, start, end, &w, final);
+    if (!final) {
+        static const unsigned char sync[4] = { 0, 0, 0xFF, 0xFF };
+        zd_put(&w, 0, 3);
+        zd_align(&w);
+        zd_bytes(&w, sync, 4);
+    }
+    zd_align(&w);
+    return w.overflow ? -1 : (int64_t)(w.out - output);
+}
+
+/**
+ * Deflate a whole buffer
+ * @param data - Input
+ * @param size - Its size
+ * @param level - 0 (stored) to 9 (smallest); below 0 for the default
+ * @param format - ZELL_DEFLATE_RAW, _ZLIB or _GZIP
+ * @param output - Output buffer
+ * @param capacity - Its size (zell_deflate_bound(size) suffices)
+ * @return -1 on error or if the output does not fit, output size on success
+ */
+ZELL_DEFLATE_SHARED
+int64_t zell_deflate(const unsigned char* data, size_t size, int level, int format,
+                     unsigned char* output, size_t capacity) {
+    ZellDeflate* d = zell_deflate_create(level);
+    if (!d) return -1;
+    // Small inputs clear and fill a smaller hash table
+    d->hash_bits = 8;
+    while (d->hash_bits < ZD_HASH_BITS && ((size_t)1 << d->hash_bits) < size) d->hash_bits++;
+
+    ZdWriter w = { 0, 0, output, output + capacity, 0 };
+    if (format == ZELL_DEFLATE_ZLIB) {
+        // Window 32KB; the level field is only informative
+        unsigned hint = d->level < 2 ? 0 : d->level < 6 ? 1 : d->level == 6 ? 2 : 3;
+        unsigned header = 0x7800 | hint << 6;
+        header += 31 - header % 31;
+        unsigned char bytes[2] = { (unsigned char)(header >> 8), (unsigned char)header };
+        zd_bytes(&w, bytes, 2);
+    } else if (format == ZELL_DEFLATE_GZIP) {
+        static const unsigned char gzip[10] = { 0x1f, 0x8b, 8, 0, 0, 0, 0, 0, 0, 3 };
+        zd_bytes(&w, gzip, 10);
+    }
+
+    size_t start = 0;
+    do {
+        size_t end = size - start > ZD_SEGMENT ? start + ZD_SEGMENT : size;
+        zd_compress(d, data, start, end, &w, end == size);
+        start = end;
+    } while (start < size);
+    zd_align(&w);
+
+    if (format == ZELL_DEFLATE_ZLIB) {
+        uint32_t adler = zell_adler32(1, data, size);
+        unsigned char bytes[4] = { (unsigned char)(adler >> 24), (unsigned char)(adler >> 16),
+                                   (unsigned char)(adler >> 8), (unsigned char)adler };
+        zd_bytes(&w, bytes, 4);
+    } else if (format == ZELL_DEFLATE_GZIP) {
+        uint32_t crc = zell_crc32(0, data, size);
+        unsigned char bytes[8] = { (unsigned char)crc, (unsigned char)(crc >> 8), (unsigned char)(crc >> 16),
+                                   (unsigned char)(crc >> 24), (unsigned char)size, (unsigned char)(size >> 8),
+                                   (unsigned char)(size >> 16), (unsigned char)((uint64_t)size >> 24) };
+        zd_bytes(&w, bytes, 8);
+    }
+    int64_t written = w.overflow ? -1 : (int64_t)(w.out - output);
+    zell_deflate_destroy(d);
+    return written;
+}
+
+#endif // ZELL_DEFLATE_H
@@ -0,0 +1,400 @@
+#ifndef ZELL_HASH_H
+#define ZELL_HASH_H
+
+// Content hashing for file_hash and the app's local result cache: a
+// 128-bit non-cryptographic hash
+// in the XXH3 family (64-byte stripes, eight 64-bit lanes, 32x32->64
+// multiply-accumulate, a scramble every 1KB block).  Each instruction set
+// has its own variant (see zell-cpu.h) and all of them produce the same
+// digest, so keys computed natively and in WebAssembly agree.  It is
+// several times faster than reading the file, so it can run in the same
+// pass as the read without slowing it down.  It is not meant to resist
+// deliberate collisions, so caches shared between users (the backend's)
+// key on SHA-256 instead.
+//
+//   zell_hash(data, size, digest)       - one buffer
+//   zell_hash_file(path, digest)        - a file, mapped or read in pieces
+//   zell_hash_create/update/digest/destroy - data that arrives in chunks
+//
+// The functions are weak symbols, so modules linked into one native binary
+// carry a single copy.
+
+#include "zell-common.h"
+#include "zell-cpu.h"
+#include "zell-source.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define ZELL_HASH_DIGEST 16
+#define ZELL_HASH_STRIPE 64
+#define ZELL_HASH_BLOCK_STRIPES 16
+#define ZELL_HASH_FILE_CHUNK ((int64_t)1 << 20)
+
+#define ZELL_HASH_SHARED __attribute__((weak))
+
+#define ZELL_HASH_P32_1 0x9E3779B1ULL
+#define ZELL_HASH_P64_1 0x9E3779B185EBCA87ULL
+#define ZELL_HASH_P64_2 0xC2B2AE3D27D4EB4FULL
+
+// Stripe s of a block is keyed with words s..s+7; the scramble uses 16..23
+static const uint64_t zell_hash_secret[24] = {
+    0xe43b9d7969da4a67ULL, 0x64bcf1fbad9fde9cULL, 0x8ff4ecd634744048ULL,
+    0xd33b7be4a11d92caULL, 0xa5921879248b0c82ULL, 0xf1d89b085bd696c2ULL,
+    0x9168d92a1c04a1c6ULL, 0xa486a2dc7ac9e8b9ULL, 0x4280ea804cfb4623ULL,
+    0x21b9da9a52ab82cfULL, 0xae221faa3f5d8d29ULL, 0x5b2da7786e0ce31eULL,
+    0x8dad7494f764b280ULL, 0xd52ab48f8732cbf7ULL, 0x6025d92311e4f01bULL,
+    0x2a3acaf25a0fd07eULL, 0x385976d476b5e02fULL, 0x10da396f053cd02fULL,
+    0x1cb7d7ced3d2318bULL, 0x493b4cf695795f02ULL, 0x13a87c7b10ded842ULL,
+    0x1fd55f756213ebedULL, 0x3b358a12da57bc44ULL, 0x9cb4e278cb0ca448ULL,
+};
+
+typedef struct {
+    uint64_t acc[8];
+    uint64_t length;
+    uint32_t stripe;     // position of the next stripe in its block
+    uint32_t buffered;
+    unsigned char buffer[ZELL_HASH_STRIPE];
+} ZellHashState;
+
+// Hash `count` whole stripes into acc, scrambling at every block end.
+// Inputs are read as little-endian words, which every target is.
+typedef void (*ZellHashStripes)(uint64_t* acc, const unsigned char* data, size_t count, uint32_t* stripe);
+
+static inline uint64_t zell_hash_read64(const unsigned char* p) {
+    uint64_t value;
+    memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+static void zell_hash_stripes_scalar(uint64_t* acc, const unsigned char* data, size_t count, uint32_t* stripe) {
+    for (size_t n = 0; n < count; n++, data += ZELL_HASH_STRIPE) {
+        const uint64_t* key = zell_hash_secret + *stripe;
+        for (int i = 0; i < 8; i++) {
+            uint64_t word = zell_hash_read64(data + i * 8);
+            uint64_t keyed = word ^ key[i];
+            acc[i ^ 1] += word;
+            acc[i] += (keyed & 0xFFFFFFFFULL) * (keyed >> 32);
+        }
+        if (++*stripe == ZELL_HASH_BLOCK_STRIPES) {
+            for (int i = 0; i < 8; i++) {
+                uint64_t a = acc[i] ^ (acc[i] >> 47) ^ zell_hash_secret[16 + i];
+                acc[i] = a * ZELL_HASH_P32_1;
+            }
+            *stripe = 0;
+        }
+    }
+}
+
+#if defined(ZELL_CPU_X86)
+ZELL_TARGET("sse4.1")
+static void zell_hash_stripes_sse41(uint64_t* acc, const unsigned char* data, size_t count, uint32_t* stripe) {
+    __m128i a[4];
+    const __m128i prime = _mm_set1_epi32((int)ZELL_HASH_P32_1);
+    for (int j = 0; j < 4; j++) a[j] = _mm_loadu_si128((const __m128i*)(acc + 2 * j));
+    for (size_t n = 0; n < count; n++, data += ZELL_HASH_STRIPE) {
+        const uint64_t* key = zell_hash_secret + *stripe;
+        for (int j = 0; j < 4; j++) {
+            __m128i word = _mm_loadu_si128((const __m128i*)(data + 16 * j));
+            __m128i keyed = _mm_xor_si128(word, _mm_loadu_si128((const __m128i*)(key + 2 * j)));
+            __m128i product = _mm_mul_epu32(keyed, _mm_shuffle_epi32(keyed, _MM_SHUFFLE(2, 3, 0, 1)));
+            __m128i swapped = _mm_shuffle_epi32(word, _MM_SHUFFLE(1, 0, 3, 2));
+            a[j] = _mm_add_epi64(a[j], _mm_add_epi64(product, swapped));
+        }
+        if (++*stripe == ZELL_HASH_BLOCK_STRIPES) {
+            for (int j = 0; j < 4; j++) {
+                __m128i x = _mm_xor_si128(a[j], _mm_srli_epi64(a[j], 47));
+                x = _mm_xor_si128(x, _mm_loadu_si128((const __m128i*)(zell_hash_secret + 16 + 2 * j)));
+                __m128i high = _mm_mul_epu32(_mm_srli_epi64(x, 32), prime);
+                a[j] = _mm_add_epi64(_mm_mul_epu32(x, prime), _mm_slli_epi64(high, 32));
+            }
+            *stripe = 0;
+        }
+    }
+    for (int j = 0; j < 4; j++) _mm_storeu_si128((__m128i*)(acc + 2 * j), a[j]);
+}
+
+ZELL_TARGET("avx2")
+static void zell_hash_stripes_avx2(uint64_t* acc, const unsigned char* data, size_t count, uint32_t* stripe) {
+    __m256i a[2];
+    const __m256i prime = _mm256_set1_epi32((int)ZELL_HASH_P32_1);
+    for (int j = 0; j < 2; j++) a[j] = _mm256_loadu_si256((const __m256i*)(acc + 4 * j));
+    for (size_t n = 0; n < count; n++, data += ZELL_HASH_STRIPE) {
+        const uint64_t* key = zell_hash_secret + *stripe;
+        for (int j = 0; j < 2; j++) {
+            __m256i word = _mm256_loadu_si256((const __m256i*)(data + 32 * j));
+            __m256i keyed = _mm256_xor_si256(word, _mm256_loadu_si256((const __m256i*)(key + 4 * j)));
+            __m256i product = _mm256_mul_epu32(keyed, _mm256_shuffle_epi32(keyed, _MM_SHUFFLE(2, 3, 0, 1)));
+            __m256i swapped = _mm256_shuffle_epi32(word, _MM_SHUFFLE(1, 0, 3, 2));
+            a[j] = _mm256_add_epi64(a[j], _mm256_add_epi64(product, swapped));
+        }
+        if (++*stripe == ZELL_HASH_BLOCK_STRIPES) {
+            for (int j = 0; j < 2; j++) {
+                __m256i x = _mm256_xor_si256(a[j], _mm256_srli_epi64(a[j], 47));
+                x = _mm256_xor_si256(x, _mm256_loadu_si256((const __m256i*)(zell_hash_secret + 16 + 4 * j)));
+                __m256i high = _mm256_mul_epu32(_mm256_srli_epi64(x, 32), prime);
+                a[j] = _mm256_add_epi64(_mm256_mul_epu32(x, prime), _mm256_slli_epi64(high, 32));
+            }
+            *stripe = 0;
+        }
+    }
+    for (int j = 0; j < 2; j++) _mm256_storeu_si256((__m256i*)(acc + 4 * j), a[j]);
+}
+
+ZELL_TARGET("avx512f,avx512bw")
+static void zell_hash_stripes_avx512(uint64_t* acc, const unsigned char* data, size_t count, uint32_t* stripe) {
+    // One stripe is exactly one register
+    __m512i a = _mm512_loadu_si512((const void*)acc);
+    const __m512i prime = _mm512_set1_epi32((int)ZELL_HASH_P32_1);
+    const __m512i scramble = _mm512_loadu_si512((const void*)(zell_hash_secret + 16));
+    for (size_t n = 0; n < count; n++, data += ZELL_HASH_STRIPE) {
+        __m512i word = _mm512_loadu_si512((const void*)data);
+        __m512i keyed = _mm512_xor_si512(word, _mm512_loadu_si512((const void*)(zell_hash_secret + *stripe)));
+        __m512i product = _mm512_mul_epu32(keyed, _mm512_shuffle_epi32(keyed, (_MM_PERM_ENUM)_MM_SHUFFLE(2, 3, 0, 1)));
+        __m512i swapped = _mm512_shuffle_epi32(word, (_MM_PERM_ENUM)_MM_SHUFFLE(1, 0, 3, 2));
+        a = _mm512_add_epi64(a, _mm512_add_epi64(product, swapped));
+        if (++*stripe == ZELL_HASH_BLOCK_STRIPES) {
+            __m512i x = _mm512_xor_si512(_mm512_xor_si512(a, _mm512_srli_epi64(a, 47)), scramble);
+            __m512i high = _mm512_mul_epu32(_mm512_srli_epi64(x, 32), prime);
+            a = _mm512_add_epi64(_mm512_mul_epu32(x, prime), _mm512_slli_epi64(high, 32));
+            *stripe = 0;
+        }
+    }
+    _mm512_storeu_si512((void*)acc, a);
+}
+#endif // ZELL_CPU_X86
+
+#if defined(ZELL_CPU_NEON_BUILD)
+static void zell_hash_stripes_neon(uint64_t* acc, const unsigned char* data, size_t count, uint32_t* stripe) {
+    uint64x2_t a[4];
+    const uint32x2_t prime = vdup_n_u32((uint32_t)ZELL_HASH_P32_1);
+    for (int j = 0; j < 4; j++) a[j] = vld1q_u64(acc + 2 * j);
+    for (size_t n = 0; n < count; n++, data += ZELL_HASH_STRIPE) {
+        const uint64_t* key = zell_hash_secret + *stripe;
+        for (int j = 0; j < 4; j++) {
+            uint64x2_t word = vreinterpretq_u64_u8(vld1q_u8(data + 16 * j));
+            uint64x2_t keyed = veorq_u64(word, vld1q_u64(key + 2 * j));
+            uint64x2_t product = vmull_u32(vmovn_u64(keyed), vshrn_n_u64(keyed, 32));
+            a[j] = vaddq_u64(a[j], vaddq_u64(product, vextq_u64(word, word, 1)));
+        }
+        if (++*stripe == ZELL_HASH_BLOCK_STRIPES) {
+            for (int j = 0; j < 4; j++) {
+                uint64x2_t x = veorq_u64(a[j], vshrq_n_u64(a[j], 47));
+                x = veorq_u64(x, vld1q_u64(zell_hash_secret + 16 + 2 * j));
+                uint64x2_t high = vmull_u32(vshrn_n_u64(x, 32), prime);
+                a[j] = vaddq_u64(vmull_u32(vmovn_u64(x), prime), vshlq_n_u64(high, 32));
+            }
+            *stripe = 0;
+        }
+    }
+    for (int j = 0; j < 4; j++) vst1q_u64(acc + 2 * j, a[j]);
+}
+#endif // ZELL_CPU_NEON_BUILD
+
+#if defined(ZELL_CPU_SIMD128_BUILD)
+static void zell_hash_stripes_simd128(uint64_t* acc, const unsigned char* data, size_t count, uint32_t* stripe) {
+    v128_t a[4];
+    const v128_t prime = wasm_i64x2_splat((int64_t)ZELL_HASH_P32_1);
+    for (int j = 0; j < 4; j++) a[j] = wasm_v128_load(acc + 2 * j);
+    for (size_t n = 0; n < count; n++, data += ZELL_HASH_STRIPE) {
+        const uint64_t* key = zell_hash_secret + *stripe;
+        for (int j = 0; j < 4; j++) {
+            v128_t word = wasm_v128_load(data + 16 * j);
+            v128_t keyed = wasm_v128_xor(word, wasm_v128_load(key + 2 * j));
+            v128_t product = wasm_u64x2_extmul_low_u32x4(wasm_i32x4_shuffle(keyed, keyed, 0, 2, 0, 2),
+                                                         wasm_i32x4_shuffle(keyed, keyed, 1, 3, 1, 3));
+            a[j] = wasm_i64x2_add(a[j], wasm_i64x2_add(product, wasm_i64x2_shuffle(word, word, 1, 0)));
+        }
+        if (++*stripe == ZELL_HASH_BLOCK_STRIPES) {
+            for (int j = 0; j < 4; j++) {
+                v128_t x = wasm_v128_xor(a[j], wasm_u64x2_shr(a[j], 47));
+                x = wasm_v128_xor(x, wasm_v128_load(zell_hash_secret + 16 + 2 * j));
+                a[j] = wasm_i64x2_mul(x, prime);
+            }
+            *stripe = 0;
+        }
+    }
+    for (int j = 0; j < 4; j++) wasm_v128_store(acc + 2 * j, a[j]);
+}
+#endif // ZELL_CPU_SIMD128_BUILD
+
+static ZellHashStripes zell_hash_kernel;
+ZELL_ONCE_DEFINE(zell_hash_kernel_once);
+
+static void zell_hash_kernel_init(void) {
+    zell_hash_kernel = zell_hash_stripes_scalar;
+    switch (zell_cpu_level()) {
+#if defined(ZELL_CPU_X86)
+        case ZELL_CPU_AVX512: zell_hash_kernel = zell_hash_stripes_avx512; break;
+        case ZELL_CPU_AVX2: zell_hash_kernel = zell_hash_stripes_avx2; break;
+        case ZELL_CPU_SSE41: zell_hash_kernel = zell_hash_stripes_sse41; break;
+#elif defined(ZELL_CPU_NEON_BUILD)
+        case ZELL_CPU_NEON: zell_hash_kernel = zell_hash_stripes_neon; break;
+#elif defined(ZELL_CPU_SIMD128_BUILD)
+        case ZELL_CPU_SIMD128: zell_hash_kernel = zell_hash_stripes_simd128; break;
+#endif
+        default: break;
+    }
+}
+
+static inline void zell_hash_init(ZellHashState* state) {
+    static const uint64_t seed[8] = {
+        0xC2B2AE3DULL, ZELL_HASH_P64_1, ZELL_HASH_P64_2, 0x165667B19E3779F9ULL,
+        0x85EBCA77C2B2AE63ULL, 0x85EBCA77ULL, 0x27D4EB2F165667C5ULL, ZELL_HASH_P32_1,
+    };
+    ZELL_ONCE(zell_hash_kernel_once, zell_hash_kernel_init);
+    memcpy(state->acc, seed, sizeof(seed));
+    state->length = 0;
+    state->stripe = 0;
+    state->buffered = 0;
+}
+
+static inline void zell_hash_feed(ZellHashState* state, const unsigned char* data, size_t size) {
+    state->length += size;
+    if (state->buffered) {
+        size_t take = ZELL_HASH_STRIPE - state->buffered;
+        if (take > size) take = size;
+        memcpy(state->buffer + state->buffered, data, take);
+        state->buffered += (uint32_t)take;
+        data += take;
+        size -= take;
+        if (state->buffered < ZELL_HASH_STRIPE) return;
+        zell_hash_kernel(state->acc, state->buffer, 1, &state->stripe);
+        state->buffered = 0;
+    }
+    size_t whole = size / ZELL_HASH_STRIPE;
+    if (whole) zell_hash_kernel(state->acc, data, whole, &state->stripe);
+    memcpy(state->buffer, data + whole * ZELL_HASH_STRIPE, size - whole * ZELL_HASH_STRIPE);
+    state->buffered = (uint32_t)(size - whole * ZELL_HASH_STRIPE);
+}
+
+static inline uint64_t zell_hash_fold(uint64_t a, uint64_t b) {
+    __uint128_t product = (__uint128_t)a * b;
+    return (uint64_t)product ^ (uint64_t)(product >> 64);
+}
+
+static inline uint64_t zell_hash_avalanche(uint64_t h) {
+    h ^= h >> 37;
+    h *= 0x165667919E3779F9ULL;
+    return h ^ (h >> 32);
+}
+
+// Digest of everything fed so far; the state is left as it was
+static inline void zell_hash_finish(const ZellHashState* state, unsigned char* digest) {
+    uint64_t acc[8];
+    uint32_t stripe = state->stripe;
+    memcpy(acc, state->acc, sizeof(acc));
+    if (state->buffered) {
+        // The zero padding is told apart from real zeros by the length below
+        unsigned char last[ZELL_HASH_STRIPE] = { 0 };
+        memcpy(last, state->buffer, state->buffered);
+        zell_hash_kernel(acc, last, 1, &stripe);
+    }
+
+    uint64_t lo = state->length * ZELL_HASH_P64_1;
+    uint64_t hi = ~state->length * ZELL_HASH_P64_2;
+    for (int i = 0; i < 4; i++) {
+        lo += zell_hash_fold(acc[2 * i] ^ zell_hash_secret[3 + 2 * i], acc[2 * i + 1] ^ zell_hash_secret[4 + 2 * i]);
+        hi += zell_hash_fold(acc[2 * i] ^ zell_hash_secret[11 + 2 * i], acc[2 * i + 1] ^ zell_hash_secret[12 + 2 * i]);
+    }
+    lo = zell_hash_avalanche(lo);
+    hi = zell_hash_avalanche(hi);
+    // Big-endian, so the hex form reads as one 128-bit number
+    for (int i = 0; i < 8; i++) {
+        digest[i] = (unsigned char)(hi >> (56 - 8 * i));
+        digest[8 + i] = (unsigned char)(lo >> (56 - 8 * i));
+    }
+}
+
+/**
+ * Hash a buffer
+ * @param data - Data to hash
+ * @param size - Size of the data
+ * @param digest - Receives ZELL_HASH_DIGEST (16) bytes
+ * @return -1 on error, digest size on success
+ */
+EMSCRIPTEN_KEEPALIVE ZELL_HASH_SHARED
+int zell_hash(const unsigned char* data, int64_t size, unsigned char* digest) {
+    if ((!data && size != 0) || size < 0 || !digest) return -1;
+    ZellHashState state;
+    zell_hash_init(&state);
+    if (size) zell_hash_feed(&state, data, (size_t)size);
+    zell_hash_finish(&state, digest);
+    return ZELL_HASH_DIGEST;
+}
+
+/**
+ * Hash a file: mapped where that is possible, otherwise read in 1MB pieces
+ * @param path - Path of the file
+ * @param digest - Receives ZELL_HASH_DIGEST (16) bytes
+ * @return -1 on error, file size on success
+ */
+EMSCRIPTEN_KEEPALIVE ZELL_HASH_SHARED
+int64_t zell_hash_file(const char* path, unsigned char* digest) {
+    ZellSource source;
+    if (!path || !digest || zell_source_open_file(&source, path) != 0) return -1;
+
+    ZellHashState state;
+    zell_hash_init(&state);
+    int64_t result = source.size;
+    if (source.data) {
+        zell_hash_feed(&state, source.data, (size_t)source.size);
+    } else {
+        unsigned char* chunk = (unsigned char*)malloc((size_t)ZELL_HASH_FILE_CHUNK);
+        for (int64_t offset = 0; chunk && offset < source.size; offset += ZELL_HASH_FILE_CHUNK) {
+            int64_t got = zell_source_read(&source, offset, chunk, ZELL_HASH_FILE_CHUNK);
+            if (got <= 0) break;
+            zell_hash_feed(&state, chunk, (size_t)got);
+        }
+        if (!chunk || (int64_t)state.length != source.size) result = -1;
+        free(chunk);
+    }
+    zell_source_close(&source);
+    if (result >= 0) zell_hash_finish(&state, digest);
+    return result;
+}
+
+/**
+ * Start hashing data that arrives in chunks
+ * @return Hash state (release with zell_hash_destroy), or NULL on error
+ */
+EMSCRIPTEN_KEEPALIVE ZELL_HASH_SHARED
+ZellHashState* zell_hash_create(void) {
+    ZellHashState* state = (ZellHashState*)malloc(sizeof(ZellHashState));
+    if (state) zell_hash_init(state);
+    return state;
+}
+
+/**
+ * Add the next chunk
+ * @param state - Hash state
+ * @param data - Chunk data
+ * @param size - Chunk size
+ * @return -1 on error, 0 on success
+ */
+EMSCRIPTEN_KEEPALIVE ZELL_HASH_SHARED
+int zell_hash_update(ZellHashState* state, const unsigned char* data, int64_t size) {
+    if (!state || (!data && size != 0) || size < 0) return -1;
+    if (size) zell_hash_feed(state, data, (size_t)size);
+    return 0;
+}
+
+/**
+ * Digest of the chunks added so far; more may still be added
+ * @param state - Hash state
+ * @param digest - Receives ZELL_HASH_DIGEST (16) bytes
+ * @return -1 on error, digest size on success
+ */
+EMSCRIPTEN_KEEPALIVE ZELL_HASH_SHARED
+int zell_hash_digest(ZellHashState* state, unsigned char* digest) {
+    if (!state || !digest) return -1;
+    zell_hash_finish(state, digest);
+    return ZELL_HASH_DIGEST;
+}
+
+EMSCRIPTEN_KEEPALIVE ZELL_HASH_SHARED
+void zell_hash_destroy(ZellHashState* state) {
+    free(state);
+}
+
+#endif // ZELL_HASH_H
@@ -0,0 +1,579 @@
+#ifndef ZELL_QUANT_H
+#define ZELL_QUANT_H
+
+// Color quantization: interleaved 8-bit pixels down to a palette of at most
+// 256 RGBA entries plus one index per pixel, for PNG-8 and GIF.
+//
+// An image with no more distinct colors than asked for keeps them exactly.
+// Otherwise the pixels are counted into a histogram of 5-6-5 bit RGB cells
+// (4-4-4-4 RGBA once the image has partial transparency), each cell keeping
+// the exact sum of the colors that fell into it.  Median cut splits the
+// cells into boxes, always the box with the largest squared error, across
+// its widest channel at the weighted median; the box means then seed a few
+// rounds of k-means over the cells.
+//
+// Pixels are mapped through a cache of nearest entries per color cell,
+// filled on first use: 6-7-6 bit (5-5-5-4) cells when mapped plainly, the
+// histogram's cells under Floyd-Steinberg error diffusion or an 8x8 ordered
+// dither, which make up for the coarser choice.  Once quantized, fully
+// transparent pixels share entry 0.
+//
+// The nearest-entry search, the inner loop of both k-means and the cache,
+// has SSE4.1/AVX2/NEON/SIMD128 kernels.
+
+#include "zell-cpu.h"
+#include "zell-alloc.h"
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <limits.h>
+#include <math.h>
+
+#define ZELL_QUANT_MAX 256
+#define ZELL_QUANT_CELLS (1 << 16)    // histogram cells, 5-6-5 or 4-4-4-4 bits
+#define ZELL_QUANT_ROUNDS 4           // k-means rounds at most
+#define ZELL_QUANT_EXACT_SLOTS 1024   // hash of colors while counting them
+#define ZELL_QUANT_PAD 1024           // channel value of padding entries: farther than any color
+
+#define ZELL_DITHER_NONE 0
+#define ZELL_DITHER_FLOYD 1           // Floyd-Steinberg error diffusion
+#define ZELL_DITHER_ORDERED 2         // 8x8 Bayer matrix
+
+// Histogram cell; after counting, also a k-means point at its mean
+typedef struct {
+    uint64_t sum[4];
+    uint32_t count;
+    unsigned char color[4];
+} ZellQuantCell;
+
+typedef struct {
+    int start, end;             // cells
+    double error;               // weighted squared distance of the cells to their mean
+    int axis;                   // channel with the largest spread
+} ZellQuantBox;
+
+// Palette laid out for the search: per entry the (r, g) and (b, a) 16-bit
+// pairs, padded with far-away entries to a multiple of 8
+typedef struct {
+    int colors;
+    int padded;
+    int16_t rg[2 * ZELL_QUANT_MAX];
+    int16_t ba[2 * ZELL_QUANT_MAX];
+} ZellQuantSearch;
+
+typedef struct {
+    int alpha;                  // partial transparency: RGBA cells
+    int transparent;            // entry 0 is reserved for alpha 0
+    int fine;                   // cache cells finer than the histogram's
+    ZellQuantSearch search;
+    int16_t* cache;             // nearest entry per color cell, -1 until looked up
+} ZellQuantMap;
+
+#define ZELL_QUANT_CACHE ((size_t)1 << 19)
+
+// Index of the entry nearest the color by squared distance, the lowest
+// index on a tie; q_rg and q_ba hold the color as the same 16-bit pairs
+typedef int (*ZellQuantNearest)(const ZellQuantSearch* s, uint32_t q_rg, uint32_t q_ba);
+
+static ZellQuantNearest zell_quant_nearest;
+ZELL_ONCE_DEFINE(zell_quant_once);
+
+static int zell_quant_nearest_scalar(const ZellQuantSearch* s, uint32_t q_rg, uint32_t q_ba) {
+    const int r = (int)(q_rg & 0xffff), g = (int)(q_rg >> 16), b = (int)(q_ba & 0xffff), a = (int)(q_ba >> 16);
+    int best = 0;
+    int32_t best_distance = INT32_MAX;
+    for (int i = 0; i < s->colors; i++) {
+        int dr = s->rg[2 * i] - r, dg = s->rg[2 * i + 1] - g, db = s->ba[2 * i] - b, da = s->ba[2 * i + 1] - a;
+        int32_t distance = dr * dr + dg * dg + db * db + da * da;
+        if (distance < best_distance) {
+            best_distance = distance;
+            best = i;
+        }
+    }
+    return best;
+}
+
+// Each lane keeps its first closest entry; the lanes then settle ties by index
+static inline int zell_quant_pick(const int32_t* distance, const int32_t* index, int lanes) {
+    int best = 0;
+    for (int l = 1; l < lanes; l++) {
+        if (distance[l] < distance[best] || (distance[l] == distance[best] && index[l] < index[best])) best = l;
+    }
+    return index[best];
+}
+
+#if defined(ZELL_CPU_X86)
+// Four entries at a time: madd squares and adds each 16-bit pair
+ZELL_TARGET("sse4.1")
+static int zell_quant_nearest_sse41(const ZellQuantSearch* s, uint32_t q_rg, uint32_t q_ba) {
+    const __m128i qrg = _mm_set1_epi32((int)q_rg), qba = _mm_set1_epi32((int)q_ba), step = _mm_set1_epi32(4);
+    __m128i best = _mm_set1_epi32(INT32_MAX), best_index = _mm_setzero_si128(), index = _mm_setr_epi32(0, 1, 2, 3);
+    for (int i = 0; i < s->padded; i += 4) {
+        __m128i drg = _mm_sub_epi16(_mm_loadu_si128((const __m128i*)(s->rg + 2 * i)), qrg);
+        __m128i dba = _mm_sub_epi16(_mm_loadu_si128((const __m128i*)(s->ba + 2 * i)), qba);
+        __m128i distance = _mm_add_epi32(_mm_madd_epi16(drg, drg), _mm_madd_epi16(dba, dba));
+        __m128i closer = _mm_cmpgt_epi32(best, distance);
+        best = _mm_min_epi32(best, distance);
+        best_index = _mm_blendv_epi8(best_index, index, closer);
+        index = _mm_add_epi32(index, step);
+    }
+    int32_t distances[4], indices[4];
+    _mm_storeu_si128((__m128i*)distances, best);
+    _mm_storeu_si128((__m128i*)indices, best_index);
+    return zell_quant_pick(distances, indices, 4);
+}
+
+ZELL_TARGET("avx2")
+static int zell_quant_nearest_avx2(const ZellQuantSearch* s, uint32_t q_rg, uint32_t q_ba) {
+    const __m256i qrg = _mm256_set1_epi32((int)q_rg), qba = _mm256_set1_epi32((int)q_ba), step = _mm256_set1_epi32(8);
+    __m256i best = _mm256_set1_epi32(INT32_MAX), best_index = _mm256_setzero_si256();
+    __m256i index = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+    for (int i = 0; i < s->padded; i += 8) {
+        __m256i drg = _mm256_sub_epi16(_mm256_loadu_si256((const __m256i*)(s->rg + 2 * i)), qrg);
+        __m256i dba = _mm256_sub_epi16(_mm256_loadu_si256((const __m256i*)(s->ba + 2 * i)), qba);
+        __m256i distance = _mm256_add_epi32(_mm256_madd_epi16(drg, drg), _mm256_madd_epi16(dba, dba));
+        __m256i closer = _mm256_cmpgt_epi32(best, distance);
+        best = _mm256_min_epi32(best, distance);
+        best_index = _mm256_blendv_epi8(best_index, index, closer);
+        index = _mm256_add_epi32(index, step);
+    }
+    int32_t distances[8], indices[8];
+    _mm256_storeu_si256((__m256i*)distances, best);
+    _mm256_storeu_si256((__m256i*)indices, best_index);
+    return zell_quant_pick(distances, indices, 8);
+}
+#endif // ZELL_CPU_X86
+
+#if defined(ZELL_CPU_NEON_BUILD)
+// The squares widen to 32 bits and pairwise adds bring each entry together
+static int zell_quant_nearest_neon(const ZellQuantSearch* s, uint32_t q_rg, uint32_t q_ba) {
+    static const int32_t first[4] = { 0, 1, 2, 3 };
+    const int16x8_t qrg = vreinterpretq_s16_u32(vdupq_n_u32(q_rg)), qba = vreinterpretq_s16_u32(vdupq_n_u32(q_ba));
+    int32x4_t best = vdupq_n_s32(INT32_MAX), best_index = vdupq_n_s32(0), index = vld1q_s32(first);
+    const int32x4_t step = vdupq_n_s32(4);
+    for (int i = 0; i < s->padded; i += 4) {
+        int16x8_t drg = vsubq_s16(vld1q_s16(s->rg + 2 * i), qrg);
+        int16x8_t dba = vsubq_s16(vld1q_s16(s->ba + 2 * i), qba);
+        int32x4_t low = vaddq_s32(vmull_s16(vget_low_s16(drg), vget_low_s16(drg)),
+                                  vmull_s16(vget_low_s16(dba), vget_low_s16(dba)));
+        int32x4_t high = vaddq_s32(vmull_s16(vget_high_s16(drg), vget_high_s16(drg)),
+                                   vmull_s16(vget_high_s16(dba), vget_high_s16(dba)));
+        int32x4_t distance = vcombine_s32(vpadd_s32(vget_low_s32(low), vget_high_s32(low)),
+                                          vpadd_s32(vget_low_s32(high), vget_high_s32(high)));
+        uint32x4_t closer = vcltq_s32(distance, best);
+        best = vminq_s32(best, distance);
+        best_index = vbslq_s32(closer, index, best_index);
+        index = vaddq_s32(index, step);
+    }
+    int32_t distances[4], indices[4];
+    vst1q_s32(distances, best);
+    vst1q_s32(indices, best_index);
+    return zell_quant_pick(distances, indices, 4);
+}
+#endif // ZELL_CPU_NEON_BUILD
+
+#if defined(ZELL_CPU_SIMD128_BUILD)
+static int zell_quant_nearest_simd128(const ZellQuantSearch* s, uint32_t q_rg, uint32_t q_ba) {
+    const v128_t qrg = wasm_i32x4_splat((int)q_rg), qba = wasm_i32x4_splat((int)q_ba), step = wasm_i32x4_splat(4);
+    v128_t best = wasm_i32x4_splat(INT32_MAX), best_index = wasm_i32x4_splat(0), index = wasm_i32x4_make(0, 1, 2, 3);
+    for (int i = 0; i < s->padded; i += 4) {
+        v128_t drg = wasm_i16x8_sub(wasm_v128_load(s->rg + 2 * i), qrg);
+        v128_t dba = wasm_i16x8_sub(wasm_v128_load(s->ba + 2 * i), qba);
+        v128_t distance = wasm_i32x4_add(wasm_i32x4_dot_i16x8(drg, drg), wasm_i32x4_dot_i16x8(dba, dba));
+        v128_t closer = wasm_i32x4_lt(distance, best);
+        best = wasm_i32x4_min(best, distance);
+        best_index = wasm_v128_bitselect(index, best_index, closer);
+        index = wasm_i32x4_add(index, step);
+    }
+    int32_t distances[4], indices[4];
+    wasm_v128_store(distances, best);
+    wasm_v128_store(indices, best_index);
+    return zell_quant_pick(distances, indices, 4);
+}
+#endif // ZELL_CPU_SIMD128_BUILD
+
+static void zell_quant_init(void) {
+    zell_quant_nearest = zell_quant_nearest_scalar;
+    switch (zell_cpu_level()) {
+#if defined(ZELL_CPU_X86)
+        case ZELL_CPU_AVX512:
+        case ZELL_CPU_AVX2: zell_quant_nearest = zell_quant_nearest_avx2; break;
+        case ZELL_CPU_SSE41: zell_quant_nearest = zell_quant_nearest_sse41; break;
+#elif defined(ZELL_CPU_NEON_BUILD)
+        case ZELL_CPU_NEON: zell_quant_nearest = zell_quant_nearest_neon; break;
+#elif defined(ZELL_CPU_SIMD128_BUILD)
+        case ZELL_CPU_SIMD128: zell_quant_nearest = zell_quant_nearest_simd128; break;
+#endif
+        default: break;
+    }
+}
+
+static inline void zell_quant_rgba(const unsigned char* px, int channels, unsigned char* rgba) {
+    switch (channels) {
+        case 1: rgba[0] = rgba[1] = rgba[2] = px[0]; rgba[3] = 255; break;
+        case 2: rgba[0] = rgba[1] = rgba[2] = px[0]; rgba[3] = px[1]; break;
+        case 3: rgba[0] = px[0]; rgba[1] = px[1]; rgba[2] = px[2]; rgba[3] = 255; break;
+        default: memcpy(rgba, px, 4); break;
+    }
+}
+
+static void zell_quant_load(ZellQuantSearch* s, const unsigned char* palette, int colors) {
+    s->colors = colors;
+    s->padded = (colors + 7) & ~7;
+    for (int i = 0; i < s->padded; i++) {
+        for (int c = 0; c < 2; c++) {
+            s->rg[2 * i + c] = i < colors ? palette[i * 4 + c] : ZELL_QUANT_PAD;
+            s->ba[2 * i + c] = i < colors ? palette[i * 4 + 2 + c] : ZELL_QUANT_PAD;
+        }
+    }
+}
+
+static inline int zell_quant_search(const ZellQuantSearch* s, const unsigned char* rgba) {
+    return zell_quant_nearest(s, (uint32_t)rgba[0] | (uint32_t)rgba[1] << 16,
+                              (uint32_t)rgba[2] | (uint32_t)rgba[3] << 16);
+}
+
+// Up to `colors` distinct colors are kept as they are; more, and this
+// gives up with -1
+static int zell_quant_exact(const unsigned char* pixels, size_t count, int channels, int colors,
+                            unsigned char* palette, unsigned char* indices) {
+    uint32_t slot_color[ZELL_QUANT_EXACT_SLOTS];
+    int16_t slot_index[ZELL_QUANT_EXACT_SLOTS];
+    memset(slot_index, 0xff, sizeof(slot_index));
+    int used = 0, last_index = -1;
+    uint32_t last = 0;
+    const unsigned char* px = pixels;
+    for (size_t i = 0; i < count; i++, px += channels) {
+        unsigned char rgba[4];
+        zell_quant_rgba(px, channels, rgba);
+        uint32_t color = (uint32_t)rgba[0] << 24 | (uint32_t)rgba[1] << 16 | (uint32_t)rgba[2] << 8 | rgba[3];
+        if (color != last || last_index < 0) {
+            unsigned slot = (color * 0x9E3779B1u) >> 22;
+            while (slot_index[slot] >= 0 && slot_color[slot] != color) slot = (slot + 1) & (ZELL_QUANT_EXACT_SLOTS - 1);
+            if (slot_index[slot] < 0) {
+                if (used == colors) return -1;
+                slot_color[slot] = color;
+                slot_index[slot] = (int16_t)used;
+                palette[used * 4] = (unsigned char)(color >> 24);
+                palette[used * 4 + 1] = (unsigned char)(color >> 16);
+                palette[used * 4 + 2] = (unsigned char)(color >> 8);
+                palette[used * 4 + 3] = (unsigned char)color;
+                used++;
+            }
+            last = color;
+            last_index = slot_index[slot];
+        }
+        indices[i] = (unsigned char)last_index;
+    }
+    return used;
+}
+
+static inline unsigned zell_quant_cell(const unsigned char* rgba, int alpha) {
+    return alpha ? (unsigned)(rgba[0] >> 4) << 12 | (unsigned)(rgba[1] >> 4) << 8 | (unsigned)(rgba[2] >> 4) << 4 | rgba[3] >> 4
+                 : (unsigned)(rgba[0] >> 3) << 11 | (unsigned)(rgba[1] >> 2) << 5 | rgba[2] >> 3;
+}
+
+static void zell_quant_box_stats(const ZellQuantCell* cells, ZellQuantBox* box, int planes) {
+    double sum[4] = { 0 }, squares[4] = { 0 }, count = 0;
+    for (int i = box->start; i < box->end; i++) {
+        double weight = cells[i].count;
+        count += weight;
+        for (int c = 0; c < planes; c++) {
+            double v = cells[i].color[c];
+            sum[c] += weight * v;
+            squares[c] += weight * v * v;
+        }
+    }
+    box->error = 0;
+    box->axis = 0;
+    double widest = -1;
+    for (int c = 0; c < planes; c++) {
+        double spread = squares[c] - sum[c] * sum[c] / count;
+        box->error += spread;
+        if (spread > widest) {
+            widest = spread;
+            box->axis = c;
+        }
+    }
+    if (box->end - box->start < 2) box->error = 0;
+}
+
+// Counting sort of a box's cells by one channel of their means
+static void zell_quant_sort(ZellQuantCell* cells, ZellQuantCell* scratch, const ZellQuantBox* box) {
+    uint32_t offsets[257] = { 0 };
+    for (int i = box->start; i < box->end; i++) offsets[cells[i].color[box->axis] + 1]++;
+    for (int v = 0; v < 256; v++) offsets[v + 1] += offsets[v];
+    for (int i = box->start; i < box->end; i++) scratch[offsets[cells[i].color[box->axis]]++] = cells[i];
+    memcpy(cells + box->start, scratch, sizeof(ZellQuantCell) * (size_t)(box->end - box->start));
+}
+
+static inline void zell_quant_mean(const uint64_t* sum, uint64_t count, unsigned char* rgba) {
+    for (int c = 0; c < 4; c++) rgba[c] = (unsigned char)((sum[c] + count / 2) / count);
+}
+
+// Median cut of the cells into at most `colors` boxes, written to the
+// palette as their means
+static int zell_quant_median_cut(ZellQuantCell* cells, int cell_count, int colors, int planes,
+                                 unsigned char* palette) {
+    ZellQuantBox boxes[ZELL_QUANT_MAX];
+    ZellQuantCell* scratch = (ZellQuantCell*)zell_pool_get(sizeof(ZellQuantCell) * (size_t)cell_count);
+    if (!scratch) return -1;
+    int count = 1;
+    boxes[0].start = 0;
+    boxes[0].end = cell_count;
+    zell_quant_box_stats(cells, &boxes[0], planes);
+    while (count < colors) {
+        int widest = -1;
+        for (int b = 0; b < count; b++) {
+            if (boxes[b].error > 0 && (widest < 0 || boxes[b].error > boxes[widest].error)) widest = b;
+        }
+        if (widest < 0) break;
+        ZellQuantBox* box = &boxes[widest];
+        zell_quant_sort(cells, scratch, box);
+        uint64_t total = 0, half = 0;
+        for (int i = box->start; i < box->end; i++) total += cells[i].count;
+        int split = box->start + 1;
+        for (int i = box->start; i < box->end - 1; i++) {
+            half += cells[i].count;
+            split = i + 1;
+            if (half * 2 >= total) break;
+        }
+        boxes[count].start = split;
+        boxes[count].end = box->end;
+        box->end = split;
+        zell_quant_box_stats(cells, box, planes);
+        zell_quant_box_stats(cells, &boxes[count], planes);
+        count++;
+    }
+    zell_pool_put(scratch);
+
+    for (int b = 0; b < count; b++) {
+        uint64_t sum[4] = { 0 }, total = 0;
+        for (int i = boxes[b].start; i < boxes[b].end; i++) {
+            for (int c = 0; c < 4; c++) sum[c] += cells[i].sum[c];
+            total += cells[i].count;
+        }
+        zell_quant_mean(sum, total, palette + b * 4);
+    }
+    return count;
+}
+
+// K-means over the cells, seeded with the palette; a reserved entry 0
+// stays put
+static void zell_quant_refine(const ZellQuantCell* cells, int cell_count, unsigned char* palette, int colors,
+                              int reserved) {
+    ZellQuantSearch search;
+    uint64_t sums[ZELL_QUANT_MAX][4];
+    uint64_t counts[ZELL_QUANT_MAX];
+    for (int round = 0; round < ZELL_QUANT_ROUNDS; round++) {
+        zell_quant_load(&search, palette, colors);
+        memset(sums, 0, sizeof(sums));
+        memset(counts, 0, sizeof(counts));
+        for (int i = 0; i < cell_count; i++) {
+            int k = zell_quant_search(&search, cells[i].color);
+            for (int c = 0; c < 4; c++) sums[k][c] += cells[i].sum[c];
+            counts[k] += cells[i].count;
+        }
+        int moved = 0;
+        for (int k = reserved; k < colors; k++) {
+            if (!counts[k]) continue;
+            unsigned char mean[4];
+            zell_quant_mean(sums[k], counts[k], mean);
+            if (memcmp(mean, palette + k * 4, 4) != 0) {
+                memcpy(palette + k * 4, mean, 4);
+                moved = 1;
+            }
+        }
+        if (!moved) break;
+    }
+}
+
+static inline int zell_quant_lookup(ZellQuantMap* map, const unsigned char* rgba) {
+    if (map->transparent && rgba[3] == 0) return 0;
+    unsigned key = !map->fine ? zell_quant_cell(rgba, map->alpha)
+        : map->alpha
+        ? (unsigned)(rgba[0] >> 3) << 14 | (unsigned)(rgba[1] >> 3) << 9 | (unsigned)(rgba[2] >> 3) << 4 | rgba[3] >> 4
+        : (unsigned)(rgba[0] >> 2) << 13 | (unsigned)(rgba[1] >> 1) << 6 | rgba[2] >> 2;
+    int k = map->cache[key];
+    if (k < 0) map->cache[key] = (int16_t)(k = zell_quant_search(&map->search, rgba));
+    return k;
+}
+
+static inline unsigned char zell_quant_clamp(int v) {
+    return (unsigned char)(v < 0 ? 0 : v > 255 ? 255 : v);
+}
+
+// Serpentine Floyd-Steinberg, errors in sixteenths and four channels wide
+// so the loops vectorize. Alpha takes its nearest entry undithered: noise
+// in soft edges costs more bytes than it hides. The error going along the
+// row and the sums for the row below stay in registers, so each row's
+// shares are stored once, finished, and only read back a row later.
+static int zell_quant_floyd(ZellQuantMap* map, const unsigned char* palette, const unsigned char* pixels,
+                            int width, int height, int channels, unsigned char* indices) {
+    const int32_t keep[4] = { -1, -1, -1, 0 };
+    const size_t row_errors = ((size_t)width + 2) * 4;
+    int32_t* errors = (int32_t*)zell_pool_get(sizeof(int32_t) * 2 * row_errors);
+    if (!errors) return -1;
+    memset(errors, 0, sizeof(int32_t) * 2 * row_errors);
+    for (int y = 0; y < height; y++) {
+        const int32_t* above = errors + (size_t)(y & 1) * row_errors;
+        int32_t* below = errors + (size_t)(~y & 1) * row_errors;
+        const int dir = y & 1 ? -1 : 1;
+        int32_t carry[4] = { 0 }, behind[4] = { 0 }, here[4] = { 0 };
+        int x = 0;
+        for (int n = 0; n < width; n++) {
+            x = dir > 0 ? n : width - 1 - n;
+            const size_t i = (size_t)y * width + x;
+            unsigned char rgba[4];
+            int32_t e[4] = { 0 };
+            zell_quant_rgba(pixels + i * channels, channels, rgba);
+            // Invisible pixels neither take nor pass on error
+            if (map->transparent && rgba[3] == 0) {
+                indices[i] = 0;
+            } else {
+                const int32_t* from = above + (size_t)(x + 1) * 4;
+                for (int c = 0; c < 4; c++) rgba[c] = zell_quant_clamp(rgba[c] + ((carry[c] + from[c] + 8) >> 4));
+                int k = zell_quant_lookup(map, rgba);
+                indices[i] = (unsigned char)k;
+                for (int c = 0; c < 4; c++) e[c] = (rgba[c] - palette[k * 4 + c]) & keep[c];
+            }
+            // 3/16 behind and 5/16 straight below are final now; 1/16 ahead
+            // waits for the next pixel's shares
+            int32_t* out = below + (size_t)(x + 1 - dir) * 4;
+            for (int c = 0; c < 4; c++) {
+                out[c] = behind[c] + 3 * e[c];
+                behind[c] = here[c] + 5 * e[c];
+                here[c] = e[c];
+                carry[c] = 7 * e[c];
+            }
+        }
+        memcpy(below + (size_t)(x + 1) * 4, behind, sizeof(behind));
+        memcpy(below + (size_t)(x + 1 + dir) * 4, here, sizeof(here));
+    }
+    zell_pool_put(errors);
+    return 0;
+}
+
+// Ordered dither: the same Bayer offset on all three color channels,
+// scaled to the typical distance between palette entries
+static void zell_quant_ordered(ZellQuantMap* map, const unsigned char* palette, int colors,
+                               const unsigned char* pixels, int width, int height, int channels,
+                               unsigned char* indices) {
+    static const unsigned char bayer[64] = {
+         0, 32,  8, 40,  2, 34, 10, 42, 48, 16, 56, 24, 50, 18, 58, 26,
+        12, 44,  4, 36, 14, 46,  6, 38, 60, 28, 52, 20, 62, 30, 54, 22,
+         3, 35, 11, 43,  1, 33,  9, 41, 51, 19, 59, 27, 49, 17, 57, 25,
+        15, 47,  7, 39, 13, 45,  5, 37, 63, 31, 55, 23, 61, 29, 53, 21,
+    };
+    double spacing = 0;
+    int counted = 0;
+    for (int i = map->transparent; i < colors; i++) {
+        int nearest = INT_MAX;
+        for (int j = map->transparent; j < colors; j++) {
+            if (j == i) continue;
+            int d = 0;
+            for (int c = 0; c < 3; c++) d += (palette[i * 4 + c] - palette[j * 4 + c]) * (palette[i * 4 + c] - palette[j * 4 + c]);
+            if (d < nearest) nearest = d;
+        }
+        if (nearest < INT_MAX) {
+            spacing += sqrt((double)nearest);
+            counted++;
+        }
+    }
+    const int spread = counted ? (int)(spacing / counted + 0.5) : 0;
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            const size_t i = (size_t)y * width + x;
+            unsigned char rgba[4];
+            zell_quant_rgba(pixels + i * channels, channels, rgba);
+            int offset = ((2 * bayer[(y & 7) * 8 + (x & 7)] - 63) * spread) / 128;
+            for (int c = 0; c < 3; c++) rgba[c] = zell_quant_clamp(rgba[c] + offset);
+            indices[i] = (unsigned char)zell_quant_lookup(map, rgba);
+        }
+    }
+}
+
+/**
+ * Reduce interleaved 8-bit pixels to a palette and an index per pixel
+ * @param pixels - Gray (1), gray + alpha (2), RGB (3) or RGBA (4) pixels
+ * @param width - Image width
+ * @param height - Image height
+ * @param channels - Number of channels
+ * @param colors - Palette entries at most (2-256)
+ * @param dither - ZELL_DITHER_NONE, ZELL_DITHER_FLOYD or ZELL_DITHER_ORDERED
+ * @param palette - Receives the entries, 4 bytes (RGBA) each
+ * @param indices - Receives width x height indices
+ * @return -1 on error, number of palette entries on success
+ */
+static int zell_quantize(const unsigned char* pixels, int width, int height, int channels, int colors,
+                         int dither, unsigned char* palette, unsigned char* indices) {
+    ZELL_ONCE(zell_quant_once, zell_quant_init);
+    const size_t count = (size_t)width * height;
+    int used = zell_quant_exact(pixels, count, channels, colors, palette, indices);
+    if (used > 0) return used;
+
+    ZellQuantMap map;
+    map.alpha = map.transparent = 0;
+    if (channels == 2 || channels == 4) {
+        const unsigned char* alpha = pixels + channels - 1;
+        for (size_t i = 0; i < count && !map.alpha; i++, alpha += channels) {
+            if (*alpha == 0) map.transparent = 1;
+            else if (*alpha != 255) map.alpha = 1;
+        }
+        if (map.alpha) map.transparent = 1;
+    }
+    ZellQuantCell* cells = (ZellQuantCell*)zell_pool_get(sizeof(ZellQuantCell) * ZELL_QUANT_CELLS);
+    map.cache = (int16_t*)zell_pool_get(sizeof(int16_t) * ZELL_QUANT_CACHE);
+    int result = -1;
+    if (!cells || !map.cache) goto done;
+
+    // Opaque cells sum their alpha only once counting is done
+    memset(cells, 0, sizeof(ZellQuantCell) * ZELL_QUANT_CELLS);
+    const int planes = map.alpha ? 4 : 3;
+    const unsigned char* px = pixels;
+    for (size_t i = 0; i < count; i++, px += channels) {
+        unsigned char rgba[4];
+        zell_quant_rgba(px, channels, rgba);
+        if (map.transparent && rgba[3] == 0) continue;
+        ZellQuantCell* cell = cells + zell_quant_cell(rgba, map.alpha);
+        for (int c = 0; c < planes; c++) cell->sum[c] += rgba[c];
+        cell->count++;
+    }
+    int cell_count = 0;
+    for (int i = 0; i < ZELL_QUANT_CELLS; i++) {
+        if (!cells[i].count) continue;
+        if (!map.alpha) cells[i].sum[3] = (uint64_t)cells[i].count * 255;
+        zell_quant_mean(cells[i].sum, cells[i].count, cells[i].color);
+        cells[cell_count++] = cells[i];
+    }
+
+    if (map.transparent) memset(palette, 0, 4);
+    used = zell_quant_median_cut(cells, cell_count, colors - map.transparent, planes, palette + map.transparent * 4);
+    if (used < 0) goto done;
+    used += map.transparent;
+    zell_quant_refine(cells, cell_count, palette, used, map.transparent);
+
+    zell_quant_load(&map.search, palette, used);
+    map.fine = dither == ZELL_DITHER_NONE;
+    memset(map.cache, 0xff, sizeof(int16_t) * (map.fine ? ZELL_QUANT_CACHE : ZELL_QUANT_CELLS));
+    if (dither == ZELL_DITHER_FLOYD) {
+        if (zell_quant_floyd(&map, palette, pixels, width, height, channels, indices) < 0) goto done;
+    } else if (dither == ZELL_DITHER_ORDERED) {
+        zell_quant_ordered(&map, palette, used, pixels, width, height, channels, indices);
+    } else {
+        px = pixels;
+        for (size_t i = 0; i < count; i++, px += channels) {
+            unsigned char rgba[4];
+            zell_quant_rgba(px, channels, rgba);
+            indices[i] = (unsigned char)zell_quant_lookup(&map, rgba);
+        }
+    }
+    result = used;
+
+done:
+    zell_pool_put(cells);
+    zell_pool_put(map.cache);
+    return result;
+}
+
+#endif // ZELL_QUANT_H
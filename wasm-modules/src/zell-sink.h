@@ -0,0 +1,104 @@
+#ifndef ZELL_SINK_H
+#define ZELL_SINK_H
+
+// Output negotiation.  Buffer entry points can be asked for the size their
+// output needs (see zell_output_valid), and those whose output size is not
+// known up front also have sink variants: instead of a worst-case output
+// buffer the caller passes a write-at-offset callback.  Output is staged in
+// a pool buffer and handed over in ZELL_SINK_CHUNK pieces, so the module
+// never holds more than one chunk of it.  Writes are positional because a
+// producer may start over (the PDF optimizer falls back to the unchanged
+// input when it cannot make a file smaller): the output is the bytes
+// written below the size the entry point returns.
+
+#include "zell-alloc.h"
+#include <stdint.h>
+#include <string.h>
+
+#define ZELL_SINK_CHUNK ((int64_t)1 << 20)
+
+// Buffer entry points take an output buffer, or NULL with size 0 to return
+// the size the output needs without writing it
+static inline int zell_output_valid(const unsigned char* output_data, int64_t output_size) {
+    return output_data ? output_size > 0 : output_size == 0;
+}
+
+/**
+ * Write part of an output. Only called from the thread that called the
+ * entry point, with non-overlapping ranges in increasing order except
+ * after a rewind to offset 0.
+ * @param ctx - Opaque pointer registered with the sink
+ * @param offset - Position of the bytes in the output
+ * @param data - Bytes to write (valid only during the call)
+ * @param length - Number of bytes
+ * @return length on success, -1 to abort the job
+ */
+typedef int64_t (*ZellWriteAt)(void* ctx, int64_t offset, const unsigned char* data, int64_t length);
+
+typedef struct {
+    ZellWriteAt write_at;
+    void* ctx;
+    unsigned char* buffer;  // staged bytes, from the pool
+    int64_t buffered;
+    int64_t position;       // output offset of buffer[0]
+    int failed;             // a write failed; later output is dropped
+} ZellSink;
+
+/**
+ * Prepare a sink
+ * @return -1 on error, 0 on success (release with zell_sink_close)
+ */
+static inline int zell_sink_init(ZellSink* sink, ZellWriteAt write_at, void* ctx) {
+    sink->write_at = write_at;
+    sink->ctx = ctx;
+    sink->buffered = 0;
+    sink->position = 0;
+    sink->failed = 0;
+    sink->buffer = write_at ? (unsigned char*)zell_pool_get((size_t)ZELL_SINK_CHUNK) : NULL;
+    return sink->buffer ? 0 : -1;
+}
+
+static inline void zell_sink_write(ZellSink* sink, const unsigned char* data, int64_t length) {
+    if (sink->failed || length <= 0) return;
+    ZELL_STATS_STAGE(ZELL_STAGE_WRITE, "sink_write");
+    if (sink->write_at(sink->ctx, sink->position, data, length) != length) sink->failed = 1;
+    sink->position += length;
+}
+
+static inline void zell_sink_flush(ZellSink* sink) {
+    zell_sink_write(sink, sink->buffer, sink->buffered);
+    sink->buffered = 0;
+}
+
+// Append bytes; large writes bypass the staging buffer
+static inline void zell_sink_put(ZellSink* sink, const void* bytes, int64_t length) {
+    const unsigned char* data = (const unsigned char*)bytes;
+    if (sink->buffered + length > ZELL_SINK_CHUNK) {
+        zell_sink_flush(sink);
+        if (length >= ZELL_SINK_CHUNK) {
+            zell_sink_write(sink, data, length);
+            return;
+        }
+    }
+    memcpy(sink->buffer + sink->buffered, data, (size_t)length);
+    sink->buffered += length;
+}
+
+// Drop staged bytes and continue writing from the start of the output
+static inline void zell_sink_rewind(ZellSink* sink) {
+    sink->buffered = 0;
+    sink->position = 0;
+}
+
+/**
+ * Flush what is staged and release the sink
+ * @return -1 if any write failed, 0 on success
+ */
+static inline int zell_sink_close(ZellSink* sink) {
+    if (sink->buffer) zell_sink_flush(sink);
+    zell_pool_put(sink->buffer);
+    sink->buffer = NULL;
+    return sink->failed ? -1 : 0;
+}
+
+#endif // ZELL_SINK_H
@@ -0,0 +1,126 @@
+#ifndef ZELL_SOURCE_H
+#define ZELL_SOURCE_H
+
+// Random-access input for the parsers of random-access formats (PDF, MP4).
+// A source is either resident bytes -- a caller's buffer, or a file mapped
+// into memory in native builds -- or a read-at-offset callback.  Parsers
+// only read the ranges they need, so a multi-gigabyte input is processed
+// with a working set proportional to what is actually touched.
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#if !defined(__EMSCRIPTEN__)
+#define ZELL_HAVE_MMAP 1
+#include <sys/mman.h>
+#endif
+
+/**
+ * Read part of an input
+ * @param ctx - Opaque pointer registered with the source
+ * @param offset - Position to read from
+ * @param buffer - Destination
+ * @param length - Bytes wanted
+ * @return bytes read (fewer only at the end of the input), or -1 on error
+ */
+typedef int64_t (*ZellReadAt)(void* ctx, int64_t offset, unsigned char* buffer, int64_t length);
+
+typedef struct {
+    const unsigned char* data;  // resident bytes, or NULL to go through read_at
+    int64_t size;
+    ZellReadAt read_at;
+    void* ctx;
+    int concurrent;             // read_at may be called from several threads at once
+    int fd;                     // file opened by zell_source_open_file, else -1
+    void* mapping;              // mmap'ed view of that file, if any
+} ZellSource;
+
+static inline void zell_source_memory(ZellSource* source, const unsigned char* data, int64_t size) {
+    source->data = data;
+    source->size = size;
+    source->read_at = NULL;
+    source->ctx = NULL;
+    source->concurrent = 1;
+    source->fd = -1;
+    source->mapping = NULL;
+}
+
+static inline void zell_source_callback(ZellSource* source, ZellReadAt read_at, void* ctx,
+                                        int64_t size, int concurrent) {
+    zell_source_memory(source, NULL, size);
+    source->read_at = read_at;
+    source->ctx = ctx;
+    source->concurrent = concurrent;
+}
+
+/**
+ * Read part of a source
+ * @return bytes read (fewer only at the end of the input), or -1 on error
+ */
+static inline int64_t zell_source_read(const ZellSource* source, int64_t offset,
+                                       unsigned char* buffer, int64_t length) {
+    if (offset < 0 || length < 0) return -1;
+    if (offset >= source->size) return 0;
+    if (length > source->size - offset) length = source->size - offset;
+    if (source->data) {
+        memcpy(buffer, source->data + offset, (size_t)length);
+        return length;
+    }
+    int64_t total = 0;
+    while (total < length) {
+        int64_t got = source->read_at(source->ctx, offset + total, buffer + total, length - total);
+        if (got < 0) return -1;
+        if (got == 0) break;
+        total += got;
+    }
+    return total;
+}
+
+static inline int64_t zell_pread_at(void* ctx, int64_t offset, unsigned char* buffer, int64_t length) {
+    int fd = (int)(intptr_t)ctx;
+    ssize_t got = pread(fd, buffer, (size_t)length, (off_t)offset);
+    return got < 0 ? -1 : (int64_t)got;
+}
+
+/**
+ * Open a file as a source: mapped into memory where that is possible,
+ * otherwise read with pread on demand
+ * @return -1 on error, 0 on success (release with zell_source_close)
+ */
+static inline int zell_source_open_file(ZellSource* source, const char* path) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return -1;
+    struct stat info;
+    if (fstat(fd, &info) != 0 || info.st_size <= 0) {
+        close(fd);
+        return -1;
+    }
+
+    zell_source_callback(source, zell_pread_at, (void*)(intptr_t)fd, (int64_t)info.st_size, 1);
+    source->fd = fd;
+#ifdef ZELL_HAVE_MMAP
+    if ((uint64_t)info.st_size <= (uint64_t)SIZE_MAX) {
+        void* mapping = mmap(NULL, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (mapping != MAP_FAILED) {
+            source->mapping = mapping;
+            source->data = (const unsigned char*)mapping;
+        }
+    }
+#endif
+    return 0;
+}
+
+static inline void zell_source_close(ZellSource* source) {
+#ifdef ZELL_HAVE_MMAP
+    if (source->mapping) munmap(source->mapping, (size_t)source->size);
+#endif
+    if (source->fd >= 0) close(source->fd);
+    source->mapping = NULL;
+    source->fd = -1;
+}
+
+#endif // ZELL_SOURCE_H
@@ -0,0 +1,494 @@
+#ifndef ZELL_SSIM_H
+#define ZELL_SSIM_H
+
+// Structural similarity (SSIM) of an encoded image against its source, for
+// picking encoder settings by how the result looks rather than by a fixed
+// quality number.
+//
+// Both images are compared as luma only, shrunk by a box filter so the
+// shorter side is about 256 pixels (the viewing-distance scaling Wang et al.
+// recommend; it also makes the metric cheap).  SSIM is taken over 8x8
+// windows every 4 pixels and averaged.
+//
+// The reference is built once per source (plane plus per-window mean and
+// variance) and compared against any number of candidates.  A candidate is
+// fed row by row straight out of its decoder; once the windows seen so far
+// make the target unreachable even if every remaining window were perfect,
+// zell_ssim_row says so and the caller can stop decoding.
+//
+// The per-window sums (the only per-pixel work after shrinking) have
+// SSE4.1/AVX2/NEON/SIMD128 kernels.
+
+#include "zell-cpu.h"
+#include "zell-alloc.h"
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+#define ZELL_SSIM_WINDOW 8
+#define ZELL_SSIM_STEP 4
+#define ZELL_SSIM_SIDE 256   // shorter side of the compared planes
+
+// Box-shrunk luma plane, filled one source row at a time
+typedef struct {
+    int scale;                 // source pixels per plane pixel, each way
+    int width, height;         // plane size
+    int source_width;
+    int pending;               // source rows summed into `columns` so far
+    int rows;                  // plane rows complete
+    uint16_t* columns;         // per source column, sum of the pending rows
+    unsigned char* plane;
+} ZellSsimPlane;
+
+typedef struct {
+    ZellSsimPlane luma;
+    int windows_x, windows_y;
+    uint32_t* sums;            // scratch: 3 x plane width column sums
+    uint16_t* window_sum;      // per window, sum of the 64 pixels
+    float* window_var;         // per window, 64^2 x variance
+} ZellSsimRef;
+
+typedef struct {
+    const ZellSsimRef* ref;
+    ZellSsimPlane luma;
+    uint32_t* sums;
+    int bands;                 // window rows done
+    double total;              // SSIM summed over the windows done
+    double target;
+} ZellSsimRun;
+
+// Window sums over 8 plane rows: sums[c] = sum y, sums[width + c] = sum y^2,
+// sums[2 * width + c] = sum x * y, for each column c
+typedef void (*ZellSsimKernel)(const unsigned char* x, const unsigned char* y, size_t stride,
+                               int width, uint32_t* sums);
+
+static ZellSsimKernel zell_ssim_kernel;
+ZELL_ONCE_DEFINE(zell_ssim_once);
+
+static void zell_ssim_columns_scalar(const unsigned char* x, const unsigned char* y, size_t stride,
+                                     int width, uint32_t* sums) {
+    memset(sums, 0, sizeof(uint32_t) * 3 * (size_t)width);
+    for (int r = 0; r < ZELL_SSIM_WINDOW; r++, x += stride, y += stride) {
+        for (int c = 0; c < width; c++) {
+            uint32_t a = x[c], b = y[c];
+            sums[c] += b;
+            sums[width + c] += b * b;
+            sums[2 * width + c] += a * b;
+        }
+    }
+}
+
+#if defined(ZELL_CPU_X86)
+// Interleaving two rows puts both rows' pixels of a column next to each
+// other, so one multiply-add sums the column's products for both rows
+ZELL_TARGET("sse4.1")
+static void zell_ssim_columns_sse41(const unsigned char* x, const unsigned char* y, size_t stride,
+                                    int width, uint32_t* sums) {
+    int c = 0;
+    for (; c + 8 <= width; c += 8) {
+        __m128i sum = _mm_setzero_si128();
+        __m128i yy_low = sum, yy_high = sum, xy_low = sum, xy_high = sum;
+        for (int r = 0; r < ZELL_SSIM_WINDOW; r += 2) {
+            const unsigned char* xr = x + (size_t)r * stride + c;
+            const unsigned char* yr = y + (size_t)r * stride + c;
+            __m128i x0 = _mm_cvtepu8_epi16(_mm_loadl_epi64((const __m128i*)xr));
+            __m128i x1 = _mm_cvtepu8_epi16(_mm_loadl_epi64((const __m128i*)(xr + stride)));
+            __m128i y0 = _mm_cvtepu8_epi16(_mm_loadl_epi64((const __m128i*)yr));
+            __m128i y1 = _mm_cvtepu8_epi16(_mm_loadl_epi64((const __m128i*)(yr + stride)));
+            sum = _mm_add_epi16(sum, _mm_add_epi16(y0, y1));
+            __m128i ylo = _mm_unpacklo_epi16(y0, y1), yhi = _mm_unpackhi_epi16(y0, y1);
+            __m128i xlo = _mm_unpacklo_epi16(x0, x1), xhi = _mm_unpackhi_epi16(x0, x1);
+            yy_low = _mm_add_epi32(yy_low, _mm_madd_epi16(ylo, ylo));
+            yy_high = _mm_add_epi32(yy_high, _mm_madd_epi16(yhi, yhi));
+            xy_low = _mm_add_epi32(xy_low, _mm_madd_epi16(xlo, ylo));
+            xy_high = _mm_add_epi32(xy_high, _mm_madd_epi16(xhi, yhi));
+        }
+        _mm_storeu_si128((__m128i*)(sums + c), _mm_cvtepu16_epi32(sum));
+        _mm_storeu_si128((__m128i*)(sums + c + 4), _mm_cvtepu16_epi32(_mm_srli_si128(sum, 8)));
+        _mm_storeu_si128((__m128i*)(sums + width + c), yy_low);
+        _mm_storeu_si128((__m128i*)(sums + width + c + 4), yy_high);
+        _mm_storeu_si128((__m128i*)(sums + 2 * width + c), xy_low);
+        _mm_storeu_si128((__m128i*)(sums + 2 * width + c + 4), xy_high);
+    }
+    for (; c < width; c++) {
+        uint32_t s = 0, yy = 0, xy = 0;
+        for (int r = 0; r < ZELL_SSIM_WINDOW; r++) {
+            uint32_t a = x[(size_t)r * stride + c], b = y[(size_t)r * stride + c];
+            s += b;
+            yy += b * b;
+            xy += a * b;
+        }
+        sums[c] = s;
+        sums[width + c] = yy;
+        sums[2 * width + c] = xy;
+    }
+}
+
+// Same with 16 columns; the unpacks work per 128-bit lane, so the halves
+// are put back in column order before storing
+ZELL_TARGET("avx2")
+static void zell_ssim_columns_avx2(const unsigned char* x, const unsigned char* y, size_t stride,
+                                   int width, uint32_t* sums) {
+    int c = 0;
+    for (; c + 16 <= width; c += 16) {
+        __m256i sum = _mm256_setzero_si256();
+        __m256i yy_low = sum, yy_high = sum, xy_low = sum, xy_high = sum;
+        for (int r = 0; r < ZELL_SSIM_WINDOW; r += 2) {
+            const unsigned char* xr = x + (size_t)r * stride + c;
+            const unsigned char* yr = y + (size_t)r * stride + c;
+            __m256i x0 = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*)xr));
+            __m256i x1 = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*)(xr + stride)));
+            __m256i y0 = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*)yr));
+            __m256i y1 = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*)(yr + stride)));
+            sum = _mm256_add_epi16(sum, _mm256_add_epi16(y0, y1));
+            __m256i ylo = _mm256_unpacklo_epi16(y0, y1), yhi = _mm256_unpackhi_epi16(y0, y1);
+            __m256i xlo = _mm256_unpacklo_epi16(x0, x1), xhi = _mm256_unpackhi_epi16(x0, x1);
+            yy_low = _mm256_add_epi32(yy_low, _mm256_madd_epi16(ylo, ylo));
+            yy_high = _mm256_add_epi32(yy_high, _mm256_madd_epi16(yhi, yhi));
+            xy_low = _mm256_add_epi32(xy_low, _mm256_madd_epi16(xlo, ylo));
+            xy_high = _mm256_add_epi32(xy_high, _mm256_madd_epi16(xhi, yhi));
+        }
+        _mm256_storeu_si256((__m256i*)(sums + c), _mm256_cvtepu16_epi32(_mm256_castsi256_si128(sum)));
+        _mm256_storeu_si256((__m256i*)(sums + c + 8), _mm256_cvtepu16_epi32(_mm256_extracti128_si256(sum, 1)));
+        _mm256_storeu_si256((__m256i*)(sums + width + c), _mm256_permute2x128_si256(yy_low, yy_high, 0x20));
+        _mm256_storeu_si256((__m256i*)(sums + width + c + 8), _mm256_permute2x128_si256(yy_low, yy_high, 0x31));
+        _mm256_storeu_si256((__m256i*)(sums + 2 * width + c), _mm256_permute2x128_si256(xy_low, xy_high, 0x20));
+        _mm256_storeu_si256((__m256i*)(sums + 2 * width + c + 8),
+                            _mm256_permute2x128_si256(xy_low, xy_high, 0x31));
+    }
+    if (c < width) {
+        // The rest, at most 15 columns, with the 8-wide kernel
+        uint32_t tail[3 * 16];
+        int rest = width - c;
+        zell_ssim_columns_sse41(x + c, y + c, stride, rest, tail);
+        memcpy(sums + c, tail, sizeof(uint32_t) * rest);
+        memcpy(sums + width + c, tail + rest, sizeof(uint32_t) * rest);
+        memcpy(sums + 2 * width + c, tail + 2 * rest, sizeof(uint32_t) * rest);
+    }
+}
+#endif // ZELL_CPU_X86
+
+#if defined(ZELL_CPU_NEON_BUILD)
+static void zell_ssim_columns_neon(const unsigned char* x, const unsigned char* y, size_t stride,
+                                   int width, uint32_t* sums) {
+    int c = 0;
+    for (; c + 8 <= width; c += 8) {
+        uint16x8_t sum = vdupq_n_u16(0);
+        uint32x4_t yy_low = vdupq_n_u32(0), yy_high = yy_low, xy_low = yy_low, xy_high = yy_low;
+        for (int r = 0; r < ZELL_SSIM_WINDOW; r++) {
+            uint8x8_t xv = vld1_u8(x + (size_t)r * stride + c);
+            uint8x8_t yv = vld1_u8(y + (size_t)r * stride + c);
+            sum = vaddw_u8(sum, yv);
+            uint16x8_t yy = vmull_u8(yv, yv), xy = vmull_u8(xv, yv);
+            yy_low = vaddw_u16(yy_low, vget_low_u16(yy));
+            yy_high = vaddw_u16(yy_high, vget_high_u16(yy));
+            xy_low = vaddw_u16(xy_low, vget_low_u16(xy));
+            xy_high = vaddw_u16(xy_high, vget_high_u16(xy));
+        }
+        vst1q_u32(sums + c, vmovl_u16(vget_low_u16(sum)));
+        vst1q_u32(sums + c + 4, vmovl_u16(vget_high_u16(sum)));
+        vst1q_u32(sums + width + c, yy_low);
+        vst1q_u32(sums + width + c + 4, yy_high);
+        vst1q_u32(sums + 2 * width + c, xy_low);
+        vst1q_u32(sums + 2 * width + c + 4, xy_high);
+    }
+    for (; c < width; c++) {
+        uint32_t s = 0, yy = 0, xy = 0;
+        for (int r = 0; r < ZELL_SSIM_WINDOW; r++) {
+            uint32_t a = x[(size_t)r * stride + c], b = y[(size_t)r * stride + c];
+            s += b;
+            yy += b * b;
+            xy += a * b;
+        }
+        sums[c] = s;
+        sums[width + c] = yy;
+        sums[2 * width + c] = xy;
+    }
+}
+#endif // ZELL_CPU_NEON_BUILD
+
+#if defined(ZELL_CPU_SIMD128_BUILD)
+static void zell_ssim_columns_simd128(const unsigned char* x, const unsigned char* y, size_t stride,
+                                      int width, uint32_t* sums) {
+    int c = 0;
+    for (; c + 8 <= width; c += 8) {
+        v128_t sum = wasm_i16x8_splat(0);
+        v128_t yy_low = wasm_i32x4_splat(0), yy_high = yy_low, xy_low = yy_low, xy_high = yy_low;
+        for (int r = 0; r < ZELL_SSIM_WINDOW; r++) {
+            v128_t xv = wasm_u16x8_extend_low_u8x16(wasm_v128_load64_zero(x + (size_t)r * stride + c));
+            v128_t yv = wasm_u16x8_extend_low_u8x16(wasm_v128_load64_zero(y + (size_t)r * stride + c));
+            sum = wasm_i16x8_add(sum, yv);
+            yy_low = wasm_i32x4_add(yy_low, wasm_u32x4_extmul_low_u16x8(yv, yv));
+            yy_high = wasm_i32x4_add(yy_high, wasm_u32x4_extmul_high_u16x8(yv, yv));
+            xy_low = wasm_i32x4_add(xy_low, wasm_u32x4_extmul_low_u16x8(xv, yv));
+            xy_high = wasm_i32x4_add(xy_high, wasm_u32x4_extmul_high_u16x8(xv, yv));
+        }
+        wasm_v128_store(sums + c, wasm_u32x4_extend_low_u16x8(sum));
+        wasm_v128_store(sums + c + 4, wasm_u32x4_extend_high_u16x8(sum));
+        wasm_v128_store(sums + width + c, yy_low);
+        wasm_v128_store(sums + width + c + 4, yy_high);
+        wasm_v128_store(sums + 2 * width + c, xy_low);
+        wasm_v128_store(sums + 2 * width + c + 4, xy_high);
+    }
+    for (; c < width; c++) {
+        uint32_t s = 0, yy = 0, xy = 0;
+        for (int r = 0; r < ZELL_SSIM_WINDOW; r++) {
+            uint32_t a = x[(size_t)r * stride + c], b = y[(size_t)r * stride + c];
+            s += b;
+            yy += b * b;
+            xy += a * b;
+        }
+        sums[c] = s;
+        sums[width + c] = yy;
+        sums[2 * width + c] = xy;
+    }
+}
+#endif // ZELL_CPU_SIMD128_BUILD
+
+static void zell_ssim_init(void) {
+    zell_ssim_kernel = zell_ssim_columns_scalar;
+    switch (zell_cpu_level()) {
+#if defined(ZELL_CPU_X86)
+        case ZELL_CPU_AVX512:
+        case ZELL_CPU_AVX2: zell_ssim_kernel = zell_ssim_columns_avx2; break;
+        case ZELL_CPU_SSE41: zell_ssim_kernel = zell_ssim_columns_sse41; break;
+#elif defined(ZELL_CPU_NEON_BUILD)
+        case ZELL_CPU_NEON: zell_ssim_kernel = zell_ssim_columns_neon; break;
+#elif defined(ZELL_CPU_SIMD128_BUILD)
+        case ZELL_CPU_SIMD128: zell_ssim_kernel = zell_ssim_columns_simd128; break;
+#endif
+        default: break;
+    }
+}
+
+/**
+ * Luma of one row of interleaved pixels, with the weights JPEG uses for Y
+ * @param luma - Output, width bytes
+ * @param pixels - Gray (1), RGB (3) or RGBA (4) pixels
+ * @param width - Row width
+ * @param channels - Number of channels
+ */
+static inline void zell_ssim_luma_row(unsigned char* luma, const unsigned char* pixels, int width,
+                                      int channels) {
+    if (channels < 3) {
+        for (int x = 0; x < width; x++) luma[x] = pixels[(size_t)x * channels];
+        return;
+    }
+    for (int x = 0; x < width; x++, pixels += channels) {
+        luma[x] = (unsigned char)((19595u * pixels[0] + 38470u * pixels[1] + 7471u * pixels[2] + 32768u) >> 16);
+    }
+}
+
+static int zell_ssim_plane_init(ZellSsimPlane* p, int source_width, int source_height, int scale) {
+    memset(p, 0, sizeof(*p));
+    p->scale = scale;
+    p->width = source_width / p->scale;
+    p->height = source_height / p->scale;
+    p->source_width = source_width;
+    if (p->width < ZELL_SSIM_WINDOW || p->height < ZELL_SSIM_WINDOW) return -1;
+
+    p->columns = (uint16_t*)zell_pool_get(sizeof(uint16_t) * (size_t)source_width);
+    p->plane = (unsigned char*)zell_pool_get((size_t)p->width * p->height);
+    if (!p->columns || !p->plane) return -1;
+    memset(p->columns, 0, sizeof(uint16_t) * (size_t)source_width);
+    return 0;
+}
+
+static void zell_ssim_plane_free(ZellSsimPlane* p) {
+    zell_pool_put(p->columns);
+    zell_pool_put(p->plane);
+    p->columns = NULL;
+    p->plane = NULL;
+}
+
+// Add a source row; returns 1 when it completed a plane row.  The scale is
+// at most a few hundred, so a column of it still fits in 16 bits.
+static int zell_ssim_plane_row(ZellSsimPlane* p, const unsigned char* luma) {
+    if (p->rows >= p->height) return 0;
+    uint16_t* columns = p->columns;
+    for (int x = 0; x < p->source_width; x++) columns[x] += luma[x];
+    if (++p->pending < p->scale) return 0;
+
+    int scale = p->scale;
+    uint32_t area = (uint32_t)scale * scale;
+    unsigned char* out = p->plane + (size_t)p->rows * p->width;
+    for (int x = 0; x < p->width; x++) {
+        uint32_t sum = 0;
+        for (int i = 0; i < scale; i++) sum += columns[x * scale + i];
+        out[x] = (unsigned char)((sum + area / 2) / area);
+    }
+    memset(columns, 0, sizeof(uint16_t) * (size_t)p->source_width);
+    p->pending = 0;
+    p->rows++;
+    return 1;
+}
+
+// Turn the column sums of a band into sums of 4 columns, in place, for each
+// of the three quantities; window j is then groups j and j + 1
+static inline void zell_ssim_groups(uint32_t* sums, int columns) {
+    int groups = columns / ZELL_SSIM_STEP;
+    for (int k = 0; k < 3; k++) {
+        uint32_t* s = sums + (size_t)k * columns;
+        for (int g = 0; g < groups; g++) {
+            const uint32_t* c = s + g * ZELL_SSIM_STEP;
+            s[g] = c[0] + c[1] + c[2] + c[3];
+        }
+    }
+}
+
+static void zell_ssim_reference_free(ZellSsimRef* ref) {
+    zell_ssim_plane_free(&ref->luma);
+    zell_pool_put(ref->sums);
+    zell_pool_put(ref->window_sum);
+    zell_pool_put(ref->window_var);
+    ref->sums = NULL;
+    ref->window_sum = NULL;
+    ref->window_var = NULL;
+}
+
+/**
+ * Build the reference for comparing candidates against a source image
+ * @param ref - Reference to fill (free with zell_ssim_reference_free)
+ * @param pixels - Gray (1), RGB (3) or RGBA (4) pixels
+ * @param width - Image width
+ * @param height - Image height
+ * @param channels - Number of channels
+ * @return -1 on error or if the image is too small to compare, 0 on success
+ */
+static int zell_ssim_reference(ZellSsimRef* ref, const unsigned char* pixels, int width, int height,
+                               int channels) {
+    ZELL_ONCE(zell_ssim_once, zell_ssim_init);
+    memset(ref, 0, sizeof(*ref));
+    int side = width < height ? width : height;
+    int scale = (side + ZELL_SSIM_SIDE / 2) / ZELL_SSIM_SIDE;
+    if (zell_ssim_plane_init(&ref->luma, width, height, scale < 1 ? 1 : scale) < 0) {
+        zell_ssim_plane_free(&ref->luma);
+        return -1;
+    }
+
+    ZellSsimPlane* p = &ref->luma;
+    ref->windows_x = (p->width - ZELL_SSIM_WINDOW) / ZELL_SSIM_STEP + 1;
+    ref->windows_y = (p->height - ZELL_SSIM_WINDOW) / ZELL_SSIM_STEP + 1;
+    size_t windows = (size_t)ref->windows_x * ref->windows_y;
+    unsigned char* row = (unsigned char*)zell_pool_get((size_t)width);
+    ref->sums = (uint32_t*)zell_pool_get(sizeof(uint32_t) * 3 * (size_t)p->width);
+    ref->window_sum = (uint16_t*)zell_pool_get(sizeof(uint16_t) * windows);
+    ref->window_var = (float*)zell_pool_get(sizeof(float) * windows);
+    if (!row || !ref->sums || !ref->window_sum || !ref->window_var) {
+        zell_pool_put(row);
+        zell_ssim_reference_free(ref);
+        return -1;
+    }
+
+    for (int y = 0; y < height && p->rows < p->height; y++) {
+        zell_ssim_luma_row(row, pixels + (size_t)y * width * channels, width, channels);
+        zell_ssim_plane_row(p, row);
+    }
+    zell_pool_put(row);
+
+    // The reference against itself: its sums of x and x^2 per window
+    int columns = (ref->windows_x + 1) * ZELL_SSIM_STEP;
+    for (int band = 0; band < ref->windows_y; band++) {
+        const unsigned char* top = p->plane + (size_t)band * ZELL_SSIM_STEP * p->width;
+        zell_ssim_kernel(top, top, (size_t)p->width, columns, ref->sums);
+        zell_ssim_groups(ref->sums, columns);
+        const uint32_t* sum = ref->sums;
+        const uint32_t* square = ref->sums + columns;
+        for (int j = 0; j < ref->windows_x; j++) {
+            uint32_t s = sum[j] + sum[j + 1], q = square[j] + square[j + 1];
+            size_t w = (size_t)band * ref->windows_x + j;
+            ref->window_sum[w] = (uint16_t)s;
+            ref->window_var[w] = (float)((int64_t)64 * q - (int64_t)s * s);
+        }
+    }
+    return 0;
+}
+
+/**
+ * Start comparing a candidate against a reference
+ * @param run - Comparison to start (finish with zell_ssim_end)
+ * @param ref - Reference of the source
+ * @param target - SSIM the candidate has to reach
+ * @return -1 on error, 0 on success
+ */
+static int zell_ssim_begin(ZellSsimRun* run, const ZellSsimRef* ref, double target) {
+    memset(run, 0, sizeof(*run));
+    run->ref = ref;
+    run->target = target;
+    run->sums = (uint32_t*)zell_pool_get(sizeof(uint32_t) * 3 * (size_t)ref->luma.width);
+    if (zell_ssim_plane_init(&run->luma, ref->luma.source_width, ref->luma.height * ref->luma.scale,
+                             ref->luma.scale) < 0 || !run->sums) {
+        zell_ssim_plane_free(&run->luma);
+        zell_pool_put(run->sums);
+        run->sums = NULL;
+        return -1;
+    }
+    return 0;
+}
+
+// SSIM of the windows of one band, from 64x the means and 64^2 x the
+// (co)variances, which keeps the sums exact integers until here
+static double zell_ssim_band(const ZellSsimRun* run, int band) {
+    const ZellSsimRef* ref = run->ref;
+    const int width = ref->luma.width;
+    const int columns = (ref->windows_x + 1) * ZELL_SSIM_STEP;
+    const size_t top = (size_t)band * ZELL_SSIM_STEP * width;
+    zell_ssim_kernel(ref->luma.plane + top, run->luma.plane + top, (size_t)width, columns, run->sums);
+    zell_ssim_groups(run->sums, columns);
+
+    // C1 = (0.01 * 255)^2 and C2 = (0.03 * 255)^2, scaled like the sums
+    const double c1 = 6.5025 * 4096.0, c2 = 58.5225 * 4096.0;
+    const uint32_t* sum = run->sums;
+    const uint32_t* square = run->sums + columns;
+    const uint32_t* product = run->sums + 2 * columns;
+    const uint16_t* ref_sum = ref->window_sum + (size_t)band * ref->windows_x;
+    const float* ref_var = ref->window_var + (size_t)band * ref->windows_x;
+    double total = 0.0;
+    for (int j = 0; j < ref->windows_x; j++) {
+        int64_t sx = ref_sum[j];
+        int64_t sy = sum[j] + sum[j + 1];
+        int64_t vy = (int64_t)64 * (square[j] + square[j + 1]) - sy * sy;
+        int64_t cov = (int64_t)64 * (product[j] + product[j + 1]) - sx * sy;
+        double numerator = (2.0 * (double)(sx * sy) + c1) * (2.0 * (double)cov + c2);
+        double denominator = ((double)(sx * sx + sy * sy) + c1) * ((double)ref_var[j] + (double)vy + c2);
+        total += numerator / denominator;
+    }
+    return total;
+}
+
+/**
+ * Feed the next row of the candidate's luma
+ * @param run - Comparison in progress
+ * @param luma - Row of the candidate, full size
+ * @return 1 once the target can no longer be reached, 0 otherwise
+ */
+static int zell_ssim_row(ZellSsimRun* run, const unsigned char* luma) {
+    const ZellSsimRef* ref = run->ref;
+    if (!zell_ssim_plane_row(&run->luma, luma)) return 0;
+    while (run->bands < ref->windows_y &&
+           run->luma.rows >= run->bands * ZELL_SSIM_STEP + ZELL_SSIM_WINDOW) {
+        run->total += zell_ssim_band(run, run->bands);
+        run->bands++;
+    }
+    // Each window scores at most 1, so the windows still to come can add at
+    // most one each
+    double windows = (double)ref->windows_x * ref->windows_y;
+    double remaining = (double)ref->windows_x * (ref->windows_y - run->bands);
+    return run->total + remaining < run->target * windows;
+}
+
+/**
+ * Finish a comparison
+ * @param run - Comparison to finish
+ * @return Mean SSIM of the candidate; after an early stop, the mean over
+ *         the windows seen, which is only an estimate
+ */
+static double zell_ssim_end(ZellSsimRun* run) {
+    zell_ssim_plane_free(&run->luma);
+    zell_pool_put(run->sums);
+    run->sums = NULL;
+    if (!run->bands) return 0.0;
+    return run->total / ((double)run->ref->windows_x * run->bands);
+}
+
+#endif // ZELL_SSIM_H
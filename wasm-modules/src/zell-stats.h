@@ -0,0 +1,432 @@
+#ifndef ZELL_STATS_H
+#define ZELL_STATS_H
+
+// Optional instrumentation, compiled in with -DZELL_STATS (`npm run
+// build:stats` for the WASM modules).  Without the flag every ZELL_STATS_*
+// macro compiles to nothing and the modules carry no extra code.
+//
+// With it, each module counts per entry point the calls, errors, wall time
+// and bytes in and out, accumulates time per stage (parse, decode,
+// transform, encode, write), tracks the high-water mark of pool and arena
+// memory handed out to jobs, and compares worker busy time against the
+// threads made available to parallel sections.  Every call and stage span
+// is also recorded as a Chrome trace event (chrome://tracing, Perfetto).
+// Stage times include nested spans: a decode inside a transform counts
+// towards both.
+//
+//   zell_get_stats(out, size)  - counters as JSON
+//   zell_get_trace(out, size)  - trace events as Chrome trace JSON
+//   zell_reset_stats()         - clear counters and events
+//
+// Like other buffer entry points, a NULL buffer with size 0 returns the
+// size the JSON needs.  The state is a weak symbol, so modules linked into
+// one native binary share one set of counters and one trace.  Spans end
+// when they go out of scope (GCC/Clang cleanup attribute).
+
+#include "zell-common.h"
+#include <stdint.h>
+
+#define ZELL_STAGE_PARSE     0
+#define ZELL_STAGE_DECODE    1
+#define ZELL_STAGE_TRANSFORM 2
+#define ZELL_STAGE_ENCODE    3
+#define ZELL_STAGE_WRITE     4
+#define ZELL_STAGE_COUNT     5
+
+#ifdef ZELL_STATS
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#define ZELL_STATS_MAX_CALLS 64   // distinct entry points tracked
+
+// Events kept per trace; later ones are counted as dropped
+#ifndef ZELL_STATS_TRACE_EVENTS
+#define ZELL_STATS_TRACE_EVENTS 65536
+#endif
+
+#define ZELL_STATS_SHARED __attribute__((weak))
+
+typedef struct {
+    const char* name;     // entry point name (a string literal)
+    int64_t calls;
+    int64_t errors;
+    int64_t ns;
+    int64_t bytes_in;
+    int64_t bytes_out;
+} ZellStatsEntry;
+
+typedef struct {
+    const char* name;     // entry point or span name (a string literal)
+    int stage;            // ZELL_STAGE_*, or -1 for an entry point call
+    int thread;
+    int64_t start_ns;
+    int64_t duration_ns;
+} ZellTraceEvent;
+
+typedef struct {
+#ifdef ZELL_HAVE_THREADS
+    pthread_mutex_t lock;  // guards the entry point table
+#endif
+    ZellStatsEntry entries[ZELL_STATS_MAX_CALLS];
+    int entry_count;
+    int64_t stage_ns[ZELL_STAGE_COUNT];
+    int64_t stage_count[ZELL_STAGE_COUNT];
+    int64_t live_bytes;        // pool and arena memory held by jobs
+    int64_t high_water_bytes;
+    int64_t busy_ns;           // worker time spent on tasks
+    int64_t capacity_ns;       // threads x wall time of parallel sections
+    int64_t event_count;       // may exceed the capacity; the rest are dropped
+    int next_thread;
+    ZellTraceEvent events[ZELL_STATS_TRACE_EVENTS];
+} ZellStatsState;
+
+#ifdef ZELL_HAVE_THREADS
+ZELL_STATS_SHARED ZellStatsState zell_stats_state = { .lock = PTHREAD_MUTEX_INITIALIZER };
+#else
+ZELL_STATS_SHARED ZellStatsState zell_stats_state;
+#endif
+
+// Small per-thread id for trace events, assigned on first use
+ZELL_STATS_SHARED _Thread_local int zell_stats_thread_id;
+
+static inline int64_t zell_stats_now(void) {
+#ifdef __EMSCRIPTEN__
+    return (int64_t)(emscripten_get_now() * 1e6);
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+#endif
+}
+
+static inline int zell_stats_thread(void) {
+    if (!zell_stats_thread_id) {
+        zell_stats_thread_id = __atomic_add_fetch(&zell_stats_state.next_thread, 1, __ATOMIC_RELAXED);
+    }
+    return zell_stats_thread_id;
+}
+
+static inline void zell_stats_add(int64_t* counter, int64_t value) {
+    __atomic_fetch_add(counter, value, __ATOMIC_RELAXED);
+}
+
+static inline void zell_stats_event(const char* name, int stage, int64_t start_ns, int64_t duration_ns) {
+    int64_t slot = __atomic_fetch_add(&zell_stats_state.event_count, 1, __ATOMIC_RELAXED);
+    if (slot >= ZELL_STATS_TRACE_EVENTS) return;
+    ZellTraceEvent* event = &zell_stats_state.events[slot];
+    event->name = name;
+    event->stage = stage;
+    event->thread = zell_stats_thread();
+    event->start_ns = start_ns;
+    event->duration_ns = duration_ns;
+}
+
+// --- Entry point calls ---------------------------------------------------------
+
+typedef struct {
+    const char* name;
+    int64_t start_ns;
+    int64_t bytes_in;
+    int64_t result;
+} ZellStatsCall;
+
+// The result stays -1 (an error) unless the call records one
+static inline ZellStatsCall zell_stats_call_begin(const char* name, int64_t bytes_in) {
+    ZellStatsCall call = { name, zell_stats_now(), bytes_in > 0 ? bytes_in : 0, -1 };
+    return call;
+}
+
+static inline void zell_stats_call_end(ZellStatsCall* call) {
+    int64_t duration = zell_stats_now() - call->start_ns;
+    zell_stats_event(call->name, -1, call->start_ns, duration);
+
+    ZellStatsState* state = &zell_stats_state;
+#ifdef ZELL_HAVE_THREADS
+    pthread_mutex_lock(&state->lock);
+#endif
+    ZellStatsEntry* entry = NULL;
+    for (int i = 0; i < state->entry_count; i++) {
+        if (state->entries[i].name == call->name || strcmp(state->entries[i].name, call->name) == 0) {
+            entry = &state->entries[i];
+            break;
+        }
+    }
+    if (!entry && state->entry_count < ZELL_STATS_MAX_CALLS) {
+        entry = &state->entries[state->entry_count++];
+        memset(entry, 0, sizeof(*entry));
+        entry->name = call->name;
+    }
+    if (entry) {
+        entry->calls++;
+        entry->ns += duration;
+        entry->bytes_in += call->bytes_in;
+        if (call->result < 0) entry->errors++;
+        else entry->bytes_out += call->result;
+    }
+#ifdef ZELL_HAVE_THREADS
+    pthread_mutex_unlock(&state->lock);
+#endif
+}
+
+// An output size: negative is an error, anything else bytes written
+static inline int64_t zell_stats_result(ZellStatsCall* call, int64_t result) {
+    call->result = result;
+    return result;
+}
+
+// A status or count: negative is an error, no bytes are counted
+static inline int64_t zell_stats_status(ZellStatsCall* call, int64_t status) {
+    call->result = status < 0 ? -1 : 0;
+    return status;
+}
+
+// Total of a caller-supplied size array, for multi-input entry points
+static inline int64_t zell_stats_total(const int64_t* sizes, int count) {
+    int64_t total = 0;
+    for (int i = 0; sizes && i < count; i++) {
+        if (sizes[i] > 0) total += sizes[i];
+    }
+    return total;
+}
+
+// --- Stage spans ---------------------------------------------------------------
+
+typedef struct {
+    const char* name;
+    int stage;
+    int64_t start_ns;
+} ZellStatsSpan;
+
+static inline ZellStatsSpan zell_stats_span_begin(int stage, const char* name) {
+    ZellStatsSpan span = { name, stage, zell_stats_now() };
+    return span;
+}
+
+static inline void zell_stats_span_end(ZellStatsSpan* span) {
+    int64_t duration = zell_stats_now() - span->start_ns;
+    zell_stats_add(&zell_stats_state.stage_ns[span->stage], duration);
+    zell_stats_add(&zell_stats_state.stage_count[span->stage], 1);
+    zell_stats_event(span->name, span->stage, span->start_ns, duration);
+}
+
+// --- Threads -----------------------------------------------------------------
+
+typedef struct {
+    int64_t start_ns;
+    int threads;
+} ZellStatsTimer;
+
+static inline ZellStatsTimer zell_stats_timer_begin(int threads) {
+    ZellStatsTimer timer = { zell_stats_now(), threads };
+    return timer;
+}
+
+static inline void zell_stats_worker_end(ZellStatsTimer* timer) {
+    zell_stats_add(&zell_stats_state.busy_ns, zell_stats_now() - timer->start_ns);
+}
+
+static inline void zell_stats_parallel_end(ZellStatsTimer* timer) {
+    zell_stats_add(&zell_stats_state.capacity_ns, (zell_stats_now() - timer->start_ns) * timer->threads);
+}
+
+// --- Memory ------------------------------------------------------------------
+
+static inline void zell_stats_alloc(int64_t bytes) {
+    int64_t live = __atomic_add_fetch(&zell_stats_state.live_bytes, bytes, __ATOMIC_RELAXED);
+    int64_t high = __atomic_load_n(&zell_stats_state.high_water_bytes, __ATOMIC_RELAXED);
+    while (live > high && !__atomic_compare_exchange_n(&zell_stats_state.high_water_bytes, &high, live, 1,
+                                                       __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+    }
+}
+
+static inline void zell_stats_free(int64_t bytes) {
+    zell_stats_add(&zell_stats_state.live_bytes, -bytes);
+}
+
+// --- JSON export -------------------------------------------------------------
+
+typedef struct {
+    char* data;
+    int64_t capacity;
+    int64_t length;   // full length, even past the capacity
+} ZellStatsJson;
+
+static inline void zell_stats_json(ZellStatsJson* json, const char* format, ...)
+    __attribute__((format(printf, 2, 3)));
+
+static inline void zell_stats_json(ZellStatsJson* json, const char* format, ...) {
+    char text[256];
+    va_list args;
+    va_start(args, format);
+    int n = vsnprintf(text, sizeof(text), format, args);
+    va_end(args);
+    if (n < 0) return;
+    if (n >= (int)sizeof(text)) n = (int)sizeof(text) - 1;
+    if (json->data && json->length + n < json->capacity) {
+        memcpy(json->data + json->length, text, (size_t)n);
+    }
+    json->length += n;
+}
+
+// Terminate the JSON; the buffer needs room for the terminator too
+static inline int64_t zell_stats_json_finish(ZellStatsJson* json) {
+    if (!json->data) return json->length; // measuring only
+    if (json->length >= json->capacity) return -1;
+    json->data[json->length] = '\0';
+    return json->length;
+}
+
+static const char* const zell_stage_names[ZELL_STAGE_COUNT] = {
+    "parse", "decode", "transform", "encode", "write"
+};
+
+/**
+ * Report the counters collected since the last reset as JSON
+ * @param output_data - Output buffer, or NULL to only measure the output
+ * @param output_size - Size of output buffer (0 when measuring)
+ * @return -1 on error, JSON length on success (not counting the terminator)
+ */
+EMSCRIPTEN_KEEPALIVE ZELL_STATS_SHARED
+int64_t zell_get_stats(char* output_data, int64_t output_size) {
+    if (output_data ? output_size <= 0 : output_size != 0) return -1;
+    ZellStatsState* state = &zell_stats_state;
+    ZellStatsJson json = { output_data, output_size, 0 };
+
+    zell_stats_json(&json, "{\"calls\":[");
+#ifdef ZELL_HAVE_THREADS
+    pthread_mutex_lock(&state->lock);
+#endif
+    for (int i = 0; i < state->entry_count; i++) {
+        const ZellStatsEntry* e = &state->entries[i];
+        zell_stats_json(&json, "%s{\"name\":\"%s\",\"calls\":%lld,\"errors\":%lld,\"ms\":%.3f"
+                        ",\"bytes_in\":%lld,\"bytes_out\":%lld}", i ? "," : "", e->name,
+                        (long long)e->calls, (long long)e->errors, e->ns / 1e6,
+                        (long long)e->bytes_in, (long long)e->bytes_out);
+    }
+#ifdef ZELL_HAVE_THREADS
+    pthread_mutex_unlock(&state->lock);
+#endif
+
+    zell_stats_json(&json, "],\"stages\":{");
+    for (int s = 0; s < ZELL_STAGE_COUNT; s++) {
+        zell_stats_json(&json, "%s\"%s\":{\"count\":%lld,\"ms\":%.3f}", s ? "," : "", zell_stage_names[s],
+                        (long long)__atomic_load_n(&state->stage_count[s], __ATOMIC_RELAXED),
+                        __atomic_load_n(&state->stage_ns[s], __ATOMIC_RELAXED) / 1e6);
+    }
+
+    int64_t busy = __atomic_load_n(&state->busy_ns, __ATOMIC_RELAXED);
+    int64_t capacity = __atomic_load_n(&state->capacity_ns, __ATOMIC_RELAXED);
+    int64_t events = __atomic_load_n(&state->event_count, __ATOMIC_RELAXED);
+    zell_stats_json(&json, "},\"memory\":{\"live_bytes\":%lld,\"high_water_bytes\":%lld}",
+                    (long long)__atomic_load_n(&state->live_bytes, __ATOMIC_RELAXED),
+                    (long long)__atomic_load_n(&state->high_water_bytes, __ATOMIC_RELAXED));
+    zell_stats_json(&json, ",\"threads\":{\"busy_ms\":%.3f,\"capacity_ms\":%.3f,\"utilization\":%.4f}",
+                    busy / 1e6, capacity / 1e6, capacity > 0 ? (double)busy / capacity : 0.0);
+    zell_stats_json(&json, ",\"trace\":{\"events\":%lld,\"dropped\":%lld}}",
+                    (long long)(events < ZELL_STATS_TRACE_EVENTS ? events : ZELL_STATS_TRACE_EVENTS),
+                    (long long)(events > ZELL_STATS_TRACE_EVENTS ? events - ZELL_STATS_TRACE_EVENTS : 0));
+    return zell_stats_json_finish(&json);
+}
+
+/**
+ * Report the recorded calls and stage spans in Chrome trace event format
+ * @param output_data - Output buffer, or NULL to only measure the output
+ * @param output_size - Size of output buffer (0 when measuring)
+ * @return -1 on error, JSON length on success (not counting the terminator)
+ */
+EMSCRIPTEN_KEEPALIVE ZELL_STATS_SHARED
+int64_t zell_get_trace(char* output_data, int64_t output_size) {
+    if (output_data ? output_size <= 0 : output_size != 0) return -1;
+    ZellStatsState* state = &zell_stats_state;
+    ZellStatsJson json = { output_data, output_size, 0 };
+
+    int64_t count = __atomic_load_n(&state->event_count, __ATOMIC_RELAXED);
+    if (count > ZELL_STATS_TRACE_EVENTS) count = ZELL_STATS_TRACE_EVENTS;
+    int64_t origin = 0;
+    for (int64_t i = 0; i < count; i++) {
+        if (i == 0 || state->events[i].start_ns < origin) origin = state->events[i].start_ns;
+    }
+
+    zell_stats_json(&json, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+    for (int64_t i = 0; i < count; i++) {
+        const ZellTraceEvent* e = &state->events[i];
+        zell_stats_json(&json, "%s{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f"
+                        ",\"pid\":1,\"tid\":%d}", i ? "," : "", e->name,
+                        e->stage < 0 ? "call" : zell_stage_names[e->stage],
+                        (e->start_ns - origin) / 1e3, e->duration_ns / 1e3, e->thread);
+    }
+    zell_stats_json(&json, "]}");
+    return zell_stats_json_finish(&json);
+}
+
+// Clear every counter and recorded event; call between jobs, not during one
+EMSCRIPTEN_KEEPALIVE ZELL_STATS_SHARED
+void zell_reset_stats(void) {
+    ZellStatsState* state = &zell_stats_state;
+#ifdef ZELL_HAVE_THREADS
+    pthread_mutex_lock(&state->lock);
+#endif
+    state->entry_count = 0;
+    for (int s = 0; s < ZELL_STAGE_COUNT; s++) {
+        __atomic_store_n(&state->stage_ns[s], 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&state->stage_count[s], 0, __ATOMIC_RELAXED);
+    }
+    // Memory still held by the caller's buffers stays live
+    __atomic_store_n(&state->high_water_bytes, __atomic_load_n(&state->live_bytes, __ATOMIC_RELAXED),
+                     __ATOMIC_RELAXED);
+    __atomic_store_n(&state->busy_ns, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&state->capacity_ns, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&state->event_count, 0, __ATOMIC_RELAXED);
+#ifdef ZELL_HAVE_THREADS
+    pthread_mutex_unlock(&state->lock);
+#endif
+}
+
+#define ZELL_STATS_CONCAT_(a, b) a##b
+#define ZELL_STATS_CONCAT(a, b) ZELL_STATS_CONCAT_(a, b)
+
+// Count the enclosing entry point.  ZELL_STATS_RESULT/STATUS wrap a value
+// it returns, ZELL_STATS_INPUT/OUTPUT set its byte counts directly
+#define ZELL_STATS_CALL(name, bytes_in) \
+    ZellStatsCall zell_stats_call __attribute__((cleanup(zell_stats_call_end))) = \
+        zell_stats_call_begin((name), (int64_t)(bytes_in))
+#define ZELL_STATS_RESULT(value) zell_stats_result(&zell_stats_call, (int64_t)(value))
+#define ZELL_STATS_STATUS(value) ((int)zell_stats_status(&zell_stats_call, (int64_t)(value)))
+#define ZELL_STATS_INPUT(bytes) (zell_stats_call.bytes_in = (int64_t)(bytes))
+#define ZELL_STATS_OUTPUT(bytes) ((void)zell_stats_result(&zell_stats_call, (int64_t)(bytes)))
+
+// Time the rest of the enclosing scope as one stage span
+#define ZELL_STATS_STAGE(stage, name) \
+    ZellStatsSpan ZELL_STATS_CONCAT(zell_stats_span_, __LINE__) \
+        __attribute__((cleanup(zell_stats_span_end))) = zell_stats_span_begin((stage), (name))
+
+// Worker busy time, and the thread capacity of a parallel section
+#define ZELL_STATS_WORKER() \
+    ZellStatsTimer ZELL_STATS_CONCAT(zell_stats_worker_, __LINE__) \
+        __attribute__((cleanup(zell_stats_worker_end))) = zell_stats_timer_begin(1)
+#define ZELL_STATS_PARALLEL(threads) \
+    ZellStatsTimer ZELL_STATS_CONCAT(zell_stats_parallel_, __LINE__) \
+        __attribute__((cleanup(zell_stats_parallel_end))) = zell_stats_timer_begin(threads)
+
+#define ZELL_STATS_ALLOC(bytes) zell_stats_alloc((int64_t)(bytes))
+#define ZELL_STATS_FREE(bytes) zell_stats_free((int64_t)(bytes))
+
+#else
+
+#define ZELL_STATS_CALL(name, bytes_in) ((void)0)
+#define ZELL_STATS_RESULT(value) (value)
+#define ZELL_STATS_STATUS(value) (value)
+#define ZELL_STATS_INPUT(bytes) ((void)0)
+#define ZELL_STATS_OUTPUT(bytes) ((void)0)
+#define ZELL_STATS_STAGE(stage, name) ((void)0)
+#define ZELL_STATS_WORKER() ((void)0)
+#define ZELL_STATS_PARALLEL(threads) ((void)0)
+#define ZELL_STATS_ALLOC(bytes) ((void)0)
+#define ZELL_STATS_FREE(bytes) ((void)0)
+
+#endif // ZELL_STATS
+
+#endif // ZELL_STATS_H